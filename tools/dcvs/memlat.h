@@ -0,0 +1,662 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Offline model of the memory DCVS voters described in the DT.
+ *
+ * Voters are the qcom,arm-memlat-mon / qcom,arm-compute-mon children of
+ * the memlat cpugrp, the qcom,rimps-memlat-mon-l3 monitors and the
+ * qcom,bimc-bwmon4/5 hardware monitors.  Each votes into the devfreq node
+ * named by its qcom,target-dev; devfreq nodes round the vote up to their
+ * operating-points-v2 table and all devfreq nodes behind the same
+ * interconnect endpoint aggregate by max into one bus frequency.
+ *
+ * The governors follow the kernel in spirit, not in every tunable:
+ *  - memlat: a CPU counts when its stall% >= stall_floor and its
+ *    instructions per cache miss are <= ipm_ceil; the fastest counting
+ *    CPU is mapped through qcom,core-dev-table.
+ *  - compute: the fastest CPU is mapped through qcom,core-dev-table.
+ *  - bw_hwmon: the measured MBps, scaled by 100 / io_percent.
+ *
+ * Traces are fed one per-CPU sample at a time.  A tick ends when the
+ * timestamp changes; votes are re-evaluated then and hold until the next
+ * tick.  CPU state persists across ticks until the CPU is sampled again,
+ * so a trace only needs rows for CPUs whose counters moved.
+ */
+
+#ifndef __TOOLS_DCVS_MEMLAT_H__
+#define __TOOLS_DCVS_MEMLAT_H__
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../dt/cpus.h"
+#include "../lib/csv.h"
+
+namespace dcvs {
+
+#define MEMLAT_MAX_EVENTS	8
+
+enum mon_kind {
+	MON_MEMLAT,
+	MON_COMPUTE,
+	MON_RIMPS_L3,
+	MON_BWMON,
+};
+
+enum dev_unit {
+	UNIT_MBPS,
+	UNIT_HZ,
+	UNIT_LEVEL,
+};
+
+struct memlat_opts {
+	uint32_t ddr_type = 7;		/* picks ddrN-map and opp-supported-hw */
+	uint32_t ipm_ceil = 400;
+	uint32_t stall_floor = 0;
+	uint32_t io_percent = 16;
+};
+
+struct core_dev {
+	uint32_t core_khz;
+	uint64_t val;
+};
+
+struct voter {
+	std::string name;
+	uint32_t node;
+	mon_kind kind;
+	uint64_t cpus;
+	uint32_t ev;
+	int ev_slot;			/* MEMLAT_MAX_EVENTS: none */
+	int col;			/* bwmon: trace column, -1 if unbound */
+	std::vector<core_dev> table;
+	int dev;
+	uint64_t vote;
+	int level;
+	std::vector<uint64_t> res;	/* microseconds per device level */
+};
+
+struct device {
+	std::string name;
+	uint32_t node;
+	const char *governor;
+	dev_unit unit;
+	uint32_t bus_width;		/* MBps -> Hz for bw_hwmon on l3 */
+	bool has_opps;
+	std::vector<uint64_t> levels;
+	int bus;
+	int level;
+	uint64_t transitions;
+	std::vector<uint64_t> res;
+};
+
+struct bus {
+	std::string name;
+	uint64_t key;
+	dev_unit unit;
+	std::vector<int> devs;
+	std::vector<uint64_t> levels;
+	int level;
+	uint64_t transitions;
+	std::vector<uint64_t> res;
+};
+
+class memlat_sim {
+public:
+	int load(const dt::tree &t, const dt::cpu_topology &cpus, const memlat_opts &o)
+	{
+		t_ = &t;
+		cpus_ = &cpus;
+		opts_ = o;
+		voters_.clear();
+		devs_.clear();
+		buses_.clear();
+		bwmons_.clear();
+		nev_ = 0;
+
+		for (uint32_t id = 0; id < t.size(); id++) {
+			int ret = 0;
+
+			if (t.is_compatible(id, "qcom,arm-memlat-mon"))
+				ret = add_mon(id, MON_MEMLAT);
+			else if (t.is_compatible(id, "qcom,arm-compute-mon"))
+				ret = add_mon(id, MON_COMPUTE);
+			else if (t.is_compatible(id, "qcom,rimps-memlat-mon-l3"))
+				ret = add_mon(id, MON_RIMPS_L3);
+			else if (t.is_compatible(id, "qcom,bimc-bwmon4") ||
+				 t.is_compatible(id, "qcom,bimc-bwmon5"))
+				ret = add_mon(id, MON_BWMON);
+			if (ret)
+				return ret;
+		}
+		if (voters_.empty())
+			return -ENOENT;
+		for (size_t i = 0; i < voters_.size(); i++)
+			if (voters_[i].kind == MON_BWMON)
+				bwmons_.push_back((int)i);
+		build_levels();
+		reset();
+		return 0;
+	}
+
+	/*
+	 * Map trace columns.  Required: time_us, cpu, freq_khz and either
+	 * inst or ipc + cyc; ev<N> for every qcom,cachemiss-ev in use.
+	 * Optional: stall (percent) and bw:<bwmon> (measured MBps).
+	 * Returns -EINVAL and names the first missing column in @missing.
+	 */
+	int bind(const csv::row &hdr, std::string *missing)
+	{
+		char name[16];
+
+		c_time_ = hdr.find("time_us");
+		c_cpu_ = hdr.find("cpu");
+		c_freq_ = hdr.find("freq_khz");
+		c_inst_ = hdr.find("inst");
+		c_ipc_ = hdr.find("ipc");
+		c_cyc_ = hdr.find("cyc");
+		c_stall_ = hdr.find("stall");
+		missing->clear();
+		if (c_time_ < 0)
+			*missing = "time_us";
+		else if (c_cpu_ < 0)
+			*missing = "cpu";
+		else if (c_freq_ < 0)
+			*missing = "freq_khz";
+		else if (c_inst_ < 0 && (c_ipc_ < 0 || c_cyc_ < 0))
+			*missing = "inst";
+		for (int e = 0; e < nev_ && missing->empty(); e++) {
+			snprintf(name, sizeof(name), "ev%u", ev_num_[e]);
+			c_ev_[e] = hdr.find(name);
+			if (c_ev_[e] < 0)
+				*missing = name;
+		}
+		for (voter &v : voters_) {
+			if (v.kind != MON_BWMON)
+				continue;
+			v.col = hdr.find("bw:" + v.name);
+			if (v.col < 0)
+				v.col = hdr.find("bw:" + std::string(t_->name(v.node)));
+		}
+		return missing->empty() ? 0 : -EINVAL;
+	}
+
+	void reset()
+	{
+		memset(cpu_, 0, sizeof(cpu_));
+		for (voter &v : voters_) {
+			v.vote = 0;
+			v.level = 0;
+			v.res.assign(devs_[v.dev].levels.size(), 0);
+		}
+		for (device &d : devs_) {
+			d.level = 0;
+			d.transitions = 0;
+			d.res.assign(d.levels.size(), 0);
+		}
+		for (bus &b : buses_) {
+			b.level = 0;
+			b.transitions = 0;
+			b.res.assign(b.levels.size(), 0);
+		}
+		bw_.assign(voters_.size(), 0);
+		dev_vote_.assign(devs_.size(), 0);
+		bus_max_.assign(buses_.size(), 0);
+		now_ = last_dt_ = samples_ = ticks_ = 0;
+		started_ = false;
+	}
+
+	/*
+	 * Feed one trace row.  @changed, if set, is called with (time_us,
+	 * bus index) whenever a bus frequency moves.
+	 */
+	template <typename F>
+	void sample(const csv::row &r, F changed)
+	{
+		uint64_t t = r.u64(c_time_);
+		uint32_t cpu = (uint32_t)r.u64(c_cpu_);
+
+		if (started_ && t != now_) {
+			tick(changed);
+			last_dt_ = t > now_ ? t - now_ : 0;
+			charge(last_dt_);
+		}
+		now_ = t;
+		started_ = true;
+		samples_++;
+
+		for (int i : bwmons_)
+			if (voters_[i].col >= 0 && voters_[i].col < r.n)
+				bw_[i] = r.u64(voters_[i].col);
+
+		if (cpu >= (uint32_t)cpus_->count())
+			return;
+		cpu_state &s = cpu_[cpu];
+
+		s.khz = (uint32_t)r.u64(c_freq_);
+		if (c_inst_ >= 0)
+			s.inst = r.u64(c_inst_);
+		else
+			s.inst = (uint64_t)(r.dbl(c_ipc_) * r.u64(c_cyc_));
+		s.stall = c_stall_ >= 0 ? (uint32_t)r.u64(c_stall_) : 100;
+		for (int e = 0; e < nev_; e++)
+			s.miss[e] = r.u64(c_ev_[e]);
+	}
+
+	/* Close the last tick, charging it the length of the one before */
+	template <typename F>
+	void finish(F changed)
+	{
+		if (!started_)
+			return;
+		tick(changed);
+		charge(last_dt_);
+		started_ = false;
+	}
+
+	const std::vector<voter> &voters() const { return voters_; }
+	const std::vector<device> &devices() const { return devs_; }
+	const std::vector<bus> &buses() const { return buses_; }
+	uint64_t samples() const { return samples_; }
+	uint64_t ticks() const { return ticks_; }
+
+	/* The qcom,cachemiss-ev numbers a trace has to provide */
+	std::vector<uint32_t> events() const
+	{
+		return std::vector<uint32_t>(ev_num_, ev_num_ + nev_);
+	}
+
+	/* First level >= @vote, the top level when the vote is above all */
+	static int ceil_level(const std::vector<uint64_t> &lv, uint64_t vote)
+	{
+		auto it = std::lower_bound(lv.begin(), lv.end(), vote);
+
+		if (lv.empty())
+			return 0;
+		return it == lv.end() ? (int)lv.size() - 1 : (int)(it - lv.begin());
+	}
+
+	/* As the kernel's core_to_dev_freq(): first row at or above @khz */
+	static uint64_t core_to_dev(const std::vector<core_dev> &tbl, uint32_t khz)
+	{
+		if (!khz || tbl.empty())
+			return 0;
+		for (const core_dev &c : tbl)
+			if (c.core_khz >= khz)
+				return c.val;
+		return tbl.back().val;
+	}
+
+private:
+	struct cpu_state {
+		uint32_t khz;
+		uint32_t stall;
+		uint64_t inst;
+		uint64_t miss[MEMLAT_MAX_EVENTS];
+	};
+
+	static std::string short_name(const char *n)
+	{
+		return strncmp(n, "qcom,", 5) ? n : n + 5;
+	}
+
+	static dev_unit unit_of(const dt::tree &t, uint32_t id)
+	{
+		property_compat pc(t, id);
+
+		if (pc.contains("qoslat"))
+			return UNIT_LEVEL;
+		if (pc.contains("-l3"))
+			return UNIT_HZ;
+		return UNIT_MBPS;
+	}
+
+	/* Substring match over every compatible entry of a node */
+	struct property_compat {
+		dt::property p;
+		bool ok;
+
+		property_compat(const dt::tree &t, uint32_t id)
+		{
+			ok = t.find_prop(id, "compatible", &p);
+		}
+
+		bool contains(const char *s) const
+		{
+			if (!ok)
+				return false;
+			for (const char *c : p.strings())
+				if (strstr(c, s))
+					return true;
+			return false;
+		}
+	};
+
+	int event_slot(uint32_t ev)
+	{
+		for (int i = 0; i < nev_; i++)
+			if (ev_num_[i] == ev)
+				return i;
+		if (nev_ == MEMLAT_MAX_EVENTS)
+			return -E2BIG;
+		ev_num_[nev_] = ev;
+		return nev_++;
+	}
+
+	/* qcom,core-dev-table, from the ddrN-map child matching ddr_type */
+	bool read_table(uint32_t id, std::vector<core_dev> *out)
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		uint32_t node = id;
+
+		for (uint32_t c = t.first_child(id); c != DT_NONE; c = t.next_sibling(c)) {
+			if (t.prop_u32(c, "qcom,ddr-type", ~0u) == opts_.ddr_type) {
+				node = c;
+				break;
+			}
+		}
+		out->clear();
+		if (!t.find_prop(node, "qcom,core-dev-table", &p) || !p.cells())
+			return false;
+		for (uint32_t i = 0; i + 1 < p.cells(); i += 2)
+			out->push_back({ p.u32(i), p.u32(i + 1) });
+		return true;
+	}
+
+	int add_mon(uint32_t id, mon_kind kind)
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		uint32_t target = DT_NONE;
+		voter v;
+		int ret;
+
+		v.name = short_name(t.name(id));
+		v.node = id;
+		v.kind = kind;
+		v.cpus = 0;
+		v.ev = 0;
+		v.ev_slot = MEMLAT_MAX_EVENTS;
+		v.col = -1;
+		v.vote = 0;
+		v.level = 0;
+
+		if (kind != MON_BWMON) {
+			if (!t.find_prop(id, "qcom,cpulist", &p) ||
+			    !(v.cpus = cpus_->mask(t, p)))
+				return 0;
+			if (!read_table(id, &v.table))
+				return 0;
+		}
+		if (kind == MON_MEMLAT || kind == MON_RIMPS_L3) {
+			v.ev = t.prop_u32(id, "qcom,cachemiss-ev", ~0u);
+			if (v.ev == ~0u)
+				return 0;
+			ret = event_slot(v.ev);
+			if (ret < 0)
+				return ret;
+			v.ev_slot = ret;
+		}
+
+		if (t.find_prop(id, "qcom,target-dev", &p) && p.len == 4)
+			target = t.by_phandle(p.u32());
+		if (target == DT_NONE && kind == MON_RIMPS_L3) {
+			/* RIMPS votes the L3 itself; borrow the bus of the
+			 * devfreq node sharing its frequency table base. */
+			v.dev = add_device(id);
+		} else if (target == DT_NONE) {
+			return 0;
+		} else {
+			v.dev = add_device(target);
+		}
+		voters_.push_back(std::move(v));
+		return 0;
+	}
+
+	int add_device(uint32_t id)
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		device d;
+
+		for (size_t i = 0; i < devs_.size(); i++)
+			if (devs_[i].node == id)
+				return (int)i;
+
+		d.name = short_name(t.name(id));
+		d.node = id;
+		d.governor = "rimps";
+		if (t.find_prop(id, "governor", &p) && p.is_string())
+			d.governor = p.str();
+		d.unit = unit_of(t, id);
+		d.bus_width = t.prop_u32(id, "qcom,bus-width", 0);
+		d.has_opps = false;
+		d.level = 0;
+		d.transitions = 0;
+
+		if (t.find_prop(id, "operating-points-v2", &p) && p.len == 4) {
+			uint32_t tbl = t.by_phandle(p.u32());
+
+			for (uint32_t c = tbl == DT_NONE ? DT_NONE : t.first_child(tbl);
+			     c != DT_NONE; c = t.next_sibling(c)) {
+				dt::property hz, hw;
+
+				if (!t.find_prop(c, "opp-hz", &hz) || !hz.cells())
+					continue;
+				if (t.find_prop(c, "opp-supported-hw", &hw) && hw.len == 4 &&
+				    opts_.ddr_type < 32 && !(hw.u32() & (1u << opts_.ddr_type)))
+					continue;
+				d.levels.push_back(hz.cell_val(0, hz.cells() >= 2 ? 2 : 1));
+			}
+			std::sort(d.levels.begin(), d.levels.end());
+			d.levels.erase(std::unique(d.levels.begin(), d.levels.end()),
+				       d.levels.end());
+			d.has_opps = !d.levels.empty();
+		}
+
+		d.bus = add_bus(bus_key(id), id);
+		buses_[d.bus].devs.push_back((int)devs_.size());
+		devs_.push_back(std::move(d));
+		return (int)devs_.size() - 1;
+	}
+
+	/* First "reg" address: how ftbl-base sharing is detected */
+	uint64_t reg_base(uint32_t id) const
+	{
+		uint32_t ac, sc;
+		dt::property p;
+
+		t_->reg_cells(id, &ac, &sc);
+		if (!t_->find_prop(id, "reg", &p) || p.cells() < ac)
+			return ~0ull;
+		return p.cell_val(0, ac);
+	}
+
+	/*
+	 * Devfreq nodes behind the same interconnect destination (or mailbox)
+	 * share a bus.  Nodes with neither fall back to the node sharing their
+	 * register base, then to a bus of their own.
+	 */
+	uint64_t bus_key(uint32_t id) const
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		uint64_t base;
+
+		if (t.find_prop(id, "interconnects", &p) && p.cells() >= 4)
+			return (uint64_t)p.u32(2) << 32 | p.u32(3);
+		if (t.find_prop(id, "mboxes", &p) && p.cells() >= 1)
+			return (uint64_t)p.u32(0) << 32 | 0xffffffffu;
+		base = reg_base(id);
+		if (base != ~0ull) {
+			for (uint32_t n = 0; n < t.size(); n++) {
+				if (n == id || reg_base(n) != base ||
+				    !t.find_prop(n, "interconnects", &p) || p.cells() < 4)
+					continue;
+				return (uint64_t)p.u32(2) << 32 | p.u32(3);
+			}
+		}
+		return 1ull << 63 | id;
+	}
+
+	int add_bus(uint64_t key, uint32_t id)
+	{
+		const dt::tree &t = *t_;
+		uint32_t prov;
+		char suffix[16];
+		bus b;
+
+		for (size_t i = 0; i < buses_.size(); i++)
+			if (buses_[i].key == key)
+				return (int)i;
+
+		b.key = key;
+		b.unit = unit_of(t, id);
+		b.level = 0;
+		b.transitions = 0;
+		prov = key >> 63 ? DT_NONE : t.by_phandle((uint32_t)(key >> 32));
+		if (prov == DT_NONE) {
+			b.name = short_name(t.name(id));
+		} else {
+			property_compat pc(t, prov);
+			const char *c = pc.ok ? pc.p.str() : t.name(prov);
+			const char *comma = strchr(c, ',');
+
+			b.name = comma ? comma + 1 : c;
+			if ((uint32_t)key != 0xffffffffu) {
+				snprintf(suffix, sizeof(suffix), ":%u", (uint32_t)key);
+				b.name += suffix;
+			}
+		}
+		buses_.push_back(std::move(b));
+		return (int)buses_.size() - 1;
+	}
+
+	uint64_t to_dev_unit(const device &d, uint64_t mbps) const
+	{
+		return d.bus_width ? mbps * 1000000 / d.bus_width : mbps;
+	}
+
+	/*
+	 * Bus levels are the union of member OPP tables and of every value a
+	 * member could be voted; OPP-less members (L3, RIMPS) use them too.
+	 */
+	void build_levels()
+	{
+		for (bus &b : buses_) {
+			for (int di : b.devs)
+				b.levels.insert(b.levels.end(), devs_[di].levels.begin(),
+						devs_[di].levels.end());
+			for (const voter &v : voters_) {
+				if (devs_[v.dev].bus != &b - buses_.data())
+					continue;
+				for (const core_dev &c : v.table)
+					b.levels.push_back(c.val);
+			}
+			std::sort(b.levels.begin(), b.levels.end());
+			b.levels.erase(std::unique(b.levels.begin(), b.levels.end()),
+				       b.levels.end());
+			if (b.levels.empty())
+				b.levels.push_back(0);
+		}
+		for (device &d : devs_)
+			if (!d.has_opps)
+				d.levels = buses_[d.bus].levels;
+	}
+
+	uint64_t eval(const voter &v) const
+	{
+		uint32_t khz = 0;
+
+		if (v.kind == MON_BWMON) {
+			uint64_t mbps = bw_[&v - voters_.data()];
+
+			return to_dev_unit(devs_[v.dev], mbps * 100 / opts_.io_percent);
+		}
+		for (uint64_t m = v.cpus; m; m &= m - 1) {
+			const cpu_state &s = cpu_[__builtin_ctzll(m)];
+
+			if (s.khz <= khz)
+				continue;
+			if (v.kind != MON_COMPUTE) {
+				uint64_t miss = s.miss[v.ev_slot];
+				uint64_t ipm = s.inst / (miss ? miss : 1);
+
+				if (s.stall < opts_.stall_floor || ipm > opts_.ipm_ceil)
+					continue;
+			}
+			khz = s.khz;
+		}
+		return core_to_dev(v.table, khz);
+	}
+
+	template <typename F>
+	void tick(F changed)
+	{
+		ticks_++;
+		std::fill(dev_vote_.begin(), dev_vote_.end(), 0);
+		std::fill(bus_max_.begin(), bus_max_.end(), 0);
+		for (voter &v : voters_) {
+			v.vote = eval(v);
+			v.level = v.vote ? ceil_level(devs_[v.dev].levels, v.vote) : 0;
+			dev_vote_[v.dev] = std::max(dev_vote_[v.dev], v.vote);
+		}
+		for (size_t i = 0; i < devs_.size(); i++) {
+			device &d = devs_[i];
+			int lv = dev_vote_[i] ? ceil_level(d.levels, dev_vote_[i]) : 0;
+
+			if (lv != d.level) {
+				d.level = lv;
+				d.transitions++;
+			}
+			bus_max_[d.bus] = std::max(bus_max_[d.bus], d.levels[lv]);
+		}
+		for (size_t i = 0; i < buses_.size(); i++) {
+			bus &b = buses_[i];
+			int lv = ceil_level(b.levels, bus_max_[i]);
+
+			if (lv != b.level) {
+				b.level = lv;
+				b.transitions++;
+				changed(now_, (int)i);
+			}
+		}
+	}
+
+	void charge(uint64_t dt_us)
+	{
+		for (voter &v : voters_)
+			v.res[v.level] += dt_us;
+		for (device &d : devs_)
+			d.res[d.level] += dt_us;
+		for (bus &b : buses_)
+			b.res[b.level] += dt_us;
+	}
+
+	const dt::tree *t_ = nullptr;
+	const dt::cpu_topology *cpus_ = nullptr;
+	memlat_opts opts_;
+	std::vector<voter> voters_;
+	std::vector<device> devs_;
+	std::vector<bus> buses_;
+	std::vector<int> bwmons_;
+	std::vector<uint64_t> bw_;		/* last measured MBps per voter */
+	std::vector<uint64_t> dev_vote_;
+	std::vector<uint64_t> bus_max_;
+
+	uint32_t ev_num_[MEMLAT_MAX_EVENTS];
+	int nev_ = 0;
+	cpu_state cpu_[DT_MAX_CPUS];
+
+	int c_time_ = -1, c_cpu_ = -1, c_freq_ = -1, c_inst_ = -1;
+	int c_ipc_ = -1, c_cyc_ = -1, c_stall_ = -1;
+	int c_ev_[MEMLAT_MAX_EVENTS];
+
+	uint64_t now_ = 0, last_dt_ = 0, samples_ = 0, ticks_ = 0;
+	bool started_ = false;
+};
+
+} /* namespace dcvs */
+
+#endif /* __TOOLS_DCVS_MEMLAT_H__ */
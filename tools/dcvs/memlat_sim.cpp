@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Replay per-CPU counter traces through the memlat / bwmon voters of a DTB.
+ *
+ * Build: g++ -std=c++17 -O2 -o memlat_sim memlat_sim.cpp
+ * Usage: memlat_sim [-d ddr_type] [-r ipm_ceil] [-s stall_floor]
+ *                   [-p io_percent] [-v] <blob.dtb> <trace.csv>
+ *        memlat_sim [options] -g samples <blob.dtb>
+ *
+ * The trace is CSV with a header row:
+ *
+ *   time_us,cpu,freq_khz,inst,ev42,ev4096,ev23[,stall][,bw:<bwmon>...]
+ *
+ * one row per CPU sample, counters being deltas over the sample window.
+ * ipc,cyc may stand in for inst.  -g replays a synthetic trace of the
+ * given length instead, to measure throughput.  -v logs every bus
+ * frequency change.
+ *
+ * Example:
+ *   memlat_sim -d 8 yupik.dtb gfxbench.csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlat.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static const char *unit_name(dcvs::dev_unit u)
+{
+	switch (u) {
+	case dcvs::UNIT_HZ:
+		return "MHz";
+	case dcvs::UNIT_LEVEL:
+		return "level";
+	default:
+		return "MBps";
+	}
+}
+
+static uint64_t scaled(dcvs::dev_unit u, uint64_t v)
+{
+	return u == dcvs::UNIT_HZ ? v / 1000000 : v;
+}
+
+static void print_res(dcvs::dev_unit u, const std::vector<uint64_t> &levels,
+		      const std::vector<uint64_t> &res)
+{
+	uint64_t total = 0;
+
+	for (uint64_t r : res)
+		total += r;
+	if (!total)
+		return;
+	for (size_t i = 0; i < res.size(); i++) {
+		if (!res[i])
+			continue;
+		printf("    %8lu %-5s %6.2f%%\n", (unsigned long)scaled(u, levels[i]),
+		       unit_name(u), 100.0 * res[i] / total);
+	}
+}
+
+static const char *kind_name(dcvs::mon_kind k)
+{
+	switch (k) {
+	case dcvs::MON_MEMLAT:
+		return "memlat";
+	case dcvs::MON_COMPUTE:
+		return "compute";
+	case dcvs::MON_RIMPS_L3:
+		return "rimps-l3";
+	default:
+		return "bwmon";
+	}
+}
+
+static void report(const dcvs::memlat_sim &sim)
+{
+	const auto &devs = sim.devices();
+
+	for (const dcvs::bus &b : sim.buses()) {
+		printf("bus %s: %lu transitions\n", b.name.c_str(),
+		       (unsigned long)b.transitions);
+		print_res(b.unit, b.levels, b.res);
+		for (int di : b.devs) {
+			const dcvs::device &d = devs[di];
+
+			printf("  device %s (%s): %lu transitions\n", d.name.c_str(),
+			       d.governor, (unsigned long)d.transitions);
+			print_res(d.unit, d.levels, d.res);
+			for (const dcvs::voter &v : sim.voters()) {
+				if (v.dev != di)
+					continue;
+				printf("    voter %s (%s", v.name.c_str(), kind_name(v.kind));
+				if (v.kind != dcvs::MON_BWMON)
+					printf(", cpus 0x%lx", (unsigned long)v.cpus);
+				if (v.ev_slot < MEMLAT_MAX_EVENTS)
+					printf(", ev %u", v.ev);
+				if (v.kind == dcvs::MON_BWMON && v.col < 0)
+					printf(", no trace column");
+				printf(")\n");
+				print_res(d.unit, d.levels, v.res);
+			}
+		}
+	}
+}
+
+/*
+ * Synthetic trace: each CPU drifts between a handful of frequencies and
+ * between compute- and memory-bound phases, sampled every millisecond.
+ */
+static std::string synth(uint64_t samples, int ncpu, const std::vector<uint32_t> &evs)
+{
+	static const uint32_t khz[] = {
+		300000, 691200, 940800, 1228800, 1516800, 1804800, 2400000, 2707200,
+	};
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	std::string s = "time_us,cpu,freq_khz,inst";
+	char line[256];
+
+	for (uint32_t e : evs)
+		s += ",ev" + std::to_string(e);
+	s += '\n';
+	s.reserve(samples * 48);
+	for (uint64_t i = 0; i < samples; i++) {
+		int cpu = (int)(i % ncpu), n;
+		uint64_t inst, miss;
+
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		inst = 1000000 + (x & 0x7fffff);
+		miss = inst / (8 + ((x >> 24) & 0x3ff));
+		n = snprintf(line, sizeof(line), "%lu,%d,%u,%lu",
+			     (unsigned long)(i / ncpu * 1000), cpu,
+			     khz[(x >> 40) & 7], (unsigned long)inst);
+		s.append(line, n);
+		for (size_t e = 0; e < evs.size(); e++) {
+			n = snprintf(line, sizeof(line), ",%lu",
+				     (unsigned long)(miss >> e));
+			s.append(line, n);
+		}
+		s += '\n';
+	}
+	return s;
+}
+
+int main(int argc, char **argv)
+{
+	dcvs::memlat_opts o;
+	dcvs::memlat_sim sim;
+	dt::cpu_topology cpus;
+	csv::reader rd;
+	csv::row r;
+	std::string trace, missing;
+	uint64_t gen = 0;
+	bool verbose = false;
+	double t0, t1;
+	dt::file f;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "d:r:s:p:g:v")) != -1) {
+		switch (opt) {
+		case 'd':
+			o.ddr_type = atoi(optarg);
+			break;
+		case 'r':
+			o.ipm_ceil = atoi(optarg);
+			break;
+		case 's':
+			o.stall_floor = atoi(optarg);
+			break;
+		case 'p':
+			o.io_percent = atoi(optarg);
+			break;
+		case 'g':
+			gen = strtoull(optarg, nullptr, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != (gen ? 1 : 2) || !o.io_percent) {
+		fprintf(stderr,
+			"usage: %s [-d ddr_type] [-r ipm_ceil] [-s stall_floor] "
+			"[-p io_percent] [-v] <blob.dtb> <trace.csv>\n"
+			"       %s [options] -g samples <blob.dtb>\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	ret = f.open(argv[optind]);
+	if (!ret)
+		ret = cpus.build(f.index());
+	if (!ret)
+		ret = sim.load(f.index(), cpus, o);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	if (gen) {
+		trace = synth(gen, cpus.count(), sim.events());
+		rd.attach(trace.data(), trace.size());
+	} else if ((ret = rd.open(argv[optind + 1]))) {
+		fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(-ret));
+		return 1;
+	}
+
+	if (!rd.next(&r) || sim.bind(r, &missing)) {
+		fprintf(stderr, "%s: trace header lacks column '%s'\n",
+			gen ? "synthetic" : argv[optind + 1],
+			missing.empty() ? "time_us" : missing.c_str());
+		return 1;
+	}
+
+	auto changed = [&](uint64_t t, int b) {
+		const dcvs::bus &bs = sim.buses()[b];
+
+		if (verbose)
+			printf("%lu %s %lu\n", (unsigned long)t, bs.name.c_str(),
+			       (unsigned long)scaled(bs.unit, bs.levels[bs.level]));
+	};
+
+	t0 = now_us();
+	while (rd.next(&r))
+		sim.sample(r, changed);
+	sim.finish(changed);
+	t1 = now_us();
+
+	report(sim);
+	fprintf(stderr, "%lu samples, %lu ticks in %.1f ms (%.2f M samples/s)\n",
+		(unsigned long)sim.samples(), (unsigned long)sim.ticks(),
+		(t1 - t0) / 1e3, sim.samples() / (t1 - t0));
+	return 0;
+}
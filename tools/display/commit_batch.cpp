@@ -0,0 +1,793 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Drive the atomic commit builder with a compositor's frames against a
+ * mock DRM device, and count what it saves over setting everything.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -I../../kernel-headers -o commit_batch commit_batch.cpp
+ * Usage: commit_batch [-f frames] [-p planes] [-a age] [-m blobs] [-N] [-s seed]
+ *        commit_batch -b [-f frames] [-p planes] [-s seed]
+ *
+ * The mock device stands in for the KMS side of an SDE driver: a CRTC
+ * with dim layer, ROI and destination scaler blobs, and planes with the
+ * usual position and framebuffer properties plus scaler and CSC blobs.
+ * It allocates blob ids the way the kernel's idr does, lowest free
+ * first, keeps blobs alive while the state holds them, rejects
+ * requests naming unknown objects, properties or blobs, or blobs of the
+ * wrong size, and copies the destination scaler's sde_drm_scaler_v2s in
+ * when that property is set, as the driver does.  vgem has no KMS, so
+ * it cannot stand in for this.
+ *
+ * The compositor runs -p planes (default 8, at most 16): a video layer
+ * with a new buffer every frame, UI layers that redraw now and then,
+ * windows sliding and rescaling, dim fades, a moving partial update
+ * ROI, and now and then a destination scaler change rewritten in
+ * place.  It sets every property of every plane each frame and commits
+ * -f frames (default 3600).  -a and -m are the builder's blob age and
+ * cache size (default 120 and 256); -N turns off reuse and diffing,
+ * which is the compositor as it was.
+ *
+ * -b checks the state the mock ends up with against what the
+ * compositor meant, frame by frame, with and without the builder and
+ * with commits failing now and then, plus TEST_ONLY, reset, eviction
+ * and ROI normalisation; then runs both and prints ioctls, bytes and
+ * properties per frame.
+ *
+ * Example:
+ *   commit_batch -f 7200 -p 12
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "commit_batch.h"
+
+using namespace sde;
+
+#define MAX_PLANES	16
+#define CRTC_ID		40
+#define PLANE_ID	50
+
+enum {
+	P_FB_ID = 1,
+	P_CRTC_X,
+	P_CRTC_Y,
+	P_CRTC_W,
+	P_CRTC_H,
+	P_SRC_X,
+	P_SRC_Y,
+	P_SRC_W,
+	P_SRC_H,
+	P_ZPOS,
+	P_ALPHA,
+	P_SCALER_V2,
+	P_CSC_V1,
+	C_DIM_LAYER_V1,
+	C_ROI_V1,
+	C_DEST_SCALER,
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static bool chance(uint64_t *x, double p)
+{
+	return (xorshift(x) >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+/* The KMS side of the driver, as far as blobs and atomic commits go */
+class mock_drm {
+public:
+	struct counters {
+		uint64_t creates, destroys, atomics, failed, bytes;
+		double us;
+	};
+
+	void add_prop(uint32_t obj, uint32_t prop, uint32_t blob_size)
+	{
+		objs_[obj][prop] = { blob_size, 0 };
+		ids_.insert(obj);
+	}
+
+	int ioctl(unsigned long req, void *arg)
+	{
+		double t0 = now_us();
+		int ret;
+
+		switch (req) {
+		case DRM_IOCTL_MODE_CREATEPROPBLOB:
+			ret = create(*static_cast<drm_mode_create_blob *>(arg));
+			break;
+		case DRM_IOCTL_MODE_DESTROYPROPBLOB:
+			ret = destroy(static_cast<drm_mode_destroy_blob *>(arg)->blob_id);
+			break;
+		case DRM_IOCTL_MODE_ATOMIC:
+			ret = atomic(*static_cast<drm_mode_atomic *>(arg));
+			break;
+		default:
+			ret = -ENOTTY;
+		}
+		c_.us += now_us() - t0;
+		return ret;
+	}
+
+	uint64_t value(uint32_t obj, uint32_t prop) const
+	{
+		return objs_.at(obj).at(prop).value;
+	}
+
+	const std::vector<uint8_t> *blob(uint32_t id) const
+	{
+		auto it = blobs_.find(id);
+
+		return it == blobs_.end() ? nullptr : &it->second.data;
+	}
+
+	/* What the driver copied in for the destination scalers */
+	const std::vector<uint8_t> &ds_copy(uint32_t obj) { return ds_[obj]; }
+
+	uint32_t user_blobs() const
+	{
+		uint32_t n = 0;
+
+		for (const auto &b : blobs_)
+			n += b.second.user;
+		return n;
+	}
+
+	const counters &stats() const { return c_; }
+
+	uint32_t fail_every = 0;
+
+private:
+	struct prop {
+		uint32_t blob_size;	/* 0 for a plain property */
+		uint64_t value;
+	};
+
+	struct blob_obj {
+		std::vector<uint8_t> data;
+		bool user;		/* not destroyed by its creator yet */
+		uint32_t refs;		/* from the state */
+	};
+
+	int create(drm_mode_create_blob &cb)
+	{
+		uint32_t id = 1;
+
+		if (!cb.length)
+			return -EINVAL;
+		while (ids_.count(id))
+			id++;
+		ids_.insert(id);
+		blob_obj &b = blobs_[id];
+		b.data.assign((const uint8_t *)(uintptr_t)cb.data,
+			      (const uint8_t *)(uintptr_t)cb.data + cb.length);
+		b.user = true;
+		b.refs = 0;
+		cb.blob_id = id;
+		c_.creates++;
+		c_.bytes += cb.length;
+		return 0;
+	}
+
+	void put(uint32_t id)
+	{
+		auto it = blobs_.find(id);
+
+		if (it != blobs_.end() && !it->second.user && !it->second.refs) {
+			blobs_.erase(it);
+			ids_.erase(id);
+		}
+	}
+
+	int destroy(uint32_t id)
+	{
+		auto it = blobs_.find(id);
+
+		if (it == blobs_.end() || !it->second.user)
+			return -ENOENT;
+		it->second.user = false;
+		c_.destroys++;
+		put(id);
+		return 0;
+	}
+
+	int atomic(const drm_mode_atomic &a)
+	{
+		const uint32_t *objs = (const uint32_t *)(uintptr_t)a.objs_ptr;
+		const uint32_t *counts = (const uint32_t *)(uintptr_t)a.count_props_ptr;
+		const uint32_t *props = (const uint32_t *)(uintptr_t)a.props_ptr;
+		const uint64_t *values = (const uint64_t *)(uintptr_t)a.prop_values_ptr;
+		std::set<uint32_t> seen;
+		uint32_t k = 0;
+
+		c_.atomics++;
+		c_.bytes += sizeof(a) + 8ull * a.count_objs;
+		if (!a.count_objs || (a.flags & ~DRM_MODE_ATOMIC_FLAGS))
+			return -EINVAL;
+		for (uint32_t i = 0; i < a.count_objs; i++) {
+			auto o = objs_.find(objs[i]);
+
+			if (o == objs_.end() || !seen.insert(objs[i]).second)
+				return -ENOENT;
+			for (uint32_t j = 0; j < counts[i]; j++, k++) {
+				auto p = o->second.find(props[k]);
+
+				c_.bytes += 12;
+				if (p == o->second.end())
+					return -ENOENT;
+				if (p->second.blob_size && values[k]) {
+					const std::vector<uint8_t> *b = blob((uint32_t)values[k]);
+
+					if (!b)
+						return -ENOENT;
+					if (b->size() != p->second.blob_size)
+						return -EINVAL;
+				}
+			}
+		}
+		if (fail_every && !(c_.atomics % fail_every)) {
+			c_.failed++;
+			return -EBUSY;
+		}
+		if (a.flags & DRM_MODE_ATOMIC_TEST_ONLY)
+			return 0;
+
+		k = 0;
+		for (uint32_t i = 0; i < a.count_objs; i++) {
+			for (uint32_t j = 0; j < counts[i]; j++, k++) {
+				prop &p = objs_[objs[i]][props[k]];
+				uint64_t old = p.value;
+
+				p.value = values[k];
+				if (!p.blob_size || old == p.value)
+					continue;
+				if (p.value) {
+					blobs_[(uint32_t)p.value].refs++;
+					if (p.blob_size == sizeof(sde_drm_dest_scaler_data))
+						copy_ds(objs[i], blobs_[(uint32_t)p.value].data);
+				}
+				if (old) {
+					blobs_[(uint32_t)old].refs--;
+					put((uint32_t)old);
+				}
+			}
+		}
+		return 0;
+	}
+
+	void copy_ds(uint32_t obj, const std::vector<uint8_t> &data)
+	{
+		sde_drm_dest_scaler_data d;
+		std::vector<uint8_t> &out = ds_[obj];
+
+		memcpy(&d, data.data(), sizeof(d));
+		out.clear();
+		for (uint32_t i = 0; i < d.num_dest_scaler && i < SDE_MAX_DS_COUNT; i++) {
+			const uint8_t *s = (const uint8_t *)(uintptr_t)d.ds_cfg[i].scaler_cfg;
+
+			if (s)
+				out.insert(out.end(), s, s + sizeof(sde_drm_scaler_v2));
+		}
+	}
+
+	std::unordered_map<uint32_t, std::unordered_map<uint32_t, prop>> objs_;
+	std::map<uint32_t, blob_obj> blobs_;
+	std::set<uint32_t> ids_;
+	std::unordered_map<uint32_t, std::vector<uint8_t>> ds_;
+	counters c_ = {};
+};
+
+struct layer {
+	uint32_t fb;
+	int32_t x, y, w, h;
+	uint32_t sw, sh;
+	uint32_t alpha;
+	bool video, yuv;
+	uint32_t moving;	/* frames of slide left */
+	int32_t dx, dy, dw;
+	sde_drm_scaler_v2 scaler;
+	sde_drm_csc_v1 csc;
+};
+
+struct compositor {
+	uint32_t planes;
+	layer l[MAX_PLANES];
+	sde_drm_dim_layer_v1 dim;
+	uint32_t dimming;
+	sde_drm_roi_v1 roi;
+	sde_drm_dest_scaler_data ds;
+	sde_drm_scaler_v2 ds_scaler[SDE_MAX_DS_COUNT];
+	uint64_t rng;
+};
+
+static void fill_scaler(sde_drm_scaler_v2 *s, uint32_t sw, uint32_t sh, uint32_t dw, uint32_t dh)
+{
+	memset(s, 0, sizeof(*s));
+	s->enable = sw != dw || sh != dh;
+	s->dir_en = s->enable;
+	for (int i = 0; i < SDE_MAX_PLANES; i++) {
+		uint32_t div = i == 1 || i == 2 ? 2 : 1;
+
+		s->src_width[i] = sw / div;
+		s->src_height[i] = sh / div;
+		s->phase_step_x[i] = (int32_t)(((uint64_t)sw << 21) / std::max(dw, 1u) / div);
+		s->phase_step_y[i] = (int32_t)(((uint64_t)sh << 21) / std::max(dh, 1u) / div);
+		s->preload_x[i] = 3;
+		s->preload_y[i] = 3;
+	}
+	s->dst_width = dw;
+	s->dst_height = dh;
+	s->lut_flag = s->enable ? 0x3f : 0;
+}
+
+static void fill_csc(sde_drm_csc_v1 *c, bool bt709)
+{
+	static const int64_t m601[9] = { 0x12a, 0, 0x198, 0x12a, -0x64, -0xd0, 0x12a, 0x204, 0 };
+	static const int64_t m709[9] = { 0x12a, 0, 0x1cb, 0x12a, -0x37, -0x89, 0x12a, 0x21d, 0 };
+
+	memset(c, 0, sizeof(*c));
+	for (int i = 0; i < 9; i++)
+		c->ctm_coeff[i] = (bt709 ? m709 : m601)[i] << 24;
+	c->pre_bias[0] = 0xfff0;
+	c->pre_bias[1] = c->pre_bias[2] = 0xff80;
+	for (int i = 0; i < 6; i += 2) {
+		c->pre_clamp[i] = c->post_clamp[i] = 0;
+		c->pre_clamp[i + 1] = c->post_clamp[i + 1] = 0x3ff;
+	}
+}
+
+static void comp_init(compositor *c, uint32_t planes, uint64_t seed)
+{
+	memset(c, 0, sizeof(*c));
+	c->planes = planes;
+	c->rng = seed;
+	for (uint32_t i = 0; i < planes; i++) {
+		layer &l = c->l[i];
+
+		l.video = i == 0;
+		l.yuv = l.video || chance(&c->rng, 0.2);
+		l.fb = 100 + i * 1000;
+		l.sw = l.video ? 1920 : 200 + (uint32_t)(xorshift(&c->rng) % 800);
+		l.sh = l.video ? 1080 : 100 + (uint32_t)(xorshift(&c->rng) % 1200);
+		l.w = l.video ? 1080 : (int32_t)l.sw;
+		l.h = l.video ? 608 : (int32_t)l.sh;
+		l.x = (int32_t)(xorshift(&c->rng) % 800);
+		l.y = (int32_t)(xorshift(&c->rng) % 1800);
+		l.alpha = 0xffff;
+		fill_csc(&l.csc, l.video);
+	}
+	for (uint32_t i = 0; i < SDE_MAX_DS_COUNT; i++) {
+		fill_scaler(&c->ds_scaler[i], 1080, 2400, 1440, 3200);
+		c->ds.ds_cfg[i].flags = SDE_DRM_DESTSCALER_ENABLE | SDE_DRM_DESTSCALER_SCALE_UPDATE;
+		c->ds.ds_cfg[i].index = i;
+		c->ds.ds_cfg[i].lm_width = 540;
+		c->ds.ds_cfg[i].lm_height = 2400;
+		c->ds.ds_cfg[i].scaler_cfg = (uintptr_t)&c->ds_scaler[i];
+	}
+	c->ds.num_dest_scaler = SDE_MAX_DS_COUNT;
+	c->roi.num_rects = 1;
+	c->roi.roi[0] = { 0, 0, 1080, 2400 };
+}
+
+/* One frame of a busy UI over a video */
+static void comp_step(compositor *c)
+{
+	uint64_t *x = &c->rng;
+
+	for (uint32_t i = 0; i < c->planes; i++) {
+		layer &l = c->l[i];
+
+		if (l.video || chance(x, 0.15))
+			l.fb++;
+		if (!l.moving && !l.video && chance(x, 0.01)) {
+			l.moving = 30;
+			l.dx = (int32_t)(xorshift(x) % 17) - 8;
+			l.dy = (int32_t)(xorshift(x) % 17) - 8;
+			l.dw = chance(x, 0.5) ? (int32_t)(xorshift(x) % 9) - 4 : 0;
+		}
+		if (l.moving) {
+			l.moving--;
+			l.x += l.dx;
+			l.y += l.dy;
+			l.w = std::max(16, l.w + l.dw);
+			l.h = std::max(16, l.h + l.dw);
+		}
+		if (chance(x, 0.001))
+			fill_csc(&l.csc, chance(x, 0.5));
+		fill_scaler(&l.scaler, l.sw, l.sh, (uint32_t)l.w, (uint32_t)l.h);
+	}
+
+	if (!c->dimming && chance(x, 0.005)) {
+		c->dimming = 20;
+		/* Stale entries past the count, as a reused struct has */
+		c->dim.layer_cfg[3].stage = (uint32_t)xorshift(x);
+	}
+	if (c->dimming) {
+		c->dimming--;
+		c->dim.num_layers = c->dimming ? 1 : 0;
+		c->dim.layer_cfg[0].flags = SDE_DRM_DIM_LAYER_INCLUSIVE;
+		c->dim.layer_cfg[0].stage = 2;
+		c->dim.layer_cfg[0].color_fill.color_3 = (20 - c->dimming) * 0x0c00;
+		c->dim.layer_cfg[0].rect = { 0, 0, 1080, 2400 };
+	}
+
+	if (chance(x, 0.3)) {
+		unsigned short rx = (unsigned short)(xorshift(x) % 1000);
+		unsigned short ry = (unsigned short)(xorshift(x) % 2300);
+
+		c->roi.num_rects = 1;
+		c->roi.roi[0] = { rx, ry, (unsigned short)(rx + 80), (unsigned short)(ry + 100) };
+	}
+
+	/* Rewritten where it is, so only the contents say it changed */
+	if (chance(x, 0.002))
+		for (auto &s : c->ds_scaler)
+			s.dst_width = s.dst_width == 1440 ? 1080 : 1440;
+}
+
+static int comp_set(const compositor &c, commit_batch *b)
+{
+	int ret;
+
+	for (uint32_t i = 0; i < c.planes; i++) {
+		const layer &l = c.l[i];
+		uint32_t id = PLANE_ID + i;
+
+		b->set(id, P_FB_ID, l.fb);
+		b->set(id, P_CRTC_X, (uint64_t)(int64_t)l.x);
+		b->set(id, P_CRTC_Y, (uint64_t)(int64_t)l.y);
+		b->set(id, P_CRTC_W, (uint32_t)l.w);
+		b->set(id, P_CRTC_H, (uint32_t)l.h);
+		b->set(id, P_SRC_X, 0);
+		b->set(id, P_SRC_Y, 0);
+		b->set(id, P_SRC_W, (uint64_t)l.sw << 16);
+		b->set(id, P_SRC_H, (uint64_t)l.sh << 16);
+		b->set(id, P_ZPOS, i);
+		b->set(id, P_ALPHA, l.alpha);
+		ret = b->set_scaler(id, P_SCALER_V2, l.scaler);
+		if (!ret && l.yuv)
+			ret = b->set_csc(id, P_CSC_V1, l.csc);
+		if (ret)
+			return ret;
+	}
+	ret = b->set_dim_layers(CRTC_ID, C_DIM_LAYER_V1, c.dim);
+	if (!ret)
+		ret = b->set_roi(CRTC_ID, C_ROI_V1, c.roi);
+	if (!ret)
+		ret = b->set_dest_scaler(CRTC_ID, C_DEST_SCALER, c.ds);
+	return ret;
+}
+
+static void mock_init(mock_drm *m, uint32_t planes)
+{
+	for (uint32_t i = 0; i < planes; i++) {
+		for (uint32_t p = P_FB_ID; p <= P_ALPHA; p++)
+			m->add_prop(PLANE_ID + i, p, 0);
+		m->add_prop(PLANE_ID + i, P_SCALER_V2, sizeof(sde_drm_scaler_v2));
+		m->add_prop(PLANE_ID + i, P_CSC_V1, sizeof(sde_drm_csc_v1));
+	}
+	m->add_prop(CRTC_ID, C_DIM_LAYER_V1, sizeof(sde_drm_dim_layer_v1));
+	m->add_prop(CRTC_ID, C_ROI_V1, sizeof(sde_drm_roi_v1));
+	m->add_prop(CRTC_ID, C_DEST_SCALER, sizeof(sde_drm_dest_scaler_data));
+}
+
+static bool blob_is(const mock_drm &m, uint32_t obj, uint32_t prop, const void *p, size_t size)
+{
+	const std::vector<uint8_t> *b = m.blob((uint32_t)m.value(obj, prop));
+
+	return b && b->size() == size && !memcmp(b->data(), p, size);
+}
+
+/* Does the device hold what the compositor meant; the first thing that differs */
+static const char *verify(mock_drm *m, const compositor &c)
+{
+	sde_drm_dim_layer_v1 dim;
+	sde_drm_roi_v1 roi;
+	const std::vector<uint8_t> &ds = m->ds_copy(CRTC_ID);
+
+	for (uint32_t i = 0; i < c.planes; i++) {
+		const layer &l = c.l[i];
+		uint32_t id = PLANE_ID + i;
+
+		if (m->value(id, P_FB_ID) != l.fb || m->value(id, P_CRTC_X) != (uint64_t)(int64_t)l.x ||
+		    m->value(id, P_CRTC_W) != (uint32_t)l.w || m->value(id, P_ZPOS) != i)
+			return "plane property";
+		if (!blob_is(*m, id, P_SCALER_V2, &l.scaler, sizeof(l.scaler)))
+			return "plane scaler";
+		if (l.yuv && !blob_is(*m, id, P_CSC_V1, &l.csc, sizeof(l.csc)))
+			return "plane csc";
+	}
+	memset(&dim, 0, sizeof(dim));
+	dim.num_layers = c.dim.num_layers;
+	memcpy(dim.layer_cfg, c.dim.layer_cfg, dim.num_layers * sizeof(dim.layer_cfg[0]));
+	if (!blob_is(*m, CRTC_ID, C_DIM_LAYER_V1, &dim, sizeof(dim)))
+		return "dim layers";
+	memset(&roi, 0, sizeof(roi));
+	roi.num_rects = c.roi.num_rects;
+	memcpy(roi.roi, c.roi.roi, roi.num_rects * sizeof(roi.roi[0]));
+	if (!blob_is(*m, CRTC_ID, C_ROI_V1, &roi, sizeof(roi)))
+		return "roi";
+	if (ds.size() != sizeof(c.ds_scaler) || memcmp(ds.data(), c.ds_scaler, ds.size()))
+		return "dest scaler contents";
+	return nullptr;
+}
+
+struct run_result {
+	batch_stats st;
+	mock_drm::counters dev;
+	uint64_t frames;
+	double us;		/* building and committing, device excluded */
+	uint32_t left;		/* user blobs on the device after teardown */
+};
+
+/*
+ * @frames of the compositor through a builder with @o; with @check, the
+ * device must hold the frame after every commit that went through.
+ */
+static int run(const batch_opts &o, uint32_t planes, uint64_t frames, uint64_t seed,
+	       uint32_t fail_every, bool check, run_result *r)
+{
+	std::unique_ptr<compositor> c(new compositor);
+	mock_drm m;
+	double t0;
+	int ret = 0;
+
+	mock_init(&m, planes);
+	m.fail_every = fail_every;
+	comp_init(c.get(), planes, seed);
+	{
+		commit_batch b;
+
+		ret = b.init([&m](unsigned long req, void *arg) { return m.ioctl(req, arg); }, o);
+		if (ret)
+			return ret;
+		t0 = now_us();
+		for (uint64_t f = 0; f < frames; f++) {
+			const char *bad;
+
+			comp_step(c.get());
+			ret = comp_set(*c, &b);
+			if (ret)
+				return ret;
+			ret = b.commit(DRM_MODE_ATOMIC_NONBLOCK);
+			if (ret == -EBUSY && fail_every)
+				continue;
+			if (ret)
+				return ret;
+			if (check && (bad = verify(&m, *c))) {
+				fprintf(stderr, "check: frame %llu: %s differs%s\n",
+					(unsigned long long)f, bad, o.diff ? "" : " (no diff)");
+				return -EIO;
+			}
+		}
+		r->us = now_us() - t0 - m.stats().us;
+		r->st = b.stats();
+	}
+	r->dev = m.stats();
+	r->frames = frames;
+	r->left = m.user_blobs();
+	return 0;
+}
+
+static void print_run(const char *name, const run_result &r)
+{
+	const batch_stats &s = r.st;
+	double n = (double)r.frames;
+
+	printf("%-8s %6.2f ioctls %8.0f blob B %6.0f req B %6.1f of %5.1f props"
+	       "  %5.2f us/frame (+%.2f device)  %u blobs peak\n",
+	       name, s.ioctls / n, s.blob_bytes / n, s.req_bytes / n, s.props_sent / n,
+	       s.props_set / n, r.us / n, r.dev.us / n, s.peak_cached);
+}
+
+static int check_edges(void)
+{
+	mock_drm m;
+	commit_batch b;
+	sde_drm_roi_v1 roi;
+	sde_drm_scaler_v2 sc;
+	uint32_t id;
+	int ret;
+
+	mock_init(&m, 1);
+	ret = b.init([&m](unsigned long req, void *arg) { return m.ioctl(req, arg); });
+	if (ret)
+		return ret;
+
+	/* Unused ROI entries are not part of the blob */
+	memset(&roi, 0, sizeof(roi));
+	roi.num_rects = 1;
+	roi.roi[0] = { 1, 2, 3, 4 };
+	b.set_roi(CRTC_ID, C_ROI_V1, roi);
+	b.set(PLANE_ID, P_FB_ID, 7);
+	if (b.commit() || b.frame().props_sent != 2 || b.frame().blobs_created != 1)
+		return -EIO;
+	id = (uint32_t)m.value(CRTC_ID, C_ROI_V1);
+	roi.roi[2] = { 9, 9, 9, 9 };
+	b.set_roi(CRTC_ID, C_ROI_V1, roi);
+	b.set(PLANE_ID, P_FB_ID, 7);
+	if (b.commit() || b.frame().props_sent || b.frame().ioctls ||
+	    m.value(CRTC_ID, C_ROI_V1) != id) {
+		fprintf(stderr, "check: unchanged frame sent %u properties, %u ioctls\n",
+			b.frame().props_sent, b.frame().ioctls);
+		return -EIO;
+	}
+
+	/* TEST_ONLY leaves the state where it was, and so the next commit */
+	b.set(PLANE_ID, P_FB_ID, 8);
+	if (b.commit(DRM_MODE_ATOMIC_TEST_ONLY) || m.value(PLANE_ID, P_FB_ID) != 7)
+		return -EIO;
+	b.set(PLANE_ID, P_FB_ID, 8);
+	if (b.commit() || b.frame().props_sent != 1 || m.value(PLANE_ID, P_FB_ID) != 8) {
+		fprintf(stderr, "check: TEST_ONLY commit counted as applied\n");
+		return -EIO;
+	}
+
+	/* After a reset everything goes */
+	b.reset();
+	b.set_roi(CRTC_ID, C_ROI_V1, roi);
+	b.set(PLANE_ID, P_FB_ID, 8);
+	if (b.commit() || b.frame().props_sent != 2 || b.frame().blobs_created) {
+		fprintf(stderr, "check: reset sent %u of 2\n", b.frame().props_sent);
+		return -EIO;
+	}
+
+	/* A blob the device refuses fails the commit, and nothing is kept */
+	memset(&sc, 0, sizeof(sc));
+	b.set_blob(PLANE_ID, P_SCALER_V2, &sc, sizeof(sc) - 4);
+	if (b.commit() != -EINVAL)
+		return -EIO;
+	b.set_scaler(PLANE_ID, P_SCALER_V2, sc);
+	if (b.commit() || b.frame().props_sent != 1) {
+		fprintf(stderr, "check: failed commit poisoned the state\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+static int check(uint32_t planes, uint64_t seed)
+{
+	batch_opts on, off, tight;
+	run_result r;
+	int ret;
+
+	off.reuse = off.diff = false;
+	tight.max_age = 4;
+	tight.max_blobs = 24;
+
+	ret = check_edges();
+	if (!ret)
+		ret = run(on, planes, 2000, seed, 0, true, &r);
+	if (!ret && r.left) {
+		fprintf(stderr, "check: %u blobs left on the device\n", r.left);
+		ret = -EIO;
+	}
+	if (!ret)
+		ret = run(off, planes, 500, seed, 0, true, &r);
+	if (!ret)
+		ret = run(on, planes, 2000, seed ^ 1, 13, true, &r);
+	if (!ret && !r.dev.failed)
+		ret = -EIO;
+	if (!ret)
+		ret = run(tight, planes, 2000, seed ^ 2, 0, true, &r);
+	if (!ret && (r.st.peak_cached > tight.max_blobs || r.left)) {
+		fprintf(stderr, "check: cache peaked at %u blobs of %u, %u left\n",
+			r.st.peak_cached, tight.max_blobs, r.left);
+		ret = -EIO;
+	}
+	if (!ret)
+		printf("check: device state, failures, TEST_ONLY, reset, eviction, roi ok\n");
+	return ret;
+}
+
+static int bench(uint32_t planes, uint64_t frames, uint64_t seed)
+{
+	batch_opts on, off;
+	run_result a, b;
+	int ret;
+
+	off.reuse = off.diff = false;
+	ret = run(off, planes, frames, seed, 0, false, &a);
+	if (!ret)
+		ret = run(on, planes, frames, seed, 0, false, &b);
+	if (ret)
+		return ret;
+	printf("%u planes, %llu frames, per frame:\n", planes, (unsigned long long)frames);
+	print_run("all", a);
+	print_run("changed", b);
+	printf("avoided: %.1f%% of ioctls, %.1f%% of blob bytes, %.1f%% of request bytes\n",
+	       100.0 * (1 - (double)b.st.ioctls / (double)a.st.ioctls),
+	       100.0 * (1 - (double)b.st.blob_bytes / (double)a.st.blob_bytes),
+	       100.0 * (1 - (double)b.st.req_bytes / (double)a.st.req_bytes));
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: commit_batch [-f frames] [-p planes] [-a age] [-m blobs] [-N] [-s seed]\n"
+		"       commit_batch -b [-f frames] [-p planes] [-s seed]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	batch_opts o;
+	run_result r;
+	uint64_t frames = 3600, seed = 0x2545f4914f6cdd1dull;
+	uint32_t planes = 8;
+	bool do_bench = false;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "f:p:a:m:Ns:b")) != -1) {
+		switch (opt) {
+		case 'f':
+			frames = std::max(1ull, strtoull(optarg, NULL, 0));
+			break;
+		case 'p':
+			planes = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			o.max_age = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			o.max_blobs = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			o.reuse = o.diff = false;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc || !planes || planes > MAX_PLANES)
+		usage();
+
+	if (do_bench) {
+		ret = check(planes, seed);
+		if (!ret)
+			ret = bench(planes, frames, seed);
+		if (ret)
+			fprintf(stderr, "bench: %s\n", strerror(-ret));
+		return ret ? 1 : 0;
+	}
+
+	ret = run(o, planes, frames, seed, 0, false, &r);
+	if (ret) {
+		fprintf(stderr, "commit_batch: %s\n", strerror(-ret));
+		return 1;
+	}
+	print_run(o.diff ? "changed" : "all", r);
+	return 0;
+}
@@ -0,0 +1,470 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Atomic commit builder for SDE plane and CRTC properties that only
+ * sends what changed.
+ *
+ * A compositor sets every property of every layer each frame, most of
+ * them blobs of sde_drm_scaler_v2, sde_drm_csc_v1, sde_drm_dim_layer_v1,
+ * sde_drm_roi_v1 and sde_drm_dest_scaler_data that are the same as last
+ * frame.  commit_batch takes them all and does two things with them.
+ *
+ * Blobs are cached by content.  Each struct is hashed (FNV-1a) and, when
+ * a blob with the same bytes is already in the cache, its id is used
+ * instead of creating another; only blobs nobody has set for max_age
+ * frames are destroyed.  roi_v1 and dim_layer_v1 are hashed with their
+ * unused entries cleared, so stale entries past the count do not make
+ * equal lists look different.  sde_drm_dest_scaler_data points at its
+ * sde_drm_scaler_v2s, which the driver reads when the property is set:
+ * the pointer and what it points at are both part of the key.
+ *
+ * Properties are diffed against the last committed state.  Everything
+ * set for a frame is merged into one DRM_IOCTL_MODE_ATOMIC, grouped by
+ * object, with the properties whose value (for blobs, the id) is what
+ * the kernel already has left out.  The kernel keeps state between
+ * commits, so nothing is lost; properties the driver does not keep
+ * between frames can be set with always.  The state only advances on a
+ * commit that succeeded and was not TEST_ONLY, so whatever a failed
+ * commit carried goes again with the next one.  reset() forgets it all,
+ * for when another master may have changed it.  A frame where nothing
+ * changed is not sent at all.
+ *
+ * ioctls go through a drm_ioctl_fn, so the same code runs on a DRM fd or
+ * a mock device.  Each commit records what it sent next to what setting
+ * everything with fresh blobs (created before, destroyed after) would
+ * have sent: ioctls, blob bytes and request bytes.  With reuse and diff
+ * off it is that compositor, for comparison.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_DISPLAY_COMMIT_BATCH_H__
+#define __TOOLS_DISPLAY_COMMIT_BATCH_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+#include <display/drm/sde_drm.h>
+
+namespace sde {
+
+typedef std::function<int(unsigned long req, void *arg)> drm_ioctl_fn;
+
+/* ioctl on a DRM fd, retried on EINTR and EAGAIN as libdrm does */
+inline drm_ioctl_fn drm_fd_ioctl(int fd)
+{
+	return [fd](unsigned long req, void *arg) {
+		int ret;
+
+		do {
+			ret = ioctl(fd, req, arg);
+		} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+		return ret ? -errno : 0;
+	};
+}
+
+inline uint64_t blob_hash(const void *p, size_t len, uint64_t h = 0xcbf29ce484222325ull)
+{
+	const uint8_t *b = static_cast<const uint8_t *>(p);
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ b[i]) * 0x100000001b3ull;
+	return h;
+}
+
+struct batch_opts {
+	uint32_t max_age = 120;		/* frames an unused blob is kept */
+	uint32_t max_blobs = 256;	/* oldest go first past this */
+	bool reuse = true;		/* blobs by content */
+	bool diff = true;		/* only properties that changed */
+};
+
+/* One commit; "naive" is setting everything with fresh blobs */
+struct batch_frame {
+	uint32_t objs, props_set, props_sent;
+	uint32_t blobs_set, blobs_created, blobs_destroyed;
+	uint32_t ioctls, naive_ioctls;
+	uint64_t blob_bytes, naive_blob_bytes;
+	uint64_t req_bytes, naive_req_bytes;
+};
+
+struct batch_stats {
+	uint64_t frames, sent, failed, collisions;
+	uint64_t props_set, props_sent, blobs_set, blobs_created, blobs_destroyed;
+	uint64_t ioctls, naive_ioctls;
+	uint64_t blob_bytes, naive_blob_bytes, req_bytes, naive_req_bytes;
+	uint32_t cached, peak_cached;
+
+	void add(const batch_frame &f)
+	{
+		props_set += f.props_set;
+		props_sent += f.props_sent;
+		blobs_set += f.blobs_set;
+		blobs_created += f.blobs_created;
+		blobs_destroyed += f.blobs_destroyed;
+		ioctls += f.ioctls;
+		naive_ioctls += f.naive_ioctls;
+		blob_bytes += f.blob_bytes;
+		naive_blob_bytes += f.naive_blob_bytes;
+		req_bytes += f.req_bytes;
+		naive_req_bytes += f.naive_req_bytes;
+	}
+};
+
+class commit_batch {
+public:
+	commit_batch() = default;
+	commit_batch(const commit_batch &) = delete;
+	commit_batch &operator=(const commit_batch &) = delete;
+
+	~commit_batch()
+	{
+		for (const auto &e : cache_)
+			destroy(e.second.id);
+		for (uint32_t id : oneshot_)
+			destroy(id);
+	}
+
+	int init(const drm_ioctl_fn &io, const batch_opts &o = batch_opts())
+	{
+		if (!io || !o.max_blobs)
+			return -EINVAL;
+		io_ = io;
+		opts_ = o;
+		return 0;
+	}
+
+	/* Plain property; @always sends it even if the kernel has it */
+	void set(uint32_t obj, uint32_t prop, uint64_t value, bool always = false)
+	{
+		uint64_t key = (uint64_t)obj << 32 | prop;
+		auto it = pidx_.find(key);
+
+		cur_.props_set++;
+		if (it != pidx_.end()) {
+			pend_[it->second].value = value;
+			pend_[it->second].always |= always;
+			return;
+		}
+		pidx_.emplace(key, (uint32_t)pend_.size());
+		pend_.push_back({ key, value, always });
+	}
+
+	/*
+	 * Blob property from @size bytes at @p; @salt is anything outside
+	 * those bytes the blob means, so equal bytes with another salt are
+	 * another blob.
+	 */
+	int set_blob(uint32_t obj, uint32_t prop, const void *p, uint32_t size, uint64_t salt = 0)
+	{
+		uint32_t id;
+		int ret;
+
+		if (!size)
+			return -EINVAL;
+		ret = opts_.reuse ? lookup((uint64_t)obj << 32 | prop, p, size, salt, &id) :
+				    create(p, size, &id);
+		if (ret)
+			return ret;
+		if (!opts_.reuse)
+			oneshot_.push_back(id);
+		cur_.blobs_set++;
+		cur_.naive_blob_bytes += size;
+		set(obj, prop, id);
+		return 0;
+	}
+
+	int set_scaler(uint32_t obj, uint32_t prop, const sde_drm_scaler_v2 &s)
+	{
+		return set_blob(obj, prop, &s, sizeof(s));
+	}
+
+	int set_csc(uint32_t obj, uint32_t prop, const sde_drm_csc_v1 &c)
+	{
+		return set_blob(obj, prop, &c, sizeof(c));
+	}
+
+	int set_dim_layers(uint32_t obj, uint32_t prop, const sde_drm_dim_layer_v1 &d)
+	{
+		sde_drm_dim_layer_v1 n;
+
+		if (d.num_layers > SDE_MAX_DIM_LAYERS)
+			return -EINVAL;
+		memset(&n, 0, sizeof(n));
+		n.num_layers = d.num_layers;
+		memcpy(n.layer_cfg, d.layer_cfg, d.num_layers * sizeof(d.layer_cfg[0]));
+		return set_blob(obj, prop, &n, sizeof(n));
+	}
+
+	int set_roi(uint32_t obj, uint32_t prop, const sde_drm_roi_v1 &r)
+	{
+		sde_drm_roi_v1 n;
+
+		if (r.num_rects > SDE_MAX_ROI_V1)
+			return -EINVAL;
+		memset(&n, 0, sizeof(n));
+		n.num_rects = r.num_rects;
+		memcpy(n.roi, r.roi, r.num_rects * sizeof(r.roi[0]));
+		return set_blob(obj, prop, &n, sizeof(n));
+	}
+
+	int set_dest_scaler(uint32_t obj, uint32_t prop, const sde_drm_dest_scaler_data &d)
+	{
+		uint64_t salt = 0xcbf29ce484222325ull;
+
+		if (d.num_dest_scaler > SDE_MAX_DS_COUNT)
+			return -EINVAL;
+		for (uint32_t i = 0; i < d.num_dest_scaler; i++) {
+			const void *s = (const void *)(uintptr_t)d.ds_cfg[i].scaler_cfg;
+
+			if (s)
+				salt = blob_hash(s, sizeof(sde_drm_scaler_v2), salt);
+		}
+		return set_blob(obj, prop, &d, sizeof(d), salt);
+	}
+
+	/*
+	 * Send what changed since the last commit as one atomic request.
+	 * Whatever was set is consumed either way.
+	 */
+	int commit(uint32_t flags = 0, uint64_t user_data = 0)
+	{
+		drm_mode_atomic req;
+		uint32_t naive_objs = 0;
+		uint64_t last_obj = ~0ull;
+		int ret = 0;
+
+		sent_.clear();
+		std::sort(pend_.begin(), pend_.end(),
+			  [](const pend &a, const pend &b) { return a.key < b.key; });
+		for (const pend &p : pend_) {
+			auto it = last_.find(p.key);
+
+			if ((p.key >> 32) != (last_obj >> 32))
+				naive_objs++;
+			last_obj = p.key;
+			if (opts_.diff && !p.always && it != last_.end() && it->second == p.value)
+				continue;
+			sent_.push_back(p);
+		}
+
+		objs_.clear();
+		counts_.clear();
+		props_.clear();
+		values_.clear();
+		for (const pend &p : sent_) {
+			if (objs_.empty() || objs_.back() != (uint32_t)(p.key >> 32)) {
+				objs_.push_back((uint32_t)(p.key >> 32));
+				counts_.push_back(0);
+			}
+			counts_.back()++;
+			props_.push_back((uint32_t)p.key);
+			values_.push_back(p.value);
+		}
+
+		cur_.objs = (uint32_t)objs_.size();
+		cur_.props_sent = (uint32_t)sent_.size();
+		cur_.req_bytes = req_bytes(cur_.objs, cur_.props_sent);
+		cur_.naive_req_bytes = req_bytes(naive_objs, (uint32_t)pend_.size());
+		/* Create and destroy each blob, plus the commit */
+		cur_.naive_ioctls = 2 * cur_.blobs_set + 1;
+
+		if (!sent_.empty()) {
+			memset(&req, 0, sizeof(req));
+			req.flags = flags;
+			req.count_objs = cur_.objs;
+			req.objs_ptr = (uintptr_t)objs_.data();
+			req.count_props_ptr = (uintptr_t)counts_.data();
+			req.props_ptr = (uintptr_t)props_.data();
+			req.prop_values_ptr = (uintptr_t)values_.data();
+			req.user_data = user_data;
+			ret = sys(io_(DRM_IOCTL_MODE_ATOMIC, &req));
+			st_.sent++;
+			if (ret)
+				st_.failed++;
+			else if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY))
+				for (const pend &p : sent_)
+					last_[p.key] = p.value;
+		}
+
+		for (uint32_t id : oneshot_)
+			destroy(id);
+		oneshot_.clear();
+		evict();
+
+		pend_.clear();
+		pidx_.clear();
+		st_.frames++;
+		st_.add(cur_);
+		st_.cached = (uint32_t)cache_.size();
+		st_.peak_cached = std::max(st_.peak_cached, st_.cached);
+		frame_ = cur_;
+		memset(&cur_, 0, sizeof(cur_));
+		now_++;
+		return ret;
+	}
+
+	/* Assume nothing about what the kernel has; the next commit sends it all */
+	void reset() { last_.clear(); }
+
+	const batch_frame &frame() const { return frame_; }
+	const batch_stats &stats() const { return st_; }
+
+private:
+	struct pend {
+		uint64_t key;		/* object << 32 | property */
+		uint64_t value;
+		bool always;
+	};
+
+	struct cached {
+		uint32_t id;
+		uint32_t used;		/* frame */
+		uint64_t salt;
+		std::vector<uint8_t> data;
+	};
+
+	/* What the ioctl copies in besides blobs */
+	static uint64_t req_bytes(uint32_t objs, uint32_t props)
+	{
+		return props ? sizeof(drm_mode_atomic) + 8ull * objs + 12ull * props : 0;
+	}
+
+	int sys(int ret)
+	{
+		cur_.ioctls++;
+		return ret;
+	}
+
+	int create(const void *p, uint32_t size, uint32_t *id)
+	{
+		drm_mode_create_blob cb;
+		int ret;
+
+		memset(&cb, 0, sizeof(cb));
+		cb.data = (uintptr_t)p;
+		cb.length = size;
+		ret = sys(io_(DRM_IOCTL_MODE_CREATEPROPBLOB, &cb));
+		if (ret)
+			return ret;
+		cur_.blobs_created++;
+		cur_.blob_bytes += size;
+		*id = cb.blob_id;
+		return 0;
+	}
+
+	void destroy(uint32_t id)
+	{
+		drm_mode_destroy_blob db = { id };
+
+		if (!sys(io_(DRM_IOCTL_MODE_DESTROYPROPBLOB, &db)))
+			cur_.blobs_destroyed++;
+	}
+
+	static bool same(const cached &e, const void *p, uint32_t size, uint64_t salt)
+	{
+		return e.salt == salt && e.data.size() == size && !memcmp(e.data.data(), p, size);
+	}
+
+	int lookup(uint64_t key, const void *p, uint32_t size, uint64_t salt, uint32_t *id)
+	{
+		auto b = bound_.find(key);
+		uint64_t h;
+		int ret;
+
+		/* Most blobs are what the property had last time: no hashing for those */
+		if (b != bound_.end()) {
+			auto it = cache_.find(b->second);
+
+			if (it != cache_.end() && same(it->second, p, size, salt)) {
+				it->second.used = now_;
+				*id = it->second.id;
+				return 0;
+			}
+		}
+
+		h = blob_hash(p, size, blob_hash(&salt, sizeof(salt)));
+		auto it = cache_.find(h);
+		if (it != cache_.end()) {
+			cached &e = it->second;
+
+			if (same(e, p, size, salt)) {
+				e.used = now_;
+				*id = e.id;
+				bound_[key] = h;
+				return 0;
+			}
+			/* Same hash, other bytes: not worth a second slot */
+			st_.collisions++;
+			ret = create(p, size, id);
+			if (!ret)
+				oneshot_.push_back(*id);
+			return ret;
+		}
+
+		ret = create(p, size, id);
+		if (ret)
+			return ret;
+		cached &e = cache_[h];
+		e.id = *id;
+		e.used = now_;
+		e.salt = salt;
+		e.data.assign(static_cast<const uint8_t *>(p), static_cast<const uint8_t *>(p) + size);
+		bound_[key] = h;
+		return 0;
+	}
+
+	/* Blobs unused for max_age frames, then the oldest past max_blobs */
+	void evict()
+	{
+		if (cache_.size() <= opts_.max_blobs && now_ % 16)
+			return;
+		for (auto it = cache_.begin(); it != cache_.end();) {
+			if (now_ - it->second.used > opts_.max_age) {
+				destroy(it->second.id);
+				it = cache_.erase(it);
+			} else {
+				++it;
+			}
+		}
+		while (cache_.size() > opts_.max_blobs) {
+			auto old = std::min_element(cache_.begin(), cache_.end(),
+						    [](const std::pair<const uint64_t, cached> &a,
+						       const std::pair<const uint64_t, cached> &b) {
+							    return a.second.used < b.second.used;
+						    });
+
+			destroy(old->second.id);
+			cache_.erase(old);
+		}
+	}
+
+	drm_ioctl_fn io_;
+	batch_opts opts_;
+	uint32_t now_ = 0;
+
+	std::vector<pend> pend_, sent_;
+	std::unordered_map<uint64_t, uint32_t> pidx_;
+	std::unordered_map<uint64_t, uint64_t> last_;
+	std::unordered_map<uint64_t, cached> cache_;
+	std::unordered_map<uint64_t, uint64_t> bound_;	/* property to its last blob's hash */
+	std::vector<uint32_t> oneshot_;		/* destroyed after the commit */
+
+	std::vector<uint32_t> objs_, counts_, props_;
+	std::vector<uint64_t> values_;
+
+	batch_frame cur_ = {}, frame_ = {};
+	batch_stats st_ = {};
+};
+
+} /* namespace sde */
+
+#endif /* __TOOLS_DISPLAY_COMMIT_BATCH_H__ */
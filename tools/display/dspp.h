@@ -0,0 +1,1113 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * CPU reference for the SDE destination surface processor (DSPP) colour
+ * chain, driven by the same msm_drm_pp.h structs userspace sets as CRTC
+ * properties, so a calibration can be rendered and compared without a
+ * panel.
+ *
+ * Pixels go through the blocks in hardware order:
+ *
+ *   IGC     per-component LUT, 8-bit input to 12-bit linear
+ *   PCC     per-output polynomial, first and second order terms
+ *   PA      memory colours, six-zone and global HSIC, in HSV
+ *   gamut   3D LUT, 17, 13 or 5 points per axis, tetrahedral
+ *   PGC     per-component 512-entry LUT, linearly interpolated
+ *   dither  4x4 ordered dither to the panel depth
+ *
+ * Everything between IGC and dither works on 12-bit integers.  Component
+ * tables follow the SDE order, c0 green, c1 blue, c2 red.  Where the uapi
+ * leaves an encoding to the hardware documentation, this is what is
+ * assumed:
+ *
+ *   PCC       coefficients s2.15 in the low 18 bits, 0x8000 is 1.0; c is
+ *             applied to full scale, so 0x8000 adds 4095
+ *   HSIC      hue s11 in the low 12 bits, a full turn; saturation and
+ *             contrast s.15 gains less one; value an s15 offset
+ *   six-zone  curve indexed by hue in 384 steps; p0 an s11 hue offset
+ *             in 1536ths of a turn, p1 s.11 saturation (low) and value
+ *             (high 16) gains less one; applied at or above threshold
+ *             saturation
+ *   memcol    hue_region hi << 16 | lo in 1536ths, wrapping if lo > hi;
+ *             sat_region, val_region 12-bit; p0 hue offset, p1, p2 s.15
+ *             saturation and value gains less one; prot_flags keep HSIC
+ *             and six-zone off the region
+ *   gamut     12-bit components, c2_c1 red << 16 | blue; entry n of the
+ *             r-major cube in col[n % 4][n / 4]; nodes 4096 / (N - 1)
+ *             apart
+ *   PGC, IGC  12-bit entries; PGC_8B_ROUND rounds PGC to 8 bits
+ *   dither    matrix entries 0..15; temporal_en steps the matrix
+ *             diagonally by one each frame
+ *
+ * Not modelled: PCC_BEFORE, IGC dither, six-zone adjust_p0/p1 and holds,
+ * memcol blend and holds, gamut scale_off (only used by the hardware to
+ * scale fine modes), DITHER_LUMA_MODE, and SPR: it rearranges subpixels
+ * for the panel layout rather than changing colour, and its uapi is
+ * opaque registers (drm_msm_spr_init_cfg cfg0..cfg17) with no meaning
+ * to go on.
+ *
+ * Frames are packed 8-bit RGB in and packed 16-bit RGB at the panel
+ * depth out.  Rows are cut into bands rendered in parallel; within a row
+ * DSPP_CHUNK pixels at a time go through every stage in planar 32-bit
+ * arrays.  With AVX2 every stage is vectorised, table lookups with
+ * gathers and PA's divisions as exact reciprocal multiplies.  NEON has
+ * no gathers: there PCC, dither and the final interleave are vectorised
+ * and load, PA, gamut and PGC fall back to the *_c stages.  The *_c
+ * stages are the reference the vector ones must match bit for bit.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_DISPLAY_DSPP_H__
+#define __TOOLS_DISPLAY_DSPP_H__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <display/drm/msm_drm_pp.h>
+
+namespace sde {
+
+#define DSPP_MAX		4095	/* 12-bit full scale */
+#define DSPP_HUE		1536	/* hue steps per turn, 256 per sextant */
+#define DSPP_CHUNK		256	/* pixels per pass through the stages */
+#define DSPP_BAND		16	/* rows per job */
+#define DSPP_PCC_TERMS		11	/* c, r, g, b, rg, gb, rb, rgb, rr, gg, bb */
+#define DSPP_GAMUT_NODES	(17 * 17 * 17)
+#define DSPP_MEMCOL		3	/* skin, sky, foliage */
+
+/* Blocks to run; IGC and dither always run, as identity and rounding */
+#define DSPP_PCC		(1 << 0)
+#define DSPP_PA			(1 << 1)
+#define DSPP_GAMUT		(1 << 2)
+#define DSPP_PGC		(1 << 3)
+
+/* The block configs as set on the CRTC; a null pointer is a block left off */
+struct dspp_config {
+	const drm_msm_igc_lut *igc = nullptr;
+	const drm_msm_pcc *pcc = nullptr;
+	const drm_msm_pa_hsic *hsic = nullptr;
+	const drm_msm_sixzone *sixzone = nullptr;
+	const drm_msm_memcol *memcol[DSPP_MEMCOL] = {};
+	const drm_msm_3d_gamut *gamut = nullptr;
+	const drm_msm_pgc_lut *pgc = nullptr;
+	const drm_msm_dither *dither = nullptr;
+	uint32_t bits = 8;		/* panel depth when there is no dither */
+};
+
+struct dspp_memcol {
+	int32_t hue_lo, hue_hi, sat_lo, sat_hi, val_lo, val_hi;
+	int32_t dh, ds, dv;
+	int32_t prot;
+};
+
+/* A config unpacked into the tables the stages use; r, g, b order */
+struct dspp {
+	uint32_t stages;
+	int32_t igc[3][256];
+	int32_t pcc[3][DSPP_PCC_TERMS];
+	uint32_t pcc_terms;		/* terms with a coefficient, bit per term */
+	/* PA */
+	int32_t hue, sat, val, cont;
+	int32_t sz_thresh;
+	int32_t sz_hue[SIXZONE_LUT_SIZE], sz_sat[SIXZONE_LUT_SIZE], sz_val[SIXZONE_LUT_SIZE];
+	uint32_t sz_hs[SIXZONE_LUT_SIZE];	/* hue << 16 | saturation, one gather for two */
+	uint32_t nmc;
+	dspp_memcol mc[DSPP_MEMCOL];
+	/* gamut */
+	int32_t grid;
+	int32_t gam[3][DSPP_GAMUT_NODES];
+	uint32_t gam_rg[DSPP_GAMUT_NODES];	/* green << 16 | red, one gather for two */
+	/* PGC, with a node past the end to interpolate the last step to */
+	int32_t pgc[3][PGC_TBL_LEN + 1];
+	uint32_t pgc_step[3][PGC_TBL_LEN];	/* next - this << 16 | this */
+	bool pgc_round;
+	/* dither: threshold per matrix entry, shift to and maximum at panel depth */
+	int32_t thr[3][DITHER_MATRIX_SZ];
+	int32_t shift[3], omax[3];
+	bool temporal;
+	uint32_t bits[3];
+};
+
+inline int32_t dspp_sext(uint32_t v, unsigned bits)
+{
+	return (int32_t)(v << (32 - bits)) >> (32 - bits);
+}
+
+inline int32_t dspp_clamp(int32_t v, int32_t lo, int32_t hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* SDE order c0, c1, c2 to r, g, b */
+static const int dspp_sde_comp[3] = { 1, 2, 0 };
+
+inline int dspp_prepare(const dspp_config &cfg, dspp *d)
+{
+	memset(d, 0, sizeof(*d));
+
+	/* IGC off passes input left-justified, so rounding back to 8 bits is exact */
+	for (int i = 0; i < 256; i++) {
+		for (int c = 0; c < 3; c++)
+			d->igc[c][i] = i << 4;
+	}
+	if (cfg.igc) {
+		const __u32 *t[3] = { cfg.igc->c0, cfg.igc->c1, cfg.igc->c2 };
+
+		for (int c = 0; c < 3; c++) {
+			for (int i = 0; i < IGC_TBL_LEN; i++)
+				d->igc[dspp_sde_comp[c]][i] = t[c][i] & DSPP_MAX;
+		}
+	}
+
+	if (cfg.pcc) {
+		const drm_msm_pcc *p = cfg.pcc;
+		const drm_msm_pcc_coeff *k[3] = { &p->r, &p->g, &p->b };
+		const __u32 sq[3][3] = {
+			{ p->r_rr, p->r_gg, p->r_bb },
+			{ p->g_rr, p->g_gg, p->g_bb },
+			{ p->b_rr, p->b_gg, p->b_bb },
+		};
+
+		for (int o = 0; o < 3; o++) {
+			const __u32 t[DSPP_PCC_TERMS] = {
+				k[o]->c, k[o]->r, k[o]->g, k[o]->b, k[o]->rg, k[o]->gb,
+				k[o]->rb, k[o]->rgb, sq[o][0], sq[o][1], sq[o][2],
+			};
+
+			for (int i = 0; i < DSPP_PCC_TERMS; i++) {
+				d->pcc[o][i] = dspp_sext(t[i], 18);
+				if (d->pcc[o][i])
+					d->pcc_terms |= 1u << i;
+			}
+		}
+		d->stages |= DSPP_PCC;
+	}
+
+	if (cfg.hsic) {
+		const drm_msm_pa_hsic *h = cfg.hsic;
+
+		if (h->flags & PA_HSIC_HUE_ENABLE)
+			d->hue = dspp_sext(h->hue, 12) * 3 / 8;
+		if (h->flags & PA_HSIC_SAT_ENABLE)
+			d->sat = dspp_sext(h->saturation, 16);
+		if (h->flags & PA_HSIC_VAL_ENABLE)
+			d->val = dspp_sext(h->value, 16);
+		if (h->flags & PA_HSIC_CONT_ENABLE)
+			d->cont = dspp_sext(h->contrast, 16);
+		d->stages |= DSPP_PA;
+	}
+
+	d->sz_thresh = DSPP_MAX + 1;
+	if (cfg.sixzone) {
+		const drm_msm_sixzone *z = cfg.sixzone;
+
+		for (int i = 0; i < SIXZONE_LUT_SIZE; i++) {
+			if (z->flags & SIXZONE_HUE_ENABLE)
+				d->sz_hue[i] = dspp_clamp(dspp_sext(z->curve[i].p0, 12),
+							  -DSPP_HUE / 2, DSPP_HUE / 2);
+			if (z->flags & SIXZONE_SAT_ENABLE)
+				d->sz_sat[i] = dspp_sext(z->curve[i].p1, 12);
+			if (z->flags & SIXZONE_VAL_ENABLE)
+				d->sz_val[i] = dspp_sext(z->curve[i].p1 >> 16, 12);
+			d->sz_hs[i] = (uint32_t)d->sz_hue[i] << 16 | (uint16_t)d->sz_sat[i];
+		}
+		d->sz_thresh = z->threshold & DSPP_MAX;
+		d->stages |= DSPP_PA;
+	}
+
+	for (int k = 0; k < DSPP_MEMCOL; k++) {
+		const drm_msm_memcol *m = cfg.memcol[k];
+		dspp_memcol *mc = &d->mc[d->nmc];
+
+		if (!m)
+			continue;
+		mc->hue_lo = std::min<int32_t>(m->hue_region & 0x7ff, DSPP_HUE - 1);
+		mc->hue_hi = std::min<int32_t>(m->hue_region >> 16 & 0x7ff, DSPP_HUE - 1);
+		mc->sat_lo = m->sat_region & DSPP_MAX;
+		mc->sat_hi = m->sat_region >> 16 & DSPP_MAX;
+		mc->val_lo = m->val_region & DSPP_MAX;
+		mc->val_hi = m->val_region >> 16 & DSPP_MAX;
+		mc->dh = dspp_clamp(dspp_sext(m->color_adjust_p0, 12), -DSPP_HUE / 2, DSPP_HUE / 2);
+		mc->ds = dspp_sext(m->color_adjust_p1, 16);
+		mc->dv = dspp_sext(m->color_adjust_p2, 16);
+		mc->prot = (int32_t)(m->prot_flags & (MEMCOL_PROT_HUE | MEMCOL_PROT_SAT |
+			   MEMCOL_PROT_VAL | MEMCOL_PROT_CONT | MEMCOL_PROT_SIXZONE));
+		d->nmc++;
+		d->stages |= DSPP_PA;
+	}
+
+	if (cfg.gamut && (cfg.gamut->flags & GAMUT_3D_MAP_EN)) {
+		const drm_msm_3d_gamut *g = cfg.gamut;
+
+		switch (g->mode) {
+		case GAMUT_3D_MODE_17:
+			d->grid = 17;
+			break;
+		case GAMUT_3D_MODE_13:
+			d->grid = 13;
+			break;
+		case GAMUT_3D_MODE_5:
+			d->grid = 5;
+			break;
+		default:
+			return -EINVAL;
+		}
+		for (int n = 0; n < d->grid * d->grid * d->grid; n++) {
+			const drm_msm_3d_col *e = &g->col[n % GAMUT_3D_TBL_NUM][n / GAMUT_3D_TBL_NUM];
+
+			d->gam[0][n] = e->c2_c1 >> 16 & DSPP_MAX;
+			d->gam[1][n] = e->c0 & DSPP_MAX;
+			d->gam[2][n] = e->c2_c1 & DSPP_MAX;
+			d->gam_rg[n] = (uint32_t)(d->gam[1][n] << 16 | d->gam[0][n]);
+		}
+		d->stages |= DSPP_GAMUT;
+	}
+
+	if (cfg.pgc) {
+		const __u32 *t[3] = { cfg.pgc->c0, cfg.pgc->c1, cfg.pgc->c2 };
+
+		for (int c = 0; c < 3; c++) {
+			int32_t *p = d->pgc[dspp_sde_comp[c]];
+
+			for (int i = 0; i < PGC_TBL_LEN; i++)
+				p[i] = t[c][i] & DSPP_MAX;
+			p[PGC_TBL_LEN] = dspp_clamp(2 * p[PGC_TBL_LEN - 1] - p[PGC_TBL_LEN - 2],
+						    0, DSPP_MAX);
+			for (int i = 0; i < PGC_TBL_LEN; i++)
+				d->pgc_step[dspp_sde_comp[c]][i] =
+					(uint32_t)(p[i + 1] - p[i]) << 16 | (uint32_t)p[i];
+		}
+		d->pgc_round = cfg.pgc->flags & PGC_8B_ROUND;
+		d->stages |= DSPP_PGC;
+	}
+
+	if (cfg.dither) {
+		const __u32 b[3] = { cfg.dither->c0_bitdepth, cfg.dither->c1_bitdepth,
+				     cfg.dither->c2_bitdepth };
+
+		for (int c = 0; c < 3; c++)
+			d->bits[dspp_sde_comp[c]] = b[c];
+		d->temporal = cfg.dither->temporal_en;
+	} else {
+		d->bits[0] = d->bits[1] = d->bits[2] = cfg.bits;
+	}
+	for (int c = 0; c < 3; c++) {
+		if (d->bits[c] < 1 || d->bits[c] > 12)
+			return -EINVAL;
+		d->shift[c] = 12 - d->bits[c];
+		d->omax[c] = (1 << d->bits[c]) - 1;
+		for (int i = 0; i < DITHER_MATRIX_SZ; i++) {
+			uint32_t m = cfg.dither ? cfg.dither->matrix[i] & 15 : 8;
+
+			d->thr[c][i] = (int32_t)(m << d->shift[c] >> 4);
+		}
+	}
+	return 0;
+}
+
+/* Unpack @n pixels through IGC, zero-filling up to a multiple of 8 */
+inline void dspp_load_c(const dspp &d, const uint8_t *src, int32_t *r, int32_t *g, int32_t *b,
+		      uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		r[i] = d.igc[0][src[3 * i]];
+		g[i] = d.igc[1][src[3 * i + 1]];
+		b[i] = d.igc[2][src[3 * i + 2]];
+	}
+	for (; i & 7; i++)
+		r[i] = g[i] = b[i] = 0;
+}
+
+inline void dspp_pcc_c(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		int32_t rg = r[i] * g[i] >> 12;
+		const int32_t x[DSPP_PCC_TERMS] = {
+			DSPP_MAX, r[i], g[i], b[i], rg, g[i] * b[i] >> 12,
+			r[i] * b[i] >> 12, rg * b[i] >> 12, r[i] * r[i] >> 12,
+			g[i] * g[i] >> 12, b[i] * b[i] >> 12,
+		};
+		int32_t out[3];
+
+		for (int o = 0; o < 3; o++) {
+			int32_t s = 0;
+
+			for (int t = 0; t < DSPP_PCC_TERMS; t++)
+				s += d.pcc[o][t] * x[t] >> 3;
+			out[o] = dspp_clamp((s + 2048) >> 12, 0, DSPP_MAX);
+		}
+		r[i] = out[0];
+		g[i] = out[1];
+		b[i] = out[2];
+	}
+}
+
+/* Offsets of the three components' ramps, and the ramp at @e, 0..256 */
+#define DSPP_HUE_R		(5 * 256)
+#define DSPP_HUE_G		(3 * 256)
+#define DSPP_HUE_B		(1 * 256)
+
+inline int32_t dspp_hsv_ramp(int32_t e)
+{
+	if (e >= DSPP_HUE)
+		e -= DSPP_HUE;
+	return dspp_clamp(std::min(e, 4 * 256 - e), 0, 256);
+}
+
+inline void dspp_pa_c(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		int32_t v0 = std::max(std::max(r[i], g[i]), b[i]);
+		int32_t c = v0 - std::min(std::min(r[i], g[i]), b[i]);
+		int32_t cc = std::max(c, 1), h0, s0, h, s, v, dh = 0, ds = 0, dv = 0, prot = 0;
+
+		s0 = c * DSPP_MAX / std::max(v0, 1);
+		if (v0 == r[i])
+			h0 = (g[i] - b[i]) * 256 / cc;
+		else if (v0 == g[i])
+			h0 = 512 + (b[i] - r[i]) * 256 / cc;
+		else
+			h0 = 1024 + (r[i] - g[i]) * 256 / cc;
+		if (h0 < 0)
+			h0 += DSPP_HUE;
+
+		/* memory colours qualify on the incoming HSV; overlaps add up */
+		for (uint32_t k = 0; k < d.nmc; k++) {
+			const dspp_memcol &mc = d.mc[k];
+			bool hue = mc.hue_lo <= mc.hue_hi ?
+				   h0 >= mc.hue_lo && h0 <= mc.hue_hi :
+				   h0 >= mc.hue_lo || h0 <= mc.hue_hi;
+
+			if (hue && s0 >= mc.sat_lo && s0 <= mc.sat_hi &&
+			    v0 >= mc.val_lo && v0 <= mc.val_hi) {
+				dh += mc.dh;
+				ds += mc.ds;
+				dv += mc.dv;
+				prot |= mc.prot;
+			}
+		}
+		h = h0 + dh;
+		s = s0 + (s0 * ds >> 15);
+		v = v0 + (v0 * dv >> 15);
+
+		if (!(prot & MEMCOL_PROT_SIXZONE) && s0 >= d.sz_thresh) {
+			int32_t k = h0 >> 2;
+
+			h += d.sz_hue[k];
+			s += s * d.sz_sat[k] >> 11;
+			v += v * d.sz_val[k] >> 11;
+		}
+		s = dspp_clamp(s, 0, DSPP_MAX);
+		v = dspp_clamp(v, 0, DSPP_MAX);
+
+		if (!(prot & MEMCOL_PROT_HUE))
+			h += d.hue;
+		if (!(prot & MEMCOL_PROT_SAT))
+			s = dspp_clamp(s * (32768 + d.sat) >> 15, 0, DSPP_MAX);
+		if (!(prot & MEMCOL_PROT_VAL))
+			v = dspp_clamp(v + d.val, 0, DSPP_MAX);
+		if (!(prot & MEMCOL_PROT_CONT))
+			v = dspp_clamp(((v - 2048) * (32768 + d.cont) >> 15) + 2048, 0, DSPP_MAX);
+
+		/* three half-turn offsets at most: bring h back into one turn */
+		h += 2 * DSPP_HUE;
+		for (int k = 0; k < 4; k++) {
+			if (h >= DSPP_HUE)
+				h -= DSPP_HUE;
+		}
+
+		/*
+		 * Chroma v * s / 4095, rounded, exactly; each component is v
+		 * less up to that much, ramping over the sextants next to the
+		 * opposite hue.
+		 */
+		c = v * s + 2047;
+		c = (c + (c >> 12) + 1) >> 12;
+		r[i] = v - (c * dspp_hsv_ramp(h + DSPP_HUE_R) >> 8);
+		g[i] = v - (c * dspp_hsv_ramp(h + DSPP_HUE_G) >> 8);
+		b[i] = v - (c * dspp_hsv_ramp(h + DSPP_HUE_B) >> 8);
+	}
+}
+
+/*
+ * Tetrahedral: walk from the cell's origin along the axis with the
+ * largest fraction, then the middle one, weighting the four corners by
+ * the steps between the sorted fractions.  Ties give the same weights
+ * whichever way they are broken.
+ */
+inline void dspp_gamut_c(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	const int32_t sr = d.grid * d.grid, sg = d.grid, sb = 1, all = sr + sg + sb;
+
+	for (uint32_t i = 0; i < n; i++) {
+		int32_t pr = r[i] * (d.grid - 1), pg = g[i] * (d.grid - 1), pb = b[i] * (d.grid - 1);
+		int32_t fr = pr & DSPP_MAX, fg = pg & DSPP_MAX, fb = pb & DSPP_MAX;
+		int32_t base = ((pr >> 12) * d.grid + (pg >> 12)) * d.grid + (pb >> 12);
+		int32_t f1 = std::max(std::max(fr, fg), fb), f3 = std::min(std::min(fr, fg), fb);
+		int32_t f2 = fr + fg + fb - f1 - f3;
+		int32_t a = fr >= fg && fr >= fb ? sr : fg >= fb ? sg : sb;
+		int32_t z = fr <= fg && fr <= fb ? sr : fg <= fb ? sg : sb;
+		int32_t out[3];
+
+		for (int c = 0; c < 3; c++) {
+			const int32_t *t = d.gam[c];
+
+			out[c] = ((4096 - f1) * t[base] + (f1 - f2) * t[base + a] +
+				  (f2 - f3) * t[base + all - z] + f3 * t[base + all] + 2048) >> 12;
+		}
+		r[i] = out[0];
+		g[i] = out[1];
+		b[i] = out[2];
+	}
+}
+
+inline void dspp_pgc_c(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	int32_t *px[3] = { r, g, b };
+
+	for (int c = 0; c < 3; c++) {
+		const int32_t *t = d.pgc[c];
+
+		for (uint32_t i = 0; i < n; i++) {
+			int32_t v = px[c][i], lo = t[v >> 3], hi = t[(v >> 3) + 1];
+
+			v = lo + (((hi - lo) * (v & 7) + 4) >> 3);
+			if (d.pgc_round)
+				v = std::min((v + 8) >> 4 << 4, DSPP_MAX);
+			px[c][i] = v;
+		}
+	}
+}
+
+/* Matrix entry for pixel @x of row @y in @frame */
+inline int dspp_dither_at(const dspp &d, uint32_t x, uint32_t y, uint32_t frame)
+{
+	uint32_t t = d.temporal ? frame : 0;
+
+	return (int)(((y + t) & 3) << 2 | ((x + t) & 3));
+}
+
+/* Dither to panel depth in place; @x is a multiple of 4 */
+inline void dspp_dither_c(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n,
+			  uint32_t x, uint32_t y, uint32_t frame)
+{
+	int32_t *px[3] = { r, g, b };
+
+	for (int c = 0; c < 3; c++) {
+		for (uint32_t i = 0; i < n; i++) {
+			int32_t t = d.thr[c][dspp_dither_at(d, x + i, y, frame)];
+
+			px[c][i] = std::min((px[c][i] + t) >> d.shift[c], d.omax[c]);
+		}
+	}
+}
+
+/* Interleave @n pixels at panel depth into packed 16-bit RGB */
+inline void dspp_store_c(const int32_t *r, const int32_t *g, const int32_t *b, uint16_t *dst,
+			 uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		dst[3 * i] = (uint16_t)r[i];
+		dst[3 * i + 1] = (uint16_t)g[i];
+		dst[3 * i + 2] = (uint16_t)b[i];
+	}
+}
+
+#if defined(__AVX2__)
+
+static const char dspp_isa[] = "avx2";
+
+static inline __m256i dspp_clamp8(__m256i v, __m256i hi)
+{
+	return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), hi);
+}
+
+/*
+ * a / b, exactly, for the quotients PA takes: a = c * 4095 or a = x * 256
+ * with c, x <= b <= 4095.  The reciprocal after one Newton step is
+ * biased low, so a * 1/b floors to the quotient or one below, and the
+ * remainder, exact in float at these sizes, says which.  Checked for
+ * every such a and b; no divide, which stalls the pipe.
+ */
+static inline __m256i dspp_udiv8(__m256i a, __m256i b)
+{
+	__m256 fa = _mm256_cvtepi32_ps(a), fb = _mm256_cvtepi32_ps(b);
+	__m256 r = _mm256_rcp_ps(fb), q;
+
+	r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(2.0f - 1.0f / (1 << 20)),
+					   _mm256_mul_ps(fb, r)));
+	q = _mm256_floor_ps(_mm256_mul_ps(fa, r));
+	q = _mm256_add_ps(q, _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(fa, _mm256_mul_ps(q, fb)),
+							 fb, _CMP_GE_OQ), _mm256_set1_ps(1.0f)));
+	return _mm256_cvttps_epi32(q);
+}
+
+/*
+ * Lanes of two 16-bit halves multiplied pairwise and summed: a 12-bit
+ * lane times a small one is a single madd, and so is a 12-bit x against
+ * an s2.15 coefficient once x is held as (x << 3) << 16 | x and the
+ * coefficient as (k >> 9 << 6) << 16 | (k & 511).
+ */
+static inline __m256i dspp_mul16(__m256i a, __m256i b)
+{
+	return _mm256_madd_epi16(a, b);
+}
+
+static inline __m256i dspp_hsv_ramp8(__m256i h, int32_t off)
+{
+	const __m256i turn = _mm256_set1_epi32(DSPP_HUE);
+	__m256i e = _mm256_add_epi32(h, _mm256_set1_epi32(off));
+
+	e = _mm256_sub_epi32(e, _mm256_andnot_si256(_mm256_cmpgt_epi32(turn, e), turn));
+	e = _mm256_min_epi32(e, _mm256_sub_epi32(_mm256_set1_epi32(4 * 256), e));
+	return _mm256_min_epi32(_mm256_max_epi32(e, _mm256_setzero_si256()),
+				_mm256_set1_epi32(256));
+}
+
+inline void dspp_load(const dspp &d, const uint8_t *src, int32_t *r, int32_t *g, int32_t *b,
+		      uint32_t n)
+{
+	/* four pixels per 128-bit lane, each component to its own dword */
+	const __m256i sel[3] = {
+		_mm256_broadcastsi128_si256(_mm_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1,
+							  6, -1, -1, -1, 9, -1, -1, -1)),
+		_mm256_broadcastsi128_si256(_mm_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1,
+							  7, -1, -1, -1, 10, -1, -1, -1)),
+		_mm256_broadcastsi128_si256(_mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1,
+							  8, -1, -1, -1, 11, -1, -1, -1)),
+	};
+	int32_t *px[3] = { r, g, b };
+	uint32_t i = 0;
+
+	/* the second half reads four bytes past its pixels */
+	for (; i + 10 <= n; i += 8) {
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)(src + 3 * i))),
+				_mm_loadu_si128((const __m128i *)(src + 3 * i + 12)), 1);
+
+		for (int c = 0; c < 3; c++)
+			_mm256_store_si256((__m256i *)(px[c] + i), _mm256_i32gather_epi32(
+				d.igc[c], _mm256_shuffle_epi8(v, sel[c]), 4));
+	}
+	dspp_load_c(d, src + 3 * i, r + i, g + i, b + i, n - i);
+}
+
+inline void dspp_pcc(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	const __m256i max = _mm256_set1_epi32(DSPP_MAX), half = _mm256_set1_epi32(2048);
+	__m256i k[3][DSPP_PCC_TERMS];
+	int terms[DSPP_PCC_TERMS], nt = 0;
+
+	for (int t = 0; t < DSPP_PCC_TERMS; t++) {
+		if (!(d.pcc_terms & 1u << t))
+			continue;
+		for (int o = 0; o < 3; o++)
+			k[o][nt] = _mm256_set1_epi32((int32_t)((uint32_t)(d.pcc[o][t] >> 9) << 22 |
+							       (uint32_t)(d.pcc[o][t] & 511)));
+		terms[nt++] = t;
+	}
+	for (uint32_t i = 0; i < n; i += 8) {
+		__m256i vr = _mm256_load_si256((const __m256i *)(r + i));
+		__m256i vg = _mm256_load_si256((const __m256i *)(g + i));
+		__m256i vb = _mm256_load_si256((const __m256i *)(b + i));
+		__m256i rg = _mm256_srai_epi32(dspp_mul16(vr, vg), 12);
+		__m256i x[DSPP_PCC_TERMS] = {
+			max, vr, vg, vb, rg,
+			_mm256_srai_epi32(dspp_mul16(vg, vb), 12),
+			_mm256_srai_epi32(dspp_mul16(vr, vb), 12),
+			_mm256_srai_epi32(dspp_mul16(rg, vb), 12),
+			_mm256_srai_epi32(dspp_mul16(vr, vr), 12),
+			_mm256_srai_epi32(dspp_mul16(vg, vg), 12),
+			_mm256_srai_epi32(dspp_mul16(vb, vb), 12),
+		};
+		__m256i sr = _mm256_setzero_si256(), sg = sr, sb = sr;
+
+		for (int j = 0; j < nt; j++) {
+			__m256i xj = x[terms[j]];
+
+			xj = _mm256_or_si256(xj, _mm256_slli_epi32(xj, 19));
+			sr = _mm256_add_epi32(sr, _mm256_srai_epi32(dspp_mul16(xj, k[0][j]), 3));
+			sg = _mm256_add_epi32(sg, _mm256_srai_epi32(dspp_mul16(xj, k[1][j]), 3));
+			sb = _mm256_add_epi32(sb, _mm256_srai_epi32(dspp_mul16(xj, k[2][j]), 3));
+		}
+		sr = _mm256_srai_epi32(_mm256_add_epi32(sr, half), 12);
+		sg = _mm256_srai_epi32(_mm256_add_epi32(sg, half), 12);
+		sb = _mm256_srai_epi32(_mm256_add_epi32(sb, half), 12);
+		_mm256_store_si256((__m256i *)(r + i), dspp_clamp8(sr, max));
+		_mm256_store_si256((__m256i *)(g + i), dspp_clamp8(sg, max));
+		_mm256_store_si256((__m256i *)(b + i), dspp_clamp8(sb, max));
+	}
+}
+
+inline void dspp_pa(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi32(1);
+	const __m256i max = _mm256_set1_epi32(DSPP_MAX), turn = _mm256_set1_epi32(DSPP_HUE);
+	const __m256i mid = _mm256_set1_epi32(2048);
+	const __m256i sz_thresh = _mm256_set1_epi32(d.sz_thresh);
+	const __m256i hue = _mm256_set1_epi32(d.hue), val = _mm256_set1_epi32(d.val);
+	const __m256i sat = _mm256_set1_epi32(32768 + d.sat);
+	const __m256i cont = _mm256_set1_epi32(32768 + d.cont);
+
+	for (uint32_t i = 0; i < n; i += 8) {
+		__m256i vr = _mm256_load_si256((const __m256i *)(r + i));
+		__m256i vg = _mm256_load_si256((const __m256i *)(g + i));
+		__m256i vb = _mm256_load_si256((const __m256i *)(b + i));
+		__m256i v0 = _mm256_max_epi32(_mm256_max_epi32(vr, vg), vb);
+		__m256i c = _mm256_sub_epi32(v0, _mm256_min_epi32(_mm256_min_epi32(vr, vg), vb));
+		__m256i s0 = dspp_udiv8(_mm256_sub_epi32(_mm256_slli_epi32(c, 12), c),
+					_mm256_max_epi32(v0, one));
+		__m256i is_r = _mm256_cmpeq_epi32(v0, vr);
+		__m256i is_g = _mm256_andnot_si256(is_r, _mm256_cmpeq_epi32(v0, vg));
+		__m256i num, base, h0, h, s, v, dh = zero, ds = zero, dv = zero, prot = zero;
+
+		num = _mm256_blendv_epi8(_mm256_sub_epi32(vr, vg), _mm256_sub_epi32(vb, vr), is_g);
+		num = _mm256_slli_epi32(_mm256_blendv_epi8(num, _mm256_sub_epi32(vg, vb), is_r), 8);
+		base = _mm256_blendv_epi8(_mm256_set1_epi32(1024), _mm256_set1_epi32(512), is_g);
+		base = _mm256_andnot_si256(is_r, base);
+		/* truncated towards zero, as C's division */
+		h0 = _mm256_sign_epi32(dspp_udiv8(_mm256_abs_epi32(num), _mm256_max_epi32(c, one)),
+				       num);
+		h0 = _mm256_add_epi32(base, h0);
+		h0 = _mm256_add_epi32(h0, _mm256_and_si256(_mm256_cmpgt_epi32(zero, h0), turn));
+
+		for (uint32_t k = 0; k < d.nmc; k++) {
+			const dspp_memcol &mc = d.mc[k];
+			__m256i lt_lo = _mm256_cmpgt_epi32(_mm256_set1_epi32(mc.hue_lo), h0);
+			__m256i gt_hi = _mm256_cmpgt_epi32(h0, _mm256_set1_epi32(mc.hue_hi));
+			__m256i out;
+
+			/* out of the region, as in dspp_pa_c but inverted */
+			if (mc.hue_lo <= mc.hue_hi)
+				out = _mm256_or_si256(lt_lo, gt_hi);
+			else
+				out = _mm256_and_si256(lt_lo, gt_hi);
+			out = _mm256_or_si256(out, _mm256_or_si256(
+				_mm256_cmpgt_epi32(_mm256_set1_epi32(mc.sat_lo), s0),
+				_mm256_cmpgt_epi32(s0, _mm256_set1_epi32(mc.sat_hi))));
+			out = _mm256_or_si256(out, _mm256_or_si256(
+				_mm256_cmpgt_epi32(_mm256_set1_epi32(mc.val_lo), v0),
+				_mm256_cmpgt_epi32(v0, _mm256_set1_epi32(mc.val_hi))));
+			dh = _mm256_add_epi32(dh, _mm256_andnot_si256(out, _mm256_set1_epi32(mc.dh)));
+			ds = _mm256_add_epi32(ds, _mm256_andnot_si256(out, _mm256_set1_epi32(mc.ds)));
+			dv = _mm256_add_epi32(dv, _mm256_andnot_si256(out, _mm256_set1_epi32(mc.dv)));
+			prot = _mm256_or_si256(prot, _mm256_andnot_si256(out,
+							_mm256_set1_epi32(mc.prot)));
+		}
+		h = _mm256_add_epi32(h0, dh);
+		s = _mm256_add_epi32(s0, _mm256_srai_epi32(_mm256_mullo_epi32(s0, ds), 15));
+		v = _mm256_add_epi32(v0, _mm256_srai_epi32(_mm256_mullo_epi32(v0, dv), 15));
+
+		if (d.sz_thresh <= DSPP_MAX) {
+			__m256i on = _mm256_andnot_si256(
+				_mm256_cmpgt_epi32(sz_thresh, s0),
+				_mm256_cmpeq_epi32(_mm256_and_si256(prot,
+					_mm256_set1_epi32(MEMCOL_PROT_SIXZONE)), zero));
+			__m256i k = _mm256_srli_epi32(h0, 2);
+			__m256i hs = _mm256_i32gather_epi32((const int *)d.sz_hs, k, 4);
+			__m256i zh = _mm256_srai_epi32(hs, 16);
+			__m256i zs = _mm256_srai_epi32(_mm256_slli_epi32(hs, 16), 16);
+			__m256i zv = _mm256_i32gather_epi32(d.sz_val, k, 4);
+
+			h = _mm256_add_epi32(h, _mm256_and_si256(on, zh));
+			s = _mm256_add_epi32(s, _mm256_and_si256(on,
+				_mm256_srai_epi32(_mm256_mullo_epi32(s, zs), 11)));
+			v = _mm256_add_epi32(v, _mm256_and_si256(on,
+				_mm256_srai_epi32(_mm256_mullo_epi32(v, zv), 11)));
+		}
+		s = dspp_clamp8(s, max);
+		v = dspp_clamp8(v, max);
+
+#define DSPP_UNPROT(bit) \
+	_mm256_cmpeq_epi32(_mm256_and_si256(prot, _mm256_set1_epi32(bit)), zero)
+		h = _mm256_add_epi32(h, _mm256_and_si256(DSPP_UNPROT(MEMCOL_PROT_HUE), hue));
+		s = _mm256_blendv_epi8(s, dspp_clamp8(_mm256_srai_epi32(
+				_mm256_mullo_epi32(s, sat), 15), max), DSPP_UNPROT(MEMCOL_PROT_SAT));
+		v = _mm256_blendv_epi8(v, dspp_clamp8(_mm256_add_epi32(v, val), max),
+				       DSPP_UNPROT(MEMCOL_PROT_VAL));
+		v = _mm256_blendv_epi8(v, dspp_clamp8(_mm256_add_epi32(_mm256_srai_epi32(
+				_mm256_mullo_epi32(_mm256_sub_epi32(v, mid), cont), 15), mid), max),
+				       DSPP_UNPROT(MEMCOL_PROT_CONT));
+#undef DSPP_UNPROT
+
+		h = _mm256_add_epi32(h, _mm256_add_epi32(turn, turn));
+		for (int k = 0; k < 4; k++)
+			h = _mm256_sub_epi32(h, _mm256_andnot_si256(_mm256_cmpgt_epi32(turn, h),
+								    turn));
+
+		c = _mm256_add_epi32(dspp_mul16(v, s), _mm256_set1_epi32(2047));
+		c = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(c, _mm256_srli_epi32(c, 12)),
+						       one), 12);
+		_mm256_store_si256((__m256i *)(r + i), _mm256_sub_epi32(v, _mm256_srai_epi32(
+					dspp_mul16(c, dspp_hsv_ramp8(h, DSPP_HUE_R)), 8)));
+		_mm256_store_si256((__m256i *)(g + i), _mm256_sub_epi32(v, _mm256_srai_epi32(
+					dspp_mul16(c, dspp_hsv_ramp8(h, DSPP_HUE_G)), 8)));
+		_mm256_store_si256((__m256i *)(b + i), _mm256_sub_epi32(v, _mm256_srai_epi32(
+					dspp_mul16(c, dspp_hsv_ramp8(h, DSPP_HUE_B)), 8)));
+	}
+}
+
+inline void dspp_gamut(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	const __m256i grid = _mm256_set1_epi32(d.grid), step = _mm256_set1_epi32(d.grid - 1);
+	const __m256i frac = _mm256_set1_epi32(DSPP_MAX), half = _mm256_set1_epi32(2048);
+	const __m256i sr = _mm256_set1_epi32(d.grid * d.grid), sg = grid, sb = _mm256_set1_epi32(1);
+	const __m256i all = _mm256_set1_epi32(d.grid * d.grid + d.grid + 1);
+	const __m256i four_k = _mm256_set1_epi32(4096);
+	const int *rg = (const int *)d.gam_rg;
+
+	for (uint32_t i = 0; i < n; i += 8) {
+		__m256i pr = _mm256_mullo_epi32(_mm256_load_si256((const __m256i *)(r + i)), step);
+		__m256i pg = _mm256_mullo_epi32(_mm256_load_si256((const __m256i *)(g + i)), step);
+		__m256i pb = _mm256_mullo_epi32(_mm256_load_si256((const __m256i *)(b + i)), step);
+		__m256i fr = _mm256_and_si256(pr, frac), fg = _mm256_and_si256(pg, frac);
+		__m256i fb = _mm256_and_si256(pb, frac);
+		__m256i base = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(
+			_mm256_mullo_epi32(_mm256_srli_epi32(pr, 12), grid),
+			_mm256_srli_epi32(pg, 12)), grid), _mm256_srli_epi32(pb, 12));
+		__m256i f1 = _mm256_max_epi32(_mm256_max_epi32(fr, fg), fb);
+		__m256i f3 = _mm256_min_epi32(_mm256_min_epi32(fr, fg), fb);
+		__m256i f2 = _mm256_sub_epi32(_mm256_add_epi32(_mm256_add_epi32(fr, fg), fb),
+					      _mm256_add_epi32(f1, f3));
+		__m256i a = _mm256_blendv_epi8(sg, sb, _mm256_cmpgt_epi32(fb, fg));
+		__m256i z = _mm256_blendv_epi8(sg, sb, _mm256_cmpgt_epi32(fg, fb));
+		__m256i ia, ib, ic, w01, w23, rg0, rga, rgb, rgc, b0, ba, bb, bc, p01[3], p23[3];
+		int32_t *out[3] = { r, g, b };
+
+		a = _mm256_blendv_epi8(sr, a, _mm256_or_si256(_mm256_cmpgt_epi32(fg, fr),
+							      _mm256_cmpgt_epi32(fb, fr)));
+		z = _mm256_blendv_epi8(sr, z, _mm256_or_si256(_mm256_cmpgt_epi32(fr, fg),
+							      _mm256_cmpgt_epi32(fr, fb)));
+		ia = _mm256_add_epi32(base, a);
+		ib = _mm256_sub_epi32(_mm256_add_epi32(base, all), z);
+		ic = _mm256_add_epi32(base, all);
+
+		/* corner weights paired as w1 << 16 | w0 and w3 << 16 | w2 */
+		w01 = _mm256_or_si256(_mm256_sub_epi32(four_k, f1),
+				      _mm256_slli_epi32(_mm256_sub_epi32(f1, f2), 16));
+		w23 = _mm256_or_si256(_mm256_sub_epi32(f2, f3), _mm256_slli_epi32(f3, 16));
+
+		rg0 = _mm256_i32gather_epi32(rg, base, 4);
+		rga = _mm256_i32gather_epi32(rg, ia, 4);
+		rgb = _mm256_i32gather_epi32(rg, ib, 4);
+		rgc = _mm256_i32gather_epi32(rg, ic, 4);
+		b0 = _mm256_i32gather_epi32(d.gam[2], base, 4);
+		ba = _mm256_i32gather_epi32(d.gam[2], ia, 4);
+		bb = _mm256_i32gather_epi32(d.gam[2], ib, 4);
+		bc = _mm256_i32gather_epi32(d.gam[2], ic, 4);
+
+		p01[0] = _mm256_blend_epi16(rg0, _mm256_slli_epi32(rga, 16), 0xaa);
+		p23[0] = _mm256_blend_epi16(rgb, _mm256_slli_epi32(rgc, 16), 0xaa);
+		p01[1] = _mm256_blend_epi16(_mm256_srli_epi32(rg0, 16), rga, 0xaa);
+		p23[1] = _mm256_blend_epi16(_mm256_srli_epi32(rgb, 16), rgc, 0xaa);
+		p01[2] = _mm256_or_si256(b0, _mm256_slli_epi32(ba, 16));
+		p23[2] = _mm256_or_si256(bb, _mm256_slli_epi32(bc, 16));
+		for (int c = 0; c < 3; c++)
+			_mm256_store_si256((__m256i *)(out[c] + i), _mm256_srai_epi32(
+				_mm256_add_epi32(_mm256_add_epi32(dspp_mul16(p01[c], w01),
+					dspp_mul16(p23[c], w23)), half), 12));
+	}
+}
+
+inline void dspp_pgc(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	const __m256i seven = _mm256_set1_epi32(7), four = _mm256_set1_epi32(4);
+	const __m256i max = _mm256_set1_epi32(DSPP_MAX), eight = _mm256_set1_epi32(8);
+	const __m256i mask = _mm256_set1_epi32(~15);
+	int32_t *px[3] = { r, g, b };
+
+	for (int c = 0; c < 3; c++) {
+		const int *t = (const int *)d.pgc_step[c];
+
+		/* this * 8 + step * frac from one entry: (frac << 16 | 8) against it */
+		for (uint32_t i = 0; i < n; i += 8) {
+			__m256i v = _mm256_load_si256((const __m256i *)(px[c] + i));
+			__m256i e = _mm256_i32gather_epi32(t, _mm256_srli_epi32(v, 3), 4);
+
+			v = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(v, seven), 16), eight);
+			v = _mm256_srai_epi32(_mm256_add_epi32(dspp_mul16(e, v), four), 3);
+			if (d.pgc_round)
+				v = _mm256_min_epi32(_mm256_and_si256(_mm256_add_epi32(v, eight), mask),
+						     max);
+			_mm256_store_si256((__m256i *)(px[c] + i), v);
+		}
+	}
+}
+
+inline void dspp_dither(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n,
+			uint32_t x, uint32_t y, uint32_t frame)
+{
+	int32_t *px[3] = { r, g, b };
+
+	for (int c = 0; c < 3; c++) {
+		int32_t t[8];
+		__m256i thr, omax = _mm256_set1_epi32(d.omax[c]);
+		__m128i shift = _mm_cvtsi32_si128(d.shift[c]);
+
+		for (int k = 0; k < 8; k++)
+			t[k] = d.thr[c][dspp_dither_at(d, x + k, y, frame)];
+		thr = _mm256_loadu_si256((const __m256i *)t);
+		for (uint32_t i = 0; i < n; i += 8) {
+			__m256i v = _mm256_load_si256((const __m256i *)(px[c] + i));
+
+			v = _mm256_min_epi32(_mm256_sra_epi32(_mm256_add_epi32(v, thr), shift), omax);
+			_mm256_store_si256((__m256i *)(px[c] + i), v);
+		}
+	}
+}
+
+inline void dspp_store(const int32_t *r, const int32_t *g, const int32_t *b, uint16_t *dst,
+		       uint32_t n)
+{
+	/* per 128-bit lane: r0-3 g0-3 and b0-3 twice to r0 g0 b0 ... b3 */
+	const __m256i rg_lo = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		0, 1, 8, 9, -1, -1, 2, 3, 10, 11, -1, -1, 4, 5, 12, 13));
+	const __m256i b_lo = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		-1, -1, -1, -1, 0, 1, -1, -1, -1, -1, 2, 3, -1, -1, -1, -1));
+	const __m256i rg_hi = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		-1, -1, 6, 7, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+	const __m256i b_hi = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		4, 5, -1, -1, -1, -1, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1));
+	uint32_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i rg = _mm256_packus_epi32(_mm256_load_si256((const __m256i *)(r + i)),
+						 _mm256_load_si256((const __m256i *)(g + i)));
+		__m256i bb = _mm256_load_si256((const __m256i *)(b + i));
+		__m256i lo, hi;
+
+		bb = _mm256_packus_epi32(bb, bb);
+		lo = _mm256_or_si256(_mm256_shuffle_epi8(rg, rg_lo), _mm256_shuffle_epi8(bb, b_lo));
+		hi = _mm256_or_si256(_mm256_shuffle_epi8(rg, rg_hi), _mm256_shuffle_epi8(bb, b_hi));
+		_mm_storeu_si128((__m128i *)(dst + 3 * i), _mm256_castsi256_si128(lo));
+		_mm_storel_epi64((__m128i *)(dst + 3 * i + 8), _mm256_castsi256_si128(hi));
+		_mm_storeu_si128((__m128i *)(dst + 3 * i + 12), _mm256_extracti128_si256(lo, 1));
+		_mm_storel_epi64((__m128i *)(dst + 3 * i + 20), _mm256_extracti128_si256(hi, 1));
+	}
+	dspp_store_c(r + i, g + i, b + i, dst + 3 * i, n - i);
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static const char dspp_isa[] = "neon";
+
+/* No gathers: load, PA, gamut and PGC are the C stages */
+inline void dspp_load(const dspp &d, const uint8_t *src, int32_t *r, int32_t *g, int32_t *b,
+		      uint32_t n)
+{
+	dspp_load_c(d, src, r, g, b, n);
+}
+
+inline void dspp_pcc(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	const int32x4_t zero = vdupq_n_s32(0), max = vdupq_n_s32(DSPP_MAX);
+	const int32x4_t half = vdupq_n_s32(2048);
+
+	for (uint32_t i = 0; i < n; i += 4) {
+		int32x4_t vr = vld1q_s32(r + i), vg = vld1q_s32(g + i), vb = vld1q_s32(b + i);
+		int32x4_t rg = vshrq_n_s32(vmulq_s32(vr, vg), 12);
+		const int32x4_t x[DSPP_PCC_TERMS] = {
+			max, vr, vg, vb, rg,
+			vshrq_n_s32(vmulq_s32(vg, vb), 12),
+			vshrq_n_s32(vmulq_s32(vr, vb), 12),
+			vshrq_n_s32(vmulq_s32(rg, vb), 12),
+			vshrq_n_s32(vmulq_s32(vr, vr), 12),
+			vshrq_n_s32(vmulq_s32(vg, vg), 12),
+			vshrq_n_s32(vmulq_s32(vb, vb), 12),
+		};
+		int32_t *out[3] = { r, g, b };
+
+		for (int o = 0; o < 3; o++) {
+			int32x4_t s = zero;
+
+			for (int t = 0; t < DSPP_PCC_TERMS; t++)
+				s = vaddq_s32(s, vshrq_n_s32(vmulq_n_s32(x[t], d.pcc[o][t]), 3));
+			s = vshrq_n_s32(vaddq_s32(s, half), 12);
+			vst1q_s32(out[o] + i, vminq_s32(vmaxq_s32(s, zero), max));
+		}
+	}
+}
+
+inline void dspp_pa(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	dspp_pa_c(d, r, g, b, n);
+}
+
+inline void dspp_gamut(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	dspp_gamut_c(d, r, g, b, n);
+}
+
+inline void dspp_pgc(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	dspp_pgc_c(d, r, g, b, n);
+}
+
+inline void dspp_dither(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n,
+			uint32_t x, uint32_t y, uint32_t frame)
+{
+	int32_t *px[3] = { r, g, b };
+
+	for (int c = 0; c < 3; c++) {
+		int32_t t[4];
+		int32x4_t thr, omax = vdupq_n_s32(d.omax[c]), shift = vdupq_n_s32(-d.shift[c]);
+
+		for (int k = 0; k < 4; k++)
+			t[k] = d.thr[c][dspp_dither_at(d, x + k, y, frame)];
+		thr = vld1q_s32(t);
+		for (uint32_t i = 0; i < n; i += 4)
+			vst1q_s32(px[c] + i, vminq_s32(vshlq_s32(vaddq_s32(vld1q_s32(px[c] + i),
+								thr), shift), omax));
+	}
+}
+
+inline void dspp_store(const int32_t *r, const int32_t *g, const int32_t *b, uint16_t *dst,
+		       uint32_t n)
+{
+	uint32_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		const int32_t *px[3] = { r + i, g + i, b + i };
+		uint16x8x3_t v;
+
+		for (int c = 0; c < 3; c++)
+			v.val[c] = vcombine_u16(vqmovun_s32(vld1q_s32(px[c])),
+						vqmovun_s32(vld1q_s32(px[c] + 4)));
+		vst3q_u16(dst + 3 * i, v);
+	}
+	dspp_store_c(r + i, g + i, b + i, dst + 3 * i, n - i);
+}
+
+#else
+
+static const char dspp_isa[] = "c";
+
+inline void dspp_load(const dspp &d, const uint8_t *src, int32_t *r, int32_t *g, int32_t *b,
+		      uint32_t n)
+{
+	dspp_load_c(d, src, r, g, b, n);
+}
+
+inline void dspp_pcc(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	dspp_pcc_c(d, r, g, b, n);
+}
+
+inline void dspp_pa(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	dspp_pa_c(d, r, g, b, n);
+}
+
+inline void dspp_gamut(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	dspp_gamut_c(d, r, g, b, n);
+}
+
+inline void dspp_pgc(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n)
+{
+	dspp_pgc_c(d, r, g, b, n);
+}
+
+inline void dspp_dither(const dspp &d, int32_t *r, int32_t *g, int32_t *b, uint32_t n,
+			uint32_t x, uint32_t y, uint32_t frame)
+{
+	dspp_dither_c(d, r, g, b, n, x, y, frame);
+}
+
+inline void dspp_store(const int32_t *r, const int32_t *g, const int32_t *b, uint16_t *dst,
+		       uint32_t n)
+{
+	dspp_store_c(r, g, b, dst, n);
+}
+
+#endif
+
+/* Render rows [@y0, @y1); @ref runs the C stages only */
+inline void dspp_rows(const dspp &d, const uint8_t *src, size_t src_stride, uint16_t *dst,
+		      size_t dst_stride, uint32_t width, uint32_t y0, uint32_t y1,
+		      uint32_t frame, bool ref)
+{
+	alignas(32) int32_t px[3][DSPP_CHUNK];
+	int32_t *r = px[0], *g = px[1], *b = px[2];
+
+	for (uint32_t y = y0; y < y1; y++) {
+		const uint8_t *s = src + y * src_stride;
+		uint16_t *o = dst + y * dst_stride;
+
+		for (uint32_t x = 0; x < width; x += DSPP_CHUNK) {
+			uint32_t n = std::min<uint32_t>(DSPP_CHUNK, width - x);
+			uint32_t n8 = (n + 7) & ~7u;
+
+			if (ref) {
+				dspp_load_c(d, s + 3 * x, r, g, b, n);
+				if (d.stages & DSPP_PCC)
+					dspp_pcc_c(d, r, g, b, n8);
+				if (d.stages & DSPP_PA)
+					dspp_pa_c(d, r, g, b, n8);
+				if (d.stages & DSPP_GAMUT)
+					dspp_gamut_c(d, r, g, b, n8);
+				if (d.stages & DSPP_PGC)
+					dspp_pgc_c(d, r, g, b, n8);
+				dspp_dither_c(d, r, g, b, n8, x, y, frame);
+				dspp_store_c(r, g, b, o + 3 * x, n);
+			} else {
+				dspp_load(d, s + 3 * x, r, g, b, n);
+				if (d.stages & DSPP_PCC)
+					dspp_pcc(d, r, g, b, n8);
+				if (d.stages & DSPP_PA)
+					dspp_pa(d, r, g, b, n8);
+				if (d.stages & DSPP_GAMUT)
+					dspp_gamut(d, r, g, b, n8);
+				if (d.stages & DSPP_PGC)
+					dspp_pgc(d, r, g, b, n8);
+				dspp_dither(d, r, g, b, n8, x, y, frame);
+				dspp_store(r, g, b, o + 3 * x, n);
+			}
+		}
+	}
+}
+
+/*
+ * Render a @width x @height frame, packed RGB888 in, packed 16-bit RGB
+ * out, strides in elements.  Bands of DSPP_BAND rows go to @jobs
+ * threads; @frame only matters to temporal dither.
+ */
+inline void dspp_render(const dspp &d, const uint8_t *src, size_t src_stride, uint16_t *dst,
+			size_t dst_stride, uint32_t width, uint32_t height, uint32_t frame,
+			unsigned jobs, bool ref = false)
+{
+	uint32_t bands = (height + DSPP_BAND - 1) / DSPP_BAND;
+	std::atomic<uint32_t> next(0);
+	std::vector<std::thread> pool;
+	auto worker = [&]() {
+		for (uint32_t i; (i = next++) < bands;)
+			dspp_rows(d, src, src_stride, dst, dst_stride, width, i * DSPP_BAND,
+				  std::min(height, (i + 1) * DSPP_BAND), frame, ref);
+	};
+
+	jobs = std::max(1u, std::min(jobs, bands));
+	for (unsigned j = 1; j < jobs; j++)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &t : pool)
+		t.join();
+}
+
+} /* namespace sde */
+
+#endif /* __TOOLS_DISPLAY_DSPP_H__ */
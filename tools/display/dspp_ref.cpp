@@ -0,0 +1,650 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Render frames through a CPU reference of the DSPP colour chain, from
+ * the msm_drm_pp.h structs a calibration would set on the CRTC.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -I../../kernel-headers -o dspp_ref dspp_ref.cpp
+ * Usage: dspp_ref [-i igc] [-p pcc] [-s hsic] [-z sixzone] [-m memcol]...
+ *                 [-g gamut] [-l pgc] [-d dither] [-o bits] [-f frame]
+ *                 [-j jobs] [-r expect.ppm] <in.ppm> [out.ppm]
+ *        dspp_ref -b [-S WxH] [-n frames] [-j jobs] [-w dir]
+ *
+ * Every config is a file holding exactly one struct of that block, as
+ * passed to the CRTC property: drm_msm_igc_lut, drm_msm_pcc,
+ * drm_msm_pa_hsic, drm_msm_sixzone, up to three drm_msm_memcol (skin,
+ * sky, foliage, in that order), drm_msm_3d_gamut, drm_msm_pgc_lut and
+ * drm_msm_dither.  A block without a file is off.  The input is a binary
+ * 8-bit PPM; the output a PPM at the panel depth, from the dither
+ * config or -o (default 8), at frame -f for temporal dither.  The FNV-1a
+ * hash of the output is printed to pin a config's result in a
+ * regression test, and -r compares it against an expected PPM,
+ * reporting the pixels that differ and by how much, failing if any do.
+ * -j is the number of render threads (default all CPUs).
+ *
+ * -b checks the vector stages against the C ones, bit for bit, on random
+ * frames with both plausible and garbage configs and on every edge of
+ * the band and chunk split, then times -n (default 60) frames of -S
+ * (default 1080x2400) with every block on, through the C stages on one
+ * thread and the vector ones on one and on -j threads.  -w also writes
+ * the plausible configs it uses to <dir>/<block>.bin, as a start for a
+ * hand-made one.
+ *
+ * Example:
+ *   dspp_ref -g panel-gamut.bin -l panel-pgc.bin -d dither6.bin in.ppm out.ppm
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dspp.h"
+
+using namespace sde;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static uint64_t fnv1a64(const void *p, size_t len)
+{
+	const uint8_t *b = (const uint8_t *)p;
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= b[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+static int parse_size(const char *s, uint32_t *w, uint32_t *h)
+{
+	char *end;
+
+	*w = (uint32_t)strtoul(s, &end, 0);
+	if (*end != 'x' || !*w)
+		return -EINVAL;
+	*h = (uint32_t)strtoul(end + 1, &end, 0);
+	return *end || !*h ? -EINVAL : 0;
+}
+
+/* Read a struct of exactly @size bytes */
+static int load_blob(const char *path, void *p, size_t size)
+{
+	FILE *f = fopen(path, "rb");
+	size_t n;
+	int c;
+
+	if (!f)
+		return -errno;
+	n = fread(p, 1, size, f);
+	c = fgetc(f);
+	fclose(f);
+	return n == size && c == EOF ? 0 : -EINVAL;
+}
+
+static int save_blob(const std::string &path, const void *p, size_t size)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	int ret = 0;
+
+	if (!f)
+		return -errno;
+	if (fwrite(p, 1, size, f) != size)
+		ret = -EIO;
+	if (fclose(f) && !ret)
+		ret = -EIO;
+	return ret;
+}
+
+static int ppm_token(FILE *f, uint32_t *v)
+{
+	int c;
+
+	do {
+		c = fgetc(f);
+		if (c == '#') {
+			while (c != '\n' && c != EOF)
+				c = fgetc(f);
+		}
+	} while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+	if (c < '0' || c > '9')
+		return -EINVAL;
+	for (*v = 0; c >= '0' && c <= '9'; c = fgetc(f))
+		*v = *v * 10 + (uint32_t)(c - '0');
+	return 0;
+}
+
+/* A binary PPM, 8 bits or up to 16 big-endian, as 16-bit samples */
+static int read_ppm(const char *path, uint32_t *w, uint32_t *h, uint32_t *maxval,
+		    std::vector<uint16_t> *px)
+{
+	FILE *f = fopen(path, "rb");
+	size_t n;
+	int ret = -EINVAL;
+
+	if (!f)
+		return -errno;
+	if (fgetc(f) != 'P' || fgetc(f) != '6' || ppm_token(f, w) || ppm_token(f, h) ||
+	    ppm_token(f, maxval) || !*w || !*h || !*maxval || *maxval > 65535)
+		goto out;
+	n = (size_t)*w * *h * 3;
+	px->resize(n);
+	if (*maxval < 256) {
+		std::vector<uint8_t> b(n);
+
+		if (fread(b.data(), 1, n, f) != n)
+			goto out;
+		std::copy(b.begin(), b.end(), px->begin());
+	} else {
+		std::vector<uint8_t> b(2 * n);
+
+		if (fread(b.data(), 1, 2 * n, f) != 2 * n)
+			goto out;
+		for (size_t i = 0; i < n; i++)
+			(*px)[i] = (uint16_t)(b[2 * i] << 8 | b[2 * i + 1]);
+	}
+	ret = 0;
+out:
+	fclose(f);
+	return ret;
+}
+
+static int write_ppm(const char *path, uint32_t w, uint32_t h, uint32_t maxval,
+		     const uint16_t *px)
+{
+	FILE *f = fopen(path, "wb");
+	size_t n = (size_t)w * h * 3;
+	std::vector<uint8_t> b;
+	int ret = 0;
+
+	if (!f)
+		return -errno;
+	fprintf(f, "P6\n%u %u\n%u\n", w, h, maxval);
+	if (maxval < 256) {
+		b.assign(px, px + n);
+	} else {
+		b.resize(2 * n);
+		for (size_t i = 0; i < n; i++) {
+			b[2 * i] = (uint8_t)(px[i] >> 8);
+			b[2 * i + 1] = (uint8_t)px[i];
+		}
+	}
+	if (fwrite(b.data(), 1, b.size(), f) != b.size())
+		ret = -EIO;
+	if (fclose(f) && !ret)
+		ret = -EIO;
+	return ret;
+}
+
+/* Every block's struct, for the configs -b makes up */
+struct blocks {
+	drm_msm_igc_lut igc;
+	drm_msm_pcc pcc;
+	drm_msm_pa_hsic hsic;
+	drm_msm_sixzone sixzone;
+	drm_msm_memcol memcol[DSPP_MEMCOL];
+	drm_msm_3d_gamut gamut;
+	drm_msm_pgc_lut pgc;
+	drm_msm_dither dither;
+
+	dspp_config config(uint32_t bits) const
+	{
+		dspp_config c;
+
+		c.igc = &igc;
+		c.pcc = &pcc;
+		c.hsic = &hsic;
+		c.sixzone = &sixzone;
+		for (int k = 0; k < DSPP_MEMCOL; k++)
+			c.memcol[k] = &memcol[k];
+		c.gamut = &gamut;
+		c.pgc = &pgc;
+		c.dither = &dither;
+		c.bits = bits;
+		return c;
+	}
+};
+
+static uint32_t fix(double v, unsigned bits)
+{
+	return (uint32_t)lround(v) & ((1u << bits) - 1);
+}
+
+static uint32_t range(uint32_t lo, uint32_t hi)
+{
+	return hi << 16 | lo;
+}
+
+/*
+ * A panel-like calibration: 2.2 gamma in and out, a slightly mixing PCC,
+ * a mild saturation and contrast lift, six-zone curves and memory colours
+ * that bend hues a little, a gamut LUT pulling toward a smaller gamut and
+ * an 8-bit Bayer dither.
+ */
+static void plausible(blocks *b, uint64_t *x, uint32_t mode)
+{
+	static const uint32_t bayer[DITHER_MATRIX_SZ] = {
+		0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5,
+	};
+	int grid = mode == GAMUT_3D_MODE_17 ? 17 : mode == GAMUT_3D_MODE_13 ? 13 : 5;
+	double jit = (double)(xorshift(x) % 1000) / 1000;
+
+	memset(b, 0, sizeof(*b));
+	for (int i = 0; i < IGC_TBL_LEN; i++)
+		b->igc.c0[i] = b->igc.c1[i] = b->igc.c2[i] =
+			fix(DSPP_MAX * pow(i / 255.0, 2.2), 12);
+	b->igc.c0_last = b->igc.c1_last = b->igc.c2_last = DSPP_MAX;
+
+	for (int o = 0; o < 3; o++) {
+		drm_msm_pcc_coeff *k = o == 0 ? &b->pcc.r : o == 1 ? &b->pcc.g : &b->pcc.b;
+		__u32 *sq = o == 0 ? &b->pcc.r_rr : o == 1 ? &b->pcc.g_rr : &b->pcc.b_rr;
+		__u32 *t[DSPP_PCC_TERMS] = {
+			&k->c, &k->r, &k->g, &k->b, &k->rg, &k->gb, &k->rb, &k->rgb,
+			sq, sq + 1, sq + 2,
+		};
+
+		for (int i = 1; i <= 3; i++)
+			*t[i] = fix(i - 1 == o ? 0x8000 * (0.92 + 0.04 * jit) : 0x8000 * 0.04, 18);
+		*t[0] = fix(-0x8000 * 0.01, 18);
+		*t[4] = fix(0x8000 * 0.02 * jit, 18);
+		*t[8 + o] = fix(-0x8000 * 0.03, 18);
+	}
+
+	b->hsic.flags = PA_HSIC_HUE_ENABLE | PA_HSIC_SAT_ENABLE | PA_HSIC_VAL_ENABLE |
+			PA_HSIC_CONT_ENABLE;
+	b->hsic.hue = fix(-12 - 20 * jit, 12);
+	b->hsic.saturation = fix(0x8000 * 0.1, 16);
+	b->hsic.value = fix(-16, 16);
+	b->hsic.contrast = fix(0x8000 * 0.05, 16);
+
+	b->sixzone.flags = SIXZONE_HUE_ENABLE | SIXZONE_SAT_ENABLE | SIXZONE_VAL_ENABLE;
+	b->sixzone.threshold = 64;
+	for (int i = 0; i < SIXZONE_LUT_SIZE; i++) {
+		double a = 2 * M_PI * i / SIXZONE_LUT_SIZE;
+
+		b->sixzone.curve[i].p0 = fix(24 * sin(3 * a + jit), 12);
+		b->sixzone.curve[i].p1 = fix(200 * cos(2 * a), 12) |
+					 fix(80 * sin(a), 12) << 16;
+	}
+
+	/* skin, sky and foliage, in 1536ths of a turn */
+	b->memcol[0].hue_region = range(40, 160);
+	b->memcol[0].sat_region = range(300, 3200);
+	b->memcol[0].val_region = range(500, DSPP_MAX);
+	b->memcol[0].color_adjust_p0 = fix(-6, 12);
+	b->memcol[0].prot_flags = MEMCOL_PROT_HUE | MEMCOL_PROT_SAT | MEMCOL_PROT_SIXZONE;
+	b->memcol[1].hue_region = range(800, 960);
+	b->memcol[1].sat_region = range(400, DSPP_MAX);
+	b->memcol[1].val_region = range(800, DSPP_MAX);
+	b->memcol[1].color_adjust_p1 = fix(0x8000 * 0.08, 16);
+	b->memcol[1].prot_flags = MEMCOL_PROT_SIXZONE;
+	b->memcol[2].hue_region = range(360, 620);
+	b->memcol[2].sat_region = range(300, DSPP_MAX);
+	b->memcol[2].val_region = range(200, DSPP_MAX);
+	b->memcol[2].color_adjust_p2 = fix(0x8000 * 0.04, 16);
+	b->memcol[2].prot_flags = MEMCOL_PROT_CONT;
+
+	b->gamut.flags = GAMUT_3D_MAP_EN;
+	b->gamut.mode = mode;
+	for (int n = 0; n < grid * grid * grid; n++) {
+		int ir = n / (grid * grid), ig = n / grid % grid, ib = n % grid;
+		double v[3] = {
+			std::min(ir * 4096.0 / (grid - 1), 4095.0),
+			std::min(ig * 4096.0 / (grid - 1), 4095.0),
+			std::min(ib * 4096.0 / (grid - 1), 4095.0),
+		};
+		double y = 0.2126 * v[0] + 0.7152 * v[1] + 0.0722 * v[2], s = 0.9 + 0.05 * jit;
+		drm_msm_3d_col *e = &b->gamut.col[n % GAMUT_3D_TBL_NUM][n / GAMUT_3D_TBL_NUM];
+
+		e->c0 = fix(y + s * (v[1] - y), 12);
+		e->c2_c1 = fix(y + s * (v[0] - y), 12) << 16 | fix(y + s * (v[2] - y), 12);
+	}
+
+	for (int i = 0; i < PGC_TBL_LEN; i++)
+		b->pgc.c0[i] = b->pgc.c1[i] = b->pgc.c2[i] =
+			fix(DSPP_MAX * pow(std::min(i * 8 / 4095.0, 1.0), 1 / 2.2), 12);
+
+	b->dither.temporal_en = 1;
+	b->dither.c0_bitdepth = b->dither.c1_bitdepth = b->dither.c2_bitdepth = 8;
+	memcpy(b->dither.matrix, bayer, sizeof(bayer));
+}
+
+/* Random bits everywhere, enough of them valid to run every block */
+static void garbage(blocks *b, uint64_t *x)
+{
+	uint32_t *w = (uint32_t *)b;
+
+	for (size_t i = 0; i < sizeof(*b) / 4; i++)
+		w[i] = (uint32_t)xorshift(x);
+	b->gamut.flags |= GAMUT_3D_MAP_EN;
+	b->gamut.mode = 1 + (uint32_t)(xorshift(x) % 3);
+	b->dither.c0_bitdepth = 1 + (uint32_t)(xorshift(x) % 12);
+	b->dither.c1_bitdepth = 1 + (uint32_t)(xorshift(x) % 12);
+	b->dither.c2_bitdepth = 1 + (uint32_t)(xorshift(x) % 12);
+}
+
+/* Gradients under noise, with flat grey and saturated patches */
+static void test_frame(std::vector<uint8_t> *px, uint32_t w, uint32_t h, uint64_t *x)
+{
+	px->resize((size_t)w * h * 3);
+	for (uint32_t y = 0; y < h; y++) {
+		for (uint32_t i = 0; i < w; i++) {
+			uint8_t *p = &(*px)[((size_t)y * w + i) * 3];
+			uint32_t n = (uint32_t)xorshift(x);
+
+			if ((i / 64 + y / 64) % 7 == 0) {
+				p[0] = p[1] = p[2] = (uint8_t)(y * 255 / h);
+			} else if ((i / 64 + y / 64) % 7 == 3) {
+				p[0] = (n & 1) ? 255 : 0;
+				p[1] = (n & 2) ? 255 : 0;
+				p[2] = (n & 4) ? 255 : 0;
+			} else {
+				p[0] = (uint8_t)(i * 255 / w + (n & 15));
+				p[1] = (uint8_t)(y * 255 / h + (n >> 4 & 15));
+				p[2] = (uint8_t)(255 - i * 255 / w + (n >> 8 & 7));
+			}
+		}
+	}
+}
+
+static int check(unsigned jobs)
+{
+	static const uint32_t sizes[][2] = {
+		{ 1, 1 }, { 7, 3 }, { 8, 17 }, { 255, 16 }, { 257, 33 }, { 513, 40 },
+		{ 1080, 48 },
+	};
+	std::unique_ptr<blocks> b(new blocks);
+	std::unique_ptr<dspp> d(new dspp);
+	std::vector<uint8_t> in;
+	uint64_t x = 0x9e3779b97f4a7c15ull, pixels = 0;
+	unsigned bad = 0, runs = 0;
+
+	for (int round = 0; round < 24; round++) {
+		const uint32_t *s = sizes[round % (sizeof(sizes) / sizeof(sizes[0]))];
+		uint32_t frame = (uint32_t)(xorshift(&x) % 7);
+
+		if (round & 1)
+			garbage(b.get(), &x);
+		else
+			plausible(b.get(), &x, 1 + (uint32_t)(round / 2 % 3));
+		if (dspp_prepare(b->config(8), d.get())) {
+			fprintf(stderr, "check: round %d: config rejected\n", round);
+			return -EINVAL;
+		}
+		test_frame(&in, s[0], s[1], &x);
+		if (round % 5 == 4) {
+			for (auto &v : in)
+				v = (uint8_t)xorshift(&x);
+		}
+
+		std::vector<uint16_t> ref((size_t)s[0] * s[1] * 3), vec(ref.size(), 0xffff);
+		std::vector<uint16_t> par(ref.size(), 0xffff);
+
+		dspp_render(*d, in.data(), s[0] * 3, ref.data(), s[0] * 3, s[0], s[1], frame, 1, true);
+		dspp_render(*d, in.data(), s[0] * 3, vec.data(), s[0] * 3, s[0], s[1], frame, 1);
+		dspp_render(*d, in.data(), s[0] * 3, par.data(), s[0] * 3, s[0], s[1], frame, jobs);
+		for (size_t i = 0; i < ref.size(); i++) {
+			if (ref[i] == vec[i] && ref[i] == par[i])
+				continue;
+			if (bad++ < 8)
+				fprintf(stderr, "check: round %d %ux%u pixel %zu,%zu c%zu: "
+					"c %u %s %u, %u jobs %u\n", round, s[0], s[1],
+					i / 3 % s[0], i / 3 / s[0], i % 3, ref[i], dspp_isa,
+					vec[i], jobs, par[i]);
+		}
+		pixels += ref.size() / 3;
+		runs++;
+	}
+	printf("check: %u configs, %llu pixels, %s against c: %s\n", runs,
+	       (unsigned long long)pixels, dspp_isa, bad ? "MISMATCH" : "ok");
+	return bad ? -EIO : 0;
+}
+
+static double time_frames(const dspp &d, const std::vector<uint8_t> &in,
+			  std::vector<uint16_t> *out, uint32_t w, uint32_t h, unsigned frames,
+			  unsigned jobs, bool ref)
+{
+	double t0 = now_us();
+
+	for (unsigned f = 0; f < frames; f++)
+		dspp_render(d, in.data(), w * 3, out->data(), w * 3, w, h, f, jobs, ref);
+	return (now_us() - t0) / frames / 1000;
+}
+
+static int bench(uint32_t w, uint32_t h, unsigned frames, unsigned jobs, const char *dir)
+{
+	static const char *const names[] = {
+		"igc", "pcc", "hsic", "sixzone", "memcol-skin", "memcol-sky",
+		"memcol-foliage", "gamut", "pgc", "dither",
+	};
+	std::unique_ptr<blocks> b(new blocks);
+	std::unique_ptr<dspp> d(new dspp);
+	std::vector<uint8_t> in;
+	std::vector<uint16_t> out((size_t)w * h * 3);
+	uint64_t x = 0x2545f4914f6cdd1dull;
+	unsigned ref_frames = std::max(1u, frames / 10);
+	double c, one, all;
+	int ret;
+
+	plausible(b.get(), &x, GAMUT_3D_MODE_17);
+	ret = dspp_prepare(b->config(8), d.get());
+	if (ret)
+		return ret;
+	if (dir) {
+		const void *p[] = {
+			&b->igc, &b->pcc, &b->hsic, &b->sixzone, &b->memcol[0], &b->memcol[1],
+			&b->memcol[2], &b->gamut, &b->pgc, &b->dither,
+		};
+		const size_t n[] = {
+			sizeof(b->igc), sizeof(b->pcc), sizeof(b->hsic), sizeof(b->sixzone),
+			sizeof(b->memcol[0]), sizeof(b->memcol[1]), sizeof(b->memcol[2]),
+			sizeof(b->gamut), sizeof(b->pgc), sizeof(b->dither),
+		};
+
+		for (size_t i = 0; i < sizeof(p) / sizeof(p[0]); i++) {
+			ret = save_blob(std::string(dir) + "/" + names[i] + ".bin", p[i], n[i]);
+			if (ret) {
+				fprintf(stderr, "%s/%s.bin: %s\n", dir, names[i], strerror(-ret));
+				return ret;
+			}
+		}
+	}
+	test_frame(&in, w, h, &x);
+
+	c = time_frames(*d, in, &out, w, h, ref_frames, 1, true);
+	one = time_frames(*d, in, &out, w, h, frames, 1, false);
+	all = time_frames(*d, in, &out, w, h, frames, jobs, false);
+	printf("%ux%u, every block on, 17-point gamut, 8-bit dither:\n", w, h);
+	printf("  %-6s %2u job%s  %8.2f ms/frame\n", "c", 1, " ", c);
+	printf("  %-6s %2u job%s  %8.2f ms/frame  %5.1fx\n", dspp_isa, 1, " ", one, c / one);
+	printf("  %-6s %2u job%s  %8.2f ms/frame  %5.1fx\n", dspp_isa, jobs,
+	       jobs == 1 ? " " : "s", all, c / all);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: dspp_ref [-i igc] [-p pcc] [-s hsic] [-z sixzone] [-m memcol]...\n"
+		"                [-g gamut] [-l pgc] [-d dither] [-o bits] [-f frame]\n"
+		"                [-j jobs] [-r expect.ppm] <in.ppm> [out.ppm]\n"
+		"       dspp_ref -b [-S WxH] [-n frames] [-j jobs] [-w dir]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	std::unique_ptr<blocks> b(new blocks);
+	std::unique_ptr<dspp> d(new dspp);
+	dspp_config cfg;
+	const char *expect = nullptr, *dir = nullptr;
+	uint32_t w = 1080, h = 2400, frame = 0, maxval, nmc = 0;
+	unsigned jobs = std::max(1u, std::thread::hardware_concurrency()), frames = 60;
+	std::vector<uint16_t> px;
+	std::vector<uint8_t> in;
+	bool do_bench = false;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "i:p:s:z:m:g:l:d:o:f:j:r:bS:n:w:")) != -1) {
+		switch (opt) {
+		case 'i':
+			ret = load_blob(optarg, &b->igc, sizeof(b->igc));
+			cfg.igc = &b->igc;
+			break;
+		case 'p':
+			ret = load_blob(optarg, &b->pcc, sizeof(b->pcc));
+			cfg.pcc = &b->pcc;
+			break;
+		case 's':
+			ret = load_blob(optarg, &b->hsic, sizeof(b->hsic));
+			cfg.hsic = &b->hsic;
+			break;
+		case 'z':
+			ret = load_blob(optarg, &b->sixzone, sizeof(b->sixzone));
+			cfg.sixzone = &b->sixzone;
+			break;
+		case 'm':
+			if (nmc == DSPP_MEMCOL)
+				usage();
+			ret = load_blob(optarg, &b->memcol[nmc], sizeof(b->memcol[nmc]));
+			cfg.memcol[nmc] = &b->memcol[nmc];
+			nmc++;
+			break;
+		case 'g':
+			ret = load_blob(optarg, &b->gamut, sizeof(b->gamut));
+			cfg.gamut = &b->gamut;
+			break;
+		case 'l':
+			ret = load_blob(optarg, &b->pgc, sizeof(b->pgc));
+			cfg.pgc = &b->pgc;
+			break;
+		case 'd':
+			ret = load_blob(optarg, &b->dither, sizeof(b->dither));
+			cfg.dither = &b->dither;
+			break;
+		case 'o':
+			cfg.bits = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			frame = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			jobs = std::max(1u, (unsigned)strtoul(optarg, NULL, 0));
+			break;
+		case 'r':
+			expect = optarg;
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		case 'S':
+			if (parse_size(optarg, &w, &h))
+				usage();
+			break;
+		case 'n':
+			frames = std::max(1u, (unsigned)strtoul(optarg, NULL, 0));
+			break;
+		case 'w':
+			dir = optarg;
+			break;
+		default:
+			usage();
+		}
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", optarg,
+				ret == -EINVAL ? "not the size of the block's struct" : strerror(-ret));
+			return 1;
+		}
+	}
+
+	if (do_bench) {
+		if (optind != argc)
+			usage();
+		if (check(std::max(jobs, 4u)))
+			return 1;
+		ret = bench(w, h, frames, jobs, dir);
+		if (ret)
+			fprintf(stderr, "bench: %s\n", strerror(-ret));
+		return ret ? 1 : 0;
+	}
+	if (optind + 1 != argc && optind + 2 != argc)
+		usage();
+
+	ret = read_ppm(argv[optind], &w, &h, &maxval, &px);
+	if (ret || maxval != 255) {
+		fprintf(stderr, "%s: %s\n", argv[optind],
+			ret && ret != -EINVAL ? strerror(-ret) : "not an 8-bit binary PPM");
+		return 1;
+	}
+	in.assign(px.begin(), px.end());
+	ret = dspp_prepare(cfg, d.get());
+	if (ret) {
+		fprintf(stderr, "config: %s\n", strerror(-ret));
+		return 1;
+	}
+	if (d->bits[0] != d->bits[1] || d->bits[0] != d->bits[2])
+		fprintf(stderr, "warning: components at %u/%u/%u bits, PPM written at %u\n",
+			d->bits[0], d->bits[1], d->bits[2],
+			std::max(std::max(d->bits[0], d->bits[1]), d->bits[2]));
+	maxval = (1u << std::max(std::max(d->bits[0], d->bits[1]), d->bits[2])) - 1;
+
+	dspp_render(*d, in.data(), w * 3, px.data(), w * 3, w, h, frame, jobs);
+	printf("%ux%u %u bits hash %016llx\n", w, h, 32 - __builtin_clz(maxval),
+	       (unsigned long long)fnv1a64(px.data(), px.size() * 2));
+
+	if (optind + 2 == argc) {
+		ret = write_ppm(argv[optind + 1], w, h, maxval, px.data());
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(-ret));
+			return 1;
+		}
+	}
+	if (expect) {
+		std::vector<uint16_t> e;
+		uint32_t ew, eh, emax;
+		uint64_t diff = 0;
+		unsigned worst = 0;
+
+		ret = read_ppm(expect, &ew, &eh, &emax, &e);
+		if (ret || ew != w || eh != h || emax != maxval) {
+			fprintf(stderr, "%s: %s\n", expect, ret && ret != -EINVAL ? strerror(-ret) :
+				"not a PPM of the same size and depth");
+			return 1;
+		}
+		for (size_t i = 0; i < px.size(); i += 3) {
+			unsigned m = 0;
+
+			for (int c = 0; c < 3; c++)
+				m = std::max(m, (unsigned)abs((int)px[i + c] - (int)e[i + c]));
+			diff += m != 0;
+			worst = std::max(worst, m);
+		}
+		printf("%s: %llu of %llu pixels differ, by up to %u\n", expect,
+		       (unsigned long long)diff, (unsigned long long)(px.size() / 3), worst);
+		if (diff)
+			return 1;
+	}
+	return 0;
+}
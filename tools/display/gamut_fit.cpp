@@ -0,0 +1,661 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Fit a panel's PGC curves and 3D gamut LUT from colorimeter readings,
+ * ready to set on the CRTC.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -I../../kernel-headers -o gamut_fit gamut_fit.cpp
+ * Usage: gamut_fit [-t space] [-G gamma] [-N points] [-l lambda] [-R]
+ *                  [-j jobs] [-o dir] <readings.csv>
+ *        gamut_fit -b [-n panels] [-s seed] [-j jobs] [-w dir]
+ *
+ * The readings are a CSV with a header naming at least the columns r,
+ * g, b (drive as a fraction of full scale, blocks bypassed) and X, Y, Z,
+ * in plain decimals; other columns are ignored.  They need black, a
+ * ramp per component ending at full drive, and as many mixed patches
+ * as the station has time for.  The fit is written to <dir>/gamut.bin
+ * and <dir>/pgc.bin (default the current directory), each exactly one
+ * drm_msm_3d_gamut or drm_msm_pgc_lut, as dspp_ref -g and -l take them.
+ *
+ * -t is the target space, srgb (default), p3 or bt2020; -G a pure power
+ * EOTF instead of the sRGB curve; -N the gamut points per axis, 17
+ * (default), 13 or 5; -l the smoothness weight (default 0.02); -R sets
+ * PGC_8B_ROUND.  -j is the number of threads (default all CPUs).
+ *
+ * -b checks the vector paths against the C ones and the fit against a
+ * panel that already is sRGB, then fits -n (default 20) simulated panels
+ * from seed -s, each read on the usual station patch set with meter
+ * noise, and prints the time per panel and the CIEDE2000 of a 15^3 test
+ * cube through dspp.h before calibration, with the matrix-only prior and
+ * with the fit.  -w also writes the first panel's readings and fit to
+ * <dir>, as a start for a real run.
+ *
+ * Example:
+ *   gamut_fit -t p3 -o /tmp/cal readings.csv
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../lib/csv.h"
+#include "gamut_fit.h"
+
+using namespace sde;
+
+static const char *const space_names[GFIT_NR_SPACES] = { "srgb", "p3", "bt2020" };
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static float uniform(uint64_t *x)
+{
+	return (float)(xorshift(x) >> 40) / (float)(1 << 24);
+}
+
+/* Close enough to a unit normal for meter noise */
+static float normal(uint64_t *x)
+{
+	float s = 0;
+
+	for (int i = 0; i < 12; i++)
+		s += uniform(x);
+	return s - 6;
+}
+
+static int save_blob(const std::string &path, const void *p, size_t size)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	int ret = 0;
+
+	if (!f)
+		return -errno;
+	if (fwrite(p, 1, size, f) != size)
+		ret = -EIO;
+	if (fclose(f) && !ret)
+		ret = -EIO;
+	return ret;
+}
+
+static int load_readings(const char *path, std::vector<gfit_patch> *pt)
+{
+	static const char *const names[6] = { "r", "g", "b", "X", "Y", "Z" };
+	csv::reader rd;
+	csv::row r;
+	int col[6], ret;
+
+	ret = rd.open(path);
+	if (ret)
+		return ret;
+	if (!rd.next(&r))
+		return -EINVAL;
+	for (int i = 0; i < 6; i++) {
+		col[i] = r.find(names[i]);
+		if (col[i] < 0) {
+			fprintf(stderr, "%s: no %s column\n", path, names[i]);
+			return -EINVAL;
+		}
+	}
+	pt->clear();
+	while (rd.next(&r)) {
+		gfit_patch p;
+
+		for (int i = 0; i < 3; i++) {
+			p.d[i] = (float)r.dbl(col[i]);
+			p.xyz[i] = (float)r.dbl(col[3 + i]);
+		}
+		pt->push_back(p);
+	}
+	return 0;
+}
+
+static int save_readings(const std::string &path, const std::vector<gfit_patch> &pt)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	int ret = 0;
+
+	if (!f)
+		return -errno;
+	fprintf(f, "r,g,b,X,Y,Z\n");
+	for (const auto &p : pt)
+		fprintf(f, "%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", p.d[0], p.d[1], p.d[2], p.xyz[0],
+			p.xyz[1], p.xyz[2]);
+	if (fclose(f))
+		ret = -EIO;
+	return ret;
+}
+
+/*
+ * Simulated panel: a power law with a linear toe per component, and
+ * luminance drooping with the total load, as an OLED's supply does, which
+ * no per-component curve can undo.
+ */
+struct panel {
+	float prim[3][3];	/* XYZ at full drive, component per column */
+	float black[3];
+	float gamma[3], toe[3];
+	float droop;
+};
+
+static void panel_xyz(const panel &p, const float d[3], float xyz[3])
+{
+	float in[3], load;
+
+	for (int c = 0; c < 3; c++)
+		in[c] = (1 - p.toe[c]) * powf(d[c], p.gamma[c]) + p.toe[c] * d[c];
+	load = (in[0] + in[1] + in[2]) / 3;
+	for (int c = 0; c < 3; c++)
+		in[c] *= 1 - p.droop * load;
+	gfit_mul3(p.prim, in, xyz);
+	for (int c = 0; c < 3; c++)
+		xyz[c] += p.black[c];
+}
+
+/* Primaries about P3, white about D65 at 400-600 nits, or exactly sRGB if @ideal */
+static void random_panel(panel *p, uint64_t *x, bool ideal)
+{
+	float xy[4][2], pr[3][3], pi[3][3], w[3], s[3], lum = 400 + 200 * uniform(x);
+
+	memcpy(xy, gfit_primaries[ideal ? GFIT_SRGB : GFIT_P3], sizeof(xy));
+	for (int c = 0; c < 4 && !ideal; c++)
+		for (int k = 0; k < 2; k++)
+			xy[c][k] += 0.012f * (uniform(x) - 0.5f);
+	for (int c = 0; c < 3; c++) {
+		pr[0][c] = xy[c][0] / xy[c][1];
+		pr[1][c] = 1;
+		pr[2][c] = (1 - xy[c][0] - xy[c][1]) / xy[c][1];
+	}
+	w[0] = xy[3][0] / xy[3][1] * lum;
+	w[1] = lum;
+	w[2] = (1 - xy[3][0] - xy[3][1]) / xy[3][1] * lum;
+	gfit_inv3(pr, pi);
+	gfit_mul3(pi, w, s);
+	for (int i = 0; i < 3; i++)
+		for (int c = 0; c < 3; c++)
+			p->prim[i][c] = pr[i][c] * s[c];
+	for (int c = 0; c < 3; c++) {
+		p->gamma[c] = 2.0f + 0.5f * uniform(x);
+		p->toe[c] = ideal ? 0 : 0.03f * uniform(x);
+		p->black[c] = ideal ? 0 : w[c] * 2e-4f;
+	}
+	p->droop = ideal ? 0 : 0.02f + 0.06f * uniform(x);
+}
+
+/* Black, 24-step ramps and a 9^3 cube, as the station reads them */
+static void read_panel(const panel &p, uint64_t *x, float noise, std::vector<gfit_patch> *pt)
+{
+	auto read = [&](float r, float g, float b) {
+		gfit_patch q = { { r, g, b }, {} };
+
+		panel_xyz(p, q.d, q.xyz);
+		for (int c = 0; c < 3; c++)
+			q.xyz[c] = std::max(0.0f, q.xyz[c] * (1 + noise * normal(x)) +
+						  noise * 5 * normal(x));
+		pt->push_back(q);
+	};
+
+	pt->clear();
+	read(0, 0, 0);
+	for (int c = 0; c < 3; c++)
+		for (int i = 1; i <= 24; i++) {
+			float d[3] = {};
+
+			d[c] = i / 24.0f;
+			read(d[0], d[1], d[2]);
+		}
+	for (int r = 0; r < 9; r++)
+		for (int g = 0; g < 9; g++)
+			for (int b = 0; b < 9; b++)
+				if ((r > 0) + (g > 0) + (b > 0) > 1)
+					read(r / 8.0f, g / 8.0f, b / 8.0f);
+}
+
+struct de_stats {
+	double mean, p95, max;
+	uint32_t n;
+};
+
+/*
+ * CIEDE2000 over a 15^3 cube of gamut inputs whose target colour the
+ * panel can show, through the gamut and PGC stages of dspp.h, or with
+ * the panel driven straight from the input if @res is null.
+ */
+static int verify(const panel &p, const gfit_result &ref, const gfit_result *res, de_stats *st)
+{
+	const int n = 15;
+	std::unique_ptr<dspp> d(new dspp);
+	std::vector<int32_t> px[3];
+	std::vector<float> tgt;
+	std::vector<double> de;
+	float white[3], top[3] = { DSPP_MAX, DSPP_MAX, DSPP_MAX };
+	int ret;
+
+	gfit_target_xyz(ref.target, top, white);
+	for (int i = 0; i < n * n * n; i++) {
+		float v[3] = { (float)(i / (n * n) * DSPP_MAX / (n - 1)),
+			       (float)(i / n % n * DSPP_MAX / (n - 1)),
+			       (float)(i % n * DSPP_MAX / (n - 1)) }, lin[3], in[3], xyz[3];
+		bool in_gamut = true;
+
+		for (int c = 0; c < 3; c++)
+			lin[c] = gfit_eotf(v[c] / DSPP_MAX, ref.target.gamma);
+		gfit_mul3(ref.prior, lin, in);
+		for (int c = 0; c < 3; c++)
+			if (in[c] < -1e-3f || in[c] > 1 + 1e-3f)
+				in_gamut = false;
+		if (!in_gamut)
+			continue;
+		gfit_target_xyz(ref.target, v, xyz);
+		for (int c = 0; c < 3; c++) {
+			px[c].push_back((int32_t)v[c]);
+			tgt.push_back(xyz[c]);
+		}
+	}
+	st->n = (uint32_t)px[0].size();
+	for (int c = 0; c < 3; c++)
+		px[c].resize((px[c].size() + 7) & ~(size_t)7);
+
+	if (res) {
+		dspp_config cfg;
+
+		cfg.gamut = &res->gamut;
+		cfg.pgc = &res->pgc;
+		cfg.bits = 12;
+		ret = dspp_prepare(cfg, d.get());
+		if (ret)
+			return ret;
+		/* The stages want their arrays aligned, as dspp_rows() has them */
+		for (size_t i = 0; i < px[0].size(); i += DSPP_CHUNK) {
+			alignas(32) int32_t c[3][DSPP_CHUNK];
+			uint32_t m = (uint32_t)std::min<size_t>(DSPP_CHUNK, px[0].size() - i);
+
+			for (int k = 0; k < 3; k++)
+				memcpy(c[k], &px[k][i], m * sizeof(int32_t));
+			dspp_gamut(*d, c[0], c[1], c[2], m);
+			dspp_pgc(*d, c[0], c[1], c[2], m);
+			for (int k = 0; k < 3; k++)
+				memcpy(&px[k][i], c[k], m * sizeof(int32_t));
+		}
+	}
+	for (uint32_t i = 0; i < st->n; i++) {
+		float dv[3], xyz[3];
+		double a[3], b[3];
+
+		for (int c = 0; c < 3; c++)
+			dv[c] = px[c][i] / (float)DSPP_MAX;
+		panel_xyz(p, dv, xyz);
+		gfit_lab(&tgt[3 * i], white, a);
+		gfit_lab(xyz, white, b);
+		de.push_back(gfit_de2000(a, b));
+	}
+	std::sort(de.begin(), de.end());
+	st->mean = 0;
+	for (double v : de)
+		st->mean += v;
+	st->mean /= std::max<size_t>(1, de.size());
+	st->p95 = de.empty() ? 0 : de[de.size() * 95 / 100];
+	st->max = de.empty() ? 0 : de.back();
+	return 0;
+}
+
+static void print_fit(const gfit_result &r)
+{
+	printf("  %u samples, %u outside the target, rms %.1f codes (prior %.1f), "
+	       "cg %d/%d/%d iterations\n", r.samples, r.dropped, r.rms, r.rms_prior,
+	       r.iters[0], r.iters[1], r.iters[2]);
+	printf("  %.2f ms: prepare %.2f, assemble %.2f, solve %.2f\n",
+	       (r.t_prep + r.t_assemble + r.t_solve) / 1000, r.t_prep / 1000,
+	       r.t_assemble / 1000, r.t_solve / 1000);
+}
+
+static int check_kernels(uint64_t *x)
+{
+	static const int grids[] = { 5, 13, 17 };
+	unsigned bad = 0;
+	double worst_eval = 0, worst_apply = 0;
+
+	for (int gi : grids) {
+		gfit_grid g;
+		gfit_samples s, t;
+		std::vector<float> v[3], o0[3], o1[3], k, y0, y1, xv;
+		const float *pv[3];
+		float *p0[3], *p1[3];
+
+		gfit_grid_init(&g, gi);
+		gfit_samples_resize(&s, 1003);
+		for (uint32_t i = 0; i < s.count; i++)
+			for (int c = 0; c < 3; c++) {
+				switch (i % 4) {
+				case 0:
+					s.x[c][i] = (float)(xorshift(x) % (DSPP_MAX + 1));
+					break;
+				case 1:	/* on nodes and cell edges */
+					s.x[c][i] = (float)std::min<uint64_t>(xorshift(x) % gi *
+						4096 / (gi - 1), DSPP_MAX);
+					break;
+				case 2:	/* ties between components */
+					s.x[c][i] = c ? s.x[0][i] : (float)(xorshift(x) % 4096);
+					break;
+				default:	/* just outside the cube, as slack lets in */
+					s.x[c][i] = (uniform(x) * 1.04f - 0.02f) * DSPP_MAX;
+				}
+			}
+		t = s;
+		gfit_tetra_c(g, &s);
+		gfit_tetra(g, &t);
+		for (uint32_t i = 0; i < s.n; i++) {
+			bool same = s.base[i] == t.base[i] && s.a[i] == t.a[i] && s.b[i] == t.b[i];
+
+			for (int c = 0; c < 4; c++)
+				same = same && !memcmp(&s.w[c][i], &t.w[c][i], sizeof(float));
+			if (!same && bad++ < 8)
+				fprintf(stderr, "check: %d points, sample %u (%g %g %g): weights "
+					"differ\n", gi, i, s.x[0][i], s.x[1][i], s.x[2][i]);
+		}
+
+		for (int c = 0; c < 3; c++) {
+			v[c].resize(g.size);
+			for (auto &e : v[c])
+				e = uniform(x) * DSPP_MAX;
+			o0[c].resize(s.n);
+			o1[c].resize(s.n);
+			pv[c] = v[c].data();
+			p0[c] = o0[c].data();
+			p1[c] = o1[c].data();
+		}
+		gfit_eval_c(g, s, pv, p0);
+		gfit_eval(g, s, pv, p1);
+		for (int c = 0; c < 3; c++)
+			for (uint32_t i = 0; i < s.n; i++)
+				worst_eval = std::max(worst_eval, (double)fabsf(o0[c][i] - o1[c][i]));
+
+		k.resize((size_t)GFIT_STENCIL * g.size);
+		for (auto &e : k)
+			e = uniform(x) - 0.5f;
+		xv.resize(g.size);
+		for (auto &e : xv)
+			e = uniform(x) * DSPP_MAX;
+		y0.resize(g.size);
+		y1.resize(g.size, -1);
+		gfit_apply_c(g, k.data(), xv.data(), y0.data());
+		gfit_apply(g, k.data(), xv.data(), y1.data());
+		for (uint32_t i = 0; i < g.size; i++)
+			worst_apply = std::max(worst_apply, (double)fabsf(y0[i] - y1[i]));
+	}
+	if (worst_eval > 1e-2 || worst_apply > 1e-1)
+		bad++;
+	printf("check: tetrahedral weights %s against c: %s; interpolation within %.1e, "
+	       "stencil within %.1e\n", gfit_isa, bad ? "MISMATCH" : "ok", worst_eval,
+	       worst_apply);
+	return bad ? -EIO : 0;
+}
+
+static int check(unsigned jobs)
+{
+	std::unique_ptr<gfit_result> r(new gfit_result), r1(new gfit_result);
+	std::vector<gfit_patch> pt, lack;
+	gfit_params prm;
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	gfit_grid g;
+	de_stats st;
+	int worst = 0, moved = 0, ret;
+	panel p;
+
+	ret = check_kernels(&x);
+	if (ret)
+		return ret;
+
+	/* A panel that already is sRGB, read without noise, wants identity */
+	random_panel(&p, &x, true);
+	read_panel(p, &x, 0, &pt);
+	prm.jobs = jobs;
+	ret = gfit_run(pt.data(), pt.size(), prm, r.get());
+	if (ret)
+		return ret;
+	gfit_grid_init(&g, 17);
+	for (int n = 0; n < DSPP_GAMUT_NODES; n++) {
+		const drm_msm_3d_col *c = &r->gamut.col[n % GAMUT_3D_TBL_NUM][n / GAMUT_3D_TBL_NUM];
+		int id[3] = { n / 289, n / 17 % 17, n % 17 };
+		int got[3] = { (int)(c->c2_c1 >> 16), (int)c->c0, (int)(c->c2_c1 & 0xffff) };
+
+		for (int k = 0; k < 3; k++)
+			worst = std::max(worst, abs(got[k] - std::min(id[k] * 256, DSPP_MAX)));
+	}
+	ret = verify(p, *r, r.get(), &st);
+	if (ret)
+		return ret;
+	printf("check: sRGB panel: gamut within %d codes of identity, mean dE00 %.2f, max %.2f\n",
+	       worst, st.mean, st.max);
+	if (worst > 24 || st.mean > 0.5)
+		return -EIO;
+
+	/* Threads only change the order samples are summed in */
+	random_panel(&p, &x, false);
+	read_panel(p, &x, 2e-3f, &pt);
+	prm.jobs = 1;
+	ret = gfit_run(pt.data(), pt.size(), prm, r.get());
+	prm.jobs = std::max(jobs, 4u);
+	if (!ret)
+		ret = gfit_run(pt.data(), pt.size(), prm, r1.get());
+	if (ret)
+		return ret;
+	for (int n = 0; n < DSPP_GAMUT_NODES; n++) {
+		const drm_msm_3d_col *a = &r->gamut.col[n % GAMUT_3D_TBL_NUM][n / GAMUT_3D_TBL_NUM];
+		const drm_msm_3d_col *b = &r1->gamut.col[n % GAMUT_3D_TBL_NUM][n / GAMUT_3D_TBL_NUM];
+
+		moved = std::max(moved, std::max(abs((int)(a->c2_c1 >> 16) - (int)(b->c2_c1 >> 16)),
+				 std::max(abs((int)a->c0 - (int)b->c0),
+					  abs((int)(a->c2_c1 & 0xffff) - (int)(b->c2_c1 & 0xffff)))));
+	}
+	printf("check: 1 against %u jobs: nodes within %d codes\n", prm.jobs, moved);
+	if (moved > 1)
+		return -EIO;
+
+	/* Without a full-drive red there is no red primary */
+	for (const auto &q : pt)
+		if (!(q.d[0] == 1 && q.d[1] == 0 && q.d[2] == 0))
+			lack.push_back(q);
+	if (gfit_run(lack.data(), lack.size(), prm, r1.get()) != -EINVAL) {
+		fprintf(stderr, "check: readings without a red primary accepted\n");
+		return -EIO;
+	}
+	prm.grid = 9;
+	if (gfit_run(pt.data(), pt.size(), prm, r1.get()) != -EINVAL) {
+		fprintf(stderr, "check: 9-point gamut accepted\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+static int bench(const gfit_params &prm, unsigned panels, uint64_t seed, const char *dir)
+{
+	std::unique_ptr<gfit_result> r(new gfit_result), r0(new gfit_result);
+	std::vector<gfit_patch> pt;
+	std::vector<double> ms;
+	gfit_params pprm = prm;
+	de_stats raw, pri, fit;
+	double sum[3][3] = {}, worst = 0;
+	uint64_t x = seed | 1;
+	int ret;
+
+	pprm.iters = 0;
+	for (unsigned i = 0; i < panels; i++) {
+		double t0;
+		panel p;
+
+		random_panel(&p, &x, false);
+		read_panel(p, &x, 2e-3f, &pt);
+		t0 = now_us();
+		ret = gfit_run(pt.data(), pt.size(), prm, r.get());
+		ms.push_back((now_us() - t0) / 1000);
+		if (ret)
+			return ret;
+		ret = gfit_run(pt.data(), pt.size(), pprm, r0.get());
+		if (!ret)
+			ret = verify(p, *r, nullptr, &raw);
+		if (!ret)
+			ret = verify(p, *r0, r0.get(), &pri);
+		if (!ret)
+			ret = verify(p, *r, r.get(), &fit);
+		if (ret)
+			return ret;
+		if (i == 0) {
+			printf("panel 0: %zu patches, droop %.3f, gamma %.2f/%.2f/%.2f\n", pt.size(),
+			       p.droop, p.gamma[0], p.gamma[1], p.gamma[2]);
+			print_fit(*r);
+		}
+		if (i == 0 && dir) {
+			ret = save_readings(std::string(dir) + "/readings.csv", pt);
+			if (!ret)
+				ret = save_blob(std::string(dir) + "/gamut.bin", &r->gamut,
+						sizeof(r->gamut));
+			if (!ret)
+				ret = save_blob(std::string(dir) + "/pgc.bin", &r->pgc, sizeof(r->pgc));
+			if (ret) {
+				fprintf(stderr, "%s: %s\n", dir, strerror(-ret));
+				return ret;
+			}
+		}
+		sum[0][0] += raw.mean, sum[0][1] += raw.p95, sum[0][2] = std::max(sum[0][2], raw.max);
+		sum[1][0] += pri.mean, sum[1][1] += pri.p95, sum[1][2] = std::max(sum[1][2], pri.max);
+		sum[2][0] += fit.mean, sum[2][1] += fit.p95, sum[2][2] = std::max(sum[2][2], fit.max);
+		worst = std::max(worst, ms.back());
+	}
+	std::sort(ms.begin(), ms.end());
+	printf("%u panels, %s, %d-point gamut, %s, %u job%s:\n", panels, space_names[prm.space],
+	       prm.grid, gfit_isa, prm.jobs, prm.jobs == 1 ? "" : "s");
+	printf("  fit %8.2f ms median, %8.2f ms worst (target 1000)\n", ms[ms.size() / 2], worst);
+	printf("  dE00 of the test cube, mean of means / mean p95 / worst:\n");
+	printf("    uncalibrated  %6.2f %6.2f %6.2f\n", sum[0][0] / panels, sum[0][1] / panels,
+	       sum[0][2]);
+	printf("    matrix prior  %6.2f %6.2f %6.2f\n", sum[1][0] / panels, sum[1][1] / panels,
+	       sum[1][2]);
+	printf("    fit           %6.2f %6.2f %6.2f\n", sum[2][0] / panels, sum[2][1] / panels,
+	       sum[2][2]);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: gamut_fit [-t space] [-G gamma] [-N points] [-l lambda] [-R]\n"
+		"                 [-j jobs] [-o dir] <readings.csv>\n"
+		"       gamut_fit -b [-n panels] [-s seed] [-j jobs] [-w dir]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	std::unique_ptr<gfit_result> r(new gfit_result);
+	std::vector<gfit_patch> pt;
+	gfit_params prm;
+	const char *out = ".", *dir = nullptr;
+	unsigned panels = 20;
+	uint64_t seed = 0x2545f4914f6cdd1dull;
+	bool do_bench = false;
+	int opt, ret;
+
+	prm.jobs = std::max(1u, std::thread::hardware_concurrency());
+	while ((opt = getopt(argc, argv, "t:G:N:l:Rj:o:bn:s:w:")) != -1) {
+		switch (opt) {
+		case 't':
+			prm.space = -1;
+			for (int i = 0; i < GFIT_NR_SPACES; i++)
+				if (!strcmp(optarg, space_names[i]))
+					prm.space = i;
+			if (prm.space < 0)
+				usage();
+			break;
+		case 'G':
+			prm.gamma = strtof(optarg, NULL);
+			break;
+		case 'N':
+			prm.grid = (int)strtol(optarg, NULL, 0);
+			break;
+		case 'l':
+			prm.lambda = strtof(optarg, NULL);
+			break;
+		case 'R':
+			prm.round8 = true;
+			break;
+		case 'j':
+			prm.jobs = std::max(1u, (unsigned)strtoul(optarg, NULL, 0));
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		case 'n':
+			panels = std::max(1u, (unsigned)strtoul(optarg, NULL, 0));
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'w':
+			dir = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (do_bench) {
+		if (optind != argc)
+			usage();
+		ret = check(prm.jobs);
+		if (!ret)
+			ret = bench(prm, panels, seed, dir);
+		if (ret)
+			fprintf(stderr, "bench: %s\n", strerror(-ret));
+		return ret ? 1 : 0;
+	}
+	if (optind + 1 != argc)
+		usage();
+
+	ret = load_readings(argv[optind], &pt);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	ret = gfit_run(pt.data(), pt.size(), prm, r.get());
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], ret == -EINVAL ?
+			"need black and a full-drive patch per component" : strerror(-ret));
+		return 1;
+	}
+	printf("%s: %zu patches, %s, %d-point gamut\n", argv[optind], pt.size(),
+	       space_names[prm.space], prm.grid);
+	print_fit(*r);
+	ret = save_blob(std::string(out) + "/gamut.bin", &r->gamut, sizeof(r->gamut));
+	if (!ret)
+		ret = save_blob(std::string(out) + "/pgc.bin", &r->pgc, sizeof(r->pgc));
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+		return 1;
+	}
+	return 0;
+}
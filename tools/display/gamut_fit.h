@@ -0,0 +1,1039 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Panel calibration fitter: from colorimeter readings of a panel driven
+ * with the DSPP colour blocks bypassed, fit the PGC curves and the 3D
+ * gamut LUT that make it reproduce a target colour space, as the
+ * drm_msm_pgc_lut and drm_msm_3d_gamut structs to set on the CRTC.
+ *
+ * A measurement is a patch: the drive level of each component, as a
+ * fraction of full scale, and the CIE XYZ read back.  Patches with all
+ * components off are black; with one component lit they are that
+ * component's ramp, and there must be one at full drive for each, which
+ * is the primary.  The rest (greys, a cube, whatever the station runs)
+ * only feed the gamut fit.
+ *
+ * PGC comes first: the ramps, projected on their primary, give each
+ * component's response, and the PGC entries invert it so a component
+ * alone follows the target EOTF.  The responses are interpolated with
+ * intensity to the 1/2.2, where a panel's ramp is close to a line.
+ *
+ * The gamut LUT is then a regularised least-squares fit.  Every patch
+ * is a sample of the inverse mapping: the gamut input whose target
+ * colour is what was measured, and the gamut output that, through the
+ * fitted PGC, gives the drive the patch used.  Node values minimise the
+ * squared error of the tetrahedral interpolation, as dspp_gamut_c() does
+ * it, at the samples, plus lambda times the squared difference between
+ * neighbouring nodes of their offset from a prior.  The prior is the
+ * matrix-only calibration from the primaries, clipped to the panel
+ * gamut; it is what the fit falls back to where there are no patches.
+ * A sample weighs Y / (Y + GFIT_DARK of white Y), so that the meter's
+ * noise floor does not bend the darkest cells.
+ * The normal equations are a 27-point stencil over the node grid; they
+ * are assembled with the samples split between threads and solved with
+ * Jacobi-preconditioned conjugate gradients, a component per thread.
+ *
+ * Target white is the target space's white at the highest luminance
+ * the panel reaches: by the primaries, less what a full white patch, if
+ * there is one, shows the panel losing with every component lit.
+ * Target black is the panel's own.  Samples further than slack outside
+ * the target cube, in encoded units, are dropped; closer ones weigh on
+ * the boundary cell's nodes as its linear extension, negative weights
+ * and all.
+ *
+ * With AVX2 the tetrahedral weights, the interpolation (with gathers)
+ * and the stencil are vectorised; with NEON the stencil only.  The *_c
+ * versions are the reference: weights must match them bit for bit, the
+ * rest to rounding.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_DISPLAY_GAMUT_FIT_H__
+#define __TOOLS_DISPLAY_GAMUT_FIT_H__
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "dspp.h"
+
+namespace sde {
+
+#define GFIT_STENCIL		27	/* 3x3x3 neighbours, self included */
+#define GFIT_SELF		13
+#define GFIT_RAMP_GAMMA		2.2f	/* response interpolation domain */
+#define GFIT_RIDGE		1e-4f	/* pull towards the prior, keeps the system definite */
+#define GFIT_DARK		1e-2f	/* meter noise floor, of target white Y */
+
+enum gfit_space {
+	GFIT_SRGB,
+	GFIT_P3,
+	GFIT_BT2020,
+	GFIT_NR_SPACES,
+};
+
+/* Red, green, blue and white chromaticities */
+static const float gfit_primaries[GFIT_NR_SPACES][4][2] = {
+	{ { 0.640f, 0.330f }, { 0.300f, 0.600f }, { 0.150f, 0.060f }, { 0.3127f, 0.3290f } },
+	{ { 0.680f, 0.320f }, { 0.265f, 0.690f }, { 0.150f, 0.060f }, { 0.3127f, 0.3290f } },
+	{ { 0.708f, 0.292f }, { 0.170f, 0.797f }, { 0.131f, 0.046f }, { 0.3127f, 0.3290f } },
+};
+
+struct gfit_patch {
+	float d[3];		/* drive, r g b, 0..1 */
+	float xyz[3];
+};
+
+struct gfit_params {
+	int space = GFIT_SRGB;
+	float gamma = 0;	/* target EOTF exponent, 0 for the sRGB curve */
+	int grid = 17;		/* 17, 13 or 5 */
+	float lambda = 0.02f;	/* smoothness weight per pair of neighbours */
+	float slack = 0.02f;
+	int iters = 400;	/* conjugate gradient bound; 0 keeps the prior */
+	float tol = 1e-5f;	/* relative residual to stop at */
+	bool round8 = false;	/* PGC_8B_ROUND */
+	unsigned jobs = 1;
+};
+
+/* Target colour of gamut input v: black + m * eotf(v / DSPP_MAX) */
+struct gfit_target {
+	float m[3][3];
+	float black[3];
+	float gamma;
+};
+
+struct gfit_result {
+	drm_msm_3d_gamut gamut;
+	drm_msm_pgc_lut pgc;
+	gfit_target target;
+	float prior[3][3];	/* target linear to component intensity */
+	uint32_t samples, dropped;
+	int iters[3];
+	float rms_prior, rms;	/* at the samples, 12-bit codes */
+	double t_prep, t_assemble, t_solve;	/* microseconds */
+};
+
+/* Node grid with a ghost layer all round, so the stencil never leaves it */
+struct gfit_grid {
+	int n, p;
+	uint32_t size;
+	uint32_t lo, hi;	/* span the stencil is applied to */
+	int32_t off[GFIT_STENCIL];
+};
+
+/* Samples in planar arrays, padded with zero weights to a multiple of 8 */
+struct gfit_samples {
+	uint32_t count, n;
+	std::vector<float> x[3];	/* gamut input, 12-bit codes */
+	std::vector<float> u[3];	/* gamut output wanted */
+	std::vector<int32_t> base, a, b;
+	std::vector<float> w[4];
+	std::vector<float> q;		/* trust in the reading */
+};
+
+inline double gfit_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Both odd-symmetric, so slack means the same on either side of the cube */
+inline float gfit_eotf(float x, float gamma)
+{
+	if (x < 0)
+		return -gfit_eotf(-x, gamma);
+	if (gamma > 0)
+		return powf(x, gamma);
+	return x <= 0.04045f ? x / 12.92f : powf((x + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float gfit_oetf(float y, float gamma)
+{
+	if (y < 0)
+		return -gfit_oetf(-y, gamma);
+	if (gamma > 0)
+		return powf(y, 1 / gamma);
+	return y <= 0.0031308f ? y * 12.92f : 1.055f * powf(y, 1 / 2.4f) - 0.055f;
+}
+
+inline int gfit_inv3(const float a[3][3], float out[3][3])
+{
+	double det = (double)a[0][0] * ((double)a[1][1] * a[2][2] - (double)a[1][2] * a[2][1]) -
+		     (double)a[0][1] * ((double)a[1][0] * a[2][2] - (double)a[1][2] * a[2][0]) +
+		     (double)a[0][2] * ((double)a[1][0] * a[2][1] - (double)a[1][1] * a[2][0]);
+
+	if (fabs(det) < 1e-12)
+		return -EINVAL;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++) {
+			int r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+
+			out[i][j] = (float)(((double)a[r0][c0] * a[r1][c1] -
+					     (double)a[r0][c1] * a[r1][c0]) / det);
+		}
+	return 0;
+}
+
+inline void gfit_mul3(const float a[3][3], const float *v, float *out)
+{
+	float t[3];
+
+	for (int i = 0; i < 3; i++)
+		t[i] = a[i][0] * v[0] + a[i][1] * v[1] + a[i][2] * v[2];
+	memcpy(out, t, sizeof(t));
+}
+
+/* Linear RGB to XYZ for @space, white at Y = 1 */
+inline int gfit_space_matrix(int space, float m[3][3])
+{
+	const float (*xy)[2];
+	float p[3][3], pi[3][3], w[3], s[3];
+	int ret;
+
+	if (space < 0 || space >= GFIT_NR_SPACES)
+		return -EINVAL;
+	xy = gfit_primaries[space];
+	for (int c = 0; c < 3; c++) {
+		p[0][c] = xy[c][0] / xy[c][1];
+		p[1][c] = 1;
+		p[2][c] = (1 - xy[c][0] - xy[c][1]) / xy[c][1];
+	}
+	w[0] = xy[3][0] / xy[3][1];
+	w[1] = 1;
+	w[2] = (1 - xy[3][0] - xy[3][1]) / xy[3][1];
+	ret = gfit_inv3(p, pi);
+	if (ret)
+		return ret;
+	gfit_mul3(pi, w, s);
+	for (int i = 0; i < 3; i++)
+		for (int c = 0; c < 3; c++)
+			m[i][c] = p[i][c] * s[c];
+	return 0;
+}
+
+inline void gfit_target_xyz(const gfit_target &t, const float v[3], float xyz[3])
+{
+	float lin[3];
+
+	for (int c = 0; c < 3; c++)
+		lin[c] = gfit_eotf(v[c] / DSPP_MAX, t.gamma);
+	gfit_mul3(t.m, lin, xyz);
+	for (int c = 0; c < 3; c++)
+		xyz[c] += t.black[c];
+}
+
+inline void gfit_lab(const float xyz[3], const float white[3], double lab[3])
+{
+	double f[3];
+
+	for (int c = 0; c < 3; c++) {
+		double t = xyz[c] / white[c];
+
+		f[c] = t > 216.0 / 24389 ? cbrt(t) : (24389.0 / 27 * t + 16) / 116;
+	}
+	lab[0] = 116 * f[1] - 16;
+	lab[1] = 500 * (f[0] - f[1]);
+	lab[2] = 200 * (f[1] - f[2]);
+}
+
+/* CIEDE2000, unit weights */
+inline double gfit_de2000(const double p[3], const double q[3])
+{
+	const double deg = M_PI / 180, p25 = 6103515625.0;	/* 25^7 */
+	double c1 = hypot(p[1], p[2]), c2 = hypot(q[1], q[2]), cm = (c1 + c2) / 2;
+	double cm7 = pow(cm, 7), g = 0.5 * (1 - sqrt(cm7 / (cm7 + p25)));
+	double a1 = p[1] * (1 + g), a2 = q[1] * (1 + g);
+	double cp1 = hypot(a1, p[2]), cp2 = hypot(a2, q[2]);
+	double h1 = cp1 ? atan2(p[2], a1) : 0, h2 = cp2 ? atan2(q[2], a2) : 0;
+	double dl = q[0] - p[0], dc = cp2 - cp1, dh, hm, lm, cpm, cpm7, t, sl, sc, sh, rt;
+
+	if (h1 < 0)
+		h1 += 2 * M_PI;
+	if (h2 < 0)
+		h2 += 2 * M_PI;
+	dh = h2 - h1;
+	if (dh > M_PI)
+		dh -= 2 * M_PI;
+	else if (dh < -M_PI)
+		dh += 2 * M_PI;
+	if (!cp1 || !cp2)
+		dh = 0;
+	dh = 2 * sqrt(cp1 * cp2) * sin(dh / 2);
+
+	hm = h1 + h2;
+	if (cp1 && cp2) {
+		if (fabs(h1 - h2) > M_PI)
+			hm += hm < 2 * M_PI ? 2 * M_PI : -2 * M_PI;
+		hm /= 2;
+	}
+	lm = (p[0] + q[0]) / 2 - 50;
+	cpm = (cp1 + cp2) / 2;
+	cpm7 = pow(cpm, 7);
+	t = 1 - 0.17 * cos(hm - 30 * deg) + 0.24 * cos(2 * hm) + 0.32 * cos(3 * hm + 6 * deg) -
+	    0.20 * cos(4 * hm - 63 * deg);
+	sl = 1 + 0.015 * lm * lm / sqrt(20 + lm * lm);
+	sc = 1 + 0.045 * cpm;
+	sh = 1 + 0.015 * cpm * t;
+	rt = -2 * sqrt(cpm7 / (cpm7 + p25)) *
+	     sin(60 * deg * exp(-pow((hm / deg - 275) / 25, 2)));
+	return sqrt(pow(dl / sl, 2) + pow(dc / sc, 2) + pow(dh / sh, 2) +
+		    rt * (dc / sc) * (dh / sh));
+}
+
+inline int gfit_grid_init(gfit_grid *g, int n)
+{
+	if (n != 17 && n != 13 && n != 5)
+		return -EINVAL;
+	g->n = n;
+	g->p = n + 2;
+	g->size = (uint32_t)(g->p * g->p * g->p);
+	g->lo = (uint32_t)(g->p * g->p + g->p + 1);
+	g->hi = g->size - g->lo;
+	for (int j = 0; j < GFIT_STENCIL; j++)
+		g->off[j] = (j / 9 - 1) * g->p * g->p + (j / 3 % 3 - 1) * g->p + (j % 3 - 1);
+	return 0;
+}
+
+/* Padded index of node (@i, @j, @k), red-major */
+inline uint32_t gfit_node(const gfit_grid &g, int i, int j, int k)
+{
+	return (uint32_t)(((i + 1) * g.p + j + 1) * g.p + k + 1);
+}
+
+/*
+ * Cell and weights of each sample, as dspp_gamut_c() picks them: base
+ * node, the corner one step along the largest fraction, the one two
+ * steps along the largest two, and the far corner.  Outside the cube
+ * the nearest cell is used, its fractions past 0 or 1.
+ */
+inline void gfit_tetra_c(const gfit_grid &g, gfit_samples *s)
+{
+	const float scale = (g.n - 1) / 4096.0f;
+	const int32_t sr = g.p * g.p, sg = g.p, sb = 1, all = sr + sg + sb;
+
+	for (uint32_t i = 0; i < s->n; i++) {
+		float pr = s->x[0][i] * scale, pg = s->x[1][i] * scale, pb = s->x[2][i] * scale;
+		int32_t ir = std::min((int32_t)pr, g.n - 2), ig = std::min((int32_t)pg, g.n - 2);
+		int32_t ib = std::min((int32_t)pb, g.n - 2);
+		float fr = pr - (float)ir, fg = pg - (float)ig, fb = pb - (float)ib;
+		float f1 = std::max(std::max(fr, fg), fb), f3 = std::min(std::min(fr, fg), fb);
+		float f2 = fr + fg + fb - f1 - f3;
+
+		s->base[i] = ((ir + 1) * g.p + ig + 1) * g.p + ib + 1;
+		s->a[i] = fr >= fg && fr >= fb ? sr : fg >= fb ? sg : sb;
+		s->b[i] = all - (fr <= fg && fr <= fb ? sr : fg <= fb ? sg : sb);
+		s->w[0][i] = 1.0f - f1;
+		s->w[1][i] = f1 - f2;
+		s->w[2][i] = f2 - f3;
+		s->w[3][i] = f3;
+	}
+}
+
+/* Interpolate node values @v at every sample into @out */
+inline void gfit_eval_c(const gfit_grid &g, const gfit_samples &s, const float *const v[3],
+			float *const out[3])
+{
+	const int32_t all = g.p * g.p + g.p + 1;
+
+	for (int c = 0; c < 3; c++) {
+		const float *t = v[c];
+
+		for (uint32_t i = 0; i < s.n; i++) {
+			int32_t o = s.base[i];
+
+			out[c][i] = s.w[0][i] * t[o] + s.w[1][i] * t[o + s.a[i]] +
+				    s.w[2][i] * t[o + s.b[i]] + s.w[3][i] * t[o + all];
+		}
+	}
+}
+
+/* @y = K @x, K as GFIT_STENCIL planes of g.size coefficients */
+inline void gfit_apply_c(const gfit_grid &g, const float *k, const float *x, float *y)
+{
+	memset(y, 0, g.lo * sizeof(*y));
+	memset(y + g.hi, 0, (g.size - g.hi) * sizeof(*y));
+	for (uint32_t i = g.lo; i < g.hi; i++) {
+		float acc = 0;
+
+		for (int j = 0; j < GFIT_STENCIL; j++)
+			acc += k[j * g.size + i] * x[i + g.off[j]];
+		y[i] = acc;
+	}
+}
+
+#if defined(__AVX2__)
+
+static const char gfit_isa[] = "avx2";
+
+inline void gfit_tetra(const gfit_grid &g, gfit_samples *s)
+{
+	const __m256 scale = _mm256_set1_ps((g.n - 1) / 4096.0f), one = _mm256_set1_ps(1.0f);
+	const __m256i last = _mm256_set1_epi32(g.n - 2), p = _mm256_set1_epi32(g.p);
+	const __m256i k1 = _mm256_set1_epi32(1);
+	const __m256i sr = _mm256_set1_epi32(g.p * g.p), sg = p, sb = k1;
+	const __m256i all = _mm256_set1_epi32(g.p * g.p + g.p + 1);
+
+	for (uint32_t i = 0; i < s->n; i += 8) {
+		__m256 pr = _mm256_mul_ps(_mm256_loadu_ps(&s->x[0][i]), scale);
+		__m256 pg = _mm256_mul_ps(_mm256_loadu_ps(&s->x[1][i]), scale);
+		__m256 pb = _mm256_mul_ps(_mm256_loadu_ps(&s->x[2][i]), scale);
+		__m256i ir = _mm256_min_epi32(_mm256_cvttps_epi32(pr), last);
+		__m256i ig = _mm256_min_epi32(_mm256_cvttps_epi32(pg), last);
+		__m256i ib = _mm256_min_epi32(_mm256_cvttps_epi32(pb), last);
+		__m256 fr = _mm256_sub_ps(pr, _mm256_cvtepi32_ps(ir));
+		__m256 fg = _mm256_sub_ps(pg, _mm256_cvtepi32_ps(ig));
+		__m256 fb = _mm256_sub_ps(pb, _mm256_cvtepi32_ps(ib));
+		__m256 f1 = _mm256_max_ps(_mm256_max_ps(fr, fg), fb);
+		__m256 f3 = _mm256_min_ps(_mm256_min_ps(fr, fg), fb);
+		__m256 f2 = _mm256_sub_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(fr, fg), fb),
+							f1), f3);
+		__m256i ra = _mm256_castps_si256(_mm256_and_ps(_mm256_cmp_ps(fr, fg, _CMP_GE_OQ),
+							       _mm256_cmp_ps(fr, fb, _CMP_GE_OQ)));
+		__m256i ga = _mm256_castps_si256(_mm256_cmp_ps(fg, fb, _CMP_GE_OQ));
+		__m256i rz = _mm256_castps_si256(_mm256_and_ps(_mm256_cmp_ps(fr, fg, _CMP_LE_OQ),
+							       _mm256_cmp_ps(fr, fb, _CMP_LE_OQ)));
+		__m256i gz = _mm256_castps_si256(_mm256_cmp_ps(fg, fb, _CMP_LE_OQ));
+		__m256i base = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(
+			_mm256_mullo_epi32(_mm256_add_epi32(ir, k1), p), _mm256_add_epi32(ig, k1)), p),
+			_mm256_add_epi32(ib, k1));
+
+		_mm256_storeu_si256((__m256i *)&s->base[i], base);
+		_mm256_storeu_si256((__m256i *)&s->a[i],
+				    _mm256_blendv_epi8(_mm256_blendv_epi8(sb, sg, ga), sr, ra));
+		_mm256_storeu_si256((__m256i *)&s->b[i], _mm256_sub_epi32(all,
+				    _mm256_blendv_epi8(_mm256_blendv_epi8(sb, sg, gz), sr, rz)));
+		_mm256_storeu_ps(&s->w[0][i], _mm256_sub_ps(one, f1));
+		_mm256_storeu_ps(&s->w[1][i], _mm256_sub_ps(f1, f2));
+		_mm256_storeu_ps(&s->w[2][i], _mm256_sub_ps(f2, f3));
+		_mm256_storeu_ps(&s->w[3][i], f3);
+	}
+}
+
+inline void gfit_eval(const gfit_grid &g, const gfit_samples &s, const float *const v[3],
+		      float *const out[3])
+{
+	const __m256i all = _mm256_set1_epi32(g.p * g.p + g.p + 1);
+
+	for (uint32_t i = 0; i < s.n; i += 8) {
+		__m256i o = _mm256_loadu_si256((const __m256i *)&s.base[i]);
+		__m256i oa = _mm256_add_epi32(o, _mm256_loadu_si256((const __m256i *)&s.a[i]));
+		__m256i ob = _mm256_add_epi32(o, _mm256_loadu_si256((const __m256i *)&s.b[i]));
+		__m256i oz = _mm256_add_epi32(o, all);
+		__m256 w0 = _mm256_loadu_ps(&s.w[0][i]), w1 = _mm256_loadu_ps(&s.w[1][i]);
+		__m256 w2 = _mm256_loadu_ps(&s.w[2][i]), w3 = _mm256_loadu_ps(&s.w[3][i]);
+
+		for (int c = 0; c < 3; c++) {
+			__m256 acc = _mm256_mul_ps(w0, _mm256_i32gather_ps(v[c], o, 4));
+
+			acc = _mm256_fmadd_ps(w1, _mm256_i32gather_ps(v[c], oa, 4), acc);
+			acc = _mm256_fmadd_ps(w2, _mm256_i32gather_ps(v[c], ob, 4), acc);
+			acc = _mm256_fmadd_ps(w3, _mm256_i32gather_ps(v[c], oz, 4), acc);
+			_mm256_storeu_ps(&out[c][i], acc);
+		}
+	}
+}
+
+inline void gfit_apply(const gfit_grid &g, const float *k, const float *x, float *y)
+{
+	uint32_t i = g.lo;
+
+	memset(y, 0, g.lo * sizeof(*y));
+	memset(y + g.hi, 0, (g.size - g.hi) * sizeof(*y));
+	for (; i + 8 <= g.hi; i += 8) {
+		__m256 acc = _mm256_setzero_ps();
+
+		for (int j = 0; j < GFIT_STENCIL; j++)
+			acc = _mm256_fmadd_ps(_mm256_loadu_ps(&k[j * g.size + i]),
+					      _mm256_loadu_ps(&x[i + g.off[j]]), acc);
+		_mm256_storeu_ps(&y[i], acc);
+	}
+	for (; i < g.hi; i++) {
+		float acc = 0;
+
+		for (int j = 0; j < GFIT_STENCIL; j++)
+			acc += k[j * g.size + i] * x[i + g.off[j]];
+		y[i] = acc;
+	}
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static const char gfit_isa[] = "neon";
+
+inline void gfit_tetra(const gfit_grid &g, gfit_samples *s)
+{
+	gfit_tetra_c(g, s);
+}
+
+inline void gfit_eval(const gfit_grid &g, const gfit_samples &s, const float *const v[3],
+		      float *const out[3])
+{
+	gfit_eval_c(g, s, v, out);
+}
+
+inline void gfit_apply(const gfit_grid &g, const float *k, const float *x, float *y)
+{
+	uint32_t i = g.lo;
+
+	memset(y, 0, g.lo * sizeof(*y));
+	memset(y + g.hi, 0, (g.size - g.hi) * sizeof(*y));
+	for (; i + 4 <= g.hi; i += 4) {
+		float32x4_t acc = vdupq_n_f32(0);
+
+		for (int j = 0; j < GFIT_STENCIL; j++)
+			acc = vfmaq_f32(acc, vld1q_f32(&k[j * g.size + i]),
+					vld1q_f32(&x[i + g.off[j]]));
+		vst1q_f32(&y[i], acc);
+	}
+	for (; i < g.hi; i++) {
+		float acc = 0;
+
+		for (int j = 0; j < GFIT_STENCIL; j++)
+			acc += k[j * g.size + i] * x[i + g.off[j]];
+		y[i] = acc;
+	}
+}
+
+#else
+
+static const char gfit_isa[] = "c";
+
+inline void gfit_tetra(const gfit_grid &g, gfit_samples *s)
+{
+	gfit_tetra_c(g, s);
+}
+
+inline void gfit_eval(const gfit_grid &g, const gfit_samples &s, const float *const v[3],
+		      float *const out[3])
+{
+	gfit_eval_c(g, s, v, out);
+}
+
+inline void gfit_apply(const gfit_grid &g, const float *k, const float *x, float *y)
+{
+	gfit_apply_c(g, k, x, y);
+}
+
+#endif
+
+inline void gfit_samples_resize(gfit_samples *s, uint32_t count)
+{
+	s->count = count;
+	s->n = (count + 7) & ~7u;
+	for (int c = 0; c < 3; c++) {
+		s->x[c].assign(s->n, 0);
+		s->u[c].assign(s->n, 0);
+	}
+	s->base.assign(s->n, 0);
+	s->a.assign(s->n, 0);
+	s->b.assign(s->n, 0);
+	for (int c = 0; c < 4; c++)
+		s->w[c].assign(s->n, 0);
+	s->q.assign(s->n, 0);
+}
+
+/* Weights for every sample, the padding left at zero weight */
+inline void gfit_weigh(const gfit_grid &g, gfit_samples *s)
+{
+	gfit_tetra(g, s);
+	for (uint32_t i = s->count; i < s->n; i++)
+		for (int c = 0; c < 4; c++)
+			s->w[c][i] = 0;
+}
+
+/*
+ * Normal equations of the fit: @k the stencil planes, @rhs one vector
+ * per component, both over the padded grid.  Each thread sums its share
+ * of the samples into its own copy; the copies are added up after.
+ */
+inline void gfit_assemble(const gfit_grid &g, const gfit_samples &s,
+			  const std::vector<float> prior[3], float lambda, unsigned jobs,
+			  std::vector<float> *k, std::vector<float> rhs[3])
+{
+	const uint32_t chunk = 256, chunks = (s.count + chunk - 1) / chunk;
+	const int32_t sr = g.p * g.p, sg = g.p, all = sr + sg + 1;
+	std::vector<std::vector<float>> part;
+	std::atomic<uint32_t> next(0);
+	std::vector<std::thread> pool;
+
+	jobs = std::max(1u, std::min(jobs, chunks));
+	part.resize(jobs);
+	auto worker = [&](unsigned id) {
+		std::vector<float> &pk = part[id];
+
+		pk.assign((size_t)(GFIT_STENCIL + 3) * g.size, 0);
+		for (uint32_t c; (c = next++) < chunks;) {
+			for (uint32_t i = c * chunk; i < std::min(s.count, (c + 1) * chunk); i++) {
+				int32_t off[4] = { 0, s.a[i], s.b[i], all }, r[4], gr[4], b[4];
+				float w[4] = { s.w[0][i], s.w[1][i], s.w[2][i], s.w[3][i] };
+
+				for (int q = 0; q < 4; q++) {
+					r[q] = off[q] / sr;
+					gr[q] = off[q] % sr / sg;
+					b[q] = off[q] % sg;
+				}
+				for (int q0 = 0; q0 < 4; q0++) {
+					uint32_t n = (uint32_t)(s.base[i] + off[q0]);
+
+					float wq = w[q0] * s.q[i];
+
+					for (int q1 = 0; q1 < 4; q1++) {
+						int j = GFIT_SELF + 9 * (r[q1] - r[q0]) +
+							3 * (gr[q1] - gr[q0]) + b[q1] - b[q0];
+
+						pk[(size_t)j * g.size + n] += wq * w[q1];
+					}
+					for (int c3 = 0; c3 < 3; c3++)
+						pk[(size_t)(GFIT_STENCIL + c3) * g.size + n] +=
+							wq * s.u[c3][i];
+				}
+			}
+		}
+	};
+
+	for (unsigned j = 1; j < jobs; j++)
+		pool.emplace_back(worker, j);
+	worker(0);
+	for (auto &t : pool)
+		t.join();
+
+	for (unsigned j = 1; j < jobs; j++)
+		for (size_t i = 0; i < part[0].size(); i++)
+			part[0][i] += part[j][i];
+	k->assign(part[0].begin(), part[0].begin() + (size_t)GFIT_STENCIL * g.size);
+	for (int c = 0; c < 3; c++)
+		rhs[c].assign(part[0].begin() + (size_t)(GFIT_STENCIL + c) * g.size,
+			      part[0].begin() + (size_t)(GFIT_STENCIL + c + 1) * g.size);
+
+	/* Six face neighbours per node, each pair's penalty split between its two ends */
+	for (int i = 0; i < g.n; i++)
+		for (int j = 0; j < g.n; j++)
+			for (int l = 0; l < g.n; l++) {
+				const int nb[6][4] = {
+					{ i - 1, j, l, GFIT_SELF - 9 }, { i + 1, j, l, GFIT_SELF + 9 },
+					{ i, j - 1, l, GFIT_SELF - 3 }, { i, j + 1, l, GFIT_SELF + 3 },
+					{ i, j, l - 1, GFIT_SELF - 1 }, { i, j, l + 1, GFIT_SELF + 1 },
+				};
+				uint32_t n = gfit_node(g, i, j, l);
+
+				(*k)[(size_t)GFIT_SELF * g.size + n] += GFIT_RIDGE;
+				for (int c = 0; c < 3; c++)
+					rhs[c][n] += GFIT_RIDGE * prior[c][n];
+				for (int e = 0; e < 6; e++) {
+					uint32_t m;
+
+					if (nb[e][0] < 0 || nb[e][0] >= g.n || nb[e][1] < 0 ||
+					    nb[e][1] >= g.n || nb[e][2] < 0 || nb[e][2] >= g.n)
+						continue;
+					m = gfit_node(g, nb[e][0], nb[e][1], nb[e][2]);
+					(*k)[(size_t)GFIT_SELF * g.size + n] += lambda;
+					(*k)[(size_t)nb[e][3] * g.size + n] -= lambda;
+					for (int c = 0; c < 3; c++)
+						rhs[c][n] += lambda * (prior[c][n] - prior[c][m]);
+				}
+			}
+}
+
+inline double gfit_dot(const float *a, const float *b, uint32_t n)
+{
+	double s = 0;
+
+	for (uint32_t i = 0; i < n; i++)
+		s += (double)a[i] * b[i];
+	return s;
+}
+
+/* Solve K @x = @rhs from the @x given; returns the iterations taken */
+inline int gfit_cg(const gfit_grid &g, const float *k, const float *idiag, const float *rhs,
+		   float *x, int iters, float tol)
+{
+	std::vector<float> r(g.size), z(g.size), p(g.size), q(g.size);
+	double bn = sqrt(gfit_dot(rhs, rhs, g.size)), rz, pq;
+	int it;
+
+	gfit_apply(g, k, x, q.data());
+	for (uint32_t i = 0; i < g.size; i++) {
+		r[i] = rhs[i] - q[i];
+		z[i] = p[i] = idiag[i] * r[i];
+	}
+	rz = gfit_dot(r.data(), z.data(), g.size);
+	for (it = 0; it < iters; it++) {
+		float alpha, beta;
+		double rz1;
+
+		if (sqrt(gfit_dot(r.data(), r.data(), g.size)) <= tol * bn)
+			break;
+		gfit_apply(g, k, p.data(), q.data());
+		pq = gfit_dot(p.data(), q.data(), g.size);
+		if (pq <= 0)
+			break;
+		alpha = (float)(rz / pq);
+		for (uint32_t i = 0; i < g.size; i++) {
+			x[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+			z[i] = idiag[i] * r[i];
+		}
+		rz1 = gfit_dot(r.data(), z.data(), g.size);
+		beta = (float)(rz1 / rz);
+		rz = rz1;
+		for (uint32_t i = 0; i < g.size; i++)
+			p[i] = z[i] + beta * p[i];
+	}
+	return it;
+}
+
+/*
+ * Response of each component from its ramp: sorted drive levels and
+ * intensity to the 1/GFIT_RAMP_GAMMA, from 0 at black to 1 at full
+ * drive, made non-decreasing.  @black and @prim (XYZ less black, a
+ * component per column) come out with it.
+ */
+inline int gfit_responses(const gfit_patch *pt, size_t n, float black[3], float prim[3][3],
+			  std::vector<float> d[3], std::vector<float> e[3])
+{
+	float sum[3][3] = {}, bsum[3] = {};
+	uint32_t cnt[3] = {}, bcnt = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		int lit = 0, c = 0;
+
+		for (int j = 0; j < 3; j++)
+			if (pt[i].d[j] < 0 || pt[i].d[j] > 1)
+				return -EINVAL;
+			else if (pt[i].d[j] > 0)
+				lit++, c = j;
+		if (!lit) {
+			for (int j = 0; j < 3; j++)
+				bsum[j] += pt[i].xyz[j];
+			bcnt++;
+		} else if (lit == 1 && pt[i].d[c] == 1) {
+			for (int j = 0; j < 3; j++)
+				sum[c][j] += pt[i].xyz[j];
+			cnt[c]++;
+		}
+	}
+	for (int j = 0; j < 3; j++)
+		black[j] = bcnt ? bsum[j] / bcnt : 0;
+	for (int c = 0; c < 3; c++) {
+		if (!cnt[c])
+			return -EINVAL;
+		for (int j = 0; j < 3; j++)
+			prim[j][c] = sum[c][j] / cnt[c] - black[j];
+	}
+
+	for (int c = 0; c < 3; c++) {
+		std::vector<std::pair<float, float>> pts;
+		float pp = prim[0][c] * prim[0][c] + prim[1][c] * prim[1][c] +
+			   prim[2][c] * prim[2][c];
+		float top;
+
+		if (!(pp > 0))
+			return -EINVAL;
+		pts.emplace_back(0.0f, 0.0f);
+		for (size_t i = 0; i < n; i++) {
+			float v = 0;
+
+			if (!(pt[i].d[c] > 0) || pt[i].d[(c + 1) % 3] > 0 || pt[i].d[(c + 2) % 3] > 0)
+				continue;
+			for (int j = 0; j < 3; j++)
+				v += (pt[i].xyz[j] - black[j]) * prim[j][c];
+			pts.emplace_back(pt[i].d[c], v / pp);
+		}
+		std::sort(pts.begin(), pts.end());
+
+		d[c].clear();
+		e[c].clear();
+		for (size_t i = 0; i < pts.size();) {
+			size_t j = i;
+			float v = 0;
+
+			for (; j < pts.size() && pts[j].first == pts[i].first; j++)
+				v += pts[j].second;
+			d[c].push_back(pts[i].first);
+			e[c].push_back(powf(std::max(v / (j - i), 0.0f), 1 / GFIT_RAMP_GAMMA));
+			i = j;
+		}
+		e[c][0] = 0;
+		for (size_t i = 1; i < e[c].size(); i++)
+			e[c][i] = std::max(e[c][i], e[c][i - 1]);
+		top = e[c].back();
+		if (!(top > 0))
+			return -EINVAL;
+		for (auto &v : e[c])
+			v /= top;
+	}
+	return 0;
+}
+
+/* Drive at which the response @d, @e reaches @v */
+inline float gfit_invert(const std::vector<float> &d, const std::vector<float> &e, float v)
+{
+	size_t j = std::upper_bound(e.begin(), e.end(), v) - e.begin();
+
+	if (j == 0)
+		return d.front();
+	if (j == e.size())
+		return d.back();
+	if (e[j] == e[j - 1])
+		return d[j - 1];
+	return d[j - 1] + (d[j] - d[j - 1]) * (v - e[j - 1]) / (e[j] - e[j - 1]);
+}
+
+/* Gamut output that the PGC table @t (PGC_TBL_LEN + 1 entries) takes to @v */
+inline float gfit_pgc_inverse(const int32_t *t, float v)
+{
+	int lo = 0, hi = PGC_TBL_LEN;
+
+	if (v <= t[0])
+		return 0;
+	if (v >= t[PGC_TBL_LEN])
+		return DSPP_MAX;
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+
+		if (t[mid] <= v)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return std::min<float>(8 * (lo + (v - t[lo]) / (float)(t[hi] - t[lo])), DSPP_MAX);
+}
+
+/*
+ * How much of the primaries' sum full white really reaches, by its
+ * weakest component; 1 without a full white patch.
+ */
+inline float gfit_white_ratio(const gfit_patch *pt, size_t n, const float black[3],
+			      const float pinv[3][3])
+{
+	float sum[3] = {}, in[3];
+	uint32_t cnt = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (pt[i].d[0] != 1 || pt[i].d[1] != 1 || pt[i].d[2] != 1)
+			continue;
+		for (int j = 0; j < 3; j++)
+			sum[j] += pt[i].xyz[j] - black[j];
+		cnt++;
+	}
+	if (!cnt)
+		return 1;
+	for (int j = 0; j < 3; j++)
+		sum[j] /= cnt;
+	gfit_mul3(pinv, sum, in);
+	return std::min(std::max(std::min(std::min(in[0], in[1]), in[2]), 0.1f), 1.0f);
+}
+
+inline int gfit_run(const gfit_patch *pt, size_t n, const gfit_params &prm, gfit_result *res)
+{
+	std::vector<float> d[3], e[3], prior[3], val[3], kmat, rhs[3], idiag;
+	int32_t pgc[3][PGC_TBL_LEN + 1];
+	float prim[3][3], pinv[3][3], tm[3][3], tinv[3][3], one[3] = { 1, 1, 1 }, w[3];
+	double t0 = gfit_now_us(), t1;
+	gfit_samples s;
+	gfit_grid g;
+	int ret;
+
+	memset(res, 0, sizeof(*res));
+	ret = gfit_grid_init(&g, prm.grid);
+	if (ret)
+		return ret;
+	if (!(prm.lambda >= 0) || !(prm.slack >= 0) || prm.iters < 0 || prm.gamma < 0)
+		return -EINVAL;
+	ret = gfit_responses(pt, n, res->target.black, prim, d, e);
+	if (ret)
+		return ret;
+
+	/* Target white as bright as the weakest component allows */
+	ret = gfit_space_matrix(prm.space, tm);
+	if (!ret)
+		ret = gfit_inv3(prim, pinv);
+	if (ret)
+		return ret;
+	{
+		float q[3][3], top;
+
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				q[i][j] = pinv[i][0] * tm[0][j] + pinv[i][1] * tm[1][j] +
+					  pinv[i][2] * tm[2][j];
+		gfit_mul3(q, one, w);
+		top = std::max(std::max(w[0], w[1]), w[2]) / gfit_white_ratio(pt, n, res->target.black,
+									      pinv);
+		if (!(top > 0))
+			return -EINVAL;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++) {
+				res->target.m[i][j] = tm[i][j] / top;
+				res->prior[i][j] = q[i][j] / top;
+			}
+	}
+	res->target.gamma = prm.gamma;
+	ret = gfit_inv3(res->target.m, tinv);
+	if (ret)
+		return ret;
+
+	/* PGC: each component alone follows the target EOTF */
+	res->pgc.flags = prm.round8 ? PGC_8B_ROUND : 0;
+	for (int c = 0; c < 3; c++) {
+		__u32 *out = c == 0 ? res->pgc.c2 : c == 1 ? res->pgc.c0 : res->pgc.c1;
+
+		for (int i = 0; i < PGC_TBL_LEN; i++) {
+			float v = gfit_eotf(std::min(8 * i, DSPP_MAX) / (float)DSPP_MAX, prm.gamma);
+			float dv = gfit_invert(d[c], e[c], powf(v, 1 / GFIT_RAMP_GAMMA));
+
+			out[i] = (__u32)lrintf(std::min(std::max(dv, 0.0f), 1.0f) * DSPP_MAX);
+			pgc[c][i] = (int32_t)out[i];
+		}
+		pgc[c][PGC_TBL_LEN] = dspp_clamp(2 * pgc[c][PGC_TBL_LEN - 1] -
+						 pgc[c][PGC_TBL_LEN - 2], 0, DSPP_MAX);
+	}
+
+	/* Samples of the inverse mapping: where each patch sits in the target cube */
+	{
+		float floor = GFIT_DARK * (res->target.m[1][0] + res->target.m[1][1] +
+					   res->target.m[1][2]);
+		std::vector<float> keep;
+
+		for (size_t i = 0; i < n; i++) {
+			float xyz[3], lin[3];
+			bool in = true;
+
+			for (int j = 0; j < 3; j++)
+				xyz[j] = pt[i].xyz[j] - res->target.black[j];
+			gfit_mul3(tinv, xyz, lin);
+			for (int c = 0; c < 3; c++) {
+				float x = gfit_oetf(lin[c], prm.gamma);
+
+				if (!(x >= -prm.slack && x <= 1 + prm.slack))
+					in = false;
+				lin[c] = x * DSPP_MAX;
+			}
+			if (!in) {
+				res->dropped++;
+				continue;
+			}
+			for (int c = 0; c < 3; c++)
+				keep.push_back(lin[c]);
+			for (int c = 0; c < 3; c++)
+				keep.push_back(gfit_pgc_inverse(pgc[c], pt[i].d[c] * DSPP_MAX));
+			keep.push_back(std::max(xyz[1], 0.0f) / (std::max(xyz[1], 0.0f) + floor));
+		}
+		gfit_samples_resize(&s, (uint32_t)(keep.size() / 7));
+		for (uint32_t i = 0; i < s.count; i++) {
+			for (int c = 0; c < 3; c++) {
+				s.x[c][i] = keep[7 * i + c];
+				s.u[c][i] = keep[7 * i + 3 + c];
+			}
+			s.q[i] = keep[7 * i + 6];
+		}
+		res->samples = s.count;
+	}
+	if (!s.count)
+		return -EINVAL;
+	gfit_weigh(g, &s);
+
+	/* Prior: the matrix-only calibration, clipped to the panel gamut */
+	for (int c = 0; c < 3; c++) {
+		prior[c].assign(g.size, 0);
+		val[c].assign(g.size, 0);
+	}
+	for (int i = 0; i < g.n; i++)
+		for (int j = 0; j < g.n; j++)
+			for (int l = 0; l < g.n; l++) {
+				float lin[3] = { (float)i, (float)j, (float)l }, in[3];
+				uint32_t m = gfit_node(g, i, j, l);
+
+				for (int c = 0; c < 3; c++)
+					lin[c] = gfit_eotf(lin[c] * 4096 / (g.n - 1) / DSPP_MAX,
+							   prm.gamma);
+				gfit_mul3(res->prior, lin, in);
+				for (int c = 0; c < 3; c++)
+					prior[c][m] = val[c][m] = gfit_oetf(std::min(std::max(in[c],
+						0.0f), 1.0f), prm.gamma) * DSPP_MAX;
+			}
+	t1 = gfit_now_us();
+	res->t_prep = t1 - t0;
+
+	gfit_assemble(g, s, prior, prm.lambda, prm.jobs, &kmat, rhs);
+	idiag.assign(g.size, 0);
+	for (uint32_t i = 0; i < g.size; i++)
+		if (kmat[(size_t)GFIT_SELF * g.size + i] > 0)
+			idiag[i] = 1 / kmat[(size_t)GFIT_SELF * g.size + i];
+	t0 = gfit_now_us();
+	res->t_assemble = t0 - t1;
+
+	{
+		std::atomic<int> next(0);
+		std::vector<std::thread> pool;
+		unsigned jobs = std::max(1u, std::min(prm.jobs, 3u));
+		auto worker = [&]() {
+			for (int c; (c = next++) < 3;)
+				res->iters[c] = gfit_cg(g, kmat.data(), idiag.data(), rhs[c].data(),
+							val[c].data(), prm.iters, prm.tol);
+		};
+
+		for (unsigned j = 1; j < jobs; j++)
+			pool.emplace_back(worker);
+		worker();
+		for (auto &t : pool)
+			t.join();
+	}
+	res->t_solve = gfit_now_us() - t0;
+
+	/* Residual at the samples, before and after */
+	{
+		std::vector<float> fit[3];
+		const float *pv[3] = { prior[0].data(), prior[1].data(), prior[2].data() };
+		const float *fv[3] = { val[0].data(), val[1].data(), val[2].data() };
+		float *out[3];
+		double e0 = 0, e1 = 0;
+
+		for (int c = 0; c < 3; c++) {
+			fit[c].resize(s.n);
+			out[c] = fit[c].data();
+		}
+		gfit_eval(g, s, pv, out);
+		for (int c = 0; c < 3; c++)
+			for (uint32_t i = 0; i < s.count; i++)
+				e0 += (fit[c][i] - s.u[c][i]) * (fit[c][i] - s.u[c][i]);
+		gfit_eval(g, s, fv, out);
+		for (int c = 0; c < 3; c++)
+			for (uint32_t i = 0; i < s.count; i++)
+				e1 += (fit[c][i] - s.u[c][i]) * (fit[c][i] - s.u[c][i]);
+		res->rms_prior = (float)sqrt(e0 / (3.0 * s.count));
+		res->rms = (float)sqrt(e1 / (3.0 * s.count));
+	}
+
+	res->gamut.flags = GAMUT_3D_MAP_EN;
+	res->gamut.mode = g.n == 17 ? GAMUT_3D_MODE_17 : g.n == 13 ? GAMUT_3D_MODE_13 :
+			  GAMUT_3D_MODE_5;
+	for (int i = 0, nn = 0; i < g.n; i++)
+		for (int j = 0; j < g.n; j++)
+			for (int l = 0; l < g.n; l++, nn++) {
+				drm_msm_3d_col *c = &res->gamut.col[nn % GAMUT_3D_TBL_NUM]
+								 [nn / GAMUT_3D_TBL_NUM];
+				uint32_t m = gfit_node(g, i, j, l), q[3];
+
+				for (int k = 0; k < 3; k++)
+					q[k] = (uint32_t)dspp_clamp((int32_t)lrintf(val[k][m]), 0,
+								    DSPP_MAX);
+				c->c2_c1 = q[0] << 16 | q[2];
+				c->c0 = q[1];
+			}
+	return 0;
+}
+
+} /* namespace sde */
+
+#endif /* __TOOLS_DISPLAY_GAMUT_FIT_H__ */
@@ -0,0 +1,630 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Run the histogram and LTM stats consumer against a simulated driver,
+ * and compare it with copying every buffer and rebuilding every curve.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -I../../kernel-headers -o ltm_stats ltm_stats.cpp
+ * Usage: ltm_stats [-r hz] [-f frames] [-t threshold] [-c clip] [-S strength]
+ *                  [-F] [-C] [-s seed]
+ *        ltm_stats -b [-r hz] [-f frames] [-s seed]
+ *
+ * The simulated driver owns LTM_BUFFER_SIZE memfd buffers, handed to the
+ * consumer as the driver would get them in drm_msm_ltm_buffers_ctrl, and
+ * sends a DRM_EVENT_HISTOGRAM and a DRM_EVENT_LTM_HIST per frame over a
+ * SOCK_SEQPACKET socket, one frame per read() as from a DRM fd.  If no
+ * buffer has been queued back in time the frame's LTM stats are lost,
+ * as on hardware.  The content is scenes of a few seconds, still, slowly
+ * panning or moving fast, with grain on every histogram, and the odd
+ * saturated frame.
+ *
+ * -r is the frame rate (default 120, 0 for as fast as it goes) and -f
+ * the frames (default 1200).  -t, -c and -S are the consumer's
+ * rebuild threshold (default 0.02), clip (3) and strength (0.5); -F
+ * rebuilds everything every frame and -C copies the stats out of the
+ * buffer first, which together are what the daemon used to do.  It
+ * prints the worker's CPU time per frame, the zones rebuilt, the
+ * latency from reading an event to being done with it, and what got
+ * dropped.
+ *
+ * -b checks the ring, the vector distance, curves, event parsing, and
+ * that rebuilding past a zero threshold gives the curves a full rebuild
+ * does, then runs both ways at -r and unpaced.
+ *
+ * Example:
+ *   ltm_stats -r 120 -f 2400 -t 0.03
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ltm_stats.h"
+
+using namespace sde;
+
+#define SIM_PIXELS	(1080 * 2400)
+#define SIM_COLS	8
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static float uniform(uint64_t *x)
+{
+	return (xorshift(x) >> 40) / (float)(1 << 24);
+}
+
+static float normal(uint64_t *x)
+{
+	float u = std::max(uniform(x), 1e-7f), v = uniform(x);
+
+	return sqrtf(-2 * logf(u)) * cosf(6.2831853f * v);
+}
+
+struct scene {
+	float phase, speed, dark, bright, spread;
+	uint32_t left;
+};
+
+static void next_scene(scene *sc, uint64_t *x)
+{
+	float r = uniform(x);
+
+	sc->left = 120 + (uint32_t)(uniform(x) * 360);
+	sc->speed = r < 0.4f ? 0 : r < 0.8f ? 0.004f : 0.06f;
+	sc->phase = uniform(x) * 20;
+	sc->dark = 0.05f + uniform(x) * 0.25f;
+	sc->bright = 0.5f + uniform(x) * 0.45f;
+	sc->spread = 0.04f + uniform(x) * 0.08f;
+}
+
+/*
+ * One frame of stats: every zone a mix of a dark and a bright lobe, the
+ * mix following a pattern that pans with the scene, plus grain.
+ */
+static void make_stats(scene *sc, uint64_t *x, float grain, drm_msm_ltm_stats_data *s,
+		       uint32_t *hist)
+{
+	const float per_zone = SIM_PIXELS / (float)LTM_ZONES;
+	float pdf[HIST_V_SIZE], g[HIST_V_SIZE] = {};
+
+	if (!sc->left--)
+		next_scene(sc, x);
+	sc->phase += sc->speed;
+
+	for (int z = 0; z < LTM_ZONES; z++) {
+		float zx = (float)(z % SIM_COLS) + sc->phase, zy = (float)(z / SIM_COLS);
+		float w = 0.5f + 0.45f * sinf(0.9f * zx + 1.7f * zy) * cosf(0.35f * zx - 0.6f * zy);
+		float k = -0.5f / (sc->spread * sc->spread), sum = 0;
+
+		for (int b = 0; b < HIST_V_SIZE; b++) {
+			float v = (b + 0.5f) / HIST_V_SIZE, d0 = v - sc->dark, d1 = v - sc->bright;
+
+			pdf[b] = (1 - w) * expf(k * d0 * d0) + w * expf(k * d1 * d1);
+			sum += pdf[b];
+		}
+		for (int i = 0; i < LTM_BINS; i++) {
+			float c = per_zone * (pdf[2 * i] + pdf[2 * i + 1]) / sum;
+
+			c += normal(x) * sqrtf(c) * grain;
+			s->stats_01[z][i] = (uint32_t)std::max(c, 0.0f);
+			g[2 * i] += per_zone * pdf[2 * i] / sum;
+			g[2 * i + 1] += per_zone * pdf[2 * i + 1] / sum;
+		}
+	}
+	for (int b = 0; b < HIST_V_SIZE; b++) {
+		hist[b] = (uint32_t)std::max(g[b] + normal(x) * sqrtf(g[b]) * grain, 0.0f);
+		s->stats_02[b] = hist[b];
+	}
+	s->status_flag = uniform(x) < 0.005f ? LTM_STATS_SAT : 0;
+	s->display_h = 1080;
+	s->display_v = 2400;
+	s->feature_flag = LTM_HIST_CHECKSUM_SUPPORT;
+	s->checksum = ltm_checksum(*s);
+}
+
+/* One event record as the driver lays it out */
+static size_t put_event(uint8_t *p, uint32_t type, const void *payload, uint32_t size)
+{
+	drm_msm_event_resp r = {};
+
+	r.base.type = type;
+	r.base.length = (uint32_t)sizeof(r) + size;
+	r.info.event = type;
+	memcpy(p, &r, sizeof(r));
+	memcpy(p + sizeof(r), payload, size);
+	return r.base.length;
+}
+
+struct sim {
+	int fd[LTM_BUFFER_SIZE];
+	uint8_t *map[LTM_BUFFER_SIZE];
+	int sock[2];
+	std::atomic<uint32_t> free_mask;
+	uint64_t frames, starved;
+
+	sim() : fd{}, map{}, sock{ -1, -1 }, free_mask(0), frames(0), starved(0) {}
+
+	~sim()
+	{
+		for (int i = 0; i < LTM_BUFFER_SIZE; i++) {
+			if (map[i])
+				munmap(map[i], LTM_MAP_SIZE);
+			if (fd[i] > 0)
+				close(fd[i]);
+		}
+		for (int s : sock)
+			if (s >= 0)
+				close(s);
+	}
+
+	int init(drm_msm_ltm_buffers_ctrl *ctrl)
+	{
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock))
+			return -errno;
+		ctrl->num_of_buffers = LTM_BUFFER_SIZE;
+		for (int i = 0; i < LTM_BUFFER_SIZE; i++) {
+			fd[i] = memfd_create("ltm_stats", MFD_CLOEXEC);
+			if (fd[i] < 0 || ftruncate(fd[i], LTM_MAP_SIZE))
+				return -errno;
+			void *p = mmap(nullptr, LTM_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+				       fd[i], 0);
+			if (p == MAP_FAILED)
+				return -errno;
+			map[i] = static_cast<uint8_t *>(p);
+			ctrl->fds[i] = (uint32_t)fd[i];
+		}
+		free_mask = (1u << LTM_BUFFER_SIZE) - 1;
+		return 0;
+	}
+
+	void requeue(uint32_t f)
+	{
+		for (int i = 0; i < LTM_BUFFER_SIZE; i++)
+			if ((uint32_t)fd[i] == f)
+				free_mask.fetch_or(1u << i);
+	}
+
+	/* The driver's side: @n frames at @hz, then hang up */
+	void run(uint64_t n, double hz, uint64_t seed, float grain)
+	{
+		std::unique_ptr<drm_msm_ltm_stats_data> s(new drm_msm_ltm_stats_data());
+		uint8_t rec[2 * sizeof(drm_msm_event_resp) + sizeof(drm_msm_hist) +
+			    sizeof(drm_msm_ltm_buffer)];
+		drm_msm_hist h = {};
+		struct timespec t;
+		uint64_t x = seed;
+		scene sc;
+
+		next_scene(&sc, &x);
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		for (uint64_t f = 0; f < n; f++) {
+			uint32_t m = free_mask.load(), len;
+			drm_msm_ltm_buffer lb = {};
+
+			if (hz > 0) {
+				uint64_t ns = t.tv_nsec + (uint64_t)(1e9 / hz);
+
+				t.tv_sec += ns / 1000000000;
+				t.tv_nsec = ns % 1000000000;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr);
+			}
+			make_stats(&sc, &x, grain, s.get(), h.data);
+			len = put_event(rec, DRM_EVENT_HISTOGRAM, &h, sizeof(h));
+			if (m) {
+				int i = __builtin_ctz(m);
+
+				lb.fd = (uint32_t)fd[i];
+				lb.offset = (uint32_t)(f * 28) % (LTM_GUARD_BYTES + 1) & ~3u;
+				memcpy(map[i] + lb.offset, s.get(), sizeof(*s));
+				free_mask.fetch_and(~(1u << i));
+				len += put_event(rec + len, DRM_EVENT_LTM_HIST, &lb, sizeof(lb));
+			} else {
+				starved++;
+			}
+			if (send(sock[0], rec, len, 0) < 0)
+				break;
+			frames++;
+		}
+		shutdown(sock[0], SHUT_WR);
+	}
+};
+
+struct run_result {
+	ltm_counters c;
+	uint64_t frames, starved;
+	double wall_us;
+};
+
+static int run_sim(const ltm_opts &o, double hz, uint64_t frames, uint64_t seed, run_result *r)
+{
+	std::unique_ptr<ltm_consumer> con(new ltm_consumer);
+	drm_msm_ltm_buffers_ctrl ctrl = {};
+	ltm_callbacks cb;
+	std::vector<uint8_t> buf(4096);
+	sim sm;
+	double t0;
+	int ret;
+
+	ret = sm.init(&ctrl);
+	if (ret)
+		return ret;
+	cb.requeue = [&](uint32_t fd) { sm.requeue(fd); };
+	ret = con->init(ctrl, o, cb);
+	if (ret)
+		return ret;
+
+	t0 = now_us();
+	con->start();
+	std::thread src([&]() { sm.run(frames, hz, seed, 0.3f); });
+	for (;;) {
+		ssize_t n = read(sm.sock[1], buf.data(), buf.size());
+
+		if (n <= 0)
+			break;
+		con->feed(buf.data(), (size_t)n, ltm_now_ns());
+	}
+	src.join();
+	con->stop();
+	r->wall_us = now_us() - t0;
+	r->c = con->counters();
+	r->frames = sm.frames;
+	r->starved = sm.starved;
+	return 0;
+}
+
+static void print_run(const char *name, const run_result &r)
+{
+	const ltm_counters &c = r.c;
+	uint64_t done = c.ltm + c.hist;
+
+	printf("%-12s %6llu frames %7.1f us/frame cpu  %5.2f zones/frame  %5llu curve pubs"
+	       "  latency p50 %6.1f p99 %7.1f max %7.1f us\n",
+	       name, (unsigned long long)r.frames,
+	       done ? c.busy_ns / 1e3 / (double)r.frames : 0.0,
+	       c.ltm ? (double)c.zone_builds / (double)c.ltm : 0.0,
+	       (unsigned long long)(c.ltm_pubs + c.cabl_pubs), ltm_latency(c, 0.5),
+	       ltm_latency(c, 0.99), c.lat_max / 1e3);
+	printf("%-12s %6llu starved %4llu overrun %4llu saturated %4llu bad  %.0f fps\n", "",
+	       (unsigned long long)r.starved, (unsigned long long)c.overrun,
+	       (unsigned long long)c.sat,
+	       (unsigned long long)(c.bad_sum + c.bad_buf + c.malformed),
+	       r.frames / r.wall_us * 1e6);
+}
+
+static int check_ring(void)
+{
+	std::unique_ptr<spsc_ring<uint64_t, 64>> r(new spsc_ring<uint64_t, 64>);
+	const uint64_t n = 1000000;
+	uint64_t bad = 0;
+
+	std::thread prod([&]() {
+		for (uint64_t i = 0; i < n;)
+			if (r->push(i))
+				i++;
+			else
+				std::this_thread::yield();
+	});
+	for (uint64_t i = 0; i < n;) {
+		uint64_t *v = r->front();
+
+		if (!v) {
+			std::this_thread::yield();
+			continue;
+		}
+		bad += *v != i++;
+		r->pop();
+	}
+	prod.join();
+	if (bad || !r->empty()) {
+		fprintf(stderr, "check: ring out of order %llu times\n", (unsigned long long)bad);
+		return -EIO;
+	}
+	return 0;
+}
+
+static int check_kernels(uint64_t *x)
+{
+	uint32_t a[HIST_V_SIZE], b[HIST_V_SIZE], c[LTM_KNOTS];
+
+	for (int t = 0; t < 200; t++) {
+		uint32_t n = t & 1 ? HIST_V_SIZE : LTM_BINS;
+		uint64_t sa, sb, ta, tb, d, e;
+
+		for (uint32_t i = 0; i < n; i++) {
+			a[i] = (uint32_t)xorshift(x) >> (t % 32);
+			b[i] = (uint32_t)xorshift(x) >> (t % 32);
+		}
+		d = ltm_l1(a, b, n, &sa, &sb);
+		e = ltm_l1_c(a, b, n, &ta, &tb);
+		if (d != e || sa != ta || sb != tb) {
+			fprintf(stderr, "check: %s distance %llu, c %llu\n", ltm_isa,
+				(unsigned long long)d, (unsigned long long)e);
+			return -EIO;
+		}
+	}
+
+	for (int i = 0; i < LTM_BINS; i++)
+		a[i] = 1000;
+	ltm_curve(a, LTM_BINS, 3, 1, c);
+	for (int k = 0; k < LTM_KNOTS; k++)
+		if (abs((int)c[k] - (int)std::min(k * 128, LTM_MAX)) > 1) {
+			fprintf(stderr, "check: flat histogram knot %d is %u\n", k, c[k]);
+			return -EIO;
+		}
+	for (int t = 0; t < 100; t++) {
+		for (int i = 0; i < LTM_BINS; i++)
+			a[i] = uniform(x) < 0.3f ? (uint32_t)(xorshift(x) % 100000) : 0;
+		ltm_curve(a, LTM_BINS, 1 + uniform(x) * 4, uniform(x), c);
+		for (int k = 1; k < LTM_KNOTS; k++)
+			if (c[k] < c[k - 1] || c[k] > LTM_MAX) {
+				fprintf(stderr, "check: curve not monotone at knot %d\n", k);
+				return -EIO;
+			}
+		if (c[0] || c[LTM_KNOTS - 1] != LTM_MAX) {
+			fprintf(stderr, "check: curve ends at %u..%u\n", c[0], c[LTM_KNOTS - 1]);
+			return -EIO;
+		}
+	}
+	return 0;
+}
+
+static int check_events(void)
+{
+	uint8_t buf[1024];
+	drm_msm_ltm_buffer lb = { 7, 16, 0 };
+	drm_event vbl = { 0x01, 32 };
+	size_t len = 0;
+	int got = 0, ret;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, &vbl, sizeof(vbl));
+	len = vbl.length;
+	len += put_event(buf + len, DRM_EVENT_LTM_HIST, &lb, sizeof(lb));
+	len += put_event(buf + len, DRM_EVENT_LTM_WB_PB, &lb, 0);
+
+	ret = ltm_walk_events(buf, len, [&](uint32_t type, const uint8_t *p, size_t n) {
+		drm_msm_ltm_buffer b;
+
+		if (type == DRM_EVENT_LTM_HIST && n == sizeof(b)) {
+			memcpy(&b, p, sizeof(b));
+			got += b.fd == 7 && b.offset == 16;
+		} else if (type == DRM_EVENT_LTM_WB_PB && !n) {
+			got++;
+		}
+	});
+	if (ret || got != 2) {
+		fprintf(stderr, "check: walked %d of 2 events (%d)\n", got, ret);
+		return -EIO;
+	}
+	for (size_t cut = 1; cut < sizeof(drm_msm_event_resp); cut++)
+		if (ltm_walk_events(buf, len - cut, [](uint32_t, const uint8_t *, size_t) {}) !=
+		    -EINVAL) {
+			fprintf(stderr, "check: event cut %zu bytes short not caught\n", cut);
+			return -EIO;
+		}
+	return 0;
+}
+
+/*
+ * Past a zero threshold every zone that changed at all is rebuilt, so
+ * the curves must be the ones rebuilding everything gives, frame for
+ * frame; corrupt and saturated stats must be left alone.
+ */
+static int check_incremental(uint64_t *x)
+{
+	struct side {
+		ltm_consumer con;
+		drm_msm_ltm_data cur;
+		std::atomic<uint32_t> back{0};
+	};
+	std::unique_ptr<side> sd[2] = { std::unique_ptr<side>(new side),
+					std::unique_ptr<side>(new side) };
+	std::unique_ptr<drm_msm_ltm_stats_data> s(new drm_msm_ltm_stats_data());
+	drm_msm_ltm_buffers_ctrl ctrl = {};
+	drm_msm_hist h;
+	uint32_t still[8][LTM_BINS];
+	uint8_t rec[256];
+	sim sm;
+	scene sc;
+	int ret;
+
+	ret = sm.init(&ctrl);
+	if (ret)
+		return ret;
+	next_scene(&sc, x);
+	make_stats(&sc, x, 0.3f, s.get(), h.data);
+	memcpy(still, s->stats_01, sizeof(still));
+	sc.speed = 0.02f;
+	for (int i = 0; i < 2; i++) {
+		ltm_opts o;
+		ltm_callbacks cb;
+		side *p = sd[i].get();
+
+		o.threshold = 0;
+		o.full = i;
+		cb.requeue = [p](uint32_t) { p->back++; };
+		cb.ltm = [p](const drm_msm_ltm_data &d, uint64_t) { p->cur = d; };
+		ret = p->con.init(ctrl, o, cb);
+		if (ret)
+			return ret;
+		p->con.start();
+	}
+
+	for (int f = 0; f < 300; f++) {
+		drm_msm_ltm_buffer lb = { ctrl.fds[0], 0, 0 };
+		size_t len;
+
+		make_stats(&sc, x, f % 3 ? 0.3f : 0, s.get(), h.data);
+		/* Some zones unchanged most frames, as still content gives */
+		if (f % 3)
+			memcpy(s->stats_01, still, sizeof(still));
+		s->status_flag = f == 100 ? LTM_STATS_SAT : 0;
+		s->checksum = ltm_checksum(*s) + (f == 200);
+		memcpy(sm.map[0], s.get(), sizeof(*s));
+		len = put_event(rec, DRM_EVENT_LTM_HIST, &lb, sizeof(lb));
+		for (auto &p : sd) {
+			p->con.feed(rec, len, ltm_now_ns());
+			while (p->back.load() != (uint32_t)f + 1) {
+				p->con.reap();
+				std::this_thread::yield();
+			}
+		}
+		if (memcmp(&sd[0]->cur, &sd[1]->cur, sizeof(sd[0]->cur))) {
+			fprintf(stderr, "check: frame %d incremental curves differ from full\n", f);
+			return -EIO;
+		}
+	}
+	for (auto &p : sd) {
+		ltm_counters c;
+
+		p->con.stop();
+		c = p->con.counters();
+		if (c.sat != 1 || c.bad_sum != 1 || c.ltm != 300) {
+			fprintf(stderr, "check: %llu saturated, %llu bad checksums of %llu\n",
+				(unsigned long long)c.sat, (unsigned long long)c.bad_sum,
+				(unsigned long long)c.ltm);
+			return -EIO;
+		}
+	}
+	return 0;
+}
+
+static int check(void)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	int ret;
+
+	ret = check_ring();
+	if (!ret)
+		ret = check_kernels(&x);
+	if (!ret)
+		ret = check_events();
+	if (!ret)
+		ret = check_incremental(&x);
+	if (!ret)
+		printf("check: ring, %s distance, curves, events, incremental ok\n", ltm_isa);
+	return ret;
+}
+
+static int bench(double hz, uint64_t frames, uint64_t seed)
+{
+	const double rates[2] = { hz, 0 };
+	ltm_opts old, inc;
+	run_result r;
+	int ret;
+
+	old.full = true;
+	old.copy = true;
+	for (int i = 0; i < (hz > 0 ? 2 : 1); i++) {
+		if (rates[i] > 0)
+			printf("%.0f Hz:\n", rates[i]);
+		else
+			printf("unpaced:\n");
+		ret = run_sim(old, rates[i], frames, seed, &r);
+		if (ret)
+			return ret;
+		print_run("copy+full", r);
+		ret = run_sim(inc, rates[i], frames, seed, &r);
+		if (ret)
+			return ret;
+		print_run("incremental", r);
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: ltm_stats [-r hz] [-f frames] [-t threshold] [-c clip] [-S strength]\n"
+		"                 [-F] [-C] [-s seed]\n"
+		"       ltm_stats -b [-r hz] [-f frames] [-s seed]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	ltm_opts o;
+	run_result r;
+	double hz = 120;
+	uint64_t frames = 1200, seed = 0x2545f4914f6cdd1dull;
+	bool do_bench = false;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "r:f:t:c:S:FCs:b")) != -1) {
+		switch (opt) {
+		case 'r':
+			hz = strtod(optarg, NULL);
+			break;
+		case 'f':
+			frames = std::max(1ull, strtoull(optarg, NULL, 0));
+			break;
+		case 't':
+			o.threshold = strtof(optarg, NULL);
+			break;
+		case 'c':
+			o.clip = strtof(optarg, NULL);
+			break;
+		case 'S':
+			o.strength = strtof(optarg, NULL);
+			break;
+		case 'F':
+			o.full = true;
+			break;
+		case 'C':
+			o.copy = true;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc || hz < 0)
+		usage();
+
+	if (do_bench) {
+		ret = check();
+		if (!ret)
+			ret = bench(hz, frames, seed);
+		if (ret)
+			fprintf(stderr, "bench: %s\n", strerror(-ret));
+		return ret ? 1 : 0;
+	}
+
+	ret = run_sim(o, hz, frames, seed, &r);
+	if (ret) {
+		fprintf(stderr, "ltm_stats: %s\n", strerror(-ret));
+		return 1;
+	}
+	print_run(o.full ? "full" : "incremental", r);
+	return 0;
+}
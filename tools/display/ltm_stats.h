@@ -0,0 +1,791 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Consumer for the SDE histogram and LTM statistics events, for a
+ * content-adaptive backlight and local tone-mapping daemon.
+ *
+ * DRM_EVENT_HISTOGRAM carries a drm_msm_hist in the event itself.
+ * DRM_EVENT_LTM_HIST carries a drm_msm_ltm_buffer naming one of the fds
+ * handed to the driver in drm_msm_ltm_buffers_ctrl; the stats sit in
+ * that buffer, offset bytes in, and the buffer is the client's until
+ * it is queued back.  ltm_buffers maps every buffer once, read-only, up
+ * front, so an event costs a lookup rather than an mmap or a copy.
+ * DRM_EVENT_LTM_WB_PB is counted; DRM_EVENT_LTM_OFF forgets the
+ * histograms the curves came from, so the next stats rebuild all of
+ * them.
+ *
+ * Two threads.  The event thread, the caller's, reads the DRM fd and
+ * passes what it got to ltm_consumer::feed(), which walks the events
+ * and puts a message per event into a single-producer single-consumer
+ * ring: the LTM buffer index and offset, or the histogram copied into
+ * the ring slot.  The worker thread takes them out, works on the LTM
+ * stats where the driver left them, and hands the buffer back through
+ * a second ring the other way; feed() gives the finished buffers to the
+ * requeue callback, so only the event thread talks to the driver.
+ * Rings are lock-free; an idle worker spins a little, then sleeps on a
+ * condition variable the producer only signals when it is asleep.  If
+ * the worker falls a ring behind, histograms are dropped and LTM
+ * buffers go straight back.
+ *
+ * Curves are only rebuilt where the content moved.  Each zone keeps the
+ * histogram its curve came from; the L1 distance from it to the new
+ * one, over both totals, is compared against a threshold, and only the
+ * zones past it get a new curve (clipped histogram equalisation, mixed
+ * with identity) and a new reference.  The global histogram is treated
+ * the same way for the backlight: the level a percentile of the
+ * content reaches decides the backlight, and a gain curve makes up for
+ * it.  The distance runs on AVX2 or NEON where the build has them.
+ *
+ * Where the uapi leaves the layout to the hardware documentation, this
+ * is what is assumed: stats_01 is LTM_DATA_SIZE_0 zone histograms of
+ * LTM_DATA_SIZE_1 bins, drm_msm_ltm_data the same zones' curves at
+ * LTM_DATA_SIZE_3 knots evenly spread over 12-bit input, 12-bit out,
+ * and checksum, when LTM_HIST_CHECKSUM_SUPPORT is set, the wrapping
+ * 32-bit sum of stats_01 and stats_02.  Stats flagged LTM_STATS_SAT or
+ * LTM_STATS_MERGE_SAT, or failing the checksum, are skipped.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_DISPLAY_LTM_STATS_H__
+#define __TOOLS_DISPLAY_LTM_STATS_H__
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <display/drm/msm_drm_pp.h>
+#include <display/drm/sde_drm.h>
+
+namespace sde {
+
+#define LTM_ZONES		LTM_DATA_SIZE_0
+#define LTM_BINS		LTM_DATA_SIZE_1
+#define LTM_KNOTS		LTM_DATA_SIZE_3
+#define LTM_MAX			4095	/* curves and backlight are 12-bit */
+#define LTM_MAP_SIZE		(sizeof(drm_msm_ltm_stats_data) + LTM_GUARD_BYTES)
+#define LTM_RING		16	/* messages in flight to the worker */
+#define LTM_SPIN		256	/* polls before the worker sleeps */
+#define LTM_LAT_STEP		10000	/* latency histogram bucket, ns */
+#define LTM_LAT_BUCKETS		1000
+
+/*
+ * Lock-free ring between exactly one producer and one consumer thread.
+ * Each side caches the other's index and only reloads it when the ring
+ * looks full or empty, so the common case touches no shared line but
+ * the slot.
+ */
+template <typename T, uint32_t N>
+class spsc_ring {
+	static_assert(N && !(N & (N - 1)), "ring size must be a power of two");
+
+public:
+	/* Producer: the slot to fill, null if full; publish() hands it over */
+	T *claim()
+	{
+		uint32_t h = head_.load(std::memory_order_relaxed);
+
+		if (h - tail_cache_ == N) {
+			tail_cache_ = tail_.load(std::memory_order_acquire);
+			if (h - tail_cache_ == N)
+				return nullptr;
+		}
+		return &slot_[h & (N - 1)];
+	}
+
+	void publish()
+	{
+		head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	bool push(const T &v)
+	{
+		T *s = claim();
+
+		if (!s)
+			return false;
+		*s = v;
+		publish();
+		return true;
+	}
+
+	/* Consumer: the oldest slot, null if empty; pop() gives it back */
+	T *front()
+	{
+		uint32_t t = tail_.load(std::memory_order_relaxed);
+
+		if (t == head_cache_) {
+			head_cache_ = head_.load(std::memory_order_acquire);
+			if (t == head_cache_)
+				return nullptr;
+		}
+		return &slot_[t & (N - 1)];
+	}
+
+	void pop()
+	{
+		tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	bool empty() const
+	{
+		return head_.load(std::memory_order_acquire) ==
+		       tail_.load(std::memory_order_acquire);
+	}
+
+private:
+	alignas(64) std::atomic<uint32_t> head_{0};
+	uint32_t tail_cache_ = 0;
+	alignas(64) std::atomic<uint32_t> tail_{0};
+	uint32_t head_cache_ = 0;
+	alignas(64) T slot_[N];
+};
+
+/* The LTM buffers, mapped once */
+class ltm_buffers {
+public:
+	ltm_buffers() = default;
+	ltm_buffers(const ltm_buffers &) = delete;
+	ltm_buffers &operator=(const ltm_buffers &) = delete;
+
+	~ltm_buffers() { unmap(); }
+
+	int map(const drm_msm_ltm_buffers_ctrl &ctrl)
+	{
+		unmap();
+		if (!ctrl.num_of_buffers || ctrl.num_of_buffers > LTM_BUFFER_SIZE)
+			return -EINVAL;
+		for (uint32_t i = 0; i < ctrl.num_of_buffers; i++) {
+			void *p = mmap(nullptr, LTM_MAP_SIZE, PROT_READ, MAP_SHARED,
+				       (int)ctrl.fds[i], 0);
+
+			if (p == MAP_FAILED) {
+				int ret = -errno;
+
+				unmap();
+				return ret;
+			}
+			fd_[i] = ctrl.fds[i];
+			base_[i] = static_cast<const uint8_t *>(p);
+			n_++;
+		}
+		return 0;
+	}
+
+	void unmap()
+	{
+		for (uint32_t i = 0; i < n_; i++)
+			munmap(const_cast<uint8_t *>(base_[i]), LTM_MAP_SIZE);
+		n_ = 0;
+	}
+
+	/* Index of the buffer behind @fd, -ENOENT if it is not one of ours */
+	int find(uint32_t fd) const
+	{
+		for (uint32_t i = 0; i < n_; i++)
+			if (fd_[i] == fd)
+				return (int)i;
+		return -ENOENT;
+	}
+
+	/* The stats in buffer @i, null if @offset is past the guard bytes */
+	const drm_msm_ltm_stats_data *stats(int i, uint32_t offset) const
+	{
+		if (i < 0 || (uint32_t)i >= n_ || offset > LTM_GUARD_BYTES || offset & 3)
+			return nullptr;
+		return reinterpret_cast<const drm_msm_ltm_stats_data *>(base_[i] + offset);
+	}
+
+	uint32_t fd(int i) const { return fd_[i]; }
+	uint32_t count() const { return n_; }
+
+private:
+	uint32_t fd_[LTM_BUFFER_SIZE] = {};
+	const uint8_t *base_[LTM_BUFFER_SIZE] = {};
+	uint32_t n_ = 0;
+};
+
+/*
+ * Walk what a read() of the DRM fd returned, calling @fn(type, payload,
+ * size) for each SDE event.  -EINVAL if a length runs off the buffer.
+ */
+template <typename F>
+inline int ltm_walk_events(const void *buf, size_t len, F fn)
+{
+	const uint8_t *p = static_cast<const uint8_t *>(buf), *end = p + len;
+
+	while (p < end) {
+		drm_event ev;
+
+		if ((size_t)(end - p) < sizeof(ev))
+			return -EINVAL;
+		memcpy(&ev, p, sizeof(ev));
+		if (ev.length < sizeof(ev) || ev.length > (size_t)(end - p))
+			return -EINVAL;
+		if (ev.type >= DRM_EVENT_HISTOGRAM) {
+			if (ev.length < sizeof(drm_msm_event_resp))
+				return -EINVAL;
+			fn(ev.type, p + sizeof(drm_msm_event_resp),
+			   ev.length - sizeof(drm_msm_event_resp));
+		}
+		p += ev.length;
+	}
+	return 0;
+}
+
+/* Wrapping sum of stats_01 and stats_02 */
+inline uint32_t ltm_checksum(const drm_msm_ltm_stats_data &s)
+{
+	uint32_t sum = 0;
+
+	for (int z = 0; z < LTM_ZONES; z++)
+		for (int i = 0; i < LTM_BINS; i++)
+			sum += s.stats_01[z][i];
+	for (int i = 0; i < LTM_DATA_SIZE_2; i++)
+		sum += s.stats_02[i];
+	return sum;
+}
+
+/* Sum of |@a[i] - @b[i]| over @n bins, with both totals */
+inline uint64_t ltm_l1_c(const uint32_t *a, const uint32_t *b, uint32_t n, uint64_t *sa,
+			 uint64_t *sb)
+{
+	uint64_t d = 0, ta = 0, tb = 0;
+
+	for (uint32_t i = 0; i < n; i++) {
+		d += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+		ta += a[i];
+		tb += b[i];
+	}
+	*sa = ta;
+	*sb = tb;
+	return d;
+}
+
+#if defined(__AVX2__)
+
+static const char ltm_isa[] = "avx2";
+
+static inline uint64_t ltm_hsum64(__m256i v)
+{
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+
+	return (uint64_t)_mm_cvtsi128_si64(s) + (uint64_t)_mm_extract_epi64(s, 1);
+}
+
+/* @n a multiple of 8 */
+inline uint64_t ltm_l1(const uint32_t *a, const uint32_t *b, uint32_t n, uint64_t *sa,
+		       uint64_t *sb)
+{
+	__m256i d = _mm256_setzero_si256(), ta = d, tb = d;
+
+	for (uint32_t i = 0; i < n; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		__m256i ad = _mm256_sub_epi32(_mm256_max_epu32(x, y), _mm256_min_epu32(x, y));
+
+		d = _mm256_add_epi64(d, _mm256_add_epi64(
+			_mm256_cvtepu32_epi64(_mm256_castsi256_si128(ad)),
+			_mm256_cvtepu32_epi64(_mm256_extracti128_si256(ad, 1))));
+		ta = _mm256_add_epi64(ta, _mm256_add_epi64(
+			_mm256_cvtepu32_epi64(_mm256_castsi256_si128(x)),
+			_mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1))));
+		tb = _mm256_add_epi64(tb, _mm256_add_epi64(
+			_mm256_cvtepu32_epi64(_mm256_castsi256_si128(y)),
+			_mm256_cvtepu32_epi64(_mm256_extracti128_si256(y, 1))));
+	}
+	*sa = ltm_hsum64(ta);
+	*sb = ltm_hsum64(tb);
+	return ltm_hsum64(d);
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static const char ltm_isa[] = "neon";
+
+inline uint64_t ltm_l1(const uint32_t *a, const uint32_t *b, uint32_t n, uint64_t *sa,
+		       uint64_t *sb)
+{
+	uint64x2_t d = vdupq_n_u64(0), ta = d, tb = d;
+
+	for (uint32_t i = 0; i < n; i += 4) {
+		uint32x4_t x = vld1q_u32(a + i), y = vld1q_u32(b + i);
+
+		d = vpadalq_u32(d, vabdq_u32(x, y));
+		ta = vpadalq_u32(ta, x);
+		tb = vpadalq_u32(tb, y);
+	}
+	*sa = vaddvq_u64(ta);
+	*sb = vaddvq_u64(tb);
+	return vaddvq_u64(d);
+}
+
+#else
+
+static const char ltm_isa[] = "c";
+
+inline uint64_t ltm_l1(const uint32_t *a, const uint32_t *b, uint32_t n, uint64_t *sa,
+		       uint64_t *sb)
+{
+	return ltm_l1_c(a, b, n, sa, sb);
+}
+
+#endif
+
+/*
+ * Clipped equalisation of @n bins into LTM_KNOTS knots: bins over @clip
+ * times the mean are cut down and the excess spread over all of them,
+ * the knots read off the cumulative sum and mixed with identity by
+ * @strength.  A flat histogram gives identity.
+ */
+inline void ltm_curve(const uint32_t *h, uint32_t n, float clip, float strength, uint32_t *out)
+{
+	const uint32_t step = n / (LTM_KNOTS - 1);
+	uint64_t total = 0, lim, excess = 0, cdf = 0;
+	uint32_t mix = (uint32_t)(std::min(std::max(strength, 0.0f), 1.0f) * 256 + 0.5f);
+
+	for (uint32_t i = 0; i < n; i++)
+		total += h[i];
+	if (!total) {
+		for (uint32_t k = 0; k < LTM_KNOTS; k++)
+			out[k] = std::min<uint32_t>(k * (LTM_MAX + 1) / (LTM_KNOTS - 1), LTM_MAX);
+		return;
+	}
+	lim = std::max<uint64_t>(1, (uint64_t)(clip * (float)total / n));
+	for (uint32_t i = 0; i < n; i++)
+		excess += h[i] > lim ? h[i] - lim : 0;
+
+	out[0] = 0;
+	for (uint32_t k = 1; k < LTM_KNOTS; k++) {
+		uint32_t id = std::min<uint32_t>(k * (LTM_MAX + 1) / (LTM_KNOTS - 1), LTM_MAX);
+		uint64_t eq;
+
+		for (uint32_t i = (k - 1) * step; i < k * step; i++)
+			cdf += std::min<uint64_t>(h[i], lim);
+		/* Spread excess as if evenly over the bins so far */
+		eq = (cdf + excess * k * step / n) * LTM_MAX / total;
+		out[k] = (uint32_t)((id * (256 - mix) + std::min<uint64_t>(eq, LTM_MAX) * mix +
+				     128) >> 8);
+	}
+}
+
+struct cabl_curve {
+	uint32_t backlight;		/* 12-bit */
+	uint32_t gain[LTM_KNOTS];	/* 12-bit in to 12-bit out */
+};
+
+/*
+ * Backlight for the level @pct of the pixels of @h (HIST_V_SIZE bins of
+ * 8-bit luma) stay under, no lower than @floor; gain restores what the
+ * lower backlight takes from that level, encoded with gamma 2.2, and
+ * rolls off linearly from there to full scale.
+ */
+inline void cabl_build(const uint32_t *h, float pct, float floor, cabl_curve *c)
+{
+	uint64_t total = 0, want, run = 0;
+	uint32_t lvl = HIST_V_SIZE - 1, knee;
+	float bl, g;
+
+	for (int i = 0; i < HIST_V_SIZE; i++)
+		total += h[i];
+	want = (uint64_t)(pct * (float)total);
+	for (int i = 0; i < HIST_V_SIZE; i++) {
+		run += h[i];
+		if (run > want) {
+			lvl = (uint32_t)i;
+			break;
+		}
+	}
+	bl = std::max(powf((lvl + 1) / (float)HIST_V_SIZE, 2.2f), floor);
+	g = powf(1 / bl, 1 / 2.2f);
+	c->backlight = (uint32_t)(bl * LTM_MAX + 0.5f);
+	knee = (uint32_t)(LTM_MAX / g);
+	for (uint32_t k = 0; k < LTM_KNOTS; k++) {
+		uint32_t in = std::min<uint32_t>(k * (LTM_MAX + 1) / (LTM_KNOTS - 1), LTM_MAX);
+		float out = in < knee ? in * g : LTM_MAX;
+
+		/* Keep some slope past the knee so the top end does not flatten out */
+		if (in >= knee && knee < LTM_MAX)
+			out = knee * g * 0.95f + (LTM_MAX - knee * g * 0.95f) *
+			      (float)(in - knee) / (float)(LTM_MAX - knee);
+		c->gain[k] = std::min<uint32_t>((uint32_t)(out + 0.5f), LTM_MAX);
+	}
+}
+
+struct ltm_opts {
+	float threshold = 0.02f;	/* L1 change over both totals that rebuilds */
+	float clip = 3.0f;
+	float strength = 0.5f;
+	float bl_pct = 0.99f;
+	float bl_floor = 0.25f;
+	bool full = false;		/* rebuild everything every frame */
+	bool copy = false;		/* copy the stats out and requeue first */
+};
+
+struct ltm_counters {
+	uint64_t events, ltm, hist, wb_pb, off;
+	uint64_t zones, zone_builds, ltm_pubs, cabl_builds, cabl_pubs;
+	uint64_t sat, bad_sum, bad_buf, overrun, malformed;
+	uint64_t busy_ns;		/* worker CPU time */
+	uint64_t lat_max;		/* event read to done, ns */
+	uint32_t lat[LTM_LAT_BUCKETS + 1];
+};
+
+/* Microseconds under which @p of the messages were done */
+inline double ltm_latency(const ltm_counters &c, double p)
+{
+	uint64_t n = 0, run = 0;
+
+	for (uint32_t i = 0; i <= LTM_LAT_BUCKETS; i++)
+		n += c.lat[i];
+	for (uint32_t i = 0; i <= LTM_LAT_BUCKETS; i++) {
+		run += c.lat[i];
+		if (n && run >= p * n)
+			return i == LTM_LAT_BUCKETS ? c.lat_max / 1e3 : (i + 1) * LTM_LAT_STEP / 1e3;
+	}
+	return 0;
+}
+
+struct ltm_msg {
+	uint32_t type;
+	uint32_t seq;
+	uint64_t t_ns;			/* when the event was read */
+	int32_t buf;			/* LTM buffer index */
+	uint32_t offset, status;
+	drm_msm_hist hist;
+};
+
+struct ltm_callbacks {
+	/* Event thread: buffer @fd is free for the driver again */
+	std::function<void(uint32_t fd)> requeue;
+	/* Worker: new curves, for the event at @t_ns */
+	std::function<void(const drm_msm_ltm_data &, uint64_t t_ns)> ltm;
+	std::function<void(const cabl_curve &, uint64_t t_ns)> cabl;
+};
+
+inline uint64_t ltm_now_ns(clockid_t clk = CLOCK_MONOTONIC)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+class ltm_consumer {
+public:
+	ltm_consumer() = default;
+	ltm_consumer(const ltm_consumer &) = delete;
+	ltm_consumer &operator=(const ltm_consumer &) = delete;
+
+	~ltm_consumer() { stop(); }
+
+	int init(const drm_msm_ltm_buffers_ctrl &ctrl, const ltm_opts &o, const ltm_callbacks &cb)
+	{
+		int ret = bufs_.map(ctrl);
+
+		if (ret)
+			return ret;
+		if (!(o.threshold >= 0) || !(o.clip > 0))
+			return -EINVAL;
+		opts_ = o;
+		cb_ = cb;
+		memset(&ev_, 0, sizeof(ev_));
+		memset(&wk_, 0, sizeof(wk_));
+		memset(&cur_, 0, sizeof(cur_));
+		memset(have_, 0, sizeof(have_));
+		have_hist_ = false;
+		copy_.reset(opts_.copy ? new drm_msm_ltm_stats_data : nullptr);
+		return 0;
+	}
+
+	void start()
+	{
+		stop_.store(false);
+		thr_ = std::thread([this]() { worker(); });
+	}
+
+	/* Let the worker finish what is queued, then hand back its buffers */
+	void stop()
+	{
+		if (!thr_.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lk(m_);
+
+			stop_.store(true);
+		}
+		cv_.notify_one();
+		thr_.join();
+		reap();
+	}
+
+	/* Event thread: everything one read() of the DRM fd returned, read at @t_ns */
+	int feed(const void *buf, size_t len, uint64_t t_ns)
+	{
+		int ret;
+
+		reap();
+		ret = ltm_walk_events(buf, len, [&](uint32_t type, const uint8_t *p, size_t n) {
+			post(type, p, n, t_ns);
+		});
+		if (ret)
+			ev_.malformed++;
+		return ret;
+	}
+
+	/* Event thread: give the driver back the buffers the worker is done with */
+	void reap()
+	{
+		for (uint32_t *fd; (fd = done_.front());) {
+			if (cb_.requeue)
+				cb_.requeue(*fd);
+			done_.pop();
+		}
+	}
+
+	/* Only once stopped */
+	ltm_counters counters() const
+	{
+		ltm_counters c = wk_;
+
+		c.events = ev_.events;
+		c.overrun = ev_.overrun;
+		c.malformed = ev_.malformed;
+		c.bad_buf += ev_.bad_buf;
+		return c;
+	}
+
+	const ltm_buffers &buffers() const { return bufs_; }
+
+private:
+	void post(uint32_t type, const uint8_t *p, size_t n, uint64_t t_ns)
+	{
+		drm_msm_ltm_buffer lb;
+		ltm_msg *m;
+		int idx = -1;
+
+		switch (type) {
+		case DRM_EVENT_HISTOGRAM:
+			if (n < sizeof(drm_msm_hist)) {
+				ev_.malformed++;
+				return;
+			}
+			break;
+		case DRM_EVENT_LTM_HIST:
+			if (n < sizeof(lb)) {
+				ev_.malformed++;
+				return;
+			}
+			memcpy(&lb, p, sizeof(lb));
+			idx = bufs_.find(lb.fd);
+			if (idx < 0) {
+				ev_.bad_buf++;
+				return;
+			}
+			break;
+		case DRM_EVENT_LTM_WB_PB:
+		case DRM_EVENT_LTM_OFF:
+			break;
+		default:
+			return;
+		}
+
+		ev_.events++;
+		m = in_.claim();
+		if (!m) {
+			ev_.overrun++;
+			if (idx >= 0 && cb_.requeue)
+				cb_.requeue(lb.fd);
+			return;
+		}
+		m->type = type;
+		m->seq = (uint32_t)ev_.events;
+		m->t_ns = t_ns;
+		m->buf = idx;
+		if (idx >= 0) {
+			m->offset = lb.offset;
+			m->status = lb.status;
+		}
+		if (type == DRM_EVENT_HISTOGRAM)
+			memcpy(&m->hist, p, sizeof(m->hist));
+		in_.publish();
+
+		/* Pairs with the fence in worker(): one of us sees the other */
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping_.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lk(m_);
+
+			cv_.notify_one();
+		}
+	}
+
+	void worker()
+	{
+		for (;;) {
+			ltm_msg *m = nullptr;
+
+			for (int i = 0; i < LTM_SPIN && !(m = in_.front()); i++) {
+#if defined(__x86_64__) || defined(__i386__)
+				__builtin_ia32_pause();
+#endif
+			}
+			if (!m) {
+				std::unique_lock<std::mutex> lk(m_);
+
+				sleeping_.store(true, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				cv_.wait(lk, [&]() { return !in_.empty() || stop_.load(); });
+				sleeping_.store(false, std::memory_order_relaxed);
+				if (in_.empty())
+					return;
+				continue;
+			}
+
+			uint64_t c0 = ltm_now_ns(CLOCK_THREAD_CPUTIME_ID), lat;
+
+			process(*m);
+			wk_.busy_ns += ltm_now_ns(CLOCK_THREAD_CPUTIME_ID) - c0;
+			lat = ltm_now_ns() - m->t_ns;
+			wk_.lat_max = std::max(wk_.lat_max, lat);
+			wk_.lat[std::min<uint64_t>(lat / LTM_LAT_STEP, LTM_LAT_BUCKETS)]++;
+			in_.pop();
+		}
+	}
+
+	void process(const ltm_msg &m)
+	{
+		switch (m.type) {
+		case DRM_EVENT_HISTOGRAM:
+			wk_.hist++;
+			global(m);
+			break;
+		case DRM_EVENT_LTM_HIST:
+			wk_.ltm++;
+			local(m);
+			break;
+		case DRM_EVENT_LTM_WB_PB:
+			wk_.wb_pb++;
+			break;
+		case DRM_EVENT_LTM_OFF:
+			wk_.off++;
+			memset(have_, 0, sizeof(have_));
+			break;
+		}
+	}
+
+	/* Past the threshold, or nothing to compare with */
+	bool moved(const uint32_t *now, const uint32_t *ref, uint32_t n, bool have)
+	{
+		uint64_t sa, sb, d;
+
+		if (!have || opts_.full)
+			return true;
+		d = ltm_l1(now, ref, n, &sa, &sb);
+		return (double)d > opts_.threshold * (double)(sa + sb);
+	}
+
+	void global(const ltm_msg &m)
+	{
+		if (!moved(m.hist.data, gref_, HIST_V_SIZE, have_hist_))
+			return;
+		memcpy(gref_, m.hist.data, sizeof(gref_));
+		have_hist_ = true;
+		cabl_build(gref_, opts_.bl_pct, opts_.bl_floor, &cabl_);
+		wk_.cabl_builds++;
+		wk_.cabl_pubs++;
+		if (cb_.cabl)
+			cb_.cabl(cabl_, m.t_ns);
+	}
+
+	void local(const ltm_msg &m)
+	{
+		const drm_msm_ltm_stats_data *s = bufs_.stats(m.buf, m.offset);
+		uint32_t fd, built = 0;
+
+		if (m.buf < 0)
+			return;
+		fd = bufs_.fd(m.buf);
+		if (!s || m.status) {
+			wk_.bad_buf++;
+			done_.push(fd);
+			return;
+		}
+		if (opts_.copy) {
+			memcpy(copy_.get(), s, sizeof(*s));
+			done_.push(fd);
+			s = copy_.get();
+		}
+
+		if (s->status_flag & (LTM_STATS_SAT | LTM_STATS_MERGE_SAT)) {
+			wk_.sat++;
+		} else if ((s->feature_flag & LTM_HIST_CHECKSUM_SUPPORT) &&
+			   ltm_checksum(*s) != s->checksum) {
+			wk_.bad_sum++;
+		} else {
+			for (int z = 0; z < LTM_ZONES; z++) {
+				wk_.zones++;
+				if (!moved(s->stats_01[z], ref_[z], LTM_BINS, have_[z]))
+					continue;
+				memcpy(ref_[z], s->stats_01[z], sizeof(ref_[z]));
+				have_[z] = true;
+				ltm_curve(ref_[z], LTM_BINS, opts_.clip, opts_.strength, cur_.data[z]);
+				built++;
+			}
+		}
+
+		wk_.zone_builds += built;
+		if (built) {
+			wk_.ltm_pubs++;
+			if (cb_.ltm)
+				cb_.ltm(cur_, m.t_ns);
+		}
+		/* Back once the frame is fully handled */
+		if (!opts_.copy)
+			done_.push(fd);
+	}
+
+	ltm_opts opts_;
+	ltm_callbacks cb_;
+	ltm_buffers bufs_;
+	spsc_ring<ltm_msg, LTM_RING> in_;
+	spsc_ring<uint32_t, 2 * LTM_RING> done_;	/* never fuller than the buffers */
+
+	/* Event thread */
+	ltm_counters ev_;
+
+	/* Worker */
+	ltm_counters wk_;
+	uint32_t ref_[LTM_ZONES][LTM_BINS];
+	bool have_[LTM_ZONES];
+	drm_msm_ltm_data cur_;
+	uint32_t gref_[HIST_V_SIZE];
+	bool have_hist_ = false;
+	cabl_curve cabl_;
+	std::unique_ptr<drm_msm_ltm_stats_data> copy_;
+
+	std::thread thr_;
+	std::mutex m_;
+	std::condition_variable cv_;
+	std::atomic<bool> sleeping_{false}, stop_{false};
+};
+
+} /* namespace sde */
+
+#endif /* __TOOLS_DISPLAY_LTM_STATS_H__ */
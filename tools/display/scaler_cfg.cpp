@@ -0,0 +1,667 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Print the sde_drm_scaler_v2 for a layer, or check and benchmark the
+ * setup, its cache and the scaler model.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -I../../kernel-headers -o scaler_cfg scaler_cfg.cpp
+ * Usage: scaler_cfg [-t fmt] [-p profile] [-S fbWxH] <crop> <dst>
+ *        scaler_cfg -b [-n layers] [-f frames] [-c capacity] [-s seed]
+ *
+ * <crop> is WxH or WxH+X+Y in the framebuffer, which -S sizes (default
+ * just the crop); <dst> is WxH.  -t is rgb (default), rgba, nv12,
+ * nv12j (chroma centred) or nv16; -p the profile, 0 (the driver's
+ * bilinear default, the default) to 3 (most sharpening).  The config is
+ * printed field by field.
+ *
+ * -b checks profile 0 against the driver's QSEED3 setup, the cache
+ * against computing every time and its LRU order against a plain
+ * list, and the model's output against linear ramps through every
+ * format and profile, including that the pixel extension is exactly
+ * enough.  Then it runs -f frames (default 600) of -n layers (default
+ * 300), mostly the same from frame to frame with some animating,
+ * computing every layer every frame and through a cache of -c entries
+ * (default 1024), and times the model on a 1080p to 1440p layer.
+ *
+ * Example:
+ *   scaler_cfg -t nv12 -p 2 -S 1920x1088 1920x1080 2560x1440
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "scaler_cfg.h"
+
+using namespace sde;
+
+static const char *const fmt_names[SCL_NR_FMTS] = { "rgb", "rgba", "nv12", "nv12j", "nv16" };
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static uint32_t urange(uint64_t *x, uint32_t lo, uint32_t hi)
+{
+	return lo + (uint32_t)(xorshift(x) % (hi - lo + 1));
+}
+
+/*
+ * The driver's _sde_plane_setup_scaler3(), as far as these fields go,
+ * for the sizes, decimation and subsampling it is handed.
+ */
+static void kernel_scaler3(uint32_t src_w, uint32_t src_h, uint32_t dst_w, uint32_t dst_h,
+			   uint32_t deci_h, uint32_t deci_v, uint32_t sub_h, uint32_t sub_v,
+			   bool yuv, sde_drm_scaler_v2 *s)
+{
+	uint32_t decimated;
+
+	memset(s, 0, sizeof(*s));
+	decimated = scl_decimated(src_w, deci_h);
+	s->phase_step_x[0] = (__s32)scl_mult_frac(1 << 21, decimated, dst_w);
+	decimated = scl_decimated(src_h, deci_v);
+	s->phase_step_y[0] = (__s32)scl_mult_frac(1 << 21, decimated, dst_h);
+	s->phase_step_y[1] = s->phase_step_y[0] / (__s32)sub_v;
+	s->phase_step_x[1] = s->phase_step_x[0] / (__s32)sub_h;
+	s->phase_step_x[2] = s->phase_step_x[1];
+	s->phase_step_y[2] = s->phase_step_y[1];
+	s->phase_step_x[3] = s->phase_step_x[0];
+	s->phase_step_y[3] = s->phase_step_y[0];
+	for (int i = 0; i < SDE_MAX_PLANES; i++) {
+		s->src_width[i] = scl_decimated(src_w, deci_h);
+		s->src_height[i] = scl_decimated(src_h, deci_v);
+		if (i == 1 || i == 2) {
+			s->src_width[i] /= sub_h;
+			s->src_height[i] /= sub_v;
+		}
+		s->preload_x[i] = 0x4;
+		s->preload_y[i] = 0x3;
+	}
+	if (!yuv && src_h == dst_h && src_w == dst_w)
+		return;
+	s->dst_width = dst_w;
+	s->dst_height = dst_h;
+	s->y_rgb_filter_cfg = FILTER_BILINEAR;
+	s->uv_filter_cfg = FILTER_BILINEAR;
+	s->alpha_filter_cfg = FILTER_ALPHA_BILINEAR;
+	s->lut_flag = 0;
+	s->blend_cfg = 1;
+	s->enable = 1;
+}
+
+static void random_geom(uint64_t *x, scl_geom *g)
+{
+	uint32_t sub_h, sub_v;
+
+	g->fmt = urange(x, 0, SCL_NR_FMTS - 1);
+	g->profile = urange(x, 0, SCL_NR_PROFILES - 1);
+	sub_h = scl_sub_h(g->fmt);
+	sub_v = scl_sub_v(g->fmt);
+	g->fb_w = urange(x, 8, 4096) & ~(sub_h - 1);
+	g->fb_h = urange(x, 8, 4096) & ~(sub_v - 1);
+	g->w = std::max(sub_h, urange(x, 1, g->fb_w) & ~(sub_h - 1));
+	g->h = std::max(sub_v, urange(x, 1, g->fb_h) & ~(sub_v - 1));
+	g->x = urange(x, 0, g->fb_w - g->w) & ~(sub_h - 1);
+	g->y = urange(x, 0, g->fb_h - g->h) & ~(sub_v - 1);
+	/* Mostly within range, sometimes not */
+	g->dst_w = std::max(1u, (uint32_t)(g->w * exp2((int)urange(x, 0, 90) / 10.0 - 4.5)));
+	g->dst_h = std::max(1u, (uint32_t)(g->h * exp2((int)urange(x, 0, 90) / 10.0 - 4.5)));
+	if (!urange(x, 0, 7)) {
+		g->dst_w = g->w;
+		g->dst_h = g->h;
+	}
+}
+
+static int check_kernel(uint64_t *x)
+{
+	uint32_t tried = 0;
+
+	for (int n = 0; n < 200000; n++) {
+		sde_drm_scaler_v2 a, b;
+		scl_geom g;
+
+		random_geom(x, &g);
+		g.profile = 0;
+		if (scl_compute(g, &a))
+			continue;
+		tried++;
+		kernel_scaler3(g.w, g.h, g.dst_w, g.dst_h, a.horz_decimate, a.vert_decimate,
+			       scl_sub_h(g.fmt), scl_sub_v(g.fmt), scl_is_yuv(g.fmt), &b);
+		/* What the driver leaves alone: phases, pixel extension */
+		memcpy(b.init_phase_x, a.init_phase_x, sizeof(a.init_phase_x));
+		memcpy(b.init_phase_y, a.init_phase_y, sizeof(a.init_phase_y));
+		b.pe = a.pe;
+		b.horz_decimate = a.horz_decimate;
+		b.vert_decimate = a.vert_decimate;
+		if (memcmp(&a, &b, sizeof(a))) {
+			fprintf(stderr, "check: %ux%u -> %ux%u %s differs from the driver\n", g.w, g.h,
+				g.dst_w, g.dst_h, fmt_names[g.fmt]);
+			return -EIO;
+		}
+	}
+	if (tried < 100000)
+		return -EIO;
+	return 0;
+}
+
+static int check_errors(void)
+{
+	sde_drm_scaler_v2 s;
+	scl_geom g = { 1920, 1080, 0, 0, 1920, 1080, 1920, 1080, SCL_NV12, 0 };
+
+	if (scl_compute(g, &s))
+		return -EIO;
+	g.x = 1;
+	g.w = 1918;
+	if (scl_compute(g, &s) != -EINVAL)		/* odd 4:2:0 crop */
+		return -EIO;
+	g.x = 0;
+	g.dst_w = 400;
+	if (scl_compute(g, &s) != -ERANGE)		/* YUV is not decimated */
+		return -EIO;
+	g.fmt = SCL_RGB;
+	if (scl_compute(g, &s) || s.horz_decimate != 1)
+		return -EIO;
+	g.dst_w = 100;
+	if (scl_compute(g, &s) != -ERANGE)		/* past 16x down */
+		return -EIO;
+	g.dst_w = 1920;
+	g.w = 1921;
+	if (scl_compute(g, &s) != -EINVAL)		/* off the framebuffer */
+		return -EIO;
+	return 0;
+}
+
+/* Same configs as computing every time, and LRU order as a list keeps it */
+static int check_cache(uint64_t *x)
+{
+	const uint32_t cap = 64, distinct = 160;
+	std::unique_ptr<scaler_cache> c(new scaler_cache);
+	std::vector<scl_geom> pool;
+	std::list<uint32_t> lru;
+	std::map<uint32_t, std::list<uint32_t>::iterator> in;
+	uint64_t hits = 0, evictions = 0;
+
+	c->init(cap);
+	while (pool.size() < distinct) {
+		sde_drm_scaler_v2 s;
+		scl_geom g;
+
+		random_geom(x, &g);
+		if (!scl_compute(g, &s))
+			pool.push_back(g);
+	}
+	for (int n = 0; n < 200000; n++) {
+		/* Skewed towards the first geometries */
+		uint32_t i = (uint32_t)(distinct * pow((xorshift(x) >> 11) * 0x1p-53, 3));
+		const sde_drm_scaler_v2 *got;
+		sde_drm_scaler_v2 want;
+		scl_geom g = pool[i];
+
+		/* Edges beyond SCL_EDGE do not matter: move the crop there */
+		if (g.x >= SCL_EDGE && g.fb_w - g.x - g.w >= SCL_EDGE && (n & 1))
+			g.x += (g.fb_w - g.x - g.w - SCL_EDGE) & ~1u;
+		if (c->get(g, &got) || scl_compute(g, &want) || memcmp(got, &want, sizeof(want))) {
+			fprintf(stderr, "check: cached config differs for %ux%u+%u+%u\n", g.w, g.h,
+				g.x, g.y);
+			return -EIO;
+		}
+
+		auto it = in.find(i);
+		if (it != in.end()) {
+			hits++;
+			lru.erase(it->second);
+		} else if (lru.size() == cap) {
+			in.erase(lru.back());
+			lru.pop_back();
+			evictions++;
+		}
+		lru.push_front(i);
+		in[i] = lru.begin();
+	}
+	if (c->stats().hits != hits || c->stats().evictions != evictions) {
+		fprintf(stderr, "check: cache %llu hits %llu evictions, list %llu %llu\n",
+			(unsigned long long)c->stats().hits, (unsigned long long)c->stats().evictions,
+			(unsigned long long)hits, (unsigned long long)evictions);
+		return -EIO;
+	}
+
+	/* A failed geometry takes no entry from the others */
+	scl_geom bad = pool[0];
+	const sde_drm_scaler_v2 *got;
+	uint64_t before = c->stats().hits;
+
+	bad.dst_w = 1;
+	bad.w = 4096;
+	bad.fb_w = 4096;
+	bad.x = 0;
+	for (int n = 0; n < 10; n++)
+		if (c->get(bad, &got) != -ERANGE)
+			return -EIO;
+	for (uint32_t i = 0; i < distinct; i++)
+		if (in.count(i))
+			c->get(pool[i], &got);
+	if (c->stats().hits - before < cap - 1)
+		return -EIO;
+	return 0;
+}
+
+/* A plane holding a linear function of the luma position of each sample */
+struct ramp {
+	double a, bx, by;
+	double ox, oy;		/* luma position of sample 0 */
+	uint32_t sx, sy;	/* luma pixels per sample */
+
+	double at(double lx, double ly) const { return a + bx * lx + by * ly; }
+
+	void fill(std::vector<uint16_t> *p, uint32_t w, uint32_t h) const
+	{
+		p->resize((size_t)w * h);
+		for (uint32_t y = 0; y < h; y++)
+			for (uint32_t x = 0; x < w; x++)
+				(*p)[(size_t)y * w + x] = (uint16_t)lround(
+					at(ox + x * (double)sx, oy + y * (double)sy));
+	}
+};
+
+/*
+ * Scale ramps through plane @p of @g; every output sample must be the
+ * ramp at the luma position its pixel centre maps to.
+ */
+static int check_ramp(const scl_geom &g, int p, double *worst)
+{
+	sde_drm_scaler_v2 s;
+	std::vector<uint16_t> src, dst;
+	bool c = p == SCL_CB;
+	uint32_t sh = c ? scl_sub_h(g.fmt) : 1, sv = c ? scl_sub_v(g.fmt) : 1;
+	uint32_t pw = g.fb_w / sh, ph = g.fb_h / sv, ow, oh;
+	double tol;
+	ramp r;
+	int ret;
+
+	ret = scl_compute(g, &s);
+	if (ret)
+		return ret;
+	r.a = 100;
+	r.bx = 600.0 / g.fb_w;
+	r.by = 300.0 / g.fb_h;
+	r.sx = sh;
+	r.sy = sv;
+	r.ox = c && (g.fmt == SCL_NV12_JPEG) ? 0.5 : 0;
+	r.oy = c && sv == 2 ? 0.5 : 0;
+	r.fill(&src, pw, ph);
+	ow = s.enable ? s.dst_width : s.src_width[p];
+	oh = s.enable ? s.dst_height : s.src_height[p];
+	dst.resize((size_t)ow * oh);
+	ret = scl_emulate(s, p, src.data(), pw, pw, ph, g.x / sh, g.y / sv, dst.data(), ow);
+	if (ret)
+		return ret;
+
+	/*
+	 * Rounding the ramp and the output costs 1, the negative lobes a
+	 * little more, and taking phases in 64ths up to a 64th of a sample
+	 */
+	tol = 1.2 + (r.bx * (sh << s.horz_decimate) + r.by * (sv << s.vert_decimate)) /
+		    SCL_FILTER_PHASES;
+	for (uint32_t y = 0; y < oh; y++) {
+		for (uint32_t x = 0; x < ow; x++) {
+			double wd = scl_decimated(g.w, s.horz_decimate);
+			double hd = scl_decimated(g.h, s.vert_decimate);
+			double lx = g.x + ((x + 0.5) * wd / ow - 0.5) * (1 << s.horz_decimate);
+			double ly = g.y + ((y + 0.5) * hd / oh - 0.5) * (1 << s.vert_decimate);
+			double e = fabs(dst[(size_t)y * ow + x] - r.at(lx, ly));
+
+			if (!s.enable)
+				e = fabs(dst[(size_t)y * ow + x] -
+					 src[(size_t)(g.y / sv + y) * pw + g.x / sh + x]);
+			*worst = std::max(*worst, e);
+			if (e > tol) {
+				fprintf(stderr, "check: %s p%u %ux%u -> %ux%u plane %d (%u,%u) off by %.2f\n",
+					fmt_names[g.fmt], g.profile, g.w, g.h, g.dst_w, g.dst_h, p, x, y, e);
+				return -EIO;
+			}
+		}
+	}
+	return 0;
+}
+
+static int check_model(uint64_t *x)
+{
+	double worst = 0;
+	uint32_t ramps = 0, edges = 0, tight = 0;
+
+	for (int n = 0; n < 1200; n++) {
+		sde_drm_scaler_v2 s;
+		scl_geom g;
+		int ret;
+
+		random_geom(x, &g);
+		g.fb_w = std::min(g.fb_w, 640u) & ~1u;
+		g.fb_h = std::min(g.fb_h, 480u) & ~1u;
+		g.w = std::min(g.w, g.fb_w);
+		g.h = std::min(g.h, g.fb_h);
+		g.x = std::min(g.x, g.fb_w - g.w) & ~1u;
+		g.y = std::min(g.y, g.fb_h - g.h) & ~1u;
+		g.w &= ~1u;
+		g.h &= ~1u;
+		g.dst_w = std::min(std::max(g.dst_w, 2u), 720u);
+		g.dst_h = std::min(std::max(g.dst_h, 2u), 540u);
+		if (!g.w || !g.h || scl_compute(g, &s))
+			continue;
+
+		/* Away from the edges every tap is real: the ramp must come through */
+		{
+			scl_geom in = g;
+
+			in.x = SCL_EDGE + 2 * urange(x, 0, 8);
+			in.y = SCL_EDGE + 2 * urange(x, 0, 8);
+			in.fb_w = in.x + in.w + SCL_EDGE + 2 * urange(x, 0, 8);
+			in.fb_h = in.y + in.h + SCL_EDGE + 2 * urange(x, 0, 8);
+			ret = check_ramp(in, SCL_Y, &worst);
+			if (!ret && scl_is_yuv(in.fmt))
+				ret = check_ramp(in, SCL_CB, &worst);
+			if (ret)
+				return ret;
+			ramps++;
+		}
+
+		/* Anywhere, a flat plane stays flat and no tap goes unprovided */
+		for (int p = 0; p < (scl_is_yuv(g.fmt) ? 2 : 1); p++) {
+			uint32_t sh = p ? scl_sub_h(g.fmt) : 1, sv = p ? scl_sub_v(g.fmt) : 1;
+			uint32_t pw = g.fb_w / sh, ph = g.fb_h / sv;
+			uint32_t ow = s.enable ? s.dst_width : s.src_width[p];
+			uint32_t oh = s.enable ? s.dst_height : s.src_height[p];
+			std::vector<uint16_t> src((size_t)pw * ph, 517), dst((size_t)ow * oh);
+			sde_drm_scaler_v2 t = s;
+
+			ret = scl_emulate(s, p, src.data(), pw, pw, ph, g.x / sh, g.y / sv,
+					  dst.data(), ow);
+			if (ret || std::any_of(dst.begin(), dst.end(), [](uint16_t v) { return v != 517; })) {
+				fprintf(stderr, "check: flat %s %ux%u+%u+%u -> %ux%u plane %d: %d\n",
+					fmt_names[g.fmt], g.w, g.h, g.x, g.y, g.dst_w, g.dst_h, p, ret);
+				return -EIO;
+			}
+			edges++;
+
+			/* One sample less on a side that needs any must be caught */
+			if (!s.enable)
+				continue;
+			if (t.pe.right_rpt[p])
+				t.pe.right_rpt[p]--;
+			else if (t.pe.right_ftch[p])
+				t.pe.right_ftch[p]--;
+			else
+				continue;
+			if (scl_emulate(t, p, src.data(), pw, pw, ph, g.x / sh, g.y / sv, dst.data(),
+					ow) != -ERANGE) {
+				fprintf(stderr, "check: short pixel extension not caught\n");
+				return -EIO;
+			}
+			tight++;
+		}
+	}
+	if (ramps < 500 || tight < 500)
+		return -EIO;
+	printf("check: %u ramps within %.2f, %u flat planes, %u tight extensions\n", ramps, worst,
+	       edges, tight);
+	return 0;
+}
+
+static int check(void)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	int ret;
+
+	ret = check_kernel(&x);
+	if (!ret)
+		ret = check_errors();
+	if (!ret)
+		ret = check_cache(&x);
+	if (!ret)
+		ret = check_model(&x);
+	if (!ret)
+		printf("check: driver parity, errors, cache, model ok\n");
+	return ret;
+}
+
+struct layer {
+	scl_geom g;
+	uint32_t anim;		/* frames of resize left */
+	int32_t dw, dh;
+};
+
+static volatile uint64_t bench_sink;
+
+static void random_layer(uint64_t *x, layer *l)
+{
+	static const uint32_t sizes[][2] = { { 1920, 1080 }, { 1280, 720 }, { 3840, 2160 },
+					     { 1080, 2400 }, { 512, 512 }, { 256, 256 },
+					     { 720, 1280 }, { 128, 64 } };
+	const uint32_t *sz = sizes[urange(x, 0, 7)];
+	scl_geom &g = l->g;
+
+	memset(l, 0, sizeof(*l));
+	g.fmt = urange(x, 0, 3) ? SCL_RGBA : SCL_NV12;
+	g.profile = g.fmt == SCL_NV12 ? 2 : urange(x, 0, 1);
+	g.fb_w = g.w = sz[0];
+	g.fb_h = g.h = sz[1];
+	g.dst_w = urange(x, 0, 1) ? g.w : std::max(2u, (g.w * urange(x, 40, 200) / 100) & ~1u);
+	g.dst_h = g.dst_w == g.w ? g.h : std::max(2u, (g.h * g.dst_w / g.w) & ~1u);
+}
+
+static int bench(uint32_t layers, uint32_t frames, uint32_t capacity, uint64_t seed)
+{
+	std::unique_ptr<scaler_cache> c(new scaler_cache);
+	std::vector<layer> ls(layers);
+	sde_drm_scaler_v2 s;
+	uint64_t x = seed, sink = 0;
+	double t_full = 0, t_cache = 0, t0;
+	int ret;
+
+	ret = c->init(capacity);
+	if (ret)
+		return ret;
+	for (layer &l : ls)
+		random_layer(&x, &l);
+	for (uint32_t f = 0; f < frames; f++) {
+		for (layer &l : ls) {
+			if (!l.anim && !urange(&x, 0, 199)) {
+				l.anim = 20;
+				l.dw = (int32_t)urange(&x, 0, 16) - 8;
+				l.dh = l.dw;
+			}
+			if (!urange(&x, 0, 999))
+				random_layer(&x, &l);
+			if (l.anim) {
+				l.anim--;
+				/* Within 4x either way, so YUV needs no decimation */
+				l.g.dst_w = (uint32_t)std::max((int32_t)(l.g.w + 3) / 4,
+							       (int32_t)l.g.dst_w + 2 * l.dw);
+				l.g.dst_h = (uint32_t)std::max((int32_t)(l.g.h + 3) / 4,
+							       (int32_t)l.g.dst_h + 2 * l.dh);
+				l.g.dst_w = std::min(l.g.dst_w, 4 * l.g.w);
+				l.g.dst_h = std::min(l.g.dst_h, 4 * l.g.h);
+			}
+		}
+
+		t0 = now_us();
+		for (const layer &l : ls) {
+			if (scl_compute(l.g, &s))
+				return -EIO;
+			sink += (uint32_t)s.phase_step_x[0];
+		}
+		t_full += now_us() - t0;
+
+		t0 = now_us();
+		for (const layer &l : ls) {
+			const sde_drm_scaler_v2 *p;
+
+			if (c->get(l.g, &p))
+				return -EIO;
+			sink += (uint32_t)p->phase_step_x[0];
+		}
+		t_cache += now_us() - t0;
+	}
+
+	const scl_cache_stats &st = c->stats();
+	printf("%u layers x %u frames: compute %.1f us/frame (%.0f ns/layer), "
+	       "cached %.1f us/frame (%.0f ns/layer)\n",
+	       layers, frames, t_full / frames, t_full * 1e3 / frames / layers, t_cache / frames,
+	       t_cache * 1e3 / frames / layers);
+	printf("cache: %.1f%% hits, %llu misses, %llu evictions, %u entries of %zu bytes\n",
+	       100 * st.hit_rate(), (unsigned long long)st.misses,
+	       (unsigned long long)st.evictions, c->size(), sizeof(sde_drm_scaler_v2));
+	bench_sink = sink;
+
+	/* The model, for scale */
+	{
+		scl_geom g = { 1920, 1080, 0, 0, 1920, 1080, 2560, 1440, SCL_NV12, 2 };
+		std::vector<uint16_t> src((size_t)1920 * 1080, 300), dst((size_t)2560 * 1440);
+
+		ret = scl_compute(g, &s);
+		if (ret)
+			return ret;
+		t0 = now_us();
+		ret = scl_emulate(s, SCL_Y, src.data(), 1920, 1920, 1080, 0, 0, dst.data(), 2560);
+		if (ret)
+			return ret;
+		printf("model: 1080p to 1440p luma in %.1f ms\n", (now_us() - t0) / 1e3);
+	}
+	return 0;
+}
+
+static bool parse_rect(const char *s, uint32_t *w, uint32_t *h, uint32_t *x, uint32_t *y)
+{
+	int n;
+
+	*x = *y = 0;
+	if (sscanf(s, "%ux%u%n", w, h, &n) != 2)
+		return false;
+	return !s[n] || sscanf(s + n, "+%u+%u", x, y) == 2;
+}
+
+static void print_cfg(const sde_drm_scaler_v2 &s)
+{
+	static const char *const names[SDE_MAX_PLANES] = { "y/rgb", "cb", "cr", "alpha" };
+
+	printf("enable %u dir_en %u decimate %ux%u dst %ux%u\n", s.enable, s.dir_en,
+	       s.horz_decimate, s.vert_decimate, s.dst_width, s.dst_height);
+	printf("filters y/rgb %u uv %u alpha %u blend %u  lut dir %u cir %u/%u\n",
+	       s.y_rgb_filter_cfg, s.uv_filter_cfg, s.alpha_filter_cfg, s.blend_cfg,
+	       s.dir_lut_idx, s.y_rgb_cir_lut_idx, s.uv_cir_lut_idx);
+	for (int i = 0; i < SDE_MAX_PLANES; i++)
+		printf("%-6s src %5ux%-5u step %8d %8d init %8d %8d preload %u %u  "
+		       "lr %5d (%d+%d %d+%d) tb %5d (%d+%d %d+%d)\n",
+		       names[i], s.src_width[i], s.src_height[i], s.phase_step_x[i],
+		       s.phase_step_y[i], s.init_phase_x[i], s.init_phase_y[i], s.preload_x[i],
+		       s.preload_y[i], s.pe.num_ext_pxls_lr[i], s.pe.left_ftch[i],
+		       s.pe.left_rpt[i], s.pe.right_ftch[i], s.pe.right_rpt[i],
+		       s.pe.num_ext_pxls_tb[i], s.pe.top_ftch[i], s.pe.top_rpt[i],
+		       s.pe.btm_ftch[i], s.pe.btm_rpt[i]);
+	if (s.de.enable)
+		printf("de sharpen %d %d clip %u limit %u thr %u %u %u %u prec %u\n",
+		       s.de.sharpen_level1, s.de.sharpen_level2, s.de.clip, s.de.limit,
+		       s.de.thr_quiet, s.de.thr_dieout, s.de.thr_low, s.de.thr_high,
+		       s.de.prec_shift);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: scaler_cfg [-t fmt] [-p profile] [-S fbWxH] <crop> <dst>\n"
+		"       scaler_cfg -b [-n layers] [-f frames] [-c capacity] [-s seed]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	scl_geom g = {};
+	sde_drm_scaler_v2 s;
+	uint32_t layers = 300, frames = 600, capacity = 1024, fb_w = 0, fb_h = 0, u;
+	uint64_t seed = 0x2545f4914f6cdd1dull;
+	bool do_bench = false;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "t:p:S:bn:f:c:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			g.fmt = SCL_NR_FMTS;
+			for (uint32_t i = 0; i < SCL_NR_FMTS; i++)
+				if (!strcmp(optarg, fmt_names[i]))
+					g.fmt = i;
+			if (g.fmt == SCL_NR_FMTS)
+				usage();
+			break;
+		case 'p':
+			g.profile = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			if (!parse_rect(optarg, &fb_w, &fb_h, &u, &u))
+				usage();
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		case 'n':
+			layers = std::max(1u, (uint32_t)strtoul(optarg, NULL, 0));
+			break;
+		case 'f':
+			frames = std::max(1u, (uint32_t)strtoul(optarg, NULL, 0));
+			break;
+		case 'c':
+			capacity = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (do_bench) {
+		if (optind != argc)
+			usage();
+		ret = check();
+		if (!ret)
+			ret = bench(layers, frames, capacity, seed);
+		if (ret)
+			fprintf(stderr, "bench: %s\n", strerror(-ret));
+		return ret ? 1 : 0;
+	}
+
+	if (optind + 2 != argc || !parse_rect(argv[optind], &g.w, &g.h, &g.x, &g.y) ||
+	    !parse_rect(argv[optind + 1], &g.dst_w, &g.dst_h, &u, &u))
+		usage();
+	g.fb_w = fb_w ? fb_w : g.x + g.w;
+	g.fb_h = fb_h ? fb_h : g.y + g.h;
+	ret = scl_compute(g, &s);
+	if (ret) {
+		fprintf(stderr, "scaler_cfg: %s\n", ret == -ERANGE ? "scale out of range" :
+			strerror(-ret));
+		return 1;
+	}
+	print_cfg(s);
+	return 0;
+}
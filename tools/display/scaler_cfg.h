@@ -0,0 +1,589 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * sde_drm_scaler_v2 setup for a source crop and destination size, a
+ * bounded LRU cache of it, and a CPU model of the scaler to check it.
+ *
+ * scl_compute() follows the driver's own QSEED3 setup where the driver
+ * has one: phase steps are mult_frac(1 << 21, decimated source, dest),
+ * decimated sizes round up, chroma steps and sizes are the luma ones
+ * divided by the subsampling (truncating), preloads are 4 across and 3
+ * down, and an RGB layer that is not scaled leaves the scaler off.
+ * YUV may not be decimated.  Decimation is chosen as the least that
+ * brings the downscale within 4x; past that, or 20x up, is -ERANGE.
+ *
+ * On top of that:
+ *  - Initial phases centre the output grid on the source, (step - 1)/2
+ *    in 21-bit fixed point rounded down.  Chroma gets a quarter sample
+ *    more across for left-cosited siting (MPEG-2 style 4:2:0 and
+ *    4:2:2); vertically, and for JPEG siting, it is centred too.
+ *  - Filters come from a profile.  Profile 0 is the driver's bilinear
+ *    setup field for field; the others use the circular filter, and for
+ *    YUV upscaling the edge-directed one with detail enhancement.  LUT
+ *    indices pick a coefficient set by the downscale ratio.
+ *  - Pixel extension: the taps of the first and last output pixels say
+ *    how far the filter reads past the crop on each side.  As much of
+ *    that as the framebuffer holds is overfetched and the rest repeated;
+ *    num_ext_pxls_lr/tb are the crop plus both sides.
+ *
+ * The result only depends on the crop and destination sizes, format,
+ * profile and how far the crop is from each framebuffer edge up to 16
+ * pixels, so that is what scaler_cache keys it by.  Entries live in a
+ * slot array on an index-linked LRU list; past the capacity the least
+ * recently used is overwritten.
+ *
+ * scl_emulate() runs one plane through a config the way the hardware
+ * steps it: the same 21-bit phase accumulator, decimation by dropping
+ * samples, taps past the crop read from the overfetch or repeated, and
+ * -ERANGE if a tap falls outside what the pixel extension provides.
+ * Filters are 64-phase bilinear or Catmull-Rom with 10-bit coefficients;
+ * the circular and edge-directed filters both use the latter, as the
+ * real LUTs are not in the uapi.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_DISPLAY_SCALER_CFG_H__
+#define __TOOLS_DISPLAY_SCALER_CFG_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <display/drm/sde_drm.h>
+
+namespace sde {
+
+#define SCL_PHASE_BITS		21
+#define SCL_ONE			(1 << SCL_PHASE_BITS)
+#define SCL_PRELOAD_H		4
+#define SCL_PRELOAD_V		3
+#define SCL_MAX_UP		20
+#define SCL_MAX_DOWN		4
+#define SCL_MAX_DECIMATE	2	/* log2 */
+#define SCL_MAX_DIM		16383	/* keeps mult_frac in 32 bits */
+#define SCL_EDGE		16	/* framebuffer distance that matters, pixels */
+#define SCL_NR_PROFILES		4
+#define SCL_NONE		0xffffffffu
+
+/* Emulation filters */
+#define SCL_FILTER_PHASES	64
+#define SCL_COEF_BITS		10
+#define SCL_SAMPLE_MAX		1023
+
+/* Plane indices of the per-plane arrays */
+#define SCL_Y			0
+#define SCL_CB			1
+#define SCL_CR			2
+#define SCL_A			3
+
+enum scl_fmt {
+	SCL_RGB,
+	SCL_RGBA,
+	SCL_NV12,		/* 4:2:0, chroma left-cosited */
+	SCL_NV12_JPEG,		/* 4:2:0, chroma centred */
+	SCL_NV16,		/* 4:2:2, chroma left-cosited */
+	SCL_NR_FMTS,
+};
+
+struct scl_geom {
+	uint32_t fb_w, fb_h;		/* framebuffer, luma pixels */
+	uint32_t x, y, w, h;		/* source crop */
+	uint32_t dst_w, dst_h;
+	uint32_t fmt;			/* enum scl_fmt */
+	uint32_t profile;
+};
+
+struct scl_profile {
+	uint32_t filter;		/* FILTER_BILINEAR or FILTER_CIRCULAR_2D */
+	bool dir;			/* edge-directed upscaling for YUV */
+	sde_drm_de_v1 de;
+};
+
+/* Starting points; sharpening wants tuning per panel */
+static const scl_profile scl_profiles[SCL_NR_PROFILES] = {
+	{ FILTER_BILINEAR, false, {} },
+	{ FILTER_CIRCULAR_2D, false, {} },
+	{ FILTER_CIRCULAR_2D, true,
+	  { 1, 16, 48, 8, 6, 4, 16, 64, 512, 6, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } } },
+	{ FILTER_CIRCULAR_2D, true,
+	  { 1, 32, 96, 16, 8, 4, 16, 64, 512, 6, { -8, 0, 8 }, { 16, 32, 16 }, { 0, 0, 0 } } },
+};
+
+static inline bool scl_is_yuv(uint32_t fmt)
+{
+	return fmt >= SCL_NV12;
+}
+
+static inline uint32_t scl_sub_h(uint32_t fmt)
+{
+	return scl_is_yuv(fmt) ? 2 : 1;
+}
+
+static inline uint32_t scl_sub_v(uint32_t fmt)
+{
+	return fmt == SCL_NV12 || fmt == SCL_NV12_JPEG ? 2 : 1;
+}
+
+/* DECIMATED_DIMENSION */
+static inline uint32_t scl_decimated(uint32_t dim, uint32_t deci)
+{
+	return (dim + (1u << deci) - 1) >> deci;
+}
+
+/* The kernel's mult_frac(x, n, d) */
+static inline uint32_t scl_mult_frac(uint32_t x, uint32_t n, uint32_t d)
+{
+	return (x / d) * n + ((x % d) * n) / d;
+}
+
+/* Reach of plane @p's taps around the sample below the phase */
+static inline void scl_plane_taps(const sde_drm_scaler_v2 &s, int p, int *lo, int *hi)
+{
+	uint32_t f = p == SCL_Y ? s.y_rgb_filter_cfg : s.uv_filter_cfg;
+
+	/* Alpha filter values overlap the others */
+	if (p == SCL_A)
+		f = s.alpha_filter_cfg == FILTER_ALPHA_DROP_REPEAT ? SCL_NONE : FILTER_BILINEAR;
+	*lo = f == FILTER_BILINEAR || f == SCL_NONE ? 0 : -1;
+	*hi = f == SCL_NONE ? 0 : f == FILTER_BILINEAR ? 1 : 2;
+}
+
+/* Coefficient set by downscale, 0 for none or upscaling */
+static inline uint32_t scl_lut_idx(uint32_t step)
+{
+	if (step <= SCL_ONE)
+		return 0;
+	if (step <= SCL_ONE + SCL_ONE / 2)
+		return 1;
+	if (step <= 2 * SCL_ONE)
+		return 2;
+	if (step <= 3 * SCL_ONE)
+		return 3;
+	return 4;
+}
+
+/*
+ * Extension of one side: @need samples past the crop, @dist framebuffer
+ * pixels there, @sub and @deci the plane's subsampling and decimation.
+ */
+static inline void scl_side(int need, uint32_t dist, uint32_t sub, uint32_t deci, __s32 *ftch,
+			    __s32 *rpt)
+{
+	int avail = (int)((std::min(dist, (uint32_t)SCL_EDGE) / sub) >> deci);
+
+	need = std::max(need, 0);
+	*ftch = std::min(need, avail);
+	*rpt = need - *ftch;
+}
+
+inline int scl_compute(const scl_geom &g, sde_drm_scaler_v2 *s)
+{
+	const scl_profile *pf;
+	uint32_t sub_h, sub_v, dh = 0, dv = 0, wd, hd;
+	bool yuv, up;
+
+	if (g.fmt >= SCL_NR_FMTS || g.profile >= SCL_NR_PROFILES || !g.w || !g.h ||
+	    !g.dst_w || !g.dst_h || g.w > SCL_MAX_DIM || g.h > SCL_MAX_DIM ||
+	    g.dst_w > SCL_MAX_DIM || g.dst_h > SCL_MAX_DIM ||
+	    g.x > g.fb_w || g.w > g.fb_w - g.x || g.y > g.fb_h || g.h > g.fb_h - g.y)
+		return -EINVAL;
+	pf = &scl_profiles[g.profile];
+	yuv = scl_is_yuv(g.fmt);
+	sub_h = scl_sub_h(g.fmt);
+	sub_v = scl_sub_v(g.fmt);
+	if ((g.x | g.w) & (sub_h - 1) || (g.y | g.h) & (sub_v - 1))
+		return -EINVAL;
+
+	if (!yuv) {
+		while (dh < SCL_MAX_DECIMATE && scl_decimated(g.w, dh) > SCL_MAX_DOWN * g.dst_w)
+			dh++;
+		while (dv < SCL_MAX_DECIMATE && scl_decimated(g.h, dv) > SCL_MAX_DOWN * g.dst_h)
+			dv++;
+	}
+	wd = scl_decimated(g.w, dh);
+	hd = scl_decimated(g.h, dv);
+	if (wd > SCL_MAX_DOWN * g.dst_w || hd > SCL_MAX_DOWN * g.dst_h ||
+	    g.dst_w > SCL_MAX_UP * wd || g.dst_h > SCL_MAX_UP * hd)
+		return -ERANGE;
+
+	memset(s, 0, sizeof(*s));
+	s->horz_decimate = dh;
+	s->vert_decimate = dv;
+	s->phase_step_x[SCL_Y] = (__s32)scl_mult_frac(SCL_ONE, wd, g.dst_w);
+	s->phase_step_y[SCL_Y] = (__s32)scl_mult_frac(SCL_ONE, hd, g.dst_h);
+	s->phase_step_x[SCL_CB] = s->phase_step_x[SCL_Y] / (__s32)sub_h;
+	s->phase_step_y[SCL_CB] = s->phase_step_y[SCL_Y] / (__s32)sub_v;
+	s->phase_step_x[SCL_CR] = s->phase_step_x[SCL_CB];
+	s->phase_step_y[SCL_CR] = s->phase_step_y[SCL_CB];
+	s->phase_step_x[SCL_A] = s->phase_step_x[SCL_Y];
+	s->phase_step_y[SCL_A] = s->phase_step_y[SCL_Y];
+
+	for (int i = 0; i < SDE_MAX_PLANES; i++) {
+		bool c = i == SCL_CB || i == SCL_CR;
+
+		s->src_width[i] = c ? wd / sub_h : wd;
+		s->src_height[i] = c ? hd / sub_v : hd;
+		s->preload_x[i] = SCL_PRELOAD_H;
+		s->preload_y[i] = SCL_PRELOAD_V;
+		s->pe.num_ext_pxls_lr[i] = (__s32)s->src_width[i];
+		s->pe.num_ext_pxls_tb[i] = (__s32)s->src_height[i];
+	}
+	if (!yuv && g.w == g.dst_w && g.h == g.dst_h)
+		return 0;
+
+	up = g.dst_w > wd || g.dst_h > hd;
+	s->enable = 1;
+	s->dst_width = g.dst_w;
+	s->dst_height = g.dst_h;
+	if (!g.profile) {
+		/* The driver's own default */
+		s->y_rgb_filter_cfg = FILTER_BILINEAR;
+		s->uv_filter_cfg = FILTER_BILINEAR;
+		s->alpha_filter_cfg = FILTER_ALPHA_BILINEAR;
+		s->blend_cfg = 1;
+	} else {
+		uint32_t idx = scl_lut_idx((uint32_t)std::max(s->phase_step_x[SCL_Y],
+							      s->phase_step_y[SCL_Y]));
+
+		s->dir_en = yuv && up && pf->dir;
+		s->y_rgb_filter_cfg = s->dir_en ? FILTER_EDGE_DIRECTED_2D : pf->filter;
+		s->uv_filter_cfg = pf->filter;
+		s->alpha_filter_cfg = FILTER_ALPHA_BILINEAR;
+		s->blend_cfg = FILTER_BLEND_CIRCULAR_2D;
+		s->dir_lut_idx = s->dir_en ? 1 : 0;
+		s->y_rgb_cir_lut_idx = idx;
+		s->uv_cir_lut_idx = idx;
+		if (s->dir_en) {
+			s->de = pf->de;
+			s->dir_weight = 0x10;
+		}
+	}
+
+	for (int i = 0; i < SDE_MAX_PLANES; i++) {
+		bool c = i == SCL_CB || i == SCL_CR;
+		uint32_t ph = c ? sub_h : 1, pv = c ? sub_v : 1;
+		int64_t sx = s->phase_step_x[i], sy = s->phase_step_y[i];
+		int64_t ix = (sx - SCL_ONE) >> 1, iy = (sy - SCL_ONE) >> 1;
+		int lo, hi, first, last;
+
+		if (c && (g.fmt == SCL_NV12 || g.fmt == SCL_NV16))
+			ix += SCL_ONE / 4;
+		s->init_phase_x[i] = (__s32)ix;
+		s->init_phase_y[i] = (__s32)iy;
+
+		scl_plane_taps(*s, i, &lo, &hi);
+		first = (int)(ix >> SCL_PHASE_BITS) + lo;
+		last = (int)((ix + (int64_t)(g.dst_w - 1) * sx) >> SCL_PHASE_BITS) + hi;
+		scl_side(-first, g.x, ph, dh, &s->pe.left_ftch[i], &s->pe.left_rpt[i]);
+		scl_side(last - ((int)s->src_width[i] - 1), g.fb_w - g.x - g.w, ph, dh,
+			 &s->pe.right_ftch[i], &s->pe.right_rpt[i]);
+		first = (int)(iy >> SCL_PHASE_BITS) + lo;
+		last = (int)((iy + (int64_t)(g.dst_h - 1) * sy) >> SCL_PHASE_BITS) + hi;
+		scl_side(-first, g.y, pv, dv, &s->pe.top_ftch[i], &s->pe.top_rpt[i]);
+		scl_side(last - ((int)s->src_height[i] - 1), g.fb_h - g.y - g.h, pv, dv,
+			 &s->pe.btm_ftch[i], &s->pe.btm_rpt[i]);
+		s->pe.num_ext_pxls_lr[i] += s->pe.left_ftch[i] + s->pe.left_rpt[i] +
+					    s->pe.right_ftch[i] + s->pe.right_rpt[i];
+		s->pe.num_ext_pxls_tb[i] += s->pe.top_ftch[i] + s->pe.top_rpt[i] +
+					    s->pe.btm_ftch[i] + s->pe.btm_rpt[i];
+	}
+	return 0;
+}
+
+struct scl_cache_stats {
+	uint64_t lookups, hits, misses, evictions, errors;
+
+	double hit_rate() const { return lookups ? (double)hits / lookups : 0; }
+};
+
+class scaler_cache {
+public:
+	int init(uint32_t capacity)
+	{
+		if (!capacity)
+			return -EINVAL;
+		slots_.assign(capacity, slot());
+		map_.clear();
+		map_.reserve(capacity * 2);
+		used_ = 0;
+		head_ = tail_ = SCL_NONE;
+		memset(&st_, 0, sizeof(st_));
+		return 0;
+	}
+
+	/*
+	 * The config for @g, computed on a miss.  It stays valid until
+	 * capacity other geometries have missed.
+	 */
+	int get(const scl_geom &g, const sde_drm_scaler_v2 **out)
+	{
+		key k = make_key(g);
+		uint32_t id;
+		int ret;
+
+		st_.lookups++;
+		auto it = map_.find(k);
+		if (it != map_.end()) {
+			id = it->second;
+			st_.hits++;
+			if (id != head_) {
+				unlink(id);
+				push(id);
+			}
+			*out = &slots_[id].cfg;
+			return 0;
+		}
+
+		st_.misses++;
+		if (used_ < slots_.size()) {
+			id = used_++;
+		} else {
+			id = tail_;
+			unlink(id);
+			map_.erase(slots_[id].k);
+			st_.evictions++;
+		}
+		ret = scl_compute(g, &slots_[id].cfg);
+		if (ret) {
+			/* Back on the tail, to be reused first */
+			st_.errors++;
+			slots_[id].k = key{ ~0ull, ~0ull };
+			push_tail(id);
+			return ret;
+		}
+		slots_[id].k = k;
+		map_.emplace(k, id);
+		push(id);
+		*out = &slots_[id].cfg;
+		return 0;
+	}
+
+	uint32_t size() const { return (uint32_t)map_.size(); }
+	const scl_cache_stats &stats() const { return st_; }
+
+private:
+	struct key {
+		uint64_t a, b;
+
+		bool operator==(const key &o) const { return a == o.a && b == o.b; }
+	};
+
+	struct key_hash {
+		size_t operator()(const key &k) const
+		{
+			uint64_t h = k.a * 0x9e3779b97f4a7c15ull ^ (k.b + 0x632be59bd9b4e019ull);
+
+			return (size_t)(h ^ h >> 29);
+		}
+	};
+
+	struct slot {
+		key k;
+		uint32_t prev, next;	/* newest first */
+		sde_drm_scaler_v2 cfg;
+	};
+
+	static key make_key(const scl_geom &g)
+	{
+		uint64_t e = std::min(g.x, (uint32_t)SCL_EDGE) |
+			     std::min(g.fb_w - std::min(g.fb_w, g.x + g.w), (uint32_t)SCL_EDGE) << 5 |
+			     std::min(g.y, (uint32_t)SCL_EDGE) << 10 |
+			     std::min(g.fb_h - std::min(g.fb_h, g.y + g.h), (uint32_t)SCL_EDGE) << 15;
+
+		/* Out of range sizes and crops must not alias valid ones */
+		if (g.w > SCL_MAX_DIM || g.h > SCL_MAX_DIM || g.dst_w > SCL_MAX_DIM ||
+		    g.dst_h > SCL_MAX_DIM || g.x > g.fb_w || g.w > g.fb_w - g.x ||
+		    g.y > g.fb_h || g.h > g.fb_h - g.y)
+			e |= 1ull << 20;
+		return key{ (uint64_t)(g.w & 0xffff) | (uint64_t)(g.h & 0xffff) << 16 |
+				    (uint64_t)(g.dst_w & 0xffff) << 32 |
+				    (uint64_t)(g.dst_h & 0xffff) << 48,
+			    e | (uint64_t)std::min(g.fmt, 0xffu) << 24 |
+				    (uint64_t)std::min(g.profile, 0xffu) << 32 |
+				    (uint64_t)(g.x & 1) << 40 | (uint64_t)(g.y & 1) << 41 };
+	}
+
+	void unlink(uint32_t id)
+	{
+		slot &s = slots_[id];
+
+		if (s.prev != SCL_NONE)
+			slots_[s.prev].next = s.next;
+		else
+			head_ = s.next;
+		if (s.next != SCL_NONE)
+			slots_[s.next].prev = s.prev;
+		else
+			tail_ = s.prev;
+	}
+
+	void push(uint32_t id)
+	{
+		slot &s = slots_[id];
+
+		s.prev = SCL_NONE;
+		s.next = head_;
+		if (head_ != SCL_NONE)
+			slots_[head_].prev = id;
+		else
+			tail_ = id;
+		head_ = id;
+	}
+
+	void push_tail(uint32_t id)
+	{
+		slot &s = slots_[id];
+
+		s.next = SCL_NONE;
+		s.prev = tail_;
+		if (tail_ != SCL_NONE)
+			slots_[tail_].next = id;
+		else
+			head_ = id;
+		tail_ = id;
+	}
+
+	std::vector<slot> slots_;
+	std::unordered_map<key, uint32_t, key_hash> map_;
+	uint32_t used_ = 0;
+	uint32_t head_ = SCL_NONE, tail_ = SCL_NONE;
+	scl_cache_stats st_ = {};
+};
+
+/* 10-bit coefficients per phase, summing to 1 << SCL_COEF_BITS */
+struct scl_filter {
+	int16_t c[SCL_FILTER_PHASES][4];
+	int lo, hi;
+};
+
+/* For taps @lo..@hi: nearest, bilinear or Catmull-Rom */
+inline void scl_filter_init(scl_filter *f, int lo, int hi)
+{
+	const int one = 1 << SCL_COEF_BITS;
+
+	f->lo = lo;
+	f->hi = hi;
+	for (int p = 0; p < SCL_FILTER_PHASES; p++) {
+		double t = (double)p / SCL_FILTER_PHASES, w[4];
+		int sum = 0, big = 0;
+
+		if (hi == 0) {
+			w[0] = 1;
+			w[1] = w[2] = w[3] = 0;
+		} else if (hi == 2) {
+			/* Catmull-Rom */
+			w[0] = ((-t + 2) * t - 1) * t / 2;
+			w[1] = ((3 * t - 5) * t * t + 2) / 2;
+			w[2] = ((-3 * t + 4) * t + 1) * t / 2;
+			w[3] = (t - 1) * t * t / 2;
+		} else {
+			w[0] = 1 - t;
+			w[1] = t;
+			w[2] = w[3] = 0;
+		}
+		for (int k = 0; k < 4; k++) {
+			f->c[p][k] = (int16_t)(w[k] * one + (w[k] < 0 ? -0.5 : 0.5));
+			sum += f->c[p][k];
+			if (f->c[p][k] > f->c[p][big])
+				big = k;
+		}
+		f->c[p][big] = (int16_t)(f->c[p][big] + one - sum);
+	}
+}
+
+/*
+ * Plane @p of @s over @src: the whole plane, @pw x @ph samples of 10
+ * bits @stride apart, with the crop at @px, @py in that plane's samples.
+ * Writes dst_width x dst_height samples (the source size if the scaler
+ * is off) to @dst, @dst_stride apart.
+ */
+inline int scl_emulate(const sde_drm_scaler_v2 &s, int p, const uint16_t *src, uint32_t stride,
+		       uint32_t pw, uint32_t ph, uint32_t px, uint32_t py, uint16_t *dst,
+		       uint32_t dst_stride)
+{
+	const int sw = (int)s.src_width[p], sh = (int)s.src_height[p];
+	const uint32_t ow = s.enable ? s.dst_width : s.src_width[p];
+	const uint32_t oh = s.enable ? s.dst_height : s.src_height[p];
+	const int l = s.pe.left_ftch[p], r = s.pe.right_ftch[p];
+	const int t = s.pe.top_ftch[p], b = s.pe.btm_ftch[p];
+	const int xl = l + s.pe.left_rpt[p], xr = r + s.pe.right_rpt[p];
+	const int yt = t + s.pe.top_rpt[p], yb = b + s.pe.btm_rpt[p];
+	const uint32_t dh = s.horz_decimate, dv = s.vert_decimate;
+	const int rows = sh + yt + yb;
+	scl_filter f;
+	int lo, hi;
+
+	if (!ow || !oh || !sw || !sh)
+		return -EINVAL;
+	/* Everything the overfetch reads must be in the plane */
+	if ((int64_t)px - ((int64_t)l << dh) < 0 || (int64_t)py - ((int64_t)t << dv) < 0 ||
+	    px + ((uint64_t)(sw - 1 + r) << dh) >= pw || py + ((uint64_t)(sh - 1 + b) << dv) >= ph)
+		return -ERANGE;
+
+	if (!s.enable) {
+		for (uint32_t y = 0; y < oh; y++)
+			for (uint32_t x = 0; x < ow; x++)
+				dst[y * dst_stride + x] = src[(py + (y << dv)) * stride + px + (x << dh)];
+		return 0;
+	}
+
+	scl_plane_taps(s, p, &lo, &hi);
+	scl_filter_init(&f, lo, hi);
+
+	/* Every source row, extension included, filtered across */
+	std::vector<int32_t> tmp((size_t)rows * ow);
+	std::vector<int32_t> xi(ow);
+	std::vector<uint8_t> xp(ow);
+
+	for (uint32_t x = 0; x < ow; x++) {
+		int64_t pos = s.init_phase_x[p] + (int64_t)x * s.phase_step_x[p];
+
+		xi[x] = (int32_t)(pos >> SCL_PHASE_BITS);
+		xp[x] = (uint8_t)((pos >> (SCL_PHASE_BITS - 6)) & (SCL_FILTER_PHASES - 1));
+		if (xi[x] + lo < -xl || xi[x] + hi > sw - 1 + xr)
+			return -ERANGE;
+	}
+	for (int yy = 0; yy < rows; yy++) {
+		int sy = std::min(std::max(yy - yt, -t), sh - 1 + b);
+		const uint16_t *row = src + (size_t)((int64_t)py + (int64_t)sy * (1 << dv)) * stride;
+
+		for (uint32_t x = 0; x < ow; x++) {
+			int32_t acc = 0;
+
+			for (int k = lo; k <= hi; k++) {
+				int sx = std::min(std::max(xi[x] + k, -l), sw - 1 + r);
+
+				acc += f.c[xp[x]][k - f.lo] *
+				       row[(int64_t)px + (int64_t)sx * (1 << dh)];
+			}
+			tmp[(size_t)yy * ow + x] = acc;
+		}
+	}
+
+	for (uint32_t y = 0; y < oh; y++) {
+		int64_t pos = s.init_phase_y[p] + (int64_t)y * s.phase_step_y[p];
+		int iy = (int)(pos >> SCL_PHASE_BITS);
+		int ip = (int)((pos >> (SCL_PHASE_BITS - 6)) & (SCL_FILTER_PHASES - 1));
+
+		if (iy + lo < -yt || iy + hi > sh - 1 + yb)
+			return -ERANGE;
+		for (uint32_t x = 0; x < ow; x++) {
+			int64_t acc = 0, v;
+
+			for (int k = lo; k <= hi; k++)
+				acc += (int64_t)f.c[ip][k - f.lo] * tmp[(size_t)(iy + k + yt) * ow + x];
+			v = (acc + (1 << (2 * SCL_COEF_BITS - 1))) >> (2 * SCL_COEF_BITS);
+			dst[y * dst_stride + x] = (uint16_t)std::min<int64_t>(std::max<int64_t>(v, 0),
+									  SCL_SAMPLE_MAX);
+		}
+	}
+	return 0;
+}
+
+} /* namespace sde */
+
+#endif /* __TOOLS_DISPLAY_SCALER_CFG_H__ */
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Logical CPU numbering.
+ *
+ * Linux numbers CPUs in the order their nodes appear under /cpus, so the
+ * logical id is just the position among device_type = "cpu" children.
+ * Clusters come from /cpus/cpu-map when present.  Phandle lists such as
+ * qcom,cpulist decode to a bitmask of logical ids.
+ */
+
+#ifndef __TOOLS_DT_CPUS_H__
+#define __TOOLS_DT_CPUS_H__
+
+#include "fdt.h"
+
+namespace dt {
+
+#define DT_MAX_CPUS	64
+
+struct cpu_rec {
+	uint32_t node;
+	uint32_t phandle;
+	uint64_t mpidr;
+	int cluster;		/* -1 without a cpu-map */
+};
+
+class cpu_topology {
+public:
+	int build(const tree &t)
+	{
+		uint32_t cpus = t.find("/cpus"), map;
+		int cluster = 0;
+
+		cpus_.clear();
+		if (cpus == DT_NONE)
+			return -ENOENT;
+		for (uint32_t c = t.first_child(cpus); c != DT_NONE; c = t.next_sibling(c)) {
+			property p;
+			cpu_rec r;
+
+			if (!t.find_prop(c, "device_type", &p) || !p.is_string() ||
+			    strcmp(p.str(), "cpu"))
+				continue;
+			if (cpus_.size() == DT_MAX_CPUS)
+				return -E2BIG;
+			r.node = c;
+			r.phandle = t.rec(c).phandle;
+			r.mpidr = 0;
+			r.cluster = -1;
+			if (t.find_prop(c, "reg", &p))
+				r.mpidr = p.cells() >= 2 ? p.u64(0) : p.cells() ? p.u32() : 0;
+			cpus_.push_back(r);
+		}
+		if (cpus_.empty())
+			return -ENOENT;
+
+		map = t.child(cpus, "cpu-map", 7);
+		if (map == DT_NONE)
+			return 0;
+		for (uint32_t cl = t.first_child(map); cl != DT_NONE;
+		     cl = t.next_sibling(cl), cluster++) {
+			uint32_t end = t.rec(cl).skip;
+
+			/* Cores may sit under nested clusters or threads */
+			for (uint32_t id = cl + 1; id < end; id++) {
+				property p;
+				int cpu;
+
+				if (!t.find_prop(id, "cpu", &p) || p.len != 4)
+					continue;
+				cpu = logical(t.by_phandle(p.u32()));
+				if (cpu >= 0)
+					cpus_[cpu].cluster = cluster;
+			}
+		}
+		return 0;
+	}
+
+	int count() const { return (int)cpus_.size(); }
+	const cpu_rec &cpu(int i) const { return cpus_[i]; }
+
+	/* Logical id of the cpu node @node, -1 if it is not one */
+	int logical(uint32_t node) const
+	{
+		for (size_t i = 0; i < cpus_.size(); i++)
+			if (cpus_[i].node == node)
+				return (int)i;
+		return -1;
+	}
+
+	/* Decode a phandle list of cpu nodes; unknown phandles are skipped */
+	uint64_t mask(const tree &t, const property &p) const
+	{
+		uint64_t m = 0;
+
+		for (uint32_t i = 0; i < p.cells(); i++) {
+			int cpu = logical(t.by_phandle(p.u32(i)));
+
+			if (cpu >= 0)
+				m |= 1ull << cpu;
+		}
+		return m;
+	}
+
+private:
+	std::vector<cpu_rec> cpus_;
+};
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_CPUS_H__ */
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Android DTBO partition image (dt_table) reader.
+ *
+ * The image is a big-endian dt_table_header followed by dt_entry_count
+ * dt_table_entry records, each pointing at an FDT overlay blob inside the
+ * same image.  Entries are handed out as views into the mapping.
+ */
+
+#ifndef __TOOLS_DT_DTBO_H__
+#define __TOOLS_DT_DTBO_H__
+
+#include <vector>
+
+#include "fdt.h"
+
+namespace dt {
+
+#define DT_TABLE_MAGIC		0xd7b7ab1e
+#define DT_TABLE_HEADER_SIZE	32
+#define DT_TABLE_ENTRY_SIZE	32
+
+/* dt_table_entry_v1 keeps the compression format in the low flag bits */
+#define DT_ENTRY_COMPRESSION_MASK	0x0f
+#define DT_ENTRY_COMPRESSION_NONE	0
+
+struct dtbo_entry {
+	const uint8_t *blob;
+	uint32_t size;
+	uint32_t id;
+	uint32_t rev;
+	uint32_t custom[4];
+};
+
+class dtbo_image {
+public:
+	int open(const char *path)
+	{
+		int ret = map_.open(path);
+
+		return ret ? ret : parse(map_.data(), map_.size());
+	}
+
+	int parse(const uint8_t *b, size_t size)
+	{
+		uint32_t tot, hsz, esz, count, eoff;
+
+		entries_.clear();
+		if (size < DT_TABLE_HEADER_SIZE || be32(b) != DT_TABLE_MAGIC)
+			return -EINVAL;
+		tot = be32(b + 4);
+		hsz = be32(b + 8);
+		esz = be32(b + 12);
+		count = be32(b + 16);
+		eoff = be32(b + 20);
+		page_size_ = be32(b + 24);
+		version_ = be32(b + 28);
+		if (tot > size || hsz < DT_TABLE_HEADER_SIZE ||
+		    esz < DT_TABLE_ENTRY_SIZE || eoff > tot ||
+		    (uint64_t)count * esz > tot - eoff)
+			return -EINVAL;
+
+		for (uint32_t i = 0; i < count; i++) {
+			const uint8_t *e = b + eoff + i * esz;
+			dtbo_entry d;
+
+			d.size = be32(e);
+			if (be32(e + 4) > tot || d.size > tot - be32(e + 4))
+				return -EINVAL;
+			d.blob = b + be32(e + 4);
+			d.id = be32(e + 8);
+			d.rev = be32(e + 12);
+			for (int k = 0; k < 4; k++)
+				d.custom[k] = be32(e + 16 + 4 * k);
+			if (version_ >= 1 && (d.custom[0] & DT_ENTRY_COMPRESSION_MASK) !=
+					     DT_ENTRY_COMPRESSION_NONE)
+				return -EOPNOTSUPP;
+			entries_.push_back(d);
+		}
+		return 0;
+	}
+
+	uint32_t count() const { return (uint32_t)entries_.size(); }
+	const dtbo_entry &entry(uint32_t i) const { return entries_[i]; }
+	uint32_t page_size() const { return page_size_; }
+	uint32_t version() const { return version_; }
+
+private:
+	mapped_file map_;
+	std::vector<dtbo_entry> entries_;
+	uint32_t page_size_ = 0, version_ = 0;
+};
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_DTBO_H__ */
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Structural diff of two DTBs, or of two dtbo.img files entry by entry.
+ *
+ * Build: g++ -std=c++17 -O2 -o dtdiff dtdiff.cpp
+ * Usage: dtdiff [-t] old.{dtb,img} new.{dtb,img}
+ *
+ * Exits 0 when the trees are equivalent, 1 when they differ and 2 on
+ * error, like diff(1).  -t prints the time spent to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <memory>
+
+#include "dtbo.h"
+#include "dtdiff.h"
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void print_entry(const char *prefix, const dt::diff_entry &e)
+{
+	switch (e.kind) {
+	case dt::diff_entry::NODE_ADDED:
+		printf("%s+ %s (%u nodes)\n", prefix, e.path.c_str(), e.nodes);
+		break;
+	case dt::diff_entry::NODE_REMOVED:
+		printf("%s- %s (%u nodes)\n", prefix, e.path.c_str(), e.nodes);
+		break;
+	case dt::diff_entry::NODE_RENAMED:
+		printf("%s> %s -> %s\n", prefix, e.path.c_str(), e.to.c_str());
+		break;
+	case dt::diff_entry::PROP_ADDED:
+		printf("%s+ %s:%s = %s\n", prefix, e.path.c_str(), e.prop.c_str(),
+		       e.new_val.c_str());
+		break;
+	case dt::diff_entry::PROP_REMOVED:
+		printf("%s- %s:%s = %s\n", prefix, e.path.c_str(), e.prop.c_str(),
+		       e.old_val.c_str());
+		break;
+	case dt::diff_entry::PROP_CHANGED:
+		printf("%s~ %s:%s\n%s    - %s\n%s    + %s\n", prefix, e.path.c_str(),
+		       e.prop.c_str(), prefix, e.old_val.c_str(), prefix,
+		       e.new_val.c_str());
+		break;
+	}
+}
+
+/* Diff two indexed blobs and print the result; returns the entry count */
+static size_t diff_blobs(const dt::tree &a, const dt::tree &b, const char *prefix)
+{
+	std::vector<dt::diff_entry> out;
+	dt::diff_side sa, sb;
+	dt::tree_diff d;
+
+	sa.init(a);
+	sb.init(b);
+	d.run(sa, sb, &out);
+	for (const dt::diff_entry &e : out)
+		print_entry(prefix, e);
+	return out.size();
+}
+
+static bool is_dtbo(const char *path)
+{
+	uint8_t magic[4];
+	FILE *f = fopen(path, "rb");
+	bool ret;
+
+	if (!f)
+		return false;
+	ret = fread(magic, 1, 4, f) == 4 && dt::be32(magic) == DT_TABLE_MAGIC;
+	fclose(f);
+	return ret;
+}
+
+static int diff_images(const char *pa, const char *pb, size_t *changes)
+{
+	dt::dtbo_image a, b;
+	uint32_t n;
+	int ret;
+
+	ret = a.open(pa);
+	if (!ret)
+		ret = b.open(pb);
+	if (ret)
+		return ret;
+	n = std::max(a.count(), b.count());
+	for (uint32_t i = 0; i < n; i++) {
+		std::unique_ptr<dt::file> fa(new dt::file), fb(new dt::file);
+		char prefix[32];
+
+		snprintf(prefix, sizeof(prefix), "[%u] ", i);
+		if (i >= a.count() || i >= b.count()) {
+			printf("%s%c entry\n", prefix, i >= a.count() ? '+' : '-');
+			(*changes)++;
+			continue;
+		}
+		ret = fa->open_mem(a.entry(i).blob, a.entry(i).size);
+		if (!ret)
+			ret = fb->open_mem(b.entry(i).blob, b.entry(i).size);
+		if (ret)
+			return ret;
+		*changes += diff_blobs(fa->index(), fb->index(), prefix);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool timing = false;
+	size_t changes = 0;
+	double t0;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "t")) != -1) {
+		if (opt != 't')
+			return 2;
+		timing = true;
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "usage: %s [-t] old.{dtb,img} new.{dtb,img}\n", argv[0]);
+		return 2;
+	}
+
+	const char *pa = argv[optind], *pb = argv[optind + 1];
+
+	t0 = now_ms();
+	if (is_dtbo(pa) != is_dtbo(pb)) {
+		fprintf(stderr, "cannot diff a DTB against a DTBO image\n");
+		return 2;
+	}
+	if (is_dtbo(pa)) {
+		ret = diff_images(pa, pb, &changes);
+	} else {
+		dt::file a, b;
+
+		ret = a.open(pa);
+		if (!ret)
+			ret = b.open(pb);
+		if (!ret)
+			changes = diff_blobs(a.index(), b.index(), "");
+	}
+	if (ret) {
+		fprintf(stderr, "%s\n", strerror(-ret));
+		return 2;
+	}
+	if (timing)
+		fprintf(stderr, "%zu differences in %.2f ms\n", changes, now_ms() - t0);
+	return changes ? 1 : 0;
+}
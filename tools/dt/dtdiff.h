@@ -0,0 +1,485 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Structural device tree diff.
+ *
+ * Both trees are hashed bottom-up first: a node's hash covers its name,
+ * its properties and its children, all combined order-independently, and
+ * phandle cells are replaced by the hash of the path they point at.  Equal
+ * subtrees are then skipped wholesale, so only the changed spine of the
+ * tree is ever walked property by property.
+ *
+ * Nodes pair up by name, then by (name without unit address, first
+ * compatible) so that a moved unit address reads as a rename rather than
+ * a remove plus add.  "phandle" properties themselves are ignored, and
+ * overlay bookkeeping nodes (__fixups__, __local_fixups__) are skipped;
+ * overlay references that only exist as __fixups__ entries render as
+ * "&label".
+ */
+
+#ifndef __TOOLS_DT_DTDIFF_H__
+#define __TOOLS_DT_DTDIFF_H__
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "refs.h"
+
+namespace dt {
+
+static inline uint64_t hmix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+static inline uint64_t hbytes(const void *p, size_t len, uint64_t seed)
+{
+	const uint8_t *b = static_cast<const uint8_t *>(p);
+	uint64_t h = seed ^ 0xcbf29ce484222325ull;
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ b[i]) * 0x100000001b3ull;
+	return hmix(h);
+}
+
+static inline uint64_t hstr(const char *s)
+{
+	return hbytes(s, strlen(s), 0);
+}
+
+struct diff_entry {
+	enum kind {
+		NODE_ADDED,
+		NODE_REMOVED,
+		NODE_RENAMED,
+		PROP_ADDED,
+		PROP_REMOVED,
+		PROP_CHANGED,
+	} kind;
+	std::string path;	/* old path; new path for NODE_ADDED */
+	std::string to;		/* new path for NODE_RENAMED */
+	std::string prop;
+	std::string old_val, new_val;
+	uint32_t nodes = 0;	/* subtree size for added/removed nodes */
+};
+
+/*
+ * One side of a diff: an indexed tree plus its hashes.
+ */
+class diff_side {
+public:
+	void init(const tree &t)
+	{
+		uint32_t n = t.size();
+
+		t_ = &t;
+		path_h_.resize(n);
+		own_h_.assign(n, 0);
+		sub_h_.assign(n, 0);
+		ignored_.assign(n, 0);
+		index_fixups();
+
+		path_h_[0] = hstr("/");
+		for (uint32_t id = 1; id < n; id++) {
+			uint32_t par = t.rec(id).parent;
+
+			path_h_[id] = hmix(path_h_[par] ^ hstr(t.name(id)));
+			if (ignored_[par] || (par == 0 && is_bookkeeping(t.name(id))))
+				ignored_[id] = 1;
+		}
+		for (uint32_t id = 0; id < n; id++) {
+			if (ignored_[id])
+				continue;
+			for (const property &p : t.props(id))
+				own_h_[id] += prop_hash(p);
+		}
+		/* Children have larger preorder ids: fold them upwards */
+		for (uint32_t id = n; id-- > 0;) {
+			if (ignored_[id])
+				continue;
+			sub_h_[id] = hmix(sub_h_[id] + own_h_[id] + hstr(t.name(id)));
+			if (id)
+				sub_h_[t.rec(id).parent] += hmix(sub_h_[id] ^ 0x5bd1e995);
+		}
+	}
+
+	const tree &t() const { return *t_; }
+	uint64_t sub_hash(uint32_t id) const { return sub_h_[id]; }
+	uint64_t own_hash(uint32_t id) const { return own_h_[id]; }
+	bool ignored(uint32_t id) const { return ignored_[id]; }
+
+	/* Hash of @p with references replaced by their targets; 0 if ignored */
+	uint64_t prop_hash(const property &p) const
+	{
+		uint64_t h;
+
+		if (p.eq("phandle") || p.eq("linux,phandle"))
+			return 0;
+		h = hstr(p.name);
+		if (!has_refs(p))
+			return hmix(h ^ hbytes(p.data, p.len, 1));
+
+		ref_cells r;
+
+		collect_refs(p, &r);
+		for (uint32_t i = 0; i < p.cells(); i++) {
+			uint64_t c = r.at(i);
+
+			h = hmix(h ^ (c ? c : p.u32(i)) ^ (uint64_t)i << 40);
+		}
+		return h;
+	}
+
+	/* Human readable value, with references and reg entries decoded */
+	std::string render(uint32_t id, const property &p) const
+	{
+		std::string s;
+		char buf[32];
+
+		if (!p.len)
+			return "<empty>";
+		if (p.is_string() && printable(p)) {
+			for (const char *x : p.strings()) {
+				if (!s.empty())
+					s += ", ";
+				s += '"';
+				s += x;
+				s += '"';
+			}
+			return s;
+		}
+		if (p.len & 3) {
+			s = "[";
+			for (uint32_t i = 0; i < p.len; i++) {
+				snprintf(buf, sizeof(buf), i ? " %02x" : "%02x", p.data[i]);
+				s += buf;
+			}
+			return s + "]";
+		}
+
+		uint32_t group = 0, ac, sc;
+		ref_cells r;
+
+		if (p.eq("reg")) {
+			t_->reg_cells(id, &ac, &sc);
+			group = ac + sc;
+		} else if (has_refs(p)) {
+			collect_refs(p, &r);
+		}
+		s = "<";
+		for (uint32_t i = 0; i < p.cells(); i++) {
+			const char *label = r.label(i);
+			uint32_t target = r.target(i);
+
+			if (i)
+				s += (group && !(i % group)) || r.starts(i) ? ">, <" : " ";
+			if (label) {
+				s += '&';
+				s += label;
+			} else if (target != DT_NONE) {
+				s += '&';
+				s += t_->path(target);
+			} else {
+				snprintf(buf, sizeof(buf), "0x%x", p.u32(i));
+				s += buf;
+			}
+		}
+		return s + ">";
+	}
+
+private:
+	/* Per-cell reference info for one property; small and on-stack */
+	struct ref_cells {
+		struct cell {
+			uint32_t idx;
+			uint32_t target;
+			const char *label;
+			uint64_t h;
+		};
+		std::vector<cell> v;
+
+		const cell *find(uint32_t i) const
+		{
+			for (const cell &c : v)
+				if (c.idx == i)
+					return &c;
+			return nullptr;
+		}
+		uint64_t at(uint32_t i) const
+		{
+			const cell *c = find(i);
+
+			return c ? c->h : 0;
+		}
+		uint32_t target(uint32_t i) const
+		{
+			const cell *c = find(i);
+
+			return c ? c->target : DT_NONE;
+		}
+		const char *label(uint32_t i) const
+		{
+			const cell *c = find(i);
+
+			return c ? c->label : nullptr;
+		}
+		bool starts(uint32_t i) const { return i && find(i); }
+	};
+
+	static bool is_bookkeeping(const char *name)
+	{
+		return !strcmp(name, "__fixups__") ||
+		       !strcmp(name, "__local_fixups__");
+	}
+
+	static bool printable(const property &p)
+	{
+		for (uint32_t i = 0; i + 1 < p.len; i++)
+			if (p.data[i] && (p.data[i] < 0x20 || p.data[i] > 0x7e))
+				return false;
+		return true;
+	}
+
+	bool has_refs(const property &p) const
+	{
+		const char *cells;
+
+		if (p.len & 3)
+			return false;
+		if (ref_classify(p.name, &cells) != REF_NONE)
+			return true;
+		for (uint32_t i = 0; i < p.cells() && !fixup_refs_.empty(); i++)
+			if (fixup_refs_.count(p.data + 4 * i))
+				return true;
+		return false;
+	}
+
+	void collect_refs(const property &p, ref_cells *r) const
+	{
+		ref_decode(*t_, p, [&](uint32_t i, uint32_t target, uint32_t) {
+			r->v.push_back({ i, target, nullptr, hmix(path_h_[target] ^ 7) });
+		});
+		if (fixup_refs_.empty())
+			return;
+		for (uint32_t i = 0; i < p.cells(); i++) {
+			auto it = fixup_refs_.find(p.data + 4 * i);
+
+			if (it != fixup_refs_.end() && !r->find(i))
+				r->v.push_back({ i, DT_NONE, it->second,
+						 hmix(hstr(it->second) ^ 11) });
+		}
+	}
+
+	/*
+	 * An overlay's references into the base are unresolved; __fixups__
+	 * says which label each one stands for.
+	 */
+	void index_fixups()
+	{
+		uint32_t fx = t_->find("/__fixups__");
+
+		fixup_refs_.clear();
+		if (fx == DT_NONE)
+			return;
+		for (const property &p : t_->props(fx)) {
+			for (const char *ref : p.strings()) {
+				const char *c1 = strchr(ref, ':');
+				const char *c2 = c1 ? strchr(c1 + 1, ':') : nullptr;
+				std::string node, prop;
+				property tp;
+				uint32_t id, off;
+
+				if (!c2)
+					continue;
+				node.assign(ref, c1 - ref);
+				prop.assign(c1 + 1, c2 - c1 - 1);
+				off = strtoul(c2 + 1, nullptr, 0);
+				id = t_->find(node.c_str());
+				if (id != DT_NONE && t_->find_prop(id, prop.c_str(), &tp) &&
+				    off + 4 <= tp.len && !(off & 3))
+					fixup_refs_.emplace(tp.data + off, p.name);
+			}
+		}
+	}
+
+	const tree *t_ = nullptr;
+	std::vector<uint64_t> path_h_, own_h_, sub_h_;
+	std::vector<uint8_t> ignored_;
+	std::unordered_map<const uint8_t *, const char *> fixup_refs_;
+};
+
+class tree_diff {
+public:
+	void run(const diff_side &a, const diff_side &b, std::vector<diff_entry> *out)
+	{
+		a_ = &a;
+		b_ = &b;
+		out_ = out;
+		compare(0, 0);
+	}
+
+private:
+	void compare(uint32_t ia, uint32_t ib)
+	{
+		if (a_->sub_hash(ia) == b_->sub_hash(ib))
+			return;
+		if (a_->own_hash(ia) != b_->own_hash(ib))
+			compare_props(ia, ib);
+		compare_children(ia, ib);
+	}
+
+	struct named {
+		const char *name;
+		uint64_t h;
+		property p;
+
+		bool operator<(const named &o) const { return strcmp(name, o.name) < 0; }
+	};
+
+	static void props_of(const diff_side &s, uint32_t id, std::vector<named> *v)
+	{
+		for (const property &p : s.t().props(id)) {
+			uint64_t h = s.prop_hash(p);
+
+			if (h)
+				v->push_back({ p.name, h, p });
+		}
+		std::sort(v->begin(), v->end());
+	}
+
+	void compare_props(uint32_t ia, uint32_t ib)
+	{
+		std::vector<named> pa, pb;
+		size_t i = 0, j = 0;
+
+		props_of(*a_, ia, &pa);
+		props_of(*b_, ib, &pb);
+		while (i < pa.size() || j < pb.size()) {
+			int c = i == pa.size() ? 1 : j == pb.size() ? -1 :
+				strcmp(pa[i].name, pb[j].name);
+			diff_entry e;
+
+			if (c == 0 && pa[i].h == pb[j].h) {
+				i++;
+				j++;
+				continue;
+			}
+			e.path = a_->t().path(ia);
+			if (c < 0) {
+				e.kind = diff_entry::PROP_REMOVED;
+				e.prop = pa[i].name;
+				e.old_val = a_->render(ia, pa[i].p);
+				i++;
+			} else if (c > 0) {
+				e.kind = diff_entry::PROP_ADDED;
+				e.prop = pb[j].name;
+				e.new_val = b_->render(ib, pb[j].p);
+				j++;
+			} else {
+				e.kind = diff_entry::PROP_CHANGED;
+				e.prop = pa[i].name;
+				e.old_val = a_->render(ia, pa[i].p);
+				e.new_val = b_->render(ib, pb[j].p);
+				i++;
+				j++;
+			}
+			out_->push_back(std::move(e));
+		}
+	}
+
+	static std::string_view base_name(const char *n)
+	{
+		const char *at = strchr(n, '@');
+
+		return at ? std::string_view(n, at - n) : std::string_view(n);
+	}
+
+	static std::string match_key(const diff_side &s, uint32_t id)
+	{
+		property p;
+		std::string k(base_name(s.t().name(id)));
+
+		k += '\0';
+		if (s.t().find_prop(id, "compatible", &p))
+			k += p.str();
+		return k;
+	}
+
+	void compare_children(uint32_t ia, uint32_t ib)
+	{
+		const tree &ta = a_->t(), &tb = b_->t();
+		std::unordered_map<std::string_view, uint32_t> bn;
+		std::vector<uint32_t> lone_a;
+		std::vector<uint8_t> used_b;
+		uint32_t b0 = ib + 1;
+
+		used_b.assign(tb.rec(ib).skip - b0, 0);
+		for (uint32_t c = tb.first_child(ib); c != DT_NONE; c = tb.next_sibling(c))
+			if (!b_->ignored(c))
+				bn.emplace(tb.name(c), c);
+
+		for (uint32_t c = ta.first_child(ia); c != DT_NONE; c = ta.next_sibling(c)) {
+			if (a_->ignored(c))
+				continue;
+			auto it = bn.find(ta.name(c));
+
+			if (it == bn.end()) {
+				lone_a.push_back(c);
+				continue;
+			}
+			used_b[it->second - b0] = 1;
+			compare(c, it->second);
+		}
+
+		/* Second chance for moved unit addresses */
+		std::unordered_multimap<std::string, uint32_t> bk;
+
+		for (auto &kv : bn)
+			if (!used_b[kv.second - b0])
+				bk.emplace(match_key(*b_, kv.second), kv.second);
+		for (uint32_t c : lone_a) {
+			auto it = bk.find(match_key(*a_, c));
+			diff_entry e;
+
+			if (it != bk.end()) {
+				uint32_t m = it->second;
+
+				bk.erase(it);
+				used_b[m - b0] = 1;
+				e.kind = diff_entry::NODE_RENAMED;
+				e.path = ta.path(c);
+				e.to = tb.path(m);
+				out_->push_back(std::move(e));
+				compare(c, m);
+				continue;
+			}
+			e.kind = diff_entry::NODE_REMOVED;
+			e.path = ta.path(c);
+			e.nodes = ta.rec(c).skip - c;
+			out_->push_back(std::move(e));
+		}
+		for (uint32_t c = tb.first_child(ib); c != DT_NONE; c = tb.next_sibling(c)) {
+			diff_entry e;
+
+			if (b_->ignored(c) || used_b[c - b0])
+				continue;
+			e.kind = diff_entry::NODE_ADDED;
+			e.path = tb.path(c);
+			e.nodes = tb.rec(c).skip - c;
+			out_->push_back(std::move(e));
+		}
+	}
+
+	const diff_side *a_ = nullptr, *b_ = nullptr;
+	std::vector<diff_entry> *out_ = nullptr;
+};
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_DTDIFF_H__ */
@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Build and query the columnar DTB index.
+ *
+ * Build: g++ -std=c++17 -O2 -o dtindex dtindex.cpp
+ * Usage: dtindex build <blob.dtb> <blob.idx>
+ *        dtindex query [-b blob.dtb] [-c compatible] [-s /subtree]
+ *                      [-p prop]... [-n iterations] <blob.idx>
+ *
+ * With -b the index is rebuilt first if the blob changed.  Nodes are
+ * selected by compatible (-c), else by having the first -p property;
+ * -s restricts the selection to one subtree.  -n repeats the query and
+ * reports the mean time per query.
+ *
+ * Example:
+ *   dtindex query -c qcom,arm-memlat-mon -p qcom,core-dev-table yupik.idx
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dtindex.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void print_value(const dt::dtidx::value &v)
+{
+	switch (v.type) {
+	case dt::DTIDX_T_EMPTY:
+		printf(";\n");
+		return;
+	case dt::DTIDX_T_STRING:
+		for (uint32_t off = 0; off < v.len; off += strlen(v.str + off) + 1)
+			printf("%s\"%s\"", off ? ", " : " = ", v.str + off);
+		/* Short values are as likely to be numbers; show both */
+		if (v.cells && v.ncells <= 2) {
+			printf(" /* <");
+			for (uint32_t i = 0; i < v.ncells; i++)
+				printf(i ? " 0x%x" : "0x%x", v.cells[i]);
+			printf("> */");
+		}
+		break;
+	case dt::DTIDX_T_CELLS:
+		printf(" = <");
+		for (uint32_t i = 0; i < v.len; i++)
+			printf(i ? " 0x%x" : "0x%x", v.cells[i]);
+		printf(">");
+		break;
+	case dt::DTIDX_T_BYTES:
+		printf(" = [");
+		for (uint32_t i = 0; i < v.len; i++)
+			printf(i ? " %02x" : "%02x", v.bytes[i]);
+		printf("]");
+		break;
+	}
+	printf(";\n");
+}
+
+#define QUERY_MAX_PROPS	16
+
+struct query {
+	const char *compat = nullptr;
+	const char *subtree = nullptr;
+	std::vector<const char *> props;
+};
+
+/*
+ * Run @q and hand each (node, property rows) hit to @fn.  Everything up
+ * to the callback is column reads; the callback decides what to print.
+ */
+template <typename F>
+static int run_query(const dt::dtidx &ix, const query &q, F fn)
+{
+	uint32_t lo = 0, hi = ix.nodes(), count;
+	uint32_t want[QUERY_MAX_PROPS];
+	const uint32_t *nodes;
+	size_t np = q.props.size();
+	std::vector<uint32_t> by_prop;
+
+	if (np > QUERY_MAX_PROPS)
+		return -E2BIG;
+	if (q.subtree) {
+		lo = ix.find(q.subtree);
+		if (lo == DT_NONE)
+			return -ENOENT;
+		hi = ix.subtree_end(lo);
+	}
+	for (size_t i = 0; i < np; i++)
+		want[i] = ix.name_id(q.props[i]);
+
+	if (q.compat) {
+		nodes = ix.compatible(q.compat, &count);
+	} else if (np) {
+		if (want[0] == DT_NONE)
+			return 0;
+		const uint32_t *rows = ix.rows_named(want[0], &count);
+
+		by_prop.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+			by_prop[i] = ix.prop_node(rows[i]);
+		nodes = by_prop.data();
+	} else {
+		return -EINVAL;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t id = nodes[i], rows[QUERY_MAX_PROPS];
+
+		if (id < lo || id >= hi)
+			continue;
+		for (size_t k = 0; k < np; k++)
+			rows[k] = want[k] == DT_NONE ? DT_NONE :
+				  ix.find_prop(id, want[k]);
+		fn(id, rows, np);
+	}
+	return 0;
+}
+
+static int cmd_build(int argc, char **argv)
+{
+	struct stat st;
+	dt::file f;
+	double t0;
+	int ret;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s build <blob.dtb> <blob.idx>\n", argv[0]);
+		return 1;
+	}
+	t0 = now_us();
+	ret = f.open(argv[2]);
+	if (!ret && stat(argv[2], &st))
+		ret = -errno;
+	if (!ret)
+		ret = dt::dtidx_write(f.index(),
+				      st.st_mtim.tv_sec * 1000000000ull +
+				      st.st_mtim.tv_nsec, argv[3]);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(-ret));
+		return 1;
+	}
+	printf("indexed %u nodes in %.0f us\n", f.index().size(), now_us() - t0);
+	return 0;
+}
+
+static int cmd_query(int argc, char **argv)
+{
+	const char *blob = nullptr;
+	int iters = 0, opt, ret;
+	bool rebuilt = false;
+	dt::dtidx ix;
+	std::string path;
+	query q;
+
+	optind = 2;
+	while ((opt = getopt(argc, argv, "b:c:s:p:n:")) != -1) {
+		switch (opt) {
+		case 'b':
+			blob = optarg;
+			break;
+		case 'c':
+			q.compat = optarg;
+			break;
+		case 's':
+			q.subtree = optarg;
+			break;
+		case 'p':
+			if (q.props.size() == QUERY_MAX_PROPS) {
+				fprintf(stderr, "at most %d -p properties\n", QUERY_MAX_PROPS);
+				return 1;
+			}
+			q.props.push_back(optarg);
+			break;
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != 1 || (!q.compat && q.props.empty())) {
+		fprintf(stderr,
+			"usage: %s query [-b blob.dtb] [-c compatible] [-s /subtree] "
+			"[-p prop]... [-n iterations] <blob.idx>\n", argv[0]);
+		return 1;
+	}
+
+	ret = blob ? ix.open_for(blob, argv[optind], &rebuilt) : ix.open(argv[optind]);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	if (rebuilt)
+		fprintf(stderr, "%s: rebuilt from %s\n", argv[optind], blob);
+
+	ret = run_query(ix, q, [&](uint32_t id, const uint32_t *rows, size_t n) {
+		ix.path(id, &path);
+		printf("%s {\n", path.c_str());
+		for (size_t k = 0; k < n; k++) {
+			if (rows[k] == DT_NONE)
+				continue;
+			printf("\t%s", q.props[k]);
+			print_value(ix.prop_value(rows[k]));
+		}
+		printf("};\n");
+	});
+	if (ret) {
+		fprintf(stderr, "query: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	if (iters > 0) {
+		uint64_t sink = 0;
+		double t0 = now_us();
+
+		for (int i = 0; i < iters; i++)
+			run_query(ix, q, [&](uint32_t id, const uint32_t *rows, size_t n) {
+				sink += id;
+				for (size_t k = 0; k < n; k++)
+					if (rows[k] != DT_NONE)
+						sink += ix.prop_value(rows[k]).len;
+			});
+		fprintf(stderr, "%.3f us/query (%d runs, %lu)\n",
+			(now_us() - t0) / iters, iters, (unsigned long)(sink & 1));
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "build"))
+		return cmd_build(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "query"))
+		return cmd_query(argc, argv);
+	fprintf(stderr, "usage: %s build|query ...\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,714 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Columnar on-disk index of a device tree blob.
+ *
+ * Every node and property becomes one row in a set of flat column arrays
+ * that are mmap'd and used in place:
+ *
+ *  - nodes: parent, name, subtree end, phandle, first property, and a
+ *    name-sorted child list per node that forms the path trie;
+ *  - properties: owning node, interned name id, value type and value
+ *    location in one of three typed pools (strings, decoded cells, bytes).
+ *    A value that passes for text but is a whole number of cells (such
+ *    as <0x30662300>) is stored both ways, since the blob cannot tell;
+ *  - postings: for every property name the properties carrying it, and
+ *    for every compatible string the nodes claiming it, both sorted.
+ *
+ * The header records the size, mtime and FNV-1a hash of the source blob;
+ * dtidx::open_for() rebuilds the index only when those no longer match.
+ * Columns are host-endian.
+ */
+
+#ifndef __TOOLS_DT_DTINDEX_H__
+#define __TOOLS_DT_DTINDEX_H__
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "fdt.h"
+
+namespace dt {
+
+#define DTIDX_MAGIC	"DTIDX\0\0"
+#define DTIDX_VERSION	1
+#define DTIDX_ENDIAN	0x01020304
+/* Sections whose size the header counts do not fix */
+#define DTIDX_ANY	(~0ull)
+
+enum dtidx_section {
+	DTIDX_NODE_PARENT,	/* u32[nodes] */
+	DTIDX_NODE_NAME,	/* u32[nodes], offset in STRPOOL */
+	DTIDX_NODE_SKIP,	/* u32[nodes], first id after the subtree */
+	DTIDX_NODE_PHANDLE,	/* u32[nodes] */
+	DTIDX_NODE_PROPS,	/* u32[nodes + 1], first property row */
+	DTIDX_NODE_CHILDREN,	/* u32[nodes + 1], first CHILD_IDS entry */
+	DTIDX_CHILD_IDS,	/* u32[nodes - 1], children sorted by name */
+	DTIDX_PROP_NODE,	/* u32[props] */
+	DTIDX_PROP_NAME,	/* u32[props], name id */
+	DTIDX_PROP_TYPE,	/* u8[props], enum dtidx_type */
+	DTIDX_PROP_VAL,		/* u32[props], offset in the type's pool */
+	DTIDX_PROP_LEN,		/* u32[props], bytes, or cells for CELLS */
+	DTIDX_PROP_ALT,		/* u32[props], CELLS offset of a STRING value
+				 * that is also a whole number of cells */
+	DTIDX_NAME_STR,		/* u32[names], sorted by string */
+	DTIDX_NAME_POST,	/* u32[names + 1], first NAME_PROPS entry */
+	DTIDX_NAME_PROPS,	/* u32[props], property rows per name */
+	DTIDX_COMPAT_STR,	/* u32[compats], sorted by string */
+	DTIDX_COMPAT_POST,	/* u32[compats + 1], first COMPAT_NODES entry */
+	DTIDX_COMPAT_NODES,	/* u32[], node ids per compatible */
+	DTIDX_STRPOOL,		/* char[] */
+	DTIDX_CELLS,		/* u32[], decoded */
+	DTIDX_BYTES,		/* u8[] */
+	DTIDX_NR_SECTIONS,
+};
+
+enum dtidx_type {
+	DTIDX_T_EMPTY,
+	DTIDX_T_STRING,		/* one or more NUL-terminated strings */
+	DTIDX_T_CELLS,
+	DTIDX_T_BYTES,
+};
+
+struct dtidx_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t nodes, props, names, compats;
+	uint64_t src_size;
+	uint64_t src_mtime_ns;
+	uint64_t src_hash;
+	struct {
+		uint64_t off, size;
+	} sec[DTIDX_NR_SECTIONS];
+};
+
+static inline uint64_t fnv1a64(const void *p, size_t len)
+{
+	const uint8_t *b = static_cast<const uint8_t *>(p);
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ b[i]) * 0x100000001b3ull;
+	return h;
+}
+
+/* dtc's heuristic: printable text split by single NULs */
+static inline bool looks_like_strings(const property &p)
+{
+	if (!p.len || p.data[p.len - 1] || !p.data[0])
+		return false;
+	for (uint32_t i = 0; i < p.len; i++) {
+		uint8_t c = p.data[i];
+
+		if (!c) {
+			if (i + 1 < p.len && !p.data[i + 1])
+				return false;
+		} else if (c < 0x20 || c > 0x7e) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Build the column set for @t and write it to @path.
+ */
+static inline int dtidx_write(const tree &t, uint64_t mtime_ns, const char *path)
+{
+	const fdt &f = t.blob();
+	std::vector<uint32_t> col[DTIDX_NR_SECTIONS];
+	std::vector<uint8_t> types, bytes;
+	std::string pool;
+	std::unordered_map<std::string_view, uint32_t> pool_at, name_id, compat_id;
+	std::vector<std::string_view> names, compats;
+	std::vector<std::vector<uint32_t>> name_rows, compat_nodes;
+	uint32_t n = t.size();
+	dtidx_header h;
+
+	auto intern = [&](std::string_view s) {
+		auto it = pool_at.find(s);
+
+		if (it != pool_at.end())
+			return it->second;
+		uint32_t off = (uint32_t)pool.size();
+
+		pool.append(s.data(), s.size());
+		pool.push_back('\0');
+		pool_at.emplace(s, off);
+		return off;
+	};
+
+	for (uint32_t id = 0; id < n; id++) {
+		const tree::node_rec &r = t.rec(id);
+
+		col[DTIDX_NODE_PARENT].push_back(r.parent);
+		col[DTIDX_NODE_NAME].push_back(intern(t.name(id)));
+		col[DTIDX_NODE_SKIP].push_back(r.skip);
+		col[DTIDX_NODE_PHANDLE].push_back(r.phandle);
+		col[DTIDX_NODE_PROPS].push_back((uint32_t)types.size());
+
+		for (const property &p : t.props(id)) {
+			uint32_t row = (uint32_t)types.size(), nid;
+			auto it = name_id.find(p.name);
+
+			if (it == name_id.end()) {
+				nid = (uint32_t)names.size();
+				name_id.emplace(p.name, nid);
+				names.push_back(p.name);
+				name_rows.emplace_back();
+			} else {
+				nid = it->second;
+			}
+			name_rows[nid].push_back(row);
+			col[DTIDX_PROP_NODE].push_back(id);
+			col[DTIDX_PROP_NAME].push_back(nid);
+
+			if (!p.len) {
+				types.push_back(DTIDX_T_EMPTY);
+				col[DTIDX_PROP_VAL].push_back(0);
+				col[DTIDX_PROP_LEN].push_back(0);
+			} else if (looks_like_strings(p)) {
+				types.push_back(DTIDX_T_STRING);
+				col[DTIDX_PROP_VAL].push_back((uint32_t)pool.size());
+				col[DTIDX_PROP_LEN].push_back(p.len);
+				pool.append(reinterpret_cast<const char *>(p.data), p.len);
+			} else if (!(p.len & 3)) {
+				types.push_back(DTIDX_T_CELLS);
+				col[DTIDX_PROP_VAL].push_back(
+					(uint32_t)col[DTIDX_CELLS].size());
+				col[DTIDX_PROP_LEN].push_back(p.cells());
+				for (uint32_t i = 0; i < p.cells(); i++)
+					col[DTIDX_CELLS].push_back(p.u32(i));
+			} else {
+				types.push_back(DTIDX_T_BYTES);
+				col[DTIDX_PROP_VAL].push_back((uint32_t)bytes.size());
+				col[DTIDX_PROP_LEN].push_back(p.len);
+				bytes.insert(bytes.end(), p.data, p.data + p.len);
+			}
+
+			if (types.back() == DTIDX_T_STRING && !(p.len & 3)) {
+				col[DTIDX_PROP_ALT].push_back(
+					(uint32_t)col[DTIDX_CELLS].size());
+				for (uint32_t i = 0; i < p.cells(); i++)
+					col[DTIDX_CELLS].push_back(p.u32(i));
+			} else {
+				col[DTIDX_PROP_ALT].push_back(DT_NONE);
+			}
+
+			if (p.eq("compatible") && types.back() == DTIDX_T_STRING) {
+				for (const char *s : p.strings()) {
+					auto ci = compat_id.find(s);
+
+					if (ci == compat_id.end()) {
+						ci = compat_id.emplace(s, (uint32_t)compats.size()).first;
+						compats.push_back(s);
+						compat_nodes.emplace_back();
+					}
+					if (compat_nodes[ci->second].empty() ||
+					    compat_nodes[ci->second].back() != id)
+						compat_nodes[ci->second].push_back(id);
+				}
+			}
+		}
+	}
+	col[DTIDX_NODE_PROPS].push_back((uint32_t)types.size());
+
+	/* Path trie: children of each node, sorted by name */
+	for (uint32_t id = 0; id < n; id++) {
+		size_t first = col[DTIDX_CHILD_IDS].size();
+
+		col[DTIDX_NODE_CHILDREN].push_back((uint32_t)first);
+		for (uint32_t c = t.first_child(id); c != DT_NONE; c = t.next_sibling(c))
+			col[DTIDX_CHILD_IDS].push_back(c);
+		std::sort(col[DTIDX_CHILD_IDS].begin() + first,
+			  col[DTIDX_CHILD_IDS].end(), [&](uint32_t a, uint32_t b) {
+			return strcmp(t.name(a), t.name(b)) < 0;
+		});
+	}
+	col[DTIDX_NODE_CHILDREN].push_back((uint32_t)col[DTIDX_CHILD_IDS].size());
+
+	/*
+	 * Renumber name ids in string order so lookups can bisect, then
+	 * lay out the posting lists in that order.
+	 */
+	std::vector<uint32_t> order(names.size()), rank(names.size());
+
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return names[a] < names[b];
+	});
+	for (uint32_t i = 0; i < order.size(); i++)
+		rank[order[i]] = i;
+	for (uint32_t &nid : col[DTIDX_PROP_NAME])
+		nid = rank[nid];
+	for (uint32_t i : order) {
+		col[DTIDX_NAME_STR].push_back(intern(names[i]));
+		col[DTIDX_NAME_POST].push_back((uint32_t)col[DTIDX_NAME_PROPS].size());
+		col[DTIDX_NAME_PROPS].insert(col[DTIDX_NAME_PROPS].end(),
+					     name_rows[i].begin(), name_rows[i].end());
+	}
+	col[DTIDX_NAME_POST].push_back((uint32_t)col[DTIDX_NAME_PROPS].size());
+
+	order.resize(compats.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return compats[a] < compats[b];
+	});
+	for (uint32_t i : order) {
+		col[DTIDX_COMPAT_STR].push_back(intern(compats[i]));
+		col[DTIDX_COMPAT_POST].push_back((uint32_t)col[DTIDX_COMPAT_NODES].size());
+		col[DTIDX_COMPAT_NODES].insert(col[DTIDX_COMPAT_NODES].end(),
+					       compat_nodes[i].begin(),
+					       compat_nodes[i].end());
+	}
+	col[DTIDX_COMPAT_POST].push_back((uint32_t)col[DTIDX_COMPAT_NODES].size());
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DTIDX_MAGIC, sizeof(h.magic));
+	h.version = DTIDX_VERSION;
+	h.endian = DTIDX_ENDIAN;
+	h.nodes = n;
+	h.props = (uint32_t)types.size();
+	h.names = (uint32_t)names.size();
+	h.compats = (uint32_t)compats.size();
+	h.src_size = f.size();
+	h.src_mtime_ns = mtime_ns;
+	h.src_hash = fnv1a64(f.base(), f.size());
+
+	const void *data[DTIDX_NR_SECTIONS];
+	uint64_t off = (sizeof(h) + 7) & ~7ull;
+
+	for (int s = 0; s < DTIDX_NR_SECTIONS; s++) {
+		data[s] = col[s].data();
+		h.sec[s].size = col[s].size() * sizeof(uint32_t);
+	}
+	data[DTIDX_PROP_TYPE] = types.data();
+	h.sec[DTIDX_PROP_TYPE].size = types.size();
+	data[DTIDX_STRPOOL] = pool.data();
+	h.sec[DTIDX_STRPOOL].size = pool.size();
+	data[DTIDX_BYTES] = bytes.data();
+	h.sec[DTIDX_BYTES].size = bytes.size();
+	for (int s = 0; s < DTIDX_NR_SECTIONS; s++) {
+		h.sec[s].off = off;
+		off = (off + h.sec[s].size + 7) & ~7ull;
+	}
+
+	std::string tmp = std::string(path) + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	static const uint8_t zero[8] = { 0 };
+	int ret = 0;
+
+	if (!fp)
+		return -errno;
+	if (fwrite(&h, sizeof(h), 1, fp) != 1)
+		ret = -EIO;
+	for (int s = 0; s < DTIDX_NR_SECTIONS && !ret; s++) {
+		uint64_t pad = h.sec[s].off - ftell(fp);
+
+		if (fwrite(zero, 1, pad, fp) != pad ||
+		    fwrite(data[s], 1, h.sec[s].size, fp) != h.sec[s].size)
+			ret = -EIO;
+	}
+	if (fclose(fp) && !ret)
+		ret = -errno;
+	/* Readers holding the old mapping keep it; rename is atomic */
+	if (!ret && rename(tmp.c_str(), path))
+		ret = -errno;
+	if (ret)
+		unlink(tmp.c_str());
+	return ret;
+}
+
+/*
+ * Read side.  All lookups are bisections or direct column reads; nothing
+ * allocates after open().
+ */
+class dtidx {
+public:
+	/*
+	 * cells is also set, with ncells, for a STRING that decodes as
+	 * cells; typed consumers should use cells whenever it is non-null.
+	 */
+	struct value {
+		uint8_t type;
+		uint32_t len;		/* bytes; cells for DTIDX_T_CELLS */
+		uint32_t ncells;
+		const char *str;
+		const uint32_t *cells;
+		const uint8_t *bytes;
+	};
+
+	int open(const char *path)
+	{
+		int ret = map_.open(path);
+
+		return ret ? ret : attach();
+	}
+
+	/*
+	 * Open the index for @blob_path at @idx_path, rebuilding it first if
+	 * it is missing or stale.  @rebuilt reports whether it was.
+	 */
+	int open_for(const char *blob_path, const char *idx_path, bool *rebuilt)
+	{
+		struct stat st;
+		uint64_t mtime;
+		int ret;
+
+		*rebuilt = false;
+		if (stat(blob_path, &st))
+			return -errno;
+		mtime = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+		if (!open(idx_path) && hdr_->src_size == (uint64_t)st.st_size) {
+			if (hdr_->src_mtime_ns == mtime)
+				return 0;
+			/* Touched but maybe not changed: compare contents */
+			mapped_file m;
+
+			if (!m.open(blob_path) &&
+			    fnv1a64(m.data(), m.size()) == hdr_->src_hash)
+				return 0;
+		}
+
+		file f;
+
+		ret = f.open(blob_path);
+		if (ret)
+			return ret;
+		ret = dtidx_write(f.index(), mtime, idx_path);
+		if (ret)
+			return ret;
+		*rebuilt = true;
+		return open(idx_path);
+	}
+
+	uint32_t nodes() const { return hdr_->nodes; }
+	uint32_t props() const { return hdr_->props; }
+	uint32_t names() const { return hdr_->names; }
+	uint32_t compats() const { return hdr_->compats; }
+	uint64_t src_hash() const { return hdr_->src_hash; }
+
+	const char *node_name(uint32_t id) const { return str(col(DTIDX_NODE_NAME)[id]); }
+	uint32_t parent(uint32_t id) const { return col(DTIDX_NODE_PARENT)[id]; }
+	uint32_t phandle(uint32_t id) const { return col(DTIDX_NODE_PHANDLE)[id]; }
+	uint32_t subtree_end(uint32_t id) const { return col(DTIDX_NODE_SKIP)[id]; }
+
+	/* Property rows of @id are [prop_begin, prop_end) */
+	uint32_t prop_begin(uint32_t id) const { return col(DTIDX_NODE_PROPS)[id]; }
+	uint32_t prop_end(uint32_t id) const { return col(DTIDX_NODE_PROPS)[id + 1]; }
+	uint32_t prop_node(uint32_t row) const { return col(DTIDX_PROP_NODE)[row]; }
+	const char *prop_name(uint32_t row) const
+	{
+		return name_str(col(DTIDX_PROP_NAME)[row]);
+	}
+
+	const char *name_str(uint32_t nid) const { return str(col(DTIDX_NAME_STR)[nid]); }
+
+	value prop_value(uint32_t row) const
+	{
+		value v = { types_[row], col(DTIDX_PROP_LEN)[row], 0, nullptr,
+			    nullptr, nullptr };
+		uint32_t off = col(DTIDX_PROP_VAL)[row];
+		uint32_t alt = col(DTIDX_PROP_ALT)[row];
+
+		switch (v.type) {
+		case DTIDX_T_STRING:
+			v.str = str(off);
+			if (alt != DT_NONE) {
+				v.cells = col(DTIDX_CELLS) + alt;
+				v.ncells = v.len / 4;
+			}
+			break;
+		case DTIDX_T_CELLS:
+			v.cells = col(DTIDX_CELLS) + off;
+			v.ncells = v.len;
+			break;
+		case DTIDX_T_BYTES:
+			v.bytes = base() + hdr_->sec[DTIDX_BYTES].off + off;
+			break;
+		}
+		return v;
+	}
+
+	/* Interned id of a property name, DT_NONE if no node has it */
+	uint32_t name_id(const char *name) const
+	{
+		return bisect(col(DTIDX_NAME_STR), hdr_->names, name);
+	}
+
+	/* Row of property @nid on node @id, DT_NONE if absent */
+	uint32_t find_prop(uint32_t id, uint32_t nid) const
+	{
+		const uint32_t *names = col(DTIDX_PROP_NAME);
+
+		for (uint32_t r = prop_begin(id); r < prop_end(id); r++)
+			if (names[r] == nid)
+				return r;
+		return DT_NONE;
+	}
+
+	uint32_t find_prop(uint32_t id, const char *name) const
+	{
+		uint32_t nid = name_id(name);
+
+		return nid == DT_NONE ? DT_NONE : find_prop(id, nid);
+	}
+
+	/* Property rows named @nid, in node order */
+	const uint32_t *rows_named(uint32_t nid, uint32_t *count) const
+	{
+		const uint32_t *post = col(DTIDX_NAME_POST);
+
+		*count = post[nid + 1] - post[nid];
+		return col(DTIDX_NAME_PROPS) + post[nid];
+	}
+
+	/* Nodes listing @compat in their compatible property, in node order */
+	const uint32_t *compatible(const char *compat, uint32_t *count) const
+	{
+		uint32_t c = bisect(col(DTIDX_COMPAT_STR), hdr_->compats, compat);
+		const uint32_t *post = col(DTIDX_COMPAT_POST);
+
+		if (c == DT_NONE) {
+			*count = 0;
+			return nullptr;
+		}
+		*count = post[c + 1] - post[c];
+		return col(DTIDX_COMPAT_NODES) + post[c];
+	}
+
+	/* Walk the trie; a component without '@' matches the first "name@..." */
+	uint32_t find(const char *path) const
+	{
+		uint32_t id = 0;
+
+		if (*path != '/')
+			return DT_NONE;
+		while (id != DT_NONE) {
+			const char *e;
+
+			while (*path == '/')
+				path++;
+			if (!*path)
+				break;
+			e = strchrnul(path, '/');
+			id = child(id, std::string_view(path, e - path));
+			path = e;
+		}
+		return id;
+	}
+
+	uint32_t child(uint32_t id, std::string_view name) const
+	{
+		char key[256];
+		uint32_t c = child_lb(id, name, false);
+
+		if (c != DT_NONE || name.find('@') != std::string_view::npos ||
+		    name.size() + 1 >= sizeof(key))
+			return c;
+		memcpy(key, name.data(), name.size());
+		key[name.size()] = '@';
+		return child_lb(id, std::string_view(key, name.size() + 1), true);
+	}
+
+	void path(uint32_t id, std::string *out) const
+	{
+		uint32_t chain[64];
+		int n = 0;
+
+		out->clear();
+		for (; id && id != DT_NONE && n < 64; id = parent(id))
+			chain[n++] = id;
+		if (!n)
+			out->push_back('/');
+		while (n--) {
+			out->push_back('/');
+			out->append(node_name(chain[n]));
+		}
+	}
+
+private:
+	int attach()
+	{
+		size_t size = map_.size();
+
+		hdr_ = reinterpret_cast<const dtidx_header *>(map_.data());
+		if (size < sizeof(*hdr_) || memcmp(hdr_->magic, DTIDX_MAGIC, 8) ||
+		    hdr_->version != DTIDX_VERSION || hdr_->endian != DTIDX_ENDIAN)
+			return -EINVAL;
+		for (int s = 0; s < DTIDX_NR_SECTIONS; s++)
+			if (hdr_->sec[s].off > size ||
+			    hdr_->sec[s].size > size - hdr_->sec[s].off ||
+			    (hdr_->sec[s].off & 7))
+				return -EINVAL;
+		if (!hdr_->nodes)
+			return -EINVAL;
+		for (int s = 0; s < DTIDX_NR_SECTIONS; s++) {
+			uint64_t want = sec_size(s);
+
+			if (want != DTIDX_ANY && hdr_->sec[s].size != want)
+				return -EINVAL;
+		}
+		if (hdr_->sec[DTIDX_CELLS].size & 3)
+			return -EINVAL;
+		/* The posting lists must end where their sections do */
+		if (col(DTIDX_NODE_PROPS)[hdr_->nodes] != hdr_->props ||
+		    col(DTIDX_NODE_CHILDREN)[hdr_->nodes] != hdr_->nodes - 1 ||
+		    col(DTIDX_NAME_POST)[hdr_->names] != hdr_->props ||
+		    col(DTIDX_COMPAT_POST)[hdr_->compats] * 4ull !=
+		    hdr_->sec[DTIDX_COMPAT_NODES].size)
+			return -EINVAL;
+		types_ = base() + hdr_->sec[DTIDX_PROP_TYPE].off;
+		return check_values();
+	}
+
+	/* Every value offset must land inside its pool, strings NUL-ended */
+	int check_values() const
+	{
+		uint64_t pool = hdr_->sec[DTIDX_STRPOOL].size;
+		uint64_t cells = hdr_->sec[DTIDX_CELLS].size / 4;
+		uint64_t bytes = hdr_->sec[DTIDX_BYTES].size;
+		const uint32_t *val = col(DTIDX_PROP_VAL), *len = col(DTIDX_PROP_LEN);
+		const uint32_t *alt = col(DTIDX_PROP_ALT);
+
+		if (pool && str(0)[pool - 1])
+			return -EINVAL;
+		for (uint32_t i = 0; i < hdr_->nodes; i++)
+			if (col(DTIDX_NODE_NAME)[i] >= pool)
+				return -EINVAL;
+		for (uint32_t i = 0; i < hdr_->names; i++)
+			if (col(DTIDX_NAME_STR)[i] >= pool)
+				return -EINVAL;
+		for (uint32_t i = 0; i < hdr_->compats; i++)
+			if (col(DTIDX_COMPAT_STR)[i] >= pool)
+				return -EINVAL;
+		for (uint32_t r = 0; r < hdr_->props; r++) {
+			uint64_t end = (uint64_t)val[r] + len[r];
+
+			switch (types_[r]) {
+			case DTIDX_T_EMPTY:
+				break;
+			case DTIDX_T_STRING:
+				if (!len[r] || end > pool ||
+				    (alt[r] != DT_NONE && alt[r] + (uint64_t)len[r] / 4 > cells))
+					return -EINVAL;
+				break;
+			case DTIDX_T_CELLS:
+				if (end > cells)
+					return -EINVAL;
+				break;
+			case DTIDX_T_BYTES:
+				if (end > bytes)
+					return -EINVAL;
+				break;
+			default:
+				return -EINVAL;
+			}
+		}
+		return 0;
+	}
+
+	/* Expected size of section @s from the header counts */
+	uint64_t sec_size(int s) const
+	{
+		uint64_t nodes = hdr_->nodes, props = hdr_->props;
+
+		switch (s) {
+		case DTIDX_NODE_PARENT:
+		case DTIDX_NODE_NAME:
+		case DTIDX_NODE_SKIP:
+		case DTIDX_NODE_PHANDLE:
+			return nodes * 4;
+		case DTIDX_NODE_PROPS:
+		case DTIDX_NODE_CHILDREN:
+			return (nodes + 1) * 4;
+		case DTIDX_CHILD_IDS:
+			return (nodes - 1) * 4;
+		case DTIDX_PROP_TYPE:
+			return props;
+		case DTIDX_PROP_NODE:
+		case DTIDX_PROP_NAME:
+		case DTIDX_PROP_VAL:
+		case DTIDX_PROP_LEN:
+		case DTIDX_PROP_ALT:
+		case DTIDX_NAME_PROPS:
+			return props * 4;
+		case DTIDX_NAME_STR:
+			return hdr_->names * 4ull;
+		case DTIDX_NAME_POST:
+			return (hdr_->names + 1ull) * 4;
+		case DTIDX_COMPAT_STR:
+			return hdr_->compats * 4ull;
+		case DTIDX_COMPAT_POST:
+			return (hdr_->compats + 1ull) * 4;
+		default:
+			return DTIDX_ANY;
+		}
+	}
+
+	const uint8_t *base() const { return map_.data(); }
+
+	const uint32_t *col(int s) const
+	{
+		return reinterpret_cast<const uint32_t *>(base() + hdr_->sec[s].off);
+	}
+
+	const char *str(uint32_t off) const
+	{
+		return reinterpret_cast<const char *>(base() +
+						      hdr_->sec[DTIDX_STRPOOL].off + off);
+	}
+
+	/* Bisect the sorted children of @id for @name (or a name it prefixes) */
+	uint32_t child_lb(uint32_t id, std::string_view name, bool prefix) const
+	{
+		const uint32_t *ids = col(DTIDX_CHILD_IDS);
+		const uint32_t *b = ids + col(DTIDX_NODE_CHILDREN)[id];
+		const uint32_t *e = ids + col(DTIDX_NODE_CHILDREN)[id + 1];
+		const uint32_t *it = std::lower_bound(b, e, name, [&](uint32_t c,
+								       std::string_view n) {
+			return std::string_view(node_name(c)) < n;
+		});
+		std::string_view hit;
+
+		if (it == e)
+			return DT_NONE;
+		hit = node_name(*it);
+		if (prefix ? !hit.compare(0, name.size(), name) : hit == name)
+			return *it;
+		return DT_NONE;
+	}
+
+	uint32_t bisect(const uint32_t *offs, uint32_t n, const char *key) const
+	{
+		uint32_t lo = 0, hi = n;
+
+		while (lo < hi) {
+			uint32_t mid = (lo + hi) / 2;
+			int c = strcmp(str(offs[mid]), key);
+
+			if (!c)
+				return mid;
+			if (c < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return DT_NONE;
+	}
+
+	mapped_file map_;
+	const dtidx_header *hdr_ = nullptr;
+	const uint8_t *types_ = nullptr;
+};
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_DTINDEX_H__ */
@@ -0,0 +1,681 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Zero-copy flattened device tree reader.
+ *
+ * The blob is mapped read-only and walked in place: node names, property
+ * names and property values are returned as pointers into the mapping, so
+ * iterating a node never allocates.  A one-shot dt::tree index records the
+ * preorder layout of the structure block (parent, subtree end, phandle) to
+ * give O(1) phandle lookup, parent lookup and sibling skipping.
+ *
+ * All fallible entry points return 0 or a negative errno.
+ */
+
+#ifndef __TOOLS_DT_FDT_H__
+#define __TOOLS_DT_FDT_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../lib/mapped_file.h"
+
+#define FDT_MAGIC		0xd00dfeed
+#define FDT_BEGIN_NODE		0x1
+#define FDT_END_NODE		0x2
+#define FDT_PROP		0x3
+#define FDT_NOP			0x4
+#define FDT_END			0x9
+
+#define FDT_HEADER_SIZE		40
+#define FDT_FIRST_SUPPORTED	16
+#define FDT_LAST_SUPPORTED	17
+
+/* Sentinel for "no node" in index-based APIs */
+#define DT_NONE			0xffffffffu
+
+namespace dt {
+
+static inline uint32_t be32(const void *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return __builtin_bswap32(v);
+}
+
+static inline uint64_t be64(const void *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return __builtin_bswap64(v);
+}
+
+static inline void put_be32(void *p, uint32_t v)
+{
+	v = __builtin_bswap32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t fdt_align(uint32_t off)
+{
+	return (off + 3) & ~3u;
+}
+
+using lib::mapped_file;
+
+/*
+ * A property value as it sits in the structure block.  Cell accessors do
+ * not bounds check beyond the property length; callers use cells().
+ */
+struct property {
+	const char *name = nullptr;
+	const uint8_t *data = nullptr;
+	uint32_t len = 0;
+
+	uint32_t cells() const { return len / 4; }
+	uint32_t u32(uint32_t i = 0) const { return be32(data + i * 4); }
+	uint64_t u64(uint32_t i = 0) const { return be64(data + i * 4); }
+
+	/* Read @n cells starting at cell @i as one number (n = 1 or 2) */
+	uint64_t cell_val(uint32_t i, uint32_t n) const
+	{
+		return n == 2 ? u64(i) : (n == 1 ? u32(i) : 0);
+	}
+
+	bool is_string() const
+	{
+		return len && data[len - 1] == '\0' && data[0];
+	}
+
+	const char *str() const
+	{
+		return is_string() ? reinterpret_cast<const char *>(data) : "";
+	}
+
+	bool eq(const char *s) const { return !strcmp(name, s); }
+
+	/* Whether @s is one of the entries of a string-list value */
+	bool has_string(const char *s) const
+	{
+		size_t sl = strlen(s) + 1;
+		uint32_t off = 0;
+
+		while (off < len) {
+			const char *p = reinterpret_cast<const char *>(data + off);
+			size_t l = strnlen(p, len - off) + 1;
+
+			if (l == sl && !memcmp(p, s, sl))
+				return true;
+			off += l;
+		}
+		return false;
+	}
+
+	/* Walk a string-list value: for (const char *s : p.strings()) */
+	struct string_iter {
+		const char *p, *end;
+
+		const char *operator*() const { return p; }
+		bool operator!=(const string_iter &o) const { return p != o.p; }
+		string_iter &operator++()
+		{
+			p += strnlen(p, end - p) + 1;
+			if (p > end)
+				p = end;
+			return *this;
+		}
+	};
+	struct string_range {
+		const char *b, *e;
+
+		string_iter begin() const { return { b, e }; }
+		string_iter end() const { return { e, e }; }
+	};
+	string_range strings() const
+	{
+		const char *b = reinterpret_cast<const char *>(data);
+
+		return { b, b + len };
+	}
+};
+
+/*
+ * Non-owning view of a validated FDT.  Offsets handed out by the view are
+ * relative to the start of the structure block.
+ */
+class fdt {
+public:
+	fdt() = default;
+
+	int init(const void *blob, size_t size)
+	{
+		const uint8_t *b = static_cast<const uint8_t *>(blob);
+		uint32_t tot, off_struct, off_strings, sz_struct, sz_strings;
+
+		if (size < FDT_HEADER_SIZE || be32(b) != FDT_MAGIC)
+			return -EINVAL;
+		tot = be32(b + 4);
+		off_struct = be32(b + 8);
+		off_strings = be32(b + 12);
+		version_ = be32(b + 20);
+		if (be32(b + 24) > FDT_LAST_SUPPORTED ||
+		    version_ < FDT_FIRST_SUPPORTED)
+			return -EPROTONOSUPPORT;
+		sz_strings = be32(b + 32);
+		/*
+		 * v16 has no size_dt_struct: bound the block by whatever
+		 * follows it, and the walk stops at FDT_END.
+		 */
+		if (version_ >= 17)
+			sz_struct = be32(b + 36);
+		else if (off_struct > tot)
+			return -EINVAL;
+		else
+			sz_struct = ((off_strings > off_struct ? off_strings : tot) -
+				     off_struct) & ~3u;
+		if (tot > size || off_struct > tot || sz_struct > tot - off_struct ||
+		    off_strings > tot || sz_strings > tot - off_strings ||
+		    (off_struct & 3) || (sz_struct & 3))
+			return -EINVAL;
+
+		base_ = b;
+		size_ = tot;
+		st_ = b + off_struct;
+		st_size_ = sz_struct;
+		str_ = reinterpret_cast<const char *>(b + off_strings);
+		str_size_ = sz_strings;
+		return 0;
+	}
+
+	const uint8_t *base() const { return base_; }
+	uint32_t size() const { return size_; }
+	uint32_t version() const { return version_; }
+	uint32_t boot_cpuid() const { return be32(base_ + 28); }
+	uint32_t struct_size() const { return st_size_; }
+	uint32_t strings_size() const { return str_size_; }
+	const char *strings() const { return str_; }
+
+	uint32_t tag(uint32_t off) const
+	{
+		return off < st_size_ && st_size_ - off >= 4 ?
+			be32(st_ + off) : FDT_END;
+	}
+
+	/* Name of the node whose FDT_BEGIN_NODE token is at @off */
+	const char *node_name(uint32_t off) const
+	{
+		return reinterpret_cast<const char *>(st_ + off + 4);
+	}
+
+	/* Offset of the first token after the name of node @off */
+	uint32_t node_body(uint32_t off) const
+	{
+		const char *n = node_name(off);
+
+		return fdt_align(off + 4 + strnlen(n, st_size_ - off - 4) + 1);
+	}
+
+	/* Decode the FDT_PROP token at @off; returns the next token offset */
+	uint32_t read_prop(uint32_t off, property *p) const
+	{
+		uint32_t len, nameoff;
+
+		if (st_size_ - off < 12)
+			return st_size_ + 4;
+		len = be32(st_ + off + 4);
+		nameoff = be32(st_ + off + 8);
+		p->name = nameoff < str_size_ ? str_ + nameoff : "";
+		p->data = st_ + off + 12;
+		/* Truncated values end the walk: callers see off > struct_size() */
+		if (len > st_size_ - off - 12) {
+			p->len = 0;
+			return st_size_ + 4;
+		}
+		p->len = len;
+		return fdt_align(off + 12 + len);
+	}
+
+	/* Skip NOPs starting at @off */
+	uint32_t skip_nops(uint32_t off) const
+	{
+		while (tag(off) == FDT_NOP)
+			off += 4;
+		return off;
+	}
+
+	/*
+	 * Offset just past the FDT_END_NODE of the node at @off; linear in
+	 * the subtree size.  dt::tree caches this.
+	 */
+	uint32_t subtree_end(uint32_t off) const
+	{
+		int depth = 0;
+		property p;
+
+		for (;;) {
+			switch (tag(off)) {
+			case FDT_BEGIN_NODE:
+				depth++;
+				off = node_body(off);
+				break;
+			case FDT_END_NODE:
+				off += 4;
+				if (--depth == 0)
+					return off;
+				break;
+			case FDT_PROP:
+				off = read_prop(off, &p);
+				break;
+			case FDT_NOP:
+				off += 4;
+				break;
+			default:
+				return st_size_;
+			}
+		}
+	}
+
+	/*
+	 * Single linear pass over the structure block.  @v provides
+	 * begin(off, name, depth), prop(const property &) and end(depth);
+	 * begin() returning false skips the node's subtree.
+	 * Returns 0 or -EINVAL on a malformed block.
+	 */
+	template <typename V>
+	int walk(V &v) const
+	{
+		uint32_t off = skip_nops(0), skip_depth = 0;
+		int depth = 0;
+		property p;
+
+		for (;;) {
+			uint32_t t = tag(off);
+
+			switch (t) {
+			case FDT_BEGIN_NODE:
+				if (!skip_depth &&
+				    !v.begin(off, node_name(off), depth))
+					skip_depth = depth + 1;
+				depth++;
+				off = node_body(off);
+				break;
+			case FDT_END_NODE:
+				if (--depth < 0)
+					return -EINVAL;
+				if (skip_depth == (uint32_t)depth + 1)
+					skip_depth = 0;
+				else if (!skip_depth)
+					v.end(depth);
+				off += 4;
+				if (!depth)
+					return 0;
+				break;
+			case FDT_PROP:
+				off = read_prop(off, &p);
+				if (off > st_size_)
+					return -EINVAL;
+				if (!skip_depth)
+					v.prop(p);
+				break;
+			case FDT_NOP:
+				off += 4;
+				break;
+			case FDT_END:
+				return depth ? -EINVAL : 0;
+			default:
+				return -EINVAL;
+			}
+		}
+	}
+
+private:
+	const uint8_t *base_ = nullptr;
+	const uint8_t *st_ = nullptr;
+	const char *str_ = nullptr;
+	uint32_t size_ = 0, st_size_ = 0, str_size_ = 0, version_ = 0;
+};
+
+/*
+ * Iterate the properties of the node at @off without allocating:
+ * for (const dt::property &p : dt::prop_range(f, off))
+ */
+class prop_iter {
+public:
+	prop_iter(const fdt *f, uint32_t off) : f_(f), off_(off) { load(); }
+
+	const property &operator*() const { return p_; }
+	const property *operator->() const { return &p_; }
+	bool operator!=(const prop_iter &o) const { return off_ != o.off_; }
+	prop_iter &operator++()
+	{
+		off_ = next_;
+		load();
+		return *this;
+	}
+
+private:
+	void load()
+	{
+		off_ = f_->skip_nops(off_);
+		if (f_->tag(off_) != FDT_PROP) {
+			off_ = DT_NONE;
+			return;
+		}
+		next_ = f_->read_prop(off_, &p_);
+	}
+
+	const fdt *f_;
+	uint32_t off_, next_ = 0;
+	property p_;
+};
+
+struct prop_range {
+	const fdt *f;
+	uint32_t node_off;
+
+	prop_range(const fdt &t, uint32_t off) : f(&t), node_off(off) {}
+	prop_iter begin() const { return prop_iter(f, f->node_body(node_off)); }
+	prop_iter end() const { return prop_iter(f, DT_NONE); }
+};
+
+/*
+ * Preorder index of every node in the structure block.  Node ids are
+ * preorder positions, so a node's subtree is the id range [id, skip).
+ */
+class tree {
+public:
+	struct node_rec {
+		uint32_t off;		/* FDT_BEGIN_NODE offset */
+		uint32_t parent;	/* parent id, DT_NONE for the root */
+		uint32_t skip;		/* first id after this subtree */
+		uint32_t phandle;	/* 0 if none */
+		uint16_t depth;
+		uint16_t nprops;
+	};
+
+	int build(const fdt &f)
+	{
+		builder b(this);
+		int ret;
+
+		f_ = &f;
+		nodes_.clear();
+		by_phandle_.clear();
+		sparse_.clear();
+		max_phandle_ = 0;
+		ret = f.walk(b);
+		if (ret)
+			return ret;
+		if (b.too_deep)
+			return -E2BIG;
+		if (nodes_.empty())
+			return -EINVAL;
+		index_phandles();
+		return 0;
+	}
+
+	const fdt &blob() const { return *f_; }
+	uint32_t size() const { return (uint32_t)nodes_.size(); }
+	const node_rec &rec(uint32_t id) const { return nodes_[id]; }
+	uint32_t max_phandle() const { return max_phandle_; }
+
+	const char *name(uint32_t id) const
+	{
+		return f_->node_name(nodes_[id].off);
+	}
+
+	prop_range props(uint32_t id) const
+	{
+		return prop_range(*f_, nodes_[id].off);
+	}
+
+	/* O(1) phandle to node id, DT_NONE if unknown */
+	uint32_t by_phandle(uint32_t ph) const
+	{
+		if (ph < by_phandle_.size())
+			return by_phandle_[ph];
+		if (!sparse_.empty()) {
+			auto it = sparse_.find(ph);
+
+			if (it != sparse_.end())
+				return it->second;
+		}
+		return DT_NONE;
+	}
+
+	/* Children: for (uint32_t c = first_child(id); c != DT_NONE; c = next_sibling(c)) */
+	uint32_t first_child(uint32_t id) const
+	{
+		return id + 1 < nodes_[id].skip ? id + 1 : DT_NONE;
+	}
+
+	uint32_t next_sibling(uint32_t id) const
+	{
+		uint32_t p = nodes_[id].parent, n = nodes_[id].skip;
+
+		return p != DT_NONE && n < nodes_[p].skip ? n : DT_NONE;
+	}
+
+	bool find_prop(uint32_t id, const char *pname, property *out) const
+	{
+		for (const property &p : props(id)) {
+			if (p.eq(pname)) {
+				*out = p;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint32_t prop_u32(uint32_t id, const char *pname, uint32_t def) const
+	{
+		property p;
+
+		return find_prop(id, pname, &p) && p.len >= 4 ? p.u32() : def;
+	}
+
+	bool is_compatible(uint32_t id, const char *compat) const
+	{
+		property p;
+
+		return find_prop(id, "compatible", &p) && p.has_string(compat);
+	}
+
+	/*
+	 * Look up a child by name.  As in libfdt, "foo" matches "foo@1000"
+	 * when the caller gives no unit address.
+	 */
+	uint32_t child(uint32_t id, const char *cname, size_t len) const
+	{
+		for (uint32_t c = first_child(id); c != DT_NONE; c = next_sibling(c)) {
+			const char *n = name(c);
+
+			if (!strncmp(n, cname, len) &&
+			    (n[len] == '\0' ||
+			     (n[len] == '@' && !memchr(cname, '@', len))))
+				return c;
+		}
+		return DT_NONE;
+	}
+
+	/* Resolve an absolute path, "/" being the root */
+	uint32_t find(const char *path) const
+	{
+		uint32_t id = 0;
+
+		if (*path != '/')
+			return DT_NONE;
+		while (*path && id != DT_NONE) {
+			const char *e;
+
+			while (*path == '/')
+				path++;
+			if (!*path)
+				break;
+			e = strchrnul(path, '/');
+			id = child(id, path, e - path);
+			path = e;
+		}
+		return id;
+	}
+
+	void path(uint32_t id, std::string *out) const
+	{
+		uint32_t chain[64];
+		int n = 0;
+
+		out->clear();
+		for (; id != DT_NONE && id && n < 64; id = nodes_[id].parent)
+			chain[n++] = id;
+		if (!n) {
+			*out = "/";
+			return;
+		}
+		while (n--) {
+			out->push_back('/');
+			out->append(name(chain[n]));
+		}
+	}
+
+	std::string path(uint32_t id) const
+	{
+		std::string s;
+
+		path(id, &s);
+		return s;
+	}
+
+	/*
+	 * Effective #address-cells/#size-cells used to decode @id's "reg":
+	 * those of its parent, with the DT spec defaults of 2 and 1.
+	 */
+	void reg_cells(uint32_t id, uint32_t *ac, uint32_t *sc) const
+	{
+		uint32_t p = nodes_[id].parent;
+
+		*ac = p == DT_NONE ? 2 : prop_u32(p, "#address-cells", 2);
+		*sc = p == DT_NONE ? 1 : prop_u32(p, "#size-cells", 1);
+	}
+
+private:
+	struct builder {
+		tree *t;
+		uint32_t stack[64];
+		uint32_t cur = DT_NONE;
+		bool too_deep = false;
+
+		explicit builder(tree *tr) : t(tr) {}
+
+		bool begin(uint32_t off, const char *, int depth)
+		{
+			node_rec r = { off, cur, 0, 0, (uint16_t)depth, 0 };
+
+			if (depth >= 64) {
+				too_deep = true;
+				return false;
+			}
+			stack[depth] = (uint32_t)t->nodes_.size();
+			cur = stack[depth];
+			t->nodes_.push_back(r);
+			return true;
+		}
+
+		void prop(const property &p)
+		{
+			node_rec &r = t->nodes_[cur];
+
+			r.nprops++;
+			if (p.len == 4 && (p.eq("phandle") || p.eq("linux,phandle")))
+				r.phandle = p.u32();
+		}
+
+		void end(int depth)
+		{
+			t->nodes_[stack[depth]].skip = (uint32_t)t->nodes_.size();
+			cur = t->nodes_[stack[depth]].parent;
+		}
+	};
+
+	void index_phandles()
+	{
+		uint32_t count = 0;
+
+		for (const node_rec &r : nodes_) {
+			if (r.phandle && r.phandle != DT_NONE) {
+				count++;
+				if (r.phandle > max_phandle_)
+					max_phandle_ = r.phandle;
+			}
+		}
+		/* dtc allocates phandles densely from 1; fall back to a hash otherwise */
+		bool dense = max_phandle_ <= 4 * count + 64;
+
+		if (dense)
+			by_phandle_.assign(max_phandle_ + 1, DT_NONE);
+		for (uint32_t i = 0; i < nodes_.size(); i++) {
+			uint32_t ph = nodes_[i].phandle;
+
+			if (!ph || ph == DT_NONE)
+				continue;
+			if (dense)
+				by_phandle_[ph] = i;
+			else
+				sparse_.emplace(ph, i);
+		}
+	}
+
+	const fdt *f_ = nullptr;
+	std::vector<node_rec> nodes_;
+	std::vector<uint32_t> by_phandle_;
+	std::unordered_map<uint32_t, uint32_t> sparse_;
+	uint32_t max_phandle_ = 0;
+};
+
+/*
+ * Convenience owner of a mapped blob plus its view and index.
+ */
+class file {
+public:
+	int open(const char *path)
+	{
+		int ret = map_.open(path);
+
+		if (ret)
+			return ret;
+		ret = fdt_.init(map_.data(), map_.size());
+		if (ret)
+			return ret;
+		return tree_.build(fdt_);
+	}
+
+	/* Index a blob embedded in a larger mapping (e.g. a dtbo.img entry) */
+	int open_mem(const void *blob, size_t size)
+	{
+		int ret = fdt_.init(blob, size);
+
+		return ret ? ret : tree_.build(fdt_);
+	}
+
+	const fdt &blob() const { return fdt_; }
+	const tree &index() const { return tree_; }
+
+	file() = default;
+	file(const file &) = delete;
+	file &operator=(const file &) = delete;
+
+private:
+	mapped_file map_;
+	fdt fdt_;
+	tree tree_;
+};
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_FDT_H__ */
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Time dt::fdt against a "dtc -I dtb" decompile of the same blob.
+ *
+ * Build: g++ -std=c++17 -O2 -o fdt_bench fdt_bench.cpp
+ * Usage: fdt_bench <blob.dtb> [iterations]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fdt.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static volatile uint64_t bench_sink;
+
+struct counter {
+	uint32_t nodes = 0, props = 0;
+	uint64_t bytes = 0;
+
+	bool begin(uint32_t, const char *, int) { nodes++; return true; }
+	void prop(const dt::property &p) { props++; bytes += p.len; }
+	void end(int) {}
+};
+
+/* Run dtc once and return its wall time, or a negative value if absent */
+static double time_dtc(const char *path)
+{
+	double t0;
+	pid_t pid;
+	int st;
+
+	t0 = now_us();
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (!pid) {
+		int fd = open("/dev/null", O_WRONLY);
+
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execlp("dtc", "dtc", "-q", "-I", "dtb", "-O", "dts", "-o", "/dev/null", path,
+		       (char *)NULL);
+		_exit(127);
+	}
+	if (waitpid(pid, &st, 0) < 0 || !WIFEXITED(st) || WEXITSTATUS(st))
+		return -1;
+	return now_us() - t0;
+}
+
+/*
+ * Properties whose first cell is a phandle: the single references and
+ * the leading phandle of the common specifier lists.
+ */
+static bool phandle_first(const char *name)
+{
+	static const char *const names[] = {
+		"interrupt-parent", "clocks", "resets", "power-domains", "iommus",
+		"phys", "dmas", "interconnects", "mboxes", "pinctrl-0", "pinctrl-1",
+		"thermal-sensors", "cooling-device", "memory-region", "qcom,smem-states",
+	};
+
+	for (const char *n : names)
+		if (!strcmp(name, n))
+			return true;
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	int iters = argc > 2 ? atoi(argv[2]) : 200;
+	const char *path;
+	double t0, t_open, t_walk, t_iter, t_ph, t_find, t_dtc;
+	uint64_t sink = 0;
+	dt::file f;
+	counter c;
+	int ret;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <blob.dtb> [iterations]\n", argv[0]);
+		return 1;
+	}
+	path = argv[1];
+	if (iters <= 0)
+		iters = 1;
+
+	t0 = now_us();
+	for (int i = 0; i < iters; i++) {
+		dt::file g;
+
+		ret = g.open(path);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+			return 1;
+		}
+		sink += g.index().size();
+	}
+	t_open = (now_us() - t0) / iters;
+
+	ret = f.open(path);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return 1;
+	}
+	const dt::tree &t = f.index();
+
+	/* Linear pass straight over the structure block */
+	t0 = now_us();
+	for (int i = 0; i < iters; i++) {
+		c = counter();
+		f.blob().walk(c);
+		sink += c.bytes;
+	}
+	t_walk = (now_us() - t0) / iters;
+
+	/* Same walk through the index and the allocation-free iterators */
+	t0 = now_us();
+	for (int i = 0; i < iters; i++) {
+		for (uint32_t id = 0; id < t.size(); id++)
+			for (const dt::property &p : t.props(id))
+				sink += p.len;
+	}
+	t_iter = (now_us() - t0) / iters;
+
+	/* Resolve the phandle references the properties make */
+	std::vector<uint32_t> phs;
+
+	for (uint32_t id = 0; id < t.size(); id++)
+		for (const dt::property &q : t.props(id))
+			if (q.len >= 4 && phandle_first(q.name) && q.u32())
+				phs.push_back(q.u32());
+	t0 = now_us();
+	for (int i = 0; i < iters; i++)
+		for (uint32_t ph : phs)
+			sink += t.by_phandle(ph);
+	t_ph = (now_us() - t0) / iters / (phs.empty() ? 1 : phs.size());
+
+	/* Path lookup plus a named property fetch on every node */
+	std::vector<std::string> paths;
+	dt::property p;
+
+	for (uint32_t id = 0; id < t.size(); id++)
+		paths.push_back(t.path(id));
+	t0 = now_us();
+	for (const std::string &s : paths) {
+		uint32_t id = t.find(s.c_str());
+
+		if (id != DT_NONE && t.find_prop(id, "compatible", &p))
+			sink += p.len;
+	}
+	t_find = (now_us() - t0) / paths.size();
+
+	t_dtc = time_dtc(path);
+
+	printf("blob:            %s (%u bytes, %u nodes, %u props, %u string bytes)\n",
+	       path, f.blob().size(), c.nodes, c.props, f.blob().strings_size());
+	printf("map+index:       %10.1f us\n", t_open);
+	printf("raw walk:        %10.1f us\n", t_walk);
+	printf("indexed walk:    %10.1f us\n", t_iter);
+	printf("phandle lookup:  %10.3f us/lookup (%zu references)\n", t_ph,
+	       phs.size());
+	printf("path+prop find:  %10.3f us/lookup\n", t_find);
+	if (t_dtc >= 0)
+		printf("dtc decompile:   %10.1f us (%.0fx map+index+walk)\n", t_dtc,
+		       t_dtc / (t_open + t_walk));
+	else
+		printf("dtc decompile:   n/a (dtc not found)\n");
+	bench_sink = sink;
+	return 0;
+}
@@ -0,0 +1,246 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Mutable device tree built on top of an indexed blob, and an FDT writer.
+ *
+ * Names and values keep pointing at their source blob (or at any other
+ * buffer that outlives the mtree), so loading a tree copies no property
+ * data.  Only structure - the node and property vectors - is allocated.
+ */
+
+#ifndef __TOOLS_DT_MTREE_H__
+#define __TOOLS_DT_MTREE_H__
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "fdt.h"
+
+namespace dt {
+
+/* Source tag of a property that came from the base blob */
+#define MPROP_BASE	(-1)
+
+struct mprop {
+	const char *name;
+	const uint8_t *data;
+	uint32_t len;
+	int src;
+};
+
+struct mnode {
+	const char *name;
+	mnode *parent = nullptr;
+	std::vector<mprop> props;
+	std::vector<std::unique_ptr<mnode>> children;
+
+	mprop *prop(const char *pname)
+	{
+		for (mprop &p : props)
+			if (!strcmp(p.name, pname))
+				return &p;
+		return nullptr;
+	}
+
+	/*
+	 * Exact-name child lookup.  Wide nodes (/soc has hundreds of
+	 * children) get a hash index on first use.
+	 */
+	mnode *child(std::string_view cname)
+	{
+		if (children.size() < 16) {
+			for (auto &c : children)
+				if (cname == c->name)
+					return c.get();
+			return nullptr;
+		}
+		if (idx_.size() != children.size()) {
+			idx_.clear();
+			for (auto &c : children)
+				idx_.emplace(c->name, c.get());
+		}
+		auto it = idx_.find(cname);
+
+		return it == idx_.end() ? nullptr : it->second;
+	}
+
+	mnode *add_child(const char *cname)
+	{
+		children.emplace_back(new mnode);
+		mnode *c = children.back().get();
+
+		c->name = cname;
+		c->parent = this;
+		if (!idx_.empty())
+			idx_.emplace(cname, c);
+		return c;
+	}
+
+	void path(std::string *out) const
+	{
+		const mnode *chain[64];
+		int n = 0;
+
+		out->clear();
+		for (const mnode *m = this; m->parent && n < 64; m = m->parent)
+			chain[n++] = m;
+		if (!n)
+			out->push_back('/');
+		while (n--) {
+			out->push_back('/');
+			out->append(chain[n]->name);
+		}
+	}
+
+private:
+	std::unordered_map<std::string_view, mnode *> idx_;
+};
+
+class mtree {
+public:
+	/* Copy the structure of @t; by_id() then maps index ids to nodes */
+	void load(const tree &t)
+	{
+		by_id_.assign(t.size(), nullptr);
+		root_.reset(new mnode);
+		root_->name = "";
+		by_id_[0] = root_.get();
+		copy_props(t, 0, root_.get());
+		for (uint32_t id = 1; id < t.size(); id++) {
+			mnode *p = by_id_[t.rec(id).parent];
+			mnode *m = p->add_child(t.name(id));
+
+			by_id_[id] = m;
+			copy_props(t, id, m);
+		}
+		src_ = &t.blob();
+	}
+
+	mnode *root() { return root_.get(); }
+	const mnode *root() const { return root_.get(); }
+	mnode *by_id(uint32_t id) { return by_id_[id]; }
+
+	/* Keep a string alive for as long as the tree; not thread safe */
+	const char *intern(std::string s)
+	{
+		arena_.push_back(std::move(s));
+		return arena_.back().c_str();
+	}
+
+	/*
+	 * Serialize to a v17 FDT.  The memory reservation map and boot cpu
+	 * are carried over from the loaded blob.
+	 */
+	void write(std::vector<uint8_t> *out) const
+	{
+		std::unordered_map<std::string_view, uint32_t> names;
+		std::vector<uint8_t> st, str;
+		uint32_t off_rsv = FDT_HEADER_SIZE, off_st, off_str, rsv_len;
+
+		emit(root_.get(), &st, &str, &names);
+		put32(&st, FDT_END);
+
+		rsv_len = rsvmap_len();
+		off_st = off_rsv + rsv_len;
+		off_str = off_st + (uint32_t)st.size();
+
+		out->assign(FDT_HEADER_SIZE, 0);
+		out->insert(out->end(), src_->base() + rsvmap_off(),
+			    src_->base() + rsvmap_off() + rsv_len);
+		out->insert(out->end(), st.begin(), st.end());
+		out->insert(out->end(), str.begin(), str.end());
+
+		uint8_t *h = out->data();
+
+		put_be32(h, FDT_MAGIC);
+		put_be32(h + 4, (uint32_t)out->size());
+		put_be32(h + 8, off_st);
+		put_be32(h + 12, off_str);
+		put_be32(h + 16, off_rsv);
+		put_be32(h + 20, FDT_LAST_SUPPORTED);
+		put_be32(h + 24, FDT_FIRST_SUPPORTED);
+		put_be32(h + 28, src_->boot_cpuid());
+		put_be32(h + 32, (uint32_t)str.size());
+		put_be32(h + 36, (uint32_t)st.size());
+	}
+
+private:
+	static void copy_props(const tree &t, uint32_t id, mnode *m)
+	{
+		m->props.reserve(t.rec(id).nprops);
+		for (const property &p : t.props(id))
+			m->props.push_back({ p.name, p.data, p.len, MPROP_BASE });
+	}
+
+	static void put32(std::vector<uint8_t> *v, uint32_t x)
+	{
+		size_t n = v->size();
+
+		v->resize(n + 4);
+		put_be32(v->data() + n, x);
+	}
+
+	static void put_bytes(std::vector<uint8_t> *v, const void *p, size_t len)
+	{
+		const uint8_t *b = static_cast<const uint8_t *>(p);
+
+		v->insert(v->end(), b, b + len);
+		v->resize(fdt_align((uint32_t)v->size()), 0);
+	}
+
+	static void emit(const mnode *m, std::vector<uint8_t> *st,
+			 std::vector<uint8_t> *str,
+			 std::unordered_map<std::string_view, uint32_t> *names)
+	{
+		put32(st, FDT_BEGIN_NODE);
+		put_bytes(st, m->name, strlen(m->name) + 1);
+		for (const mprop &p : m->props) {
+			auto it = names->find(p.name);
+			uint32_t nameoff;
+
+			if (it == names->end()) {
+				nameoff = (uint32_t)str->size();
+				str->insert(str->end(), p.name,
+					    p.name + strlen(p.name) + 1);
+				names->emplace(p.name, nameoff);
+			} else {
+				nameoff = it->second;
+			}
+			put32(st, FDT_PROP);
+			put32(st, p.len);
+			put32(st, nameoff);
+			put_bytes(st, p.data, p.len);
+		}
+		for (const auto &c : m->children)
+			emit(c.get(), st, str, names);
+		put32(st, FDT_END_NODE);
+	}
+
+	uint32_t rsvmap_off() const { return be32(src_->base() + 16); }
+
+	/* Length of the source reservation map including the terminator */
+	uint32_t rsvmap_len() const
+	{
+		uint32_t off = rsvmap_off(), len = 0;
+
+		while (off + len + 16 <= src_->size()) {
+			len += 16;
+			if (!be64(src_->base() + off + len - 16) &&
+			    !be64(src_->base() + off + len - 8))
+				break;
+		}
+		return len;
+	}
+
+	std::unique_ptr<mnode> root_;
+	std::vector<mnode *> by_id_;
+	std::deque<std::string> arena_;
+	const fdt *src_ = nullptr;
+};
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_MTREE_H__ */
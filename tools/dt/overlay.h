@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Device tree overlay applier.
+ *
+ * Follows the libfdt fdt_overlay_apply() sequence - renumber overlay
+ * phandles past the base, patch __local_fixups__, resolve __fixups__
+ * through the base __symbols__, merge every fragment, then export the
+ * overlay's symbols - with two differences:
+ *
+ *  - symbol and path lookups go through hash maps built once per blob
+ *    rather than repeated tree scans;
+ *  - fragments are grouped by the base nodes their merge visits, and
+ *    groups that share no node are merged concurrently.
+ *
+ * Property overrides that change an existing value are reported as
+ * conflicts instead of being applied silently.  As in libfdt, an overlay
+ * node merged onto a node that already has a phandle keeps the existing
+ * phandle and the overlay's references are redirected to it.
+ */
+
+#ifndef __TOOLS_DT_OVERLAY_H__
+#define __TOOLS_DT_OVERLAY_H__
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+
+#include "mtree.h"
+
+namespace dt {
+
+struct overlay_conflict {
+	std::string path;	/* merged node */
+	const char *prop;
+	int frag;		/* fragment that won */
+	int prev;		/* previous writer: fragment or MPROP_BASE */
+	uint32_t old_len, new_len;
+};
+
+struct overlay_stats {
+	uint32_t fragments = 0;
+	uint32_t groups = 0;
+	uint32_t jobs = 0;		/* threads the merge ran on */
+	uint32_t fixups = 0;
+	uint32_t local_fixups = 0;
+	uint32_t props_set = 0;
+	uint32_t nodes_added = 0;
+};
+
+class overlay {
+public:
+	/*
+	 * @base must stay alive and unmodified while the overlay is used.
+	 * The overlay blob is copied so that phandles can be patched in
+	 * place; merged properties point into that copy.  Overlay phandles
+	 * are moved past both the base's and @taken, the largest phandle
+	 * already in the tree this will be applied to; pass the previous
+	 * overlay's max_phandle() when stacking several.
+	 */
+	int load(const tree &base, const void *blob, size_t size, uint32_t taken = 0)
+	{
+		const uint8_t *b = static_cast<const uint8_t *>(blob);
+		int ret;
+
+		base_ = &base;
+		delta_ = std::max(base.max_phandle(), taken);
+		top_ = delta_;
+		buf_.assign(b, b + size);
+		ret = fdt_.init(buf_.data(), buf_.size());
+		if (ret)
+			return ret;
+		ret = tree_.build(fdt_);
+		if (ret)
+			return ret;
+
+		paths_.clear();
+		paths_.reserve(tree_.size());
+		for (uint32_t id = 0; id < tree_.size(); id++)
+			paths_.emplace(tree_.path(id), id);
+
+		ret = renumber();
+		if (!ret)
+			ret = local_fixups();
+		if (!ret)
+			ret = fixups();
+		return ret;
+	}
+
+	/*
+	 * Merge into @m, which must have been loaded from the base tree.
+	 * @jobs <= 1 merges in fragment order on the calling thread.
+	 */
+	int apply(mtree *m, int jobs)
+	{
+		std::vector<frag> frags;
+		std::vector<std::vector<uint32_t>> groups;
+		std::vector<std::vector<overlay_conflict>> found;
+		std::vector<overlay_stats> gstats;
+		std::atomic<uint32_t> next(0);
+		int ret;
+
+		ret = collect_fragments(&frags);
+		if (ret)
+			return ret;
+		keep_phandles(m, frags);
+		group_fragments(frags, &groups);
+		stats_.fragments = (uint32_t)frags.size();
+		stats_.groups = (uint32_t)groups.size();
+
+		found.resize(groups.size());
+		gstats.resize(groups.size());
+		auto worker = [&]() {
+			uint32_t g;
+
+			while ((g = next++) < groups.size())
+				for (uint32_t fi : groups[g])
+					merge(frags[fi].ov, m->by_id(frags[fi].target),
+					      frags[fi].index, &found[g], &gstats[g]);
+		};
+
+		jobs = std::max(1, std::min<int>(jobs, (int)groups.size()));
+		stats_.jobs = (uint32_t)jobs;
+		if (jobs == 1) {
+			worker();
+		} else {
+			std::vector<std::thread> th;
+
+			for (int i = 0; i < jobs; i++)
+				th.emplace_back(worker);
+			for (auto &t : th)
+				t.join();
+		}
+
+		for (uint32_t g = 0; g < groups.size(); g++) {
+			conflicts_.insert(conflicts_.end(), found[g].begin(),
+					  found[g].end());
+			stats_.props_set += gstats[g].props_set;
+			stats_.nodes_added += gstats[g].nodes_added;
+		}
+		return export_symbols(m, frags);
+	}
+
+	const std::vector<overlay_conflict> &conflicts() const { return conflicts_; }
+	const overlay_stats &stats() const { return stats_; }
+	/* Largest phandle in the tree once this overlay is applied */
+	uint32_t max_phandle() const { return top_; }
+	const tree &index() const { return tree_; }
+
+private:
+	struct frag {
+		uint32_t ov;		/* __overlay__ node in the overlay */
+		uint32_t target;	/* base node id */
+		uint32_t index;		/* N of fragment@N, or position */
+		uint32_t node;		/* fragment node in the overlay */
+	};
+
+	uint8_t *mut(const uint8_t *p) { return buf_.data() + (p - buf_.data()); }
+
+	/* Move every overlay phandle past the target's largest one */
+	int renumber()
+	{
+		for (uint32_t id = 0; id < tree_.size(); id++) {
+			for (const property &p : tree_.props(id)) {
+				uint32_t v;
+
+				if (p.len != 4 || !(p.eq("phandle") ||
+						    p.eq("linux,phandle")))
+					continue;
+				v = p.u32();
+				if (v == DT_NONE || (uint64_t)v + delta_ >= DT_NONE)
+					return -EINVAL;
+				put_be32(mut(p.data), v + delta_);
+				top_ = std::max(top_, v + delta_);
+			}
+		}
+		return 0;
+	}
+
+	/* Shift references to the overlay's own phandles by the same delta */
+	int local_fixups()
+	{
+		uint32_t lf = tree_.find("/__local_fixups__"), end;
+		size_t plen = strlen("/__local_fixups__");
+
+		if (lf == DT_NONE)
+			return 0;
+		end = tree_.rec(lf).skip;
+		for (uint32_t id = lf; id < end; id++) {
+			std::string rel = tree_.path(id).substr(plen);
+			uint32_t target;
+
+			if (rel.empty())
+				rel = "/";
+			auto it = paths_.find(rel);
+
+			if (it == paths_.end())
+				return -ENOENT;
+			target = it->second;
+			for (const property &fx : tree_.props(id)) {
+				property tp;
+
+				if (!tree_.find_prop(target, fx.name, &tp))
+					return -ENOENT;
+				for (uint32_t i = 0; i < fx.cells(); i++) {
+					uint32_t o = fx.u32(i);
+
+					if (o > tp.len || tp.len - o < 4)
+						return -EINVAL;
+					put_be32(mut(tp.data + o),
+						 be32(tp.data + o) + delta_);
+					local_refs_.push_back(mut(tp.data + o));
+					stats_.local_fixups++;
+				}
+			}
+		}
+		return 0;
+	}
+
+	/* Resolve "path:prop:offset" references against the base symbols */
+	int fixups()
+	{
+		uint32_t fx = tree_.find("/__fixups__"), sy;
+		std::unordered_map<std::string_view, const char *> symbols;
+
+		if (fx == DT_NONE)
+			return 0;
+		sy = base_->find("/__symbols__");
+		if (sy == DT_NONE)
+			return -ENOENT;
+		for (const property &p : base_->props(sy))
+			symbols.emplace(p.name, p.str());
+
+		for (const property &p : tree_.props(fx)) {
+			auto it = symbols.find(p.name);
+			uint32_t node, ph;
+
+			if (it == symbols.end())
+				return -ENOENT;
+			node = base_->find(it->second);
+			if (node == DT_NONE || !(ph = base_->rec(node).phandle))
+				return -ENOENT;
+
+			for (const char *ref : p.strings()) {
+				const char *c1 = strchr(ref, ':');
+				const char *c2 = c1 ? strchr(c1 + 1, ':') : nullptr;
+				std::string prop_name;
+				property tp;
+				uint32_t o;
+
+				if (!c2)
+					return -EINVAL;
+				auto pit = paths_.find(std::string(ref, c1 - ref));
+
+				if (pit == paths_.end())
+					return -ENOENT;
+				prop_name.assign(c1 + 1, c2 - c1 - 1);
+				o = strtoul(c2 + 1, nullptr, 0);
+				if (!tree_.find_prop(pit->second, prop_name.c_str(), &tp) ||
+				    o > tp.len || tp.len - o < 4)
+					return -EINVAL;
+				put_be32(mut(tp.data + o), ph);
+				stats_.fixups++;
+			}
+		}
+		return 0;
+	}
+
+	int collect_fragments(std::vector<frag> *out)
+	{
+		uint32_t n = 0;
+
+		for (uint32_t c = tree_.first_child(0); c != DT_NONE;
+		     c = tree_.next_sibling(c), n++) {
+			uint32_t ov = tree_.child(c, "__overlay__", 11);
+			const char *at = strchr(tree_.name(c), '@');
+			property tp;
+			frag f;
+
+			if (ov == DT_NONE)
+				continue;
+			if (tree_.find_prop(c, "target", &tp) && tp.len == 4)
+				f.target = base_->by_phandle(tp.u32());
+			else if (tree_.find_prop(c, "target-path", &tp))
+				f.target = base_->find(tp.str());
+			else
+				return -EINVAL;
+			if (f.target == DT_NONE)
+				return -ENOENT;
+			f.ov = ov;
+			f.node = c;
+			f.index = at ? strtoul(at + 1, nullptr, 10) : n;
+			out->push_back(f);
+		}
+		return 0;
+	}
+
+	/*
+	 * Pair overlay nodes with the nodes they will merge onto; where both
+	 * carry a phandle, the existing one wins and local references follow.
+	 */
+	void keep_phandles(mtree *m, const std::vector<frag> &frags)
+	{
+		std::unordered_map<uint32_t, uint32_t> remap;
+
+		for (const frag &f : frags)
+			pair_phandles(f.ov, m->by_id(f.target), &remap);
+		if (remap.empty())
+			return;
+		for (uint8_t *ref : local_refs_) {
+			auto it = remap.find(be32(ref));
+
+			if (it != remap.end())
+				put_be32(ref, it->second);
+		}
+	}
+
+	void pair_phandles(uint32_t ov, mnode *m,
+			   std::unordered_map<uint32_t, uint32_t> *remap)
+	{
+		mprop *mp = m->prop("phandle");
+		property op;
+
+		if (mp && mp->len == 4 && tree_.find_prop(ov, "phandle", &op) &&
+		    op.len == 4) {
+			remap->emplace(op.u32(), be32(mp->data));
+			skip_.insert(op.data);
+		}
+		for (uint32_t c = tree_.first_child(ov); c != DT_NONE;
+		     c = tree_.next_sibling(c)) {
+			mnode *mc = m->child(tree_.name(c));
+
+			if (mc)
+				pair_phandles(c, mc, remap);
+		}
+	}
+
+	/*
+	 * Merging a fragment reads and writes only the nodes it visits: its
+	 * target and the base nodes its overlay subtree lands on.  Nodes it
+	 * adds hang off a visited one, so fragments that visit no common
+	 * node can be merged in any order, and each group is the closure
+	 * of fragments linked by a shared node.
+	 */
+	void group_fragments(const std::vector<frag> &frags,
+			     std::vector<std::vector<uint32_t>> *groups)
+	{
+		std::vector<uint32_t> leader(frags.size()), group_of(frags.size(), DT_NONE);
+		std::unordered_map<uint32_t, uint32_t> owner;
+		std::vector<uint32_t> seen;
+
+		for (uint32_t i = 0; i < frags.size(); i++) {
+			leader[i] = i;
+			seen.clear();
+			visited(frags[i].ov, frags[i].target, &seen);
+			for (uint32_t id : seen) {
+				auto it = owner.emplace(id, i).first;
+
+				unite(&leader, it->second, i);
+			}
+		}
+		/* Groups and their members come out in fragment order */
+		for (uint32_t i = 0; i < frags.size(); i++) {
+			uint32_t r = find(&leader, i);
+
+			if (group_of[r] == DT_NONE) {
+				group_of[r] = (uint32_t)groups->size();
+				groups->emplace_back();
+			}
+			(*groups)[group_of[r]].push_back(i);
+		}
+	}
+
+	void visited(uint32_t ov, uint32_t id, std::vector<uint32_t> *out) const
+	{
+		out->push_back(id);
+		for (uint32_t c = tree_.first_child(ov); c != DT_NONE;
+		     c = tree_.next_sibling(c)) {
+			/* Exact names, as mnode::child() matches them */
+			for (uint32_t bc = base_->first_child(id); bc != DT_NONE;
+			     bc = base_->next_sibling(bc)) {
+				if (!strcmp(base_->name(bc), tree_.name(c))) {
+					visited(c, bc, out);
+					break;
+				}
+			}
+		}
+	}
+
+	static uint32_t find(std::vector<uint32_t> *leader, uint32_t i)
+	{
+		while ((*leader)[i] != i)
+			i = (*leader)[i] = (*leader)[(*leader)[i]];
+		return i;
+	}
+
+	static void unite(std::vector<uint32_t> *leader, uint32_t a, uint32_t b)
+	{
+		a = find(leader, a);
+		b = find(leader, b);
+		if (a != b)
+			(*leader)[std::max(a, b)] = std::min(a, b);
+	}
+
+	void merge(uint32_t ov, mnode *m, uint32_t fi,
+		   std::vector<overlay_conflict> *found, overlay_stats *st)
+	{
+		for (const property &p : tree_.props(ov)) {
+			mprop *old;
+
+			if (skip_.count(p.data))
+				continue;
+			old = m->prop(p.name);
+			st->props_set++;
+			if (!old) {
+				m->props.push_back({ p.name, p.data, p.len, (int)fi });
+				continue;
+			}
+			if (old->len != p.len || memcmp(old->data, p.data, p.len)) {
+				overlay_conflict c;
+
+				m->path(&c.path);
+				c.prop = old->name;
+				c.frag = fi;
+				c.prev = old->src;
+				c.old_len = old->len;
+				c.new_len = p.len;
+				found->push_back(std::move(c));
+			}
+			old->data = p.data;
+			old->len = p.len;
+			old->src = fi;
+		}
+		for (uint32_t c = tree_.first_child(ov); c != DT_NONE;
+		     c = tree_.next_sibling(c)) {
+			const char *n = tree_.name(c);
+			mnode *mc = m->child(n);
+
+			if (!mc) {
+				mc = m->add_child(n);
+				st->nodes_added++;
+			}
+			merge(c, mc, fi, found, st);
+		}
+	}
+
+	/*
+	 * Overlay symbols point below /fragment@N/__overlay__; rewrite them
+	 * to the merged location and add them to the base __symbols__.
+	 */
+	int export_symbols(mtree *m, const std::vector<frag> &frags)
+	{
+		uint32_t sy = tree_.find("/__symbols__");
+		std::unordered_map<uint32_t, const frag *> by_node;
+		mnode *msy;
+
+		if (sy == DT_NONE)
+			return 0;
+		msy = m->root()->child("__symbols__");
+		if (!msy)
+			msy = m->root()->add_child("__symbols__");
+		for (const frag &f : frags)
+			by_node.emplace(f.node, &f);
+
+		for (const property &p : tree_.props(sy)) {
+			const char *s = p.str(), *rest;
+			std::string out;
+			uint32_t id;
+
+			auto it = paths_.find(s);
+			if (it == paths_.end())
+				continue;
+			/* Walk up to the fragment this symbol lives in */
+			for (id = it->second; id != DT_NONE && tree_.rec(id).depth > 1;
+			     id = tree_.rec(id).parent)
+				;
+			auto fit = id == DT_NONE ? by_node.end() : by_node.find(id);
+
+			if (fit == by_node.end())
+				continue;
+			rest = strstr(s, "/__overlay__");
+			if (!rest)
+				continue;
+			rest += strlen("/__overlay__");
+			out = base_->path(fit->second->target);
+			if (out == "/")
+				out.clear();
+			out += rest;
+
+			const char *val = m->intern(out);
+			mprop *old = msy->prop(p.name);
+
+			if (old) {
+				old->data = reinterpret_cast<const uint8_t *>(val);
+				old->len = (uint32_t)out.size() + 1;
+				old->src = fit->second->index;
+			} else {
+				msy->props.push_back({ p.name,
+					reinterpret_cast<const uint8_t *>(val),
+					(uint32_t)out.size() + 1,
+					(int)fit->second->index });
+			}
+		}
+		return 0;
+	}
+
+	const tree *base_ = nullptr;
+	std::vector<uint8_t> buf_;
+	fdt fdt_;
+	tree tree_;
+	std::unordered_map<std::string, uint32_t> paths_;
+	std::vector<uint8_t *> local_refs_;
+	std::unordered_set<const uint8_t *> skip_;
+	std::vector<overlay_conflict> conflicts_;
+	overlay_stats stats_;
+	uint32_t delta_ = 0;
+	uint32_t top_ = 0;
+};
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_OVERLAY_H__ */
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Phandle reference decoding.
+ *
+ * A flattened blob does not say which cells are phandles.  This follows
+ * the bindings instead: "<list>" properties carry (phandle, args...)
+ * tuples whose arg count comes from the target's "#<cells>" property,
+ * and a set of well-known properties are plain phandle lists.
+ */
+
+#ifndef __TOOLS_DT_REFS_H__
+#define __TOOLS_DT_REFS_H__
+
+#include "fdt.h"
+
+namespace dt {
+
+enum ref_kind {
+	REF_NONE,
+	REF_LIST,	/* every cell is a phandle */
+	REF_ARGS,	/* (phandle, #cells args) tuples */
+};
+
+struct ref_spec {
+	const char *prop;
+	const char *cells;
+};
+
+static const ref_spec ref_args_props[] = {
+	{ "clocks",		"#clock-cells" },
+	{ "assigned-clocks",	"#clock-cells" },
+	{ "resets",		"#reset-cells" },
+	{ "power-domains",	"#power-domain-cells" },
+	{ "dmas",		"#dma-cells" },
+	{ "mboxes",		"#mbox-cells" },
+	{ "iommus",		"#iommu-cells" },
+	{ "phys",		"#phy-cells" },
+	{ "io-channels",	"#io-channel-cells" },
+	{ "thermal-sensors",	"#thermal-sensor-cells" },
+	{ "cooling-device",	"#cooling-cells" },
+	{ "interconnects",	"#interconnect-cells" },
+	{ "interrupts-extended", "#interrupt-cells" },
+	{ "hwlocks",		"#hwlock-cells" },
+	{ "qcom,freq-domain",	"#freq-domain-cells" },
+	{ "qcom,smem-states",	"#qcom,smem-state-cells" },
+};
+
+static const char *const ref_list_props[] = {
+	"interrupt-parent", "memory-region", "nvmem-cells", "nvmem",
+	"cpu", "cpus", "cpu-idle-states", "next-level-cache", "trip",
+	"remote-endpoint", "parent-node", "qcom,cpulist", "qcom,target-dev",
+	"qcom,cpu", "qcom,msm-bus,name-ref",
+};
+
+static inline bool ends_with(const char *s, const char *suffix)
+{
+	size_t a = strlen(s), b = strlen(suffix);
+
+	return a >= b && !strcmp(s + a - b, suffix);
+}
+
+/* "pinctrl-<N>", not "pinctrl-names" */
+static inline bool is_pinctrl_state(const char *name)
+{
+	if (strncmp(name, "pinctrl-", 8) || !name[8])
+		return false;
+	for (name += 8; *name; name++)
+		if (*name < '0' || *name > '9')
+			return false;
+	return true;
+}
+
+/* How @name references other nodes; @cells gets the "#cells" name */
+static inline ref_kind ref_classify(const char *name, const char **cells)
+{
+	*cells = nullptr;
+	for (const ref_spec &s : ref_args_props) {
+		if (!strcmp(name, s.prop)) {
+			*cells = s.cells;
+			return REF_ARGS;
+		}
+	}
+	if (ends_with(name, "-gpios") || !strcmp(name, "gpios") ||
+	    ends_with(name, "-gpio")) {
+		*cells = "#gpio-cells";
+		return REF_ARGS;
+	}
+	for (const char *p : ref_list_props)
+		if (!strcmp(name, p))
+			return REF_LIST;
+	if (ends_with(name, "-supply") || is_pinctrl_state(name))
+		return REF_LIST;
+	return REF_NONE;
+}
+
+/*
+ * Split @p into references.  @fn(cell, target, nargs) is called for each
+ * phandle cell index with the node it names and how many argument cells
+ * follow it.  Returns false - after reporting what it could - when the
+ * value does not decode cleanly, in which case callers should treat the
+ * rest as plain cells.
+ */
+template <typename F>
+static inline bool ref_decode(const tree &t, const property &p, F fn)
+{
+	const char *cells;
+	ref_kind k = ref_classify(p.name, &cells);
+	uint32_t n = p.cells(), i = 0;
+
+	if (k == REF_NONE || (p.len & 3))
+		return false;
+	while (i < n) {
+		uint32_t ph = p.u32(i), target = t.by_phandle(ph), nargs = 0;
+
+		if (target == DT_NONE)
+			return false;
+		if (k == REF_ARGS) {
+			property cp;
+
+			/* Unknown arg count: one reference owns the rest */
+			if (t.find_prop(target, cells, &cp) && cp.len == 4)
+				nargs = cp.u32();
+			else
+				nargs = n - i - 1;
+			if (i + 1 + nargs > n)
+				return false;
+		}
+		fn(i, target, nargs);
+		i += 1 + nargs;
+	}
+	return true;
+}
+
+} /* namespace dt */
+
+#endif /* __TOOLS_DT_REFS_H__ */
@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * GPU devfreq replay over one speed bin's power levels.
+ *
+ * The trace gives GPU busy percentage per sample window, optionally with
+ * the frequency it was measured at and the share of busy time stalled on
+ * DDR (the gpubw governor's ram_wait input).  Busy time is turned into
+ * cycles of work at the recorded frequency, or at the bin's top level
+ * when the trace does not say; work the simulated level cannot finish
+ * in a window carries over, so an undersized level shows up as backlog.
+ *
+ * Two level governors are modelled:
+ *  - ondemand: devfreq simple_ondemand, target = f * busy / (up - down/2)
+ *    rounded up to a level, straight to the top above the up threshold.
+ *  - step: one level per polling period, up at or above the up
+ *    threshold, down below the down threshold, like msm-adreno-tz.
+ * The DDR vote starts at the level's qcom,bus-freq and, with a ram_wait
+ * column, walks within qcom,bus-min..max: up while stalls exceed
+ * ram_up%, down while below ram_down%.
+ */
+
+#ifndef __TOOLS_GPU_DEVFREQ_H__
+#define __TOOLS_GPU_DEVFREQ_H__
+
+#include "../lib/csv.h"
+#include "kgsl.h"
+
+namespace gpu {
+
+enum gov_kind {
+	GOV_ONDEMAND,
+	GOV_STEP,
+};
+
+struct devfreq_opts {
+	gov_kind gov = GOV_ONDEMAND;
+	uint32_t polling_ms = 10;
+	uint32_t up = 90;		/* percent */
+	uint32_t down = 5;		/* ondemand: differential; step: threshold */
+	uint32_t ram_up = 50;
+	uint32_t ram_down = 20;
+};
+
+class devfreq_sim {
+public:
+	int init(const kgsl_gpu &g, const pwr_table &tb, const devfreq_opts &o)
+	{
+		g_ = &g;
+		tb_ = tb;
+		opts_ = o;
+		if (tb_.levels.empty() || !o.polling_ms || o.up > 100 ||
+		    (o.gov == GOV_ONDEMAND ? o.down > o.up : o.down >= o.up))
+			return -EINVAL;
+		level_res_.assign(tb_.levels.size(), 0);
+		bus_res_.assign(std::max<size_t>(g.ddr_kbps().size(), 1), 0);
+		level_ = tb_.initial;
+		bus_ = tb_.levels[level_].bus.freq;
+		now_ = 0;
+		started_ = false;
+		next_eval_ = 0;
+		win_busy_ = win_total_ = win_ram_ = 0;
+		backlog_ = max_backlog_ = 0;
+		work_ = busy_us_ = span_us_ = late_us_ = 0;
+		kbps_us_ = hz_us_ = 0;
+		transitions_ = bus_transitions_ = 0;
+		return 0;
+	}
+
+	/* time_us or time_ms, busy_pct; freq_mhz / freq_khz, ram_pct optional */
+	int bind(const csv::row &hdr)
+	{
+		c_us_ = hdr.find("time_us");
+		c_ms_ = hdr.find("time_ms");
+		c_busy_ = hdr.find("busy_pct");
+		c_mhz_ = hdr.find("freq_mhz");
+		c_khz_ = hdr.find("freq_khz");
+		c_ram_ = hdr.find("ram_pct");
+		return (c_us_ < 0 && c_ms_ < 0) || c_busy_ < 0 ? -EINVAL : 0;
+	}
+
+	/* Each row closes the window since the previous one */
+	template <typename F>
+	void sample(const csv::row &r, F changed)
+	{
+		uint64_t t = c_us_ >= 0 ? r.u64(c_us_) : r.u64(c_ms_) * 1000;
+		double busy = std::min(100.0, std::max(0.0, r.dbl(c_busy_))) / 100;
+		uint64_t rec_hz = c_mhz_ >= 0 ? (uint64_t)(r.dbl(c_mhz_) * 1e6) :
+				  c_khz_ >= 0 ? r.u64(c_khz_) * 1000 : tb_.levels[0].hz;
+		double ram = c_ram_ >= 0 ? r.dbl(c_ram_) / 100 : -1;
+
+		if (!started_) {
+			started_ = true;
+			now_ = t;
+			next_eval_ = t + opts_.polling_ms * 1000ull;
+			return;
+		}
+		if (t <= now_)
+			return;
+		run(t - now_, busy * rec_hz * (t - now_) / 1e6, ram);
+		now_ = t;
+		while (now_ >= next_eval_) {
+			evaluate(changed);
+			next_eval_ += opts_.polling_ms * 1000ull;
+		}
+	}
+
+	const pwr_table &table() const { return tb_; }
+	const std::vector<uint64_t> &level_res() const { return level_res_; }
+	const std::vector<uint64_t> &bus_res() const { return bus_res_; }
+	uint64_t span_us() const { return span_us_; }
+	uint64_t busy_us() const { return busy_us_; }
+	uint64_t late_us() const { return late_us_; }
+	uint32_t transitions() const { return transitions_; }
+	uint32_t bus_transitions() const { return bus_transitions_; }
+	double work_cycles() const { return work_; }
+	double max_backlog() const { return max_backlog_; }
+	double mean_hz() const { return span_us_ ? hz_us_ / span_us_ : 0; }
+	double mean_kbps() const { return span_us_ ? kbps_us_ / span_us_ : 0; }
+
+private:
+	void run(uint64_t dt, double cycles, double ram)
+	{
+		const pwrlevel &l = tb_.levels[level_];
+		double cap = (double)l.hz * dt / 1e6, done;
+
+		work_ += cycles;
+		backlog_ += cycles;
+		done = std::min(backlog_, cap);
+		backlog_ -= done;
+		max_backlog_ = std::max(max_backlog_, backlog_);
+		if (backlog_ > 0)
+			late_us_ += dt;
+
+		busy_us_ += (uint64_t)(done / l.hz * 1e6);
+		win_busy_ += done / l.hz * 1e6;
+		win_total_ += dt;
+		if (ram >= 0)
+			win_ram_ += ram * done / l.hz * 1e6;
+		else
+			win_ram_ = -1;
+
+		span_us_ += dt;
+		level_res_[level_] += dt;
+		if (bus_ >= 0 && (size_t)bus_ < bus_res_.size())
+			bus_res_[bus_] += dt;
+		hz_us_ += (double)l.hz * dt;
+		kbps_us_ += (double)g_->ddr_vote(bus_) * dt;
+	}
+
+	int pick_level(uint32_t pct) const
+	{
+		int n = (int)tb_.levels.size(), lvl = level_;
+		uint64_t target;
+
+		if (opts_.gov == GOV_STEP) {
+			if (pct >= opts_.up && lvl > 0)
+				return lvl - 1;
+			if (pct < opts_.down && lvl < n - 1)
+				return lvl + 1;
+			return lvl;
+		}
+		/* devfreq_simple_ondemand_func() */
+		if (pct > opts_.up)
+			return 0;
+		if (pct > opts_.up - opts_.down)
+			return lvl;
+		target = tb_.levels[lvl].hz * pct / (opts_.up - opts_.down / 2);
+
+		for (lvl = n - 1; lvl > 0; lvl--)
+			if (tb_.levels[lvl].hz >= target)
+				break;
+		return lvl;
+	}
+
+	template <typename F>
+	void evaluate(F changed)
+	{
+		uint32_t pct;
+		int lvl, bus;
+
+		if (win_total_ <= 0)
+			return;
+		pct = (uint32_t)(100 * win_busy_ / win_total_);
+		/* Backlog means the window was really saturated */
+		if (backlog_ > 0)
+			pct = 100;
+		lvl = pick_level(pct);
+		const pwrlevel &l = tb_.levels[lvl];
+
+		bus = lvl == level_ ? bus_ : l.bus.freq;
+		if (win_ram_ >= 0 && win_busy_ > 0) {
+			double ram = 100 * win_ram_ / win_busy_;
+
+			if (ram > opts_.ram_up && bus < l.bus.max)
+				bus++;
+			else if (ram < opts_.ram_down && bus > l.bus.min)
+				bus--;
+		}
+		bus = std::max(l.bus.min, std::min(l.bus.max, bus));
+		win_busy_ = win_total_ = win_ram_ = 0;
+		if (lvl == level_ && bus == bus_)
+			return;
+		transitions_ += lvl != level_;
+		bus_transitions_ += bus != bus_;
+		level_ = lvl;
+		bus_ = bus;
+		changed(now_, level_, bus_);
+	}
+
+	const kgsl_gpu *g_ = nullptr;
+	pwr_table tb_;
+	devfreq_opts opts_;
+	std::vector<uint64_t> level_res_, bus_res_;
+	int level_ = 0, bus_ = -1;
+	int c_us_ = -1, c_ms_ = -1, c_busy_ = -1, c_mhz_ = -1, c_khz_ = -1, c_ram_ = -1;
+	uint64_t now_ = 0, next_eval_ = 0;
+	bool started_ = false;
+	double win_busy_ = 0, win_total_ = 0, win_ram_ = 0;
+	double backlog_ = 0, max_backlog_ = 0, work_ = 0;
+	uint64_t busy_us_ = 0, span_us_ = 0, late_us_ = 0;
+	double hz_us_ = 0, kbps_us_ = 0;
+	uint32_t transitions_ = 0, bus_transitions_ = 0;
+};
+
+} /* namespace gpu */
+
+#endif /* __TOOLS_GPU_DEVFREQ_H__ */
@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Decode the Adreno power-level tables of a DTB and replay GPU busy
+ * traces through a devfreq governor, per speed bin.
+ *
+ * Build: g++ -std=c++17 -O2 -o gpu_sim gpu_sim.cpp
+ * Usage: gpu_sim [-d ddr_type] [-b speed_bin] [-G] [-F qfprom.bin] <blob.dtb>
+ *        gpu_sim [table options] [-o ondemand|step] [-p polling_ms]
+ *                [-u up:down] [-r ram_up:ram_down] [-v] <blob.dtb> <trace.csv>
+ *        gpu_sim [options] -g seconds <blob.dtb>
+ *
+ * Without a trace the tables are printed: fuses, DDR and CNOC bus
+ * tables, and every bin's levels with their corners, DDR votes and the
+ * cycles one frame may spend at 60/90/120 fps.  With a trace, CSV with
+ * a header row:
+ *
+ *   time_us,busy_pct[,freq_mhz][,ram_pct]
+ *
+ * is replayed against every bin, or just the one picked by -b or by the
+ * speed_bin fuse of a qfprom dump (-F).  Levels above the NOM corner are
+ * only used with the gaming fuse (-G, or set in the dump).  -g replays
+ * a synthetic game-like trace instead and -v logs each vote change.
+ *
+ * Example:
+ *   gpu_sim -d 8 -o step yupik.dtb manhattan.csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "devfreq.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void print_tables(const gpu::kgsl_gpu &g, const uint32_t *bin, bool gaming)
+{
+	static const unsigned int fps[] = { 60, 90, 120 };
+
+	printf("%s\n", g.name());
+	for (const gpu::nvmem_fuse &f : g.fuses())
+		printf("  fuse %s: qfprom 0x%x, %u bytes, bits %u+%u\n", f.name.c_str(),
+		       f.offset, f.len, f.bit, f.nbits);
+	printf("  ddr table (kBps):");
+	for (uint32_t v : g.ddr_kbps())
+		printf(" %u", v);
+	printf("\n  cnoc table:");
+	for (uint32_t v : g.cnoc())
+		printf(" %u", v);
+	printf("\n  l3 levels (MHz):");
+	for (uint64_t v : g.l3_hz())
+		printf(" %lu", (unsigned long)(v / 1000000));
+	printf("\n");
+
+	for (const gpu::pwr_table &all : g.tables()) {
+		gpu::pwr_table tb;
+
+		if ((bin && all.speed_bin != *bin) || g.select(all.speed_bin, gaming, &tb))
+			continue;
+		printf("speed bin %u: %zu levels, initial %u\n", tb.speed_bin,
+		       tb.levels.size(), tb.initial);
+		for (size_t i = 0; i < tb.levels.size(); i++) {
+			const gpu::pwrlevel &l = tb.levels[i];
+
+			printf("  %zu: %4lu MHz corner %3u ddr %u kBps [%u..%u]", i,
+			       (unsigned long)(l.hz / 1000000), l.corner, g.ddr_vote(l.bus.freq),
+			       g.ddr_vote(l.bus.min), g.ddr_vote(l.bus.max));
+			if (l.l3_hz)
+				printf(" l3 %lu MHz", (unsigned long)(l.l3_hz / 1000000));
+			if (l.gaming)
+				printf(" gaming");
+			printf("\n");
+		}
+		printf("  frame budget at %lu MHz:", (unsigned long)(tb.levels[0].hz / 1000000));
+		for (unsigned int f : fps)
+			printf(" %.2f Mcycles@%u", tb.levels[0].hz / 1e6 / f, f);
+		printf("\n");
+	}
+}
+
+static void report(const gpu::kgsl_gpu &g, const gpu::devfreq_sim &s)
+{
+	const gpu::pwr_table &tb = s.table();
+	uint64_t span = s.span_us();
+
+	if (!span)
+		return;
+	printf("speed bin %u: %u level / %u bus transitions, busy %.1f%%, "
+	       "mean %.0f MHz, ddr %.0f MBps\n", tb.speed_bin, s.transitions(),
+	       s.bus_transitions(), 100.0 * s.busy_us() / span, s.mean_hz() / 1e6,
+	       s.mean_kbps() / 1000);
+	printf("  work %.1f Gcycles, late %.2f%% of the time, worst backlog %.2f ms at top\n",
+	       s.work_cycles() / 1e9, 100.0 * s.late_us() / span,
+	       s.max_backlog() / tb.levels[0].hz * 1e3);
+	for (size_t i = 0; i < tb.levels.size(); i++)
+		if (s.level_res()[i])
+			printf("    %4lu MHz %6.2f%%\n", (unsigned long)(tb.levels[i].hz / 1000000),
+			       100.0 * s.level_res()[i] / span);
+	for (size_t i = 0; i < s.bus_res().size(); i++)
+		if (s.bus_res()[i])
+			printf("    %8u kBps %6.2f%%\n", g.ddr_vote((int)i),
+			       100.0 * s.bus_res()[i] / span);
+}
+
+/*
+ * Synthetic trace: 60 fps frames whose GPU cost drifts between light
+ * menus and heavy scenes, sampled every 2 ms at a fixed 550 MHz.
+ */
+static std::string synth(double seconds)
+{
+	std::string s = "time_us,busy_pct,freq_mhz,ram_pct\n";
+	uint64_t x = 0x2545f4914f6cdd1dull, end = (uint64_t)(seconds * 1e6);
+	double cost = 0.4;
+	char line[64];
+
+	s.reserve(end / 2000 * 24);
+	for (uint64_t t = 0; t < end; t += 2000) {
+		uint64_t in_frame = t % 16667;
+		double busy, ram;
+
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		if (!in_frame || in_frame < 2000) {
+			cost += ((double)(x % 1000) / 1000 - 0.5) * 0.08;
+			if ((t / 5000000) % 3 == 2)
+				cost = std::min(cost, 0.35);
+			cost = std::max(0.1, std::min(1.6, cost));
+		}
+		busy = in_frame < cost * 16667 ? 100 : 5;
+		ram = 15 + (double)(x >> 32 & 63);
+		snprintf(line, sizeof(line), "%lu,%.0f,550,%.0f\n", (unsigned long)t, busy, ram);
+		s += line;
+	}
+	return s;
+}
+
+static int parse_pair(const char *s, uint32_t *a, uint32_t *b)
+{
+	unsigned int x, y;
+
+	if (sscanf(s, "%u:%u", &x, &y) != 2)
+		return -EINVAL;
+	*a = x;
+	*b = y;
+	return 0;
+}
+
+/* speed_bin and gaming_bin from a dump of the qfprom block */
+static int read_fuses(const char *path, const gpu::kgsl_gpu &g, uint32_t *bin, bool *gaming)
+{
+	const gpu::nvmem_fuse *sb = g.fuse("speed_bin"), *gb = g.fuse("gaming_bin");
+	lib::mapped_file m;
+	uint32_t v;
+	int ret = m.open(path);
+
+	if (ret)
+		return ret;
+	if (!sb)
+		return -ENOENT;
+	ret = sb->extract(m.data(), m.size(), bin);
+	if (!ret && gb && !gb->extract(m.data(), m.size(), &v))
+		*gaming = v != 0;
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	gpu::devfreq_opts o;
+	gpu::kgsl_gpu g;
+	csv::reader rd;
+	csv::row r;
+	std::string trace;
+	const char *fuses = nullptr;
+	uint32_t ddr_type = 7, bin = 0;
+	bool gaming = false, one_bin = false, verbose = false;
+	double gen = 0, t0, t1;
+	uint64_t rows = 0;
+	dt::file f;
+	int opt, ret, nargs;
+
+	while ((opt = getopt(argc, argv, "d:b:GF:o:p:u:r:g:v")) != -1) {
+		switch (opt) {
+		case 'd':
+			ddr_type = (uint32_t)atoi(optarg);
+			break;
+		case 'b':
+			bin = (uint32_t)strtoul(optarg, nullptr, 0);
+			one_bin = true;
+			break;
+		case 'G':
+			gaming = true;
+			break;
+		case 'F':
+			fuses = optarg;
+			break;
+		case 'o':
+			if (!strcmp(optarg, "ondemand"))
+				o.gov = gpu::GOV_ONDEMAND;
+			else if (!strcmp(optarg, "step"))
+				o.gov = gpu::GOV_STEP;
+			else
+				return 1;
+			break;
+		case 'p':
+			o.polling_ms = (uint32_t)atoi(optarg);
+			break;
+		case 'u':
+			if (parse_pair(optarg, &o.up, &o.down))
+				return 1;
+			break;
+		case 'r':
+			if (parse_pair(optarg, &o.ram_up, &o.ram_down))
+				return 1;
+			break;
+		case 'g':
+			gen = atof(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	/* The step governor's down threshold is absolute */
+	if (o.gov == gpu::GOV_STEP && o.down == gpu::devfreq_opts().down)
+		o.down = 50;
+	nargs = argc - optind;
+	if (gen > 0 ? nargs != 1 : nargs < 1 || nargs > 2) {
+		fprintf(stderr,
+			"usage: %s [-d ddr_type] [-b speed_bin] [-G] [-F qfprom.bin] <blob.dtb>\n"
+			"       %s [table options] [-o ondemand|step] [-p polling_ms] "
+			"[-u up:down] [-r ram_up:ram_down] [-v] <blob.dtb> <trace.csv>\n"
+			"       %s [options] -g seconds <blob.dtb>\n", argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	ret = f.open(argv[optind]);
+	if (!ret)
+		ret = g.load(f.index(), ddr_type);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	if (fuses) {
+		ret = read_fuses(fuses, g, &bin, &gaming);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", fuses, strerror(-ret));
+			return 1;
+		}
+		one_bin = true;
+	}
+
+	if (nargs == 1 && gen <= 0) {
+		print_tables(g, one_bin ? &bin : nullptr, gaming);
+		return 0;
+	}
+
+	if (gen > 0) {
+		trace = synth(gen);
+		rd.attach(trace.data(), trace.size());
+	} else if ((ret = rd.open(argv[optind + 1]))) {
+		fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(-ret));
+		return 1;
+	}
+
+	t0 = now_us();
+	for (const gpu::pwr_table &all : g.tables()) {
+		gpu::devfreq_sim s;
+		gpu::pwr_table tb;
+
+		if (one_bin && all.speed_bin != bin)
+			continue;
+		ret = g.select(all.speed_bin, gaming, &tb);
+		if (!ret)
+			ret = s.init(g, tb, o);
+		if (ret) {
+			fprintf(stderr, "speed bin %u: %s\n", all.speed_bin, strerror(-ret));
+			return 1;
+		}
+
+		rd.rewind();
+		if (!rd.next(&r) || s.bind(r)) {
+			fprintf(stderr, "%s: trace header needs time_us and busy_pct\n",
+				gen > 0 ? "synthetic" : argv[optind + 1]);
+			return 1;
+		}
+
+		auto changed = [&](uint64_t t, int lvl, int bus) {
+			if (verbose)
+				printf("%lu bin %u %lu MHz %u kBps\n", (unsigned long)t, tb.speed_bin,
+				       (unsigned long)(tb.levels[lvl].hz / 1000000), g.ddr_vote(bus));
+		};
+
+		while (rd.next(&r)) {
+			s.sample(r, changed);
+			rows++;
+		}
+		report(g, s);
+	}
+	t1 = now_us();
+
+	if (!rows) {
+		fprintf(stderr, "speed bin %u: not in %s\n", bin, argv[optind]);
+		return 1;
+	}
+	fprintf(stderr, "%lu rows replayed in %.1f ms\n", (unsigned long)rows, (t1 - t0) / 1e3);
+	return 0;
+}
@@ -0,0 +1,284 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Adreno power levels and bus tables from the qcom,kgsl-3d0 node.
+ *
+ * Power levels sit in qcom,gpu-pwrlevel-bins/qcom,gpu-pwrlevels-N, one
+ * table per qcom,speed-bin, or directly in qcom,gpu-pwrlevels on parts
+ * without bins.  Level 0 is the fastest.  Each level names its RPMh corner
+ * (qcom,level) and its DDR vote as indices into qcom,bus-table-ddrN for
+ * the DDR type fitted (unsuffixed on older targets): the nominal vote
+ * qcom,bus-freq and the range qcom,bus-min / qcom,bus-max the bandwidth
+ * governor may move within.  qcom,bus-table-cnoc is the config NoC vote
+ * and qcom,l3-pwrlevels the L3 votes kgsl can place.
+ *
+ * The bin is read at boot from the speed_bin fuse; the gaming_bin fuse
+ * unlocks the levels above the NOM corner.  Both fuses are nvmem cells
+ * in the qfprom, described here by offset and bit range so a dump of
+ * the fuse block can be decoded the way the nvmem core does.
+ */
+
+#ifndef __TOOLS_GPU_KGSL_H__
+#define __TOOLS_GPU_KGSL_H__
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../dt/fdt.h"
+
+namespace gpu {
+
+#define RPMH_REGULATOR_LEVEL_NOM	256
+
+struct bus_range {
+	int freq, min, max;		/* indices into the DDR table, -1: none */
+};
+
+struct pwrlevel {
+	uint32_t node;
+	uint32_t reg;
+	uint64_t hz;
+	uint32_t corner;		/* qcom,level */
+	bus_range bus;
+	uint32_t acd;
+	uint64_t l3_hz;			/* qcom,l3-freq, 0 when not per level */
+	bool gaming;			/* only with the gaming_bin fuse */
+};
+
+struct pwr_table {
+	uint32_t node;
+	uint32_t speed_bin;
+	uint32_t initial;		/* qcom,initial-pwrlevel */
+	std::vector<pwrlevel> levels;
+};
+
+struct nvmem_fuse {
+	std::string name;
+	uint32_t offset, len;		/* bytes */
+	uint32_t bit, nbits;		/* "bits" = <bit_offset nbits> */
+
+	/* nvmem_shift_read_buffer_in_place() on a dump of the fuse block */
+	int extract(const uint8_t *blk, size_t n, uint32_t *val) const
+	{
+		uint64_t v = 0;
+
+		if (!len || len > 8 || offset + len > n)
+			return -ERANGE;
+		for (uint32_t i = 0; i < len; i++)
+			v |= (uint64_t)blk[offset + i] << (8 * i);
+		v >>= bit;
+		if (nbits && nbits < 64)
+			v &= (1ull << nbits) - 1;
+		*val = (uint32_t)v;
+		return 0;
+	}
+};
+
+class kgsl_gpu {
+public:
+	/* @ddr_type picks qcom,bus-table-ddrN; 0 or a missing table: unsuffixed */
+	int load(const dt::tree &t, uint32_t ddr_type)
+	{
+		uint32_t bins, l3;
+		dt::property p;
+		char name[32];
+
+		t_ = &t;
+		node_ = DT_NONE;
+		tables_.clear();
+		ddr_kbps_.clear();
+		cnoc_.clear();
+		l3_hz_.clear();
+		fuses_.clear();
+		for (uint32_t id = 0; id < t.size() && node_ == DT_NONE; id++)
+			if (t.is_compatible(id, "qcom,kgsl-3d0"))
+				node_ = id;
+		if (node_ == DT_NONE)
+			return -ENOENT;
+
+		snprintf(suffix_, sizeof(suffix_), "-ddr%u", ddr_type);
+		snprintf(name, sizeof(name), "qcom,bus-table%s", suffix_);
+		if (!ddr_type || !t.find_prop(node_, name, &p)) {
+			strcpy(suffix_, "-ddr");
+			if (!t.find_prop(node_, "qcom,bus-table-ddr", &p))
+				suffix_[0] = '\0';
+		}
+		if (suffix_[0])
+			for (uint32_t i = 0; i < p.cells(); i++)
+				ddr_kbps_.push_back(p.u32(i));
+		if (t.find_prop(node_, "qcom,bus-table-cnoc", &p))
+			for (uint32_t i = 0; i < p.cells(); i++)
+				cnoc_.push_back(p.u32(i));
+
+		l3 = t.child(node_, "qcom,l3-pwrlevels", 17);
+		for (uint32_t c = l3 == DT_NONE ? DT_NONE : t.first_child(l3);
+		     c != DT_NONE; c = t.next_sibling(c))
+			l3_hz_.push_back(freq(c, "qcom,l3-freq"));
+
+		load_fuses();
+
+		bins = t.child(node_, "qcom,gpu-pwrlevel-bins", 22);
+		if (bins != DT_NONE) {
+			for (uint32_t b = t.first_child(bins); b != DT_NONE; b = t.next_sibling(b))
+				if (!strncmp(t.name(b), "qcom,gpu-pwrlevels", 18))
+					add_table(b, t.prop_u32(b, "qcom,speed-bin", 0));
+		} else {
+			uint32_t b = t.child(node_, "qcom,gpu-pwrlevels", 18);
+
+			if (b != DT_NONE)
+				add_table(b, 0);
+		}
+		return tables_.empty() ? -ENODATA : 0;
+	}
+
+	uint32_t node() const { return node_; }
+	const char *name() const { return t_->name(node_); }
+	const std::vector<pwr_table> &tables() const { return tables_; }
+	const std::vector<uint32_t> &ddr_kbps() const { return ddr_kbps_; }
+	const std::vector<uint32_t> &cnoc() const { return cnoc_; }
+	const std::vector<uint64_t> &l3_hz() const { return l3_hz_; }
+	const std::vector<nvmem_fuse> &fuses() const { return fuses_; }
+
+	const nvmem_fuse *fuse(const char *name) const
+	{
+		for (const nvmem_fuse &f : fuses_)
+			if (f.name == name)
+				return &f;
+		return nullptr;
+	}
+
+	/*
+	 * The levels kgsl would expose for @speed_bin: the bin's table, less
+	 * the gaming levels unless the gaming fuse is blown.
+	 */
+	int select(uint32_t speed_bin, bool gaming, pwr_table *out) const
+	{
+		for (const pwr_table &tb : tables_) {
+			uint32_t dropped = 0;
+
+			if (tb.speed_bin != speed_bin)
+				continue;
+			*out = tb;
+			out->levels.clear();
+			for (const pwrlevel &l : tb.levels) {
+				if (l.gaming && !gaming) {
+					dropped++;
+					continue;
+				}
+				out->levels.push_back(l);
+			}
+			if (out->levels.empty())
+				return -ENODATA;
+			out->initial = tb.initial >= dropped ? tb.initial - dropped : 0;
+			if (out->initial >= out->levels.size())
+				out->initial = (uint32_t)out->levels.size() - 1;
+			return 0;
+		}
+		return -ENOENT;
+	}
+
+	/* DDR vote of a bus table index, kBps; 0 when out of range */
+	uint32_t ddr_vote(int idx) const
+	{
+		return idx >= 0 && (size_t)idx < ddr_kbps_.size() ? ddr_kbps_[idx] : 0;
+	}
+
+private:
+	uint64_t freq(uint32_t id, const char *prop) const
+	{
+		dt::property p;
+
+		if (!t_->find_prop(id, prop, &p))
+			return 0;
+		return p.len == 8 ? p.u64(0) : p.len == 4 ? p.u32() : 0;
+	}
+
+	int index(uint32_t id, const char *what) const
+	{
+		char name[48];
+
+		snprintf(name, sizeof(name), "qcom,bus-%s%s", what, suffix_);
+		return (int)t_->prop_u32(id, name, ~0u);
+	}
+
+	void add_table(uint32_t b, uint32_t bin)
+	{
+		const dt::tree &t = *t_;
+		pwr_table tb;
+
+		tb.node = b;
+		tb.speed_bin = bin;
+		tb.initial = t.prop_u32(b, "qcom,initial-pwrlevel", 0);
+		for (uint32_t c = t.first_child(b); c != DT_NONE; c = t.next_sibling(c)) {
+			pwrlevel l;
+
+			if (strncmp(t.name(c), "qcom,gpu-pwrlevel", 17))
+				continue;
+			l.node = c;
+			l.reg = t.prop_u32(c, "reg", (uint32_t)tb.levels.size());
+			l.hz = freq(c, "qcom,gpu-freq");
+			l.corner = t.prop_u32(c, "qcom,level", 0);
+			l.bus = { index(c, "freq"), index(c, "min"), index(c, "max") };
+			if (l.bus.min < 0)
+				l.bus.min = l.bus.freq;
+			if (l.bus.max < 0)
+				l.bus.max = l.bus.freq;
+			l.acd = t.prop_u32(c, "qcom,acd-level", 0);
+			l.l3_hz = freq(c, "qcom,l3-freq");
+			l.gaming = l.corner > RPMH_REGULATOR_LEVEL_NOM;
+			tb.levels.push_back(l);
+		}
+		/* reg orders the levels; the kernel indexes by it */
+		std::stable_sort(tb.levels.begin(), tb.levels.end(),
+				 [](const pwrlevel &a, const pwrlevel &b) { return a.reg < b.reg; });
+		if (!tb.levels.empty())
+			tables_.push_back(std::move(tb));
+	}
+
+	/* nvmem-cells / nvmem-cell-names pointing into the qfprom */
+	void load_fuses()
+	{
+		const dt::tree &t = *t_;
+		dt::property cells, names;
+		size_t i = 0;
+
+		if (!t.find_prop(node_, "nvmem-cells", &cells) ||
+		    !t.find_prop(node_, "nvmem-cell-names", &names))
+			return;
+		for (const char *n : names.strings()) {
+			uint32_t c;
+			dt::property p;
+			nvmem_fuse f;
+
+			if (i >= cells.cells())
+				break;
+			c = t.by_phandle(cells.u32((uint32_t)i++));
+			if (c == DT_NONE || !t.find_prop(c, "reg", &p) || p.cells() < 2)
+				continue;
+			f.name = n;
+			f.offset = p.u32(0);
+			f.len = p.u32(1);
+			f.bit = f.nbits = 0;
+			if (t.find_prop(c, "bits", &p) && p.cells() >= 2) {
+				f.bit = p.u32(0);
+				f.nbits = p.u32(1);
+			}
+			fuses_.push_back(f);
+		}
+	}
+
+	const dt::tree *t_ = nullptr;
+	uint32_t node_ = DT_NONE;
+	char suffix_[16];
+	std::vector<pwr_table> tables_;
+	std::vector<uint32_t> ddr_kbps_;
+	std::vector<uint32_t> cnoc_;
+	std::vector<uint64_t> l3_hz_;
+	std::vector<nvmem_fuse> fuses_;
+};
+
+} /* namespace gpu */
+
+#endif /* __TOOLS_GPU_KGSL_H__ */
@@ -0,0 +1,600 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Interconnect bandwidth votes of every DT consumer, aggregated over a
+ * NoC topology model.
+ *
+ * Providers are the nodes with #interconnect-cells.  The DT only names a
+ * path's two endpoints, so routes follow the Qualcomm layout: traffic
+ * between two NoCs crosses the hub (gem_noc) unless one end is the hub,
+ * and a path inside one provider touches only that provider.  mc_virt is
+ * the DDR.  Votes aggregate per provider the way icc-rpmh does: ab sums
+ * over every path crossing it, ib takes the max, and what the provider
+ * must run at is max(ab / channels, ib).
+ *
+ * Vote tables come from whatever each driver reads:
+ *  - qcom,msm-bus,vectors-KBps and qcom,ufs-bus-bw,vectors-KBps:
+ *    num-cases rows of <ab ib> per path, in interconnects order;
+ *  - qcom,sde-max-bw-{low,high}-kbps on the MDP data and EBI paths,
+ *    with qcom,sde-reg-bus,vectors-KBps on the register bus;
+ *  - cam-ahb-bw-KBps on cam_ahb, camnoc-axi-min-ib-bw (Bps) on the
+ *    camnoc AXI ports while the camera is on;
+ *  - the kgsl power levels' DDR votes;
+ *  - operating-points-v2 of the devfreq-icc CPU voters.
+ * Consumers with interconnects but no table take explicit votes only.
+ *
+ * Every (consumer, case) is flattened into a dense ab/ib vector over
+ * the providers at load time, so a scenario is a handful of vector adds
+ * and maxes.
+ */
+
+#ifndef __TOOLS_ICC_ICC_H__
+#define __TOOLS_ICC_ICC_H__
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../gpu/kgsl.h"
+
+namespace icc {
+
+#define ICC_MAX_NODES	32
+
+struct provider {
+	std::string name;
+	uint32_t node;
+	uint32_t phandle;
+	uint32_t cells;			/* #interconnect-cells */
+	uint32_t cap_kbps;		/* 0: unknown */
+	uint32_t channels;
+};
+
+struct path {
+	std::string name;
+	int src, dst;			/* providers */
+	uint32_t src_id, dst_id;
+	uint32_t hops;			/* bitmask of providers */
+};
+
+/* One row of a vote table: <ab ib> per path, kBps */
+struct vcase {
+	std::string label;
+	std::vector<uint32_t> ab, ib;
+};
+
+struct alignas(64) contrib {
+	uint32_t ab[ICC_MAX_NODES];
+	uint32_t ib[ICC_MAX_NODES];
+};
+
+struct consumer {
+	std::string name;
+	uint32_t node;
+	const char *source;
+	std::vector<path> paths;
+	std::vector<vcase> cases;
+	std::vector<contrib> dense;	/* per case */
+};
+
+struct icc_opts {
+	uint32_t ddr_type = 7;		/* opp-supported-hw bit */
+	uint32_t ddr_channels = 2;
+};
+
+/* A provider's aggregate and what it must run at, kBps */
+struct agg {
+	alignas(64) uint32_t ab[ICC_MAX_NODES];
+	alignas(64) uint32_t ib[ICC_MAX_NODES];
+	alignas(64) float need[ICC_MAX_NODES];
+	alignas(64) float util[ICC_MAX_NODES];
+	int worst;
+};
+
+class topology {
+public:
+	int load(const dt::tree &t, const icc_opts &o)
+	{
+		t_ = &t;
+		opts_ = o;
+		providers_.clear();
+		consumers_.clear();
+		hub_ = ddr_ = -1;
+
+		for (uint32_t id = 0; id < t.size(); id++) {
+			dt::property p;
+			provider pv;
+
+			if (!t.find_prop(id, "#interconnect-cells", &p) || p.len != 4)
+				continue;
+			if (providers_.size() == ICC_MAX_NODES)
+				return -E2BIG;
+			pv.name = short_compat(id);
+			pv.node = id;
+			pv.phandle = t.rec(id).phandle;
+			pv.cells = p.u32();
+			pv.cap_kbps = 0;
+			pv.channels = 1;
+			if (ends_with(pv.name, "gem_noc"))
+				hub_ = (int)providers_.size();
+			if (ends_with(pv.name, "mc_virt")) {
+				ddr_ = (int)providers_.size();
+				pv.channels = o.ddr_channels;
+			}
+			providers_.push_back(pv);
+		}
+		if (providers_.empty())
+			return -ENOENT;
+
+		for (uint32_t id = 0; id < t.size(); id++) {
+			dt::property p;
+
+			if (!t.find_prop(id, "interconnects", &p) || under_cpas(id))
+				continue;
+			add_consumer(id);
+		}
+		caps_from_opps();
+		for (consumer &c : consumers_)
+			flatten(&c);
+		return consumers_.empty() ? -ENODATA : 0;
+	}
+
+	const std::vector<provider> &providers() const { return providers_; }
+	const std::vector<consumer> &consumers() const { return consumers_; }
+	int ddr() const { return ddr_; }
+	int hub() const { return hub_; }
+	const std::vector<std::pair<std::string, uint32_t>> &ddr_opps() const { return ddr_opps_; }
+
+	int find_provider(const std::string &name) const
+	{
+		for (size_t i = 0; i < providers_.size(); i++)
+			if (providers_[i].name == name || ends_with(providers_[i].name, name))
+				return (int)i;
+		return -1;
+	}
+
+	int find_consumer(const std::string &name) const
+	{
+		for (size_t i = 0; i < consumers_.size(); i++)
+			if (consumers_[i].name == name)
+				return (int)i;
+		return -1;
+	}
+
+	int find_case(int c, const std::string &label) const
+	{
+		const consumer &cs = consumers_[c];
+		char *end;
+		unsigned long n;
+
+		if (label == "max")
+			return (int)cs.cases.size() - 1;
+		for (size_t i = 0; i < cs.cases.size(); i++)
+			if (cs.cases[i].label == label)
+				return (int)i;
+		n = strtoul(label.c_str(), &end, 0);
+		return !*end && !label.empty() && n < cs.cases.size() ? (int)n : -1;
+	}
+
+	void set_capacity(int pv, uint32_t kbps) { providers_[pv].cap_kbps = kbps; }
+
+	/* A one-off vote on one path of @c, as a dense vector */
+	void custom(int c, int path_idx, uint32_t ab, uint32_t ib, contrib *out) const
+	{
+		const path &p = consumers_[c].paths[path_idx];
+
+		memset(out, 0, sizeof(*out));
+		for (uint32_t m = p.hops; m; m &= m - 1) {
+			out->ab[__builtin_ctz(m)] = ab;
+			out->ib[__builtin_ctz(m)] = ib;
+		}
+	}
+
+	/* icc aggregation over @n contributions */
+	void aggregate(const contrib *const *v, size_t n, agg *out) const
+	{
+		uint32_t *__restrict ab = out->ab, *__restrict ib = out->ib;
+		float best = -1;
+
+		memset(out->ab, 0, sizeof(out->ab));
+		memset(out->ib, 0, sizeof(out->ib));
+		for (size_t i = 0; i < n; i++) {
+			const uint32_t *__restrict cab = v[i]->ab, *__restrict cib = v[i]->ib;
+
+			for (int k = 0; k < ICC_MAX_NODES; k++) {
+				ab[k] += cab[k];
+				ib[k] = std::max(ib[k], cib[k]);
+			}
+		}
+		for (int k = 0; k < ICC_MAX_NODES; k++) {
+			out->need[k] = std::max(ab[k] * inv_ch_[k], (float)ib[k]);
+			out->util[k] = out->need[k] * inv_cap_[k];
+		}
+		out->worst = 0;
+		for (int k = 0; k < (int)providers_.size(); k++) {
+			if (out->util[k] > best) {
+				best = out->util[k];
+				out->worst = k;
+			}
+		}
+	}
+
+	/* Smallest DDR OPP covering @kbps, or -1 */
+	int ddr_opp(float kbps) const
+	{
+		for (size_t i = 0; i < ddr_opps_.size(); i++)
+			if (ddr_opps_[i].second >= kbps)
+				return (int)i;
+		return -1;
+	}
+
+	/* Recompute the per-provider scale factors after capacity changes */
+	void finalize()
+	{
+		for (int k = 0; k < ICC_MAX_NODES; k++) {
+			bool real = k < (int)providers_.size();
+
+			inv_ch_[k] = real ? 1.0f / providers_[k].channels : 0;
+			inv_cap_[k] = real && providers_[k].cap_kbps ?
+				      1.0f / providers_[k].cap_kbps : 0;
+		}
+	}
+
+private:
+	static bool ends_with(const std::string &s, const std::string &suf)
+	{
+		return s.size() >= suf.size() && !s.compare(s.size() - suf.size(), suf.size(), suf);
+	}
+
+	/* "qcom,yupik-gem_noc" -> "gem_noc"; non-NoC providers keep their name */
+	std::string short_compat(uint32_t id) const
+	{
+		dt::property p;
+		const char *c, *dash;
+		std::string n = t_->name(id);
+
+		if (!t_->find_prop(id, "compatible", &p) || !p.is_string())
+			return n;
+		c = p.str();
+		if (strstr(c, "epss-l3"))
+			return "l3";
+		dash = strchr(c, '-');
+		return dash ? dash + 1 : c;
+	}
+
+	std::string short_name(uint32_t id) const
+	{
+		std::string n = t_->name(id);
+		size_t at = n.find('@');
+
+		if (!n.compare(0, 5, "qcom,"))
+			n.erase(0, 5);
+		return at == std::string::npos ? n : n.substr(0, n.find('@'));
+	}
+
+	bool under_cpas(uint32_t id) const
+	{
+		for (uint32_t p = t_->rec(id).parent; p != DT_NONE && p; p = t_->rec(p).parent)
+			if (t_->is_compatible(p, "qcom,cam-cpas"))
+				return true;
+		return false;
+	}
+
+	int provider_of(uint32_t phandle) const
+	{
+		for (size_t i = 0; i < providers_.size(); i++)
+			if (providers_[i].phandle == phandle)
+				return (int)i;
+		return -1;
+	}
+
+	uint32_t route(int src, int dst) const
+	{
+		uint32_t m = 1u << src | 1u << dst;
+
+		if (src != dst && src != hub_ && dst != hub_ && hub_ >= 0)
+			m |= 1u << hub_;
+		return m;
+	}
+
+	/* interconnects = <&src id &dst id>... named by interconnect-names */
+	void add_paths(uint32_t id, consumer *c) const
+	{
+		dt::property p, names;
+		std::vector<const char *> nm;
+		uint32_t i = 0;
+
+		if (t_->find_prop(id, "interconnect-names", &names))
+			for (const char *s : names.strings())
+				nm.push_back(s);
+		if (!t_->find_prop(id, "interconnects", &p))
+			return;
+		while (i < p.cells()) {
+			path pt;
+			int s = provider_of(p.u32(i)), d;
+
+			/* Each end is a phandle and its provider's id cells, all present */
+			if (s < 0 || i + 1 + providers_[s].cells > p.cells())
+				return;
+			pt.src = s;
+			pt.src_id = providers_[s].cells ? p.u32(i + 1) : 0;
+			i += 1 + providers_[s].cells;
+			if (i >= p.cells() || (d = provider_of(p.u32(i))) < 0 ||
+			    i + 1 + providers_[d].cells > p.cells())
+				return;
+			pt.dst = d;
+			pt.dst_id = providers_[d].cells ? p.u32(i + 1) : 0;
+			i += 1 + providers_[d].cells;
+			pt.name = c->paths.size() < nm.size() ? nm[c->paths.size()] :
+				  "path" + std::to_string(c->paths.size());
+			pt.hops = route(pt.src, pt.dst);
+			c->paths.push_back(pt);
+		}
+	}
+
+	int path_named(const consumer &c, const char *name) const
+	{
+		for (size_t i = 0; i < c.paths.size(); i++)
+			if (c.paths[i].name == name)
+				return (int)i;
+		return -1;
+	}
+
+	vcase blank(const consumer &c, std::string label) const
+	{
+		vcase v;
+
+		v.label = std::move(label);
+		v.ab.assign(c.paths.size(), 0);
+		v.ib.assign(c.paths.size(), 0);
+		return v;
+	}
+
+	void add_consumer(uint32_t id)
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		consumer c;
+
+		c.name = short_name(id);
+		c.node = id;
+		c.source = "none";
+		for (consumer &o : consumers_) {
+			if (o.name != c.name)
+				continue;
+			/* Clashing names keep their unit address */
+			o.name = t.name(o.node);
+			c.name = t.name(id);
+		}
+		add_paths(id, &c);
+		if (c.paths.empty())
+			return;
+
+		if (t.find_prop(id, "qcom,msm-bus,vectors-KBps", &p))
+			vectors(id, "qcom,msm-bus,", p, &c);
+		else if (t.find_prop(id, "qcom,ufs-bus-bw,vectors-KBps", &p))
+			vectors(id, "qcom,ufs-bus-bw,", p, &c);
+		else if (t.find_prop(id, "qcom,sde-max-bw-high-kbps", &p))
+			sde(id, &c);
+		else if (t.is_compatible(id, "qcom,cam-cpas"))
+			cpas(id, &c);
+		else if (t.is_compatible(id, "qcom,kgsl-3d0"))
+			kgsl(&c);
+		else if (t.find_prop(id, "operating-points-v2", &p))
+			opps(id, p, &c);
+		if (c.cases.empty())
+			c.cases.push_back(blank(c, "off"));
+		consumers_.push_back(std::move(c));
+	}
+
+	/* Legacy msm-bus layout: num-cases rows, num-paths <ab ib> per row */
+	void vectors(uint32_t id, const char *pfx, const dt::property &p, consumer *c)
+	{
+		std::string k(pfx);
+		uint32_t np = t_->prop_u32(id, (k + "num-paths").c_str(), (uint32_t)c->paths.size());
+		uint32_t nc = t_->prop_u32(id, (k + "num-cases").c_str(), 0);
+		std::vector<std::string> labels;
+		dt::property names;
+
+		/* Case names if given, else the bandwidths the cases stand for */
+		if (t_->find_prop(id, "qcom,bus-vector-names", &names))
+			for (const char *s : names.strings())
+				labels.push_back(s);
+		else if (t_->find_prop(id, "qcom,bus-bw-vectors-bps", &names))
+			for (uint32_t i = 0; i < names.cells(); i++)
+				labels.push_back(names.u32(i) == ~0u ? "max" :
+						 std::to_string(names.u32(i)));
+		if (!np || np > c->paths.size())
+			return;
+		if (!nc)
+			nc = p.cells() / (2 * np);
+		c->source = "msm-bus";
+		for (uint32_t r = 0; r < nc && (r + 1) * np * 2 <= p.cells(); r++) {
+			vcase v = blank(*c, r < labels.size() ? labels[r] : "case" + std::to_string(r));
+
+			for (uint32_t k2 = 0; k2 < np; k2++) {
+				v.ab[k2] = p.u32((r * np + k2) * 2);
+				v.ib[k2] = p.u32((r * np + k2) * 2 + 1);
+			}
+			c->cases.push_back(std::move(v));
+		}
+	}
+
+	/* MDP: off / low / high on the data and EBI paths, reg bus alongside */
+	void sde(uint32_t id, consumer *c)
+	{
+		static const char *const lvl[] = { "off", "low", "high" };
+		uint32_t bw[3] = { 0, t_->prop_u32(id, "qcom,sde-max-bw-low-kbps", 0),
+				   t_->prop_u32(id, "qcom,sde-max-bw-high-kbps", 0) };
+		int data = path_named(*c, "qcom,sde-data-bus0");
+		int ebi = path_named(*c, "qcom,sde-ebi-bus");
+		int reg = path_named(*c, "qcom,sde-reg-bus");
+		dt::property rv;
+		bool has_reg = t_->find_prop(id, "qcom,sde-reg-bus,vectors-KBps", &rv) &&
+			       rv.cells() >= 2;
+
+		c->source = "sde";
+		for (int i = 0; i < 3; i++) {
+			vcase v = blank(*c, lvl[i]);
+
+			for (int pth : { data, ebi }) {
+				if (pth >= 0) {
+					v.ab[pth] = bw[i];
+					v.ib[pth] = bw[i];
+				}
+			}
+			if (reg >= 0 && has_reg) {
+				uint32_t row = std::min<uint32_t>(i ? i + 1 : 0, rv.cells() / 2 - 1);
+
+				v.ab[reg] = rv.u32(row * 2);
+				v.ib[reg] = rv.u32(row * 2 + 1);
+			}
+			c->cases.push_back(std::move(v));
+		}
+	}
+
+	/* Camera: the AHB table plus the camnoc AXI ports' minimum ib */
+	void cpas(uint32_t id, consumer *c)
+	{
+		const dt::tree &t = *t_;
+		uint64_t min_ib = 0;
+		dt::property p;
+		int ahb;
+		size_t axi0;
+
+		if (t.find_prop(id, "camnoc-axi-min-ib-bw", &p))
+			min_ib = p.len == 8 ? p.u64(0) : p.u32();
+		axi0 = c->paths.size();
+		for (uint32_t d = id + 1; d < t.rec(id).skip; d++)
+			if (t.find_prop(d, "interconnects", &p))
+				add_paths(d, c);
+		ahb = path_named(*c, "cam_ahb");
+		if (!t.find_prop(id, "cam-ahb-bw-KBps", &p) || p.cells() < 2)
+			return;
+		c->source = "cpas";
+		for (uint32_t r = 0; r < p.cells() / 2; r++) {
+			vcase v = blank(*c, "case" + std::to_string(r));
+
+			if (ahb >= 0) {
+				v.ab[ahb] = p.u32(r * 2);
+				v.ib[ahb] = p.u32(r * 2 + 1);
+			}
+			for (size_t k = axi0; r && k < c->paths.size(); k++)
+				v.ib[k] = (uint32_t)(min_ib / 1000);
+			c->cases.push_back(std::move(v));
+		}
+	}
+
+	/* GPU: each power level's nominal DDR vote, ab = ib as when busy */
+	void kgsl(consumer *c)
+	{
+		gpu::kgsl_gpu g;
+		const gpu::pwr_table *tb;
+		int ddr = path_named(*c, "gpu_icc_path");
+
+		if (ddr < 0 || g.load(*t_, opts_.ddr_type) || g.tables().empty())
+			return;
+		tb = &g.tables()[0];
+		c->source = "kgsl";
+		c->cases.push_back(blank(*c, "off"));
+		for (auto l = tb->levels.rbegin(); l != tb->levels.rend(); ++l) {
+			vcase v = blank(*c, std::to_string(l->hz / 1000000) + "MHz");
+
+			v.ab[ddr] = v.ib[ddr] = g.ddr_vote(l->bus.freq);
+			c->cases.push_back(std::move(v));
+		}
+	}
+
+	std::vector<std::pair<std::string, uint32_t>> opp_table(uint32_t tbl) const
+	{
+		std::vector<std::pair<std::string, uint32_t>> v;
+
+		for (uint32_t c = tbl == DT_NONE ? DT_NONE : t_->first_child(tbl);
+		     c != DT_NONE; c = t_->next_sibling(c)) {
+			dt::property hz, hw;
+
+			if (!t_->find_prop(c, "opp-hz", &hz) || !hz.cells())
+				continue;
+			if (t_->find_prop(c, "opp-supported-hw", &hw) && hw.len == 4 &&
+			    opts_.ddr_type < 32 && !(hw.u32() & (1u << opts_.ddr_type)))
+				continue;
+			/* devfreq-icc tables are MBps */
+			v.push_back({ t_->name(c),
+				      (uint32_t)hz.cell_val(0, hz.cells() >= 2 ? 2 : 1) * 1000 });
+		}
+		std::sort(v.begin(), v.end(), [](const auto &a, const auto &b) {
+			return a.second < b.second;
+		});
+		return v;
+	}
+
+	/* CPU devfreq-icc voters: ib per OPP, ab too under bw_hwmon */
+	void opps(uint32_t id, const dt::property &p, consumer *c)
+	{
+		dt::property gov;
+		bool hwmon = t_->find_prop(id, "governor", &gov) && gov.is_string() &&
+			     !strcmp(gov.str(), "bw_hwmon");
+
+		if (p.len != 4)
+			return;
+		c->source = "devfreq";
+		c->cases.push_back(blank(*c, "off"));
+		for (const auto &o : opp_table(t_->by_phandle(p.u32()))) {
+			vcase v = blank(*c, o.first);
+
+			v.ib[0] = o.second;
+			v.ab[0] = hwmon ? o.second : 0;
+			c->cases.push_back(std::move(v));
+		}
+	}
+
+	/* A provider's ceiling is the top OPP of the devfreq voters ending on it */
+	void caps_from_opps()
+	{
+		for (const consumer &c : consumers_) {
+			dt::property p;
+
+			if (strcmp(c.source, "devfreq") || c.cases.size() < 2)
+				continue;
+			provider &pv = providers_[c.paths[0].dst];
+
+			pv.cap_kbps = std::max(pv.cap_kbps, c.cases.back().ib[0]);
+			if (c.paths[0].dst == ddr_ && ddr_opps_.empty() &&
+			    t_->find_prop(c.node, "operating-points-v2", &p))
+				ddr_opps_ = opp_table(t_->by_phandle(p.u32()));
+		}
+		finalize();
+	}
+
+	void flatten(consumer *c) const
+	{
+		c->dense.assign(c->cases.size(), contrib{});
+		for (size_t i = 0; i < c->cases.size(); i++) {
+			contrib &d = c->dense[i];
+
+			memset(&d, 0, sizeof(d));
+			for (size_t k = 0; k < c->paths.size(); k++) {
+				for (uint32_t m = c->paths[k].hops; m; m &= m - 1) {
+					int n = __builtin_ctz(m);
+
+					d.ab[n] += c->cases[i].ab[k];
+					d.ib[n] = std::max(d.ib[n], c->cases[i].ib[k]);
+				}
+			}
+		}
+	}
+
+	const dt::tree *t_ = nullptr;
+	icc_opts opts_;
+	std::vector<provider> providers_;
+	std::vector<consumer> consumers_;
+	std::vector<std::pair<std::string, uint32_t>> ddr_opps_;
+	int hub_ = -1, ddr_ = -1;
+	alignas(64) float inv_ch_[ICC_MAX_NODES];
+	alignas(64) float inv_cap_[ICC_MAX_NODES];
+};
+
+} /* namespace icc */
+
+#endif /* __TOOLS_ICC_ICC_H__ */
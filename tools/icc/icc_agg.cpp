@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Aggregate the interconnect votes of a DTB's consumers over concurrency
+ * scenarios and find the NoC or DDR that runs out first.
+ *
+ * Build: g++ -std=c++17 -O3 -o icc_agg icc_agg.cpp
+ * Usage: icc_agg [-d ddr_type] [-C ddr_channels] [-c noc=MBps]... -l <blob.dtb>
+ *        icc_agg [options] [-n repeat] [-v] <blob.dtb> <scenarios.txt>
+ *        icc_agg [options] [-k top] -x consumer,consumer... <blob.dtb>
+ *
+ * -l lists providers, consumers, their paths and vote cases.  A scenario
+ * file has one scenario per line:
+ *
+ *   4k-rec: vidc.venus-ddr=2400/3200 mdss_mdp=high ufshc=HS_RB_G4_L2 cam-cpas=max
+ *
+ * each item picking a consumer's case by label, index or "max", or
+ * giving one path an explicit ab/ib in MBps.  For every scenario the
+ * worst provider, its utilisation and the DDR OPP needed are printed;
+ * -v adds every provider's ab/ib.  -x instead sweeps every combination of
+ * the listed consumers' cases and reports how many overload a provider
+ * and the -k worst.  -c sets a provider's capacity where the DT has none.
+ *
+ * Example:
+ *   icc_agg -d 8 -x mdss_mdp,ufshc,kgsl-3d0,cam-cpas,sdhci@7C4000 yupik.dtb
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "icc.h"
+#include "../lib/csv.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+struct scenario {
+	std::string name;
+	std::vector<std::pair<int, int>> picks;		/* consumer, case */
+	std::vector<icc::contrib> custom;
+	std::vector<const icc::contrib *> v;
+};
+
+static void list(const icc::topology &tp)
+{
+	for (const icc::provider &p : tp.providers()) {
+		printf("provider %s", p.name.c_str());
+		if (p.cap_kbps)
+			printf(": %u MBps", p.cap_kbps / 1000);
+		if (p.channels > 1)
+			printf(" x%u channels", p.channels);
+		printf("\n");
+	}
+	for (const icc::consumer &c : tp.consumers()) {
+		printf("consumer %s (%s)\n", c.name.c_str(), c.source);
+		for (const icc::path &p : c.paths) {
+			printf("  path %s: %s:%u -> %s:%u via", p.name.c_str(),
+			       tp.providers()[p.src].name.c_str(), p.src_id,
+			       tp.providers()[p.dst].name.c_str(), p.dst_id);
+			for (uint32_t m = p.hops; m; m &= m - 1)
+				printf(" %s", tp.providers()[__builtin_ctz(m)].name.c_str());
+			printf("\n");
+		}
+		for (size_t i = 0; i < c.cases.size(); i++) {
+			printf("  %zu %s:", i, c.cases[i].label.c_str());
+			for (size_t k = 0; k < c.paths.size(); k++)
+				printf(" %u/%u", c.cases[i].ab[k] / 1000, c.cases[i].ib[k] / 1000);
+			printf("\n");
+		}
+	}
+}
+
+static int parse_item(const icc::topology &tp, const char *b, const char *e, scenario *sc)
+{
+	std::string it(b, e), who, what;
+	size_t eq = it.find('='), dot;
+	unsigned int ab, ib;
+	int c, cs;
+
+	if (eq == std::string::npos)
+		return -EINVAL;
+	who = it.substr(0, eq);
+	what = it.substr(eq + 1);
+	if (sscanf(what.c_str(), "%u/%u", &ab, &ib) == 2) {
+		const icc::consumer *con;
+		int path = -1;
+
+		dot = who.rfind('.');
+		c = tp.find_consumer(dot == std::string::npos ? who : who.substr(0, dot));
+		if (c < 0)
+			return -ENOENT;
+		con = &tp.consumers()[c];
+		for (size_t i = 0; i < con->paths.size(); i++)
+			if (dot == std::string::npos ? !i : con->paths[i].name == who.substr(dot + 1))
+				path = (int)i;
+		if (path < 0)
+			return -ENOENT;
+		sc->custom.emplace_back();
+		tp.custom(c, path, ab * 1000, ib * 1000, &sc->custom.back());
+		return 0;
+	}
+	c = tp.find_consumer(who);
+	if (c < 0 || (cs = tp.find_case(c, what)) < 0)
+		return -ENOENT;
+	sc->picks.push_back({ c, cs });
+	return 0;
+}
+
+static int parse_scenario(const icc::topology &tp, const char *b, const char *e, scenario *sc)
+{
+	const char *colon = static_cast<const char *>(memchr(b, ':', e - b));
+
+	if (!colon)
+		return -EINVAL;
+	sc->name.assign(b, colon);
+	for (const char *p = colon + 1; p < e;) {
+		const char *q;
+		int ret;
+
+		while (p < e && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+		for (q = p; q < e && *q != ' ' && *q != '\t' && *q != ','; q++)
+			;
+		if (q == p)
+			break;
+		ret = parse_item(tp, p, q, sc);
+		if (ret) {
+			fprintf(stderr, "%s: bad item '%.*s'\n", sc->name.c_str(), (int)(q - p), p);
+			return ret;
+		}
+		p = q;
+	}
+	for (const auto &pk : sc->picks)
+		sc->v.push_back(&tp.consumers()[pk.first].dense[pk.second]);
+	for (const icc::contrib &c : sc->custom)
+		sc->v.push_back(&c);
+	return 0;
+}
+
+static void print_agg(const icc::topology &tp, const icc::agg &a, bool verbose)
+{
+	const icc::provider &w = tp.providers()[a.worst];
+	int ddr = tp.ddr(), opp = ddr >= 0 ? tp.ddr_opp(a.need[ddr]) : -1;
+
+	if (a.util[a.worst] > 0)
+		printf("  worst %s %.1f%%", w.name.c_str(), 100 * a.util[a.worst]);
+	else
+		printf("  no capped provider loaded");
+	if (ddr >= 0)
+		printf(", ddr needs %.0f MBps (%s)", a.need[ddr] / 1000,
+		       opp >= 0 ? tp.ddr_opps()[opp].first.c_str() : "over the top OPP");
+	printf("\n");
+	if (!verbose)
+		return;
+	for (size_t k = 0; k < tp.providers().size(); k++) {
+		if (!a.ab[k] && !a.ib[k])
+			continue;
+		printf("    %-16s ab %7u ib %7u need %7u MBps", tp.providers()[k].name.c_str(),
+		       a.ab[k] / 1000, a.ib[k] / 1000, (uint32_t)(a.need[k] / 1000));
+		if (tp.providers()[k].cap_kbps)
+			printf(" %5.1f%%", 100 * a.util[k]);
+		printf("\n");
+	}
+}
+
+/* Every combination of the listed consumers' cases, odometer order */
+static int sweep(const icc::topology &tp, const char *spec, int top)
+{
+	std::vector<int> cons, idx;
+	std::vector<const icc::contrib *> v;
+	std::vector<std::pair<float, std::vector<int>>> worst;
+	uint64_t n = 0, over = 0;
+	icc::agg a;
+	double t0, t1;
+
+	for (const char *p = spec; *p;) {
+		const char *q = strchr(p, ',');
+		std::string name = q ? std::string(p, q) : std::string(p);
+		int c = tp.find_consumer(name);
+
+		if (c < 0) {
+			fprintf(stderr, "%s: no such consumer\n", name.c_str());
+			return -ENOENT;
+		}
+		cons.push_back(c);
+		p = q ? q + 1 : p + strlen(p);
+	}
+	idx.assign(cons.size(), 0);
+	v.resize(cons.size());
+
+	t0 = now_us();
+	for (;;) {
+		size_t i;
+		float u;
+
+		for (i = 0; i < cons.size(); i++)
+			v[i] = &tp.consumers()[cons[i]].dense[idx[i]];
+		tp.aggregate(v.data(), v.size(), &a);
+		u = a.util[a.worst];
+		n++;
+		over += u > 1;
+		if ((int)worst.size() < top || u > worst.back().first) {
+			if ((int)worst.size() == top)
+				worst.pop_back();
+			worst.push_back({ u, idx });
+			std::sort(worst.begin(), worst.end(), [](const auto &x, const auto &y) {
+				return x.first > y.first;
+			});
+		}
+		for (i = 0; i < cons.size(); i++) {
+			if (++idx[i] < (int)tp.consumers()[cons[i]].cases.size())
+				break;
+			idx[i] = 0;
+		}
+		if (i == cons.size())
+			break;
+	}
+	t1 = now_us();
+
+	printf("%lu scenarios, %lu overload a provider\n", (unsigned long)n, (unsigned long)over);
+	for (const auto &w : worst) {
+		printf("%.1f%%:", 100 * w.first);
+		for (size_t i = 0; i < cons.size(); i++)
+			printf(" %s=%s", tp.consumers()[cons[i]].name.c_str(),
+			       tp.consumers()[cons[i]].cases[w.second[i]].label.c_str());
+		printf("\n");
+		for (size_t i = 0; i < cons.size(); i++)
+			v[i] = &tp.consumers()[cons[i]].dense[w.second[i]];
+		tp.aggregate(v.data(), v.size(), &a);
+		print_agg(tp, a, false);
+	}
+	fprintf(stderr, "%.1f ms, %.2f M scenarios/s\n", (t1 - t0) / 1e3, n / (t1 - t0));
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::pair<std::string, uint32_t>> caps;
+	std::vector<scenario> scs;
+	icc::topology tp;
+	icc::icc_opts o;
+	const char *sweep_spec = nullptr;
+	bool do_list = false, verbose = false;
+	int opt, ret, repeat = 1, top = 10;
+	double t0, t1;
+	dt::file f;
+	icc::agg a;
+
+	while ((opt = getopt(argc, argv, "d:C:c:ln:vx:k:")) != -1) {
+		switch (opt) {
+		case 'd':
+			o.ddr_type = (uint32_t)atoi(optarg);
+			break;
+		case 'C':
+			o.ddr_channels = (uint32_t)atoi(optarg);
+			break;
+		case 'c': {
+			const char *eq = strchr(optarg, '=');
+
+			if (!eq)
+				return 1;
+			caps.push_back({ std::string(optarg, eq - optarg), (uint32_t)atoi(eq + 1) * 1000 });
+			break;
+		}
+		case 'l':
+			do_list = true;
+			break;
+		case 'n':
+			repeat = atoi(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'x':
+			sweep_spec = optarg;
+			break;
+		case 'k':
+			top = atoi(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != (do_list || sweep_spec ? 1 : 2) || !o.ddr_channels ||
+	    repeat < 1 || top < 1) {
+		fprintf(stderr,
+			"usage: %s [-d ddr_type] [-C ddr_channels] [-c noc=MBps]... -l <blob.dtb>\n"
+			"       %s [options] [-n repeat] [-v] <blob.dtb> <scenarios.txt>\n"
+			"       %s [options] [-k top] -x consumer,consumer... <blob.dtb>\n",
+			argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	ret = f.open(argv[optind]);
+	if (!ret)
+		ret = tp.load(f.index(), o);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	for (const auto &c : caps) {
+		int pv = tp.find_provider(c.first);
+
+		if (pv < 0) {
+			fprintf(stderr, "%s: no such provider\n", c.first.c_str());
+			return 1;
+		}
+		tp.set_capacity(pv, c.second);
+	}
+	tp.finalize();
+
+	if (do_list) {
+		list(tp);
+		return 0;
+	}
+	if (sweep_spec)
+		return sweep(tp, sweep_spec, top) ? 1 : 0;
+
+	{
+		lib::mapped_file m;
+		const char *p, *end;
+
+		ret = m.open(argv[optind + 1]);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(-ret));
+			return 1;
+		}
+		p = reinterpret_cast<const char *>(m.data());
+		end = p + m.size();
+		while (p < end) {
+			const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+
+			if (!nl)
+				nl = end;
+			if (nl > p && *p != '#') {
+				scs.emplace_back();
+				if (parse_scenario(tp, p, nl, &scs.back()))
+					return 1;
+			}
+			p = nl + 1;
+		}
+	}
+
+	t0 = now_us();
+	for (int r = 0; r < repeat; r++)
+		for (const scenario &sc : scs)
+			tp.aggregate(sc.v.data(), sc.v.size(), &a);
+	t1 = now_us();
+
+	for (const scenario &sc : scs) {
+		printf("%s:\n", sc.name.c_str());
+		tp.aggregate(sc.v.data(), sc.v.size(), &a);
+		print_agg(tp, a, verbose);
+	}
+	fprintf(stderr, "%lu evaluations in %.1f ms (%.2f M scenarios/s)\n",
+		(unsigned long)scs.size() * repeat, (t1 - t0) / 1e3,
+		scs.size() * repeat / (t1 - t0));
+	return 0;
+}
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Minimal zero-copy reader for the comma separated traces the simulators
+ * replay.  The file is mapped once; fields are handed out as [begin, end)
+ * pointer pairs and numbers are parsed in place.  Lines starting with '#'
+ * and blank lines are skipped.  No quoting: trace fields never need it.
+ */
+
+#ifndef __TOOLS_LIB_CSV_H__
+#define __TOOLS_LIB_CSV_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string_view>
+
+#include "mapped_file.h"
+
+namespace csv {
+
+#define CSV_MAX_FIELDS	64
+
+struct row {
+	const char *f[CSV_MAX_FIELDS];
+	const char *e[CSV_MAX_FIELDS];
+	int n;
+
+	std::string_view str(int i) const
+	{
+		return i < n ? std::string_view(f[i], e[i] - f[i]) : std::string_view();
+	}
+
+	/* Unsigned decimal; stops at the first non-digit */
+	uint64_t u64(int i) const
+	{
+		uint64_t v = 0;
+
+		if (i >= n)
+			return 0;
+		for (const char *p = f[i]; p < e[i] && *p >= '0' && *p <= '9'; p++)
+			v = v * 10 + (*p - '0');
+		return v;
+	}
+
+	int64_t i64(int i) const
+	{
+		if (i < n && f[i] < e[i] && *f[i] == '-') {
+			row r = *this;
+
+			r.f[i]++;
+			return -(int64_t)r.u64(i);
+		}
+		return (int64_t)u64(i);
+	}
+
+	/* Decimal with optional fraction; enough for trace data */
+	double dbl(int i) const
+	{
+		const char *p, *end;
+		double v = 0, scale = 1;
+		bool neg = false;
+
+		if (i >= n)
+			return 0;
+		p = f[i];
+		end = e[i];
+		if (p < end && *p == '-') {
+			neg = true;
+			p++;
+		}
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			v = v * 10 + (*p - '0');
+		if (p < end && *p == '.')
+			for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+				v += (*p - '0') * (scale *= 0.1);
+		return neg ? -v : v;
+	}
+
+	/* Column index of @name in a header row, -1 if absent */
+	int find(std::string_view name) const
+	{
+		for (int i = 0; i < n; i++)
+			if (str(i) == name)
+				return i;
+		return -1;
+	}
+};
+
+class reader {
+public:
+	int open(const char *path)
+	{
+		int ret = map_.open(path);
+
+		if (ret)
+			return ret;
+		attach(reinterpret_cast<const char *>(map_.data()), map_.size());
+		return 0;
+	}
+
+	/* Read from a caller-owned buffer instead of a file */
+	void attach(const char *buf, size_t len)
+	{
+		base_ = p_ = buf;
+		end_ = buf + len;
+		line_ = 0;
+	}
+
+	/* Split the next data line into @r; false at end of input */
+	bool next(row *r, char sep = ',')
+	{
+		for (;;) {
+			const char *nl, *p;
+
+			if (p_ >= end_)
+				return false;
+			nl = static_cast<const char *>(memchr(p_, '\n', end_ - p_));
+			if (!nl)
+				nl = end_;
+			p = p_;
+			p_ = nl + 1;
+			line_++;
+			if (nl > p && nl[-1] == '\r')
+				nl--;
+			if (p == nl || *p == '#')
+				continue;
+
+			r->n = 0;
+			while (r->n < CSV_MAX_FIELDS) {
+				const char *s = static_cast<const char *>(
+					memchr(p, sep, nl - p));
+
+				if (!s)
+					s = nl;
+				r->f[r->n] = trim_front(p, s);
+				r->e[r->n] = trim_back(r->f[r->n], s);
+				r->n++;
+				if (s == nl)
+					break;
+				p = s + 1;
+			}
+			return true;
+		}
+	}
+
+	unsigned long line() const { return line_; }
+
+	/* Rewind to the first line */
+	void rewind()
+	{
+		p_ = base_;
+		line_ = 0;
+	}
+
+private:
+	static const char *trim_front(const char *p, const char *e)
+	{
+		while (p < e && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	static const char *trim_back(const char *b, const char *e)
+	{
+		while (e > b && (e[-1] == ' ' || e[-1] == '\t'))
+			e--;
+		return e;
+	}
+
+	lib::mapped_file map_;
+	const char *base_ = nullptr, *p_ = nullptr, *end_ = nullptr;
+	unsigned long line_ = 0;
+};
+
+} /* namespace csv */
+
+#endif /* __TOOLS_LIB_CSV_H__ */
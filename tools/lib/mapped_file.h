@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Read-only mapping of a whole file, for the tools that parse blobs,
+ * dumps and traces in place.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_LIB_MAPPED_FILE_H__
+#define __TOOLS_LIB_MAPPED_FILE_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lib {
+
+/*
+ * Read-only mapping of a file.  Move-only; unmaps on destruction.
+ */
+class mapped_file {
+public:
+	mapped_file() = default;
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	mapped_file(mapped_file &&o) noexcept : addr_(o.addr_), size_(o.size_)
+	{
+		o.addr_ = nullptr;
+		o.size_ = 0;
+	}
+
+	mapped_file &operator=(mapped_file &&o) noexcept
+	{
+		if (this != &o) {
+			reset();
+			addr_ = o.addr_;
+			size_ = o.size_;
+			o.addr_ = nullptr;
+			o.size_ = 0;
+		}
+		return *this;
+	}
+
+	~mapped_file() { reset(); }
+
+	int open(const char *path)
+	{
+		struct stat st;
+		void *p;
+		int fd, ret = 0;
+
+		reset();
+		fd = ::open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+		if (fstat(fd, &st) < 0) {
+			ret = -errno;
+			goto out;
+		}
+		if (!st.st_size) {
+			ret = -EINVAL;
+			goto out;
+		}
+		p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			ret = -errno;
+			goto out;
+		}
+		addr_ = static_cast<const uint8_t *>(p);
+		size_ = st.st_size;
+	out:
+		::close(fd);
+		return ret;
+	}
+
+	void reset()
+	{
+		if (addr_)
+			munmap(const_cast<uint8_t *>(addr_), size_);
+		addr_ = nullptr;
+		size_ = 0;
+	}
+
+	const uint8_t *data() const { return addr_; }
+	size_t size() const { return size_; }
+
+private:
+	const uint8_t *addr_ = nullptr;
+	size_t size_ = 0;
+};
+
+} /* namespace lib */
+
+#endif /* __TOOLS_LIB_MAPPED_FILE_H__ */
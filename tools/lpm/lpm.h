@@ -0,0 +1,629 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * CPU and cluster low-power mode selection, replayed over idle intervals.
+ *
+ * The levels come from qcom,lpm-levels: each qcom,pm-cluster holds its
+ * qcom,pm-cluster-level nodes, qcom,pm-cpu groups naming their CPUs in
+ * qcom,cpu with qcom,pm-cpu-level nodes, and possibly nested clusters.
+ * Without lpm-levels the generic cpu-idle-states are used, with WFI as
+ * an implicit level 0 and no cluster levels.
+ *
+ * Selection follows the msm lpm-levels driver: walk the levels from the
+ * shallowest and stop at the first whose exit latency reaches the PM QoS
+ * request or whose min-residency-us exceeds the expected sleep; cluster
+ * levels also need every child to sit at or below qcom,min-child-idx.
+ * The expected sleep is the next timer, or the mean of the last ten
+ * idle periods when they are tight enough (qcom,ref-stddev); a wrong
+ * prediction is cut short by a timer qcom,tmr-add after it, and the
+ * CPU reselects against its timer.
+ *
+ * The DT has no idle power, so energy is relative: each level has a
+ * power fraction of its group's level 0, and min-residency-us is taken
+ * as the break-even against level 0.  Staying d us in a level then
+ * saves (1 - power) * (d - min_residency), which goes negative for a
+ * premature exit.  Cluster savings are weighted by the cluster's level 0
+ * power in units of one CPU's.
+ */
+
+#ifndef __TOOLS_LPM_LPM_H__
+#define __TOOLS_LPM_LPM_H__
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../dt/cpus.h"
+#include "../lib/csv.h"
+
+namespace lpm {
+
+#define LPM_HISTORY		10
+#define LPM_NO_QOS		UINT32_MAX
+
+struct level {
+	uint32_t node;
+	std::string name;
+	uint32_t entry_us, exit_us, min_res_us;
+	uint32_t psci;			/* qcom,psci-mode / qcom,psci-cpu-mode */
+	uint32_t min_child;		/* qcom,min-child-idx */
+	bool reset, notify_rpm;
+	double power;			/* fraction of level 0 */
+};
+
+struct cpu_group {
+	uint32_t node;
+	uint64_t cpus;
+	int cluster;			/* -1: none */
+	uint32_t ref_stddev;		/* us, 0: no prediction */
+	uint32_t tmr_add;
+	std::vector<level> levels;
+};
+
+struct cluster {
+	uint32_t node;
+	std::string name;
+	int parent;
+	uint64_t cpus;			/* every CPU beneath */
+	std::vector<int> groups, children;
+	std::vector<level> levels;
+};
+
+/* A device's CPU latency request */
+struct qos_source {
+	uint32_t node;
+	std::string name;
+	const char *prop;
+	uint64_t cpus;
+	uint32_t us;
+};
+
+class lpm_model {
+public:
+	int load(const dt::tree &t, const dt::cpu_topology &cpus)
+	{
+		uint32_t root = DT_NONE;
+
+		t_ = &t;
+		cpus_ = &cpus;
+		groups_.clear();
+		clusters_.clear();
+		qos_.clear();
+		for (uint32_t id = 0; id < t.size() && root == DT_NONE; id++)
+			if (t.is_compatible(id, "qcom,lpm-levels"))
+				root = id;
+		if (root != DT_NONE) {
+			for (uint32_t c = t.first_child(root); c != DT_NONE; c = t.next_sibling(c))
+				if (!strncmp(t.name(c), "qcom,pm-cluster", 15))
+					add_cluster(c, -1);
+		} else {
+			load_idle_states();
+		}
+		load_qos();
+		return groups_.empty() ? -ENODATA : 0;
+	}
+
+	const std::vector<cpu_group> &groups() const { return groups_; }
+	const std::vector<cluster> &clusters() const { return clusters_; }
+	const std::vector<qos_source> &qos() const { return qos_; }
+
+	int group_of(int cpu) const
+	{
+		for (size_t i = 0; i < groups_.size(); i++)
+			if (groups_[i].cpus >> cpu & 1)
+				return (int)i;
+		return -1;
+	}
+
+	/* Override the power of every level called @name; count of matches */
+	int set_power(const char *name, double power)
+	{
+		int n = 0;
+
+		for (cpu_group &g : groups_)
+			for (level &l : g.levels)
+				if (l.name == name) {
+					l.power = power;
+					n++;
+				}
+		for (cluster &c : clusters_)
+			for (level &l : c.levels)
+				if (l.name == name) {
+					l.power = power;
+					n++;
+				}
+		return n;
+	}
+
+private:
+	/*
+	 * Defaults until measured: CPU levels by PSCI state (WFI, retention,
+	 * power collapse, rail collapse), cluster levels halving per step.
+	 */
+	static double cpu_power(uint32_t psci, size_t idx)
+	{
+		switch (psci) {
+		case 1:
+			return 1.0;
+		case 2:
+			return 0.5;
+		case 3:
+			return 0.15;
+		case 4:
+			return 0.05;
+		}
+		return idx ? 0.5 / idx : 1.0;
+	}
+
+	level parse_level(uint32_t id, bool cpu, size_t idx) const
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		level l;
+
+		l.node = id;
+		l.name = t.find_prop(id, "idle-state-name", &p) && p.is_string() ? p.str() :
+			 t.name(id);
+		l.entry_us = t.prop_u32(id, "entry-latency-us", 0);
+		l.exit_us = t.prop_u32(id, "exit-latency-us", 0);
+		l.min_res_us = t.prop_u32(id, "min-residency-us", l.entry_us + l.exit_us);
+		l.psci = t.prop_u32(id, cpu ? "qcom,psci-cpu-mode" : "qcom,psci-mode", 0);
+		l.min_child = t.prop_u32(id, "qcom,min-child-idx", 0);
+		l.reset = t.find_prop(id, "qcom,is-reset", &p);
+		l.notify_rpm = t.find_prop(id, "qcom,notify-rpm", &p);
+		l.power = cpu ? cpu_power(l.psci, idx) : ldexp(1.0, -(int)idx);
+		return l;
+	}
+
+	void add_levels(uint32_t id, const char *prefix, bool cpu, std::vector<level> *out) const
+	{
+		const dt::tree &t = *t_;
+		size_t n = strlen(prefix);
+
+		for (uint32_t c = t.first_child(id); c != DT_NONE; c = t.next_sibling(c))
+			if (!strncmp(t.name(c), prefix, n))
+				out->push_back(parse_level(c, cpu, out->size()));
+	}
+
+	int add_cluster(uint32_t id, int parent)
+	{
+		const dt::tree &t = *t_;
+		int k = (int)clusters_.size();
+		dt::property p;
+
+		clusters_.emplace_back();
+		clusters_[k].node = id;
+		clusters_[k].name = t.find_prop(id, "idle-state-name", &p) && p.is_string() ?
+				    p.str() : t.name(id);
+		clusters_[k].parent = parent;
+		clusters_[k].cpus = 0;
+		add_levels(id, "qcom,pm-cluster-level", false, &clusters_[k].levels);
+
+		for (uint32_t c = t.first_child(id); c != DT_NONE; c = t.next_sibling(c)) {
+			if (!strncmp(t.name(c), "qcom,pm-cluster-level", 21))
+				continue;
+			if (!strncmp(t.name(c), "qcom,pm-cluster", 15)) {
+				int child = add_cluster(c, k);
+
+				clusters_[k].children.push_back(child);
+				clusters_[k].cpus |= clusters_[child].cpus;
+			} else if (!strncmp(t.name(c), "qcom,pm-cpu", 11)) {
+				cpu_group g;
+
+				if (!t.find_prop(c, "qcom,cpu", &p))
+					continue;
+				g.node = c;
+				g.cpus = cpus_->mask(t, p);
+				g.cluster = k;
+				g.ref_stddev = t.prop_u32(c, "qcom,ref-stddev", 0);
+				g.tmr_add = t.prop_u32(c, "qcom,tmr-add", 0);
+				add_levels(c, "qcom,pm-cpu-level", true, &g.levels);
+				if (g.levels.empty() || !g.cpus)
+					continue;
+				clusters_[k].groups.push_back((int)groups_.size());
+				clusters_[k].cpus |= g.cpus;
+				groups_.push_back(std::move(g));
+			}
+		}
+		return k;
+	}
+
+	/* cpu-idle-states, grouping CPUs that list the same states */
+	void load_idle_states()
+	{
+		const dt::tree &t = *t_;
+
+		for (int cpu = 0; cpu < cpus_->count(); cpu++) {
+			uint32_t node = cpus_->cpu(cpu).node;
+			dt::property p, q;
+			bool found = false;
+
+			if (!t.find_prop(node, "cpu-idle-states", &p))
+				continue;
+			for (cpu_group &g : groups_) {
+				int first = __builtin_ctzll(g.cpus);
+
+				t.find_prop(cpus_->cpu(first).node, "cpu-idle-states", &q);
+				if (q.len == p.len && !memcmp(q.data, p.data, p.len)) {
+					g.cpus |= 1ull << cpu;
+					found = true;
+					break;
+				}
+			}
+			if (found)
+				continue;
+
+			cpu_group g;
+			level wfi = { DT_NONE, "wfi", 1, 1, 1, 1, 0, false, false, 1.0 };
+
+			g.node = node;
+			g.cpus = 1ull << cpu;
+			g.cluster = -1;
+			g.ref_stddev = g.tmr_add = 0;
+			g.levels.push_back(wfi);
+			for (uint32_t i = 0; i < p.cells(); i++) {
+				uint32_t s = t.by_phandle(p.u32(i));
+
+				if (s != DT_NONE)
+					g.levels.push_back(parse_level(s, true, g.levels.size()));
+			}
+			groups_.push_back(std::move(g));
+		}
+	}
+
+	/*
+	 * Latency requests drivers place from DT values, each with the
+	 * property holding its CPU mask when it is not all CPUs.
+	 */
+	void load_qos()
+	{
+		static const struct {
+			const char *prop, *mask;
+		} props[] = {
+			{ "qcom,qos-latency-us", nullptr },
+			{ "qcom,pm-qos-latency", nullptr },
+			{ "qcom,sde-qos-cpu-dma-latency", "qcom,sde-qos-cpu-mask" },
+			{ "qcom,sde-qos-cpu-irq-latency", "qcom,sde-qos-cpu-mask" },
+			{ "qcom,qos-cpu-latency-us", "qcom,qos-cpu-mask" },
+		};
+		const dt::tree &t = *t_;
+		uint64_t all = cpus_->count() >= 64 ? ~0ull : (1ull << cpus_->count()) - 1;
+
+		for (uint32_t id = 0; id < t.size(); id++) {
+			for (const auto &q : props) {
+				dt::property p;
+				qos_source s;
+				char buf[64];
+
+				if (!t.find_prop(id, q.prop, &p) || p.len != 4)
+					continue;
+				s.node = id;
+				s.name = t.name(id);
+				if (s.name.compare(0, 5, "qcom,") == 0)
+					s.name.erase(0, 5);
+				if (s.name.find('@') != std::string::npos)
+					s.name.erase(s.name.find('@'));
+				for (const qos_source &o : qos_)
+					if (o.name == s.name && o.node != id) {
+						snprintf(buf, sizeof(buf), "%s@%u", s.name.c_str(), id);
+						s.name = buf;
+					}
+				s.prop = q.prop;
+				s.us = p.u32();
+				s.cpus = q.mask ? t.prop_u32(id, q.mask, (uint32_t)all) & all : all;
+				qos_.push_back(std::move(s));
+			}
+		}
+	}
+
+	const dt::tree *t_ = nullptr;
+	const dt::cpu_topology *cpus_ = nullptr;
+	std::vector<cpu_group> groups_;
+	std::vector<cluster> clusters_;
+	std::vector<qos_source> qos_;
+};
+
+struct sim_opts {
+	bool predict = true;
+	double cluster_weight = 2.0;	/* cluster level 0 power, in CPUs */
+};
+
+struct level_stats {
+	uint64_t res_us = 0;
+	uint32_t entries = 0;
+	uint32_t premature = 0;		/* left before min-residency-us */
+};
+
+struct cpu_stats {
+	uint64_t idle_us = 0;
+	uint32_t wakes = 0;
+	uint32_t pred_wakes = 0;	/* woken by the prediction timer */
+	uint32_t worst_lat_us = 0;
+	uint32_t violations = 0;	/* wakeup latency above the request */
+};
+
+class lpm_sim {
+public:
+	/* @qos_us: per CPU latency request, LPM_NO_QOS for none */
+	int init(const lpm_model &m, const std::vector<uint32_t> &qos_us, const sim_opts &o)
+	{
+		size_t ncpu = qos_us.size();
+
+		m_ = &m;
+		opts_ = o;
+		qos_ = qos_us;
+		cpu_.assign(ncpu, cpu_state());
+		cpu_stats_.assign(ncpu, cpu_stats());
+		group_stats_.clear();
+		for (const cpu_group &g : m.groups())
+			group_stats_.emplace_back(g.levels.size());
+		cluster_stats_.clear();
+		for (const cluster &c : m.clusters())
+			cluster_stats_.emplace_back(c.levels.size());
+		cl_level_.assign(m.clusters().size(), -1);
+		cl_end_.assign(m.clusters().size(), 0);
+		cl_idle_us_.assign(m.clusters().size(), 0);
+		cpu_saving_ = cl_saving_ = 0;
+		skipped_ = 0;
+		now_ = 0;
+		first_ = UINT64_MAX;
+		last_ = 0;
+		return 0;
+	}
+
+	/* time_us, cpu, idle_us; timer_us (time to the next timer) optional */
+	int bind(const csv::row &hdr)
+	{
+		c_t_ = hdr.find("time_us");
+		c_cpu_ = hdr.find("cpu");
+		c_idle_ = hdr.find("idle_us");
+		c_timer_ = hdr.find("timer_us");
+		return c_t_ < 0 || c_cpu_ < 0 || c_idle_ < 0 ? -EINVAL : 0;
+	}
+
+	/*
+	 * One idle period, entered at time_us.  Rows must come in time
+	 * order; a row before the CPU's previous wakeup is dropped.
+	 * @chosen(t, cpu, cluster, level, us) sees every level entered,
+	 * cluster -1 for the CPU's own level.
+	 */
+	template <typename F>
+	void sample(const csv::row &r, F chosen)
+	{
+		uint64_t t = r.u64(c_t_), d = r.u64(c_idle_);
+		uint64_t timer = c_timer_ >= 0 ? r.u64(c_timer_) : d;
+		int64_t cpu = r.i64(c_cpu_);
+		int g;
+
+		if (cpu < 0 || (size_t)cpu >= cpu_.size() || t < now_ || !d ||
+		    t < cpu_[cpu].end || (g = m_->group_of((int)cpu)) < 0) {
+			skipped_++;
+			return;
+		}
+		now_ = t;
+		first_ = std::min(first_, t);
+		last_ = std::max(last_, t + d);
+		enter_cpu((int)cpu, g, t, d, timer, chosen);
+		enter_clusters((int)cpu, g, t, chosen);
+	}
+
+	const std::vector<std::vector<level_stats>> &group_stats() const { return group_stats_; }
+	const std::vector<std::vector<level_stats>> &cluster_stats() const { return cluster_stats_; }
+	const std::vector<cpu_stats> &cpus() const { return cpu_stats_; }
+	uint64_t cluster_idle_us(int k) const { return cl_idle_us_[k]; }
+	double cpu_saving() const { return cpu_saving_; }
+	double cluster_saving() const { return cl_saving_; }
+	uint64_t skipped() const { return skipped_; }
+	uint64_t span_us() const { return last_ > first_ ? last_ - first_ : 0; }
+
+private:
+	struct cpu_state {
+		uint64_t end = 0;		/* idle until */
+		uint64_t wake = 0;		/* first wakeup, the prediction timer */
+		uint64_t expect = 0;		/* what the governor expected before it */
+		uint64_t timer = 0;		/* next timer */
+		int lvl = 0, lvl2 = 0;		/* before and after @wake */
+		uint64_t hist[LPM_HISTORY] = {};
+		uint32_t nhist = 0;
+	};
+
+	/* lpm_cpuidle_predict(): mean of the history once it is tight */
+	static bool predict(const cpu_state &s, uint32_t ref_stddev, uint64_t *out)
+	{
+		uint64_t v[LPM_HISTORY];
+		size_t n = LPM_HISTORY;
+
+		if (s.nhist < LPM_HISTORY || !ref_stddev)
+			return false;
+		std::copy(s.hist, s.hist + n, v);
+		/* Drop the largest sample at a time while the spread is too wide */
+		for (int tries = 0; tries < 3; tries++) {
+			double sum = 0, sq = 0, avg;
+
+			for (size_t i = 0; i < n; i++)
+				sum += v[i];
+			avg = sum / n;
+			for (size_t i = 0; i < n; i++)
+				sq += (v[i] - avg) * (v[i] - avg);
+			if (sqrt(sq / n) <= ref_stddev || avg > 6 * sqrt(sq / n)) {
+				*out = (uint64_t)avg;
+				return true;
+			}
+			std::swap(*std::max_element(v, v + n), v[n - 1]);
+			n--;
+		}
+		return false;
+	}
+
+	static int select(const std::vector<level> &lv, uint64_t sleep_us, uint32_t lat_us,
+			  int min_child, int best)
+	{
+		for (size_t i = 0; i < lv.size(); i++) {
+			if (min_child >= 0 && (uint32_t)min_child < lv[i].min_child)
+				continue;
+			if (lat_us <= lv[i].exit_us)
+				break;
+			if (sleep_us < lv[i].min_res_us)
+				break;
+			best = (int)i;
+		}
+		return best;
+	}
+
+	/* Saving against level 0 over @d us at @l, in level 0 us */
+	static double saving(const level &l, uint64_t d)
+	{
+		return (1.0 - l.power) * ((double)d - l.min_res_us);
+	}
+
+	void account(level_stats *st, const level &l, uint64_t d)
+	{
+		st->res_us += d;
+		st->entries++;
+		st->premature += d < l.min_res_us;
+	}
+
+	template <typename F>
+	void enter_cpu(int cpu, int g, uint64_t t, uint64_t d, uint64_t timer, F chosen)
+	{
+		const cpu_group &grp = m_->groups()[g];
+		cpu_state &s = cpu_[cpu];
+		cpu_stats &cs = cpu_stats_[cpu];
+		uint64_t pred, first = d;
+		bool predicted;
+
+		predicted = opts_.predict && predict(s, grp.ref_stddev, &pred) && pred < timer;
+		s.lvl = select(grp.levels, predicted ? pred : timer, qos_[cpu], -1, 0);
+		s.timer = t + timer;
+		s.end = t + d;
+		s.expect = predicted && grp.tmr_add ? std::min(t + pred + grp.tmr_add, s.timer) :
+			   s.timer;
+		s.lvl2 = s.lvl;
+		if (predicted && grp.tmr_add && pred + grp.tmr_add < d) {
+			/* The prediction timer fires; reselect against the real timer */
+			first = pred + grp.tmr_add;
+			s.lvl2 = select(grp.levels, timer > first ? timer - first : 0,
+					qos_[cpu], -1, 0);
+			cs.pred_wakes++;
+		}
+		s.wake = t + first;
+
+		account(&group_stats_[g][s.lvl], grp.levels[s.lvl], first);
+		cpu_saving_ += saving(grp.levels[s.lvl], first);
+		wakeup(cpu, grp.levels[s.lvl].exit_us);
+		chosen(t, cpu, -1, s.lvl, first);
+		if (first < d) {
+			account(&group_stats_[g][s.lvl2], grp.levels[s.lvl2], d - first);
+			cpu_saving_ += saving(grp.levels[s.lvl2], d - first);
+			wakeup(cpu, grp.levels[s.lvl2].exit_us);
+			chosen(t + first, cpu, -1, s.lvl2, d - first);
+		}
+
+		s.hist[s.nhist % LPM_HISTORY] = d;
+		s.nhist++;
+		cs.idle_us += d;
+	}
+
+	void wakeup(int cpu, uint32_t lat)
+	{
+		cpu_stats &cs = cpu_stats_[cpu];
+
+		cs.wakes++;
+		cs.worst_lat_us = std::max(cs.worst_lat_us, lat);
+		cs.violations += lat > qos_[cpu];
+	}
+
+	/* The level @cpu votes for a cluster at @t */
+	int vote(int cpu, uint64_t t) const
+	{
+		return t < cpu_[cpu].wake ? cpu_[cpu].lvl : cpu_[cpu].lvl2;
+	}
+
+	/* Walk up from @cpu's cluster while everything beneath is idle */
+	template <typename F>
+	void enter_clusters(int cpu, int g, uint64_t t, F chosen)
+	{
+		for (int k = m_->groups()[g].cluster; k >= 0; k = m_->clusters()[k].parent) {
+			const cluster &cl = m_->clusters()[k];
+			uint64_t end = UINT64_MAX, expect = UINT64_MAX, d;
+			uint32_t lat = LPM_NO_QOS, chain, below;
+			int first = -1, min_child = INT32_MAX, lvl;
+
+			if (!cl.cpus || cl.levels.empty())
+				return;
+			for (uint64_t m = cl.cpus; m; m &= m - 1) {
+				int c = __builtin_ctzll(m);
+				uint64_t w;
+
+				if ((size_t)c >= cpu_.size() || cpu_[c].end <= t)
+					return;
+				const cpu_state &s = cpu_[c];
+
+				w = t < s.wake ? s.wake : s.end;
+				if (w < end) {
+					end = w;
+					first = c;
+				}
+				expect = std::min(expect, t < s.wake ? s.expect : s.timer);
+				lat = std::min(lat, qos_[c]);
+			}
+			for (int gi : cl.groups)
+				for (uint64_t m = m_->groups()[gi].cpus; m; m &= m - 1)
+					min_child = std::min(min_child, vote(__builtin_ctzll(m), t));
+			for (int ch : cl.children)
+				min_child = std::min(min_child, cl_end_[ch] > t ? cl_level_[ch] : -1);
+
+			if (min_child < 0)
+				return;
+			lvl = select(cl.levels, expect - t, lat, min_child, -1);
+			if (lvl < 0)
+				return;
+			d = end - t;
+			cl_level_[k] = lvl;
+			cl_end_[k] = end;
+			cl_idle_us_[k] += d;
+			account(&cluster_stats_[k][lvl], cl.levels[lvl], d);
+			cl_saving_ += opts_.cluster_weight * saving(cl.levels[lvl], d);
+			chosen(t, cpu, k, lvl, d);
+
+			/*
+			 * The first CPU back pays for every cluster it wakes.  Its
+			 * wakeup is one violation however many levels it climbs,
+			 * so count it at the level that takes the chain over the
+			 * request; a CPU exit alone over it was counted at entry.
+			 */
+			chain = m_->groups()[m_->group_of(first)].levels[vote(first, end - 1)].exit_us;
+			below = UINT32_MAX;
+			for (int j = m_->groups()[m_->group_of(first)].cluster; j >= 0;
+			     j = m_->clusters()[j].parent) {
+				if (cl_end_[j] <= t || cl_level_[j] < 0)
+					break;
+				if (j == k)
+					below = chain;
+				chain += m_->clusters()[j].levels[cl_level_[j]].exit_us;
+				if (j == k)
+					break;
+			}
+			cpu_stats_[first].worst_lat_us = std::max(cpu_stats_[first].worst_lat_us, chain);
+			cpu_stats_[first].violations += chain > qos_[first] && below <= qos_[first];
+		}
+	}
+
+	const lpm_model *m_ = nullptr;
+	sim_opts opts_;
+	std::vector<uint32_t> qos_;
+	std::vector<cpu_state> cpu_;
+	std::vector<cpu_stats> cpu_stats_;
+	std::vector<std::vector<level_stats>> group_stats_, cluster_stats_;
+	std::vector<int> cl_level_;
+	std::vector<uint64_t> cl_end_, cl_idle_us_;
+	double cpu_saving_ = 0, cl_saving_ = 0;
+	uint64_t skipped_ = 0, now_ = 0, first_ = UINT64_MAX, last_ = 0;
+	int c_t_ = -1, c_cpu_ = -1, c_idle_ = -1, c_timer_ = -1;
+};
+
+} /* namespace lpm */
+
+#endif /* __TOOLS_LPM_LPM_H__ */
@@ -0,0 +1,358 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Predict the low-power modes CPUs and clusters reach over recorded idle
+ * periods, and what PM QoS latency requests cost in residency.
+ *
+ * Build: g++ -std=c++17 -O2 -o lpm_sim lpm_sim.cpp
+ * Usage: lpm_sim -l <blob.dtb>
+ *        lpm_sim [-q source,...|all] [-Q cpumask:us]... [-w level=power]...
+ *                [-W cluster_weight] [-P] [-v] <blob.dtb> <idle.csv>
+ *        lpm_sim [options] -g seconds <blob.dtb>
+ *
+ * -l lists the CPU and cluster levels and the latency requests found in
+ * the DT.  The trace is CSV with a header row, one idle period per row
+ * in time order:
+ *
+ *   time_us,cpu,idle_us[,timer_us]
+ *
+ * timer_us is the time to the next timer at entry; without it every
+ * wakeup is taken as foreseen.  -q applies the DT requests named (see
+ * -l) and -Q adds one by hand; the trace is then replayed with and
+ * without them.  -w sets the relative power of a level by name, -W the
+ * cluster's level 0 power in CPUs, -P turns off the history predictor,
+ * -g replays a synthetic phone-idle trace and -v logs each cluster entry.
+ *
+ * Example:
+ *   lpm_sim -q mdss_mdp,ssusb yupik.dtb idle.csv
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lpm.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void print_level(const lpm::level &l)
+{
+	printf("    %-10s entry %5u exit %5u min-residency %5u us, power %.2f", l.name.c_str(),
+	       l.entry_us, l.exit_us, l.min_res_us, l.power);
+	if (l.min_child)
+		printf(", children >= %u", l.min_child);
+	if (l.notify_rpm)
+		printf(", rpmh");
+	printf("\n");
+}
+
+static void list(const lpm::lpm_model &m, const dt::tree &t)
+{
+	for (const lpm::cluster &c : m.clusters()) {
+		printf("cluster %s (cpus 0x%lx)\n", c.name.c_str(), (unsigned long)c.cpus);
+		for (const lpm::level &l : c.levels)
+			print_level(l);
+	}
+	for (const lpm::cpu_group &g : m.groups()) {
+		printf("cpus 0x%lx (%s)", (unsigned long)g.cpus, t.name(g.node));
+		if (g.ref_stddev)
+			printf(", predicts within %u us, timer +%u us", g.ref_stddev, g.tmr_add);
+		printf("\n");
+		for (const lpm::level &l : g.levels)
+			print_level(l);
+	}
+	for (const lpm::qos_source &q : m.qos())
+		printf("qos %s: %u us on cpus 0x%lx (%s)\n", q.name.c_str(), q.us,
+		       (unsigned long)q.cpus, q.prop);
+}
+
+static void print_res(const char *name, const lpm::level_stats &s, uint64_t idle)
+{
+	if (!s.entries)
+		return;
+	printf("    %-10s %6.2f%% %8u entries", name, idle ? 100.0 * s.res_us / idle : 0.0,
+	       s.entries);
+	if (s.premature)
+		printf(", %u premature", s.premature);
+	printf("\n");
+}
+
+static void report(const char *label, const lpm::lpm_model &m, const lpm::lpm_sim &s,
+		   const std::vector<uint32_t> &qos)
+{
+	uint64_t span = s.span_us(), cpu_idle = 0;
+	uint32_t pred = 0;
+
+	printf("%s:\n", label);
+	for (size_t g = 0; g < m.groups().size(); g++) {
+		const lpm::cpu_group &grp = m.groups()[g];
+		uint64_t idle = 0;
+
+		for (uint64_t c = grp.cpus; c; c &= c - 1)
+			if ((size_t)__builtin_ctzll(c) < s.cpus().size())
+				idle += s.cpus()[__builtin_ctzll(c)].idle_us;
+		cpu_idle += idle;
+		printf("  cpus 0x%lx idle %.1f%%\n", (unsigned long)grp.cpus,
+		       span ? 100.0 * idle / span / __builtin_popcountll(grp.cpus) : 0.0);
+		for (size_t l = 0; l < grp.levels.size(); l++)
+			print_res(grp.levels[l].name.c_str(), s.group_stats()[g][l], idle);
+	}
+	for (size_t k = 0; k < m.clusters().size(); k++) {
+		const lpm::cluster &cl = m.clusters()[k];
+
+		printf("  cluster %s down %.1f%%\n", cl.name.c_str(),
+		       span ? 100.0 * s.cluster_idle_us((int)k) / span : 0.0);
+		for (size_t l = 0; l < cl.levels.size(); l++)
+			print_res(cl.levels[l].name.c_str(), s.cluster_stats()[k][l], span);
+	}
+	printf("  saved %.1f%% of the cpu idle energy at level 0, %.1f ms; cluster %.1f ms\n",
+	       cpu_idle ? 100 * s.cpu_saving() / cpu_idle : 0.0, s.cpu_saving() / 1e3,
+	       s.cluster_saving() / 1e3);
+	for (size_t c = 0; c < s.cpus().size(); c++) {
+		const lpm::cpu_stats &cs = s.cpus()[c];
+
+		pred += cs.pred_wakes;
+		if (!cs.wakes)
+			continue;
+		printf("  cpu%zu worst wakeup %u us", c, cs.worst_lat_us);
+		if (qos[c] != LPM_NO_QOS)
+			printf(", request %u us, %u over", qos[c], cs.violations);
+		printf("\n");
+	}
+	if (pred)
+		printf("  %u wakeups by the prediction timer\n", pred);
+}
+
+/*
+ * Synthetic trace: little CPUs on a 4 ms tick with frequent interrupts,
+ * big CPUs tickless with rare ones, 25-400 us of work between idles;
+ * every other two seconds the screen is off and all go quiet.
+ */
+static std::string synth(double seconds, int ncpu)
+{
+	std::vector<std::pair<uint64_t, std::string>> rows;
+	std::string s = "time_us,cpu,idle_us,timer_us\n";
+	uint64_t x = 0x2545f4914f6cdd1dull, end = (uint64_t)(seconds * 1e6);
+	char line[64];
+
+	auto rnd = [&x]() {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		return (double)(x >> 11) / (1ull << 53);
+	};
+
+	for (int c = 0; c < ncpu; c++) {
+		bool little = c < ncpu / 2;
+		uint64_t t = (uint64_t)(rnd() * 1000);
+
+		while (t < end) {
+			bool off = (t / 2000000) & 1;
+			uint64_t tick = off ? 64000 : little ? 4000 : 16000, timer, idle;
+			double irq = off ? 250000 : little ? 2500 : 20000;
+
+			t += 25 + (uint64_t)(rnd() * 375);
+			timer = tick - t % tick;
+			idle = std::min(timer, 1 + (uint64_t)(-irq * log(1 - rnd())));
+			snprintf(line, sizeof(line), "%lu,%d,%lu,%lu\n", (unsigned long)t, c,
+				 (unsigned long)idle, (unsigned long)timer);
+			rows.push_back({ t, line });
+			t += idle;
+		}
+	}
+	std::stable_sort(rows.begin(), rows.end(),
+			 [](const auto &a, const auto &b) { return a.first < b.first; });
+	s.reserve(rows.size() * 24);
+	for (const auto &r : rows)
+		s += r.second;
+	return s;
+}
+
+/* -q: DT requests by name, or every one */
+static int apply_qos(const lpm::lpm_model &m, const char *spec, std::vector<uint32_t> *qos)
+{
+	for (const char *p = spec; *p;) {
+		const char *q = strchr(p, ',');
+		std::string name = q ? std::string(p, q - p) : std::string(p);
+		bool found = false;
+
+		for (const lpm::qos_source &src : m.qos()) {
+			if (name != "all" && src.name != name)
+				continue;
+			for (size_t c = 0; c < qos->size(); c++)
+				if (src.cpus >> c & 1)
+					(*qos)[c] = std::min((*qos)[c], src.us);
+			found = true;
+		}
+		if (!found) {
+			fprintf(stderr, "%s: no such latency request\n", name.c_str());
+			return -ENOENT;
+		}
+		p = q ? q + 1 : p + strlen(p);
+	}
+	return 0;
+}
+
+static int replay(csv::reader &rd, const lpm::lpm_model &m, const std::vector<uint32_t> &qos,
+		  const lpm::sim_opts &o, bool verbose, lpm::lpm_sim *s, uint64_t *rows)
+{
+	csv::row r;
+
+	s->init(m, qos, o);
+	rd.rewind();
+	if (!rd.next(&r) || s->bind(r))
+		return -EINVAL;
+
+	auto chosen = [&](uint64_t t, int cpu, int k, int lvl, uint64_t d) {
+		if (verbose && k >= 0)
+			printf("%lu cpu%d %s %s %lu us\n", (unsigned long)t, cpu,
+			       m.clusters()[k].name.c_str(), m.clusters()[k].levels[lvl].name.c_str(),
+			       (unsigned long)d);
+	};
+
+	while (rd.next(&r)) {
+		s->sample(r, chosen);
+		(*rows)++;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::pair<std::string, double>> powers;
+	std::vector<std::pair<uint64_t, uint32_t>> manual;
+	std::vector<const char *> sources;
+	std::vector<uint32_t> none, qos;
+	dt::cpu_topology cpus;
+	lpm::lpm_model m;
+	lpm::sim_opts o;
+	lpm::lpm_sim base, cur;
+	csv::reader rd;
+	std::string trace;
+	bool do_list = false, verbose = false;
+	double gen = 0, t0, t1;
+	uint64_t rows = 0;
+	dt::file f;
+	int opt, ret, nargs;
+
+	while ((opt = getopt(argc, argv, "lq:Q:w:W:Pg:v")) != -1) {
+		switch (opt) {
+		case 'l':
+			do_list = true;
+			break;
+		case 'q':
+			sources.push_back(optarg);
+			break;
+		case 'Q': {
+			unsigned long mask;
+			unsigned int us;
+
+			if (sscanf(optarg, "%lx:%u", &mask, &us) != 2)
+				return 1;
+			manual.push_back({ mask, us });
+			break;
+		}
+		case 'w': {
+			const char *eq = strchr(optarg, '=');
+
+			if (!eq)
+				return 1;
+			powers.push_back({ std::string(optarg, eq - optarg), atof(eq + 1) });
+			break;
+		}
+		case 'W':
+			o.cluster_weight = atof(optarg);
+			break;
+		case 'P':
+			o.predict = false;
+			break;
+		case 'g':
+			gen = atof(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	nargs = argc - optind;
+	if (do_list || gen > 0 ? nargs != 1 : nargs != 2) {
+		fprintf(stderr,
+			"usage: %s -l <blob.dtb>\n"
+			"       %s [-q source,...|all] [-Q cpumask:us]... [-w level=power]... "
+			"[-W cluster_weight] [-P] [-v] <blob.dtb> <idle.csv>\n"
+			"       %s [options] -g seconds <blob.dtb>\n", argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	ret = f.open(argv[optind]);
+	if (!ret)
+		ret = cpus.build(f.index());
+	if (!ret)
+		ret = m.load(f.index(), cpus);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	for (const auto &p : powers)
+		if (!m.set_power(p.first.c_str(), p.second)) {
+			fprintf(stderr, "%s: no such level\n", p.first.c_str());
+			return 1;
+		}
+	if (do_list) {
+		list(m, f.index());
+		return 0;
+	}
+
+	none.assign(cpus.count(), LPM_NO_QOS);
+	qos = none;
+	for (const char *spec : sources)
+		if (apply_qos(m, spec, &qos))
+			return 1;
+	for (const auto &q : manual)
+		for (size_t c = 0; c < qos.size(); c++)
+			if (q.first >> c & 1)
+				qos[c] = std::min(qos[c], q.second);
+
+	if (gen > 0) {
+		trace = synth(gen, cpus.count());
+		rd.attach(trace.data(), trace.size());
+	} else if ((ret = rd.open(argv[optind + 1]))) {
+		fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(-ret));
+		return 1;
+	}
+
+	t0 = now_us();
+	ret = replay(rd, m, none, o, verbose && qos == none, &base, &rows);
+	if (!ret && qos != none)
+		ret = replay(rd, m, qos, o, verbose, &cur, &rows);
+	t1 = now_us();
+	if (ret) {
+		fprintf(stderr, "%s: trace header needs time_us, cpu and idle_us\n",
+			gen > 0 ? "synthetic" : argv[optind + 1]);
+		return 1;
+	}
+
+	report("no latency requests", m, base, none);
+	if (qos != none) {
+		double b = base.cpu_saving() + base.cluster_saving();
+		double c = cur.cpu_saving() + cur.cluster_saving();
+
+		report("with latency requests", m, cur, qos);
+		printf("latency requests cost %.1f%% of the idle energy saving\n",
+		       b > 0 ? 100 * (b - c) / b : 0.0);
+	}
+	if (base.skipped())
+		fprintf(stderr, "%lu rows out of order or for unknown cpus skipped\n",
+			(unsigned long)base.skipped());
+	fprintf(stderr, "%lu rows replayed in %.1f ms\n", (unsigned long)rows, (t1 - t0) / 1e3);
+	return 0;
+}
@@ -0,0 +1,555 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Summarise msm_vidc extradata dumps, fuzz the reader, or time it.
+ *
+ * Build: g++ -std=c++17 -O2 -o extradata_scan extradata_scan.cpp
+ * Usage: extradata_scan [-S region] [-v] <dump>...
+ *        extradata_scan -z iterations [-o corpus_dir]
+ *        extradata_scan -b [-n streams] [-r fps] [-T seconds]
+ *
+ * A dump is extradata regions back to back, each -S bytes (default
+ * VENUS_EXTRADATA_SIZE, 16 KiB), as an encoder's meta plane would be
+ * saved one frame after the other.  Every region is walked and the
+ * records counted by type, with frame QP and bit totals; -v prints each
+ * record.  Regions the walk stopped early in are reported with the
+ * reason.
+ *
+ * -z builds seed regions holding every payload type, then mutates them
+ * (bit flips, size and count fields set to edge values, truncation) and
+ * walks each, checking that every record and every view lies inside the
+ * region.  Build with -fsanitize=address,undefined to have reads caught
+ * too.  -o writes the seeds and the first mutants that failed a walk as
+ * a corpus, one region per file.
+ *
+ * extradata_corpus/ holds one small region per way a walk can end: the
+ * clean ends (ok-*), the header checks that stop it (named after the
+ * error), and payload counts the views refuse (view-*).  Scanning it
+ * with a sanitizer build replays each case.
+ *
+ * -b gives each of -n encoder streams (default 1000) its own region,
+ * with the records a QoE monitor sees per frame (QP, bits, ROI map on a
+ * quarter of the streams, HDR metadata once a second), and walks them
+ * round robin for -T seconds, keeping per-stream QP and bitrate, as a
+ * monitor would.  It reports regions per second against the -n x -r
+ * (default 60 fps) the box produces, and the share of one core that is.
+ *
+ * Example:
+ *   extradata_scan -b -n 1000 -r 60
+ *   extradata_scan extradata_corpus/ok-*
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../lib/mapped_file.h"
+#include "vidc_extradata.h"
+
+static const struct {
+	uint32_t type;
+	const char *name;
+} type_names[] = {
+	{ MSM_VIDC_EXTRADATA_INTERLACE_VIDEO, "INTERLACE_VIDEO" },
+	{ MSM_VIDC_EXTRADATA_FRAME_RATE, "FRAME_RATE" },
+	{ MSM_VIDC_EXTRADATA_TIMESTAMP, "TIMESTAMP" },
+	{ MSM_VIDC_EXTRADATA_NUM_CONCEALED_MB, "NUM_CONCEALED_MB" },
+	{ MSM_VIDC_EXTRADATA_RECOVERY_POINT_SEI, "RECOVERY_POINT_SEI" },
+	{ MSM_VIDC_EXTRADATA_ASPECT_RATIO, "ASPECT_RATIO" },
+	{ MSM_VIDC_EXTRADATA_INPUT_CROP, "INPUT_CROP" },
+	{ MSM_VIDC_EXTRADATA_OUTPUT_CROP, "OUTPUT_CROP" },
+	{ MSM_VIDC_EXTRADATA_INDEX, "INDEX" },
+	{ MSM_VIDC_EXTRADATA_PANSCAN_WINDOW, "PANSCAN_WINDOW" },
+	{ MSM_VIDC_EXTRADATA_STREAM_USERDATA, "STREAM_USERDATA" },
+	{ MSM_VIDC_EXTRADATA_FRAME_QP, "FRAME_QP" },
+	{ MSM_VIDC_EXTRADATA_FRAME_BITS_INFO, "FRAME_BITS_INFO" },
+	{ MSM_VIDC_EXTRADATA_S3D_FRAME_PACKING, "S3D_FRAME_PACKING" },
+	{ MSM_VIDC_EXTRADATA_ROI_QP, "ROI_QP" },
+	{ MSM_VIDC_EXTRADATA_MASTERING_DISPLAY_COLOUR_SEI, "MASTERING_DISPLAY_COLOUR_SEI" },
+	{ MSM_VIDC_EXTRADATA_CONTENT_LIGHT_LEVEL_SEI, "CONTENT_LIGHT_LEVEL_SEI" },
+	{ MSM_VIDC_EXTRADATA_HDR10PLUS_METADATA, "HDR10PLUS_METADATA" },
+	{ MSM_VIDC_EXTRADATA_CVP_METADATA, "CVP_METADATA" },
+	{ MSM_VIDC_EXTRADATA_VUI_DISPLAY_INFO, "VUI_DISPLAY_INFO" },
+	{ MSM_VIDC_EXTRADATA_HDR_HIST, "HDR_HIST" },
+	{ MSM_VIDC_EXTRADATA_MPEG2_SEQDISP, "MPEG2_SEQDISP" },
+	{ MSM_VIDC_EXTRADATA_VPX_COLORSPACE_INFO, "VPX_COLORSPACE_INFO" },
+	{ MSM_VIDC_EXTRADATA_METADATA_LTRINFO, "METADATA_LTRINFO" },
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static const char *type_name(uint32_t type)
+{
+	for (const auto &t : type_names)
+		if (t.type == type)
+			return t.name;
+	return "unknown";
+}
+
+/* Per-type counts for the dump summary */
+struct summary : vidc::visitor {
+	std::map<uint32_t, std::pair<uint64_t, uint64_t>> types;	/* records, bytes */
+	uint64_t qp_frames = 0, qp_sum = 0, bits = 0, bit_frames = 0;
+	bool verbose = false;
+
+	void frame_qp(const msm_vidc_frame_qp_payload &p)
+	{
+		qp_frames++;
+		qp_sum += p.frame_qp;
+		if (verbose)
+			printf("  frame_qp %u, qp_sum %u over %u blocks\n", p.frame_qp, p.qp_sum,
+			       p.total_num_blocks);
+	}
+
+	void frame_bits(const msm_vidc_frame_bits_info_payload &p)
+	{
+		bit_frames++;
+		bits += p.frame_bits;
+		if (verbose)
+			printf("  frame_bits %u, header %u\n", p.frame_bits, p.header_bits);
+	}
+
+	void content_light_level(const msm_vidc_content_light_level_sei_payload &p)
+	{
+		if (verbose)
+			printf("  max_cll %u, max_fall %u\n", p.nMaxContentLight,
+			       p.nMaxPicAverageLight);
+	}
+
+	void hdr10plus(const vidc::bytes &b)
+	{
+		if (verbose)
+			printf("  hdr10+ %u bytes\n", b.len);
+	}
+
+	void roi_qp(const vidc::roi_view &r)
+	{
+		if (verbose)
+			printf("  roi %s, offsets %d/%d, %u byte map\n", r.enabled ? "on" : "off",
+			       r.upper_qp_offset, r.lower_qp_offset, r.map.len);
+	}
+};
+
+static int scan(const char *path, size_t region, bool verbose)
+{
+	lib::mapped_file f;
+	summary s;
+	size_t regions = 0, bad = 0;
+	int ret;
+
+	ret = f.open(path);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return ret;
+	}
+	s.verbose = verbose;
+	for (size_t off = 0; off < f.size(); off += region, regions++) {
+		vidc::extradata x;
+
+		x.init(f.data() + off, std::min(region, f.size() - off));
+		if (verbose)
+			printf("region %zu\n", regions);
+		for (const vidc::record &r : x) {
+			auto &t = s.types[r.type];
+
+			t.first++;
+			t.second += r.len;
+			if (verbose)
+				printf(" %s (%#x), %u bytes\n", type_name(r.type), r.type, r.len);
+		}
+		ret = vidc::walk(x, s);
+		if (ret < 0) {
+			bad++;
+			fprintf(stderr, "%s: region %zu at %#zx: %s\n", path, regions, off,
+				strerror(-ret));
+		}
+	}
+
+	printf("%s: %zu regions, %zu stopped early\n", path, regions, bad);
+	for (const auto &t : s.types)
+		printf("  %-30s %10lu records %12lu bytes\n", type_name(t.first),
+		       (unsigned long)t.second.first, (unsigned long)t.second.second);
+	if (s.qp_frames)
+		printf("  mean frame QP %.2f\n", (double)s.qp_sum / s.qp_frames);
+	if (s.bit_frames)
+		printf("  mean frame bits %.0f\n", (double)s.bits / s.bit_frames);
+	return 0;
+}
+
+/* One region with a record of every type the reader has a view for */
+static void seed_all(uint8_t *buf, size_t size, uint64_t *x)
+{
+	vidc::writer w = { buf, size };
+	uint8_t *p;
+
+	for (const auto &t : type_names) {
+		uint32_t len;
+
+		switch (t.type) {
+		case MSM_VIDC_EXTRADATA_HDR10PLUS_METADATA:
+			len = 4 + 61;
+			p = w.add(t.type, len);
+			*reinterpret_cast<uint32_t *>(p) = 61;
+			break;
+		case MSM_VIDC_EXTRADATA_ROI_QP:
+			len = 16 + 510;
+			p = w.add(t.type, len);
+			reinterpret_cast<uint32_t *>(p)[2] = 1;
+			reinterpret_cast<uint32_t *>(p)[3] = 510;
+			break;
+		case MSM_VIDC_EXTRADATA_PANSCAN_WINDOW:
+			len = 4 + 2 * sizeof(msm_vidc_panscan_window);
+			p = w.add(t.type, len);
+			*reinterpret_cast<uint32_t *>(p) = 2;
+			break;
+		case MSM_VIDC_EXTRADATA_STREAM_USERDATA:
+			len = 4 + 33;
+			p = w.add(t.type, len);
+			break;
+		case MSM_VIDC_EXTRADATA_CVP_METADATA:
+			len = sizeof(msm_vidc_enc_cvp_metadata_payload);
+			p = w.add(t.type, len);
+			break;
+		case MSM_VIDC_EXTRADATA_HDR_HIST:
+			len = sizeof(msm_vidc_extradata_hdr_hist_payload);
+			p = w.add(t.type, len);
+			break;
+		default:
+			len = 4 * (1 + xorshift(x) % 24);
+			p = w.add(t.type, len);
+			break;
+		}
+		if (!p)
+			break;
+		for (uint32_t i = t.type == MSM_VIDC_EXTRADATA_ROI_QP ? 16 : 4; i < len; i++)
+			p[i] = (uint8_t)xorshift(x);
+	}
+	w.finish();
+}
+
+/* A visitor that reads every byte of every view, to give the sanitizers a go */
+struct toucher : vidc::visitor {
+	const uint8_t *lo, *hi;
+	uint64_t sum = 0, bad = 0;
+
+	void in(const void *p, size_t len)
+	{
+		const uint8_t *b = static_cast<const uint8_t *>(p);
+
+		if (b < lo || b + len > hi) {
+			bad++;
+			return;
+		}
+		for (size_t i = 0; i < len; i++)
+			sum += b[i];
+	}
+
+	void frame_qp(const msm_vidc_frame_qp_payload &p) { in(&p, sizeof(p)); }
+	void output_crop(const msm_vidc_output_crop_payload &p) { in(&p, sizeof(p)); }
+	void mastering_display(const msm_vidc_mastering_display_colour_sei_payload &p)
+	{
+		in(&p, sizeof(p));
+	}
+	void cvp_metadata(const msm_vidc_enc_cvp_metadata_payload &p) { in(&p, sizeof(p)); }
+	void hdr_hist(const msm_vidc_extradata_hdr_hist_payload &p) { in(&p, sizeof(p)); }
+	void hdr10plus(const vidc::bytes &b) { in(b.data, b.len); }
+	void roi_qp(const vidc::roi_view &r) { in(r.map.data, r.map.len); }
+
+	void other(const vidc::record &r)
+	{
+		const msm_vidc_panscan_window *wnd;
+		vidc::bytes b;
+		uint32_t n, kind;
+
+		in(r.data, r.len);
+		if (!vidc::panscan(r, &wnd, &n))
+			in(wnd, n * sizeof(*wnd));
+		if (!vidc::userdata(r, &kind, &b))
+			in(b.data, b.len);
+	}
+};
+
+static int save(const std::string &dir, const char *name, uint64_t n, const uint8_t *buf,
+		size_t len)
+{
+	char path[4096];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s-%06lu", dir.c_str(), name, (unsigned long)n);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write(fd, buf, len) != (ssize_t)len)
+		ret = -errno;
+	if (fd >= 0)
+		close(fd);
+	if (ret)
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+	return ret;
+}
+
+/* Corrupt a region: flip bits, or set a size or count to an edge value */
+static size_t mutate(uint8_t *buf, size_t size, uint64_t *x)
+{
+	static const uint32_t edge[] = {
+		0, 1, 3, 4, 19, 20, 21, 24, 0x7fffffff, 0x80000000, 0xfffffffc, 0xffffffff,
+	};
+	int n = 1 + xorshift(x) % 4;
+
+	while (n--) {
+		size_t word = (xorshift(x) % (size / 4)) * 4;
+
+		switch (xorshift(x) % 4) {
+		case 0:
+			buf[xorshift(x) % size] ^= (uint8_t)(1 << (xorshift(x) % 8));
+			break;
+		case 1:
+			memcpy(buf + word, &edge[xorshift(x) % (sizeof(edge) / sizeof(edge[0]))], 4);
+			break;
+		case 2: {
+			uint32_t v;
+
+			memcpy(&v, buf + word, 4);
+			v += (uint32_t)(xorshift(x) % 9) - 4;
+			memcpy(buf + word, &v, 4);
+			break;
+		}
+		default:
+			size = 4 * (xorshift(x) % (size / 4) + 1);
+			break;
+		}
+	}
+	return size;
+}
+
+static int fuzz(uint64_t iters, const std::string &dir)
+{
+	const size_t region = VENUS_EXTRADATA_SIZE(0, 0);
+	std::vector<uint32_t> seed(region / 4), work(region / 4);
+	uint8_t *s = reinterpret_cast<uint8_t *>(seed.data());
+	uint8_t *w = reinterpret_cast<uint8_t *>(work.data());
+	uint64_t x = 0x853c49e6748fea9bull, records = 0, stopped = 0, saved = 0, bad = 0;
+	double t0 = now_us();
+
+	for (uint64_t i = 0; i < iters; i++) {
+		vidc::extradata xd;
+		toucher t;
+		size_t len;
+		int ret;
+
+		if (i % 1024 == 0) {
+			seed_all(s, region, &x);
+			if (!dir.empty() && save(dir, "seed", i / 1024, s, region))
+				return -EIO;
+		}
+		memcpy(w, s, region);
+		len = mutate(w, region, &x);
+		xd.init(w, len);
+		t.lo = w;
+		t.hi = w + len;
+		for (const vidc::record &r : xd) {
+			if (r.data < w + XD_HEADER_SIZE || r.data + r.len > w + len)
+				t.bad++;
+		}
+		ret = vidc::walk(xd, t);
+		if (ret < 0) {
+			stopped++;
+			if (!dir.empty() && saved < 256)
+				save(dir, "stop", saved++, w, len);
+		} else {
+			records += ret;
+		}
+		if (t.bad) {
+			fprintf(stderr, "iteration %lu: view outside the region\n", (unsigned long)i);
+			bad++;
+		}
+	}
+	printf("%lu mutants, %lu records walked, %lu walks stopped early, %lu escaped (%.1f s)\n",
+	       (unsigned long)iters, (unsigned long)records, (unsigned long)stopped,
+	       (unsigned long)bad, (now_us() - t0) / 1e6);
+	return bad ? -EDOM : 0;
+}
+
+/* What a QoE monitor keeps per stream */
+struct stream_stats : vidc::visitor {
+	uint64_t frames = 0, qp_sum = 0, bits = 0, roi_bytes = 0;
+	uint32_t max_cll = 0;
+
+	void frame_qp(const msm_vidc_frame_qp_payload &p)
+	{
+		frames++;
+		qp_sum += p.frame_qp;
+	}
+	void frame_bits(const msm_vidc_frame_bits_info_payload &p) { bits += p.frame_bits; }
+	void roi_qp(const vidc::roi_view &r) { roi_bytes += r.map.len; }
+	void content_light_level(const msm_vidc_content_light_level_sei_payload &p)
+	{
+		max_cll = std::max(max_cll, p.nMaxContentLight);
+	}
+};
+
+/* An encoder frame's extradata; every fps-th frame carries the HDR SEIs */
+static void encoder_region(uint8_t *buf, size_t size, uint32_t stream, uint32_t frame,
+			   uint32_t fps, uint64_t *x)
+{
+	vidc::writer w = { buf, size };
+	msm_vidc_frame_qp_payload *qp;
+	msm_vidc_frame_bits_info_payload *bits;
+
+	qp = w.add<msm_vidc_frame_qp_payload>(MSM_VIDC_EXTRADATA_FRAME_QP);
+	qp->frame_qp = 22 + xorshift(x) % 16;
+	qp->total_num_blocks = 8160;
+	qp->qp_sum = qp->frame_qp * qp->total_num_blocks;
+	bits = w.add<msm_vidc_frame_bits_info_payload>(MSM_VIDC_EXTRADATA_FRAME_BITS_INFO);
+	bits->frame_bits = 40000 + xorshift(x) % 200000;
+	bits->header_bits = 320;
+	if (stream % 4 == 0) {
+		uint32_t *roi = reinterpret_cast<uint32_t *>(
+			w.add(MSM_VIDC_EXTRADATA_ROI_QP, 16 + 8160));
+
+		roi[0] = -2;
+		roi[1] = 2;
+		roi[2] = 1;
+		roi[3] = 8160;
+	}
+	if (frame % fps == 0) {
+		auto *cll = w.add<msm_vidc_content_light_level_sei_payload>(
+			MSM_VIDC_EXTRADATA_CONTENT_LIGHT_LEVEL_SEI);
+		uint32_t *hdr = reinterpret_cast<uint32_t *>(
+			w.add(MSM_VIDC_EXTRADATA_HDR10PLUS_METADATA, 4 + 64));
+
+		cll->nMaxContentLight = 1000;
+		cll->nMaxPicAverageLight = 400;
+		w.add<msm_vidc_mastering_display_colour_sei_payload>(
+			MSM_VIDC_EXTRADATA_MASTERING_DISPLAY_COLOUR_SEI)->nMaxDisplayMasteringLuminance =
+			1000;
+		hdr[0] = 64;
+	}
+	w.finish();
+}
+
+static int bench(uint32_t streams, uint32_t fps, double seconds)
+{
+	const size_t region = VENUS_EXTRADATA_SIZE(0, 0);
+	/* A few frames per stream, so the walk does not see one region hot */
+	const uint32_t depth = 4;
+	std::vector<uint32_t> mem((size_t)streams * depth * region / 4);
+	std::vector<stream_stats> stats(streams);
+	uint64_t x = 88172645463325252ull, walked = 0, records = 0;
+	double t0, t;
+
+	for (uint32_t s = 0; s < streams; s++)
+		for (uint32_t d = 0; d < depth; d++)
+			encoder_region(reinterpret_cast<uint8_t *>(&mem[(s * depth + d) * region / 4]),
+				       region, s, d * (fps / 2), fps, &x);
+
+	t0 = now_us();
+	for (uint32_t d = 0; (t = now_us() - t0) < seconds * 1e6; d = (d + 1) % depth) {
+		for (uint32_t s = 0; s < streams; s++) {
+			vidc::extradata xd;
+			int ret;
+
+			xd.init(&mem[(s * depth + d) * region / 4], region);
+			ret = vidc::walk(xd, stats[s]);
+			if (ret < 0) {
+				fprintf(stderr, "stream %u: %s\n", s, strerror(-ret));
+				return ret;
+			}
+			records += ret;
+		}
+		walked += streams;
+	}
+
+	printf("%u streams, %lu regions, %lu records in %.2f s\n", streams, (unsigned long)walked,
+	       (unsigned long)records, t / 1e6);
+	printf("%.0f regions/s, %.0f ns each; %u streams at %u fps need %u/s: %.2f%% of a core\n",
+	       walked / t * 1e6, t * 1e3 / walked, streams, fps, streams * fps,
+	       100.0 * streams * fps / (walked / t * 1e6));
+	printf("stream 0: mean QP %.2f, %.0f kbit/s, max CLL %u\n",
+	       (double)stats[0].qp_sum / stats[0].frames,
+	       (double)stats[0].bits / stats[0].frames * fps / 1e3, stats[0].max_cll);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t region = VENUS_EXTRADATA_SIZE(0, 0);
+	uint32_t streams = 1000, fps = 60;
+	uint64_t iters = 0;
+	double seconds = 2;
+	bool verbose = false, do_bench = false;
+	std::string dir;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "S:vz:o:bn:r:T:")) != -1) {
+		switch (opt) {
+		case 'S':
+			region = (size_t)atol(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'z':
+			iters = strtoull(optarg, NULL, 0);
+			break;
+		case 'o':
+			dir = optarg;
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		case 'n':
+			streams = (uint32_t)atoi(optarg);
+			break;
+		case 'r':
+			fps = (uint32_t)atoi(optarg);
+			break;
+		case 'T':
+			seconds = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (!region || (region & 3) || !streams || fps < 2 ||
+	    ((iters || do_bench) ? optind != argc : optind == argc)) {
+		fprintf(stderr,
+			"usage: %s [-S region] [-v] <dump>...\n"
+			"       %s -z iterations [-o corpus_dir]\n"
+			"       %s -b [-n streams] [-r fps] [-T seconds]\n",
+			argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	if (!dir.empty() && mkdir(dir.c_str(), 0755) && errno != EEXIST) {
+		fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+		return 1;
+	}
+	if (iters)
+		return fuzz(iters, dir) ? 1 : 0;
+	if (do_bench)
+		return bench(streams, fps, seconds) ? 1 : 0;
+	for (int i = optind; i < argc; i++)
+		ret |= scan(argv[i], region, verbose);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,456 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copy the visible picture out of a linear Venus decoder buffer.
+ *
+ * A decoded frame sits in a buffer padded to the VENUS_* strides and
+ * scanlines, and the picture worth showing is a crop of it, which the
+ * decoder reports in its extradata: the output crop, else the input
+ * crop, else all of the coded width and height.  copy_frame() finds it
+ * with venus::geom() and vidc::walk() and copies just those lines and
+ * columns, packed: the luma (or RGBA) lines, then the chroma lines, no
+ * padding.  For 4:2:0 the crop's left and top are rounded down and its
+ * right and bottom up to even, so chroma stays sited.
+ *
+ * Interlaced frames, as the interlace payload marks them, come with the
+ * two fields woven line by line.  COPY_WEAVE copies them so.  COPY_BOB
+ * keeps the field shown first and rebuilds the other one's lines as
+ * the rounded mean of the kept lines above and below, chroma the same
+ * at its own resolution; the means run on AVX2, SSE2 or NEON, whichever
+ * the build enables, else in C.  Progressive frames are copied either
+ * way.
+ *
+ * Linear NV12, NV21, NV12_128, NV12_512, P010 and RGBA8888 only; UBWC
+ * buffers are not handled (ubwc_tile.h only models their layout).  A
+ * copy_pool pipelines frames over worker threads: submit() queues a job
+ * and returns, waiting only when the queue is full, and drain() waits
+ * for all of them.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_MEDIA_FRAME_COPY_H__
+#define __TOOLS_MEDIA_FRAME_COPY_H__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "vidc_extradata.h"
+#include "venus_geom.h"
+
+namespace vidc {
+
+#define COPY_WEAVE		0
+#define COPY_BOB		1
+
+/* Where the picture is, in pixels of the coded frame */
+struct visible_area {
+	uint32_t left, top, width, height;
+	bool interlaced;
+	bool bottom_first;
+};
+
+struct frame_src {
+	const uint8_t *buf;
+	unsigned int fmt;		/* COLOR_FMT_* */
+	uint32_t width, height;		/* coded */
+	const void *extradata;		/* NULL: no crop, progressive */
+	size_t extradata_size;
+};
+
+struct copy_stats {
+	uint64_t frames;
+	uint64_t read, written;		/* bytes the copy touched */
+	uint64_t buffer;		/* bytes a whole-buffer copy would have read */
+};
+
+/* Bytes a sample (a UV pair counts as one), and whether there is chroma */
+inline int copy_sample_bytes(unsigned int fmt, bool *yuv)
+{
+	switch (fmt) {
+	case COLOR_FMT_NV12:
+	case COLOR_FMT_NV21:
+	case COLOR_FMT_NV12_128:
+	case COLOR_FMT_NV12_512:
+		*yuv = true;
+		return 1;
+	case COLOR_FMT_P010:
+		*yuv = true;
+		return 2;
+	case COLOR_FMT_RGBA8888:
+		*yuv = false;
+		return 4;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+/* dst[i] = (a[i] + b[i] + 1) / 2, over @n bytes of 8-bit or (@wide) 16-bit samples */
+inline void copy_avg_c(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, bool wide)
+{
+	if (!wide) {
+		for (size_t i = 0; i < n; i++)
+			dst[i] = (uint8_t)((a[i] + b[i] + 1) >> 1);
+		return;
+	}
+	for (size_t i = 0; i + 2 <= n; i += 2) {
+		uint16_t x, y, v;
+
+		memcpy(&x, a + i, 2);
+		memcpy(&y, b + i, 2);
+		v = (uint16_t)((x + y + 1) >> 1);
+		memcpy(dst + i, &v, 2);
+	}
+}
+
+#if defined(__AVX2__)
+
+static const char copy_isa[] = "avx2";
+
+inline void copy_avg(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, bool wide)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    wide ? _mm256_avg_epu16(x, y) : _mm256_avg_epu8(x, y));
+	}
+	copy_avg_c(dst + i, a + i, b + i, n - i, wide);
+}
+
+#elif defined(__SSE2__)
+
+static const char copy_isa[] = "sse2";
+
+inline void copy_avg(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, bool wide)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+
+		_mm_storeu_si128((__m128i *)(dst + i), wide ? _mm_avg_epu16(x, y) : _mm_avg_epu8(x, y));
+	}
+	copy_avg_c(dst + i, a + i, b + i, n - i, wide);
+}
+
+#elif defined(__ARM_NEON)
+
+static const char copy_isa[] = "neon";
+
+inline void copy_avg(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, bool wide)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		if (wide)
+			vst1q_u16((uint16_t *)(dst + i),
+				  vrhaddq_u16(vld1q_u16((const uint16_t *)(a + i)),
+					      vld1q_u16((const uint16_t *)(b + i))));
+		else
+			vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+	}
+	copy_avg_c(dst + i, a + i, b + i, n - i, wide);
+}
+
+#else
+
+static const char copy_isa[] = "c";
+
+inline void copy_avg(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, bool wide)
+{
+	copy_avg_c(dst, a, b, n, wide);
+}
+
+#endif
+
+struct crop_visitor : visitor {
+	const msm_vidc_output_crop_payload *out = nullptr;
+	const msm_vidc_input_crop_payload *in = nullptr;
+	const msm_vidc_interlace_payload *il = nullptr;
+
+	void output_crop(const msm_vidc_output_crop_payload &p) { out = &p; }
+	void input_crop(const msm_vidc_input_crop_payload &p) { in = &p; }
+	void interlace(const msm_vidc_interlace_payload &p) { il = &p; }
+};
+
+/*
+ * The visible area of @s: -ERANGE for a crop outside the coded frame,
+ * -EBADMSG for extradata that cannot be read, -EOPNOTSUPP for a format
+ * copy_frame() does not do.
+ */
+inline int find_visible(const frame_src &s, visible_area *v)
+{
+	uint32_t l = 0, t = 0, w = s.width, h = s.height;
+	crop_visitor c;
+	bool yuv;
+	int ret;
+
+	ret = copy_sample_bytes(s.fmt, &yuv);
+	if (ret < 0)
+		return ret;
+	if (!s.width || !s.height)
+		return -EINVAL;
+	*v = { 0, 0, s.width, s.height, false, false };
+	if (s.extradata) {
+		extradata x;
+
+		ret = x.init(s.extradata, s.extradata_size);
+		if (!ret && walk(x, c) < 0)
+			ret = x.error();
+		if (ret)
+			return ret == -EINVAL ? ret : -EBADMSG;
+	}
+	if (c.out) {
+		l = c.out->left;
+		t = c.out->top;
+		w = c.out->display_width;
+		h = c.out->display_height;
+	} else if (c.in) {
+		l = c.in->left;
+		t = c.in->top;
+		w = c.in->width;
+		h = c.in->height;
+	}
+	if (!w || !h || l >= s.width || t >= s.height || w > s.width - l || h > s.height - t)
+		return -ERANGE;
+	if (yuv) {
+		uint32_t r = std::min(s.width, (l + w + 1) & ~1u);
+		uint32_t b = std::min(s.height, (t + h + 1) & ~1u);
+
+		l &= ~1u;
+		t &= ~1u;
+		w = r - l;
+		h = b - t;
+	}
+	v->left = l;
+	v->top = t;
+	v->width = w;
+	v->height = h;
+	if (c.il && !(c.il->format & MSM_VIDC_INTERLACE_FRAME_PROGRESSIVE) && c.il->format) {
+		v->interlaced = true;
+		v->bottom_first = c.il->format & (MSM_VIDC_INTERLACE_INTERLEAVE_FRAME_BOTTOMFIELDFIRST |
+						  MSM_VIDC_INTERLACE_FRAME_BOTTOMFIELDFIRST);
+	}
+	return 0;
+}
+
+/* Bytes copy_frame() writes for @v of @fmt */
+inline size_t packed_size(unsigned int fmt, const visible_area &v)
+{
+	bool yuv;
+	int px = copy_sample_bytes(fmt, &yuv);
+
+	if (px < 0)
+		return 0;
+	return (size_t)v.width * px * v.height +
+	       (yuv ? (size_t)v.width * px * ((v.height + 1) / 2) : 0);
+}
+
+/*
+ * Lines [@top, @top + @rows) of a plane at @src, @row_bytes from @left_bytes
+ * on, to @dst packed.  With @bob, lines not of parity @keep are rebuilt
+ * from their neighbours of that parity within the plane's @plane_rows,
+ * which must be at least two.  Returns the bytes read.
+ */
+inline size_t copy_plane(uint8_t *dst, const uint8_t *src, size_t stride, uint32_t left_bytes,
+		       uint32_t row_bytes, uint32_t top, uint32_t rows, uint32_t plane_rows,
+		       bool bob, uint32_t keep, bool wide)
+{
+	size_t read = 0;
+
+	for (uint32_t r = 0; r < rows; r++) {
+		uint32_t y = top + r;
+		const uint8_t *line = src + (size_t)y * stride + left_bytes;
+		uint8_t *out = dst + (size_t)r * row_bytes;
+
+		if (!bob || (y & 1) == keep) {
+			memcpy(out, line, row_bytes);
+			read += row_bytes;
+			continue;
+		}
+		/* the kept field's lines either side; at an edge, the one there is */
+		uint32_t above = y ? y - 1 : y + 1;
+		uint32_t below = y + 1 < plane_rows ? y + 1 : y - 1;
+
+		copy_avg(out, src + (size_t)above * stride + left_bytes,
+			 src + (size_t)below * stride + left_bytes, row_bytes, wide);
+		read += 2 * (size_t)row_bytes;
+	}
+	return read;
+}
+
+/*
+ * The visible area of @s to @dst, @size bytes, packed as packed_size()
+ * says, weaving or bobbing interlaced frames as @mode asks.  Adds what it
+ * moved to @st when that is not NULL.
+ */
+inline int copy_frame(const frame_src &s, int mode, uint8_t *dst, size_t size,
+		      copy_stats *st = NULL)
+{
+	venus::geometry g;
+	visible_area v;
+	size_t y_bytes, uv_bytes = 0, read;
+	bool yuv = false, bob;
+	int px, ret;
+
+	ret = find_visible(s, &v);
+	if (ret)
+		return ret;
+	if (mode != COPY_WEAVE && mode != COPY_BOB)
+		return -EINVAL;
+	if (size < packed_size(s.fmt, v))
+		return -ENOSPC;
+	px = copy_sample_bytes(s.fmt, &yuv);
+	g = venus::geom(s.fmt, s.width, s.height);
+	bob = mode == COPY_BOB && v.interlaced && s.height >= 4;
+
+	y_bytes = (size_t)v.width * px * v.height;
+	if (yuv) {
+		read = copy_plane(dst, s.buf + g.y.offset, g.y_stride, v.left * px, v.width * px,
+				  v.top, v.height, s.height, bob, v.bottom_first, px == 2);
+		uv_bytes = (size_t)v.width * px * ((v.height + 1) / 2);
+		read += copy_plane(dst + y_bytes, s.buf + g.uv.offset, g.uv_stride, v.left * px,
+				   v.width * px, v.top / 2, (v.height + 1) / 2, (s.height + 1) / 2,
+				   bob, v.bottom_first, px == 2);
+	} else {
+		read = copy_plane(dst, s.buf + g.y.offset, g.rgb_stride, v.left * px, v.width * px,
+				  v.top, v.height, s.height, bob, v.bottom_first, false);
+	}
+	if (st) {
+		st->frames++;
+		st->read += read;
+		st->written += y_bytes + uv_bytes;
+		st->buffer += g.size;
+	}
+	return 0;
+}
+
+/* One frame for a copy_pool; ret is set when it is done */
+struct copy_job {
+	frame_src src;
+	int mode;
+	uint8_t *dst;
+	size_t size;
+	int ret;
+};
+
+/*
+ * Worker threads copying frames as they are queued.  Jobs are the
+ * caller's and must stay put until drain() returns; the queue holds
+ * @depth of them, so submit() waits only when the workers are that far
+ * behind.
+ */
+class copy_pool {
+public:
+	copy_pool() = default;
+	copy_pool(const copy_pool &) = delete;
+	copy_pool &operator=(const copy_pool &) = delete;
+	~copy_pool() { stop(); }
+
+	int start(int jobs, size_t depth)
+	{
+		if (jobs < 1 || !depth || !th_.empty())
+			return -EINVAL;
+		q_.assign(depth, nullptr);
+		head_ = tail_ = queued_ = busy_ = 0;
+		quit_ = false;
+		st_ = std::vector<copy_stats>(jobs, copy_stats{});
+		for (int i = 0; i < jobs; i++)
+			th_.emplace_back([this, i] { run(&st_[i]); });
+		return 0;
+	}
+
+	void submit(copy_job *j)
+	{
+		std::unique_lock<std::mutex> lk(mu_);
+
+		space_.wait(lk, [this] { return queued_ < q_.size(); });
+		q_[tail_] = j;
+		tail_ = (tail_ + 1) % q_.size();
+		queued_++;
+		work_.notify_one();
+	}
+
+	/* Wait for every job submitted so far; the stats of all of them */
+	copy_stats drain()
+	{
+		std::unique_lock<std::mutex> lk(mu_);
+		copy_stats t = {};
+
+		idle_.wait(lk, [this] { return !queued_ && !busy_; });
+		for (const copy_stats &s : st_) {
+			t.frames += s.frames;
+			t.read += s.read;
+			t.written += s.written;
+			t.buffer += s.buffer;
+		}
+		return t;
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mu_);
+
+			quit_ = true;
+		}
+		work_.notify_all();
+		for (std::thread &t : th_)
+			t.join();
+		th_.clear();
+	}
+
+private:
+	void run(copy_stats *st)
+	{
+		std::unique_lock<std::mutex> lk(mu_);
+
+		for (;;) {
+			copy_job *j;
+
+			work_.wait(lk, [this] { return queued_ || quit_; });
+			if (!queued_)
+				return;
+			j = q_[head_];
+			head_ = (head_ + 1) % q_.size();
+			queued_--;
+			busy_++;
+			space_.notify_one();
+			lk.unlock();
+			j->ret = copy_frame(j->src, j->mode, j->dst, j->size, st);
+			lk.lock();
+			if (!--busy_ && !queued_)
+				idle_.notify_all();
+		}
+	}
+
+	std::mutex mu_;
+	std::condition_variable work_, space_, idle_;
+	std::vector<copy_job *> q_;
+	size_t head_ = 0, tail_ = 0, queued_ = 0, busy_ = 0;
+	bool quit_ = false;
+	std::vector<std::thread> th_;
+	std::vector<copy_stats> st_;	/* one per worker, read when idle */
+};
+
+} /* namespace vidc */
+
+#endif /* __TOOLS_MEDIA_FRAME_COPY_H__ */
@@ -0,0 +1,458 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copy the visible picture out of decoder output buffers, or time it
+ * against copying whole buffers.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -o frame_extract frame_extract.cpp
+ * Usage: frame_extract -f fmt -s WxH [-x extradata] [-B] [-j jobs] <in> <out>
+ *        frame_extract -b [-f fmt] [-s WxH] [-c WxH+L+T] [-i] [-B] [-n frames]
+ *                      [-j jobs] [-T seconds]
+ *
+ * fmt is NV12, NV21, NV12_128, NV12_512, P010 or RGBA8888, -s the coded
+ * size.  <in> holds whole buffers back to back, each VENUS_BUFFER_SIZE
+ * bytes; -x names a dump of the same frames' extradata, one region of
+ * VENUS_EXTRADATA_SIZE each, that gives the crop and field order.
+ * Every frame's visible area goes to <out> packed; -B bobs interlaced
+ * frames instead of weaving them.
+ *
+ * -b checks the vector line mean against the C one and copy_frame()
+ * against a plain per-pixel crop and bob over every format, then times
+ * -n (default 32) noise frames of the coded size with an output crop of
+ * -c (default 1920x1080+0+0; -i marks them interlaced, top field first)
+ * two ways: copying each whole buffer and cropping the copy, as a
+ * thumbnailer does now, and copy_frame() over a copy_pool of -j threads
+ * (default 1).  Reports frames per second and the bytes each moves.
+ *
+ * Example:
+ *   frame_extract -b -f NV12 -s 1920x1088 -c 1920x1080+0+0 -i -B -j 4
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "frame_copy.h"
+
+static const struct {
+	const char *name;
+	unsigned int fmt;
+} fmt_names[] = {
+	{ "NV12", COLOR_FMT_NV12 },
+	{ "NV21", COLOR_FMT_NV21 },
+	{ "NV12_128", COLOR_FMT_NV12_128 },
+	{ "NV12_512", COLOR_FMT_NV12_512 },
+	{ "P010", COLOR_FMT_P010 },
+	{ "RGBA8888", COLOR_FMT_RGBA8888 },
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static int parse_fmt(const char *s)
+{
+	for (const auto &f : fmt_names)
+		if (!strcmp(s, f.name))
+			return (int)f.fmt;
+	return -1;
+}
+
+static const char *fmt_name(unsigned int fmt)
+{
+	for (const auto &f : fmt_names)
+		if (f.fmt == fmt)
+			return f.name;
+	return "?";
+}
+
+/* An extradata region with an output crop and, when @interlaced, field order */
+static void make_extradata(std::vector<uint32_t> &xd, const vidc::visible_area &c,
+			   bool interlaced)
+{
+	vidc::writer w = { reinterpret_cast<uint8_t *>(xd.data()), xd.size() * 4 };
+	auto *o = w.add<msm_vidc_output_crop_payload>(MSM_VIDC_EXTRADATA_OUTPUT_CROP);
+	auto *il = w.add<msm_vidc_interlace_payload>(MSM_VIDC_EXTRADATA_INTERLACE_VIDEO);
+
+	memset(o, 0, sizeof(*o));
+	o->size = sizeof(*o);
+	o->left = c.left;
+	o->top = c.top;
+	o->display_width = o->width = c.width;
+	o->display_height = o->height = c.height;
+	il->format = interlaced ? MSM_VIDC_INTERLACE_INTERLEAVE_FRAME_TOPFIELDFIRST :
+				  MSM_VIDC_INTERLACE_FRAME_PROGRESSIVE;
+	il->color_format = MSM_VIDC_HAL_INTERLACE_COLOR_FORMAT_NV12;
+	w.finish();
+}
+
+/* Sample (x, y) of a plane, one @px bytes wide, the obvious way */
+static const uint8_t *at(const uint8_t *plane, size_t stride, uint32_t x, uint32_t y, int px)
+{
+	return plane + (size_t)y * stride + (size_t)x * px;
+}
+
+/* What copy_frame() should write, pixel by pixel */
+static void reference(const vidc::frame_src &s, const vidc::visible_area &v, bool bob,
+		      std::vector<uint8_t> &out)
+{
+	venus::geometry g = venus::geom(s.fmt, s.width, s.height);
+	bool yuv = false;
+	int px = vidc::copy_sample_bytes(s.fmt, &yuv);
+	struct {
+		const uint8_t *base;
+		size_t stride;
+		uint32_t top, rows, all;
+	} planes[2] = {
+		{ s.buf + g.y.offset, yuv ? g.y_stride : g.rgb_stride, v.top, v.height, s.height },
+		{ s.buf + g.uv.offset, g.uv_stride, v.top / 2, (v.height + 1) / 2,
+		  (s.height + 1) / 2 },
+	};
+	uint32_t keep = v.bottom_first;
+
+	out.clear();
+	for (int p = 0; p < (yuv ? 2 : 1); p++) {
+		for (uint32_t r = 0; r < planes[p].rows; r++) {
+			uint32_t y = planes[p].top + r;
+
+			for (uint32_t x = v.left; x < v.left + v.width; x++) {
+				const uint8_t *a = at(planes[p].base, planes[p].stride, x, y, px);
+				uint32_t ya, yb;
+
+				if (!bob || (y & 1) == keep) {
+					out.insert(out.end(), a, a + px);
+					continue;
+				}
+				ya = y ? y - 1 : y + 1;
+				yb = y + 1 < planes[p].all ? y + 1 : y - 1;
+				for (int k = 0; k < px; k += (px == 2 ? 2 : 1)) {
+					const uint8_t *pa = at(planes[p].base, planes[p].stride, x, ya, px) + k;
+					const uint8_t *pb = at(planes[p].base, planes[p].stride, x, yb, px) + k;
+
+					if (px == 2) {
+						uint16_t m = (uint16_t)((pa[0] + (pa[1] << 8) + pb[0] +
+									 (pb[1] << 8) + 1) >> 1);
+
+						out.push_back((uint8_t)m);
+						out.push_back((uint8_t)(m >> 8));
+					} else {
+						out.push_back((uint8_t)((pa[0] + pb[0] + 1) >> 1));
+					}
+				}
+			}
+		}
+	}
+}
+
+static int check(void)
+{
+	static const struct {
+		uint32_t w, h;
+		vidc::visible_area c;
+	} cases[] = {
+		{ 1920, 1088, { 0, 0, 1920, 1080, false, false } },
+		{ 720, 576, { 8, 2, 703, 571, false, false } },
+		{ 1280, 720, { 161, 91, 960, 539, false, false } },
+		{ 352, 288, { 0, 1, 352, 287, false, false } },
+	};
+	uint8_t a[300], b[300], simd[300], ref[300];
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+
+	for (int i = 0; i < 10000; i++) {
+		size_t n = xorshift(&x) % 300;
+
+		for (size_t k = 0; k < sizeof(a); k++) {
+			a[k] = (uint8_t)xorshift(&x);
+			b[k] = (uint8_t)xorshift(&x);
+		}
+		for (bool wide : { false, true }) {
+			vidc::copy_avg(simd, a, b, n & ~(size_t)1, wide);
+			vidc::copy_avg_c(ref, a, b, n & ~(size_t)1, wide);
+			if (memcmp(simd, ref, n & ~(size_t)1)) {
+				fprintf(stderr, "%s line mean differs from C\n", vidc::copy_isa);
+				return -EDOM;
+			}
+		}
+	}
+
+	for (const auto &f : fmt_names) {
+		for (const auto &t : cases) {
+			for (int mode = 0; mode < 4; mode++) {
+				bool interlaced = mode & 1, bob = mode & 2;
+				std::vector<uint8_t> buf(venus::buffer_size(f.fmt, t.w, t.h));
+				std::vector<uint32_t> xd(VENUS_EXTRADATA_SIZE(0, 0) / 4);
+				std::vector<uint8_t> got, want;
+				vidc::visible_area v;
+				vidc::frame_src s;
+				int ret;
+
+				for (uint8_t &p : buf)
+					p = (uint8_t)xorshift(&x);
+				make_extradata(xd, t.c, interlaced);
+				s = { buf.data(), f.fmt, t.w, t.h, xd.data(), xd.size() * 4 };
+				ret = vidc::find_visible(s, &v);
+				if (!ret) {
+					got.resize(vidc::packed_size(f.fmt, v));
+					ret = vidc::copy_frame(s, bob ? COPY_BOB : COPY_WEAVE, got.data(),
+							       got.size());
+				}
+				if (ret) {
+					fprintf(stderr, "%s %ux%u: %s\n", f.name, t.w, t.h, strerror(-ret));
+					return ret;
+				}
+				reference(s, v, bob && interlaced, want);
+				if (got != want) {
+					fprintf(stderr, "%s %ux%u crop %ux%u+%u+%u%s%s differs\n", f.name,
+						t.w, t.h, t.c.width, t.c.height, t.c.left, t.c.top,
+						interlaced ? " interlaced" : "", bob ? " bob" : "");
+					return -EDOM;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static int bench(unsigned int fmt, uint32_t w, uint32_t h, const vidc::visible_area &crop,
+		 bool interlaced, int mode, int frames, int jobs, double seconds)
+{
+	size_t size = venus::buffer_size(fmt, w, h);
+	std::vector<std::vector<uint8_t>> bufs(frames), outs(frames);
+	std::vector<uint32_t> xd(VENUS_EXTRADATA_SIZE(0, 0) / 4);
+	std::vector<vidc::copy_job> job(frames);
+	std::vector<uint8_t> whole(size);
+	uint64_t x = 0x2545f4914f6cdd1dull, n;
+	vidc::visible_area v;
+	vidc::copy_stats st = {};
+	vidc::copy_pool pool;
+	double t0, t, full_fps;
+	size_t packed, read;
+	int ret;
+
+	ret = check();
+	if (ret)
+		return ret;
+	make_extradata(xd, crop, interlaced);
+	for (int i = 0; i < frames; i++) {
+		bufs[i].resize(size);
+		for (size_t k = 0; k + 8 <= size; k += 8) {
+			uint64_t r = xorshift(&x);
+
+			memcpy(&bufs[i][k], &r, 8);
+		}
+		job[i].src = { bufs[i].data(), fmt, w, h, xd.data(), xd.size() * 4 };
+		job[i].mode = mode;
+	}
+	ret = vidc::find_visible(job[0].src, &v);
+	if (ret) {
+		fprintf(stderr, "crop: %s\n", strerror(-ret));
+		return ret;
+	}
+	packed = vidc::packed_size(fmt, v);
+	for (int i = 0; i < frames; i++) {
+		outs[i].resize(packed);
+		job[i].dst = outs[i].data();
+		job[i].size = packed;
+	}
+
+	/* Whole buffer, then the crop out of the copy */
+	t0 = now_us();
+	for (n = 0; (t = now_us() - t0) < seconds * 1e6; n++) {
+		vidc::copy_job &j = job[n % frames];
+		vidc::frame_src s = j.src;
+
+		memcpy(whole.data(), s.buf, size);
+		s.buf = whole.data();
+		ret = vidc::copy_frame(s, mode, j.dst, j.size);
+		if (ret)
+			return ret;
+	}
+	full_fps = n / t * 1e6;
+
+	ret = pool.start(jobs, 2 * jobs);
+	if (ret)
+		return ret;
+	t0 = now_us();
+	for (n = 0; (t = now_us() - t0) < seconds * 1e6;) {
+		for (int i = 0; i < frames; i++, n++)
+			pool.submit(&job[i]);
+		st = pool.drain();
+		for (int i = 0; i < frames; i++)
+			if (job[i].ret)
+				return job[i].ret;
+	}
+
+	printf("%s %ux%u, %ux%u+%u+%u visible%s, %s, %s\n", fmt_name(fmt), w, h, v.width,
+	       v.height, v.left, v.top, interlaced ? " interlaced" : "",
+	       mode == COPY_BOB ? "bob" : "weave", vidc::copy_isa);
+	/* the whole-buffer way reads the buffer and then the crop out of its copy */
+	read = size + st.read / st.frames;
+	printf("whole buffer then crop: %8.1f fps, %zu bytes read, %zu written a frame\n",
+	       full_fps, read, size + packed);
+	printf("visible only, %2d jobs:  %8.1f fps, %zu bytes read, %zu written a frame\n", jobs,
+	       n / t * 1e6, (size_t)(st.read / st.frames), (size_t)(st.written / st.frames));
+	printf("saved %.1f%% of the bytes moved\n",
+	       100.0 * (1 - (double)(st.read + st.written) / st.frames / (read + size + packed)));
+	return 0;
+}
+
+/* Batches of 2 * @jobs frames: read them all, copy them on the pool, write them in order */
+static int extract(unsigned int fmt, uint32_t w, uint32_t h, const char *xd_path, int mode,
+		   int jobs, const char *in, const char *out)
+{
+	size_t size = venus::buffer_size(fmt, w, h), region = VENUS_EXTRADATA_SIZE(0, 0);
+	size_t batch = 2 * (size_t)jobs;
+	std::vector<std::vector<uint8_t>> bufs(batch, std::vector<uint8_t>(size));
+	std::vector<std::vector<uint8_t>> xds(batch, std::vector<uint8_t>(region));
+	std::vector<std::vector<uint8_t>> dsts(batch, std::vector<uint8_t>(size));
+	std::vector<vidc::copy_job> job(batch);
+	FILE *fi = fopen(in, "rb"), *fx = NULL, *fo = NULL;
+	vidc::copy_stats st = {};
+	vidc::copy_pool pool;
+	unsigned long frames = 0;
+	size_t n;
+	int ret = 0;
+
+	if (!fi || (xd_path && !(fx = fopen(xd_path, "rb"))) || !(fo = fopen(out, "wb"))) {
+		ret = -errno;
+		fprintf(stderr, "%s: %s\n", !fi ? in : !fo && (!xd_path || fx) ? out : xd_path,
+			strerror(-ret));
+		goto out;
+	}
+	ret = pool.start(jobs, batch);
+	if (ret)
+		goto out;
+	do {
+		for (n = 0; n < batch && fread(bufs[n].data(), 1, size, fi) == size; n++) {
+			vidc::copy_job &j = job[n];
+
+			j = { { bufs[n].data(), fmt, w, h, NULL, 0 }, mode, dsts[n].data(), size, 0 };
+			if (fx) {
+				if (fread(xds[n].data(), 1, region, fx) != region) {
+					fprintf(stderr, "%s: short, frame %lu\n", xd_path, frames + n);
+					ret = -ENODATA;
+					goto out;
+				}
+				j.src.extradata = xds[n].data();
+				j.src.extradata_size = region;
+			}
+			pool.submit(&j);
+		}
+		st = pool.drain();
+		for (size_t i = 0; i < n; i++, frames++) {
+			vidc::visible_area v;
+
+			ret = job[i].ret;
+			if (!ret)
+				ret = vidc::find_visible(job[i].src, &v);
+			if (ret) {
+				fprintf(stderr, "frame %lu: %s\n", frames, strerror(-ret));
+				goto out;
+			}
+			if (fwrite(dsts[i].data(), 1, vidc::packed_size(fmt, v), fo) !=
+			    vidc::packed_size(fmt, v)) {
+				ret = -errno;
+				fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+				goto out;
+			}
+		}
+	} while (n == batch);
+	fprintf(stderr, "%lu frames, %.1f%% of the buffer bytes read\n", frames,
+		st.buffer ? 100.0 * st.read / st.buffer : 0.0);
+out:
+	pool.stop();
+	if (fi)
+		fclose(fi);
+	if (fx)
+		fclose(fx);
+	if (fo)
+		fclose(fo);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int fmt = COLOR_FMT_NV12, jobs = 1, frames = 32, mode = COPY_WEAVE, opt;
+	vidc::visible_area crop = { 0, 0, 1920, 1080, false, false };
+	bool interlaced = false, do_bench = false;
+	unsigned int w = 1920, h = 1088;
+	const char *xd_path = NULL;
+	double seconds = 1;
+
+	while ((opt = getopt(argc, argv, "f:s:c:x:iBj:bn:T:")) != -1) {
+		switch (opt) {
+		case 'f':
+			fmt = parse_fmt(optarg);
+			if (fmt < 0) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &w, &h) != 2 || !w || !h) {
+				fprintf(stderr, "bad size %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			if (sscanf(optarg, "%ux%u+%u+%u", &crop.width, &crop.height, &crop.left,
+				   &crop.top) != 4) {
+				fprintf(stderr, "bad crop %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'x':
+			xd_path = optarg;
+			break;
+		case 'i':
+			interlaced = true;
+			break;
+		case 'B':
+			mode = COPY_BOB;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'T':
+			seconds = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (jobs < 1 || frames < 1 || (do_bench ? optind != argc : optind != argc - 2)) {
+		fprintf(stderr,
+			"usage: %s -f fmt -s WxH [-x extradata] [-B] [-j jobs] <in> <out>\n"
+			"       %s -b [-f fmt] [-s WxH] [-c WxH+L+T] [-i] [-B] [-n frames]\n"
+			"          [-j jobs] [-T seconds]\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	if (do_bench)
+		return bench((unsigned int)fmt, w, h, crop, interlaced, mode, frames, jobs,
+			     seconds) ? 1 : 0;
+	return extract((unsigned int)fmt, w, h, xd_path, mode, jobs, argv[optind],
+		       argv[optind + 1]) ? 1 : 0;
+}
@@ -0,0 +1,339 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Hold msm_media_info.h and mmm_color_fmt.h to each other.
+ *
+ * Build: g++ -std=c++17 -O2 -pthread -o geom_diff geom_diff.cpp
+ * Usage: geom_diff [-m max] [-s step] [-f floor] [-j jobs] [-v]
+ *
+ * The decoder sizes a buffer with VENUS_*, the display imports it with
+ * MMM_COLOR_FMT_*; the two headers are separate copies of the same
+ * math and nothing keeps them so.  For every format both have, by name,
+ * every stride, scanline and meta helper is compared for every width or
+ * height from 0 to max (default 8192), and BUFFER_SIZE and
+ * BUFFER_SIZE_USED (progressive and interlaced) over the width x height
+ * grid, every step-th value (default 1, all of them).  Rows of the grid
+ * are spread over -j threads (default: every core).  The scalar headers
+ * themselves are called, not venus_geom.h or mmm_batch.h, which share
+ * one table and would agree with each other whatever the headers say.
+ *
+ * Per format it reports the divergent values (-v prints the first few),
+ * the largest amount by which the display would expect more bytes than
+ * the decoder allocated (reads past the buffer) or fewer (megabytes
+ * allocated for nothing), and the padding: buffer bytes over picture
+ * bytes, mean and worst, for pictures at least -f (default 320) on each
+ * side.
+ *
+ * Two mismatches are known and reported apart, not failed: NV12_128
+ * exists only on the Venus side, so a display importing it as NV12 is
+ * compared too, and the enums are numbered differently from NV12_128 on,
+ * so a Venus value handed to the MMM helpers as is is compared as well.
+ * Exit status 1 when a shared format diverges.
+ *
+ * Example:
+ *   geom_diff -m 4096 -s 2
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "../../kernel-headers/vidc/media/msm_media_info.h"
+#include "../../kernel-headers/display/media/mmm_color_fmt.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+enum pair_kind {
+	PAIR_SHARED,		/* same format on both sides: must agree */
+	PAIR_IMPORT,		/* Venus-only format, imported as its display cousin */
+	PAIR_RENUMBERED,	/* Venus enum value passed to MMM as is */
+};
+
+static const char *const kind_names[] = { "shared", "import", "renumbered" };
+
+struct pair {
+	const char *name;
+	unsigned int venus, mmm;
+	pair_kind kind;
+	uint32_t bpp;		/* picture bits a pixel, for the padding */
+};
+
+#define SHARED(f, bpp)	{ #f, COLOR_FMT_##f, MMM_COLOR_FMT_##f, PAIR_SHARED, bpp }
+
+static const pair pairs[] = {
+	SHARED(NV12, 12),
+	SHARED(NV21, 12),
+	SHARED(NV12_UBWC, 12),
+	SHARED(NV12_BPP10_UBWC, 15),
+	SHARED(RGBA8888, 32),
+	SHARED(RGBA8888_UBWC, 32),
+	SHARED(RGBA1010102_UBWC, 32),
+	SHARED(RGB565_UBWC, 16),
+	SHARED(P010_UBWC, 24),
+	SHARED(P010, 24),
+	SHARED(NV12_512, 12),
+	{ "NV12_128 as NV12", COLOR_FMT_NV12_128, MMM_COLOR_FMT_NV12, PAIR_IMPORT, 12 },
+};
+
+typedef unsigned int (*dim_fn)(unsigned int, unsigned int);
+
+static const struct {
+	const char *name;
+	dim_fn venus, mmm;
+	bool height;
+} helpers[] = {
+	{ "Y_STRIDE", VENUS_Y_STRIDE, MMM_COLOR_FMT_Y_STRIDE, false },
+	{ "UV_STRIDE", VENUS_UV_STRIDE, MMM_COLOR_FMT_UV_STRIDE, false },
+	{ "Y_SCANLINES", VENUS_Y_SCANLINES, MMM_COLOR_FMT_Y_SCANLINES, true },
+	{ "UV_SCANLINES", VENUS_UV_SCANLINES, MMM_COLOR_FMT_UV_SCANLINES, true },
+	{ "Y_META_STRIDE", VENUS_Y_META_STRIDE, MMM_COLOR_FMT_Y_META_STRIDE, false },
+	{ "Y_META_SCANLINES", VENUS_Y_META_SCANLINES, MMM_COLOR_FMT_Y_META_SCANLINES, true },
+	{ "UV_META_STRIDE", VENUS_UV_META_STRIDE, MMM_COLOR_FMT_UV_META_STRIDE, false },
+	{ "UV_META_SCANLINES", VENUS_UV_META_SCANLINES, MMM_COLOR_FMT_UV_META_SCANLINES, true },
+	{ "RGB_STRIDE", VENUS_RGB_STRIDE, MMM_COLOR_FMT_RGB_STRIDE, false },
+	{ "RGB_SCANLINES", VENUS_RGB_SCANLINES, MMM_COLOR_FMT_RGB_SCANLINES, true },
+	{ "RGB_META_STRIDE", VENUS_RGB_META_STRIDE, MMM_COLOR_FMT_RGB_META_STRIDE, false },
+	{ "RGB_META_SCANLINES", VENUS_RGB_META_SCANLINES, MMM_COLOR_FMT_RGB_META_SCANLINES, true },
+};
+
+#define NR_EXAMPLES	4
+
+struct example {
+	const char *what;
+	uint32_t w, h, venus, mmm;
+};
+
+/* What one pair came to, over some rows or all of them */
+struct result {
+	uint64_t checked = 0, diverged = 0;
+	int64_t short_by = 0, over_by = 0;	/* display wants more, less */
+	uint32_t short_w = 0, short_h = 0, over_w = 0, over_h = 0;
+	double pad[2] = { 0, 0 };		/* worst buffer / picture, each side */
+	uint32_t pad_w[2] = {}, pad_h[2] = {};
+	double pad_sum[2] = { 0, 0 };
+	uint64_t pad_n = 0;
+	std::vector<example> ex;
+
+	void diverge(const char *what, uint32_t w, uint32_t h, uint32_t v, uint32_t m)
+	{
+		diverged++;
+		if (ex.size() < NR_EXAMPLES)
+			ex.push_back({ what, w, h, v, m });
+	}
+
+	void sizes(uint32_t w, uint32_t h, uint32_t v, uint32_t m)
+	{
+		int64_t d = (int64_t)m - v;
+
+		if (d > short_by) {
+			short_by = d;
+			short_w = w;
+			short_h = h;
+		}
+		if (-d > over_by) {
+			over_by = -d;
+			over_w = w;
+			over_h = h;
+		}
+	}
+
+	void padding(int side, uint32_t w, uint32_t h, uint32_t bpp, uint32_t size)
+	{
+		double r = size / ((double)w * h * bpp / 8);
+
+		pad_sum[side] += r;
+		pad_n += !side;
+		if (r > pad[side]) {
+			pad[side] = r;
+			pad_w[side] = w;
+			pad_h[side] = h;
+		}
+	}
+
+	void merge(const result &o)
+	{
+		checked += o.checked;
+		diverged += o.diverged;
+		if (o.short_by > short_by) {
+			short_by = o.short_by;
+			short_w = o.short_w;
+			short_h = o.short_h;
+		}
+		if (o.over_by > over_by) {
+			over_by = o.over_by;
+			over_w = o.over_w;
+			over_h = o.over_h;
+		}
+		pad_n += o.pad_n;
+		for (int s = 0; s < 2; s++) {
+			pad_sum[s] += o.pad_sum[s];
+			if (o.pad[s] > pad[s]) {
+				pad[s] = o.pad[s];
+				pad_w[s] = o.pad_w[s];
+				pad_h[s] = o.pad_h[s];
+			}
+		}
+		for (const example &e : o.ex)
+			if (ex.size() < NR_EXAMPLES)
+				ex.push_back(e);
+	}
+};
+
+/* The per-dimension helpers, every value from 0 to @max */
+static void diff_dims(const pair &p, uint32_t max, result *r)
+{
+	for (const auto &hp : helpers) {
+		for (uint32_t x = 0; x <= max; x++) {
+			uint32_t v = hp.venus(p.venus, x), m = hp.mmm(p.mmm, x);
+
+			r->checked++;
+			if (v != m)
+				r->diverge(hp.name, hp.height ? 0 : x, hp.height ? x : 0, v, m);
+		}
+	}
+}
+
+/* BUFFER_SIZE and BUFFER_SIZE_USED along one row of the grid */
+static void diff_row(const pair &p, uint32_t h, uint32_t max, uint32_t step, uint32_t floor,
+		     result *r)
+{
+	for (uint32_t w = 0; w <= max; w += w < 2 ? 1 : step) {
+		uint32_t v = VENUS_BUFFER_SIZE(p.venus, w, h);
+		uint32_t m = MMM_COLOR_FMT_BUFFER_SIZE(p.mmm, w, h);
+
+		r->checked += 3;
+		if (v != m)
+			r->diverge("BUFFER_SIZE", w, h, v, m);
+		r->sizes(w, h, v, m);
+		if (w >= floor && h >= floor) {
+			r->padding(0, w, h, p.bpp, v);
+			r->padding(1, w, h, p.bpp, m);
+		}
+		for (int il = 0; il < 2; il++) {
+			v = VENUS_BUFFER_SIZE_USED(p.venus, w, h, il);
+			m = MMM_COLOR_FMT_BUFFER_SIZE_USED(p.mmm, w, h, il);
+			if (v != m)
+				r->diverge(il ? "BUFFER_SIZE_USED interlaced" : "BUFFER_SIZE_USED", w,
+					   h, v, m);
+			r->sizes(w, h, v, m);
+		}
+	}
+}
+
+static void print(const pair &p, const result &r, bool verbose)
+{
+	printf("%-24s %-10s %12lu %10lu", p.name, kind_names[p.kind], (unsigned long)r.checked,
+	       (unsigned long)r.diverged);
+	if (r.short_by)
+		printf("  short %ld at %ux%u", (long)r.short_by, r.short_w, r.short_h);
+	if (r.over_by)
+		printf("  over %ld at %ux%u", (long)r.over_by, r.over_w, r.over_h);
+	printf("\n%-24s padding: venus %.2fx mean, %.2fx at %ux%u", "",
+	       r.pad_n ? r.pad_sum[0] / r.pad_n : 0, r.pad[0], r.pad_w[0], r.pad_h[0]);
+	if (!r.pad[1])
+		printf(", mmm none");
+	else if (r.pad[1] != r.pad[0] || r.pad_w[1] != r.pad_w[0] || r.pad_h[1] != r.pad_h[0])
+		printf(", mmm %.2fx mean, %.2fx at %ux%u", r.pad_sum[1] / r.pad_n, r.pad[1],
+		       r.pad_w[1], r.pad_h[1]);
+	printf("\n");
+	if (verbose)
+		for (const example &e : r.ex)
+			printf("%-24s %s(%u, %u): venus %u, mmm %u\n", "", e.what, e.w, e.h, e.venus,
+			       e.mmm);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t max = 8192, step = 1, floor = 320;
+	int jobs = (int)std::thread::hardware_concurrency(), opt;
+	std::vector<pair> all(pairs, pairs + sizeof(pairs) / sizeof(pairs[0]));
+	std::vector<uint32_t> rows;
+	std::vector<std::vector<result>> part;
+	std::vector<std::thread> th;
+	std::atomic<size_t> next(0);
+	bool verbose = false, bad = false;
+	uint64_t checked = 0;
+	double t0;
+
+	while ((opt = getopt(argc, argv, "m:s:f:j:v")) != -1) {
+		switch (opt) {
+		case 'm':
+			max = (uint32_t)atoi(optarg);
+			break;
+		case 's':
+			step = (uint32_t)atoi(optarg);
+			break;
+		case 'f':
+			floor = (uint32_t)atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (!step || optind != argc) {
+		fprintf(stderr, "usage: %s [-m max] [-s step] [-f floor] [-j jobs] [-v]\n", argv[0]);
+		return 1;
+	}
+	jobs = std::max(jobs, 1);
+
+	/* A Venus value from NV12_128 on names another format, or none, on the MMM side */
+	for (const pair &p : pairs) {
+		if (p.kind == PAIR_SHARED && p.venus != p.mmm) {
+			pair r = p;
+
+			r.kind = PAIR_RENUMBERED;
+			r.mmm = p.venus;
+			all.push_back(r);
+		}
+	}
+
+	for (uint32_t h = 0; h <= max; h += h < 2 ? 1 : step)
+		rows.push_back(h);
+	part.assign(jobs, std::vector<result>(all.size()));
+	t0 = now_us();
+
+	/* Work is (pair, row); the rows of one pair are taken in turn */
+	auto worker = [&](int id) {
+		for (size_t k; (k = next++) < all.size() * rows.size();)
+			diff_row(all[k / rows.size()], rows[k % rows.size()], max, step, floor,
+				 &part[id][k / rows.size()]);
+	};
+
+	for (int i = 0; i < jobs; i++)
+		th.emplace_back(worker, i);
+	for (std::thread &t : th)
+		t.join();
+
+	printf("%-24s %-10s %12s %10s\n", "format", "kind", "compared", "diverged");
+	for (size_t i = 0; i < all.size(); i++) {
+		result r;
+
+		diff_dims(all[i], max, &r);
+		for (int j = 0; j < jobs; j++)
+			r.merge(part[j][i]);
+		print(all[i], r, verbose);
+		checked += r.checked;
+		bad |= all[i].kind == PAIR_SHARED && r.diverged;
+	}
+	printf("%lu comparisons on %d threads in %.1f s, shared formats %s\n",
+	       (unsigned long)checked, jobs, (now_us() - t0) / 1e6, bad ? "DIVERGE" : "agree");
+	return bad ? 1 : 0;
+}
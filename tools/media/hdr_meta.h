@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * HDR metadata from decoder extradata to the SDE connector's
+ * drm_msm_ext_hdr_metadata, without allocating and without repeats.
+ *
+ * The decoder hands out a mastering display SEI and a content light
+ * level SEI with every IRAP picture, HDR10+ (ST 2094-40) with many
+ * frames, and the VUI transfer characteristics; all of it mostly the
+ * same value over and over.  An hdr_stream keeps the metadata last sent
+ * for one stream, in the DRM struct itself, with the HDR10+ bytes in a
+ * buffer it owns that hdr_plus_payload points at.  update() folds one
+ * frame's extradata into a candidate, and reports a new blob only when
+ * a field the sink sees differs from what was last sent.  SEIs persist
+ * until replaced, so a frame without them changes nothing.
+ *
+ * Field mapping:
+ *   display primaries, white point  as in the SEI, 0.00002 units
+ *   max_luminance                   SEI 0.0001 cd/m2 units to cd/m2
+ *   min_luminance                   SEI 0.0001 cd/m2 units, kept
+ *   max_content/average_light_level cd/m2, kept
+ *   eotf                            ST 2084 or HLG from the VUI; ST 2084
+ *                                   if there is mastering data and no VUI
+ *
+ * Primaries are passed in SEI order (G, B, R), unchanged; the connector
+ * packs them into the infoframe as given.  HDR10+ payloads over
+ * HDR_PLUS_MAX bytes are dropped, not truncated.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_MEDIA_HDR_META_H__
+#define __TOOLS_MEDIA_HDR_META_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <display/drm/sde_drm.h>
+
+#include "vidc_extradata.h"
+
+namespace vidc {
+
+#define HDR_PLUS_MAX		1024	/* bytes of HDR10+ kept per stream */
+
+/* drm_msm_ext_hdr_metadata::hdr_state */
+#define HDR_STATE_OFF		0
+#define HDR_STATE_ON		1
+
+/* What one frame's extradata said, before it is compared */
+struct hdr_frame {
+	const msm_vidc_mastering_display_colour_sei_payload *mdcv = nullptr;
+	const msm_vidc_content_light_level_sei_payload *cll = nullptr;
+	const msm_vidc_vui_display_info_payload *vui = nullptr;
+	bytes plus;
+	bool has_plus = false;
+};
+
+struct hdr_visitor : visitor {
+	hdr_frame *f;
+
+	void mastering_display(const msm_vidc_mastering_display_colour_sei_payload &p)
+	{
+		f->mdcv = &p;
+	}
+	void content_light_level(const msm_vidc_content_light_level_sei_payload &p)
+	{
+		f->cll = &p;
+	}
+	void vui_display(const msm_vidc_vui_display_info_payload &p) { f->vui = &p; }
+	void hdr10plus(const bytes &b)
+	{
+		f->plus = b;
+		f->has_plus = true;
+	}
+};
+
+struct hdr_stream_stats {
+	uint64_t frames = 0;		/* update() calls */
+	uint64_t carrying = 0;		/* frames with any HDR metadata */
+	uint64_t emitted = 0;		/* new blobs */
+	uint64_t plus_dropped = 0;	/* HDR10+ over HDR_PLUS_MAX */
+	uint64_t bad = 0;		/* regions the walk stopped early in */
+};
+
+/* One stream's last sent metadata */
+class hdr_stream {
+public:
+	hdr_stream() { reset(); }
+	hdr_stream(const hdr_stream &) = delete;
+	hdr_stream &operator=(const hdr_stream &) = delete;
+
+	/* Back to SDR, as on a seek or a new stream; the next HDR frame emits */
+	void reset()
+	{
+		memset(&md_, 0, sizeof(md_));
+		md_.hdr_plus_payload = (uint64_t)(uintptr_t)plus_;
+		sent_ = false;
+		vui_seen_ = false;
+	}
+
+	/*
+	 * Fold in the extradata region of one frame.  Returns 1 and points
+	 * @out at the metadata to set when the sink must see a change, 0 when
+	 * nothing it sees changed, or a negative errno for a region that
+	 * cannot be read at all.  *@out stays valid until the next update().
+	 */
+	int update(const void *region, size_t size, const drm_msm_ext_hdr_metadata **out)
+	{
+		extradata x;
+		hdr_frame f;
+		hdr_visitor v;
+		int ret;
+
+		st_.frames++;
+		ret = x.init(region, size);
+		if (ret)
+			return ret;
+		v.f = &f;
+		if (walk(x, v) < 0)
+			st_.bad++;
+		return apply(f, out);
+	}
+
+	/* The same, for a frame whose records were already picked out */
+	int apply(const hdr_frame &f, const drm_msm_ext_hdr_metadata **out)
+	{
+		drm_msm_ext_hdr_metadata n;
+		bool plus_changed = false;
+
+		/* Padding included, so the memcmp below sees only real changes */
+		memcpy(&n, &md_, sizeof(n));
+		if (!f.mdcv && !f.cll && !f.vui && !f.has_plus)
+			return 0;
+		st_.carrying++;
+
+		if (f.mdcv) {
+			for (int i = 0; i < HDR_PRIMARIES_COUNT; i++) {
+				n.display_primaries_x[i] = f.mdcv->nDisplayPrimariesX[i];
+				n.display_primaries_y[i] = f.mdcv->nDisplayPrimariesY[i];
+			}
+			n.white_point_x = f.mdcv->nWhitePointX;
+			n.white_point_y = f.mdcv->nWhitePointY;
+			n.max_luminance = f.mdcv->nMaxDisplayMasteringLuminance / 10000;
+			n.min_luminance = f.mdcv->nMinDisplayMasteringLuminance;
+			if (!vui_seen_)
+				n.eotf = HDR_EOTF_SMTPE_ST2084;
+		}
+		if (f.cll) {
+			n.max_content_light_level = f.cll->nMaxContentLight;
+			n.max_average_light_level = f.cll->nMaxPicAverageLight;
+		}
+		if (f.vui) {
+			vui_seen_ = true;
+			n.eotf = eotf(f.vui->transfer_char);
+		}
+		if (f.has_plus) {
+			if (f.plus.len > HDR_PLUS_MAX) {
+				st_.plus_dropped++;
+			} else if (f.plus.len != md_.hdr_plus_payload_size ||
+				   memcmp(plus_, f.plus.data, f.plus.len)) {
+				n.hdr_plus_payload_size = f.plus.len;
+				plus_changed = true;
+			}
+		}
+		n.hdr_supported = n.eotf != HDR_EOTF_SDR_LUM_RANGE;
+		n.hdr_state = n.hdr_supported ? HDR_STATE_ON : HDR_STATE_OFF;
+
+		if (sent_ && !plus_changed && !memcmp(&n, &md_, sizeof(n)))
+			return 0;
+		if (plus_changed)
+			memcpy(plus_, f.plus.data, f.plus.len);
+		memcpy(&md_, &n, sizeof(n));
+		sent_ = true;
+		st_.emitted++;
+		*out = &md_;
+		return 1;
+	}
+
+	const drm_msm_ext_hdr_metadata &current() const { return md_; }
+	const hdr_stream_stats &stats() const { return st_; }
+
+	static uint32_t eotf(uint32_t transfer_char)
+	{
+		switch (transfer_char) {
+		case MSM_VIDC_TRANSFER_SMPTE_ST2084:
+			return HDR_EOTF_SMTPE_ST2084;
+		case MSM_VIDC_TRANSFER_HLG:
+			return HDR_EOTF_HLG;
+		default:
+			return HDR_EOTF_SDR_LUM_RANGE;
+		}
+	}
+
+private:
+	drm_msm_ext_hdr_metadata md_;
+	uint8_t plus_[HDR_PLUS_MAX];
+	bool sent_ = false, vui_seen_ = false;
+	hdr_stream_stats st_;
+};
+
+} /* namespace vidc */
+
+#endif /* __TOOLS_MEDIA_HDR_META_H__ */
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Replay decoder extradata through the HDR metadata translator and count
+ * the display property updates it saves.
+ *
+ * Build: g++ -std=c++17 -O2 -I../../kernel-headers -o hdr_replay hdr_replay.cpp
+ * Usage: hdr_replay [-S region] [-v] <dump>...
+ *        hdr_replay -g seconds [-n streams] [-r fps] [-o dir] [-v]
+ *
+ * Every dump is one stream: extradata regions of -S bytes (default
+ * VENUS_EXTRADATA_SIZE) back to back, one per decoded frame.  Each goes
+ * through its own vidc::hdr_stream.  A player that sets the HDR property
+ * on every frame that carries HDR metadata makes as many updates as
+ * there are such frames; the translator makes one per change.  Both are
+ * reported per stream and in total, with the time per frame and the
+ * heap allocations made while replaying, which should be none.  -v
+ * prints every emitted blob.
+ *
+ * -g replays -n (default 8) synthetic streams of that many seconds at -r
+ * fps (default 30) instead: mastering display, light level and VUI on
+ * every one-second IRAP, HDR10+ on every frame, constant within scenes
+ * of two to ten seconds; a quarter of the streams are HLG without
+ * HDR10+, and every eighth switches mastering data half way through.
+ * -o also writes them to <dir>/stream-N.xd, ready to replay.
+ *
+ * Example:
+ *   hdr_replay -g 600 -n 16 -r 60
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../lib/mapped_file.h"
+#include "hdr_meta.h"
+
+/* Heap allocations made by anything, to check the replay makes none */
+static uint64_t allocations;
+
+void *operator new(size_t n)
+{
+	void *p;
+
+	allocations++;
+	p = malloc(n ? n : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static void print_blob(const char *name, uint64_t frame, const drm_msm_ext_hdr_metadata *m)
+{
+	printf("%s frame %lu: state %u eotf %u, G %u,%u B %u,%u R %u,%u W %u,%u, "
+	       "lum %u/%u, cll %u fall %u, hdr10+ %u bytes\n", name,
+	       (unsigned long)frame, m->hdr_state, m->eotf, m->display_primaries_x[0],
+	       m->display_primaries_y[0], m->display_primaries_x[1], m->display_primaries_y[1],
+	       m->display_primaries_x[2], m->display_primaries_y[2], m->white_point_x,
+	       m->white_point_y, m->max_luminance, m->min_luminance, m->max_content_light_level,
+	       m->max_average_light_level, m->hdr_plus_payload_size);
+}
+
+/*
+ * A synthetic stream's extradata, a frame at a time.  BT.2020 primaries
+ * on a 1000 or 4000 nit mastering display, in SEI units.
+ */
+struct synth_stream {
+	uint64_t x;
+	uint32_t fps, frames, frame = 0, scene_end = 0;
+	bool hlg, switches;
+	uint8_t plus[96];
+
+	void region(uint8_t *buf, size_t size)
+	{
+		vidc::writer w = { buf, size };
+		bool late = switches && frame >= frames / 2;
+
+		if (frame % fps == 0) {
+			auto *m = w.add<msm_vidc_mastering_display_colour_sei_payload>(
+				MSM_VIDC_EXTRADATA_MASTERING_DISPLAY_COLOUR_SEI);
+			auto *c = w.add<msm_vidc_content_light_level_sei_payload>(
+				MSM_VIDC_EXTRADATA_CONTENT_LIGHT_LEVEL_SEI);
+			auto *v = w.add<msm_vidc_vui_display_info_payload>(
+				MSM_VIDC_EXTRADATA_VUI_DISPLAY_INFO);
+			static const uint32_t px[3] = { 8500, 6550, 35400 };
+			static const uint32_t py[3] = { 39850, 2300, 14600 };
+
+			memcpy(m->nDisplayPrimariesX, px, sizeof(px));
+			memcpy(m->nDisplayPrimariesY, py, sizeof(py));
+			m->nWhitePointX = 15635;
+			m->nWhitePointY = 16450;
+			m->nMaxDisplayMasteringLuminance = late ? 40000000 : 10000000;
+			m->nMinDisplayMasteringLuminance = 50;
+			c->nMaxContentLight = late ? 3000 : 1000;
+			c->nMaxPicAverageLight = 400;
+			memset(v, 0, sizeof(*v));
+			v->video_signal_present_flag = 1;
+			v->color_description_present_flag = 1;
+			v->color_primaries = MSM_VIDC_BT2020;
+			v->matrix_coeffs = MSM_VIDC_MATRIX_BT_2020;
+			v->transfer_char = hlg ? MSM_VIDC_TRANSFER_HLG : MSM_VIDC_TRANSFER_SMPTE_ST2084;
+		}
+		if (!hlg) {
+			uint32_t *p = reinterpret_cast<uint32_t *>(
+				w.add(MSM_VIDC_EXTRADATA_HDR10PLUS_METADATA, 4 + sizeof(plus)));
+
+			if (frame >= scene_end) {
+				scene_end = frame + fps * (2 + xorshift(&x) % 9);
+				for (uint8_t &b : plus)
+					b = (uint8_t)xorshift(&x);
+			}
+			p[0] = sizeof(plus);
+			memcpy(p + 1, plus, sizeof(plus));
+		}
+		w.finish();
+		frame++;
+	}
+};
+
+struct result {
+	std::string name;
+	vidc::hdr_stream_stats st;
+};
+
+/*
+ * Replay @n regions of @size bytes from @get(i) through a fresh stream,
+ * adding the heap allocations made meanwhile to @allocs.
+ */
+template <typename G>
+static vidc::hdr_stream_stats replay(const char *name, uint64_t n, size_t size, bool verbose,
+				     G get, uint64_t *allocs)
+{
+	vidc::hdr_stream s;
+	uint64_t before = allocations;
+
+	for (uint64_t i = 0; i < n; i++) {
+		const drm_msm_ext_hdr_metadata *m;
+
+		if (s.update(get(i), size, &m) > 0 && verbose)
+			print_blob(name, i, m);
+	}
+	*allocs += allocations - before;
+	return s.stats();
+}
+
+static int write_dump(const std::string &path, const std::vector<uint32_t> &buf)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	size_t len = buf.size() * 4;
+	int ret = 0;
+
+	if (fd < 0 || write(fd, buf.data(), len) != (ssize_t)len)
+		ret = -errno;
+	if (fd >= 0)
+		close(fd);
+	if (ret)
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(-ret));
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t region = VENUS_EXTRADATA_SIZE(0, 0);
+	uint32_t streams = 8, fps = 30;
+	std::vector<result> res;
+	vidc::hdr_stream_stats total;
+	uint64_t allocs = 0;
+	double gen = 0, t0, t = 0;
+	bool verbose = false;
+	std::string dir;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "S:g:n:r:o:v")) != -1) {
+		switch (opt) {
+		case 'S':
+			region = (size_t)atol(optarg);
+			break;
+		case 'g':
+			gen = atof(optarg);
+			break;
+		case 'n':
+			streams = (uint32_t)atoi(optarg);
+			break;
+		case 'r':
+			fps = (uint32_t)atoi(optarg);
+			break;
+		case 'o':
+			dir = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (!region || (region & 3) || !fps || (gen > 0 ? optind != argc : optind == argc)) {
+		fprintf(stderr,
+			"usage: %s [-S region] [-v] <dump>...\n"
+			"       %s -g seconds [-n streams] [-r fps] [-o dir] [-v]\n", argv[0], argv[0]);
+		return 1;
+	}
+	if (!dir.empty() && mkdir(dir.c_str(), 0755) && errno != EEXIST) {
+		fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+		return 1;
+	}
+	if (gen > 0) {
+		for (uint32_t s = 0; s < streams; s++) {
+			std::string name = "synth-" + std::to_string(s);
+			std::vector<uint32_t> buf;
+			synth_stream g = {};
+
+			g.x = 0x2545f4914f6cdd1dull * (s + 1);
+			g.fps = fps;
+			g.frames = (uint32_t)(gen * fps);
+			g.hlg = s % 4 == 3;
+			g.switches = s % 8 == 5;
+			buf.resize(g.frames * (region / 4));
+			for (uint32_t i = 0; i < g.frames; i++)
+				g.region(reinterpret_cast<uint8_t *>(&buf[i * (region / 4)]), region);
+			if (!dir.empty() &&
+			    write_dump(dir + "/stream-" + std::to_string(s) + ".xd", buf))
+				return 1;
+
+			t0 = now_us();
+			res.push_back({ name, replay(name.c_str(), g.frames, region, verbose,
+						     [&](uint64_t i) { return &buf[i * (region / 4)]; },
+						     &allocs) });
+			t += now_us() - t0;
+		}
+	} else {
+		for (int i = optind; i < argc; i++) {
+			lib::mapped_file f;
+			int ret = f.open(argv[i]);
+
+			if (ret) {
+				fprintf(stderr, "%s: %s\n", argv[i], strerror(-ret));
+				return 1;
+			}
+			t0 = now_us();
+			res.push_back({ argv[i], replay(argv[i], f.size() / region, region, verbose,
+							[&](uint64_t k) { return f.data() + k * region; },
+							&allocs) });
+			t += now_us() - t0;
+		}
+	}
+
+	printf("%-24s %9s %9s %9s %9s %8s\n", "stream", "frames", "carrying", "emitted", "avoided",
+	       "avoided%");
+	for (const result &r : res) {
+		const vidc::hdr_stream_stats &st = r.st;
+
+		printf("%-24s %9lu %9lu %9lu %9lu %7.2f%%\n", r.name.c_str(), (unsigned long)st.frames,
+		       (unsigned long)st.carrying, (unsigned long)st.emitted,
+		       (unsigned long)(st.carrying - st.emitted),
+		       st.carrying ? 100.0 * (st.carrying - st.emitted) / st.carrying : 0.0);
+		if (st.bad || st.plus_dropped)
+			printf("%-24s %lu regions stopped early, %lu HDR10+ payloads too large\n", "",
+			       (unsigned long)st.bad, (unsigned long)st.plus_dropped);
+		total.frames += st.frames;
+		total.carrying += st.carrying;
+		total.emitted += st.emitted;
+	}
+	printf("%-24s %9lu %9lu %9lu %9lu %7.2f%%\n", "total", (unsigned long)total.frames,
+	       (unsigned long)total.carrying, (unsigned long)total.emitted,
+	       (unsigned long)(total.carrying - total.emitted),
+	       total.carrying ? 100.0 * (total.carrying - total.emitted) / total.carrying : 0.0);
+	printf("%.0f ns per frame, %lu heap allocations while replaying\n",
+	       total.frames ? t * 1e3 / total.frames : 0.0, (unsigned long)allocs);
+	return allocs ? 1 : 0;
+}
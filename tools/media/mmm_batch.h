@@ -0,0 +1,447 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * MMM_COLOR_FMT buffer planning for whole arrays of requests.
+ *
+ * The display side mmm_color_fmt.h repeats the Venus buffer math under
+ * its own format numbering (there is no NV12_128), so the per-format
+ * rows are venus_geom.h's, reached through a renumbering table.  What
+ * changes is the shape of the call: a compositor that replans its layer
+ * pools on a mode switch asks for hundreds of (format, width, height)
+ * triples at once, and wants strides, scanlines, meta plane sizes and
+ * the buffer size for each.
+ *
+ * Requests are bucketed by format with a counting sort.  Inside a bucket
+ * the format constants are uniform, so the widths and heights run
+ * through AVX2, SSE4.1 or NEON lanes (whichever the build targets, one
+ * at a time otherwise) with no per-lane table lookups; only the NV12
+ * UBWC field split differs between lanes, and that is a select.  Results
+ * go back to the caller's order.  A batch of one format skips the sort.
+ *
+ * Output is one column per quantity, any of which may be left NULL.
+ * Scanlines and meta scanlines are per field when the buffer is split,
+ * as MMM_COLOR_FMT_BUFFER_SIZE lays it out.  Requests with a zero width
+ * or height, or an unknown format, come back all zero.  mmm_check holds
+ * every column to the scalar header.
+ */
+
+#ifndef __TOOLS_MEDIA_MMM_BATCH_H__
+#define __TOOLS_MEDIA_MMM_BATCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "../../kernel-headers/display/media/mmm_color_fmt.h"
+#include "venus_geom.h"
+
+namespace mmm {
+
+#define MMM_NR_FMTS		(MMM_COLOR_FMT_NV12_512 + 1)
+
+enum column {
+	COL_Y_STRIDE,
+	COL_UV_STRIDE,
+	COL_Y_SCANLINES,
+	COL_UV_SCANLINES,
+	COL_Y_META_STRIDE,
+	COL_Y_META_SCANLINES,
+	COL_UV_META_STRIDE,
+	COL_UV_META_SCANLINES,
+	COL_RGB_STRIDE,
+	COL_RGB_SCANLINES,
+	COL_RGB_META_STRIDE,
+	COL_RGB_META_SCANLINES,
+	COL_META_PLANE,		/* Y or RGB meta plane, 4K aligned */
+	COL_UV_META_PLANE,
+	COL_SIZE,
+	NR_COLS,
+};
+
+static const char *const col_names[NR_COLS] = {
+	"y_stride", "uv_stride", "y_scanlines", "uv_scanlines",
+	"y_meta_stride", "y_meta_scanlines", "uv_meta_stride", "uv_meta_scanlines",
+	"rgb_stride", "rgb_scanlines", "rgb_meta_stride", "rgb_meta_scanlines",
+	"meta_plane", "uv_meta_plane", "size",
+};
+
+/* Where to store each quantity; NULL columns are not computed */
+struct columns {
+	uint32_t *col[NR_COLS];
+};
+
+/* mmm_color_fmts value to its color_fmts twin; anything else to the empty row */
+constexpr unsigned int venus_fmt(unsigned int fmt)
+{
+	switch (fmt) {
+	case MMM_COLOR_FMT_NV12:		return COLOR_FMT_NV12;
+	case MMM_COLOR_FMT_NV21:		return COLOR_FMT_NV21;
+	case MMM_COLOR_FMT_NV12_UBWC:		return COLOR_FMT_NV12_UBWC;
+	case MMM_COLOR_FMT_NV12_BPP10_UBWC:	return COLOR_FMT_NV12_BPP10_UBWC;
+	case MMM_COLOR_FMT_RGBA8888:		return COLOR_FMT_RGBA8888;
+	case MMM_COLOR_FMT_RGBA8888_UBWC:	return COLOR_FMT_RGBA8888_UBWC;
+	case MMM_COLOR_FMT_RGBA1010102_UBWC:	return COLOR_FMT_RGBA1010102_UBWC;
+	case MMM_COLOR_FMT_RGB565_UBWC:		return COLOR_FMT_RGB565_UBWC;
+	case MMM_COLOR_FMT_P010_UBWC:		return COLOR_FMT_P010_UBWC;
+	case MMM_COLOR_FMT_P010:		return COLOR_FMT_P010;
+	case MMM_COLOR_FMT_NV12_512:		return COLOR_FMT_NV12_512;
+	default:				return VENUS_NR_FMTS;
+	}
+}
+
+inline const venus::layout &lookup(unsigned int fmt)
+{
+	return venus::layouts[venus_fmt(fmt)];
+}
+
+/*
+ * The lane type: unsigned 32-bit lanes with wrap-around arithmetic, as
+ * the header's unsigned int has.  Masks are all ones or all zeros.
+ */
+#if defined(__AVX2__)
+
+static const char isa[] = "avx2";
+
+struct vec {
+	__m256i v;
+	enum { lanes = 8 };
+};
+
+inline vec load(const uint32_t *p) { return { _mm256_loadu_si256((const __m256i *)p) }; }
+inline void store(uint32_t *p, vec a) { _mm256_storeu_si256((__m256i *)p, a.v); }
+inline vec splat(uint32_t x) { return { _mm256_set1_epi32((int)x) }; }
+inline vec operator+(vec a, vec b) { return { _mm256_add_epi32(a.v, b.v) }; }
+inline vec operator*(vec a, vec b) { return { _mm256_mullo_epi32(a.v, b.v) }; }
+inline vec operator&(vec a, vec b) { return { _mm256_and_si256(a.v, b.v) }; }
+inline vec operator|(vec a, vec b) { return { _mm256_or_si256(a.v, b.v) }; }
+inline vec andnot(vec m, vec a) { return { _mm256_andnot_si256(m.v, a.v) }; }
+inline vec shr(vec a, unsigned int n) { return { _mm256_srl_epi32(a.v, _mm_cvtsi32_si128((int)n)) }; }
+inline vec is_zero(vec a) { return { _mm256_cmpeq_epi32(a.v, _mm256_setzero_si256()) }; }
+inline vec at_most(vec a, uint32_t x) { return { _mm256_cmpeq_epi32(_mm256_min_epu32(a.v, _mm256_set1_epi32((int)x)), a.v) }; }
+inline vec select(vec m, vec a, vec b) { return { _mm256_blendv_epi8(b.v, a.v, m.v) }; }
+
+/* x / 3 as (x * 0xaaaaaaab) >> 33, even and odd lanes apart */
+inline vec div3(vec a)
+{
+	const __m256i k = _mm256_set1_epi32((int)0xaaaaaaab);
+	__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(a.v, k), 33);
+	__m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a.v, 32), k), 33);
+
+	return { _mm256_or_si256(even, _mm256_slli_epi64(odd, 32)) };
+}
+
+#elif defined(__SSE4_1__)
+
+static const char isa[] = "sse4.1";
+
+struct vec {
+	__m128i v;
+	enum { lanes = 4 };
+};
+
+inline vec load(const uint32_t *p) { return { _mm_loadu_si128((const __m128i *)p) }; }
+inline void store(uint32_t *p, vec a) { _mm_storeu_si128((__m128i *)p, a.v); }
+inline vec splat(uint32_t x) { return { _mm_set1_epi32((int)x) }; }
+inline vec operator+(vec a, vec b) { return { _mm_add_epi32(a.v, b.v) }; }
+inline vec operator*(vec a, vec b) { return { _mm_mullo_epi32(a.v, b.v) }; }
+inline vec operator&(vec a, vec b) { return { _mm_and_si128(a.v, b.v) }; }
+inline vec operator|(vec a, vec b) { return { _mm_or_si128(a.v, b.v) }; }
+inline vec andnot(vec m, vec a) { return { _mm_andnot_si128(m.v, a.v) }; }
+inline vec shr(vec a, unsigned int n) { return { _mm_srl_epi32(a.v, _mm_cvtsi32_si128((int)n)) }; }
+inline vec is_zero(vec a) { return { _mm_cmpeq_epi32(a.v, _mm_setzero_si128()) }; }
+inline vec at_most(vec a, uint32_t x) { return { _mm_cmpeq_epi32(_mm_min_epu32(a.v, _mm_set1_epi32((int)x)), a.v) }; }
+inline vec select(vec m, vec a, vec b) { return { _mm_blendv_epi8(b.v, a.v, m.v) }; }
+
+inline vec div3(vec a)
+{
+	const __m128i k = _mm_set1_epi32((int)0xaaaaaaab);
+	__m128i even = _mm_srli_epi64(_mm_mul_epu32(a.v, k), 33);
+	__m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(a.v, 32), k), 33);
+
+	return { _mm_or_si128(even, _mm_slli_epi64(odd, 32)) };
+}
+
+#elif defined(__ARM_NEON)
+
+static const char isa[] = "neon";
+
+struct vec {
+	uint32x4_t v;
+	enum { lanes = 4 };
+};
+
+inline vec load(const uint32_t *p) { return { vld1q_u32(p) }; }
+inline void store(uint32_t *p, vec a) { vst1q_u32(p, a.v); }
+inline vec splat(uint32_t x) { return { vdupq_n_u32(x) }; }
+inline vec operator+(vec a, vec b) { return { vaddq_u32(a.v, b.v) }; }
+inline vec operator*(vec a, vec b) { return { vmulq_u32(a.v, b.v) }; }
+inline vec operator&(vec a, vec b) { return { vandq_u32(a.v, b.v) }; }
+inline vec operator|(vec a, vec b) { return { vorrq_u32(a.v, b.v) }; }
+inline vec andnot(vec m, vec a) { return { vbicq_u32(a.v, m.v) }; }
+inline vec shr(vec a, unsigned int n) { return { vshlq_u32(a.v, vdupq_n_s32(-(int)n)) }; }
+inline vec is_zero(vec a) { return { vceqq_u32(a.v, vdupq_n_u32(0)) }; }
+inline vec at_most(vec a, uint32_t x) { return { vcleq_u32(a.v, vdupq_n_u32(x)) }; }
+inline vec select(vec m, vec a, vec b) { return { vbslq_u32(m.v, a.v, b.v) }; }
+
+inline vec div3(vec a)
+{
+	const uint32x2_t k = vdup_n_u32(0xaaaaaaab);
+	uint32x2_t lo = vshrn_n_u64(vmull_u32(vget_low_u32(a.v), k), 32);
+	uint32x2_t hi = vshrn_n_u64(vmull_u32(vget_high_u32(a.v), k), 32);
+
+	return { vshrq_n_u32(vcombine_u32(lo, hi), 1) };
+}
+
+#else
+
+static const char isa[] = "scalar";
+
+struct vec {
+	uint32_t v;
+	enum { lanes = 1 };
+};
+
+inline vec load(const uint32_t *p) { return { *p }; }
+inline void store(uint32_t *p, vec a) { *p = a.v; }
+inline vec splat(uint32_t x) { return { x }; }
+inline vec operator+(vec a, vec b) { return { a.v + b.v }; }
+inline vec operator*(vec a, vec b) { return { a.v * b.v }; }
+inline vec operator&(vec a, vec b) { return { a.v & b.v }; }
+inline vec operator|(vec a, vec b) { return { a.v | b.v }; }
+inline vec andnot(vec m, vec a) { return { ~m.v & a.v }; }
+inline vec shr(vec a, unsigned int n) { return { a.v >> n }; }
+inline vec is_zero(vec a) { return { 0u - (uint32_t)!a.v }; }
+inline vec at_most(vec a, uint32_t x) { return { 0u - (uint32_t)(a.v <= x) }; }
+inline vec select(vec m, vec a, vec b) { return { (m.v & a.v) | (~m.v & b.v) }; }
+inline vec div3(vec a) { return { venus::div(a.v, venus::make_div(3)) }; }
+
+#endif
+
+/* venus::div, align, align2, roundup and roundup2 over lanes */
+inline vec div(vec x, const venus::divisor &d)
+{
+	x = shr(x, d.shift);
+	return d.by3 ? div3(x) : x;
+}
+
+inline vec align(vec x, const venus::divisor &d)
+{
+	return d.d == 1 ? x : div(x + splat(d.d - 1), d) * splat(d.d);
+}
+
+inline vec align2(vec x, uint32_t a)
+{
+	return (x + splat(a - 1)) & splat(~(a - 1));
+}
+
+inline vec roundup(vec x, const venus::divisor &d)
+{
+	return div(x + splat(d.d - 1), d);
+}
+
+inline vec roundup2(vec x, unsigned int shift)
+{
+	return shr(x + splat((1u << shift) - 1), shift);
+}
+
+/* One column of one vector; empty requests come out zero */
+inline void put(uint32_t *dst, size_t i, vec empty, vec v)
+{
+	if (dst)
+		store(dst + i, andnot(empty, v));
+}
+
+/*
+ * Requests of format @l, a whole number of vectors of them: w[] and h[]
+ * in, dst[c][] out for every non-NULL column.  Linear YUV planes are
+ * packed, the rest page aligned, exactly as in venus::compute().  The
+ * format tests are the same on every pass, so they cost next to nothing;
+ * the stores are spelled out rather than looped over, which keeps the
+ * column pointers in registers.
+ */
+inline void plan_lanes(const venus::layout &l, bool may_split, const uint32_t *w,
+		       const uint32_t *h, size_t n, uint32_t *const dst[NR_COLS])
+{
+	const vec zero = splat(0), one = splat(1);
+	bool yuv = l.yuv_m, pm = l.page_m;
+
+	for (size_t i = 0; i < n; i += vec::lanes) {
+		vec vw = load(w + i), vh = load(h + i);
+		vec empty = is_zero(vw) | is_zero(vh);
+		vec split = zero, fh, s, ys, uvs = zero, ms = zero, mss = zero;
+		vec ums = zero, umss = zero, bytes, data, uv = zero, meta = zero, uv_meta = zero;
+
+		if (may_split)
+			split = at_most(vw, INTERLACE_WIDTH_MAX) &
+				at_most(vh, INTERLACE_HEIGHT_MAX) &
+				at_most(shr(vh * vw, 8), INTERLACE_MB_PER_FRAME_MAX);
+		fh = select(split, shr(vh + one, 1), vh);
+
+		s = align2(div(align(vw, l.pre) * splat(l.mul), l.den), l.stride);
+		ys = align2(fh, l.y_scan);
+		data = s * ys;
+		if (yuv) {
+			uvs = align2(shr(fh + one, 1), l.uv_scan);
+			uv = s * uvs;
+		}
+		if (pm) {
+			data = align2(data, 4096);
+			uv = align2(uv, 4096);
+		}
+		if (l.meta_m) {
+			ms = align2(roundup(vw, l.y_tile_w), 64);
+			mss = align2(roundup2(fh, l.y_tile_h), 16);
+			meta = align2(ms * mss, 4096);
+		}
+		if (l.uv_meta_m) {
+			ums = align2(roundup(shr(vw + one, 1), l.uv_tile_w), 64);
+			umss = align2(roundup2(shr(fh + one, 1), l.uv_tile_h), 16);
+			uv_meta = align2(ums * umss, 4096);
+		}
+		bytes = meta + data + uv_meta + uv;
+		bytes = select(split, bytes + bytes, bytes);
+
+		put(dst[COL_Y_STRIDE], i, empty, yuv ? s : zero);
+		put(dst[COL_UV_STRIDE], i, empty, yuv ? s : zero);
+		put(dst[COL_Y_SCANLINES], i, empty, yuv ? ys : zero);
+		put(dst[COL_UV_SCANLINES], i, empty, uvs);
+		put(dst[COL_Y_META_STRIDE], i, empty, yuv ? ms : zero);
+		put(dst[COL_Y_META_SCANLINES], i, empty, yuv ? mss : zero);
+		put(dst[COL_UV_META_STRIDE], i, empty, ums);
+		put(dst[COL_UV_META_SCANLINES], i, empty, umss);
+		put(dst[COL_RGB_STRIDE], i, empty, yuv ? zero : s);
+		put(dst[COL_RGB_SCANLINES], i, empty, yuv ? zero : ys);
+		put(dst[COL_RGB_META_STRIDE], i, empty, yuv ? zero : ms);
+		put(dst[COL_RGB_META_SCANLINES], i, empty, yuv ? zero : mss);
+		put(dst[COL_META_PLANE], i, empty, meta);
+		put(dst[COL_UV_META_PLANE], i, empty, uv_meta);
+		put(dst[COL_SIZE], i, empty, align2(bytes, 4096));
+	}
+}
+
+/*
+ * Requests all of format @fmt.  BUFFER_SIZE_USED when @used, which only
+ * differs for progressive NV12 UBWC.
+ */
+inline void plan(unsigned int fmt, const uint32_t *w, const uint32_t *h, size_t n,
+		 const columns &out, bool used = false, bool interlace = false)
+{
+	const venus::layout l = lookup(fmt);	/* a copy: out[] may not alias it */
+	bool may_split = l.fields && (!used || interlace);
+	size_t body = n - n % vec::lanes;
+	uint32_t tw[vec::lanes] = {}, th[vec::lanes] = {};
+	uint32_t tail[NR_COLS][vec::lanes], *dst[NR_COLS];
+
+	if (l.kind == venus::KIND_NONE) {
+		for (int c = 0; c < NR_COLS; c++)
+			if (out.col[c])
+				memset(out.col[c], 0, n * sizeof(uint32_t));
+		return;
+	}
+
+	plan_lanes(l, may_split, w, h, body, out.col);
+	if (body == n)
+		return;
+
+	/* The last partial vector, padded with empty requests */
+	memcpy(tw, w + body, (n - body) * sizeof(uint32_t));
+	memcpy(th, h + body, (n - body) * sizeof(uint32_t));
+	for (int c = 0; c < NR_COLS; c++)
+		dst[c] = out.col[c] ? tail[c] : NULL;
+	plan_lanes(l, may_split, tw, th, vec::lanes, dst);
+	for (int c = 0; c < NR_COLS; c++)
+		if (out.col[c])
+			memcpy(out.col[c] + body, tail[c], (n - body) * sizeof(uint32_t));
+}
+
+/*
+ * Mixed formats.  Each format's requests are copied out to a run padded
+ * to whole vectors with empty ones, so no run has a tail; the results
+ * are then read back in the caller's order.  Keeps its scratch between
+ * calls, so a compositor holding one planner does not allocate once it
+ * has seen its largest batch.
+ */
+class planner {
+public:
+	void plan(const uint32_t *fmt, const uint32_t *w, const uint32_t *h, size_t n,
+		  const columns &out, bool used = false, bool interlace = false)
+	{
+		size_t count[MMM_NR_FMTS + 1] = {}, start[MMM_NR_FMTS + 2] = {};
+		size_t fill[MMM_NR_FMTS + 1], m;
+		columns tmp = {};
+		size_t ncols = 0;
+
+		if (!n)
+			return;
+		for (size_t i = 0; i < n; i++)
+			count[bucket(fmt[i])]++;
+		for (unsigned int b = 0; b <= MMM_NR_FMTS; b++) {
+			if (count[b] == n) {
+				mmm::plan(fmt[0], w, h, n, out, used, interlace);
+				return;
+			}
+			start[b + 1] = start[b] + (count[b] + vec::lanes - 1) / vec::lanes * vec::lanes;
+		}
+		m = start[MMM_NR_FMTS + 1];
+
+		for (int c = 0; c < NR_COLS; c++)
+			ncols += out.col[c] != NULL;
+		pos.resize(n);
+		sw.assign(m, 0);
+		sh.assign(m, 0);
+		scratch.resize(m * ncols);
+
+		memcpy(fill, start, sizeof(fill));
+		for (size_t i = 0; i < n; i++) {
+			size_t k = fill[bucket(fmt[i])]++;
+
+			pos[i] = (uint32_t)k;
+			sw[k] = w[i];
+			sh[k] = h[i];
+		}
+		for (int c = 0, j = 0; c < NR_COLS; c++)
+			if (out.col[c])
+				tmp.col[c] = &scratch[m * j++];
+
+		for (unsigned int b = 0; b <= MMM_NR_FMTS; b++) {
+			columns part = {};
+
+			if (!count[b])
+				continue;
+			for (int c = 0; c < NR_COLS; c++)
+				if (tmp.col[c])
+					part.col[c] = tmp.col[c] + start[b];
+			mmm::plan(b, &sw[start[b]], &sh[start[b]], start[b + 1] - start[b], part,
+				  used, interlace);
+		}
+
+		for (int c = 0; c < NR_COLS; c++) {
+			uint32_t *d = out.col[c];
+			const uint32_t *t = tmp.col[c];
+
+			if (!d)
+				continue;
+			for (size_t i = 0; i < n; i++)
+				d[i] = t[pos[i]];
+		}
+	}
+
+private:
+	static unsigned int bucket(uint32_t fmt)
+	{
+		return fmt < MMM_NR_FMTS ? fmt : MMM_NR_FMTS;
+	}
+
+	std::vector<uint32_t> pos, sw, sh, scratch;
+};
+
+} /* namespace mmm */
+
+#endif /* __TOOLS_MEDIA_MMM_BATCH_H__ */
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Check mmm_batch.h against mmm_color_fmt.h and time the two.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -o mmm_check mmm_check.cpp
+ * Usage: mmm_check [-m max] [-s step] [-c | -b] [-n requests]
+ *
+ * One batch per height covers every format (plus a few past the last),
+ * every step-th width from 0 to max, in shuffled order, and goes through
+ * the planner for BUFFER_SIZE and for BUFFER_SIZE_USED with and without
+ * interlace; each format's slice also goes through the single-format
+ * call.  Every column of every request is compared with what the scalar
+ * MMM_COLOR_FMT_* helpers give, the scanlines taken per field when NV12
+ * UBWC is split.  The first mismatches are printed and the exit status
+ * is 1.
+ *
+ * The benchmark plans batches of random layer requests, as a mode
+ * switch would, in mixed formats and in one format, for all columns and
+ * for the size alone, and reports requests per microsecond for the
+ * scalar header loop and for the batch API.  The lane width depends on
+ * the -m flags the build uses.  -c only checks, -b only times.
+ *
+ * Example:
+ *   mmm_check -m 4096 -s 2
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "mmm_batch.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Every column the way the scalar header has it */
+static void reference(unsigned int f, uint32_t w, uint32_t h, bool used, bool interlace,
+		      uint32_t *col)
+{
+	bool split = f == MMM_COLOR_FMT_NV12_UBWC && (!used || interlace) &&
+		     w <= INTERLACE_WIDTH_MAX && h <= INTERLACE_HEIGHT_MAX &&
+		     (h * w) / 256 <= INTERLACE_MB_PER_FRAME_MAX;
+	uint32_t fh = split ? (h + 1) >> 1 : h;
+
+	if (!w || !h) {
+		memset(col, 0, mmm::NR_COLS * sizeof(*col));
+		return;
+	}
+	col[mmm::COL_Y_STRIDE] = MMM_COLOR_FMT_Y_STRIDE(f, w);
+	col[mmm::COL_UV_STRIDE] = MMM_COLOR_FMT_UV_STRIDE(f, w);
+	col[mmm::COL_Y_SCANLINES] = MMM_COLOR_FMT_Y_SCANLINES(f, fh);
+	col[mmm::COL_UV_SCANLINES] = MMM_COLOR_FMT_UV_SCANLINES(f, fh);
+	col[mmm::COL_Y_META_STRIDE] = MMM_COLOR_FMT_Y_META_STRIDE(f, w);
+	col[mmm::COL_Y_META_SCANLINES] = MMM_COLOR_FMT_Y_META_SCANLINES(f, fh);
+	col[mmm::COL_UV_META_STRIDE] = MMM_COLOR_FMT_UV_META_STRIDE(f, w);
+	col[mmm::COL_UV_META_SCANLINES] = MMM_COLOR_FMT_UV_META_SCANLINES(f, fh);
+	col[mmm::COL_RGB_STRIDE] = MMM_COLOR_FMT_RGB_STRIDE(f, w);
+	col[mmm::COL_RGB_SCANLINES] = MMM_COLOR_FMT_RGB_SCANLINES(f, h);
+	col[mmm::COL_RGB_META_STRIDE] = MMM_COLOR_FMT_RGB_META_STRIDE(f, w);
+	col[mmm::COL_RGB_META_SCANLINES] = MMM_COLOR_FMT_RGB_META_SCANLINES(f, h);
+	col[mmm::COL_META_PLANE] =
+		MMM_COLOR_FMT_ALIGN(col[mmm::COL_Y_META_STRIDE] * col[mmm::COL_Y_META_SCANLINES],
+				    4096) +
+		MMM_COLOR_FMT_ALIGN(col[mmm::COL_RGB_META_STRIDE] *
+				    col[mmm::COL_RGB_META_SCANLINES], 4096);
+	col[mmm::COL_UV_META_PLANE] =
+		MMM_COLOR_FMT_ALIGN(col[mmm::COL_UV_META_STRIDE] *
+				    col[mmm::COL_UV_META_SCANLINES], 4096);
+	col[mmm::COL_SIZE] = used ? MMM_COLOR_FMT_BUFFER_SIZE_USED(f, w, h, interlace) :
+				    MMM_COLOR_FMT_BUFFER_SIZE(f, w, h);
+}
+
+struct batch {
+	std::vector<uint32_t> fmt, w, h;
+	std::vector<uint32_t> cols;
+	mmm::columns out;
+
+	void resize(size_t n)
+	{
+		fmt.resize(n);
+		w.resize(n);
+		h.resize(n);
+		cols.resize(n * mmm::NR_COLS);
+		for (int c = 0; c < mmm::NR_COLS; c++)
+			out.col[c] = &cols[n * c];
+	}
+};
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static int check(uint32_t max, uint32_t step)
+{
+	static const struct {
+		bool used, interlace;
+	} modes[] = { { false, false }, { true, false }, { true, true } };
+	const unsigned int nr_fmts = MMM_NR_FMTS + 3;
+	mmm::planner p;
+	batch b;
+	uint64_t n = 0, bad = 0, x = 1;
+	double t0 = now_us();
+	uint32_t want[mmm::NR_COLS];
+
+	std::vector<uint32_t> widths;
+	for (uint32_t w = 0; w <= max; w += w < 2 ? 1 : step)
+		widths.push_back(w);
+	b.resize(widths.size() * nr_fmts);
+
+	auto compare = [&](const char *how, size_t i, bool used, bool il) {
+		uint32_t f = b.fmt[i], w = b.w[i], h = b.h[i];
+
+		reference(f, w, h, used, il, want);
+		for (int c = 0; c < mmm::NR_COLS; c++, n++) {
+			if (want[c] == b.out.col[c][i] || bad++ >= 10)
+				continue;
+			fprintf(stderr, "%s %s(%u, %u, %u, used %d, il %d): header %u, batch %u\n",
+				how, mmm::col_names[c], f, w, h, used, il, want[c],
+				b.out.col[c][i]);
+		}
+	};
+
+	for (uint32_t h = 0; h <= max; h += h < 2 ? 1 : step) {
+		size_t k = 0;
+
+		for (unsigned int f = 0; f < nr_fmts; f++) {
+			for (uint32_t w : widths) {
+				b.fmt[k] = f;
+				b.w[k] = w;
+				b.h[k++] = h;
+			}
+		}
+
+		/* Single format calls on each slice, in place */
+		for (const auto &m : modes) {
+			for (unsigned int f = 0; f < nr_fmts; f++) {
+				size_t at = f * widths.size();
+				mmm::columns part;
+
+				for (int c = 0; c < mmm::NR_COLS; c++)
+					part.col[c] = b.out.col[c] + at;
+				mmm::plan(f, &b.w[at], &b.h[at], widths.size(), part, m.used,
+					  m.interlace);
+			}
+			for (size_t i = 0; i < k; i++)
+				compare("plan", i, m.used, m.interlace);
+		}
+
+		/* Then shuffled, through the planner */
+		for (size_t i = k - 1; i > 0; i--) {
+			size_t j = xorshift(&x) % (i + 1);
+
+			std::swap(b.fmt[i], b.fmt[j]);
+			std::swap(b.w[i], b.w[j]);
+		}
+		for (const auto &m : modes) {
+			p.plan(b.fmt.data(), b.w.data(), b.h.data(), k, b.out, m.used, m.interlace);
+			for (size_t i = 0; i < k; i++)
+				compare("planner", i, m.used, m.interlace);
+		}
+	}
+	printf("%s: %lu comparisons, %lu mismatches (%.1f s)\n", mmm::isa, (unsigned long)n,
+	       (unsigned long)bad, (now_us() - t0) / 1e6);
+	return bad ? -EDOM : 0;
+}
+
+/* Keep the compiler from dropping the loops */
+static void sink(const batch &b)
+{
+	static volatile uint32_t s;
+
+	for (size_t i = 0; i < b.cols.size(); i += 64)
+		s += b.cols[i];
+}
+
+static void scalar_plan(batch &b, bool size_only)
+{
+	uint32_t col[mmm::NR_COLS];
+
+	for (size_t i = 0; i < b.fmt.size(); i++) {
+		if (size_only) {
+			b.out.col[mmm::COL_SIZE][i] = MMM_COLOR_FMT_BUFFER_SIZE(b.fmt[i], b.w[i],
+										b.h[i]);
+			continue;
+		}
+		reference(b.fmt[i], b.w[i], b.h[i], false, false, col);
+		for (int c = 0; c < mmm::NR_COLS; c++)
+			b.out.col[c][i] = col[c];
+	}
+}
+
+static void bench(size_t n)
+{
+	static const unsigned int fmts[] = {
+		MMM_COLOR_FMT_NV12, MMM_COLOR_FMT_NV12_UBWC, MMM_COLOR_FMT_NV12_BPP10_UBWC,
+		MMM_COLOR_FMT_P010_UBWC, MMM_COLOR_FMT_RGBA8888, MMM_COLOR_FMT_RGBA8888_UBWC,
+		MMM_COLOR_FMT_RGBA1010102_UBWC, MMM_COLOR_FMT_RGB565_UBWC,
+	};
+	const size_t rounds = std::max<size_t>(1, (1 << 22) / n);
+	mmm::planner p;
+	batch b;
+	uint64_t x = 0x2545f4914f6cdd1dull;
+
+	b.resize(n);
+	printf("%s, %zu requests per batch, requests per us\n", mmm::isa, n);
+	printf("%-24s %8s %8s %8s\n", "", "header", "batch", "gain");
+	for (int mixed = 1; mixed >= 0; mixed--) {
+		for (size_t i = 0; i < n; i++) {
+			b.fmt[i] = mixed ? fmts[xorshift(&x) % (sizeof(fmts) / sizeof(fmts[0]))] :
+					   (unsigned int)MMM_COLOR_FMT_RGBA8888_UBWC;
+			b.w[i] = 16 + (uint32_t)(xorshift(&x) & 0xfff) * 2;
+			b.h[i] = 16 + (uint32_t)(xorshift(&x) & 0xfff) * 2;
+		}
+		for (int size_only = 0; size_only < 2; size_only++) {
+			mmm::columns out = {};
+			double t0, scalar, simd;
+			char name[32];
+
+			if (size_only)
+				out.col[mmm::COL_SIZE] = b.out.col[mmm::COL_SIZE];
+			else
+				out = b.out;
+
+			t0 = now_us();
+			for (size_t r = 0; r < rounds; r++)
+				scalar_plan(b, size_only);
+			scalar = now_us() - t0;
+			sink(b);
+
+			t0 = now_us();
+			for (size_t r = 0; r < rounds; r++)
+				p.plan(b.fmt.data(), b.w.data(), b.h.data(), n, out);
+			simd = now_us() - t0;
+			sink(b);
+
+			snprintf(name, sizeof(name), "%s, %s", mixed ? "mixed" : "one format",
+				 size_only ? "size" : "all columns");
+			printf("%-24s %8.1f %8.1f %7.2fx\n", name, rounds * n / scalar,
+			       rounds * n / simd, scalar / simd);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t max = 8192, step = 7;
+	bool do_check = true, do_bench = true;
+	size_t requests = 512;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:s:cbn:")) != -1) {
+		switch (opt) {
+		case 'm':
+			max = (uint32_t)atoi(optarg);
+			break;
+		case 's':
+			step = (uint32_t)atoi(optarg);
+			break;
+		case 'c':
+			do_bench = false;
+			break;
+		case 'b':
+			do_check = false;
+			break;
+		case 'n':
+			requests = (size_t)atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-m max] [-s step] [-c | -b] [-n requests]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!step || !requests || optind != argc) {
+		fprintf(stderr, "usage: %s [-m max] [-s step] [-c | -b] [-n requests]\n", argv[0]);
+		return 1;
+	}
+
+	if (do_check && check(max, step))
+		return 1;
+	if (do_bench)
+		bench(requests);
+	return 0;
+}
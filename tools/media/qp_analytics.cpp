@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Turn encoder extradata dumps into a QP and bitrate series, and report
+ * rate control behaviour from it.
+ *
+ * Build: g++ -std=c++17 -O2 -pthread -o qp_analytics qp_analytics.cpp
+ * Usage: qp_analytics -o <series> [-S region] [-r fps] [-j jobs] <dump>...
+ *        qp_analytics -o <series> -g seconds [-n sessions] [-r fps] [-j jobs]
+ *        qp_analytics [-w window_s] [-B target_kbps] [-t tolerance] [-j jobs] [-v] <series>
+ *
+ * Ingest: every dump is one session, extradata regions of -S bytes
+ * (default VENUS_EXTRADATA_SIZE) back to back, one per encoded frame, as
+ * extradata_scan reads them.  Sessions are spread over -j threads, each
+ * mapping its dump and writing its rows straight into the series file.
+ * -r is the sessions' nominal frame rate (default 30): the timestamp of
+ * a frame without a TIMESTAMP record, and the length of the window
+ * below.  -g ingests -n (default 64) synthetic sessions of that many
+ * seconds instead, made in memory region by region: a rate-controlled
+ * encoder with a GOP of two seconds, scene cuts, and LTR refreshes.
+ *
+ * Report: per session, bitrate over a sliding -w second window (default
+ * 1), how long and how far it went over -B kbps (default: the session's
+ * own mean) by more than -t (default 0.1), the frame QP percentiles and
+ * the LTR marks; the sessions that overshot most are listed, -v lists
+ * all of them.  The fleet's QP histogram follows.
+ *
+ * Example:
+ *   qp_analytics -o fleet.qps -g 600 -n 256 -j 8
+ *   qp_analytics -w 2 -t 0.25 fleet.qps
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "qp_series.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+/* Run @fn(i) for i in [0, n) on @jobs threads */
+template <typename F>
+static void parallel(size_t n, int jobs, F fn)
+{
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> th;
+
+	auto worker = [&]() {
+		for (size_t i; (i = next++) < n;)
+			fn(i);
+	};
+
+	jobs = std::max(1, std::min<int>(jobs, (int)n));
+	for (int i = 1; i < jobs; i++)
+		th.emplace_back(worker);
+	worker();
+	for (auto &t : th)
+		t.join();
+}
+
+/*
+ * A synthetic encoder session.  Complexity drifts and jumps at scene
+ * cuts; the frame's bits follow complexity over 2^(QP/6), and QP chases
+ * the target a frame late, so cuts overshoot until it catches up.
+ * I-frames open every GOP and every cut, and refresh the LTR mark.
+ */
+struct synth_session {
+	uint64_t x;
+	double target_bits, complexity = 1, qp = 30;
+	uint32_t fps, gop, frame = 0, ltr = 0;
+
+	void region(uint8_t *buf, size_t size)
+	{
+		vidc::writer w = { buf, size };
+		bool cut = xorshift(&x) % (fps * 20) == 0;
+		bool intra = frame % gop == 0 || cut;
+		double shape = intra ? 5 : 0.85, bits;
+
+		complexity *= 1 + ((double)(xorshift(&x) % 1001) - 500) / 25000;
+		if (cut)
+			complexity *= 0.5 + (double)(xorshift(&x) % 2000) / 1000;
+		complexity = std::min(8.0, std::max(0.125, complexity));
+		bits = target_bits * shape * complexity * exp2((30 - qp) / 6);
+		qp += std::max(-2.0, std::min(2.0, 6 * log2(bits / target_bits / shape)));
+		qp = std::min(51.0, std::max(10.0, qp));
+		if (intra)
+			ltr = frame + 1;
+
+		auto *ts = w.add<msm_vidc_ts_payload>(MSM_VIDC_EXTRADATA_TIMESTAMP);
+		uint64_t us = (uint64_t)frame * 1000000 / fps;
+
+		ts->timestamp_lo = (uint32_t)us;
+		ts->timestamp_hi = (uint32_t)(us >> 32);
+		auto *q = w.add<msm_vidc_frame_qp_payload>(MSM_VIDC_EXTRADATA_FRAME_QP);
+		q->frame_qp = (uint32_t)(qp + 0.5);
+		q->total_num_blocks = 8160;
+		q->qp_sum = (uint32_t)(qp * 8160 + xorshift(&x) % 4096);
+		auto *b = w.add<msm_vidc_frame_bits_info_payload>(MSM_VIDC_EXTRADATA_FRAME_BITS_INFO);
+		b->frame_bits = (uint32_t)bits;
+		b->header_bits = intra ? 1200 : 160;
+		auto *l = w.add<msm_vidc_metadata_ltr_payload>(MSM_VIDC_EXTRADATA_METADATA_LTRINFO);
+		l->ltr_use_mark = ltr;
+		w.finish();
+		frame++;
+	}
+};
+
+static int ingest(const char *out, const std::vector<std::string> &dumps, size_t region,
+		  double gen, uint32_t nr_gen, uint32_t fps, int jobs)
+{
+	std::vector<lib::mapped_file> maps(dumps.size());
+	std::vector<std::string> names;
+	std::vector<uint64_t> rows;
+	std::vector<uint32_t> rate;
+	std::atomic<uint64_t> bad(0), bytes(0);
+	vidc::series_writer w;
+	uint64_t total = 0;
+	double t0 = now_us();
+	int ret;
+
+	for (size_t i = 0; i < dumps.size(); i++) {
+		ret = maps[i].open(dumps[i].c_str());
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", dumps[i].c_str(), strerror(-ret));
+			return ret;
+		}
+		names.push_back(dumps[i].substr(dumps[i].rfind('/') + 1));
+		rows.push_back(maps[i].size() / region);
+	}
+	for (uint32_t i = 0; i < nr_gen; i++) {
+		names.push_back("synth-" + std::to_string(i));
+		rows.push_back((uint64_t)(gen * fps));
+	}
+	rate.assign(names.size(), fps << 16);
+	for (uint64_t r : rows)
+		total += r;
+
+	ret = w.create(out, names, rows, rate);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+		return ret;
+	}
+
+	parallel(names.size(), jobs, [&](size_t s) {
+		std::vector<uint32_t> tmp;
+		synth_session gen_s;
+		uint64_t used = 0;
+		vidc::row r;
+
+		if (s >= dumps.size()) {
+			tmp.resize(region / 4);
+			gen_s.x = 0x9e3779b97f4a7c15ull * (s + 1);
+			gen_s.fps = fps;
+			gen_s.gop = 2 * fps;
+			gen_s.target_bits = (2e6 + 6e6 * (s % 5) / 4) / fps;
+		}
+		for (uint64_t i = 0; i < rows[s]; i++) {
+			const uint8_t *p;
+
+			if (s < dumps.size()) {
+				p = maps[s].data() + i * region;
+			} else {
+				gen_s.region(reinterpret_cast<uint8_t *>(tmp.data()), region);
+				p = reinterpret_cast<const uint8_t *>(tmp.data());
+			}
+			used += vidc::region_row(p, region, i, fps << 16, &r);
+			if (r.flags & ROW_BAD)
+				bad++;
+			w.put(s, i, r);
+		}
+		bytes += used;
+	});
+
+	ret = w.close();
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+		return ret;
+	}
+	t0 = now_us() - t0;
+	fprintf(stderr, "%zu sessions, %lu frames (%lu with bad extradata) in %.2f s: "
+		"%.0f frames/s, %.0f MB/s of records\n", names.size(), (unsigned long)total,
+		(unsigned long)bad.load(), t0 / 1e6, total / t0 * 1e6, bytes.load() / t0);
+	return 0;
+}
+
+static int report(const char *path, const vidc::rc_opts &o, int jobs, bool verbose)
+{
+	vidc::series s;
+	std::vector<vidc::rc_report> r;
+	std::vector<uint32_t> order;
+	uint64_t hist[SERIES_QP_BINS] = {}, frames = 0, qp_frames = 0, ltr = 0, bad = 0;
+	double t0, over_s = 0, seconds = 0;
+	uint32_t over = 0;
+	int ret;
+
+	ret = s.open(path);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return ret;
+	}
+	r.resize(s.sessions());
+	t0 = now_us();
+	parallel(s.sessions(), jobs, [&](size_t i) { vidc::analyse(s, (uint32_t)i, o, &r[i]); });
+	t0 = now_us() - t0;
+
+	for (uint32_t i = 0; i < s.sessions(); i++) {
+		frames += r[i].frames;
+		qp_frames += r[i].qp_frames;
+		ltr += r[i].ltr_changes;
+		bad += r[i].bad;
+		seconds += r[i].seconds;
+		over_s += r[i].over_s;
+		over += r[i].over_s > 0;
+		for (int q = 0; q < SERIES_QP_BINS; q++)
+			hist[q] += r[i].qp_hist[q];
+		order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return r[a].worst_over > r[b].worst_over;
+	});
+
+	printf("%u sessions, %lu frames, %.0f s; %lu frames with bad extradata\n", s.sessions(),
+	       (unsigned long)frames, seconds, (unsigned long)bad);
+	printf("window %.2f s, tolerance %.0f%%: %u sessions over, %.1f%% of the time\n",
+	       o.window_s, o.tolerance * 100, over, seconds ? 100 * over_s / seconds : 0);
+	printf("%-24s %8s %9s %9s %9s %7s %7s %4s %4s %6s %6s\n", "session", "frames", "kbps",
+	       "target", "peak", "over%", "over_s", "qp50", "qp90", "blkqp", "ltr");
+	for (size_t k = 0; k < order.size() && (verbose || k < 10); k++) {
+		const vidc::rc_report &x = r[order[k]];
+
+		printf("%-24s %8lu %9.0f %9.0f %9.0f %7.1f %7.1f %4u %4u %6.2f %6lu\n",
+		       s.name(order[k]).c_str(), (unsigned long)x.frames, x.mean_kbps, x.target_kbps,
+		       x.peak_kbps, x.worst_over * 100, x.over_s, x.qp_percentile(0.5),
+		       x.qp_percentile(0.9), x.mean_block_qp, (unsigned long)x.ltr_changes);
+	}
+
+	printf("frame QP over %lu frames:\n", (unsigned long)qp_frames);
+	for (int q = 0; q < SERIES_QP_BINS; q += 4) {
+		uint64_t n = hist[q] + hist[q + 1] + hist[q + 2] + hist[q + 3];
+
+		if (n)
+			printf("  %3d-%-3d %6.2f%% %s\n", q, q + 3, 100.0 * n / qp_frames,
+			       std::string((size_t)(60.0 * n / qp_frames + 0.5), '#').c_str());
+	}
+	printf("%lu LTR mark changes, one per %.1f s\n", (unsigned long)ltr,
+	       ltr ? seconds / ltr : 0.0);
+	fprintf(stderr, "analysed in %.1f ms: %.0f frames/s\n", t0 / 1e3, frames / t0 * 1e6);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t region = VENUS_EXTRADATA_SIZE(0, 0);
+	uint32_t fps = 30, sessions = 64;
+	const char *out = NULL;
+	vidc::rc_opts o;
+	double gen = 0;
+	bool verbose = false;
+	int jobs = 1, opt;
+
+	while ((opt = getopt(argc, argv, "o:S:r:j:g:n:w:B:t:v")) != -1) {
+		switch (opt) {
+		case 'o':
+			out = optarg;
+			break;
+		case 'S':
+			region = (size_t)atol(optarg);
+			break;
+		case 'r':
+			fps = (uint32_t)atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'g':
+			gen = atof(optarg);
+			break;
+		case 'n':
+			sessions = (uint32_t)atoi(optarg);
+			break;
+		case 'w':
+			o.window_s = atof(optarg);
+			break;
+		case 'B':
+			o.target_kbps = atof(optarg);
+			break;
+		case 't':
+			o.tolerance = atof(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (!region || (region & 3) || !fps || fps > 0xffff || jobs < 1 || o.window_s <= 0 ||
+	    (out ? (gen > 0) != (optind == argc) : optind != argc - 1)) {
+		fprintf(stderr,
+			"usage: %s -o <series> [-S region] [-r fps] [-j jobs] <dump>...\n"
+			"       %s -o <series> -g seconds [-n sessions] [-r fps] [-j jobs]\n"
+			"       %s [-w window_s] [-B target_kbps] [-t tolerance] [-j jobs] [-v] "
+			"<series>\n", argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	if (out)
+		return ingest(out, std::vector<std::string>(argv + optind, argv + argc), region,
+			      gen, gen > 0 ? sessions : 0, fps, jobs) ? 1 : 0;
+	return report(argv[optind], o, jobs, verbose) ? 1 : 0;
+}
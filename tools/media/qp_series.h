@@ -0,0 +1,437 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Columnar time series of encoder rate control, from extradata dumps.
+ *
+ * Each extradata region of a recorded session becomes one row: its
+ * timestamp, frame and header bits, frame QP, mean block QP and LTR
+ * mark, from the TIMESTAMP, FRAME_BITS_INFO, FRAME_QP and METADATA_LTRINFO
+ * records.  Rows of all sessions go into one file, a column at a time,
+ * every session's rows contiguous:
+ *
+ *   series_header | session table | names | column 0 | column 1 | ...
+ *
+ * Columns start on 64-byte boundaries and are plain little-endian arrays
+ * of nr_rows, so a reader maps the file and indexes them in place.  The
+ * writer sizes the file up front from the row count of every session,
+ * maps it shared, and lets any number of threads fill disjoint sessions.
+ *
+ * analyse() runs over one session's columns: bitrate over a sliding
+ * window of frames, the QP histogram, how far and how long the
+ * window rate goes over the target, and how often LTR is used.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_MEDIA_QP_SERIES_H__
+#define __TOOLS_MEDIA_QP_SERIES_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../lib/mapped_file.h"
+#include "vidc_extradata.h"
+
+namespace vidc {
+
+#define SERIES_MAGIC		"QPSERIES"
+#define SERIES_VERSION		1
+#define SERIES_ALIGN		64u
+#define SERIES_QP_BINS		256
+
+/* Row flags: which records the region had */
+#define ROW_QP			0x01
+#define ROW_BITS		0x02
+#define ROW_LTR			0x04
+#define ROW_TS			0x08
+#define ROW_BAD			0x80	/* the walk stopped early */
+
+enum series_col {
+	SCOL_TS,		/* u64: microseconds */
+	SCOL_BITS,		/* u32: frame bits */
+	SCOL_HDR_BITS,		/* u32: header bits */
+	SCOL_LTR,		/* u32: ltr_use_mark */
+	SCOL_MEAN_QP,		/* u16: qp_sum / total_num_blocks, Q8 */
+	SCOL_QP,		/* u8: frame QP */
+	SCOL_FLAGS,		/* u8: ROW_* */
+	NR_SCOLS
+};
+
+static const uint8_t scol_width[NR_SCOLS] = { 8, 4, 4, 4, 2, 1, 1 };
+
+struct series_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nr_sessions;
+	uint64_t nr_rows;
+	uint64_t names_off;
+	uint64_t col_off[NR_SCOLS];
+};
+
+struct series_session {
+	uint64_t first, rows;
+	uint32_t name_off, name_len;
+	uint32_t fps_q16;		/* nominal rate: the window, and absent timestamps */
+	uint32_t reserved;
+};
+
+/* One region's worth of row */
+struct row {
+	uint64_t ts = 0;
+	uint32_t bits = 0, hdr_bits = 0, ltr = 0;
+	uint16_t mean_qp = 0;
+	uint8_t qp = 0, flags = 0;
+};
+
+/* Fills a row from the records it cares about */
+struct row_visitor : visitor {
+	row *r;
+
+	void timestamp(const msm_vidc_ts_payload &p)
+	{
+		r->ts = (uint64_t)p.timestamp_hi << 32 | p.timestamp_lo;
+		r->flags |= ROW_TS;
+	}
+
+	void frame_qp(const msm_vidc_frame_qp_payload &p)
+	{
+		r->qp = (uint8_t)std::min(p.frame_qp, 255u);
+		if (p.total_num_blocks)
+			r->mean_qp = (uint16_t)std::min<uint64_t>(
+				((uint64_t)p.qp_sum << 8) / p.total_num_blocks, 0xffff);
+		else
+			r->mean_qp = (uint16_t)(r->qp << 8);
+		r->flags |= ROW_QP;
+	}
+
+	void frame_bits(const msm_vidc_frame_bits_info_payload &p)
+	{
+		r->bits = p.frame_bits;
+		r->hdr_bits = p.header_bits;
+		r->flags |= ROW_BITS;
+	}
+
+	void other(const record &rec)
+	{
+		if (auto *p = rec.as<MSM_VIDC_EXTRADATA_METADATA_LTRINFO>()) {
+			r->ltr = p->ltr_use_mark;
+			r->flags |= ROW_LTR;
+		}
+	}
+};
+
+/*
+ * The row for region @n of a session, timestamped at @fps_q16 if need be.
+ * Returns the bytes of records walked.
+ */
+inline size_t region_row(const uint8_t *base, size_t size, uint64_t n, uint32_t fps_q16, row *r)
+{
+	extradata x;
+	row_visitor v;
+
+	*r = row();
+	v.r = r;
+	if (x.init(base, size) || walk(x, v) < 0)
+		r->flags |= ROW_BAD;
+	if (!(r->flags & ROW_TS))
+		r->ts = n * (1000000ull << 16) / fps_q16;
+	return x.used();
+}
+
+inline uint64_t series_align(uint64_t off)
+{
+	return (off + SERIES_ALIGN - 1) & ~(uint64_t)(SERIES_ALIGN - 1);
+}
+
+/*
+ * Writes a series file.  create() lays it out for sessions of known row
+ * counts; then put() may be called from several threads at once as long
+ * as no two write the same session.
+ */
+class series_writer {
+public:
+	series_writer() = default;
+	series_writer(const series_writer &) = delete;
+	series_writer &operator=(const series_writer &) = delete;
+	~series_writer() { close(); }
+
+	int create(const char *path, const std::vector<std::string> &names,
+		   const std::vector<uint64_t> &rows, const std::vector<uint32_t> &fps_q16)
+	{
+		series_header h = {};
+		uint64_t off, name_bytes = 0, total = 0;
+		int ret = 0;
+
+		close();
+		for (size_t i = 0; i < names.size(); i++) {
+			name_bytes += names[i].size();
+			total += rows[i];
+		}
+		memcpy(h.magic, SERIES_MAGIC, sizeof(h.magic));
+		h.version = SERIES_VERSION;
+		h.nr_sessions = (uint32_t)names.size();
+		h.nr_rows = total;
+		h.names_off = sizeof(h) + names.size() * sizeof(series_session);
+		off = series_align(h.names_off + name_bytes);
+		for (int c = 0; c < NR_SCOLS; c++) {
+			h.col_off[c] = off;
+			off = series_align(off + total * scol_width[c]);
+		}
+
+		fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd_ < 0)
+			return -errno;
+		if (ftruncate(fd_, (off_t)off) < 0) {
+			ret = -errno;
+			goto fail;
+		}
+		base_ = static_cast<uint8_t *>(mmap(nullptr, off, PROT_READ | PROT_WRITE, MAP_SHARED,
+						    fd_, 0));
+		if (base_ == MAP_FAILED) {
+			base_ = nullptr;
+			ret = -errno;
+			goto fail;
+		}
+		size_ = off;
+
+		memcpy(base_, &h, sizeof(h));
+		sessions_ = reinterpret_cast<series_session *>(base_ + sizeof(h));
+		total = 0;
+		name_bytes = 0;
+		for (size_t i = 0; i < names.size(); i++) {
+			sessions_[i] = { total, rows[i], (uint32_t)name_bytes,
+					 (uint32_t)names[i].size(), fps_q16[i], 0 };
+			memcpy(base_ + h.names_off + name_bytes, names[i].data(), names[i].size());
+			total += rows[i];
+			name_bytes += names[i].size();
+		}
+		for (int c = 0; c < NR_SCOLS; c++)
+			col_[c] = base_ + h.col_off[c];
+		return 0;
+	fail:
+		::close(fd_);
+		fd_ = -1;
+		return ret;
+	}
+
+	const series_session &session(size_t i) const { return sessions_[i]; }
+
+	/* Row @i of session @s */
+	void put(size_t s, uint64_t i, const row &r)
+	{
+		uint64_t k = sessions_[s].first + i;
+
+		reinterpret_cast<uint64_t *>(col_[SCOL_TS])[k] = r.ts;
+		reinterpret_cast<uint32_t *>(col_[SCOL_BITS])[k] = r.bits;
+		reinterpret_cast<uint32_t *>(col_[SCOL_HDR_BITS])[k] = r.hdr_bits;
+		reinterpret_cast<uint32_t *>(col_[SCOL_LTR])[k] = r.ltr;
+		reinterpret_cast<uint16_t *>(col_[SCOL_MEAN_QP])[k] = r.mean_qp;
+		col_[SCOL_QP][k] = r.qp;
+		col_[SCOL_FLAGS][k] = r.flags;
+	}
+
+	int close()
+	{
+		int ret = 0;
+
+		if (base_) {
+			if (msync(base_, size_, MS_SYNC) < 0)
+				ret = -errno;
+			munmap(base_, size_);
+			base_ = nullptr;
+		}
+		if (fd_ >= 0) {
+			::close(fd_);
+			fd_ = -1;
+		}
+		return ret;
+	}
+
+private:
+	int fd_ = -1;
+	uint8_t *base_ = nullptr;
+	size_t size_ = 0;
+	series_session *sessions_ = nullptr;
+	uint8_t *col_[NR_SCOLS] = {};
+};
+
+/* A series file mapped read-only, its columns checked against its size */
+class series {
+public:
+	int open(const char *path)
+	{
+		const series_header *h;
+		int ret = map_.open(path);
+
+		if (ret)
+			return ret;
+		if (map_.size() < sizeof(*h))
+			return -EINVAL;
+		h = reinterpret_cast<const series_header *>(map_.data());
+		if (memcmp(h->magic, SERIES_MAGIC, sizeof(h->magic)))
+			return -EINVAL;
+		if (h->version != SERIES_VERSION)
+			return -EPROTONOSUPPORT;
+		if (h->names_off != sizeof(*h) + (uint64_t)h->nr_sessions * sizeof(series_session) ||
+		    h->names_off > h->col_off[0])
+			return -EINVAL;
+		for (int c = 0; c < NR_SCOLS; c++) {
+			if ((h->col_off[c] % SERIES_ALIGN) || h->col_off[c] > map_.size() ||
+			    h->nr_rows > (map_.size() - h->col_off[c]) / scol_width[c])
+				return -EINVAL;
+		}
+		sessions_ = reinterpret_cast<const series_session *>(map_.data() + sizeof(*h));
+		for (uint32_t i = 0; i < h->nr_sessions; i++) {
+			const series_session &s = sessions_[i];
+
+			if (s.first > h->nr_rows || s.rows > h->nr_rows - s.first ||
+			    (uint64_t)s.name_off + s.name_len > h->col_off[0] - h->names_off ||
+			    !s.fps_q16)
+				return -EINVAL;
+		}
+		h_ = h;
+		return 0;
+	}
+
+	uint32_t sessions() const { return h_->nr_sessions; }
+	uint64_t rows() const { return h_->nr_rows; }
+	const series_session &session(uint32_t i) const { return sessions_[i]; }
+
+	std::string name(uint32_t i) const
+	{
+		const char *p = reinterpret_cast<const char *>(map_.data() + h_->names_off);
+
+		return std::string(p + sessions_[i].name_off, sessions_[i].name_len);
+	}
+
+	template <typename T>
+	const T *col(series_col c) const
+	{
+		return reinterpret_cast<const T *>(map_.data() + h_->col_off[c]);
+	}
+
+private:
+	lib::mapped_file map_;
+	const series_header *h_ = nullptr;
+	const series_session *sessions_ = nullptr;
+};
+
+struct rc_opts {
+	double window_s = 1.0;		/* rolling bitrate window */
+	double target_kbps = 0;		/* 0: the session's own mean */
+	double tolerance = 0.10;	/* overshoot counted above target * (1 + this) */
+};
+
+struct rc_report {
+	uint64_t frames = 0, bad = 0;
+	uint64_t qp_frames = 0;		/* frames with a FRAME_QP record */
+	double seconds = 0;
+	double mean_kbps = 0, target_kbps = 0;
+	double peak_kbps = 0;		/* highest window rate */
+	double over_s = 0;		/* time the window rate spent over tolerance */
+	double worst_over = 0;		/* peak / target - 1 */
+	double header_share = 0;	/* header bits / frame bits */
+	double mean_qp = 0;		/* frame QP */
+	double mean_block_qp = 0;
+	uint64_t qp_hist[SERIES_QP_BINS] = {};
+	uint64_t ltr_frames = 0;	/* rows with a non-zero mark */
+	uint64_t ltr_changes = 0;	/* rows whose mark differs from the last */
+
+	/* Smallest QP with more than @p of the frames at or under it */
+	unsigned int qp_percentile(double p) const
+	{
+		uint64_t want = (uint64_t)(p * qp_frames), seen = 0;
+
+		for (unsigned int q = 0; q < SERIES_QP_BINS; q++) {
+			seen += qp_hist[q];
+			if (seen > want || (seen && seen == qp_frames))
+				return q;
+		}
+		return 0;
+	}
+};
+
+/*
+ * Rate control figures for one session.  The window is the last
+ * window_s seconds of frames at the session's frame rate, counted in
+ * output order, as the encoder's rate control counts them; timestamps
+ * only give the duration, since B-frames leave them out of order.  The
+ * window is judged once full, so a session's start does not read as a
+ * burst.
+ */
+inline void analyse(const series &s, uint32_t i, const rc_opts &o, rc_report *r)
+{
+	const series_session &ss = s.session(i);
+	const uint64_t *ts = s.col<uint64_t>(SCOL_TS) + ss.first;
+	const uint32_t *bits = s.col<uint32_t>(SCOL_BITS) + ss.first;
+	const uint32_t *hdr = s.col<uint32_t>(SCOL_HDR_BITS) + ss.first;
+	const uint32_t *ltr = s.col<uint32_t>(SCOL_LTR) + ss.first;
+	const uint16_t *mqp = s.col<uint16_t>(SCOL_MEAN_QP) + ss.first;
+	const uint8_t *qp = s.col<uint8_t>(SCOL_QP) + ss.first;
+	const uint8_t *flags = s.col<uint8_t>(SCOL_FLAGS) + ss.first;
+	const double fps = ss.fps_q16 / 65536.0;
+	const uint64_t win = std::max<uint64_t>(1, (uint64_t)(o.window_s * fps + 0.5));
+	uint64_t total = 0, headers = 0, qp_sum = 0, mqp_sum = 0, in_win = 0;
+	uint64_t lo = UINT64_MAX, hi = 0;
+	uint32_t last_ltr = 0;
+	double limit;
+
+	*r = rc_report();
+	r->frames = ss.rows;
+	if (!ss.rows)
+		return;
+
+	for (uint64_t k = 0; k < ss.rows; k++) {
+		total += bits[k];
+		headers += hdr[k];
+		lo = std::min(lo, ts[k]);
+		hi = std::max(hi, ts[k]);
+		if (flags[k] & ROW_QP) {
+			r->qp_hist[qp[k]]++;
+			qp_sum += qp[k];
+			mqp_sum += mqp[k];
+			r->qp_frames++;
+		}
+		if (ltr[k])
+			r->ltr_frames++;
+		if (ltr[k] != last_ltr)
+			r->ltr_changes++;
+		last_ltr = ltr[k];
+		if (flags[k] & ROW_BAD)
+			r->bad++;
+	}
+	r->seconds = (hi - lo) / 1e6 + 1 / fps;
+	r->mean_kbps = total / r->seconds / 1e3;
+	r->target_kbps = o.target_kbps ? o.target_kbps : r->mean_kbps;
+	r->header_share = total ? (double)headers / total : 0;
+	r->mean_qp = r->qp_frames ? (double)qp_sum / r->qp_frames : 0;
+	r->mean_block_qp = r->qp_frames ? mqp_sum / 256.0 / r->qp_frames : 0;
+
+	limit = r->target_kbps * (1 + o.tolerance);
+	for (uint64_t k = 0; k < ss.rows; k++) {
+		double kbps;
+
+		in_win += bits[k];
+		if (k >= win)
+			in_win -= bits[k - win];
+		if (k + 1 < win)
+			continue;
+		kbps = in_win * fps / win / 1e3;
+		r->peak_kbps = std::max(r->peak_kbps, kbps);
+		if (kbps > limit)
+			r->over_s += 1 / fps;
+	}
+	if (r->target_kbps)
+		r->worst_over = std::max(0.0, r->peak_kbps / r->target_kbps - 1);
+}
+
+} /* namespace vidc */
+
+#endif /* __TOOLS_MEDIA_QP_SERIES_H__ */
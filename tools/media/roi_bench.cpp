@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Build encoder ROI delta-QP maps from saliency masks at frame rate and
+ * time it.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -o roi_bench roi_bench.cpp
+ * Usage: roi_bench [-s WxH] [-m WxH] [-b block] [-t 2bit|2byte] [-q fg,bg]
+ *                  [-a alpha] [-n frames] [-r fps] [-o map]
+ *
+ * Checks the vector reductions against the C ones and the block means of
+ * a few mask and frame sizes against a plain per-block average.  Then
+ * a builder thread turns -n (default 600) synthetic masks of -m (default
+ * the frame size) into maps for a -s (default 3840x2160) frame, paced at
+ * -r fps (default 60, 0 for flat out), while a submit thread takes the
+ * newest map at the same rate, half a frame later, as an encoder's
+ * queueing thread would.  The masks are a handful of soft ellipses, the
+ * faces, drifting across the picture.
+ *
+ * Reports the build time (mean, 99th percentile, worst) against the
+ * frame time, the worst time take() held up the submit thread, and how
+ * many takes found no map newer than the last.  -b is the block size
+ * (default 16), -t the map type (default 2byte), -q the delta QP at full
+ * and at no saliency (default -6,4), -a the Q8 smoothing weight of a new
+ * frame (default 96).  -o writes the last map's payload to a file.
+ *
+ * Example:
+ *   roi_bench -s 3840x2160 -m 960x540 -b 32 -r 60
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "roi_map.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void sleep_until_us(double t)
+{
+	double d = t - now_us();
+	struct timespec ts;
+
+	if (d <= 0)
+		return;
+	ts.tv_sec = (time_t)(d / 1e6);
+	ts.tv_nsec = (long)((d - ts.tv_sec * 1e6) * 1e3);
+	nanosleep(&ts, NULL);
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static int parse_size(const char *s, uint32_t *w, uint32_t *h)
+{
+	return sscanf(s, "%ux%u", w, h) == 2 && *w && *h ? 0 : -EINVAL;
+}
+
+/* Saliency of @faces soft ellipses at time @t, for a mask @w x @h */
+static void synth_mask(std::vector<uint8_t> &m, uint32_t w, uint32_t h, int faces, double t)
+{
+	std::fill(m.begin(), m.end(), 0);
+	for (int f = 0; f < faces; f++) {
+		double cx = w * (0.5 + 0.35 * sin(0.3 * t + 1.7 * f));
+		double cy = h * (0.5 + 0.3 * cos(0.2 * t + 2.3 * f));
+		double rx = w * (0.05 + 0.02 * (f % 3)), ry = rx * 1.3;
+		int x0 = std::max(0, (int)(cx - rx)), x1 = std::min((int)w, (int)(cx + rx) + 1);
+		int y0 = std::max(0, (int)(cy - ry)), y1 = std::min((int)h, (int)(cy + ry) + 1);
+
+		for (int y = y0; y < y1; y++) {
+			for (int x = x0; x < x1; x++) {
+				double dx = (x - cx) / rx, dy = (y - cy) / ry, d = dx * dx + dy * dy;
+				uint8_t &p = m[(size_t)y * w + x];
+
+				if (d < 1)
+					p = std::max(p, (uint8_t)(255 * (1 - d * d)));
+			}
+		}
+	}
+}
+
+static int check_kernels(void)
+{
+	static uint8_t src[ROI_FLUSH_ROWS * 256];
+	uint16_t acc[256], ref[256];
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+
+	for (int i = 0; i < 2000; i++) {
+		uint32_t n = (uint32_t)(xorshift(&x) % 257);
+		uint32_t rows = 1 + (uint32_t)(xorshift(&x) % ROI_FLUSH_ROWS);
+
+		for (uint8_t &p : src)
+			p = (uint8_t)xorshift(&x);
+		memset(acc, 0x5a, sizeof(acc));
+		memset(ref, 0x5a, sizeof(ref));
+		vidc::roi_add_rows(acc, src, 256, rows, n);
+		vidc::roi_add_rows_c(ref, src, 256, rows, n);
+		if (memcmp(acc, ref, sizeof(acc)) || vidc::roi_sum(acc, n) != vidc::roi_sum_c(ref, n)) {
+			fprintf(stderr, "roi %s kernels differ from C\n", vidc::roi_isa);
+			return -EDOM;
+		}
+	}
+	return 0;
+}
+
+/* Block means of a noisy mask against the mean of every pixel centred in the block */
+static int check_means(uint32_t w, uint32_t h, uint32_t mw, uint32_t mh, uint32_t block)
+{
+	vidc::roi_config c = { w, h, block, ROI_TYPE_2BYTE, mw, mh, -6, 4, 256, 0, 255 };
+	std::vector<uint8_t> m((size_t)mw * mh);
+	uint64_t x = 0x2545f4914f6cdd1dull ^ w ^ (uint64_t)mh << 20;
+	vidc::roi_map map;
+	int ret;
+
+	for (uint8_t &p : m)
+		p = (uint8_t)xorshift(&x);
+	ret = map.init(c);
+	if (!ret)
+		ret = map.build({ m.data(), mw, mh, mw });
+	if (ret)
+		return ret;
+	for (uint32_t by = 0; by < map.blocks_y(); by++) {
+		for (uint32_t bx = 0; bx < map.blocks_x(); bx++) {
+			uint64_t sum = 0, n = 0;
+			uint32_t want;
+
+			for (uint32_t y = 0; y < mh; y++) {
+				double cy = (y + 0.5) * h / mh;
+
+				if (cy < by * block || cy >= std::min((by + 1) * block, h))
+					continue;
+				for (uint32_t k = 0; k < mw; k++) {
+					double cx = (k + 0.5) * w / mw;
+
+					if (cx >= bx * block && cx < std::min((bx + 1) * block, w)) {
+						sum += m[(size_t)y * mw + k];
+						n++;
+					}
+				}
+			}
+			if (!n)		/* coarser than the blocks; nearest pixel, not checked */
+				continue;
+			want = (uint32_t)((sum + n / 2) / n);
+			if (map.means()[by * map.blocks_x() + bx] != want) {
+				fprintf(stderr, "%ux%u mask on %ux%u/%u: block %u,%u mean %u, want %u\n",
+					mw, mh, w, h, block, bx, by,
+					map.means()[by * map.blocks_x() + bx], want);
+				return -EDOM;
+			}
+		}
+	}
+	return 0;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s WxH] [-m WxH] [-b block] [-t 2bit|2byte] [-q fg,bg]\n"
+		"       %*s [-a alpha] [-n frames] [-r fps] [-o map]\n",
+		prog, (int)strlen(prog), "");
+	return 1;
+}
+
+static int percentile(std::vector<double> &v, double p, double *out)
+{
+	if (v.empty())
+		return -ENODATA;
+	std::sort(v.begin(), v.end());
+	*out = v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	vidc::roi_config c = { 3840, 2160, 16, ROI_TYPE_2BYTE, 0, 0, -6, 4, 96, 64, 160 };
+	static const int ring = 16;
+	std::vector<std::vector<uint8_t>> masks(ring);
+	std::vector<double> build_us;
+	std::atomic<bool> done{ false };
+	uint32_t frames = 600, fps = 60;
+	double take_max = 0, t_start, mean = 0, p99 = 0, worst, frame_us;
+	uint64_t stale = 0, last_seq = 0;
+	const char *out = NULL;
+	vidc::roi_map map;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "s:m:b:t:q:a:n:r:o:")) != -1) {
+		switch (opt) {
+		case 's':
+			if (parse_size(optarg, &c.width, &c.height))
+				return usage(argv[0]);
+			break;
+		case 'm':
+			if (parse_size(optarg, &c.mask_width, &c.mask_height))
+				return usage(argv[0]);
+			break;
+		case 'b':
+			c.block = (uint32_t)atoi(optarg);
+			break;
+		case 't':
+			if (!strcmp(optarg, "2bit"))
+				c.type = ROI_TYPE_2BIT;
+			else if (!strcmp(optarg, "2byte"))
+				c.type = ROI_TYPE_2BYTE;
+			else
+				return usage(argv[0]);
+			break;
+		case 'q':
+			if (sscanf(optarg, "%d,%d", &c.fg_qp, &c.bg_qp) != 2)
+				return usage(argv[0]);
+			break;
+		case 'a':
+			c.alpha = (uint32_t)atoi(optarg);
+			break;
+		case 'n':
+			frames = (uint32_t)atoi(optarg);
+			break;
+		case 'r':
+			fps = (uint32_t)atoi(optarg);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc || !frames)
+		return usage(argv[0]);
+	if (!c.mask_width) {
+		c.mask_width = c.width;
+		c.mask_height = c.height;
+	}
+	ret = map.init(c);
+	if (ret) {
+		fprintf(stderr, "roi map: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	ret = check_kernels();
+	if (!ret)
+		ret = check_means(1920, 1080, 1920, 1080, 16);
+	if (!ret)
+		ret = check_means(1920, 1088, 640, 360, 32);
+	if (!ret)
+		ret = check_means(1280, 720, 1001, 563, 16);
+	if (!ret)
+		ret = check_means(640, 480, 2000, 1500, 64);
+	if (!ret)
+		ret = check_means(3840, 2160, 160, 90, 16);
+	if (ret)
+		return 1;
+
+	for (int i = 0; i < ring; i++) {
+		masks[i].resize((size_t)c.mask_width * c.mask_height);
+		synth_mask(masks[i], c.mask_width, c.mask_height, 4, i * 0.5);
+	}
+	build_us.reserve(frames);
+	frame_us = fps ? 1e6 / fps : 0;
+	t_start = now_us() + 1000;
+
+	std::thread submit([&] {
+		for (uint32_t i = 0; !done.load(std::memory_order_relaxed); i++) {
+			const msm_vidc_roi_qp_payload *p;
+			size_t len;
+			uint64_t seq;
+			double t0;
+
+			if (fps)
+				sleep_until_us(t_start + (i + 0.5) * frame_us);
+			else
+				std::this_thread::yield();
+			t0 = now_us();
+			p = map.take(&len, &seq);
+			take_max = std::max(take_max, now_us() - t0);
+			if (p && seq == last_seq)
+				stale++;
+			if (p)
+				last_seq = seq;
+		}
+	});
+
+	for (uint32_t i = 0; i < frames; i++) {
+		const std::vector<uint8_t> &m = masks[i % ring];
+		double t0;
+
+		if (fps)
+			sleep_until_us(t_start + i * frame_us);
+		t0 = now_us();
+		ret = map.build({ m.data(), c.mask_width, c.mask_height, c.mask_width });
+		build_us.push_back(now_us() - t0);
+		if (ret) {
+			fprintf(stderr, "build: %s\n", strerror(-ret));
+			break;
+		}
+	}
+	done.store(true);
+	submit.join();
+	if (ret)
+		return 1;
+
+	for (double b : build_us)
+		mean += b;
+	mean /= build_us.size();
+	percentile(build_us, 0.99, &p99);
+	worst = build_us.back();
+	printf("%ux%u mask -> %ux%u map (%ux%u frame, %u blocks, %s), %zu byte payload, %s\n",
+	       c.mask_width, c.mask_height, map.blocks_x(), map.blocks_y(), c.width, c.height,
+	       c.block, c.type == ROI_TYPE_2BYTE ? "2byte" : "2bit",
+	       ROI_PAYLOAD_HDR + map.map_bytes(), vidc::roi_isa);
+	printf("build: mean %.0f us, p99 %.0f us, worst %.0f us", mean, p99, worst);
+	if (fps)
+		printf(" (%.1f%% of a %.0f us frame)", 100 * mean / frame_us, frame_us);
+	printf("\ntake: worst %.2f us, %lu takes with no newer map\n", take_max,
+	       (unsigned long)stale);
+
+	if (out) {
+		const msm_vidc_roi_qp_payload *p;
+		size_t len = 0;
+		uint64_t seq;
+		FILE *f;
+
+		p = map.take(&len, &seq);
+		f = fopen(out, "wb");
+		if (!f || !p || fwrite(p, 1, len, f) != len) {
+			fprintf(stderr, "%s: %s\n", out, strerror(errno));
+			return 1;
+		}
+		fclose(f);
+	}
+	return 0;
+}
@@ -0,0 +1,422 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Encoder ROI delta-QP maps from saliency masks.
+ *
+ * A mask is one byte of saliency a pixel, 0 for background up to 255,
+ * at whatever resolution the face or saliency detector runs.  A map is
+ * the per-block QP data that follows msm_vidc_roi_qp_payload in the
+ * encoder's input extradata, one entry a macroblock (16) or CTB (32 or
+ * 64) of the coded frame, in raster order, rows not padded:
+ *
+ *   ROI_TYPE_2BYTE  a little-endian s16 delta QP a block
+ *   ROI_TYPE_2BIT   four blocks a byte, first in the low bits: 0 no
+ *                   offset, 1 upper_qp_offset, 2 lower_qp_offset
+ *
+ * Each block takes the mean of the mask pixels whose centres fall in it
+ * (the nearest one when the mask is coarser than the blocks).  A block
+ * row's mask rows are summed down each column into 16-bit totals, up to
+ * ROI_FLUSH_ROWS at a time and in registers, 16 columns at once; then
+ * every block's columns are added up.  Both steps run on
+ * AVX2, SSE2 or NEON, whichever the build enables, else in C.  Means
+ * are smoothed over time per block, an exponential average in Q8, and
+ * looked up in a table from saliency to delta QP, linear from bg_qp at
+ * 0 to fg_qp at 255.
+ *
+ * build() runs on one thread, take() on another, the encoder's submit
+ * thread, and neither ever waits for the other.  Maps go to a back
+ * buffer while the submit side reads its front one; the finished back
+ * buffer is swapped with a spare through one atomic, from which take()
+ * swaps it to the front.  All memory is allocated by init().
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_MEDIA_ROI_MAP_H__
+#define __TOOLS_MEDIA_ROI_MAP_H__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "vidc_extradata.h"
+
+namespace vidc {
+
+#define ROI_TYPE_2BIT		V4L2_CID_MPEG_VIDC_VIDEO_ROI_TYPE_2BIT
+#define ROI_TYPE_2BYTE		V4L2_CID_MPEG_VIDC_VIDEO_ROI_TYPE_2BYTE
+#define ROI_FLUSH_ROWS		128	/* 128 * 255 still fits a signed 16-bit lane */
+#define ROI_PAYLOAD_HDR		offsetof(struct msm_vidc_roi_qp_payload, data)
+
+struct roi_config {
+	uint32_t width, height;		/* coded frame */
+	uint32_t block;			/* 16, 32 or 64 */
+	uint32_t type;			/* ROI_TYPE_2BIT or ROI_TYPE_2BYTE */
+	uint32_t mask_width, mask_height;
+	int32_t fg_qp, bg_qp;		/* delta QP at saliency 255 and 0 */
+	uint32_t alpha;			/* Q8 weight of a new frame, 256: no smoothing */
+	uint8_t lo, hi;			/* 2BIT: lower offset below lo, upper from hi */
+};
+
+struct roi_mask {
+	const uint8_t *data;
+	uint32_t width, height, stride;
+};
+
+/* acc[i] = sum of @rows rows of @stride from @src, column i, up to ROI_FLUSH_ROWS */
+inline void roi_add_rows_c(uint16_t *acc, const uint8_t *src, size_t stride, uint32_t rows,
+			   uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		uint16_t s = 0;
+
+		for (uint32_t y = 0; y < rows; y++)
+			s += src[y * stride + i];
+		acc[i] = s;
+	}
+}
+
+inline uint32_t roi_sum_c(const uint16_t *acc, uint32_t n)
+{
+	uint32_t s = 0;
+
+	for (uint32_t i = 0; i < n; i++)
+		s += acc[i];
+	return s;
+}
+
+#if defined(__AVX2__)
+
+static const char roi_isa[] = "avx2";
+
+inline void roi_add_rows(uint16_t *acc, const uint8_t *src, size_t stride, uint32_t rows,
+			 uint32_t n)
+{
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m256i a = _mm256_setzero_si256();
+
+		for (uint32_t y = 0; y < rows; y++)
+			a = _mm256_add_epi16(a, _mm256_cvtepu8_epi16(
+				_mm_loadu_si128((const __m128i *)(src + y * stride + i))));
+		_mm256_storeu_si256((__m256i *)(acc + i), a);
+	}
+	roi_add_rows_c(acc + i, src + i, stride, rows, n - i);
+}
+
+inline uint32_t roi_sum(const uint16_t *acc, uint32_t n)
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i s = _mm256_setzero_si256();
+	__m128i h;
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16)
+		s = _mm256_add_epi32(s, _mm256_madd_epi16(
+			_mm256_loadu_si256((const __m256i *)(acc + i)), ones));
+	h = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+	h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+	h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32_t)_mm_cvtsi128_si32(h) + roi_sum_c(acc + i, n - i);
+}
+
+#elif defined(__SSE2__)
+
+static const char roi_isa[] = "sse2";
+
+inline void roi_add_rows(uint16_t *acc, const uint8_t *src, size_t stride, uint32_t rows,
+			 uint32_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i a0 = zero, a1 = zero;
+
+		for (uint32_t y = 0; y < rows; y++) {
+			__m128i r = _mm_loadu_si128((const __m128i *)(src + y * stride + i));
+
+			a0 = _mm_add_epi16(a0, _mm_unpacklo_epi8(r, zero));
+			a1 = _mm_add_epi16(a1, _mm_unpackhi_epi8(r, zero));
+		}
+		_mm_storeu_si128((__m128i *)(acc + i), a0);
+		_mm_storeu_si128((__m128i *)(acc + i + 8), a1);
+	}
+	roi_add_rows_c(acc + i, src + i, stride, rows, n - i);
+}
+
+inline uint32_t roi_sum(const uint16_t *acc, uint32_t n)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i s = _mm_setzero_si128();
+	uint32_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+		s = _mm_add_epi32(s, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(acc + i)), ones));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32_t)_mm_cvtsi128_si32(s) + roi_sum_c(acc + i, n - i);
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static const char roi_isa[] = "neon";
+
+inline void roi_add_rows(uint16_t *acc, const uint8_t *src, size_t stride, uint32_t rows,
+			 uint32_t n)
+{
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		uint16x8_t a0 = vdupq_n_u16(0), a1 = vdupq_n_u16(0);
+
+		for (uint32_t y = 0; y < rows; y++) {
+			uint8x16_t r = vld1q_u8(src + y * stride + i);
+
+			a0 = vaddw_u8(a0, vget_low_u8(r));
+			a1 = vaddw_high_u8(a1, r);
+		}
+		vst1q_u16(acc + i, a0);
+		vst1q_u16(acc + i + 8, a1);
+	}
+	roi_add_rows_c(acc + i, src + i, stride, rows, n - i);
+}
+
+inline uint32_t roi_sum(const uint16_t *acc, uint32_t n)
+{
+	uint32x4_t s = vdupq_n_u32(0);
+	uint32_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+		s = vpadalq_u16(s, vld1q_u16(acc + i));
+	return vaddvq_u32(s) + roi_sum_c(acc + i, n - i);
+}
+
+#else
+
+static const char roi_isa[] = "c";
+
+inline void roi_add_rows(uint16_t *acc, const uint8_t *src, size_t stride, uint32_t rows,
+			 uint32_t n)
+{
+	roi_add_rows_c(acc, src, stride, rows, n);
+}
+
+inline uint32_t roi_sum(const uint16_t *acc, uint32_t n)
+{
+	return roi_sum_c(acc, n);
+}
+
+#endif
+
+class roi_map {
+public:
+	roi_map() = default;
+	roi_map(const roi_map &) = delete;
+	roi_map &operator=(const roi_map &) = delete;
+
+	int init(const roi_config &c)
+	{
+		size_t words;
+
+		if (!c.width || !c.height || !c.mask_width || !c.mask_height ||
+		    (c.block != 16 && c.block != 32 && c.block != 64) ||
+		    (c.type != ROI_TYPE_2BIT && c.type != ROI_TYPE_2BYTE) ||
+		    !c.alpha || c.alpha > 256 || c.lo > c.hi)
+			return -EINVAL;
+		c_ = c;
+		bw_ = (c.width + c.block - 1) / c.block;
+		bh_ = (c.height + c.block - 1) / c.block;
+		ranges(c.width, c.mask_width, c.block, bw_, &x0_, &x1_);
+		ranges(c.height, c.mask_height, c.block, bh_, &y0_, &y1_);
+		for (int i = 0; i < 256; i++) {
+			int32_t d = (c.fg_qp - c.bg_qp) * i;
+
+			lut_[i] = (int16_t)(c.bg_qp + (d >= 0 ? d + 127 : d - 127) / 255);
+		}
+		acc_.assign(c.mask_width, 0);
+		sums_.assign(bw_, 0);
+		means_.assign((size_t)bw_ * bh_, 0);
+		ema_.assign((size_t)bw_ * bh_, 0);
+		map_bytes_ = c.type == ROI_TYPE_2BYTE ? (size_t)bw_ * bh_ * 2 :
+							((size_t)bw_ * bh_ + 3) / 4;
+		words = (ROI_PAYLOAD_HDR + map_bytes_ + 3) / 4;
+		for (int i = 0; i < 3; i++) {
+			slot_[i].assign(words, 0);
+			seq_[i] = 0;
+		}
+		back_ = 0;
+		front_ = 1;
+		mailbox_.store(2, std::memory_order_relaxed);
+		built_ = 0;
+		return 0;
+	}
+
+	/* Forget the smoothing, as on a scene cut; the next map is the mask's own */
+	void reset() { built_ = 0; }
+
+	/* Build the next map from @m and publish it; never waits for take() */
+	int build(const roi_mask &m)
+	{
+		msm_vidc_roi_qp_payload *p;
+
+		if (!m.data || m.width != c_.mask_width || m.height != c_.mask_height ||
+		    m.stride < m.width)
+			return -EINVAL;
+		reduce(m);
+		smooth();
+		p = reinterpret_cast<msm_vidc_roi_qp_payload *>(slot_[back_].data());
+		p->upper_qp_offset = c_.fg_qp;
+		p->lower_qp_offset = c_.bg_qp;
+		p->b_roi_info = 1;
+		p->mbi_info_size = (uint32_t)map_bytes_;
+		emit(reinterpret_cast<uint8_t *>(p) + ROI_PAYLOAD_HDR);
+		seq_[back_] = ++built_seq_;
+		back_ = mailbox_.exchange(back_ | NEW, std::memory_order_acq_rel) & 3;
+		return 0;
+	}
+
+	/*
+	 * The newest map built, as an ROI_QP payload of *@len bytes, and its
+	 * build number in *@seq; NULL before the first.  It stays put until
+	 * the next take(), however many maps are built meanwhile.
+	 */
+	const msm_vidc_roi_qp_payload *take(size_t *len, uint64_t *seq)
+	{
+		if (mailbox_.load(std::memory_order_relaxed) & NEW)
+			front_ = mailbox_.exchange(front_, std::memory_order_acq_rel) & 3;
+		if (!seq_[front_])
+			return NULL;
+		*len = ROI_PAYLOAD_HDR + map_bytes_;
+		*seq = seq_[front_];
+		return reinterpret_cast<const msm_vidc_roi_qp_payload *>(slot_[front_].data());
+	}
+
+	uint32_t blocks_x() const { return bw_; }
+	uint32_t blocks_y() const { return bh_; }
+	size_t map_bytes() const { return map_bytes_; }
+
+	/* Per-block mask means of the last build(), before smoothing */
+	const uint8_t *means() const { return means_.data(); }
+
+private:
+	static const uint32_t NEW = 4;
+
+	/*
+	 * Mask pixels [lo, hi) of each of the @n blocks of @block cutting
+	 * @frame pixels, the mask being @mask pixels across the same picture.
+	 */
+	static void ranges(uint32_t frame, uint32_t mask, uint32_t block, uint32_t n,
+			   std::vector<uint32_t> *lo, std::vector<uint32_t> *hi)
+	{
+		lo->resize(n);
+		hi->resize(n);
+		for (uint32_t b = 0; b < n; b++) {
+			uint64_t f0 = (uint64_t)b * block, f1 = f0 + block < frame ? f0 + block : frame;
+			/* first pixel whose centre is at or past f0: ceil(f0 * mask / frame - 1/2) */
+			uint32_t m0 = (uint32_t)((2 * f0 * mask + frame - 1) / (2 * (uint64_t)frame));
+			uint32_t m1 = (uint32_t)((2 * f1 * mask + frame - 1) / (2 * (uint64_t)frame));
+
+			if (m1 > mask)
+				m1 = mask;
+			if (m0 >= m1) {
+				/* no centre inside: the pixel under the block's centre */
+				m0 = (uint32_t)((f0 + f1) * mask / (2 * (uint64_t)frame));
+				m0 = m0 < mask ? m0 : mask - 1;
+				m1 = m0 + 1;
+			}
+			(*lo)[b] = m0;
+			(*hi)[b] = m1;
+		}
+	}
+
+	void reduce(const roi_mask &m)
+	{
+		for (uint32_t by = 0; by < bh_; by++) {
+			memset(sums_.data(), 0, bw_ * sizeof(sums_[0]));
+			for (uint32_t y = y0_[by]; y < y1_[by]; y += ROI_FLUSH_ROWS) {
+				uint32_t rows = std::min(y1_[by] - y, (uint32_t)ROI_FLUSH_ROWS);
+
+				roi_add_rows(acc_.data(), m.data + (size_t)y * m.stride, m.stride, rows,
+					     m.width);
+				for (uint32_t bx = 0; bx < bw_; bx++)
+					sums_[bx] += roi_sum(acc_.data() + x0_[bx], x1_[bx] - x0_[bx]);
+			}
+			for (uint32_t bx = 0; bx < bw_; bx++) {
+				uint32_t n = (x1_[bx] - x0_[bx]) * (y1_[by] - y0_[by]);
+
+				means_[(size_t)by * bw_ + bx] = (uint8_t)((sums_[bx] + n / 2) / n);
+			}
+		}
+	}
+
+	void smooth()
+	{
+		size_t n = means_.size();
+
+		if (!built_++ || c_.alpha == 256) {
+			for (size_t i = 0; i < n; i++)
+				ema_[i] = (uint16_t)(means_[i] << 8);
+			return;
+		}
+		for (size_t i = 0; i < n; i++) {
+			int32_t d = ((int32_t)means_[i] << 8) - ema_[i];
+
+			ema_[i] = (uint16_t)(ema_[i] + d * (int32_t)c_.alpha / 256);
+		}
+	}
+
+	void emit(uint8_t *out)
+	{
+		size_t n = ema_.size();
+
+		if (c_.type == ROI_TYPE_2BYTE) {
+			for (size_t i = 0; i < n; i++) {
+				int16_t d = lut_[(ema_[i] + 128) >> 8];
+
+				out[2 * i] = (uint8_t)d;
+				out[2 * i + 1] = (uint8_t)((uint16_t)d >> 8);
+			}
+			return;
+		}
+		memset(out, 0, map_bytes_);
+		for (size_t i = 0; i < n; i++) {
+			uint32_t s = (ema_[i] + 128) >> 8;
+			uint8_t code = s >= c_.hi ? 1 : s < c_.lo ? 2 : 0;
+
+			out[i / 4] |= (uint8_t)(code << (2 * (i % 4)));
+		}
+	}
+
+	roi_config c_ = {};
+	uint32_t bw_ = 0, bh_ = 0;
+	std::vector<uint32_t> x0_, x1_, y0_, y1_;
+	int16_t lut_[256];
+	std::vector<uint16_t> acc_;
+	std::vector<uint32_t> sums_;
+	std::vector<uint8_t> means_;
+	std::vector<uint16_t> ema_;		/* Q8 */
+	uint64_t built_ = 0, built_seq_ = 0;
+	size_t map_bytes_ = 0;
+
+	/* Back is build()'s, front is take()'s, the mailbox holds the spare */
+	std::vector<uint32_t> slot_[3];
+	uint64_t seq_[3] = {};
+	uint32_t back_ = 0, front_ = 1;
+	std::atomic<uint32_t> mailbox_{ 2 };
+};
+
+} /* namespace vidc */
+
+#endif /* __TOOLS_MEDIA_ROI_MAP_H__ */
@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Time detiling UBWC-sized frames to linear images, on synthetic frames.
+ *
+ * The tile order is a linear-tile model (see ubwc_tile.h): it has the
+ * real sizes, plane layout and per-tile work, but not the hardware's
+ * macrotile and bank swizzle, so it cannot read real UBWC dumps and the
+ * tool does not take any.
+ *
+ * Build: g++ -std=c++17 -O2 -march=native -pthread -o ubwc_detile ubwc_detile.cpp
+ * Usage: ubwc_detile [-f fmt] [-s WxH] [-i] [-n frames] [-j jobs] [-T seconds]
+ *
+ * fmt is NV12_UBWC (the default), P010_UBWC, NV12_BPP10_UBWC or
+ * RGBA8888_UBWC, each frame the size BUFFER_SIZE_USED gives (with -i,
+ * the interlaced size), detiled to packed NV12, P010 or RGBA8888.
+ *
+ * Frames are filled with noise, tiled and detiled and the round trip
+ * checked, and the TP10 unpack is checked against the C one.  Then the
+ * frames per second are reported detiling one frame on one thread, and
+ * a batch of -n frames (default 8) over -j threads.  -T sets how long
+ * each timing runs (default 1 s).
+ *
+ * Example:
+ *   ubwc_detile -f NV12_BPP10_UBWC -s 3840x2160 -j 4
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "ubwc_tile.h"
+
+static const struct {
+	const char *name;
+	unsigned int fmt;
+} fmt_names[] = {
+	{ "NV12_UBWC", COLOR_FMT_NV12_UBWC },
+	{ "P010_UBWC", COLOR_FMT_P010_UBWC },
+	{ "NV12_BPP10_UBWC", COLOR_FMT_NV12_BPP10_UBWC },
+	{ "RGBA8888_UBWC", COLOR_FMT_RGBA8888_UBWC },
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static int parse_fmt(const char *s)
+{
+	for (const auto &f : fmt_names)
+		if (!strcmp(s, f.name))
+			return (int)f.fmt;
+	return -1;
+}
+
+static const char *fmt_name(unsigned int fmt)
+{
+	for (const auto &f : fmt_names)
+		if (f.fmt == fmt)
+			return f.name;
+	return "?";
+}
+
+/*
+ * A frame's buffer and its packed linear image, both on a cache line
+ * boundary as an allocator would give them, so detiling can stream
+ */
+struct image {
+	std::vector<uint8_t> buf_mem, lin_mem;
+	uint8_t *buf, *lin;
+	size_t buf_len, lin_len;
+	ubwc::frame f;
+
+	void init(unsigned int fmt, uint32_t w, uint32_t h, bool interlaced)
+	{
+		const ubwc::tile_fmt *t = ubwc::lookup_tile_fmt(fmt);
+		uint32_t y_stride = w * t->bytes_per_px;
+		uint32_t uv_stride = t->planes == 2 ? (w + 1) / 2 * 2 * t->bytes_per_px : 0;
+
+		buf_len = ubwc::frame_bytes(fmt, w, h, interlaced);
+		lin_len = (size_t)y_stride * h + (size_t)uv_stride * ((h + 1) / 2);
+		buf_mem.resize(buf_len + 63);
+		lin_mem.resize(lin_len + 63);
+		f = { fmt, w, h, interlaced, NULL, buf_len, { NULL, y_stride, NULL, uv_stride } };
+		bind();
+	}
+
+	/* Point the frame at this copy's memory */
+	void bind(void)
+	{
+		buf = buf_mem.data() + (-(uintptr_t)buf_mem.data() & 63);
+		lin = lin_mem.data() + (-(uintptr_t)lin_mem.data() & 63);
+		f.buf = buf;
+		f.lin.y = lin;
+		f.lin.uv = lin + (size_t)f.lin.y_stride * f.h;
+	}
+};
+
+/* The vector TP10 unpack against the C one, on noise */
+static int check_tp10(void)
+{
+	uint8_t src[64], simd[96], ref[96];
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+
+	for (int i = 0; i < 100000; i++) {
+		for (int k = 0; k < 64; k += 8) {
+			uint64_t v = xorshift(&x);
+
+			memcpy(src + k, &v, 8);
+		}
+		ubwc::unpack_tp10(src, simd);
+		ubwc::unpack_tp10_c(src, ref);
+		if (memcmp(simd, ref, sizeof(ref))) {
+			fprintf(stderr, "tp10 %s unpack differs from C\n", ubwc::isa);
+			return -EDOM;
+		}
+	}
+	return 0;
+}
+
+/* Noise on the linear side; 10-bit formats keep the low six bits clear */
+static void fill(image &im, uint64_t *x)
+{
+	bool p010 = ubwc::lookup_tile_fmt(im.f.fmt)->bytes_per_px == 2;
+
+	for (size_t i = 0; i + 8 <= im.lin_len; i += 8) {
+		uint64_t v = xorshift(x);
+
+		if (p010)
+			v &= 0xffc0ffc0ffc0ffc0ull;
+		memcpy(im.lin + i, &v, 8);
+	}
+}
+
+static int bench(const image &proto, int frames, int jobs, double seconds)
+{
+	std::vector<image> ims(frames, proto);
+	std::vector<ubwc::frame> batch;
+	std::vector<uint8_t> want;
+	uint64_t x = 1;
+	double t0, t;
+	long n;
+	int ret;
+
+	ret = check_tp10();
+	if (ret)
+		return ret;
+	for (image &im : ims) {
+		im.bind();
+		fill(im, &x);
+		want.assign(im.lin, im.lin + im.lin_len);
+		ret = ubwc::tile(im.f);
+		if (!ret) {
+			memset(im.lin, 0xa5, im.lin_len);
+			ret = ubwc::detile(im.f);
+		}
+		if (ret)
+			return ret;
+		if (memcmp(im.lin, want.data(), im.lin_len)) {
+			fprintf(stderr, "round trip differs\n");
+			return -EDOM;
+		}
+		batch.push_back(im.f);
+	}
+
+	printf("%s %ux%u%s, %s, round trip ok\n", fmt_name(proto.f.fmt), proto.f.w, proto.f.h,
+	       proto.f.interlaced ? " interlaced" : "", ubwc::isa);
+
+	t0 = now_us();
+	for (n = 0; (t = now_us() - t0) < seconds * 1e6; n++)
+		ubwc::detile(ims[n % frames].f);
+	printf("one thread:  %8.1f fps, %6.2f GB/s\n", n / t * 1e6,
+	       n * (double)proto.buf_len / t / 1e3);
+
+	t0 = now_us();
+	for (n = 0; (t = now_us() - t0) < seconds * 1e6; n += frames)
+		ubwc::batch(batch, jobs);
+	printf("%2d threads:  %8.1f fps, %6.2f GB/s\n", jobs, n / t * 1e6,
+	       n * (double)proto.buf_len / t / 1e3);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int fmt = COLOR_FMT_NV12_UBWC, jobs = 1, frames = 8, opt;
+	unsigned int w = 3840, h = 2160;
+	bool interlaced = false;
+	double seconds = 1;
+	image proto;
+
+	while ((opt = getopt(argc, argv, "f:s:ij:n:T:")) != -1) {
+		switch (opt) {
+		case 'f':
+			fmt = parse_fmt(optarg);
+			if (fmt < 0) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &w, &h) != 2 || !w || !h) {
+				fprintf(stderr, "bad size %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'i':
+			interlaced = true;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'T':
+			seconds = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (jobs < 1 || frames < 1 || optind != argc) {
+		fprintf(stderr, "usage: %s [-f fmt] [-s WxH] [-i] [-n frames] [-j jobs] [-T seconds]\n",
+			argv[0]);
+		return 1;
+	}
+
+	proto.init((unsigned int)fmt, w, h, interlaced);
+	return bench(proto, frames, jobs, seconds) ? 1 : 0;
+}
@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Replay a frame buffer allocation trace through the Venus buffer pool
+ * and report hit rate, system calls and fragmentation.
+ *
+ * Build: g++ -std=c++17 -O2 -o ubwc_pool ubwc_pool.cpp
+ * Usage: ubwc_pool [-c chunk_MiB] [-L limit_MiB] [-i max_idle_MiB] [-P] [-U] [-N] [-v]
+ *                  <trace.csv>
+ *        ubwc_pool [options] -g seconds
+ *
+ * The trace is CSV with a header row, one event per row:
+ *
+ *   op,id,fmt,width,height
+ *
+ * op is alloc or free, id the caller's handle for the buffer, fmt a
+ * color_fmts name without the COLOR_FMT_ prefix (NV12_UBWC) or number;
+ * free rows need only op and id.  -c sets the arena growth step, -L its
+ * ceiling, -i how many idle bytes are kept before the oldest are
+ * retired, -P punches retired ranges out of the memfd, -U does not
+ * export dma-bufs even where /dev/udmabuf exists.  -N replays the trace
+ * a second time with a memfd, a mapping and a dma-buf made per buffer
+ * and torn down on free, for comparison.  -g replays a synthetic
+ * transcoding service: four sessions at 30 fps switching ABR rungs every
+ * few seconds.  -v logs every allocation that missed its class.
+ *
+ * Example:
+ *   ubwc_pool -i 256 -N -g 600
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../lib/csv.h"
+#include "ubwc_pool.h"
+
+#define MiB		(1024.0 * 1024.0)
+
+/* In enum color_fmts order */
+static const char *const fmt_names[VENUS_NR_FMTS] = {
+	"NV12", "NV12_128", "NV21", "NV12_UBWC", "NV12_BPP10_UBWC", "RGBA8888",
+	"RGBA8888_UBWC", "RGBA1010102_UBWC", "RGB565_UBWC", "P010_UBWC", "P010", "NV12_512",
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int parse_fmt(std::string_view s)
+{
+	for (unsigned int f = 0; f < VENUS_NR_FMTS; f++)
+		if (s == fmt_names[f])
+			return (int)f;
+	if (!s.empty() && s[0] >= '0' && s[0] <= '9') {
+		unsigned int f = (unsigned int)atoi(std::string(s).c_str());
+
+		return f < VENUS_NR_FMTS ? (int)f : -1;
+	}
+	return -1;
+}
+
+/* Sessions of a transcoding service: a window of frames in flight each */
+static std::string synth(double seconds)
+{
+	static const struct {
+		uint32_t w, h;
+	} ladder[] = { { 3840, 2160 }, { 1920, 1080 }, { 1280, 720 }, { 960, 540 }, { 640, 360 } };
+	static const struct {
+		unsigned int fmt;
+		int window, fps;
+	} kinds[] = {
+		{ COLOR_FMT_NV12_UBWC, 8, 30 },
+		{ COLOR_FMT_NV12_UBWC, 8, 30 },
+		{ COLOR_FMT_NV12_BPP10_UBWC, 6, 30 },
+		{ COLOR_FMT_RGBA8888_UBWC, 3, 10 },
+	};
+	struct session {
+		int rung;
+		double next_switch;
+		std::vector<uint64_t> held;
+	} ss[4];
+	uint64_t x = 0x9e3779b97f4a7c15ull, id = 0;
+	std::string out = "op,id,fmt,width,height\n";
+	char line[96];
+
+	auto rnd = [&x]() {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		return x;
+	};
+
+	for (auto &s : ss) {
+		s.rung = (int)(rnd() % 5);
+		s.next_switch = 2 + rnd() % 7;
+	}
+	for (int tick = 0; tick < seconds * 30; tick++) {
+		double t = tick / 30.0;
+
+		for (int i = 0; i < 4; i++) {
+			session &s = ss[i];
+
+			if (tick % (30 / kinds[i].fps))
+				continue;
+			if (t >= s.next_switch) {
+				/* A rung change flushes the pipeline */
+				for (uint64_t h : s.held)
+					out += "free," + std::to_string(h) + "\n";
+				s.held.clear();
+				s.rung = (int)(rnd() % 5);
+				s.next_switch = t + 2 + rnd() % 7;
+			}
+			snprintf(line, sizeof(line), "alloc,%lu,%s,%u,%u\n", (unsigned long)id,
+				 fmt_names[kinds[i].fmt], ladder[s.rung].w, ladder[s.rung].h);
+			out += line;
+			s.held.push_back(id++);
+			if ((int)s.held.size() > kinds[i].window) {
+				out += "free," + std::to_string(s.held.front()) + "\n";
+				s.held.erase(s.held.begin());
+			}
+		}
+	}
+	return out;
+}
+
+struct columns {
+	int op, id, fmt, w, h;
+};
+
+static int header(csv::reader &rd, columns *c)
+{
+	csv::row r;
+
+	rd.rewind();
+	if (rd.next(&r))
+		*c = { r.find("op"), r.find("id"), r.find("fmt"), r.find("width"),
+		       r.find("height") };
+	else
+		*c = { -1, -1, -1, -1, -1 };
+	if (c->op < 0 || c->id < 0 || c->fmt < 0 || c->w < 0 || c->h < 0) {
+		fprintf(stderr, "trace header needs op, id, fmt, width and height\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int replay(csv::reader &rd, ubwc::pool &p, bool verbose, uint64_t *events)
+{
+	std::unordered_map<uint64_t, uint32_t> ids;
+	columns c;
+	csv::row r;
+	int ret = header(rd, &c);
+
+	if (ret)
+		return ret;
+	while (rd.next(&r)) {
+		uint64_t id = r.u64(c.id);
+
+		(*events)++;
+		if (r.str(c.op) == "free") {
+			auto it = ids.find(id);
+
+			if (it == ids.end())
+				continue;
+			p.free(it->second);
+			ids.erase(it);
+		} else {
+			int fmt = parse_fmt(r.str(c.fmt));
+			uint64_t hits = p.stats().hits;
+			ubwc::buffer b;
+
+			if (fmt < 0 || ids.count(id)) {
+				fprintf(stderr, "line %lu: bad format or id in use\n", rd.line());
+				return -EINVAL;
+			}
+			ret = p.alloc(fmt, (uint32_t)r.u64(c.w), (uint32_t)r.u64(c.h), &b);
+			if (ret) {
+				fprintf(stderr, "line %lu: %s\n", rd.line(), strerror(-ret));
+				return ret;
+			}
+			ids[id] = b.id;
+			if (verbose && p.stats().hits == hits)
+				printf("miss %s %lux%lu: %u bytes at %#lx\n", fmt_names[fmt],
+				       (unsigned long)r.u64(c.w), (unsigned long)r.u64(c.h), b.size,
+				       (unsigned long)b.offset);
+		}
+	}
+	return 0;
+}
+
+/* Per-buffer memfd, mapping and dma-buf, gone again on free */
+struct naive_buf {
+	int memfd, dmabuf;
+	void *va;
+	uint32_t size;
+};
+
+static int naive_replay(csv::reader &rd, bool udmabuf, uint64_t *syscalls)
+{
+	std::unordered_map<uint64_t, naive_buf> live;
+	int udev = -1, ret;
+	columns c;
+	csv::row r;
+
+	ret = header(rd, &c);
+	if (ret)
+		return ret;
+	if (udmabuf) {
+		udev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+		(*syscalls)++;
+	}
+	while (rd.next(&r)) {
+		uint64_t id = r.u64(c.id);
+
+		if (r.str(c.op) == "free") {
+			auto it = live.find(id);
+
+			if (it == live.end())
+				continue;
+			munmap(it->second.va, it->second.size);
+			close(it->second.memfd);
+			*syscalls += 2;
+			if (it->second.dmabuf >= 0) {
+				close(it->second.dmabuf);
+				(*syscalls)++;
+			}
+			live.erase(it);
+		} else {
+			naive_buf b = { -1, -1, NULL, 0 };
+
+			b.size = venus::buffer_size(parse_fmt(r.str(c.fmt)), (uint32_t)r.u64(c.w),
+						    (uint32_t)r.u64(c.h));
+			b.memfd = memfd_create("frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+			if (b.memfd < 0 || ftruncate(b.memfd, b.size) < 0 ||
+			    fcntl(b.memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)
+				return -errno;
+			b.va = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_SHARED, b.memfd, 0);
+			if (b.va == MAP_FAILED)
+				return -errno;
+			*syscalls += 4;
+			if (udev >= 0) {
+				struct udmabuf_create cr = { (__u32)b.memfd, UDMABUF_FLAGS_CLOEXEC, 0,
+							     b.size };
+
+				b.dmabuf = ioctl(udev, UDMABUF_CREATE, &cr);
+				(*syscalls)++;
+			}
+			live[id] = b;
+		}
+	}
+	for (auto &l : live) {
+		munmap(l.second.va, l.second.size);
+		close(l.second.memfd);
+		if (l.second.dmabuf >= 0)
+			close(l.second.dmabuf);
+	}
+	if (udev >= 0)
+		close(udev);
+	return 0;
+}
+
+static void report(const ubwc::pool &p)
+{
+	const ubwc::pool_stats &s = p.stats();
+	std::vector<ubwc::size_class> cls;
+
+	printf("pool: memfd arena, %s\n", p.exports_dmabuf() ? "dma-bufs exported" :
+	       "no dma-bufs (/dev/udmabuf not used)");
+	printf("allocs %lu, hits %lu (%.1f%%), frees %lu, buffers retired %lu\n",
+	       (unsigned long)s.allocs, (unsigned long)s.hits, 100 * s.hit_rate(),
+	       (unsigned long)s.frees, (unsigned long)s.retired);
+	printf("syscalls %lu (%.2f per 1000 allocs), arena grown %lu times\n",
+	       (unsigned long)s.syscalls, s.allocs ? 1000.0 * s.syscalls / s.allocs : 0.0,
+	       (unsigned long)s.grows);
+	printf("peak live %.1f MiB, peak arena %.1f MiB (%+.1f%%)\n", s.peak_live / MiB,
+	       s.peak_arena / MiB,
+	       s.peak_live ? 100.0 * ((double)s.peak_arena / s.peak_live - 1) : 0.0);
+	printf("now: live %.1f MiB, idle %.1f MiB, holes %.1f MiB, largest %.1f MiB, "
+	       "fragmentation %.1f%%\n", s.live_bytes / MiB, s.idle_bytes / MiB,
+	       s.hole_bytes / MiB, s.largest_hole / MiB, 100 * s.fragmentation());
+
+	p.for_each_class([&cls](const ubwc::size_class &c) { cls.push_back(c); });
+	std::sort(cls.begin(), cls.end(), [](const ubwc::size_class &a, const ubwc::size_class &b) {
+		return a.size > b.size;
+	});
+	printf("%10s  %-28s %9s %6s %5s %5s\n", "size", "first seen", "allocs", "hit%", "live",
+	       "idle");
+	for (const auto &c : cls) {
+		char seen[48];
+
+		snprintf(seen, sizeof(seen), "%s %ux%u", fmt_names[c.fmt], c.w, c.h);
+		printf("%10u  %-28s %9lu %5.1f%% %5u %5u\n", c.size, seen, (unsigned long)c.allocs,
+		       c.allocs ? 100.0 * c.hits / c.allocs : 0.0, c.live, c.idle);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	ubwc::pool_opts o;
+	bool verbose = false, naive = false;
+	double gen = 0, t0, t1;
+	uint64_t events = 0;
+	std::string trace;
+	csv::reader rd;
+	ubwc::pool p;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "c:L:i:PUNg:v")) != -1) {
+		switch (opt) {
+		case 'c':
+			o.chunk = (uint64_t)(atof(optarg) * MiB);
+			break;
+		case 'L':
+			o.limit = (uint64_t)(atof(optarg) * MiB);
+			break;
+		case 'i':
+			o.max_idle = (uint64_t)(atof(optarg) * MiB);
+			break;
+		case 'P':
+			o.punch = true;
+			break;
+		case 'U':
+			o.udmabuf = false;
+			break;
+		case 'N':
+			naive = true;
+			break;
+		case 'g':
+			gen = atof(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (gen > 0 ? optind != argc : optind != argc - 1) {
+		fprintf(stderr,
+			"usage: %s [-c chunk_MiB] [-L limit_MiB] [-i max_idle_MiB] [-P] [-U] [-N] "
+			"[-v] <trace.csv>\n"
+			"       %s [options] -g seconds\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	if (gen > 0) {
+		trace = synth(gen);
+		rd.attach(trace.data(), trace.size());
+	} else if ((ret = rd.open(argv[optind]))) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	ret = p.init(o);
+	if (ret) {
+		fprintf(stderr, "pool: %s\n", strerror(-ret));
+		return 1;
+	}
+	t0 = now_us();
+	ret = replay(rd, p, verbose, &events);
+	t1 = now_us();
+	if (ret)
+		return 1;
+	report(p);
+	fprintf(stderr, "%lu events replayed in %.1f ms\n", (unsigned long)events,
+		(t1 - t0) / 1e3);
+
+	if (naive) {
+		uint64_t syscalls = 0;
+
+		t0 = now_us();
+		ret = naive_replay(rd, o.udmabuf, &syscalls);
+		t1 = now_us();
+		if (ret) {
+			fprintf(stderr, "per-buffer replay: %s\n", strerror(-ret));
+			return 1;
+		}
+		printf("per-buffer memfd: syscalls %lu (%.2f per 1000 allocs), %.1f ms\n",
+		       (unsigned long)syscalls,
+		       p.stats().allocs ? 1000.0 * syscalls / p.stats().allocs : 0.0,
+		       (t1 - t0) / 1e3);
+	}
+	return 0;
+}
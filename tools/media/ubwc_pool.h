@@ -0,0 +1,429 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Recycling pool for Venus frame buffers, keyed by VENUS_BUFFER_SIZE.
+ *
+ * Every buffer is a page aligned range of one memfd arena, mapped once
+ * for the CPU and, when /dev/udmabuf can be opened, exported once as a
+ * dma-buf.  Freed buffers are not given back: they go idle on the list
+ * of their size class, and the next request for that exact size takes
+ * the most recently freed one, mapping and dma-buf included, without a
+ * system call.  Sizes are the 4K aligned VENUS_BUFFER_SIZE of the
+ * format and resolution, so two resolutions that round to the same UBWC
+ * geometry share a class.
+ *
+ * A request for a class with nothing idle takes the best fitting hole
+ * in the arena, else the arena top.  Before the arena grows, idle
+ * buffers of other classes are retired, least recently freed first, and
+ * their ranges merged back into the holes: after a resolution switch
+ * the old size's buffers become the new size's, and memory only grows
+ * when the live set does.  Idle bytes over a ceiling are retired on
+ * free as well.  Growth is an ftruncate of the memfd, a chunk at a time,
+ * inside an address range reserved up front.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_MEDIA_UBWC_POOL_H__
+#define __TOOLS_MEDIA_UBWC_POOL_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../../kernel-headers/linux/udmabuf.h"
+#include "venus_geom.h"
+
+namespace ubwc {
+
+#define POOL_PAGE		4096u
+#define POOL_NONE		0xffffffffu
+
+struct pool_opts {
+	uint64_t chunk = 64ull << 20;		/* arena growth step */
+	uint64_t limit = 4ull << 30;		/* arena ceiling, reserved at init */
+	uint64_t max_idle = 512ull << 20;	/* idle bytes kept before retiring */
+	bool udmabuf = true;			/* export dma-bufs if the device opens */
+	bool punch = false;			/* hand retired pages back to the kernel */
+};
+
+/* What alloc() hands out; id goes back to free() */
+struct buffer {
+	uint32_t id;
+	uint32_t size;
+	uint64_t offset;	/* in the memfd */
+	void *va;
+	int dmabuf;		/* -1 without udmabuf */
+};
+
+struct pool_stats {
+	uint64_t allocs, hits, frees, retired, grows, syscalls;
+	uint64_t live_bytes, idle_bytes, hole_bytes, largest_hole;
+	uint64_t arena_bytes, peak_live, peak_arena;
+
+	double hit_rate() const { return allocs ? (double)hits / allocs : 0; }
+
+	/* Share of the free space below the arena top not usable in one piece */
+	double fragmentation() const
+	{
+		return hole_bytes ? 1 - (double)largest_hole / hole_bytes : 0;
+	}
+};
+
+struct size_class {
+	uint32_t size;
+	unsigned int fmt;	/* first request seen, for reports */
+	uint32_t w, h;
+	uint64_t allocs, hits;
+	uint32_t live, idle;
+	uint32_t head;		/* most recently freed idle slot */
+};
+
+class pool {
+public:
+	pool() = default;
+	pool(const pool &) = delete;
+	pool &operator=(const pool &) = delete;
+
+	~pool()
+	{
+		for (const slot &s : slots_)
+			if (s.dmabuf >= 0)
+				close(s.dmabuf);
+		if (base_)
+			munmap(base_, opts_.limit);
+		if (udev_ >= 0)
+			close(udev_);
+		if (memfd_ >= 0)
+			close(memfd_);
+	}
+
+	int init(const pool_opts &o = pool_opts())
+	{
+		opts_ = o;
+		opts_.chunk = (o.chunk + POOL_PAGE - 1) & ~(uint64_t)(POOL_PAGE - 1);
+		if (!opts_.chunk || opts_.limit < opts_.chunk)
+			return -EINVAL;
+
+		memfd_ = sys(memfd_create("ubwc_pool", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+		if (memfd_ < 0)
+			return -errno;
+		/* udmabuf wants the memfd unable to shrink under the dma-bufs */
+		if (sys(fcntl(memfd_, F_ADD_SEALS, F_SEAL_SHRINK)) < 0)
+			return -errno;
+		base_ = mmap(NULL, opts_.limit, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE,
+			     memfd_, 0);
+		st_.syscalls++;
+		if (base_ == MAP_FAILED) {
+			base_ = NULL;
+			return -errno;
+		}
+		if (o.udmabuf)
+			udev_ = sys(open("/dev/udmabuf", O_RDWR | O_CLOEXEC));
+		return 0;
+	}
+
+	bool exports_dmabuf() const { return udev_ >= 0; }
+
+	/* A buffer for @fmt at @w x @h, as VENUS_BUFFER_SIZE sizes it */
+	int alloc(unsigned int fmt, uint32_t w, uint32_t h, buffer *b)
+	{
+		uint32_t size = venus::buffer_size(fmt, w, h);
+		size_class *c;
+		uint32_t id;
+		int ret;
+
+		if (!size)
+			return -EINVAL;
+		c = &cls_[size];
+		if (!c->size)
+			*c = { size, fmt, w, h, 0, 0, 0, 0, POOL_NONE };
+
+		if (c->head != POOL_NONE) {
+			id = c->head;
+			unlink_idle(id);
+			c->hits++;
+			st_.hits++;
+		} else {
+			ret = place(size, &id);
+			if (ret)
+				return ret;
+			slots_[id].cls = c;
+		}
+
+		slot &s = slots_[id];
+
+		s.live = true;
+		c->live++;
+		c->allocs++;
+		st_.allocs++;
+		st_.live_bytes += size;
+		st_.peak_live = std::max(st_.peak_live, st_.live_bytes);
+		*b = { id, size, s.offset, (char *)base_ + s.offset, s.dmabuf };
+		return 0;
+	}
+
+	int free(uint32_t id)
+	{
+		if (id >= slots_.size() || !slots_[id].live)
+			return -EINVAL;
+
+		slot &s = slots_[id];
+
+		s.live = false;
+		s.cls->live--;
+		st_.live_bytes -= s.cls->size;
+		st_.frees++;
+		link_idle(id);
+		while (st_.idle_bytes > opts_.max_idle)
+			retire(lru_tail_);
+		return 0;
+	}
+
+	/* Retire idle buffers, oldest first, until at most @keep bytes idle */
+	void trim(uint64_t keep)
+	{
+		while (st_.idle_bytes > keep)
+			retire(lru_tail_);
+	}
+
+	const pool_stats &stats() const { return st_; }
+
+	template <typename F>
+	void for_each_class(F fn) const
+	{
+		for (const auto &c : cls_)
+			fn(c.second);
+	}
+
+private:
+	struct slot {
+		uint64_t offset;
+		size_class *cls;
+		int dmabuf;
+		bool live;
+		uint32_t prev, next;		/* class idle list, newest first */
+		uint32_t lru_prev, lru_next;	/* every idle slot, newest first */
+	};
+
+	int sys(int ret)
+	{
+		st_.syscalls++;
+		return ret;
+	}
+
+	/* Room for a new buffer of @size, as a slot with its dma-buf */
+	int place(uint32_t size, uint32_t *id)
+	{
+		uint64_t off = 0;
+		int ret;
+
+		while (!take_hole(size, &off)) {
+			if (top_ + size <= st_.arena_bytes || lru_tail_ == POOL_NONE) {
+				ret = take_top(size, &off);
+				if (ret)
+					return ret;
+				break;
+			}
+			/* Idle memory goes back into circulation before the arena grows */
+			retire(lru_tail_);
+		}
+
+		if (spare_.empty()) {
+			*id = (uint32_t)slots_.size();
+			slots_.emplace_back();
+		} else {
+			*id = spare_.back();
+			spare_.pop_back();
+		}
+		slots_[*id] = { off, NULL, -1, false, POOL_NONE, POOL_NONE, POOL_NONE, POOL_NONE };
+
+		if (udev_ >= 0) {
+			struct udmabuf_create cr = { (__u32)memfd_, UDMABUF_FLAGS_CLOEXEC, off, size };
+
+			slots_[*id].dmabuf = sys(ioctl(udev_, UDMABUF_CREATE, &cr));
+			if (slots_[*id].dmabuf < 0) {
+				ret = -errno;
+				give_back(off, size);
+				spare_.push_back(*id);
+				return ret;
+			}
+		}
+		return 0;
+	}
+
+	int take_top(uint32_t size, uint64_t *off)
+	{
+		uint64_t end = top_ + size;
+
+		if (end > st_.arena_bytes) {
+			uint64_t want = (end + opts_.chunk - 1) / opts_.chunk * opts_.chunk;
+
+			want = std::min(want, opts_.limit);
+			if (end > want)
+				return -ENOMEM;
+			if (sys(ftruncate(memfd_, (off_t)want)) < 0)
+				return -errno;
+			st_.arena_bytes = want;
+			st_.peak_arena = std::max(st_.peak_arena, want);
+			st_.grows++;
+		}
+		*off = top_;
+		top_ = end;
+		return 0;
+	}
+
+	/* Best fit among the holes below the arena top */
+	bool take_hole(uint32_t size, uint64_t *off)
+	{
+		auto it = by_len_.lower_bound({ size, 0 });
+		uint64_t len;
+
+		if (it == by_len_.end())
+			return false;
+		len = it->first;
+		*off = it->second;
+		by_len_.erase(it);
+		holes_.erase(*off);
+		st_.hole_bytes -= len;
+		if (len > size)
+			add_hole(*off + size, len - size);
+		update_largest();
+		return true;
+	}
+
+	void add_hole(uint64_t off, uint64_t len)
+	{
+		holes_[off] = len;
+		by_len_.insert({ len, off });
+		st_.hole_bytes += len;
+	}
+
+	void del_hole(std::map<uint64_t, uint64_t>::iterator it)
+	{
+		by_len_.erase({ it->second, it->first });
+		st_.hole_bytes -= it->second;
+		holes_.erase(it);
+	}
+
+	/* Return a range, merging with its neighbours and with the top */
+	void give_back(uint64_t off, uint64_t len)
+	{
+		auto next = holes_.lower_bound(off);
+
+		if (next != holes_.end() && off + len == next->first) {
+			len += next->second;
+			del_hole(next);
+		}
+		next = holes_.lower_bound(off);
+		if (next != holes_.begin()) {
+			auto prev = std::prev(next);
+
+			if (prev->first + prev->second == off) {
+				off = prev->first;
+				len += prev->second;
+				del_hole(prev);
+			}
+		}
+		if (off + len == top_)
+			top_ = off;
+		else
+			add_hole(off, len);
+		update_largest();
+	}
+
+	void update_largest()
+	{
+		st_.largest_hole = by_len_.empty() ? 0 : by_len_.rbegin()->first;
+	}
+
+	/* Hand an idle slot's range back to the arena */
+	void retire(uint32_t id)
+	{
+		slot &s = slots_[id];
+		uint32_t size = s.cls->size;
+
+		unlink_idle(id);
+		if (s.dmabuf >= 0)
+			sys(close(s.dmabuf));
+		if (opts_.punch)
+			sys(fallocate(memfd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				      (off_t)s.offset, size));
+		give_back(s.offset, size);
+		s.dmabuf = -1;
+		s.cls = NULL;
+		spare_.push_back(id);
+		st_.retired++;
+	}
+
+	void link_idle(uint32_t id)
+	{
+		slot &s = slots_[id];
+		size_class *c = s.cls;
+
+		s.prev = POOL_NONE;
+		s.next = c->head;
+		if (c->head != POOL_NONE)
+			slots_[c->head].prev = id;
+		c->head = id;
+		c->idle++;
+
+		s.lru_prev = POOL_NONE;
+		s.lru_next = lru_head_;
+		if (lru_head_ != POOL_NONE)
+			slots_[lru_head_].lru_prev = id;
+		else
+			lru_tail_ = id;
+		lru_head_ = id;
+		st_.idle_bytes += c->size;
+	}
+
+	void unlink_idle(uint32_t id)
+	{
+		slot &s = slots_[id];
+		size_class *c = s.cls;
+
+		if (s.prev != POOL_NONE)
+			slots_[s.prev].next = s.next;
+		else
+			c->head = s.next;
+		if (s.next != POOL_NONE)
+			slots_[s.next].prev = s.prev;
+		c->idle--;
+
+		if (s.lru_prev != POOL_NONE)
+			slots_[s.lru_prev].lru_next = s.lru_next;
+		else
+			lru_head_ = s.lru_next;
+		if (s.lru_next != POOL_NONE)
+			slots_[s.lru_next].lru_prev = s.lru_prev;
+		else
+			lru_tail_ = s.lru_prev;
+		st_.idle_bytes -= c->size;
+	}
+
+	pool_opts opts_;
+	int memfd_ = -1, udev_ = -1;
+	void *base_ = NULL;
+	uint64_t top_ = 0;
+	std::vector<slot> slots_;
+	std::vector<uint32_t> spare_;
+	std::unordered_map<uint32_t, size_class> cls_;
+	std::map<uint64_t, uint64_t> holes_;		/* offset -> length */
+	std::set<std::pair<uint64_t, uint64_t>> by_len_;	/* (length, offset) */
+	uint32_t lru_head_ = POOL_NONE, lru_tail_ = POOL_NONE;
+	pool_stats st_ = {};
+};
+
+} /* namespace ubwc */
+
+#endif /* __TOOLS_MEDIA_UBWC_POOL_H__ */
@@ -0,0 +1,506 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Model of UBWC tiling and detiling in uncompressed tile mode, for
+ * timing the per-tile work; not a reader or writer of real UBWC buffers.
+ *
+ * The tile geometry is the one msm_media_info.h and mmm_color_fmt.h size
+ * the meta planes with: one meta byte per tile, and a tile is the meta
+ * tile width in pixels by the meta tile height in lines, 256 bytes:
+ *
+ *   NV12_UBWC        Y 32x8,  UV 16x8 pairs   (32 bytes a line)
+ *   P010_UBWC        Y 32x4,  UV 16x4 pairs   (64 bytes a line)
+ *   NV12_BPP10_UBWC  Y 48x4,  UV 24x4 pairs   (64 bytes: 16 TP10 words)
+ *   RGBA8888_UBWC    16x4                     (64 bytes a line)
+ *
+ * Planes are where venus::geom() puts them.  Within a plane, tiles are
+ * stored whole, one after the other, left to right and then down, and
+ * an uncompressed tile is its lines in order; tile_offset() is the one
+ * place that ordering lives.  The hardware instead groups tiles into
+ * macrotiles (drm_fourcc.h: mostly 4x4) and swizzles them by DDR bank,
+ * and nothing in this tree gives that mapping or a buffer tiled by it to
+ * check one against, so it is not guessed at.  The sizes, plane
+ * placement and per-tile work are the real ones, which is what the
+ * timings need.  Meta planes are skipped on detiling and zeroed on
+ * tiling.  Interlaced NV12 UBWC keeps each field as a frame of half
+ * height; the linear side has the fields' lines interleaved.
+ *
+ * Linear output is NV12, P010 (10 bits in the top of 16) or RGBA8888 at
+ * the caller's strides.  The TP10 unpack runs on AVX2 or SSSE3, whichever
+ * the build enables, else in C; the other formats are line copies of a
+ * fixed width.  Detiling with AVX2 streams whole cache lines to the
+ * linear side when its lines are 64-byte aligned.  Work is cut into
+ * bands of tile rows, which batch() spreads over threads.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_MEDIA_UBWC_TILE_H__
+#define __TOOLS_MEDIA_UBWC_TILE_H__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+#include "venus_geom.h"
+
+namespace ubwc {
+
+#define UBWC_TILE_BYTES		256u
+#define UBWC_BAND_ROWS		8	/* tile rows per unit of work */
+
+/* A plane of tiles: bytes a tile line, lines a tile, TP10 packed or not */
+struct tile_kind {
+	uint32_t line_bytes;
+	uint32_t lines;
+	bool tp10;
+};
+
+struct tile_fmt {
+	unsigned int fmt;
+	int planes;			/* 1: RGB, 2: Y and UV */
+	tile_kind y, uv;
+	uint32_t bytes_per_px;		/* linear Y or RGB, 2 for P010 */
+};
+
+inline const tile_fmt *lookup_tile_fmt(unsigned int fmt)
+{
+	static const tile_fmt fmts[] = {
+		{ COLOR_FMT_NV12_UBWC, 2, { 32, 8, false }, { 32, 8, false }, 1 },
+		{ COLOR_FMT_P010_UBWC, 2, { 64, 4, false }, { 64, 4, false }, 2 },
+		{ COLOR_FMT_NV12_BPP10_UBWC, 2, { 64, 4, true }, { 64, 4, true }, 2 },
+		{ COLOR_FMT_RGBA8888_UBWC, 1, { 64, 4, false }, { 0, 0, false }, 4 },
+	};
+
+	for (const tile_fmt &t : fmts)
+		if (t.fmt == fmt)
+			return &t;
+	return NULL;
+}
+
+/* The linear side; uv is unused for RGBA */
+struct linear {
+	uint8_t *y;
+	uint32_t y_stride;
+	uint8_t *uv;
+	uint32_t uv_stride;
+};
+
+/*
+ * Byte offset of tile (@tx, @ty) in a plane @tiles_x tiles wide, row
+ * major with no macrotile or bank swizzle; see the top of the file.
+ */
+inline size_t tile_offset(uint32_t tx, uint32_t ty, uint32_t tiles_x)
+{
+	return ((size_t)ty * tiles_x + tx) * UBWC_TILE_BYTES;
+}
+
+/*
+ * TP10 to P010: a 32-bit word holds three 10-bit samples in bits 0-9,
+ * 10-19 and 20-29.  Sixteen words make 48 samples, 96 bytes out.  The
+ * vector kernels pick, for every 16-bit output, the two bytes its
+ * sample straddles, then multiply to move the sample to the top and mask.
+ */
+inline uint16_t tp10_sample(const uint8_t *src, unsigned int n)
+{
+	uint32_t word;
+
+	memcpy(&word, src + 4 * (n / 3), 4);
+	return (uint16_t)((word >> (10 * (n % 3)) & 0x3ff) << 6);
+}
+
+inline void unpack_tp10_c(const uint8_t *src, uint8_t *dst)
+{
+	for (unsigned int n = 0; n < 48; n++) {
+		uint16_t v = tp10_sample(src, n);
+
+		memcpy(dst + 2 * n, &v, 2);
+	}
+}
+
+/* For output block b % 3 of eight samples: source byte and multiplier per lane */
+#define TP10_SHUF(o)	(o), (o) + 1
+#define TP10_MASK0	TP10_SHUF(0), TP10_SHUF(1), TP10_SHUF(2), TP10_SHUF(4), \
+			TP10_SHUF(5), TP10_SHUF(6), TP10_SHUF(8), TP10_SHUF(9)
+#define TP10_MASK1	TP10_SHUF(2), TP10_SHUF(4), TP10_SHUF(5), TP10_SHUF(6), \
+			TP10_SHUF(8), TP10_SHUF(9), TP10_SHUF(10), TP10_SHUF(12)
+#define TP10_MASK2	TP10_SHUF(5), TP10_SHUF(6), TP10_SHUF(8), TP10_SHUF(9), \
+			TP10_SHUF(10), TP10_SHUF(12), TP10_SHUF(13), TP10_SHUF(14)
+#define TP10_MUL0	64, 16, 4, 64, 16, 4, 64, 16
+#define TP10_MUL1	4, 64, 16, 4, 64, 16, 4, 64
+#define TP10_MUL2	16, 4, 64, 16, 4, 64, 16, 4
+
+/* Source of each output block: words 0, 2, 4, then 32 bytes on; never past the line */
+static const unsigned int tp10_src[6] = { 0, 8, 16, 32, 40, 48 };
+
+#if defined(__AVX2__)
+
+static const char isa[] = "avx2";
+
+/* With @stream, @dst is 32-byte aligned and written past the cache */
+inline void unpack_tp10(const uint8_t *src, uint8_t *dst, bool stream = false)
+{
+	const __m256i shuf[3] = {
+		_mm256_setr_epi8(TP10_MASK0, TP10_MASK1),
+		_mm256_setr_epi8(TP10_MASK2, TP10_MASK0),
+		_mm256_setr_epi8(TP10_MASK1, TP10_MASK2),
+	};
+	const __m256i mul[3] = {
+		_mm256_setr_epi16(TP10_MUL0, TP10_MUL1),
+		_mm256_setr_epi16(TP10_MUL2, TP10_MUL0),
+		_mm256_setr_epi16(TP10_MUL1, TP10_MUL2),
+	};
+	const __m256i top = _mm256_set1_epi16((short)0xffc0);
+
+	/* Blocks 2k and 2k + 1 side by side: 32 bytes of output in order */
+	for (int k = 0; k < 3; k++) {
+		__m256i v = _mm256_loadu2_m128i((const __m128i *)(src + tp10_src[2 * k + 1]),
+						(const __m128i *)(src + tp10_src[2 * k]));
+
+		v = _mm256_shuffle_epi8(v, shuf[k]);
+		v = _mm256_and_si256(_mm256_mullo_epi16(v, mul[k]), top);
+		if (stream)
+			_mm256_stream_si256((__m256i *)(dst + 32 * k), v);
+		else
+			_mm256_storeu_si256((__m256i *)(dst + 32 * k), v);
+	}
+}
+
+#elif defined(__SSSE3__)
+
+static const char isa[] = "ssse3";
+
+inline void unpack_tp10(const uint8_t *src, uint8_t *dst, bool = false)
+{
+	const __m128i shuf[3] = {
+		_mm_setr_epi8(TP10_MASK0), _mm_setr_epi8(TP10_MASK1), _mm_setr_epi8(TP10_MASK2),
+	};
+	const __m128i mul[3] = {
+		_mm_setr_epi16(TP10_MUL0), _mm_setr_epi16(TP10_MUL1), _mm_setr_epi16(TP10_MUL2),
+	};
+	const __m128i top = _mm_set1_epi16((short)0xffc0);
+
+	for (int b = 0; b < 6; b++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + tp10_src[b]));
+
+		v = _mm_shuffle_epi8(v, shuf[b % 3]);
+		v = _mm_and_si128(_mm_mullo_epi16(v, mul[b % 3]), top);
+		_mm_storeu_si128((__m128i *)(dst + 16 * b), v);
+	}
+}
+
+#else
+
+static const char isa[] = "c";
+
+inline void unpack_tp10(const uint8_t *src, uint8_t *dst, bool = false)
+{
+	unpack_tp10_c(src, dst);
+}
+
+#endif
+
+/* P010 back to TP10, for the tiler; not on any hot path */
+inline void pack_tp10(const uint8_t *src, uint8_t *dst)
+{
+	for (unsigned int i = 0; i < 16; i++) {
+		uint16_t s[3];
+		uint32_t word;
+
+		memcpy(s, src + 6 * i, 6);
+		word = (uint32_t)(s[0] >> 6) | (uint32_t)(s[1] >> 6) << 10 |
+		       (uint32_t)(s[2] >> 6) << 20;
+		memcpy(dst + 4 * i, &word, 4);
+	}
+}
+
+/*
+ * One plane's place in the buffer and in the linear image: @rows lines
+ * of @row_bytes, which are lines field, field + fields, ... of @lin.
+ */
+struct plane_map {
+	const tile_kind *k;
+	size_t offset;
+	uint32_t tiles_x, tile_rows;
+	uint32_t rows, row_bytes;
+	uint8_t *lin;
+	uint32_t lin_stride;
+	uint32_t field, fields;
+};
+
+/*
+ * The band's tiles one after the other: a tile's lines are contiguous,
+ * so each is read once, front to back, and its lines go to @nl linear
+ * lines @lin.  Detiling with AVX2 into lines aligned to the cache line,
+ * the linear side is written with streaming stores, two tiles at a time
+ * so every cache line is written whole: a frame does not fit in the
+ * cache and is not read back, and filling lines only to overwrite them
+ * doubles the write traffic.  The band ends with a fence.
+ */
+#if defined(__AVX2__)
+template <uint32_t LEN>
+inline void stream_line(uint8_t *dst, const uint8_t *src)
+{
+	for (uint32_t i = 0; i < LEN; i += 32)
+		_mm256_stream_si256((__m256i *)(dst + i),
+				    _mm256_loadu_si256((const __m256i *)(src + i)));
+}
+
+inline bool can_stream(const plane_map &p)
+{
+	return !(((uintptr_t)p.lin | p.lin_stride) & 63);
+}
+
+inline void stream_done(void)
+{
+	_mm_sfence();
+}
+#else
+template <uint32_t LEN>
+inline void stream_line(uint8_t *dst, const uint8_t *src)
+{
+	memcpy(dst, src, LEN);
+}
+
+inline bool can_stream(const plane_map &)
+{
+	return false;
+}
+
+inline void stream_done(void)
+{
+}
+#endif
+
+/* Linear lines of tile row @ty, at most one tile's worth; returns how many */
+inline uint32_t band_lines(const plane_map &p, uint32_t ty, uint8_t **lin)
+{
+	uint32_t r = ty * p.k->lines, nl = std::min(p.k->lines, p.rows - std::min(p.rows, r));
+
+	for (uint32_t l = 0; l < nl; l++)
+		lin[l] = p.lin + (size_t)((r + l) * p.fields + p.field) * p.lin_stride;
+	return nl;
+}
+
+#define UBWC_MAX_LINES	8
+
+/* Tile lines of a band to linear lines, or back when @to_tiles */
+template <uint32_t LINE>
+inline void copy_band(const plane_map &p, uint8_t *buf, uint32_t ty0, uint32_t ty1,
+		      bool to_tiles)
+{
+	uint32_t full = p.row_bytes / LINE, rest = p.row_bytes % LINE;
+	uint32_t pairs = !to_tiles && can_stream(p) ? full / 2 : 0;
+	uint8_t *lin[UBWC_MAX_LINES];
+
+	for (uint32_t ty = ty0; ty < ty1; ty++) {
+		uint32_t nl = band_lines(p, ty, lin), tx = 0;
+		uint8_t *t = buf + p.offset + tile_offset(0, ty, p.tiles_x);
+		size_t x = 0;
+
+		for (; tx < 2 * pairs; tx += 2, t += 2 * UBWC_TILE_BYTES, x += 2 * LINE) {
+			for (uint32_t l = 0; l < nl; l++) {
+				stream_line<LINE>(lin[l] + x, t + l * LINE);
+				stream_line<LINE>(lin[l] + x + LINE, t + UBWC_TILE_BYTES + l * LINE);
+			}
+		}
+		for (; tx < full; tx++, t += UBWC_TILE_BYTES, x += LINE) {
+			for (uint32_t l = 0; l < nl; l++) {
+				if (to_tiles)
+					memcpy(t + l * LINE, lin[l] + x, LINE);
+				else
+					memcpy(lin[l] + x, t + l * LINE, LINE);
+			}
+		}
+		for (uint32_t l = 0; rest && l < nl; l++) {
+			if (to_tiles)
+				memcpy(t + l * LINE, lin[l] + x, rest);
+			else
+				memcpy(lin[l] + x, t + l * LINE, rest);
+		}
+	}
+	if (pairs)
+		stream_done();
+}
+
+/* TP10 tile lines to P010 lines, 48 samples of a tile line at a time */
+inline void tp10_band(const plane_map &p, uint8_t *buf, uint32_t ty0, uint32_t ty1,
+		      bool to_tiles)
+{
+	uint32_t full = p.row_bytes / 96, rest = p.row_bytes % 96;
+	uint32_t pairs = !to_tiles && can_stream(p) ? full / 2 : 0;
+	uint8_t *lin[UBWC_MAX_LINES];
+	uint8_t tmp[96];
+
+	for (uint32_t ty = ty0; ty < ty1; ty++) {
+		uint32_t nl = band_lines(p, ty, lin), tx = 0;
+		uint8_t *t = buf + p.offset + tile_offset(0, ty, p.tiles_x);
+		size_t x = 0;
+
+		for (; tx < 2 * pairs; tx += 2, t += 2 * UBWC_TILE_BYTES, x += 2 * 96) {
+			for (uint32_t l = 0; l < nl; l++) {
+				unpack_tp10(t + l * 64, lin[l] + x, true);
+				unpack_tp10(t + UBWC_TILE_BYTES + l * 64, lin[l] + x + 96, true);
+			}
+		}
+		for (; tx < full; tx++, t += UBWC_TILE_BYTES, x += 96) {
+			for (uint32_t l = 0; l < nl; l++) {
+				if (to_tiles)
+					pack_tp10(lin[l] + x, t + l * 64);
+				else
+					unpack_tp10(t + l * 64, lin[l] + x);
+			}
+		}
+		for (uint32_t l = 0; rest && l < nl; l++) {
+			if (to_tiles) {
+				memset(tmp, 0, sizeof(tmp));
+				memcpy(tmp, lin[l] + x, rest);
+				pack_tp10(tmp, t + l * 64);
+			} else {
+				unpack_tp10(t + l * 64, tmp);
+				memcpy(lin[l] + x, tmp, rest);
+			}
+		}
+	}
+	if (pairs)
+		stream_done();
+}
+
+inline void run_band(const plane_map &p, uint8_t *buf, uint32_t ty0, uint32_t ty1, bool to_tiles)
+{
+	if (p.k->tp10)
+		tp10_band(p, buf, ty0, ty1, to_tiles);
+	else if (p.k->line_bytes == 32)
+		copy_band<32>(p, buf, ty0, ty1, to_tiles);
+	else
+		copy_band<64>(p, buf, ty0, ty1, to_tiles);
+}
+
+/* One frame: @buf holds it in UBWC layout, @lin in linear */
+struct frame {
+	unsigned int fmt;
+	uint32_t w, h;
+	bool interlaced;
+	uint8_t *buf;
+	size_t len;
+	linear lin;
+};
+
+/* Bytes of a buffer as the producer lays it out: one field unless interlaced */
+inline size_t frame_bytes(unsigned int fmt, uint32_t w, uint32_t h, bool interlaced)
+{
+	return venus::buffer_size_used(fmt, w, h, interlaced);
+}
+
+/* Every plane of every field of @f */
+inline int plane_maps(const frame &f, std::vector<plane_map> *out)
+{
+	const tile_fmt *t = lookup_tile_fmt(f.fmt);
+	venus::geometry g;
+
+	if (!t)
+		return -EOPNOTSUPP;
+	if (!f.w || !f.h)
+		return -EINVAL;
+	g = venus::geom(f.fmt, f.w, f.h, true, f.interlaced);
+	if (f.len < g.size)
+		return -EMSGSIZE;
+
+	for (uint32_t field = 0; field < g.fields; field++) {
+		size_t base = (size_t)field * (g.size / g.fields);
+		uint32_t uvh = (f.h + 1) / 2;
+		/* The top field has the odd line out, in luma and in chroma */
+		uint32_t fh = (f.h + g.fields - 1 - field) / g.fields;
+		uint32_t fuvh = (uvh + g.fields - 1 - field) / g.fields;
+
+		if (t->planes == 1) {
+			out->push_back({ &t->y, base + g.y.offset, g.rgb_stride / t->y.line_bytes,
+					 g.rgb_scanlines / t->y.lines, fh, f.w * t->bytes_per_px,
+					 f.lin.y, f.lin.y_stride, field, g.fields });
+			continue;
+		}
+		out->push_back({ &t->y, base + g.y.offset, g.y_stride / t->y.line_bytes,
+				 g.y_scanlines / t->y.lines, fh, f.w * t->bytes_per_px, f.lin.y,
+				 f.lin.y_stride, field, g.fields });
+		out->push_back({ &t->uv, base + g.uv.offset, g.uv_stride / t->uv.line_bytes,
+				 g.uv_scanlines / t->uv.lines, fuvh,
+				 (f.w + 1) / 2 * 2 * t->bytes_per_px, f.lin.uv, f.lin.uv_stride, field,
+				 g.fields });
+	}
+	return 0;
+}
+
+struct band {
+	const plane_map *p;
+	uint8_t *buf;
+	uint32_t ty0, ty1;
+};
+
+/*
+ * Detile (or, with @to_tiles, tile) every frame of @frames, bands of
+ * tile rows spread over @jobs threads.  Tiling zeroes the meta planes.
+ */
+inline int batch(const std::vector<frame> &frames, int jobs, bool to_tiles = false)
+{
+	std::vector<std::vector<plane_map>> maps(frames.size());
+	std::vector<band> work;
+	std::atomic<size_t> next(0);
+	int ret;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		ret = plane_maps(frames[i], &maps[i]);
+		if (ret)
+			return ret;
+		if (to_tiles)
+			memset(frames[i].buf, 0, frame_bytes(frames[i].fmt, frames[i].w,
+							      frames[i].h, frames[i].interlaced));
+		for (const plane_map &p : maps[i]) {
+			uint32_t used = std::min(p.tile_rows, (p.rows + p.k->lines - 1) / p.k->lines);
+
+			for (uint32_t ty = 0; ty < used; ty += UBWC_BAND_ROWS)
+				work.push_back({ &p, frames[i].buf, ty,
+						 std::min<uint32_t>(used, ty + UBWC_BAND_ROWS) });
+		}
+	}
+
+	auto worker = [&]() {
+		for (size_t k; (k = next++) < work.size();)
+			run_band(*work[k].p, work[k].buf, work[k].ty0, work[k].ty1, to_tiles);
+	};
+
+	jobs = std::max(1, std::min<int>(jobs, (int)work.size()));
+	if (jobs == 1) {
+		worker();
+	} else {
+		std::vector<std::thread> th;
+
+		for (int i = 0; i < jobs; i++)
+			th.emplace_back(worker);
+		for (auto &t : th)
+			t.join();
+	}
+	return 0;
+}
+
+inline int detile(const frame &f, int jobs = 1)
+{
+	return batch({ f }, jobs);
+}
+
+inline int tile(const frame &f, int jobs = 1)
+{
+	return batch({ f }, jobs, true);
+}
+
+} /* namespace ubwc */
+
+#endif /* __TOOLS_MEDIA_UBWC_TILE_H__ */
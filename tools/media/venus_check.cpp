@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Check venus_geom.h against msm_media_info.h and time the two.
+ *
+ * Build: g++ -std=c++17 -O2 -o venus_check venus_check.cpp
+ * Usage: venus_check [-m max] [-s step] [-c | -b] [-n calls]
+ *
+ * Every VENUS_* helper is compared for every format, plus values past
+ * the last one, and every width or height from 0 to max (8192 by
+ * default).  VENUS_BUFFER_SIZE and VENUS_BUFFER_SIZE_USED are compared
+ * over the width x height grid, every step-th value (1: all of them),
+ * through buffer_size() and the full geometry.  The first mismatches
+ * are printed and the exit status is 1.
+ *
+ * The benchmark replays random format/resolution requests the way an
+ * allocator makes them: the buffer size alone, and all the plane
+ * strides and scanlines plus the size.  The calls requests (16384 by
+ * default) are replayed 32 times and the best pass is reported.
+ * -c only checks, -b only times.
+ *
+ * Example:
+ *   venus_check -s 3
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "venus_geom.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+typedef unsigned int (*c_fn)(unsigned int, unsigned int);
+typedef uint32_t (*geom_fn)(const venus::layout &, uint32_t);
+
+static const struct {
+	const char *name;
+	c_fn c;
+	geom_fn g;
+} helpers[] = {
+	{ "VENUS_Y_STRIDE", VENUS_Y_STRIDE, venus::y_stride },
+	{ "VENUS_UV_STRIDE", VENUS_UV_STRIDE, venus::uv_stride },
+	{ "VENUS_Y_SCANLINES", VENUS_Y_SCANLINES, venus::y_scanlines },
+	{ "VENUS_UV_SCANLINES", VENUS_UV_SCANLINES, venus::uv_scanlines },
+	{ "VENUS_Y_META_STRIDE", VENUS_Y_META_STRIDE, venus::y_meta_stride },
+	{ "VENUS_Y_META_SCANLINES", VENUS_Y_META_SCANLINES, venus::y_meta_scanlines },
+	{ "VENUS_UV_META_STRIDE", VENUS_UV_META_STRIDE, venus::uv_meta_stride },
+	{ "VENUS_UV_META_SCANLINES", VENUS_UV_META_SCANLINES, venus::uv_meta_scanlines },
+	{ "VENUS_RGB_STRIDE", VENUS_RGB_STRIDE, venus::rgb_stride },
+	{ "VENUS_RGB_SCANLINES", VENUS_RGB_SCANLINES, venus::rgb_scanlines },
+	{ "VENUS_RGB_META_STRIDE", VENUS_RGB_META_STRIDE, venus::rgb_meta_stride },
+	{ "VENUS_RGB_META_SCANLINES", VENUS_RGB_META_SCANLINES, venus::rgb_meta_scanlines },
+};
+
+/* Values of VENUS_BUFFER_SIZE; the point is that these are constants */
+static_assert(venus::buffer_size(COLOR_FMT_NV12_UBWC, 1920, 1080) == 3219456, "");
+static_assert(venus::geom(COLOR_FMT_P010_UBWC, 3840, 2160).size == 25051136, "");
+
+static int check(uint32_t max, uint32_t step)
+{
+	uint64_t n = 0, bad = 0;
+	double t0 = now_us();
+
+	auto fail = [&](const char *what, unsigned int f, uint32_t w, uint32_t h,
+			uint32_t want, uint32_t got) {
+		if (bad++ < 10)
+			fprintf(stderr, "%s(%u, %u, %u): header %u, venus_geom %u\n", what, f, w,
+				h, want, got);
+	};
+
+	for (unsigned int f = 0; f < VENUS_NR_FMTS + 3; f++) {
+		const venus::layout &l = venus::lookup(f);
+
+		for (const auto &hp : helpers)
+			for (uint32_t x = 0; x <= max; x++, n++)
+				if (hp.c(f, x) != hp.g(l, x))
+					fail(hp.name, f, x, 0, hp.c(f, x), hp.g(l, x));
+	}
+
+	for (unsigned int f = 0; f < VENUS_NR_FMTS + 1; f++) {
+		for (uint32_t w = 0; w <= max; w += w < 2 ? 1 : step) {
+			for (uint32_t h = 0; h <= max; h += h < 2 ? 1 : step) {
+				uint32_t want = VENUS_BUFFER_SIZE(f, w, h);
+
+				n += 5;
+				/*
+				 * geom() has no planes for an empty buffer, and its
+				 * scanlines are per field, but strides are the header's
+				 */
+				if (w && h) {
+					n++;
+					if (VENUS_UV_STRIDE(f, w) != venus::geom(f, w, h).uv_stride)
+						fail("geom.uv_stride", f, w, h, VENUS_UV_STRIDE(f, w),
+						     venus::geom(f, w, h).uv_stride);
+				}
+				if (want != venus::buffer_size(f, w, h))
+					fail("VENUS_BUFFER_SIZE", f, w, h, want,
+					     venus::buffer_size(f, w, h));
+				if (want != venus::geom(f, w, h).size)
+					fail("geom", f, w, h, want, venus::geom(f, w, h).size);
+				for (int il = 0; il < 2; il++) {
+					want = VENUS_BUFFER_SIZE_USED(f, w, h, il);
+					if (want != venus::buffer_size_used(f, w, h, il))
+						fail("VENUS_BUFFER_SIZE_USED", f, w, h, want,
+						     venus::buffer_size_used(f, w, h, il));
+				}
+			}
+		}
+	}
+	printf("%lu comparisons, %lu mismatches (%.1f s)\n", (unsigned long)n,
+	       (unsigned long)bad, (now_us() - t0) / 1e6);
+	return bad ? -EDOM : 0;
+}
+
+struct request {
+	unsigned int fmt;
+	uint32_t w, h;
+};
+
+/* Keep the compiler from dropping or hoisting the loops */
+static void sink(uint64_t v)
+{
+	static volatile uint64_t s;
+
+	s += v;
+}
+
+#define BENCH_PASSES	32
+
+/* Best pass over @rq: the requests stay cached, as an allocator's would */
+template <typename F>
+static double run(const std::vector<request> &rq, F fn)
+{
+	double best = 0;
+
+	for (int pass = 0; pass < BENCH_PASSES; pass++) {
+		double t0 = now_us(), t;
+		uint64_t acc = 0;
+
+		for (const request &r : rq)
+			acc += fn(r);
+		sink(acc);
+		t = (now_us() - t0) * 1e3 / rq.size();
+		if (!pass || t < best)
+			best = t;
+	}
+	return best;
+}
+
+static void bench(size_t calls)
+{
+	static const unsigned int fmts[] = {
+		COLOR_FMT_NV12, COLOR_FMT_NV12_UBWC, COLOR_FMT_NV12_BPP10_UBWC,
+		COLOR_FMT_P010_UBWC, COLOR_FMT_P010, COLOR_FMT_RGBA8888_UBWC, COLOR_FMT_NV12_512,
+	};
+	std::vector<request> rq(calls);
+	uint64_t x = 0x2545f4914f6cdd1dull;
+
+	for (request &r : rq) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		r.fmt = fmts[x % (sizeof(fmts) / sizeof(fmts[0]))];
+		r.w = 16 + (uint32_t)(x >> 16 & 0xfff) * 2;
+		r.h = 16 + (uint32_t)(x >> 32 & 0xfff) * 2;
+	}
+
+	printf("%-28s %8s %8s\n", "ns per request", "header", "geom");
+	printf("%-28s %8.2f %8.2f\n", "buffer size",
+	       run(rq, [](const request &r) { return VENUS_BUFFER_SIZE(r.fmt, r.w, r.h); }),
+	       run(rq, [](const request &r) { return venus::buffer_size(r.fmt, r.w, r.h); }));
+	printf("%-28s %8.2f %8.2f\n", "strides, scanlines, size",
+	       run(rq, [](const request &r) {
+			return VENUS_Y_STRIDE(r.fmt, r.w) + VENUS_UV_STRIDE(r.fmt, r.w) +
+			       VENUS_Y_SCANLINES(r.fmt, r.h) + VENUS_UV_SCANLINES(r.fmt, r.h) +
+			       VENUS_Y_META_STRIDE(r.fmt, r.w) +
+			       VENUS_Y_META_SCANLINES(r.fmt, r.h) +
+			       VENUS_BUFFER_SIZE(r.fmt, r.w, r.h);
+	       }),
+	       run(rq, [](const request &r) {
+			venus::geometry g = venus::geom(r.fmt, r.w, r.h);
+
+			return g.y_stride + g.uv_stride + g.y_scanlines + g.uv_scanlines +
+			       g.y_meta_stride + g.y_meta_scanlines + g.size;
+	       }));
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t max = 8192, step = 1;
+	bool do_check = true, do_bench = true;
+	size_t calls = 1 << 14;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:s:cbn:")) != -1) {
+		switch (opt) {
+		case 'm':
+			max = (uint32_t)atoi(optarg);
+			break;
+		case 's':
+			step = (uint32_t)atoi(optarg);
+			break;
+		case 'c':
+			do_bench = false;
+			break;
+		case 'b':
+			do_check = false;
+			break;
+		case 'n':
+			calls = (size_t)atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-m max] [-s step] [-c | -b] [-n calls]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!step || !calls || optind != argc) {
+		fprintf(stderr, "usage: %s [-m max] [-s step] [-c | -b] [-n calls]\n", argv[0]);
+		return 1;
+	}
+
+	if (do_check && check(max, step))
+		return 1;
+	if (do_bench)
+		bench(calls);
+	return 0;
+}
@@ -0,0 +1,421 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Venus buffer geometry without the per-call format switch.
+ *
+ * msm_media_info.h answers each VENUS_* question with its own switch over
+ * color_fmts.  Every format is really a handful of numbers: how the
+ * width becomes a stride (an optional pre-alignment, a byte multiplier
+ * and divisor, the stride alignment), the scanline alignments, the UBWC
+ * metadata tile, and whether NV12 UBWC is split into two fields at
+ * interlace-capable sizes.  Those live in one table row per format, so:
+ *
+ *  - venus::geom() and buffer_size() are constexpr, and fold to
+ *    constants when the format and resolution are known;
+ *  - with the format a runtime value, geom() evaluates the row with
+ *    masks instead of a switch, and buffer_size() makes one indirect
+ *    call into code specialised for that format's row, skipping the
+ *    plane bookkeeping.
+ *
+ * The only divisors that are not powers of two are 3 times one (192,
+ * 48 and 24) or 3 itself (the 4/3 of TP10), and are done by reciprocal.
+ *
+ * Results match the C header bit for bit, including the zeros it returns
+ * for the wrong kind of format and its unsigned wrap-around; venus_check
+ * compares the two over every format and size up to 8K.
+ */
+
+#ifndef __TOOLS_MEDIA_VENUS_GEOM_H__
+#define __TOOLS_MEDIA_VENUS_GEOM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <utility>
+
+#include "../../kernel-headers/vidc/media/msm_media_info.h"
+
+namespace venus {
+
+#define VENUS_NR_FMTS		(COLOR_FMT_NV12_512 + 1)
+
+enum layout_kind : uint8_t {
+	KIND_NONE,
+	KIND_YUV,		/* linear Y + interleaved UV */
+	KIND_YUV_UBWC,		/* Y meta, Y, UV meta, UV; each 4K aligned */
+	KIND_RGB,
+	KIND_RGB_UBWC,		/* meta, RGB */
+};
+
+/* x / d for d = 2^shift or 3 * 2^shift */
+struct divisor {
+	uint32_t d;
+	uint8_t shift;
+	bool by3;
+};
+
+constexpr divisor make_div(uint32_t d)
+{
+	divisor v = { d, 0, d % 3 == 0 };
+
+	for (uint32_t m = v.by3 ? d / 3 : d; m > 1; m >>= 1)
+		v.shift++;
+	return v;
+}
+
+constexpr uint32_t div(uint32_t x, divisor v)
+{
+	uint32_t q = x >> v.shift;
+	uint32_t q3 = (uint32_t)((uint64_t)q * 0xaaaaaaabull >> 33);
+
+	return v.by3 ? q3 : q;
+}
+
+/* MSM_MEDIA_ALIGN and MSM_MEDIA_ROUNDUP, same wrap-around */
+constexpr uint32_t align(uint32_t x, divisor v)
+{
+	return div(x + v.d - 1, v) * v.d;
+}
+
+constexpr uint32_t roundup(uint32_t x, divisor v)
+{
+	return div(x + v.d - 1, v);
+}
+
+/* The power of two cases, which are most of them */
+constexpr uint32_t align2(uint32_t x, uint32_t a)
+{
+	return (x + a - 1) & ~(a - 1);
+}
+
+constexpr uint32_t roundup2(uint32_t x, uint8_t shift)
+{
+	return (x + (1u << shift) - 1) >> shift;
+}
+
+constexpr uint32_t mask(bool on)
+{
+	return 0u - (uint32_t)on;
+}
+
+struct layout {
+	layout_kind kind;
+	bool fields;			/* NV12 UBWC: two fields up to 1920x1920 */
+	uint8_t y_tile_h, uv_tile_h;	/* metadata tile height, log2 */
+	divisor pre;			/* width pre-alignment */
+	uint32_t mul;			/* bytes per sample, times den */
+	divisor den;
+	uint32_t stride;		/* alignments, powers of two */
+	uint32_t y_scan, uv_scan;
+	divisor y_tile_w, uv_tile_w;	/* metadata tile; RGB uses the Y one */
+	uint32_t yuv_m, rgb_m;		/* all ones for the kind, else 0 */
+	uint32_t meta_m, uv_meta_m;	/* UBWC metadata planes */
+	uint32_t page_m;		/* 4095 when data planes are page aligned */
+};
+
+constexpr layout make_layout(unsigned int fmt)
+{
+	layout l = { KIND_NONE, false, 0, 0, make_div(1), 1, make_div(1), 1, 1, 1,
+		     make_div(1), make_div(1), 0, 0, 0, 0, 0 };
+
+	switch (fmt) {
+	case COLOR_FMT_NV12:
+	case COLOR_FMT_NV21:
+	case COLOR_FMT_NV12_512:
+		l.kind = KIND_YUV;
+		l.stride = 512;
+		l.y_scan = 512;
+		l.uv_scan = 256;
+		break;
+	case COLOR_FMT_NV12_128:
+		l.kind = KIND_YUV;
+		l.stride = 128;
+		l.y_scan = 32;
+		l.uv_scan = 16;
+		break;
+	case COLOR_FMT_P010:
+		l.kind = KIND_YUV;
+		l.mul = 2;
+		l.stride = 256;
+		l.y_scan = 32;
+		l.uv_scan = 16;
+		break;
+	case COLOR_FMT_NV12_UBWC:
+		l.kind = KIND_YUV_UBWC;
+		l.stride = 128;
+		l.y_scan = 32;
+		l.uv_scan = 32;
+		l.y_tile_w = make_div(32);
+		l.y_tile_h = 3;
+		l.uv_tile_w = make_div(16);
+		l.uv_tile_h = 3;
+		l.fields = true;
+		break;
+	case COLOR_FMT_NV12_BPP10_UBWC:
+		l.kind = KIND_YUV_UBWC;
+		l.pre = make_div(192);
+		l.mul = 4;
+		l.den = make_div(3);
+		l.stride = 256;
+		l.y_scan = 16;
+		l.uv_scan = 16;
+		l.y_tile_w = make_div(48);
+		l.y_tile_h = 2;
+		l.uv_tile_w = make_div(24);
+		l.uv_tile_h = 2;
+		break;
+	case COLOR_FMT_P010_UBWC:
+		l.kind = KIND_YUV_UBWC;
+		l.mul = 2;
+		l.stride = 256;
+		l.y_scan = 16;
+		l.uv_scan = 16;
+		l.y_tile_w = make_div(32);
+		l.y_tile_h = 2;
+		l.uv_tile_w = make_div(16);
+		l.uv_tile_h = 2;
+		break;
+	case COLOR_FMT_RGBA8888:
+		l.kind = KIND_RGB;
+		l.mul = 4;
+		l.stride = 128;
+		l.y_scan = 32;
+		break;
+	case COLOR_FMT_RGBA8888_UBWC:
+	case COLOR_FMT_RGBA1010102_UBWC:
+	case COLOR_FMT_RGB565_UBWC:
+		l.kind = KIND_RGB_UBWC;
+		l.mul = fmt == COLOR_FMT_RGB565_UBWC ? 2 : 4;
+		l.stride = 256;
+		l.y_scan = 16;
+		l.y_tile_w = make_div(16);
+		l.y_tile_h = 2;
+		break;
+	}
+	l.yuv_m = l.kind == KIND_YUV || l.kind == KIND_YUV_UBWC ? ~0u : 0;
+	l.rgb_m = l.kind == KIND_RGB || l.kind == KIND_RGB_UBWC ? ~0u : 0;
+	l.meta_m = l.kind == KIND_YUV_UBWC || l.kind == KIND_RGB_UBWC ? ~0u : 0;
+	l.uv_meta_m = l.kind == KIND_YUV_UBWC ? ~0u : 0;
+	l.page_m = l.kind != KIND_YUV ? 4095 : 0;
+	return l;
+}
+
+/* One row per format and a last, empty one for anything out of range */
+constexpr std::array<layout, VENUS_NR_FMTS + 1> make_layouts()
+{
+	std::array<layout, VENUS_NR_FMTS + 1> t = {};
+
+	for (unsigned int f = 0; f <= VENUS_NR_FMTS; f++)
+		t[f] = make_layout(f);
+	return t;
+}
+
+constexpr std::array<layout, VENUS_NR_FMTS + 1> layouts = make_layouts();
+
+constexpr const layout &lookup(unsigned int fmt)
+{
+	return layouts[fmt < VENUS_NR_FMTS ? fmt : VENUS_NR_FMTS];
+}
+
+struct plane {
+	uint32_t offset, size;
+};
+
+/*
+ * Everything VENUS_BUFFER_SIZE works out, for one width and height.
+ * Planes are in buffer order; for RGB, y_meta and y are the RGB meta and
+ * data planes.  With two fields the four planes repeat for the bottom
+ * field at offset size / 2.
+ */
+struct geometry {
+	uint32_t y_stride, uv_stride, y_scanlines, uv_scanlines;
+	uint32_t y_meta_stride, y_meta_scanlines, uv_meta_stride, uv_meta_scanlines;
+	uint32_t rgb_stride, rgb_scanlines, rgb_meta_stride, rgb_meta_scanlines;
+	plane y_meta, y, uv_meta, uv;
+	uint32_t fields;
+	uint32_t size;
+};
+
+/* The per-dimension helpers, each as its VENUS_* namesake */
+constexpr uint32_t stride(const layout &l, uint32_t w)
+{
+	return align2(div(align(w, l.pre) * l.mul, l.den), l.stride);
+}
+
+constexpr uint32_t y_stride(const layout &l, uint32_t w)
+{
+	return stride(l, w) & l.yuv_m & mask(w);
+}
+
+/* Interleaved UV: half the samples of twice the size, so Y's stride */
+constexpr uint32_t uv_stride(const layout &l, uint32_t w)
+{
+	return stride(l, w) & l.yuv_m & mask(w);
+}
+
+constexpr uint32_t y_scanlines(const layout &l, uint32_t h)
+{
+	return align2(h, l.y_scan) & l.yuv_m & mask(h);
+}
+
+constexpr uint32_t uv_scanlines(const layout &l, uint32_t h)
+{
+	return align2((h + 1) >> 1, l.uv_scan) & l.yuv_m & mask(h);
+}
+
+constexpr uint32_t y_meta_stride(const layout &l, uint32_t w)
+{
+	return align2(roundup(w, l.y_tile_w), 64) & l.uv_meta_m & mask(w);
+}
+
+constexpr uint32_t y_meta_scanlines(const layout &l, uint32_t h)
+{
+	return align2(roundup2(h, l.y_tile_h), 16) & l.uv_meta_m & mask(h);
+}
+
+constexpr uint32_t uv_meta_stride(const layout &l, uint32_t w)
+{
+	return align2(roundup((w + 1) >> 1, l.uv_tile_w), 64) & l.uv_meta_m & mask(w);
+}
+
+constexpr uint32_t uv_meta_scanlines(const layout &l, uint32_t h)
+{
+	return align2(roundup2((h + 1) >> 1, l.uv_tile_h), 16) & l.uv_meta_m & mask(h);
+}
+
+constexpr uint32_t rgb_stride(const layout &l, uint32_t w)
+{
+	return stride(l, w) & l.rgb_m & mask(w);
+}
+
+constexpr uint32_t rgb_scanlines(const layout &l, uint32_t h)
+{
+	return align2(h, l.y_scan) & l.rgb_m & mask(h);
+}
+
+constexpr uint32_t rgb_meta_stride(const layout &l, uint32_t w)
+{
+	return align2(roundup(w, l.y_tile_w), 64) & l.meta_m & l.rgb_m & mask(w);
+}
+
+constexpr uint32_t rgb_meta_scanlines(const layout &l, uint32_t h)
+{
+	return align2(roundup2(h, l.y_tile_h), 16) & l.meta_m & l.rgb_m & mask(h);
+}
+
+/*
+ * VENUS_BUFFER_SIZE, and VENUS_BUFFER_SIZE_USED when @used: a
+ * progressive NV12 UBWC buffer is then never split into fields.  Y and
+ * RGB share the stride, scanline and meta tile arithmetic; the kind
+ * masks only pick where the results land.  An empty buffer is all zero.
+ */
+constexpr geometry compute(const layout &l, uint32_t w, uint32_t h, bool used = false,
+			   bool interlace = false)
+{
+	bool split = l.fields && (!used || interlace) && w <= INTERLACE_WIDTH_MAX &&
+		     h <= INTERLACE_HEIGHT_MAX && (h * w) / 256 <= INTERLACE_MB_PER_FRAME_MAX;
+	uint32_t fh = split ? (h + 1) >> 1 : h, m = mask(w && h);
+	uint32_t yuv = l.yuv_m & m, rgb = l.rgb_m & m, meta = l.meta_m & m;
+	uint32_t uv_meta = l.uv_meta_m & m, pm = l.page_m;
+	uint32_t s = stride(l, w), ys = align2(fh, l.y_scan);
+	uint32_t uvs = align2((fh + 1) >> 1, l.uv_scan);
+	uint32_t ms = align2(roundup(w, l.y_tile_w), 64), mss = align2(roundup2(fh, l.y_tile_h), 16);
+	uint32_t ums = align2(roundup((w + 1) >> 1, l.uv_tile_w), 64);
+	uint32_t umss = align2(roundup2((fh + 1) >> 1, l.uv_tile_h), 16);
+	geometry g = {};
+
+	g.y_stride = g.uv_stride = s & yuv;
+	g.y_scanlines = ys & yuv;
+	g.uv_scanlines = uvs & yuv;
+	g.y_meta_stride = ms & meta & yuv;
+	g.y_meta_scanlines = mss & meta & yuv;
+	g.uv_meta_stride = ums & uv_meta;
+	g.uv_meta_scanlines = umss & uv_meta;
+	g.rgb_stride = s & rgb;
+	g.rgb_scanlines = ys & rgb;
+	g.rgb_meta_stride = ms & meta & rgb;
+	g.rgb_meta_scanlines = mss & meta & rgb;
+
+	/* Linear YUV planes are packed; every other plane is page aligned */
+	g.y_meta.size = ((ms * mss + 4095) & ~4095u) & meta;
+	g.y.size = ((s * ys + pm) & ~pm) & (yuv | rgb);
+	g.uv_meta.size = ((ums * umss + 4095) & ~4095u) & uv_meta;
+	g.uv.size = ((s * uvs + pm) & ~pm) & yuv;
+	g.y.offset = g.y_meta.size;
+	g.uv_meta.offset = g.y.offset + g.y.size;
+	g.uv.offset = g.uv_meta.offset + g.uv_meta.size;
+	g.fields = split ? 2 : 1;
+	g.size = align2((g.uv.offset + g.uv.size) * g.fields, 4096);
+	return g;
+}
+
+/* compute(...).size without the per-plane bookkeeping */
+constexpr uint32_t size_of(const layout &l, uint32_t w, uint32_t h, bool used = false,
+			   bool interlace = false)
+{
+	bool split = l.fields && (!used || interlace) && w <= INTERLACE_WIDTH_MAX &&
+		     h <= INTERLACE_HEIGHT_MAX && (h * w) / 256 <= INTERLACE_MB_PER_FRAME_MAX;
+	uint32_t fh = split ? (h + 1) >> 1 : h, pm = l.page_m;
+	uint32_t s = stride(l, w), ys = align2(fh, l.y_scan);
+	uint32_t uvs = align2((fh + 1) >> 1, l.uv_scan) & l.yuv_m;
+	uint32_t bytes = ((s * ys + pm) & ~pm) + ((s * uvs + pm) & ~pm);
+
+	if (l.meta_m) {
+		uint32_t ms = align2(roundup(w, l.y_tile_w), 64);
+		uint32_t mss = align2(roundup2(fh, l.y_tile_h), 16);
+		uint32_t ums = align2(roundup((w + 1) >> 1, l.uv_tile_w), 64);
+		uint32_t umss = align2(roundup2((fh + 1) >> 1, l.uv_tile_h), 16);
+
+		bytes += ((ms * mss + 4095) & ~4095u) +
+			 (((ums * umss + 4095) & ~4095u) & l.uv_meta_m);
+	}
+	bytes &= (l.yuv_m | l.rgb_m) & mask(w && h);
+	return align2(bytes << split, 4096);
+}
+
+/*
+ * geom() computes the layout row it is given; buffer_size() goes through
+ * one instance per format, whose row is a constant.  The call target is
+ * then the only thing that depends on the format, where the C header
+ * takes a switch in every helper.  Everything is constexpr, so with the
+ * format and resolution known the result is a constant.
+ */
+template <size_t F>
+constexpr uint32_t size_at(uint32_t w, uint32_t h, bool used, bool interlace)
+{
+	constexpr layout l = layouts[F];
+
+	return size_of(l, w, h, used, interlace);
+}
+
+typedef uint32_t (*size_fn)(uint32_t w, uint32_t h, bool used, bool interlace);
+
+template <size_t... F>
+constexpr std::array<size_fn, sizeof...(F)> make_size_fns(std::index_sequence<F...>)
+{
+	return { { size_at<F>... } };
+}
+
+/* The last entry answers for out-of-range formats, as lookup() does */
+constexpr std::array<size_fn, VENUS_NR_FMTS + 1> size_fns =
+	make_size_fns(std::make_index_sequence<VENUS_NR_FMTS + 1>());
+
+constexpr geometry geom(unsigned int fmt, uint32_t w, uint32_t h, bool used = false,
+			bool interlace = false)
+{
+	return compute(lookup(fmt), w, h, used, interlace);
+}
+
+constexpr uint32_t buffer_size(unsigned int fmt, uint32_t w, uint32_t h)
+{
+	return size_fns[fmt < VENUS_NR_FMTS ? fmt : VENUS_NR_FMTS](w, h, false, false);
+}
+
+constexpr uint32_t buffer_size_used(unsigned int fmt, uint32_t w, uint32_t h, bool interlace)
+{
+	return size_fns[fmt < VENUS_NR_FMTS ? fmt : VENUS_NR_FMTS](w, h, true, interlace);
+}
+
+} /* namespace venus */
+
+#endif /* __TOOLS_MEDIA_VENUS_GEOM_H__ */
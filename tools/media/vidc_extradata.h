@@ -0,0 +1,416 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Zero-copy reader for msm_vidc extradata regions.
+ *
+ * The firmware writes a run of msm_vidc_extradata_header records, each
+ * @size bytes including the header and a multiple of four, its payload
+ * of @data_size bytes at @data.  The run ends at a record of type
+ * MSM_VIDC_EXTRADATA_NONE, at a zero size, or at the end of the region.
+ * Fewer bytes than a header before the end must be zero padding; if not,
+ * a record was cut off.
+ *
+ * vidc::extradata walks a region in place: iterating yields records that
+ * point into it, and record::as<TYPE>() returns the payload struct that
+ * msm_vidc_utils.h defines for TYPE, or NULL if the payload is shorter
+ * than that struct.  A record is only handed out once its header and
+ * payload are inside the region, and the region must be 4-byte aligned,
+ * so the structs can be read through the pointers directly.  Payloads
+ * with a count or size inside them (HDR10+, ROI QP, pan-scan, user data)
+ * have views that check it against the payload length first.
+ *
+ * A record that does not fit ends the walk and leaves the reason in
+ * extradata::error().  walk() dispatches each record to a visitor's
+ * member named after its type.
+ *
+ * Errors are negative errno values.
+ */
+
+#ifndef __TOOLS_MEDIA_VIDC_EXTRADATA_H__
+#define __TOOLS_MEDIA_VIDC_EXTRADATA_H__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The tree's v4l2-controls.h first: msm_vidc_utils.h extends that one, not the host's */
+#include "../../kernel-headers/linux/v4l2-controls.h"
+#include "../../kernel-headers/vidc/media/msm_vidc_utils.h"
+
+namespace vidc {
+
+/* Header bytes ahead of the payload */
+#define XD_HEADER_SIZE		offsetof(struct msm_vidc_extradata_header, data)
+
+/* The payload struct each type carries */
+template <uint32_t TYPE> struct payload;
+
+#define XD_PAYLOAD(t, st)						\
+	template <> struct payload<MSM_VIDC_EXTRADATA_##t> { typedef struct st type; }
+
+XD_PAYLOAD(INTERLACE_VIDEO, msm_vidc_interlace_payload);
+XD_PAYLOAD(FRAME_RATE, msm_vidc_framerate_payload);
+XD_PAYLOAD(TIMESTAMP, msm_vidc_ts_payload);
+XD_PAYLOAD(NUM_CONCEALED_MB, msm_vidc_concealmb_payload);
+XD_PAYLOAD(RECOVERY_POINT_SEI, msm_vidc_recoverysei_payload);
+XD_PAYLOAD(ASPECT_RATIO, msm_vidc_aspect_ratio_payload);
+XD_PAYLOAD(INPUT_CROP, msm_vidc_input_crop_payload);
+XD_PAYLOAD(OUTPUT_CROP, msm_vidc_output_crop_payload);
+XD_PAYLOAD(INDEX, msm_vidc_extradata_index);
+XD_PAYLOAD(FRAME_QP, msm_vidc_frame_qp_payload);
+XD_PAYLOAD(FRAME_BITS_INFO, msm_vidc_frame_bits_info_payload);
+XD_PAYLOAD(S3D_FRAME_PACKING, msm_vidc_s3d_frame_packing_payload);
+XD_PAYLOAD(MASTERING_DISPLAY_COLOUR_SEI, msm_vidc_mastering_display_colour_sei_payload);
+XD_PAYLOAD(CONTENT_LIGHT_LEVEL_SEI, msm_vidc_content_light_level_sei_payload);
+XD_PAYLOAD(CVP_METADATA, msm_vidc_enc_cvp_metadata_payload);
+XD_PAYLOAD(VUI_DISPLAY_INFO, msm_vidc_vui_display_info_payload);
+XD_PAYLOAD(HDR_HIST, msm_vidc_extradata_hdr_hist_payload);
+XD_PAYLOAD(MPEG2_SEQDISP, msm_vidc_mpeg2_seqdisp_payload);
+XD_PAYLOAD(VPX_COLORSPACE_INFO, msm_vidc_vpx_colorspace_payload);
+XD_PAYLOAD(METADATA_LTRINFO, msm_vidc_metadata_ltr_payload);
+
+#undef XD_PAYLOAD
+
+/* Bytes inside a payload */
+struct bytes {
+	const uint8_t *data = nullptr;
+	uint32_t len = 0;
+};
+
+/* One record, pointing into the region */
+struct record {
+	uint32_t type = MSM_VIDC_EXTRADATA_NONE;
+	uint32_t version = 0;
+	uint32_t port_index = 0;
+	const uint8_t *data = nullptr;
+	uint32_t len = 0;
+
+	template <uint32_t TYPE>
+	const typename payload<TYPE>::type *as() const
+	{
+		typedef typename payload<TYPE>::type T;
+
+		if (type != TYPE || len < sizeof(T))
+			return nullptr;
+		return reinterpret_cast<const T *>(data);
+	}
+
+	/* The word at @off, or 0 past the payload */
+	uint32_t u32(uint32_t off) const
+	{
+		return off + 4 <= len ? *reinterpret_cast<const uint32_t *>(data + off) : 0;
+	}
+};
+
+/* HDR10+ SEI bytes, as many as the payload's size field says */
+inline int hdr10plus(const record &r, bytes *out)
+{
+	uint32_t size = r.u32(0);
+
+	if (r.type != MSM_VIDC_EXTRADATA_HDR10PLUS_METADATA || r.len < 4)
+		return -EINVAL;
+	if (size > r.len - 4)
+		return -EBADMSG;
+	*out = { r.data + 4, size };
+	return 0;
+}
+
+/*
+ * ROI QP: the fixed fields and the per-block QP map that follows them.
+ * Encoder input ROI carries the QP offsets ahead of the map; decoder
+ * output has the short msm_vidc_roi_deltaqp_payload form, told apart by
+ * whether mbi_info_size fits the payload at the long offset.
+ */
+struct roi_view {
+	int32_t upper_qp_offset, lower_qp_offset;
+	bool enabled;
+	bytes map;
+};
+
+inline int roi_qp(const record &r, roi_view *out)
+{
+	const size_t lng = offsetof(struct msm_vidc_roi_qp_payload, data);
+	const size_t shrt = offsetof(struct msm_vidc_roi_deltaqp_payload, data);
+
+	if (r.type != MSM_VIDC_EXTRADATA_ROI_QP || r.len < shrt)
+		return -EINVAL;
+	if (r.len >= lng && r.u32(12) <= r.len - lng) {
+		const msm_vidc_roi_qp_payload *p =
+			reinterpret_cast<const msm_vidc_roi_qp_payload *>(r.data);
+
+		*out = { p->upper_qp_offset, p->lower_qp_offset, !!p->b_roi_info,
+			 { r.data + lng, p->mbi_info_size } };
+		return 0;
+	}
+	if (r.u32(4) > r.len - shrt)
+		return -EBADMSG;
+	*out = { 0, 0, !!r.u32(0), { r.data + shrt, r.u32(4) } };
+	return 0;
+}
+
+/* Pan-scan windows, as many as fit and are announced */
+inline int panscan(const record &r, const msm_vidc_panscan_window **wnd, uint32_t *n)
+{
+	const size_t hdr = offsetof(struct msm_vidc_panscan_window_payload, wnd);
+
+	if (r.type != MSM_VIDC_EXTRADATA_PANSCAN_WINDOW || r.len < hdr)
+		return -EINVAL;
+	*n = r.u32(0);
+	if (*n > (r.len - hdr) / sizeof(**wnd))
+		return -EBADMSG;
+	*wnd = reinterpret_cast<const msm_vidc_panscan_window *>(r.data + hdr);
+	return 0;
+}
+
+/* Stream user data: its MSM_VIDC_USERDATA_TYPE_* and the bytes after it */
+inline int userdata(const record &r, uint32_t *kind, bytes *out)
+{
+	if (r.type != MSM_VIDC_EXTRADATA_STREAM_USERDATA || r.len < 4)
+		return -EINVAL;
+	*kind = r.u32(0);
+	*out = { r.data + 4, r.len - 4 };
+	return 0;
+}
+
+/*
+ * Non-owning view of one extradata region.  Iteration stops at the first
+ * record that does not fit; error() then says why.
+ */
+class extradata {
+public:
+	extradata() = default;
+
+	int init(const void *base, size_t size)
+	{
+		if (reinterpret_cast<uintptr_t>(base) & 3)
+			return -EINVAL;
+		base_ = static_cast<const uint8_t *>(base);
+		size_ = size;
+		err_ = 0;
+		return 0;
+	}
+
+	class iterator {
+	public:
+		const record &operator*() const { return rec_; }
+		const record *operator->() const { return &rec_; }
+		bool operator!=(const iterator &o) const { return off_ != o.off_; }
+
+		iterator &operator++()
+		{
+			off_ += next_;
+			load();
+			return *this;
+		}
+
+	private:
+		friend class extradata;
+
+		iterator(const extradata *x, size_t off) : x_(x), off_(off) { load(); }
+
+		/* Decode the header at off_, or move to the end */
+		void load()
+		{
+			const size_t left = x_->size_ - off_;
+			const msm_vidc_extradata_header *h;
+			int err = 0;
+
+			if (off_ == x_->size_)
+				return;
+			h = reinterpret_cast<const msm_vidc_extradata_header *>(x_->base_ + off_);
+			if (left < XD_HEADER_SIZE) {
+				/* Zero padding ends the run; anything else is a cut header */
+				for (size_t i = 0; i < left; i++)
+					if (x_->base_[off_ + i])
+						x_->err_ = -EMSGSIZE;
+				goto end;
+			}
+			if (!h->size || h->type == MSM_VIDC_EXTRADATA_NONE)
+				goto end;
+			if (h->size < XD_HEADER_SIZE || (h->size & 3))
+				err = -EBADMSG;
+			else if (h->size > left || h->data_size > h->size - XD_HEADER_SIZE)
+				err = -EMSGSIZE;
+			if (err) {
+				x_->err_ = err;
+				goto end;
+			}
+			rec_.type = h->type;
+			rec_.version = h->version;
+			rec_.port_index = h->port_index;
+			rec_.data = x_->base_ + off_ + XD_HEADER_SIZE;
+			rec_.len = h->data_size;
+			next_ = h->size;
+			x_->used_ = off_ + next_;
+			return;
+		end:
+			off_ = x_->size_;
+		}
+
+		const extradata *x_;
+		size_t off_;
+		uint32_t next_ = 0;
+		record rec_;
+	};
+
+	iterator begin() const
+	{
+		err_ = 0;
+		used_ = 0;
+		return iterator(this, 0);
+	}
+	iterator end() const { return iterator(this, size_); }
+
+	/* 0 if the last walk ended cleanly, else why it stopped */
+	int error() const { return err_; }
+
+	/* Bytes of the records the last walk handed out, headers included */
+	size_t used() const { return used_; }
+
+	/* The first record of @type, or -ENOENT */
+	int find(uint32_t type, record *out) const
+	{
+		for (const record &r : *this) {
+			if (r.type == type) {
+				*out = r;
+				return 0;
+			}
+		}
+		return err_ ? err_ : -ENOENT;
+	}
+
+private:
+	const uint8_t *base_ = nullptr;
+	size_t size_ = 0;
+	mutable int err_ = 0;
+	mutable size_t used_ = 0;
+};
+
+/*
+ * Appends records to a region the way the firmware lays them out, for
+ * tools that make test regions.
+ */
+struct writer {
+	uint8_t *base;
+	size_t size, off = 0;
+
+	/* Space for a @len byte payload of @type, or NULL when full */
+	uint8_t *add(uint32_t type, uint32_t len)
+	{
+		uint32_t rec = (uint32_t)((XD_HEADER_SIZE + len + 3) & ~3u);
+		msm_vidc_extradata_header *h;
+
+		if (rec > size - off)
+			return nullptr;
+		h = reinterpret_cast<msm_vidc_extradata_header *>(base + off);
+		h->size = rec;
+		h->version = 1;
+		h->port_index = 1;
+		h->type = type;
+		h->data_size = len;
+		off += rec;
+		return reinterpret_cast<uint8_t *>(h->data);
+	}
+
+	template <typename T>
+	T *add(uint32_t type)
+	{
+		return reinterpret_cast<T *>(add(type, sizeof(T)));
+	}
+
+	/* The terminating record, when it fits */
+	void finish()
+	{
+		add(MSM_VIDC_EXTRADATA_NONE, 0);
+		memset(base + off, 0, size - off);
+	}
+};
+
+/*
+ * Base for walk() visitors: a member per payload type, each a no-op.  A
+ * visitor derives from it and declares the ones it wants; unknown types
+ * and payloads too short for their struct go to other().
+ */
+struct visitor {
+	void interlace(const msm_vidc_interlace_payload &) {}
+	void frame_rate(const msm_vidc_framerate_payload &) {}
+	void timestamp(const msm_vidc_ts_payload &) {}
+	void concealed_mb(const msm_vidc_concealmb_payload &) {}
+	void recovery_point(const msm_vidc_recoverysei_payload &) {}
+	void aspect_ratio(const msm_vidc_aspect_ratio_payload &) {}
+	void input_crop(const msm_vidc_input_crop_payload &) {}
+	void output_crop(const msm_vidc_output_crop_payload &) {}
+	void frame_qp(const msm_vidc_frame_qp_payload &) {}
+	void frame_bits(const msm_vidc_frame_bits_info_payload &) {}
+	void mastering_display(const msm_vidc_mastering_display_colour_sei_payload &) {}
+	void content_light_level(const msm_vidc_content_light_level_sei_payload &) {}
+	void hdr10plus(const bytes &) {}
+	void roi_qp(const roi_view &) {}
+	void cvp_metadata(const msm_vidc_enc_cvp_metadata_payload &) {}
+	void vui_display(const msm_vidc_vui_display_info_payload &) {}
+	void hdr_hist(const msm_vidc_extradata_hdr_hist_payload &) {}
+	void other(const record &) {}
+};
+
+#define XD_VISIT(TYPE, fn)					\
+	case MSM_VIDC_EXTRADATA_##TYPE:				\
+		if (auto *p = r.as<MSM_VIDC_EXTRADATA_##TYPE>()) {	\
+			v.fn(*p);				\
+			continue;				\
+		}						\
+		break
+
+/*
+ * Hand every record of @x to @v; returns the number of records, or the
+ * error that ended the walk.  Bad counts inside HDR10+ and ROI payloads
+ * send the record to other() rather than failing the region.
+ */
+template <typename V>
+inline int walk(const extradata &x, V &v)
+{
+	int n = 0;
+
+	for (const record &r : x) {
+		bytes b;
+		roi_view roi;
+
+		n++;
+		switch (r.type) {
+		XD_VISIT(INTERLACE_VIDEO, interlace);
+		XD_VISIT(FRAME_RATE, frame_rate);
+		XD_VISIT(TIMESTAMP, timestamp);
+		XD_VISIT(NUM_CONCEALED_MB, concealed_mb);
+		XD_VISIT(RECOVERY_POINT_SEI, recovery_point);
+		XD_VISIT(ASPECT_RATIO, aspect_ratio);
+		XD_VISIT(INPUT_CROP, input_crop);
+		XD_VISIT(OUTPUT_CROP, output_crop);
+		XD_VISIT(FRAME_QP, frame_qp);
+		XD_VISIT(FRAME_BITS_INFO, frame_bits);
+		XD_VISIT(MASTERING_DISPLAY_COLOUR_SEI, mastering_display);
+		XD_VISIT(CONTENT_LIGHT_LEVEL_SEI, content_light_level);
+		XD_VISIT(CVP_METADATA, cvp_metadata);
+		XD_VISIT(VUI_DISPLAY_INFO, vui_display);
+		XD_VISIT(HDR_HIST, hdr_hist);
+		case MSM_VIDC_EXTRADATA_HDR10PLUS_METADATA:
+			if (!vidc::hdr10plus(r, &b)) {
+				v.hdr10plus(b);
+				continue;
+			}
+			break;
+		case MSM_VIDC_EXTRADATA_ROI_QP:
+			if (!vidc::roi_qp(r, &roi)) {
+				v.roi_qp(roi);
+				continue;
+			}
+			break;
+		}
+		v.other(r);
+	}
+	return x.error() ? x.error() : n;
+}
+
+#undef XD_VISIT
+
+} /* namespace vidc */
+
+#endif /* __TOOLS_MEDIA_VIDC_EXTRADATA_H__ */
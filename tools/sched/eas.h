@@ -0,0 +1,587 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Energy-aware placement replay.
+ *
+ * A scheduler trace is first reduced to a workload: one activation per
+ * wakeup-to-sleep interval of every task, carrying the CPU time it used
+ * scaled to capacity 1024 (the work it would take on the biggest CPU at
+ * its top frequency).  The workload is then replayed through a simple
+ * discrete-event model per scenario:
+ *
+ *  - every CPU runs its activations FIFO, progressing at the capacity of
+ *    its domain's current performance state;
+ *  - PELT-style utilisation (32 ms half-life) is kept per task and per CPU
+ *    and the domain frequency follows schedutil, 1.25x the busiest CPU's
+ *    utilisation, clamped by the uclamp values of the tasks queued there;
+ *  - waking tasks are placed by the scenario's policy: as traced, on the
+ *    biggest idle CPU, or by an energy search modelled on
+ *    find_energy_efficient_cpu().
+ *
+ * There is no preemption, load balancing or idle-state cost: the numbers
+ * are for comparing policies against each other, not for absolute power.
+ */
+
+#ifndef __TOOLS_SCHED_EAS_H__
+#define __TOOLS_SCHED_EAS_H__
+
+#include <fnmatch.h>
+#include <math.h>
+
+#include <deque>
+#include <queue>
+#include <string>
+
+#include "em.h"
+#include "sched_trace.h"
+
+namespace sched {
+
+struct activation {
+	uint64_t wake_ns;
+	uint32_t task;
+	int16_t orig_cpu;
+	float work_us;		/* at capacity 1024 */
+};
+
+struct task_info {
+	int32_t pid;
+	std::string comm;
+};
+
+class workload {
+public:
+	int build(const sched_trace &tr, const energy_model &em)
+	{
+		struct pid_state {
+			uint32_t task;
+			bool active, running, ran;
+			int cpu;
+			uint64_t since;
+			double work;
+			activation a;
+		};
+		std::unordered_map<int32_t, pid_state> ps;
+		std::vector<int32_t> on_cpu(em.nr_cpus(), 0);
+		std::vector<uint32_t> cap(em.nr_cpus());
+		const std::vector<sched_event> &ev = tr.events();
+
+		tasks_.clear();
+		acts_.clear();
+		if (ev.empty())
+			return -ENODATA;
+		for (int c = 0; c < em.nr_cpus(); c++)
+			cap[c] = em.cpu(c).cap_orig;
+		start_ns_ = ev.front().ts_ns;
+		end_ns_ = ev.back().ts_ns;
+
+		auto get = [&](int32_t pid) -> pid_state & {
+			auto it = ps.find(pid);
+
+			if (it != ps.end())
+				return it->second;
+			pid_state &s = ps[pid];
+
+			s = pid_state{ (uint32_t)tasks_.size(), false, false, false, 0, 0, 0, {} };
+			tasks_.push_back({ pid, tr.comm(pid) });
+			return s;
+		};
+		auto flush = [&](pid_state &s, uint64_t ts) {
+			if (s.running && ts > s.since)
+				s.work += (ts - s.since) / 1e3 * cap[s.cpu] / SCHED_CAPACITY_SCALE;
+			s.since = ts;
+		};
+		auto begin = [&](pid_state &s, uint64_t ts, int cpu) {
+			s.active = true;
+			s.ran = false;
+			s.work = 0;
+			s.a.wake_ns = ts;
+			s.a.task = s.task;
+			s.a.orig_cpu = (int16_t)cpu;
+		};
+
+		for (const sched_event &e : ev) {
+			if (e.cpu < 0 || e.cpu >= em.nr_cpus())
+				continue;
+			switch (e.type) {
+			case EV_FREQ: {
+				int pd = em.cpu(e.cpu).pd;
+				const perf_state &st = em.pd(pd).ps[em.state_of_khz(pd, e.khz)];
+
+				if (on_cpu[e.cpu])
+					flush(get(on_cpu[e.cpu]), e.ts_ns);
+				cap[e.cpu] = st.cap;
+				break;
+			}
+			case EV_WAKEUP: {
+				pid_state &s = get(e.prev_pid);
+
+				if (e.prev_pid > 0 && !s.active)
+					begin(s, e.ts_ns, e.cpu);
+				break;
+			}
+			case EV_SWITCH:
+				if (e.prev_pid > 0) {
+					pid_state &s = get(e.prev_pid);
+
+					flush(s, e.ts_ns);
+					s.running = false;
+					if (!e.prev_runnable && s.active) {
+						s.a.work_us = (float)s.work;
+						if (s.work > 0)
+							acts_.push_back(s.a);
+						s.active = false;
+					}
+				}
+				on_cpu[e.cpu] = e.next_pid;
+				if (e.next_pid > 0) {
+					pid_state &s = get(e.next_pid);
+
+					if (!s.active)
+						begin(s, e.ts_ns, e.cpu);
+					if (!s.ran)
+						s.a.orig_cpu = e.cpu;
+					s.ran = true;
+					s.running = true;
+					s.cpu = e.cpu;
+					s.since = e.ts_ns;
+				}
+				break;
+			}
+		}
+		/* Activations end in trace order; replay wants wakeup order */
+		std::stable_sort(acts_.begin(), acts_.end(),
+				 [](const activation &a, const activation &b) {
+			return a.wake_ns < b.wake_ns;
+		});
+		return acts_.empty() ? -ENODATA : 0;
+	}
+
+	const std::vector<task_info> &tasks() const { return tasks_; }
+	const std::vector<activation> &acts() const { return acts_; }
+	uint64_t start_ns() const { return start_ns_; }
+	uint64_t end_ns() const { return end_ns_; }
+
+private:
+	std::vector<task_info> tasks_;
+	std::vector<activation> acts_;
+	uint64_t start_ns_ = 0, end_ns_ = 0;
+};
+
+enum place_policy {
+	POL_ORIG,	/* where the trace ran it */
+	POL_PERF,	/* biggest idle CPU, else most spare capacity */
+	POL_EAS,	/* lowest energy among CPUs the task fits */
+};
+
+struct uclamp_rule {
+	std::string comm;	/* fnmatch() pattern */
+	uint16_t min, max;
+};
+
+struct scenario {
+	std::string name;
+	place_policy policy = POL_EAS;
+	std::vector<uclamp_rule> uclamp;
+	uint64_t isolated = 0;
+};
+
+struct pd_result {
+	double energy_mj = 0;
+	std::vector<uint64_t> res_ns;
+	uint64_t transitions = 0;
+};
+
+struct eas_result {
+	std::vector<pd_result> pd;
+	std::vector<uint64_t> busy_ns;
+	std::vector<uint64_t> placed;
+	std::vector<float> response_us;	/* per activation, wakeup to done */
+	uint64_t overutilized = 0;
+	uint64_t span_ns = 0;
+};
+
+class eas_sim {
+public:
+	eas_sim(const energy_model &em, const workload &wl, const scenario &sc)
+		: em_(em), wl_(wl), sc_(sc)
+	{
+	}
+
+	/* -EINVAL if the scenario isolates every CPU: nothing could run */
+	int run(eas_result *r)
+	{
+		const std::vector<activation> &acts = wl_.acts();
+		size_t next = 0;
+
+		int c;
+
+		for (c = 0; c < em_.nr_cpus() && !allowed(c); c++)
+			;
+		if (c == em_.nr_cpus())
+			return -EINVAL;
+		init(r);
+		while (next < acts.size() || !done_.empty()) {
+			uint64_t tw = next < acts.size() ? acts[next].wake_ns : UINT64_MAX;
+
+			while (!done_.empty() && done_.top().gen != cpus_[done_.top().cpu].gen)
+				done_.pop();
+			if (!done_.empty() && done_.top().t <= tw) {
+				done_ev d = done_.top();
+
+				done_.pop();
+				advance(d.t);
+				complete(d.cpu);
+			} else if (next < acts.size()) {
+				advance(tw);
+				wake((uint32_t)next++);
+			}
+		}
+		r->span_ns = now_ - wl_.start_ns();
+		return 0;
+	}
+
+private:
+	struct cpu_rt {
+		std::deque<uint32_t> q;
+		int64_t cur = -1;
+		double remain = 0;	/* us of work at capacity 1024 */
+		uint64_t started = 0;
+		double util = 0;
+		double est = 0;		/* sum of queued tasks' util */
+		uint32_t gen = 0;
+	};
+
+	struct task_rt {
+		double util = 0;
+		uint64_t last = 0;
+		int prev_cpu = -1;
+		uint16_t umin = 0, umax = SCHED_CAPACITY_SCALE;
+	};
+
+	struct done_ev {
+		uint64_t t;
+		int cpu;
+		uint32_t gen;
+
+		bool operator>(const done_ev &o) const { return t > o.t; }
+	};
+
+	/* PELT decay for @dt_ns: y^(dt/1ms) with y^32 = 1/2 */
+	static double decay(uint64_t dt_ns)
+	{
+		return exp2(-(double)dt_ns / 32e6);
+	}
+
+	void init(eas_result *r)
+	{
+		r_ = r;
+		now_ = wl_.start_ns();
+		cpus_.assign(em_.nr_cpus(), cpu_rt());
+		tasks_.assign(wl_.tasks().size(), task_rt());
+		state_.assign(em_.nr_pds(), 0);
+		est_.assign(wl_.acts().size(), 0);
+		done_ = decltype(done_)();
+		r->pd.assign(em_.nr_pds(), pd_result());
+		for (int pd = 0; pd < em_.nr_pds(); pd++)
+			r->pd[pd].res_ns.assign(em_.pd(pd).ps.size(), 0);
+		r->busy_ns.assign(em_.nr_cpus(), 0);
+		r->placed.assign(em_.nr_cpus(), 0);
+		r->response_us.clear();
+		r->response_us.reserve(wl_.acts().size());
+		r->overutilized = 0;
+
+		for (size_t i = 0; i < tasks_.size(); i++) {
+			const char *comm = wl_.tasks()[i].comm.c_str();
+
+			tasks_[i].last = now_;
+			for (const uclamp_rule &u : sc_.uclamp) {
+				if (!fnmatch(u.comm.c_str(), comm, 0)) {
+					tasks_[i].umin = u.min;
+					tasks_[i].umax = u.max;
+					break;
+				}
+			}
+		}
+	}
+
+	const perf_state &cur_ps(int c) const
+	{
+		int pd = em_.cpu(c).pd;
+
+		return em_.pd(pd).ps[state_[pd]];
+	}
+
+	void advance(uint64_t t)
+	{
+		uint64_t dt;
+		double y, dt_us;
+
+		if (t <= now_)
+			return;
+		dt = t - now_;
+		dt_us = dt / 1e3;
+		y = decay(dt);
+		for (int pd = 0; pd < em_.nr_pds(); pd++)
+			r_->pd[pd].res_ns[state_[pd]] += dt;
+		for (size_t c = 0; c < cpus_.size(); c++) {
+			cpu_rt &cr = cpus_[c];
+			const perf_state &ps = cur_ps((int)c);
+
+			if (cr.cur < 0) {
+				cr.util *= y;
+				continue;
+			}
+			cr.remain -= dt_us * ps.cap / SCHED_CAPACITY_SCALE;
+			cr.util = cr.util * y + ps.cap * (1 - y);
+			r_->busy_ns[c] += dt;
+			r_->pd[em_.cpu((int)c).pd].energy_mj += ps.power_mw * dt / 1e9;
+		}
+		now_ = t;
+	}
+
+	void schedule(int c)
+	{
+		cpu_rt &cr = cpus_[c];
+		double us;
+
+		cr.gen++;
+		if (cr.cur < 0)
+			return;
+		us = std::max(0.0, cr.remain) * SCHED_CAPACITY_SCALE / cur_ps(c).cap;
+		done_.push({ now_ + (uint64_t)(us * 1e3), c, cr.gen });
+	}
+
+	void start(int c)
+	{
+		cpu_rt &cr = cpus_[c];
+		task_rt *t;
+
+		if (cr.cur >= 0 || cr.q.empty())
+			return;
+		cr.cur = cr.q.front();
+		cr.q.pop_front();
+		cr.remain = wl_.acts()[cr.cur].work_us;
+		cr.started = now_;
+		t = &tasks_[wl_.acts()[cr.cur].task];
+		t->util *= decay(now_ - t->last);
+		t->last = now_;
+		schedule(c);
+	}
+
+	void complete(int c)
+	{
+		cpu_rt &cr = cpus_[c];
+		const activation &a = wl_.acts()[cr.cur];
+		task_rt &t = tasks_[a.task];
+		uint64_t ran = now_ - cr.started;
+		double y = decay(ran);
+
+		r_->response_us.push_back((now_ - a.wake_ns) / 1e3f);
+		if (ran)
+			t.util = t.util * y + std::min<double>(SCHED_CAPACITY_SCALE,
+				SCHED_CAPACITY_SCALE * a.work_us * 1e3 / ran) * (1 - y);
+		t.last = now_;
+		t.prev_cpu = c;
+		cr.est = std::max(0.0, cr.est - est_[cr.cur]);
+		cr.cur = -1;
+		start(c);
+		if (cr.cur < 0)
+			cr.gen++;
+		update_freq(em_.cpu(c).pd);
+	}
+
+	void wake(uint32_t i)
+	{
+		const activation &a = wl_.acts()[i];
+		task_rt &t = tasks_[a.task];
+		int c;
+
+		t.util *= decay(now_ - t.last);
+		t.last = now_;
+		c = select(a, t);
+		est_[i] = t.util;
+		cpus_[c].est += t.util;
+		cpus_[c].q.push_back(i);
+		r_->placed[c]++;
+		start(c);
+		update_freq(em_.cpu(c).pd);
+	}
+
+	double cpu_util(int c) const
+	{
+		return std::max(cpus_[c].util, cpus_[c].est);
+	}
+
+	/* rq-level uclamp: max of the min and max clamps of queued tasks */
+	void rq_clamp(int c, uint32_t *umin, uint32_t *umax) const
+	{
+		const cpu_rt &cr = cpus_[c];
+
+		*umin = 0;
+		*umax = 0;
+		auto add = [&](uint32_t act) {
+			const task_rt &t = tasks_[wl_.acts()[act].task];
+
+			*umin = std::max<uint32_t>(*umin, t.umin);
+			*umax = std::max<uint32_t>(*umax, t.umax);
+		};
+		if (cr.cur >= 0)
+			add((uint32_t)cr.cur);
+		for (uint32_t a : cr.q)
+			add(a);
+		if (cr.cur < 0 && cr.q.empty())
+			*umax = SCHED_CAPACITY_SCALE;
+	}
+
+	void update_freq(int pd)
+	{
+		uint32_t max = 0;
+		int st;
+
+		for (uint64_t m = em_.pd(pd).cpus; m; m &= m - 1) {
+			int c = __builtin_ctzll(m);
+			uint32_t u = (uint32_t)cpu_util(c), umin, umax;
+
+			rq_clamp(c, &umin, &umax);
+			u = std::min(std::max(u, umin), umax);
+			max = std::max(max, u);
+		}
+		st = em_.state_for(pd, max);
+		if (st == state_[pd])
+			return;
+		state_[pd] = st;
+		r_->pd[pd].transitions++;
+		for (uint64_t m = em_.pd(pd).cpus; m; m &= m - 1)
+			schedule(__builtin_ctzll(m));
+	}
+
+	bool allowed(int c) const
+	{
+		return !(sc_.isolated >> c & 1);
+	}
+
+	int select(const activation &a, const task_rt &t)
+	{
+		int c;
+
+		switch (sc_.policy) {
+		case POL_ORIG:
+			if (a.orig_cpu >= 0 && allowed(a.orig_cpu))
+				return a.orig_cpu;
+			return select_perf();
+		case POL_PERF:
+			return select_perf();
+		default:
+			c = select_energy(t);
+			if (c >= 0)
+				return c;
+			r_->overutilized++;
+			return select_perf();
+		}
+	}
+
+	/* Most spare capacity among allowed CPUs, -1 if none is */
+	int select_perf() const
+	{
+		int best = -1;
+		double spare = -1e9;
+
+		for (int c = 0; c < em_.nr_cpus(); c++) {
+			double s;
+
+			if (!allowed(c))
+				continue;
+			s = em_.cpu(c).cap_orig - cpu_util(c);
+			/* Idle wins over busy, then capacity */
+			if (cpus_[c].cur < 0 && cpus_[c].q.empty())
+				s += 2 * SCHED_CAPACITY_SCALE;
+			if (s > spare) {
+				spare = s;
+				best = c;
+			}
+		}
+		return best;
+	}
+
+	static bool fits(double util, uint32_t cap)
+	{
+		return util * 1280 < (double)cap * 1024;
+	}
+
+	/* Energy of @pd with @extra util added on CPU @on (-1: none) */
+	double pd_energy(int pd, int on, double extra, uint32_t boost) const
+	{
+		double max = 0, sum = 0;
+
+		for (uint64_t m = em_.pd(pd).cpus; m; m &= m - 1) {
+			int c = __builtin_ctzll(m);
+			double u = cpu_util(c);
+
+			if (c == on)
+				u = std::max(u + extra, (double)boost);
+			u = std::min<double>(u, em_.cpu(c).cap_orig);
+			max = std::max(max, u);
+			sum += u;
+		}
+		return em_.energy(pd, (uint32_t)max, (uint32_t)sum);
+	}
+
+	int select_energy(const task_rt &t)
+	{
+		double tu = std::min<double>(std::max<double>(t.util, t.umin), t.umax);
+		double best_delta = 1e300, prev_delta = 1e300;
+		int best = -1;
+
+		for (int pd = 0; pd < em_.nr_pds(); pd++) {
+			double base = -1, spare = -1e9;
+			int cand = -1;
+
+			for (uint64_t m = em_.pd(pd).cpus; m; m &= m - 1) {
+				int c = __builtin_ctzll(m);
+				double u = cpu_util(c) + t.util;
+				uint32_t cap = em_.cpu(c).cap_orig;
+
+				if (!allowed(c) || !fits(std::max(u, tu), cap))
+					continue;
+				if (c == t.prev_cpu) {
+					base = pd_energy(pd, -1, 0, 0);
+					prev_delta = pd_energy(pd, c, t.util, t.umin) - base;
+				}
+				if (cap - u > spare) {
+					spare = cap - u;
+					cand = c;
+				}
+			}
+			if (cand < 0)
+				continue;
+			if (base < 0)
+				base = pd_energy(pd, -1, 0, 0);
+			double d = pd_energy(pd, cand, t.util, t.umin) - base;
+
+			if (d < best_delta) {
+				best_delta = d;
+				best = cand;
+			}
+		}
+		/* Only leave prev_cpu for a saving of at least 1/16th */
+		if (prev_delta < 1e300 && best_delta + prev_delta / 16 >= prev_delta)
+			return t.prev_cpu;
+		return best;
+	}
+
+	const energy_model &em_;
+	const workload &wl_;
+	const scenario &sc_;
+	eas_result *r_ = nullptr;
+	uint64_t now_ = 0;
+	std::vector<cpu_rt> cpus_;
+	std::vector<task_rt> tasks_;
+	std::vector<int> state_;
+	std::vector<double> est_;
+	/* Completion times; entries whose gen is stale are skipped */
+	std::priority_queue<done_ev, std::vector<done_ev>, std::greater<done_ev>> done_;
+};
+
+} /* namespace sched */
+
+#endif /* __TOOLS_SCHED_EAS_H__ */
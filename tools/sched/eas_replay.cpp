@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Replay a scheduler trace through the DT's capacity and energy model
+ * under several placement / uclamp scenarios at once.
+ *
+ * Build: g++ -std=c++17 -O2 -pthread -o eas_replay eas_replay.cpp
+ * Usage: eas_replay [-j jobs] [-s scenario]... [-i isolated_mask]
+ *                   [-f pd=khz,khz...]... [-V vmin:vmax] <blob.dtb> <trace.txt>
+ *        eas_replay [options] -g seconds <blob.dtb>
+ *
+ * The trace is ftrace or perf script text with sched_switch and
+ * sched_wakeup, and optionally cpu_frequency to scale the recorded run
+ * times.  A scenario is "policy[:comm=min-max]..." where policy is orig,
+ * perf or eas and each comm pattern (fnmatch) gets those uclamp values;
+ * the default is "-s orig -s perf -s eas".  -f overrides a domain's
+ * frequency table, otherwise frequencies seen in the trace are used, and
+ * failing that the memlat core-dev-table points.  -g generates a
+ * synthetic trace of the given length instead.
+ *
+ * Example:
+ *   eas_replay -s eas -s 'eas:*Render*=512-1024' yupik.dtb scroll.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "eas.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int parse_scenario(const char *spec, sched::scenario *sc)
+{
+	const char *p = strchr(spec, ':');
+	std::string pol(spec, p ? p - spec : strlen(spec));
+
+	sc->name = spec;
+	if (pol == "orig")
+		sc->policy = sched::POL_ORIG;
+	else if (pol == "perf")
+		sc->policy = sched::POL_PERF;
+	else if (pol == "eas")
+		sc->policy = sched::POL_EAS;
+	else
+		return -EINVAL;
+
+	while (p && *p == ':') {
+		const char *eq = strchr(++p, '='), *next = strchr(p, ':');
+		unsigned int lo, hi;
+
+		if (!eq || (next && next < eq) || sscanf(eq + 1, "%u-%u", &lo, &hi) != 2 ||
+		    lo > hi || hi > SCHED_CAPACITY_SCALE)
+			return -EINVAL;
+		sc->uclamp.push_back({ std::string(p, eq - p), (uint16_t)lo, (uint16_t)hi });
+		p = next;
+	}
+	return 0;
+}
+
+static int parse_table(const char *spec, sched::energy_model *em)
+{
+	std::vector<uint32_t> khz;
+	char *end;
+	long pd = strtol(spec, &end, 0);
+
+	if (*end != '=' || pd < 0 || pd >= em->nr_pds())
+		return -EINVAL;
+	do {
+		khz.push_back((uint32_t)strtoul(end + 1, &end, 0));
+	} while (*end == ',');
+	if (*end)
+		return -EINVAL;
+	em->set_table((int)pd, khz);
+	return 0;
+}
+
+/* Frequencies the trace reports per domain, if it has cpu_frequency */
+static void tables_from_trace(const sched::sched_trace &tr, sched::energy_model *em,
+			      const std::vector<bool> &fixed)
+{
+	std::vector<std::vector<uint32_t>> khz(em->nr_pds());
+
+	for (const sched::sched_event &e : tr.events())
+		if (e.type == sched::EV_FREQ && e.cpu >= 0 && e.cpu < em->nr_cpus())
+			khz[em->cpu(e.cpu).pd].push_back(e.khz);
+	for (int pd = 0; pd < em->nr_pds(); pd++)
+		if (!fixed[pd] && !khz[pd].empty())
+			em->set_table(pd, khz[pd]);
+}
+
+/*
+ * Synthetic ftrace text: a mix of periodic UI-like tasks, a few heavy
+ * threads and background noise, scheduled round-robin on the trace CPUs.
+ */
+static std::string synth(double seconds, int ncpu)
+{
+	struct gen_task {
+		int pid;
+		const char *comm;
+		uint64_t period, run, next;
+	};
+	std::vector<gen_task> tasks;
+	std::vector<uint64_t> busy(ncpu, 0);
+	std::string s;
+	uint64_t end = (uint64_t)(seconds * 1e9), x = 0x2545f4914f6cdd1dull;
+	char line[640];
+	int n;
+
+	static const char *const names[] = {
+		"RenderThread", "surfaceflinger", "ui", "HwBinder", "kworker/u16:1",
+		"audio_io", "binder", "crtc_commit", "logd", "system_server",
+	};
+	for (int i = 0; i < 40; i++) {
+		uint64_t period = 1000000ull * (4 + (i * 7) % 29);
+
+		tasks.push_back({ 1000 + i, names[i % 10], period,
+				  period / (6 + i % 23), (uint64_t)i * 100000 });
+	}
+	s.reserve((size_t)(seconds * 40 * 200 * 1000 / 16));
+	for (;;) {
+		gen_task *t = &tasks[0];
+		uint64_t start, run;
+		int cpu;
+
+		for (gen_task &g : tasks)
+			if (g.next < t->next)
+				t = &g;
+		if (t->next >= end)
+			break;
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		cpu = (int)(x % ncpu);
+		start = std::max(t->next, busy[cpu]);
+		run = t->run / 2 + x % (t->run + 1);
+		n = snprintf(line, sizeof(line),
+			     " <idle>-0 [%03d] d..2 %lu.%06lu: sched_wakeup: comm=%s pid=%d prio=120 target_cpu=%03d\n"
+			     " <idle>-0 [%03d] d..2 %lu.%06lu: sched_switch: prev_comm=swapper/%d prev_pid=0 prev_prio=120 prev_state=R ==> next_comm=%s next_pid=%d next_prio=120\n"
+			     " %s-%d [%03d] d..2 %lu.%06lu: sched_switch: prev_comm=%s prev_pid=%d prev_prio=120 prev_state=S ==> next_comm=swapper/%d next_pid=0 next_prio=120\n",
+			     cpu, (unsigned long)(t->next / 1000000000), (unsigned long)(t->next / 1000 % 1000000),
+			     t->comm, t->pid, cpu,
+			     cpu, (unsigned long)(start / 1000000000), (unsigned long)(start / 1000 % 1000000),
+			     cpu, t->comm, t->pid,
+			     t->comm, t->pid, cpu, (unsigned long)((start + run) / 1000000000),
+			     (unsigned long)((start + run) / 1000 % 1000000), t->comm, t->pid, cpu);
+		s.append(line, n);
+		busy[cpu] = start + run;
+		t->next += t->period;
+	}
+	return s;
+}
+
+static void report(const sched::energy_model &em, const sched::scenario &sc,
+		   sched::eas_result &r)
+{
+	double total = 0, mean = 0;
+	size_t n = r.response_us.size();
+	float p50 = 0, p95 = 0, p99 = 0;
+
+	for (const sched::pd_result &p : r.pd)
+		total += p.energy_mj;
+	for (float v : r.response_us)
+		mean += v;
+	if (n) {
+		mean /= n;
+		std::nth_element(r.response_us.begin(), r.response_us.begin() + n / 2,
+				 r.response_us.end());
+		p50 = r.response_us[n / 2];
+		std::nth_element(r.response_us.begin(), r.response_us.begin() + n * 95 / 100,
+				 r.response_us.end());
+		p95 = r.response_us[n * 95 / 100];
+		std::nth_element(r.response_us.begin(), r.response_us.begin() + n * 99 / 100,
+				 r.response_us.end());
+		p99 = r.response_us[n * 99 / 100];
+	}
+
+	printf("scenario %s: %.1f mJ over %.3f s, %lu overutilized wakeups\n",
+	       sc.name.c_str(), total, r.span_ns / 1e9, (unsigned long)r.overutilized);
+	printf("  response us: mean %.1f p50 %.1f p95 %.1f p99 %.1f (%zu activations)\n",
+	       mean, p50, p95, p99, n);
+	for (int pd = 0; pd < em.nr_pds(); pd++) {
+		const sched::perf_domain &d = em.pd(pd);
+		const sched::pd_result &p = r.pd[pd];
+		uint64_t span = 0;
+
+		for (uint64_t v : p.res_ns)
+			span += v;
+		printf("  pd%d (cpus 0x%lx): %.1f mJ, %lu transitions\n", d.id,
+		       (unsigned long)d.cpus, p.energy_mj, (unsigned long)p.transitions);
+		for (size_t i = 0; i < d.ps.size(); i++)
+			if (p.res_ns[i])
+				printf("    %7u kHz %6.2f%%\n", d.ps[i].khz,
+				       100.0 * p.res_ns[i] / (span ? span : 1));
+	}
+	printf("  cpu   placed   busy\n");
+	for (int c = 0; c < em.nr_cpus(); c++)
+		printf("  %3d %8lu %5.1f%%\n", c, (unsigned long)r.placed[c],
+		       100.0 * r.busy_ns[c] / (r.span_ns ? r.span_ns : 1));
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<sched::scenario> scs;
+	std::vector<const char *> tables;
+	sched::energy_model em;
+	sched::sched_trace tr;
+	sched::workload wl;
+	sched::em_opts eo;
+	dt::cpu_topology cpus;
+	uint64_t isolated = 0;
+	double gen = 0, t0, t1, t2;
+	int jobs = (int)std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+	dt::file f;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "j:s:i:f:V:g:")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = std::max(1, atoi(optarg));
+			break;
+		case 's':
+			scs.emplace_back();
+			if (parse_scenario(optarg, &scs.back())) {
+				fprintf(stderr, "bad scenario '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'i':
+			isolated = strtoull(optarg, nullptr, 16);
+			break;
+		case 'f':
+			tables.push_back(optarg);
+			break;
+		case 'V':
+			if (sscanf(optarg, "%u:%u", &eo.vmin_mv, &eo.vmax_mv) != 2) {
+				fprintf(stderr, "bad voltage range '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'g':
+			gen = atof(optarg);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != (gen > 0 ? 1 : 2)) {
+		fprintf(stderr,
+			"usage: %s [-j jobs] [-s scenario]... [-i isolated_mask] "
+			"[-f pd=khz,...]... [-V vmin:vmax] <blob.dtb> <trace.txt>\n"
+			"       %s [options] -g seconds <blob.dtb>\n", argv[0], argv[0]);
+		return 1;
+	}
+	if (scs.empty()) {
+		for (const char *s : { "orig", "perf", "eas" }) {
+			scs.emplace_back();
+			parse_scenario(s, &scs.back());
+		}
+	}
+
+	ret = f.open(argv[optind]);
+	if (!ret)
+		ret = cpus.build(f.index());
+	if (!ret)
+		ret = em.build(f.index(), cpus);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	for (int c = 0; c < em.nr_cpus(); c++) {
+		if ((isolated >> c & 1) && !em.cpu(c).isolatable)
+			fprintf(stderr, "cpu%d has no isolation device; isolating anyway\n", c);
+	}
+	for (sched::scenario &sc : scs)
+		sc.isolated = isolated;
+
+	std::vector<bool> fixed(em.nr_pds(), false);
+
+	for (const char *t : tables) {
+		if (parse_table(t, &em)) {
+			fprintf(stderr, "bad frequency table '%s'\n", t);
+			return 1;
+		}
+		fixed[atoi(t)] = true;
+	}
+
+	if (gen > 0) {
+		std::string text = synth(gen, em.nr_cpus());
+
+		t0 = now_us();
+		ret = tr.parse(text.data(), text.size(), jobs);
+	} else {
+		t0 = now_us();
+		ret = tr.open(argv[optind + 1], jobs);
+	}
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", gen > 0 ? "synthetic" : argv[optind + 1],
+			strerror(-ret));
+		return 1;
+	}
+	tables_from_trace(tr, &em, fixed);
+	ret = em.finalize(eo);
+	if (!ret)
+		ret = wl.build(tr, em);
+	if (ret) {
+		fprintf(stderr, "model: %s\n", strerror(-ret));
+		return 1;
+	}
+	t1 = now_us();
+
+	for (int pd = 0; pd < em.nr_pds(); pd++) {
+		const sched::perf_domain &d = em.pd(pd);
+
+		printf("pd%d cpus 0x%lx cap %u dpc %u: %u..%u kHz, %.0f..%.0f mW\n",
+		       d.id, (unsigned long)d.cpus,
+		       em.cpu(__builtin_ctzll(d.cpus)).cap_orig, d.dpc,
+		       d.ps.front().khz, d.ps.back().khz, d.ps.front().power_mw,
+		       d.ps.back().power_mw);
+	}
+
+	/* Scenarios are independent: one worker each, up to -j at a time */
+	std::vector<sched::eas_result> res(scs.size());
+	std::vector<int> err(scs.size());
+	std::vector<std::thread> th;
+	std::atomic<size_t> next(0);
+
+	for (int i = 0; i < std::min<int>(jobs, (int)scs.size()); i++)
+		th.emplace_back([&] {
+			for (size_t k; (k = next++) < scs.size();)
+				err[k] = sched::eas_sim(em, wl, scs[k]).run(&res[k]);
+		});
+	for (std::thread &t : th)
+		t.join();
+	t2 = now_us();
+	for (size_t k = 0; k < scs.size(); k++) {
+		if (err[k]) {
+			fprintf(stderr, "%s: every CPU is isolated\n", scs[k].name.c_str());
+			return 1;
+		}
+	}
+
+	for (size_t k = 0; k < scs.size(); k++)
+		report(em, scs[k], res[k]);
+	fprintf(stderr, "%lu lines, %zu events, %zu activations of %zu tasks: "
+		"parse %.0f ms, replay %.0f ms (%zu scenarios, %d jobs)\n",
+		(unsigned long)tr.lines(), tr.events().size(), wl.acts().size(),
+		wl.tasks().size(), (t1 - t0) / 1e3, (t2 - t1) / 1e3, scs.size(), jobs);
+	return 0;
+}
@@ -0,0 +1,237 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * CPU capacity and energy model built from the DT.
+ *
+ * Performance domains come from qcom,freq-domain (the cpufreq-hw domain
+ * index), CPU capacity from capacity-dmips-mhz scaled by the domain's top
+ * frequency and normalised so the biggest CPU is 1024, as the arch
+ * topology code does.  Power per performance state follows the kernel's
+ * dynamic-power-coefficient estimate, P = dpc * f[MHz] * V[mV]^2 / 1e9 mW.
+ *
+ * cpufreq-hw reads its frequency table from the EPSS LUT, so the DT has
+ * no OPPs and no voltages.  Tables can be supplied by the caller; failing
+ * that they are the core frequencies the memlat monitors list in their
+ * qcom,core-dev-table, which are LUT rows.  Voltage is interpolated
+ * linearly across each table between vmin and vmax.
+ */
+
+#ifndef __TOOLS_SCHED_EM_H__
+#define __TOOLS_SCHED_EM_H__
+
+#include <algorithm>
+#include <vector>
+
+#include "../dt/cpus.h"
+
+namespace sched {
+
+#define SCHED_CAPACITY_SCALE	1024
+
+struct perf_state {
+	uint32_t khz;
+	uint32_t cap;		/* capacity of one CPU at this frequency */
+	uint32_t mv;
+	double power_mw;	/* one CPU fully busy */
+	double cost;		/* power_mw / cap */
+};
+
+struct perf_domain {
+	int id;			/* cpufreq-hw domain index */
+	uint64_t cpus;
+	uint32_t dpc;
+	std::vector<perf_state> ps;
+};
+
+struct cpu_info {
+	int pd;
+	uint32_t dmips;
+	uint32_t cap_orig;
+	bool isolatable;	/* has a qcom,cpu-isolate cooling device */
+};
+
+struct em_opts {
+	uint32_t vmin_mv = 600;
+	uint32_t vmax_mv = 1000;
+};
+
+class energy_model {
+public:
+	/* Domains and per-CPU constants; frequency tables seeded from the DT */
+	int build(const dt::tree &t, const dt::cpu_topology &cpus)
+	{
+		pds_.clear();
+		cpus_.assign(cpus.count(), cpu_info{ -1, SCHED_CAPACITY_SCALE, 0, false });
+
+		for (int c = 0; c < cpus.count(); c++) {
+			uint32_t node = cpus.cpu(c).node;
+			dt::property p;
+			int dom = 0, pd;
+
+			if (t.find_prop(node, "qcom,freq-domain", &p) && p.cells() >= 2)
+				dom = (int)p.u32(1);
+			else
+				dom = cpus.cpu(c).cluster >= 0 ? cpus.cpu(c).cluster : 0;
+			pd = find_pd(dom);
+			if (pd < 0) {
+				pds_.push_back({ dom, 0, 0, {} });
+				pd = (int)pds_.size() - 1;
+			}
+			pds_[pd].cpus |= 1ull << c;
+			if (!pds_[pd].dpc)
+				pds_[pd].dpc = t.prop_u32(node, "dynamic-power-coefficient", 0);
+			cpus_[c].pd = pd;
+			cpus_[c].dmips = t.prop_u32(node, "capacity-dmips-mhz",
+						    SCHED_CAPACITY_SCALE);
+		}
+		std::sort(pds_.begin(), pds_.end(), [](const perf_domain &a,
+						       const perf_domain &b) {
+			return a.id < b.id;
+		});
+		for (size_t pd = 0; pd < pds_.size(); pd++)
+			for (uint64_t m = pds_[pd].cpus; m; m &= m - 1)
+				cpus_[__builtin_ctzll(m)].pd = (int)pd;
+
+		/* Isolation devices name their CPU with qcom,cpu */
+		for (uint32_t id = 0; id < t.size(); id++) {
+			dt::property p;
+			int c;
+
+			if (!strstr(t.name(id), "-isolate") ||
+			    !t.find_prop(id, "qcom,cpu", &p) || p.len != 4)
+				continue;
+			c = cpus.logical(t.by_phandle(p.u32()));
+			if (c >= 0)
+				cpus_[c].isolatable = true;
+		}
+
+		seed_tables(t, cpus);
+		return 0;
+	}
+
+	/* Replace a domain's frequency table (kHz, any order) */
+	void set_table(int pd, std::vector<uint32_t> khz)
+	{
+		std::sort(khz.begin(), khz.end());
+		khz.erase(std::unique(khz.begin(), khz.end()), khz.end());
+		pds_[pd].ps.clear();
+		for (uint32_t f : khz)
+			if (f)
+				pds_[pd].ps.push_back({ f, 0, 0, 0, 0 });
+	}
+
+	/*
+	 * Capacities and power, once every table is final.  Returns -ENODATA
+	 * naming nothing if a domain still has no frequencies.
+	 */
+	int finalize(const em_opts &o)
+	{
+		uint64_t top = 0;
+
+		for (const perf_domain &pd : pds_)
+			if (pd.ps.empty())
+				return -ENODATA;
+		for (const cpu_info &c : cpus_)
+			top = std::max<uint64_t>(top, (uint64_t)c.dmips * fmax(c.pd));
+		for (cpu_info &c : cpus_)
+			c.cap_orig = (uint32_t)((uint64_t)c.dmips * fmax(c.pd) *
+						SCHED_CAPACITY_SCALE / top);
+
+		for (perf_domain &pd : pds_) {
+			uint32_t cap = cpus_[__builtin_ctzll(pd.cpus)].cap_orig;
+			uint32_t lo = pd.ps.front().khz, hi = pd.ps.back().khz;
+
+			for (perf_state &s : pd.ps) {
+				double mhz = s.khz / 1000.0, mv;
+
+				mv = hi == lo ? o.vmax_mv : o.vmin_mv +
+				     (double)(o.vmax_mv - o.vmin_mv) * (s.khz - lo) / (hi - lo);
+				s.mv = (uint32_t)mv;
+				s.cap = std::max<uint32_t>(1, (uint32_t)((uint64_t)cap * s.khz / hi));
+				s.power_mw = pd.dpc * mhz * mv * mv / 1e9;
+				s.cost = s.power_mw / s.cap;
+			}
+		}
+		return 0;
+	}
+
+	int nr_pds() const { return (int)pds_.size(); }
+	const perf_domain &pd(int i) const { return pds_[i]; }
+	int nr_cpus() const { return (int)cpus_.size(); }
+	const cpu_info &cpu(int c) const { return cpus_[c]; }
+
+	uint32_t fmax(int pd) const
+	{
+		return pds_[pd].ps.empty() ? 0 : pds_[pd].ps.back().khz;
+	}
+
+	/* schedutil: 1.25 * util headroom, first state whose capacity covers it */
+	int state_for(int pd, uint32_t util) const
+	{
+		const std::vector<perf_state> &ps = pds_[pd].ps;
+		uint32_t want = util + (util >> 2);
+
+		for (size_t i = 0; i < ps.size(); i++)
+			if (ps[i].cap >= want)
+				return (int)i;
+		return (int)ps.size() - 1;
+	}
+
+	/* Index of the state closest to @khz from above */
+	int state_of_khz(int pd, uint32_t khz) const
+	{
+		const std::vector<perf_state> &ps = pds_[pd].ps;
+
+		for (size_t i = 0; i < ps.size(); i++)
+			if (ps[i].khz >= khz)
+				return (int)i;
+		return (int)ps.size() - 1;
+	}
+
+	/* em_cpu_energy(): what a domain burns for @sum_util at @max_util's OPP */
+	double energy(int pd, uint32_t max_util, uint32_t sum_util) const
+	{
+		return pds_[pd].ps[state_for(pd, max_util)].cost * sum_util;
+	}
+
+private:
+	int find_pd(int dom) const
+	{
+		for (size_t i = 0; i < pds_.size(); i++)
+			if (pds_[i].id == dom)
+				return (int)i;
+		return -1;
+	}
+
+	/* Core frequencies of monitors whose CPUs sit in one domain */
+	void seed_tables(const dt::tree &t, const dt::cpu_topology &cpus)
+	{
+		std::vector<std::vector<uint32_t>> khz(pds_.size());
+
+		for (uint32_t id = 0; id < t.size(); id++) {
+			dt::property p, tbl;
+			uint64_t m;
+			int pd;
+
+			if (!t.find_prop(id, "qcom,cpulist", &p) ||
+			    !t.find_prop(id, "qcom,core-dev-table", &tbl))
+				continue;
+			m = cpus.mask(t, p);
+			if (!m)
+				continue;
+			pd = cpus_[__builtin_ctzll(m)].pd;
+			if (m & ~pds_[pd].cpus)
+				continue;
+			for (uint32_t i = 0; i + 1 < tbl.cells(); i += 2)
+				khz[pd].push_back(tbl.u32(i));
+		}
+		for (size_t pd = 0; pd < pds_.size(); pd++)
+			set_table((int)pd, std::move(khz[pd]));
+	}
+
+	std::vector<perf_domain> pds_;
+	std::vector<cpu_info> cpus_;
+};
+
+} /* namespace sched */
+
+#endif /* __TOOLS_SCHED_EM_H__ */
@@ -0,0 +1,259 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * sched_switch / sched_wakeup / cpu_frequency parser for ftrace and
+ * perf script text output.
+ *
+ *   <idle>-0  [001] d..2  1234.567890: sched_switch: prev_comm=... ==> ...
+ *   foo  123 [002]  1234.567890: sched:sched_wakeup: comm=bar pid=456 ...
+ *
+ * Only the "[cpu]", the timestamp and the key=value payload are used, so
+ * both layouts parse the same way.  The file is split at line boundaries
+ * and the pieces are parsed concurrently; events come back in file order,
+ * which for both tools is timestamp order.
+ */
+
+#ifndef __TOOLS_SCHED_SCHED_TRACE_H__
+#define __TOOLS_SCHED_SCHED_TRACE_H__
+
+#include <stddef.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../lib/mapped_file.h"
+
+namespace sched {
+
+enum sched_ev_type : uint8_t {
+	EV_SWITCH,
+	EV_WAKEUP,
+	EV_FREQ,
+};
+
+struct sched_event {
+	uint64_t ts_ns;
+	sched_ev_type type;
+	bool prev_runnable;	/* switch: prev_state R, i.e. preempted */
+	int16_t cpu;		/* switch/freq: the CPU; wakeup: target_cpu */
+	int32_t prev_pid;	/* switch: prev_pid; wakeup: pid */
+	int32_t next_pid;
+	uint32_t khz;		/* freq */
+};
+
+class sched_trace {
+public:
+	int open(const char *path, int jobs)
+	{
+		int ret = map_.open(path);
+
+		if (ret)
+			return ret;
+		return parse(reinterpret_cast<const char *>(map_.data()), map_.size(), jobs);
+	}
+
+	int parse(const char *buf, size_t len, int jobs)
+	{
+		std::vector<chunk> parts(jobs > 0 ? jobs : 1);
+		std::vector<std::thread> th;
+		size_t at = 0, n = 0;
+
+		for (size_t i = 0; i < parts.size(); i++) {
+			size_t end = i + 1 == parts.size() ? len : len / parts.size() * (i + 1);
+			const void *nl;
+
+			if (end < at)
+				end = at;
+			nl = end < len ? memchr(buf + end, '\n', len - end) : nullptr;
+			end = nl ? (const char *)nl - buf + 1 : len;
+			parts[i].b = buf + at;
+			parts[i].e = buf + end;
+			at = end;
+		}
+		for (size_t i = 1; i < parts.size(); i++)
+			th.emplace_back([&parts, i] { parts[i].run(); });
+		parts[0].run();
+		for (std::thread &t : th)
+			t.join();
+
+		for (const chunk &c : parts)
+			n += c.ev.size();
+		events_.clear();
+		events_.reserve(n);
+		comm_.clear();
+		lines_ = 0;
+		for (chunk &c : parts) {
+			events_.insert(events_.end(), c.ev.begin(), c.ev.end());
+			for (auto &kv : c.comm)
+				comm_.emplace(kv.first, std::move(kv.second));
+			lines_ += c.lines;
+		}
+		return events_.empty() ? -ENODATA : 0;
+	}
+
+	const std::vector<sched_event> &events() const { return events_; }
+	uint64_t lines() const { return lines_; }
+
+	const char *comm(int32_t pid) const
+	{
+		auto it = comm_.find(pid);
+
+		return it == comm_.end() ? "?" : it->second.c_str();
+	}
+
+private:
+	struct chunk {
+		const char *b, *e;
+		std::vector<sched_event> ev;
+		std::unordered_map<int32_t, std::string> comm;
+		uint64_t lines = 0;
+
+		void run()
+		{
+			while (b < e) {
+				const char *nl = static_cast<const char *>(memchr(b, '\n', e - b));
+
+				if (!nl)
+					nl = e;
+				line(b, nl);
+				lines++;
+				b = nl + 1;
+			}
+		}
+
+		static const char *find(const char *b, const char *e, const char *key)
+		{
+			size_t kl = strlen(key);
+
+			if (e - b < (ptrdiff_t)kl)
+				return nullptr;
+			const void *p = memmem(b, e - b, key, kl);
+
+			return p ? static_cast<const char *>(p) + kl : nullptr;
+		}
+
+		static int64_t num(const char *p, const char *e)
+		{
+			int64_t v = 0;
+			bool neg = p < e && *p == '-';
+
+			for (p += neg; p < e && *p >= '0' && *p <= '9'; p++)
+				v = v * 10 + (*p - '0');
+			return neg ? -v : v;
+		}
+
+		void remember(int32_t pid, const char *b, const char *e)
+		{
+			if (pid > 0 && b && e > b && !comm.count(pid))
+				comm.emplace(pid, std::string(b, e));
+		}
+
+		void line(const char *b, const char *e)
+		{
+			const char *p = b, *q, *name;
+			sched_event ev;
+			uint64_t sec = 0, frac = 0, scale = 1000000000;
+
+			/* "[cpu]": the first bracket followed by digits */
+			while ((p = static_cast<const char *>(memchr(p, '[', e - p)))) {
+				if (p + 1 < e && p[1] >= '0' && p[1] <= '9')
+					break;
+				p++;
+			}
+			if (!p)
+				return;
+			ev.cpu = (int16_t)num(p + 1, e);
+
+			/* Timestamp: first "digits.digits:" after the bracket */
+			for (q = p; q < e; q++) {
+				const char *s = q;
+
+				if (*q < '0' || *q > '9' || (q > b && q[-1] != ' '))
+					continue;
+				while (q < e && *q >= '0' && *q <= '9')
+					q++;
+				if (q >= e || *q != '.') {
+					continue;
+				}
+				sec = num(s, q);
+				for (q++; q < e && *q >= '0' && *q <= '9'; q++) {
+					frac = frac * 10 + (*q - '0');
+					scale /= 10;
+				}
+				if (q < e && *q == ':')
+					break;
+				sec = frac = 0;
+				scale = 1000000000;
+			}
+			if (q >= e || !scale)
+				return;
+			ev.ts_ns = sec * 1000000000ull + frac * scale;
+
+			name = q + 1;
+			while (name < e && *name == ' ')
+				name++;
+			if (!strncmp(name, "sched:", 6))
+				name += 6;
+			else if (!strncmp(name, "power:", 6))
+				name += 6;
+
+			ev.prev_runnable = false;
+			ev.prev_pid = ev.next_pid = 0;
+			ev.khz = 0;
+			if (!strncmp(name, "sched_switch:", 13)) {
+				const char *pc, *pp, *ps, *nc, *np;
+
+				pc = find(name, e, "prev_comm=");
+				pp = find(name, e, " prev_pid=");
+				ps = find(name, e, " prev_state=");
+				nc = find(name, e, "next_comm=");
+				np = find(name, e, " next_pid=");
+				if (!pp || !ps || !np)
+					return;
+				ev.type = EV_SWITCH;
+				ev.prev_pid = (int32_t)num(pp, e);
+				ev.next_pid = (int32_t)num(np, e);
+				/* "R" alone is preemption; "R+" too */
+				ev.prev_runnable = *ps == 'R';
+				remember(ev.prev_pid, pc, pp - 10);
+				remember(ev.next_pid, nc, np - 10);
+			} else if (!strncmp(name, "sched_wakeup:", 13) ||
+				   !strncmp(name, "sched_wakeup_new:", 17)) {
+				const char *c, *pid, *tc;
+
+				c = find(name, e, "comm=");
+				pid = find(name, e, " pid=");
+				tc = find(name, e, "target_cpu=");
+				if (!pid)
+					return;
+				ev.type = EV_WAKEUP;
+				ev.prev_pid = (int32_t)num(pid, e);
+				if (tc)
+					ev.cpu = (int16_t)num(tc, e);
+				remember(ev.prev_pid, c, pid - 5);
+			} else if (!strncmp(name, "cpu_frequency:", 14)) {
+				const char *st = find(name, e, "state="), *id = find(name, e, "cpu_id=");
+
+				if (!st || !id)
+					return;
+				ev.type = EV_FREQ;
+				ev.khz = (uint32_t)num(st, e);
+				ev.cpu = (int16_t)num(id, e);
+			} else {
+				return;
+			}
+			this->ev.push_back(ev);
+		}
+	};
+
+	lib::mapped_file map_;
+	std::vector<sched_event> events_;
+	std::unordered_map<int32_t, std::string> comm_;
+	uint64_t lines_ = 0;
+};
+
+} /* namespace sched */
+
+#endif /* __TOOLS_SCHED_SCHED_TRACE_H__ */
@@ -0,0 +1,660 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Thermal zone / cooling-map graph and a step-response throttling model.
+ *
+ * Zones, trips and cooling maps are read from the DT thermal-zones node;
+ * cooling devices are classified by what they act on: cpufreq policies
+ * (cpu nodes), the cpu-voltage cluster devices, CPU isolation and
+ * hotplug, the GPU power levels and opaque QMI mitigation devices.
+ *
+ * A recorded temperature trace is taken as the unmitigated response of
+ * each sensor to the load.  step_wise is run on top of it as the kernel
+ * would; every active cooling device removes part of the power heating
+ * the sensors it is bound to, and the temperature drop that buys follows
+ * a first-order step response:
+ *
+ *   drop' = ((T_rec - T_amb) * coupling * cut - drop) / tau
+ *
+ * where cut is the largest fraction of power any bound device removes.
+ * The simulated temperature T_rec - drop drives the governor, so trips
+ * fire later and release earlier than in the raw trace, as on a device.
+ */
+
+#ifndef __TOOLS_THERMAL_THERMAL_H__
+#define __TOOLS_THERMAL_THERMAL_H__
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../gpu/kgsl.h"
+#include "../lib/csv.h"
+#include "../sched/em.h"
+
+namespace thermal {
+
+#define THERMAL_NO_LIMIT	0xffffffffu
+#define THERMAL_MAX_LIMIT	0xfffffffeu	/* qcom: the device's max state */
+#define THERMAL_NO_TARGET	(-1)
+
+enum cdev_kind {
+	CDEV_CPUFREQ,
+	CDEV_CPU_VOLTAGE,
+	CDEV_CPU_ISOLATE,
+	CDEV_CPU_HOTPLUG,
+	CDEV_GPU,
+	CDEV_QMI,
+	CDEV_OTHER,
+};
+
+enum trip_type {
+	TRIP_ACTIVE,
+	TRIP_PASSIVE,
+	TRIP_HOT,
+	TRIP_CRITICAL,
+};
+
+struct cdev {
+	std::string name;
+	uint32_t node;
+	cdev_kind kind;
+	uint64_t cpus;
+	std::vector<int> pds;		/* cpufreq / cpu-voltage */
+	uint32_t max_state;
+	uint32_t state;
+	std::vector<uint64_t> res_ms;
+};
+
+struct trip {
+	std::string name;
+	uint32_t node;
+	int temp;			/* millicelsius */
+	int hyst;
+	trip_type type;
+	bool active;
+	uint64_t first_ms;		/* UINT64_MAX: never fired */
+	uint64_t fires;
+	uint64_t active_ms;
+};
+
+struct binding {
+	int trip;
+	int cdev;
+	uint32_t lower, upper;
+	int target;
+};
+
+struct sensor {
+	std::string name;		/* "<provider>:<index>" */
+	bool bound;			/* a trace column feeds it */
+	bool level;			/* trips are raw levels, not mC */
+	double t_rec;
+	double drop;
+	double max_rec, max_sim;
+	std::vector<int> cdevs;		/* bound anywhere on this sensor */
+};
+
+struct zone {
+	std::string name;
+	uint32_t node;
+	int sensor;
+	bool step_wise;
+	uint32_t passive_ms, polling_ms;
+	std::vector<trip> trips;
+	std::vector<binding> maps;
+	double last;
+	uint64_t next_eval;
+};
+
+struct thermal_opts {
+	double ambient = 25000;		/* millicelsius */
+	double tau_ms = 2000;
+	double coupling = 0.6;
+	uint32_t qmi_states = 3;	/* QMI devices report theirs at runtime */
+	int gpu_bin = 0;		/* qcom,speed-bin of the GPU level table */
+	uint32_t vmin_mv = 600, vmax_mv = 1000;
+};
+
+class thermal_model {
+public:
+	int load(const dt::tree &t, const dt::cpu_topology &cpus,
+		 const sched::energy_model &em, const thermal_opts &o)
+	{
+		uint32_t tz = DT_NONE;
+
+		t_ = &t;
+		cpus_ = &cpus;
+		em_ = &em;
+		opts_ = o;
+		zones_.clear();
+		cdevs_.clear();
+		sensors_.clear();
+		gpu_khz_.clear();
+
+		for (uint32_t id = 0; id < t.size() && tz == DT_NONE; id++)
+			if (!strcmp(t.name(id), "thermal-zones"))
+				tz = id;
+		if (tz == DT_NONE)
+			return -ENOENT;
+		for (uint32_t z = t.first_child(tz); z != DT_NONE; z = t.next_sibling(z)) {
+			int ret = add_zone(z);
+
+			if (ret)
+				return ret;
+		}
+		if (zones_.empty())
+			return -ENOENT;
+		for (zone &z : zones_)
+			for (const binding &b : z.maps)
+				add_unique(&sensors_[z.sensor].cdevs, b.cdev);
+		for (cdev &c : cdevs_)
+			c.res_ms.assign(c.max_state + 1, 0);
+		reset();
+		return 0;
+	}
+
+	/*
+	 * Map trace columns: time_ms or time_us, then one column per zone
+	 * (its node name, with or without the -step/-usr suffix).  Values
+	 * are millicelsius, or celsius when below 1000, except on sensors
+	 * whose trips are raw levels (the rdpm power-estimate zones).
+	 */
+	int bind(const csv::row &hdr)
+	{
+		c_ms_ = hdr.find("time_ms");
+		c_us_ = hdr.find("time_us");
+		cols_.clear();
+		if (c_ms_ < 0 && c_us_ < 0)
+			return -EINVAL;
+		for (int i = 0; i < hdr.n; i++) {
+			std::string_view h = hdr.str(i);
+
+			for (const zone &z : zones_) {
+				if (h == z.name || h == base_name(z.name)) {
+					cols_.push_back({ i, z.sensor });
+					sensors_[z.sensor].bound = true;
+					break;
+				}
+			}
+		}
+		return cols_.empty() ? -ENODATA : 0;
+	}
+
+	void reset()
+	{
+		for (sensor &s : sensors_) {
+			s.t_rec = opts_.ambient;
+			s.drop = 0;
+			s.max_rec = s.max_sim = -1e9;
+		}
+		for (zone &z : zones_) {
+			z.last = opts_.ambient;
+			z.next_eval = 0;
+			for (trip &tp : z.trips) {
+				tp.active = false;
+				tp.first_ms = UINT64_MAX;
+				tp.fires = 0;
+				tp.active_ms = 0;
+			}
+			for (binding &b : z.maps)
+				b.target = THERMAL_NO_TARGET;
+		}
+		for (cdev &c : cdevs_) {
+			c.state = 0;
+			std::fill(c.res_ms.begin(), c.res_ms.end(), 0);
+		}
+		cap_ms_.assign(em_->nr_pds(), 0);
+		cap_lost_ms_ = 0;
+		gpu_ms_ = 0;
+		span_ms_ = 0;
+		now_ = 0;
+		started_ = false;
+	}
+
+	/* Feed one trace row; @fired(time_ms, zone, trip, on) sees trip edges */
+	template <typename F>
+	void sample(const csv::row &r, F fired)
+	{
+		uint64_t t = c_ms_ >= 0 ? r.u64(c_ms_) : r.u64(c_us_) / 1000;
+		double dt;
+
+		if (started_ && t > now_) {
+			dt = (double)(t - now_);
+			account(t - now_);
+			step(dt);
+		}
+		now_ = t;
+		started_ = true;
+
+		for (const col &c : cols_) {
+			sensor &s = sensors_[c.sensor];
+			double v = r.dbl(c.idx);
+
+			s.t_rec = !s.level && fabs(v) < 1000 ? v * 1000 : v;
+		}
+		for (sensor &s : sensors_) {
+			if (!s.bound)
+				continue;
+			s.max_rec = std::max(s.max_rec, s.t_rec);
+			s.max_sim = std::max(s.max_sim, s.t_rec - s.drop);
+		}
+		for (size_t i = 0; i < zones_.size(); i++)
+			govern((int)i, fired);
+		update_cdevs();
+	}
+
+	const std::vector<zone> &zones() const { return zones_; }
+	const std::vector<cdev> &cdevs() const { return cdevs_; }
+	const std::vector<sensor> &sensors() const { return sensors_; }
+	const std::vector<uint32_t> &gpu_khz() const { return gpu_khz_; }
+	uint64_t span_ms() const { return span_ms_; }
+
+	/* Time-weighted frequency cap per domain and GPU, in kHz-ms */
+	uint64_t cap_khz_ms(int pd) const { return cap_ms_[pd]; }
+	uint64_t gpu_khz_ms() const { return gpu_ms_; }
+	/* Time-weighted CPU capacity lost, capacity-ms */
+	uint64_t cap_lost_ms() const { return cap_lost_ms_; }
+
+	/* Frequency ceiling @c imposes on domain @pd at @state */
+	uint32_t cpu_cap_khz(int pd, uint32_t state) const
+	{
+		const std::vector<sched::perf_state> &ps = em_->pd(pd).ps;
+
+		if (state >= ps.size())
+			state = (uint32_t)ps.size() - 1;
+		return ps[ps.size() - 1 - state].khz;
+	}
+
+private:
+	struct col {
+		int idx;
+		int sensor;
+	};
+
+	static void add_unique(std::vector<int> *v, int x)
+	{
+		if (std::find(v->begin(), v->end(), x) == v->end())
+			v->push_back(x);
+	}
+
+	static std::string_view base_name(const std::string &n)
+	{
+		std::string_view s(n);
+
+		for (const char *suf : { "-step", "-usr" }) {
+			size_t l = strlen(suf);
+
+			if (s.size() > l && s.substr(s.size() - l) == suf)
+				return s.substr(0, s.size() - l);
+		}
+		return s;
+	}
+
+	int add_sensor(uint32_t z)
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		uint32_t prov;
+		std::string name;
+
+		if (!t.find_prop(z, "thermal-sensors", &p) || !p.cells())
+			return -1;
+		prov = t.by_phandle(p.u32());
+		name = prov == DT_NONE ? "?" : t.name(prov);
+		if (p.cells() > 1)
+			name += ":" + std::to_string(p.u32(1));
+		for (size_t i = 0; i < sensors_.size(); i++)
+			if (sensors_[i].name == name)
+				return (int)i;
+		sensors_.push_back({ name, false, true, 0, 0, 0, 0, {} });
+		return (int)sensors_.size() - 1;
+	}
+
+	int add_zone(uint32_t z)
+	{
+		const dt::tree &t = *t_;
+		uint32_t trips = t.child(z, "trips", 5), maps = t.child(z, "cooling-maps", 12);
+		dt::property p;
+		zone zn;
+
+		zn.name = t.name(z);
+		zn.node = z;
+		zn.sensor = add_sensor(z);
+		if (zn.sensor < 0)
+			return 0;
+		zn.step_wise = t.find_prop(z, "thermal-governor", &p) &&
+			       !strcmp(p.str(), "step_wise");
+		zn.passive_ms = t.prop_u32(z, "polling-delay-passive", 0);
+		zn.polling_ms = t.prop_u32(z, "polling-delay", 0);
+
+		for (uint32_t c = trips == DT_NONE ? DT_NONE : t.first_child(trips);
+		     c != DT_NONE; c = t.next_sibling(c)) {
+			trip tp;
+			const char *type = "passive";
+
+			if (t.find_prop(c, "type", &p) && p.is_string())
+				type = p.str();
+			tp.name = t.name(c);
+			tp.node = c;
+			tp.temp = (int)t.prop_u32(c, "temperature", 0);
+			tp.hyst = (int)t.prop_u32(c, "hysteresis", 0);
+			tp.type = !strcmp(type, "critical") ? TRIP_CRITICAL :
+				  !strcmp(type, "hot") ? TRIP_HOT :
+				  !strcmp(type, "active") ? TRIP_ACTIVE : TRIP_PASSIVE;
+			zn.trips.push_back(tp);
+			if (tp.temp >= 1000)
+				sensors_[zn.sensor].level = false;
+		}
+
+		for (uint32_t c = maps == DT_NONE ? DT_NONE : t.first_child(maps);
+		     c != DT_NONE; c = t.next_sibling(c)) {
+			uint32_t tn = DT_NONE;
+			int ti = -1;
+
+			if (t.find_prop(c, "trip", &p) && p.len == 4)
+				tn = t.by_phandle(p.u32());
+			for (size_t i = 0; i < zn.trips.size(); i++)
+				if (zn.trips[i].node == tn)
+					ti = (int)i;
+			if (ti < 0 || !t.find_prop(c, "cooling-device", &p))
+				continue;
+			/* Several devices may share one map, three cells each */
+			for (uint32_t i = 0; i + 2 < p.cells(); i += 3) {
+				uint32_t dev = t.by_phandle(p.u32(i));
+				int cd;
+
+				if (dev == DT_NONE)
+					continue;
+				cd = add_cdev(dev);
+				zn.maps.push_back({ ti, cd, p.u32(i + 1), p.u32(i + 2),
+						    THERMAL_NO_TARGET });
+				if (cdevs_[cd].kind == CDEV_QMI || cdevs_[cd].kind == CDEV_OTHER) {
+					uint32_t up = p.u32(i + 2);
+
+					if (up < THERMAL_MAX_LIMIT && up > cdevs_[cd].max_state)
+						cdevs_[cd].max_state = up;
+				}
+			}
+		}
+		zones_.push_back(std::move(zn));
+		return 0;
+	}
+
+	int add_cdev(uint32_t id)
+	{
+		const dt::tree &t = *t_;
+		dt::property p;
+		cdev c;
+		int cpu;
+
+		for (size_t i = 0; i < cdevs_.size(); i++)
+			if (cdevs_[i].node == id)
+				return (int)i;
+
+		c.name = t.name(id);
+		c.node = id;
+		c.cpus = 0;
+		c.state = 0;
+		c.max_state = 1;
+		c.kind = CDEV_OTHER;
+		cpu = cpus_->logical(id);
+
+		if (cpu >= 0) {
+			c.kind = CDEV_CPUFREQ;
+			c.pds.push_back(em_->cpu(cpu).pd);
+			c.cpus = em_->pd(c.pds[0]).cpus;
+		} else if (t.find_prop(id, "qcom,cpu", &p) && p.len == 4) {
+			c.kind = strstr(c.name.c_str(), "hotplug") ? CDEV_CPU_HOTPLUG :
+								    CDEV_CPU_ISOLATE;
+			c.cpus = cpus_->mask(t, p);
+		} else if (t.find_prop(id, "qcom,cluster0", &p)) {
+			c.kind = CDEV_CPU_VOLTAGE;
+			for (int k = 0; k < 8; k++) {
+				char name[16];
+
+				snprintf(name, sizeof(name), "qcom,cluster%d", k);
+				if (!t.find_prop(id, name, &p))
+					break;
+				uint64_t m = cpus_->mask(t, p);
+
+				if (!m)
+					continue;
+				c.cpus |= m;
+				add_unique(&c.pds, em_->cpu(__builtin_ctzll(m)).pd);
+			}
+		} else if (t.is_compatible(id, "qcom,kgsl-3d0")) {
+			c.kind = CDEV_GPU;
+			load_gpu();
+		} else if (t.find_prop(id, "qcom,qmi-dev-name", &p)) {
+			c.kind = CDEV_QMI;
+			c.max_state = opts_.qmi_states;
+		}
+
+		if (c.kind == CDEV_CPUFREQ || c.kind == CDEV_CPU_VOLTAGE) {
+			c.max_state = 0;
+			for (int pd : c.pds)
+				c.max_state = std::max<uint32_t>(c.max_state,
+					(uint32_t)em_->pd(pd).ps.size() - 1);
+		} else if (c.kind == CDEV_GPU) {
+			c.max_state = gpu_khz_.empty() ? 1 : (uint32_t)gpu_khz_.size() - 1;
+		}
+		cdevs_.push_back(std::move(c));
+		return (int)cdevs_.size() - 1;
+	}
+
+	/* GPU power levels of the selected speed bin, fastest first */
+	void load_gpu()
+	{
+		gpu::kgsl_gpu g;
+		gpu::pwr_table tb;
+
+		gpu_khz_.clear();
+		if (g.load(*t_, 0) || g.select((uint32_t)opts_.gpu_bin, true, &tb))
+			return;
+		for (const gpu::pwrlevel &l : tb.levels)
+			gpu_khz_.push_back((uint32_t)(l.hz / 1000));
+	}
+
+	/* Fraction of its power @c sheds at @state */
+	double cut(const cdev &c, uint32_t state) const
+	{
+		double s = 0;
+
+		if (!state)
+			return 0;
+		switch (c.kind) {
+		case CDEV_CPU_ISOLATE:
+		case CDEV_CPU_HOTPLUG:
+			return 1;
+		case CDEV_CPUFREQ:
+		case CDEV_CPU_VOLTAGE:
+			for (int pd : c.pds) {
+				const std::vector<sched::perf_state> &ps = em_->pd(pd).ps;
+				uint32_t i = std::min<uint32_t>(state, (uint32_t)ps.size() - 1);
+
+				s += 1 - ps[ps.size() - 1 - i].power_mw / ps.back().power_mw;
+			}
+			return c.pds.empty() ? 0 : s / c.pds.size();
+		case CDEV_GPU:
+			if (gpu_khz_.size() < 2)
+				return 0;
+			return 1 - gpu_power(gpu_khz_[std::min<size_t>(state, gpu_khz_.size() - 1)]) /
+				   gpu_power(gpu_khz_[0]);
+		default:
+			return (double)state / (c.max_state ? c.max_state : 1);
+		}
+	}
+
+	/* f * V^2 with V linear over the level table, as for the CPUs */
+	double gpu_power(uint32_t khz) const
+	{
+		double lo = gpu_khz_.back(), hi = gpu_khz_.front();
+		double mv = hi == lo ? opts_.vmax_mv :
+			    opts_.vmin_mv + (opts_.vmax_mv - opts_.vmin_mv) * (khz - lo) / (hi - lo);
+
+		return khz * mv * mv;
+	}
+
+	void step(double dt_ms)
+	{
+		double a = 1 - exp(-dt_ms / opts_.tau_ms);
+
+		for (sensor &s : sensors_) {
+			double c = 0, target;
+
+			for (int cd : s.cdevs)
+				c = std::max(c, cut(cdevs_[cd], cdevs_[cd].state));
+			target = std::max(0.0, s.t_rec - opts_.ambient) * opts_.coupling * c;
+			s.drop += (target - s.drop) * a;
+		}
+	}
+
+	void account(uint64_t dt)
+	{
+		uint32_t lost = 0;
+
+		span_ms_ += dt;
+		for (zone &z : zones_)
+			for (trip &tp : z.trips)
+				if (tp.active)
+					tp.active_ms += dt;
+		for (cdev &c : cdevs_)
+			c.res_ms[c.state] += dt;
+		for (int pd = 0; pd < em_->nr_pds(); pd++) {
+			uint32_t st = 0, cap;
+
+			for (const cdev &c : cdevs_)
+				if ((c.kind == CDEV_CPUFREQ || c.kind == CDEV_CPU_VOLTAGE) &&
+				    std::find(c.pds.begin(), c.pds.end(), pd) != c.pds.end())
+					st = std::max(st, c.state);
+			cap = cpu_cap_khz(pd, st);
+			cap_ms_[pd] += (uint64_t)cap * dt;
+			for (uint64_t m = em_->pd(pd).cpus; m; m &= m - 1) {
+				int cpu = __builtin_ctzll(m);
+				uint32_t orig = em_->cpu(cpu).cap_orig;
+
+				if (offline(cpu))
+					lost += orig;
+				else
+					lost += orig - (uint32_t)((uint64_t)orig * cap / em_->fmax(pd));
+			}
+		}
+		cap_lost_ms_ += (uint64_t)lost * dt;
+		for (const cdev &c : cdevs_)
+			if (c.kind == CDEV_GPU && !gpu_khz_.empty())
+				gpu_ms_ += (uint64_t)gpu_khz_[std::min<size_t>(c.state,
+						gpu_khz_.size() - 1)] * dt;
+	}
+
+	bool offline(int cpu) const
+	{
+		for (const cdev &c : cdevs_)
+			if ((c.kind == CDEV_CPU_ISOLATE || c.kind == CDEV_CPU_HOTPLUG) &&
+			    c.state && (c.cpus >> cpu & 1))
+				return true;
+		return false;
+	}
+
+	uint32_t limit(const cdev &c, uint32_t v) const
+	{
+		return v >= THERMAL_MAX_LIMIT ? (v == THERMAL_NO_LIMIT ? ~0u : c.max_state) : v;
+	}
+
+	/* step_wise get_target_state() with the qcom hysteresis release */
+	template <typename F>
+	void govern(int zi, F fired)
+	{
+		zone &z = zones_[zi];
+		const sensor &s = sensors_[z.sensor];
+		double temp = s.t_rec - s.drop;
+		int trend = temp > z.last ? 1 : temp < z.last ? -1 : 0;
+		uint32_t period;
+
+		if (!s.bound)
+			return;
+		/* The passive delay while any trip is throttling, as the core does */
+		period = z.polling_ms;
+		for (const trip &tp : z.trips)
+			if (tp.active)
+				period = z.passive_ms;
+		if (now_ < z.next_eval)
+			return;
+		z.next_eval = now_ + period;
+
+		for (size_t ti = 0; ti < z.trips.size(); ti++) {
+			trip &tp = z.trips[ti];
+			bool throttle = temp >= tp.temp ||
+					(tp.active && temp > tp.temp - tp.hyst);
+
+			if (throttle != tp.active) {
+				tp.active = throttle;
+				if (throttle) {
+					tp.fires++;
+					if (tp.first_ms == UINT64_MAX)
+						tp.first_ms = now_;
+				}
+				fired(now_, zi, (int)ti, throttle);
+			}
+			if (!z.step_wise)
+				continue;
+
+			for (binding &b : z.maps) {
+				const cdev &c = cdevs_[b.cdev];
+				uint32_t lo, up, cur = c.state;
+
+				if (b.trip != (int)ti)
+					continue;
+				lo = limit(c, b.lower);
+				up = limit(c, b.upper);
+				if (lo == ~0u)
+					lo = 0;
+				if (up == ~0u)
+					up = c.max_state;
+				if (throttle && (trend > 0 || b.target == THERMAL_NO_TARGET)) {
+					b.target = (int)std::max(lo, std::min(cur + 1, up));
+				} else if (!throttle && trend < 0) {
+					/* As step_wise: a stable reading holds the state */
+					if (cur <= lo || b.target == THERMAL_NO_TARGET)
+						b.target = THERMAL_NO_TARGET;
+					else
+						b.target = (int)std::min(cur - 1, up);
+				}
+			}
+		}
+		z.last = temp;
+	}
+
+	/* thermal_cdev_update(): the deepest state any instance asks for */
+	void update_cdevs()
+	{
+		for (cdev &c : cdevs_)
+			c.state = 0;
+		for (const zone &z : zones_)
+			for (const binding &b : z.maps)
+				if (b.target > 0 && (uint32_t)b.target > cdevs_[b.cdev].state)
+					cdevs_[b.cdev].state = std::min<uint32_t>(b.target,
+						cdevs_[b.cdev].max_state);
+	}
+
+	const dt::tree *t_ = nullptr;
+	const dt::cpu_topology *cpus_ = nullptr;
+	const sched::energy_model *em_ = nullptr;
+	thermal_opts opts_;
+	std::vector<zone> zones_;
+	std::vector<cdev> cdevs_;
+	std::vector<sensor> sensors_;
+	std::vector<uint32_t> gpu_khz_;
+	std::vector<col> cols_;
+	std::vector<uint64_t> cap_ms_;
+	uint64_t cap_lost_ms_ = 0, gpu_ms_ = 0, span_ms_ = 0, now_ = 0;
+	int c_ms_ = -1, c_us_ = -1;
+	bool started_ = false;
+};
+
+} /* namespace thermal */
+
+#endif /* __TOOLS_THERMAL_THERMAL_H__ */
@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Evaluate a DTB's thermal zones and cooling maps against tsens traces.
+ *
+ * Build: g++ -std=c++17 -O2 -o thermal_sim thermal_sim.cpp
+ * Usage: thermal_sim [-a ambient_mC] [-t tau_ms] [-c coupling] [-b gpu_bin]
+ *                    [-q qmi_states] [-v] <blob.dtb> <trace.csv>
+ *        thermal_sim [options] -g seconds <blob.dtb>
+ *
+ * The trace is CSV with a header row:
+ *
+ *   time_ms,cpu-0-0,cpu-1-0,gpuss-0,...
+ *
+ * time_us may replace time_ms, and each further column names a thermal
+ * zone with or without its -step/-usr suffix.  Readings are taken as the
+ * unmitigated temperature; step_wise runs on the simulated temperature
+ * after throttling (see thermal.h).  The report gives recorded and
+ * simulated peaks per sensor, when each trip first fired and for how
+ * long, cooling-device state residency and the CPU and GPU frequency
+ * lost to mitigation.  -b picks the GPU speed bin, -g generates a
+ * synthetic sustained-load trace and -v logs every trip crossing.
+ *
+ * Example:
+ *   thermal_sim -a 30000 yupik.dtb antutu-tsens.csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "thermal.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static const char *kind_name(thermal::cdev_kind k)
+{
+	switch (k) {
+	case thermal::CDEV_CPUFREQ:
+		return "cpufreq";
+	case thermal::CDEV_CPU_VOLTAGE:
+		return "cpu-voltage";
+	case thermal::CDEV_CPU_ISOLATE:
+		return "isolate";
+	case thermal::CDEV_CPU_HOTPLUG:
+		return "hotplug";
+	case thermal::CDEV_GPU:
+		return "gpu";
+	case thermal::CDEV_QMI:
+		return "qmi";
+	default:
+		return "other";
+	}
+}
+
+static void report(const thermal::thermal_model &m, const sched::energy_model &em)
+{
+	uint64_t span = m.span_ms(), cap = 0;
+
+	if (!span)
+		return;
+	printf("%lu ms simulated\n", (unsigned long)span);
+
+	for (const thermal::zone &z : m.zones()) {
+		const thermal::sensor &s = m.sensors()[z.sensor];
+		bool any = false;
+
+		if (!s.bound)
+			continue;
+		for (const thermal::trip &tp : z.trips)
+			any |= tp.fires != 0;
+		printf("zone %s (%s, %s): max %.1f%s recorded, %.1f%s simulated\n",
+		       z.name.c_str(), s.name.c_str(), z.step_wise ? "step_wise" : "user_space",
+		       s.level ? s.max_rec : s.max_rec / 1000, s.level ? "" : " C",
+		       s.level ? s.max_sim : s.max_sim / 1000, s.level ? "" : " C");
+		if (!any)
+			continue;
+		for (const thermal::trip &tp : z.trips) {
+			if (!tp.fires)
+				continue;
+			printf("  trip %s %d/%d: first %.3f s, %lu fires, active %.2f%%\n",
+			       tp.name.c_str(), s.level ? tp.temp : tp.temp / 1000,
+			       s.level ? tp.hyst : tp.hyst / 1000,
+			       tp.first_ms / 1e3, (unsigned long)tp.fires,
+			       100.0 * tp.active_ms / span);
+		}
+	}
+
+	for (const thermal::cdev &c : m.cdevs()) {
+		if (c.res_ms[0] == span)
+			continue;
+		printf("cdev %s (%s, max %u):", c.name.c_str(), kind_name(c.kind), c.max_state);
+		for (size_t i = 0; i < c.res_ms.size(); i++)
+			if (c.res_ms[i])
+				printf(" %zu:%.1f%%", i, 100.0 * c.res_ms[i] / span);
+		printf("\n");
+	}
+
+	for (int pd = 0; pd < em.nr_pds(); pd++) {
+		double mean = (double)m.cap_khz_ms(pd) / span;
+
+		printf("cpu pd%d (0x%lx): fmax %u kHz, mean cap %.0f kHz (%.1f%% lost)\n",
+		       pd, (unsigned long)em.pd(pd).cpus, em.fmax(pd), mean,
+		       100.0 * (1 - mean / em.fmax(pd)));
+	}
+	for (int c = 0; c < em.nr_cpus(); c++)
+		cap += em.cpu(c).cap_orig;
+	printf("cpu capacity: %.1f%% lost on average\n",
+	       100.0 * m.cap_lost_ms() / span / cap);
+	if (!m.gpu_khz().empty()) {
+		double mean = (double)m.gpu_khz_ms() / span;
+
+		printf("gpu: fmax %u kHz, mean cap %.0f kHz (%.1f%% lost)\n",
+		       m.gpu_khz()[0], mean, 100.0 * (1 - mean / m.gpu_khz()[0]));
+	}
+}
+
+/*
+ * Synthetic trace: every sensor heats towards a load-dependent plateau
+ * with its own time constant, the load stepping between a heavy and an
+ * idle phase every minute, sampled every 100 ms.
+ */
+static std::string synth(double seconds, const thermal::thermal_model &m)
+{
+	std::vector<const thermal::zone *> cols;
+	std::vector<double> temp;
+	std::string s = "time_ms";
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	char buf[32];
+
+	for (const thermal::zone &z : m.zones()) {
+		bool dup = false;
+
+		for (const thermal::zone *c : cols)
+			dup |= c->sensor == z.sensor;
+		if (dup || m.sensors()[z.sensor].level)
+			continue;
+		cols.push_back(&z);
+		s += "," + z.name;
+	}
+	s += '\n';
+	temp.assign(cols.size(), 35000);
+	for (uint64_t t = 0; t < (uint64_t)(seconds * 1000); t += 100) {
+		bool heavy = (t / 60000) % 2 == 0;
+
+		snprintf(buf, sizeof(buf), "%lu", (unsigned long)t);
+		s += buf;
+		for (size_t i = 0; i < cols.size(); i++) {
+			double plateau = heavy ? 95000 + 3000.0 * (i % 9) : 45000;
+			double tau = 8000 + 1500.0 * (i % 5);
+
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			temp[i] += (plateau - temp[i]) * 100 / tau;
+			snprintf(buf, sizeof(buf), ",%.0f", temp[i] + (double)(x % 800) - 400);
+			s += buf;
+		}
+		s += '\n';
+	}
+	return s;
+}
+
+int main(int argc, char **argv)
+{
+	thermal::thermal_opts o;
+	thermal::thermal_model m;
+	sched::energy_model em;
+	dt::cpu_topology cpus;
+	sched::em_opts eo;
+	csv::reader rd;
+	csv::row r;
+	std::string trace;
+	uint64_t rows = 0;
+	double gen = 0, t0, t1;
+	bool verbose = false;
+	dt::file f;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "a:t:c:b:q:g:v")) != -1) {
+		switch (opt) {
+		case 'a':
+			o.ambient = atof(optarg);
+			break;
+		case 't':
+			o.tau_ms = atof(optarg);
+			break;
+		case 'c':
+			o.coupling = atof(optarg);
+			break;
+		case 'b':
+			o.gpu_bin = atoi(optarg);
+			break;
+		case 'q':
+			o.qmi_states = (uint32_t)atoi(optarg);
+			break;
+		case 'g':
+			gen = atof(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != (gen > 0 ? 1 : 2) || o.tau_ms <= 0) {
+		fprintf(stderr,
+			"usage: %s [-a ambient_mC] [-t tau_ms] [-c coupling] [-b gpu_bin] "
+			"[-q qmi_states] [-v] <blob.dtb> <trace.csv>\n"
+			"       %s [options] -g seconds <blob.dtb>\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	ret = f.open(argv[optind]);
+	if (!ret)
+		ret = cpus.build(f.index());
+	if (!ret)
+		ret = em.build(f.index(), cpus);
+	if (!ret)
+		ret = em.finalize(eo);
+	if (!ret)
+		ret = m.load(f.index(), cpus, em, o);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	if (gen > 0) {
+		trace = synth(gen, m);
+		rd.attach(trace.data(), trace.size());
+	} else if ((ret = rd.open(argv[optind + 1]))) {
+		fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(-ret));
+		return 1;
+	}
+
+	if (!rd.next(&r) || m.bind(r)) {
+		fprintf(stderr, "%s: trace header needs time_ms and a zone column\n",
+			gen > 0 ? "synthetic" : argv[optind + 1]);
+		return 1;
+	}
+
+	auto fired = [&](uint64_t t, int zi, int ti, bool on) {
+		const thermal::zone &z = m.zones()[zi];
+
+		if (verbose)
+			printf("%lu %s %s %s\n", (unsigned long)t, z.name.c_str(),
+			       z.trips[ti].name.c_str(), on ? "on" : "off");
+	};
+
+	t0 = now_us();
+	while (rd.next(&r)) {
+		m.sample(r, fired);
+		rows++;
+	}
+	t1 = now_us();
+
+	report(m, em);
+	fprintf(stderr, "%lu rows, %zu zones, %zu cooling devices in %.1f ms\n",
+		(unsigned long)rows, m.zones().size(), m.cdevs().size(), (t1 - t0) / 1e3);
+	return 0;
+}